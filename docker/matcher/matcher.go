@@ -46,6 +46,7 @@ func MatchHandler( w http.ResponseWriter, r * http.Request ) {
     connectTokenString := base64.StdEncoding.EncodeToString( connectTokenData )
     fmt.Printf( "matched client %.16x to %s:%d [%.16x]\n", clientId, ServerAddress, ServerPort, protocolId )
     w.Header().Set( "Content-Type", "application/text" )
+    w.Header().Set( "Content-Length", strconv.Itoa( len( connectTokenString ) ) )
     if _, err := io.WriteString( w, connectTokenString ); err != nil {
         panic( err )
     }
@@ -5,7 +5,7 @@ if os.is "windows" then
     debug_libs = { "sodium-debug", "mbedtls-debug", "mbedx509-debug", "mbedcrypto-debug" }
     release_libs = { "sodium-release", "mbedtls-release", "mbedx509-release", "mbedcrypto-release" }
 else
-    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto" }
+    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto", "pthread" }
     release_libs = debug_libs
 end
 
@@ -63,6 +63,22 @@ project "soak"
     files { "tests/soak.cpp", "tests/shared.h" }
     links { "yojimbo" }
 
+project "load"
+    files { "tests/load.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
+project "bench"
+    files { "tests/bench.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
+project "goodput"
+    files { "tests/goodput.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
+project "replay"
+    files { "tests/replay.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
 if not os.is "windows" then
 
     -- MacOSX and Linux.
@@ -209,6 +225,42 @@ if not os.is "windows" then
         end
     }
 
+    newaction
+    {
+        trigger     = "load",
+        description = "Build and run load test with 64 clients",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 load config=release_x64" == 0 then
+                os.execute "./bin/load"
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "bench",
+        description = "Build and run benchmarks in release, writing results to bench.csv",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 bench config=release_x64" == 0 then
+                os.execute "./bin/bench | tee bench.csv"
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "goodput",
+        description = "Build and run reliable channel goodput benchmark in release, writing results to goodput.csv",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 goodput config=release_x64" == 0 then
+                os.execute "./bin/goodput | tee goodput.csv"
+            end
+        end
+    }
+
     newaction
     {
         trigger     = "cppcheck",
@@ -0,0 +1,545 @@
+/*
+    Benchmarks
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared.h"
+#include <string.h>
+
+// Every benchmark runs a fixed number of iterations with fixed seeds, so the same build on the same machine does the same work each run.
+// Results go to stdout as CSV, one line per benchmark, so they can be collected and compared across releases. Progress goes to stderr.
+
+const uint64_t BenchSeed = 0x9E3779B97F4A7C15ULL;
+
+static const char * benchFilter = NULL;
+
+static bool BenchEnabled( const char * name )
+{
+    return benchFilter == NULL || strstr( name, benchFilter ) != NULL;
+}
+
+static void BenchResult( const char * name, int param, uint64_t iterations, double seconds, uint64_t bytes )
+{
+    const double nanosecondsPerOp = iterations ? ( seconds * 1000000000.0 ) / double( iterations ) : 0.0;
+    const double megabytesPerSecond = ( seconds > 0.0 ) ? ( double( bytes ) / ( 1024.0 * 1024.0 ) ) / seconds : 0.0;
+    printf( "%s,%d,%" PRIu64 ",%.6f,%.2f,%.2f\n", name, param, iterations, seconds, nanosecondsPerOp, megabytesPerSecond );
+    fflush( stdout );
+}
+
+// -------------------------------------------------------------------------------------------
+
+const int BitpackerBufferBytes = 64 * 1024;
+const int BitpackerPasses = 1000;
+
+static volatile uint32_t benchSink;
+
+static void BenchBitpacker()
+{
+    if ( !BenchEnabled( "bitpacker" ) )
+        return;
+
+    static const int bitWidths[] = { 1, 4, 8, 13, 16, 24, 32 };
+
+    uint32_t * buffer = (uint32_t*) malloc( BitpackerBufferBytes );
+
+    for ( int i = 0; i < int( sizeof( bitWidths ) / sizeof( int ) ); ++i )
+    {
+        const int bits = bitWidths[i];
+        const int numValues = ( BitpackerBufferBytes * 8 ) / bits - 32;
+        const uint32_t mask = ( bits == 32 ) ? 0xFFFFFFFF : ( ( 1U << bits ) - 1 );
+
+        uint32_t * values = (uint32_t*) malloc( numValues * sizeof( uint32_t ) );
+        Random random( BenchSeed, bits );
+        for ( int j = 0; j < numValues; ++j )
+            values[j] = random.GetUint32() & mask;
+
+        double start = yojimbo_time();
+        for ( int pass = 0; pass < BitpackerPasses; ++pass )
+        {
+            BitWriter writer( buffer, BitpackerBufferBytes );
+            for ( int j = 0; j < numValues; ++j )
+                writer.WriteBits( values[j], bits );
+            writer.FlushBits();
+        }
+        double finish = yojimbo_time();
+
+        BenchResult( "bitpacker_write", bits, uint64_t( BitpackerPasses ) * numValues, finish - start, uint64_t( BitpackerPasses ) * numValues * bits / 8 );
+
+        start = yojimbo_time();
+        uint32_t sum = 0;
+        for ( int pass = 0; pass < BitpackerPasses; ++pass )
+        {
+            BitReader reader( buffer, BitpackerBufferBytes );
+            for ( int j = 0; j < numValues; ++j )
+                sum += reader.ReadBits( bits );
+        }
+        finish = yojimbo_time();
+        benchSink = sum;
+
+        BenchResult( "bitpacker_read", bits, uint64_t( BitpackerPasses ) * numValues, finish - start, uint64_t( BitpackerPasses ) * numValues * bits / 8 );
+
+        free( values );
+    }
+
+    free( buffer );
+}
+
+// -------------------------------------------------------------------------------------------
+
+const int BenchMaxItems = 32;
+const int SerializeIterations = 200000;
+
+struct BenchObject : public Serializable
+{
+    int a, b, c;
+    uint32_t d;
+    bool e;
+    float f;
+    double g;
+    uint64_t h;
+    int numItems;
+    int items[BenchMaxItems];
+    uint8_t bytes[17];
+    char string[32];
+
+    void Init( Random & random )
+    {
+        a = random.GetInt( -10, 10 );
+        b = random.GetInt( 0, 1000000 );
+        c = random.GetInt( -100, 10000 );
+        d = random.GetUint32() & 0xFFFF;
+        e = ( random.GetUint32() & 1 ) != 0;
+        f = random.GetFloat( -1000.0f, 1000.0f );
+        g = random.GetFloat( 0.0f, 1.0f );
+        h = ( uint64_t( random.GetUint32() ) << 32 ) | random.GetUint32();
+        numItems = BenchMaxItems / 2;
+        for ( int i = 0; i < numItems; ++i )
+            items[i] = random.GetInt( 0, 255 );
+        for ( int i = 0; i < int( sizeof( bytes ) ); ++i )
+            bytes[i] = uint8_t( random.GetUint32() );
+        strcpy( string, "hello world!" );
+    }
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_int( stream, a, -10, 10 );
+        serialize_int( stream, b, 0, 1000000 );
+        serialize_int( stream, c, -100, 10000 );
+        serialize_bits( stream, d, 16 );
+        serialize_bool( stream, e );
+        serialize_float( stream, f );
+        serialize_double( stream, g );
+        serialize_uint64( stream, h );
+        serialize_int( stream, numItems, 0, BenchMaxItems );
+        for ( int i = 0; i < numItems; ++i )
+            serialize_bits( stream, items[i], 8 );
+        serialize_bytes( stream, bytes, sizeof( bytes ) );
+        serialize_string( stream, string, sizeof( string ) );
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+};
+
+static void BenchSerialize()
+{
+    if ( !BenchEnabled( "serialize" ) )
+        return;
+
+    const int BufferBytes = 1024;
+    uint8_t buffer[BufferBytes];
+
+    Random random( BenchSeed );
+    BenchObject object;
+    object.Init( random );
+
+    int bytesWritten = 0;
+
+    double start = yojimbo_time();
+    for ( int i = 0; i < SerializeIterations; ++i )
+    {
+        WriteStream stream( GetDefaultAllocator(), buffer, BufferBytes );
+        object.Serialize( stream );
+        stream.Flush();
+        bytesWritten = stream.GetBytesProcessed();
+    }
+    double finish = yojimbo_time();
+
+    BenchResult( "serialize_write", bytesWritten, SerializeIterations, finish - start, uint64_t( SerializeIterations ) * bytesWritten );
+
+    BenchObject readObject;
+    bool result = true;
+
+    start = yojimbo_time();
+    for ( int i = 0; i < SerializeIterations; ++i )
+    {
+        ReadStream stream( GetDefaultAllocator(), buffer, bytesWritten );
+        result &= readObject.Serialize( stream );
+    }
+    finish = yojimbo_time();
+
+    if ( !result || readObject.h != object.h )
+        fprintf( stderr, "error: serialize_read failed\n" );
+
+    BenchResult( "serialize_read", bytesWritten, SerializeIterations, finish - start, uint64_t( SerializeIterations ) * bytesWritten );
+
+    int bitsMeasured = 0;
+
+    start = yojimbo_time();
+    for ( int i = 0; i < SerializeIterations; ++i )
+    {
+        MeasureStream stream( GetDefaultAllocator() );
+        object.Serialize( stream );
+        bitsMeasured += stream.GetBitsProcessed();
+    }
+    finish = yojimbo_time();
+    benchSink = uint32_t( bitsMeasured );
+
+    BenchResult( "serialize_measure", bytesWritten, SerializeIterations, finish - start, uint64_t( SerializeIterations ) * bytesWritten );
+}
+
+// -------------------------------------------------------------------------------------------
+
+const int ChannelIterations = 20000;
+
+static void BenchChannel()
+{
+    if ( !BenchEnabled( "channel" ) )
+        return;
+
+    static const int queueDepths[] = { 1, 16, 64, 256, 512 };
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+
+    uint8_t * packetData = (uint8_t*) malloc( connectionConfig.maxPacketSize );
+
+    for ( int i = 0; i < int( sizeof( queueDepths ) / sizeof( int ) ); ++i )
+    {
+        const int queueDepth = queueDepths[i];
+
+        double time = 100.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        uint16_t messageSequence = 0;
+        uint16_t packetSequence = 0;
+        uint64_t numMessagesReceived = 0;
+        uint64_t packetBytesTotal = 0;
+        double packTime = 0.0;
+        double unpackTime = 0.0;
+
+        for ( int j = 0; j < ChannelIterations; ++j )
+        {
+            // top up the send queue, so every packet is generated with the same number of messages waiting
+
+            ConnectionStats stats;
+            sender.GetStats( stats );
+            for ( int k = stats.channel[0].sendQueueDepth; k < queueDepth; ++k )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                yojimbo_assert( message );
+                message->sequence = messageSequence++;
+                sender.SendMessage( 0, message );
+            }
+
+            int packetBytes = 0;
+
+            double start = yojimbo_time();
+            const bool generated = sender.GeneratePacket( NULL, packetSequence, packetData, connectionConfig.maxPacketSize, packetBytes );
+            double finish = yojimbo_time();
+            packTime += finish - start;
+
+            if ( generated )
+            {
+                start = yojimbo_time();
+                receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes );
+                finish = yojimbo_time();
+                unpackTime += finish - start;
+                sender.ProcessAcks( &packetSequence, 1 );
+                packetBytesTotal += packetBytes;
+            }
+
+            while ( Message * message = receiver.ReceiveMessage( 0 ) )
+            {
+                messageFactory.ReleaseMessage( message );
+                numMessagesReceived++;
+            }
+
+            packetSequence++;
+            time += 0.01;
+            sender.AdvanceTime( time );
+            receiver.AdvanceTime( time );
+        }
+
+        BenchResult( "channel_pack", queueDepth, ChannelIterations, packTime, packetBytesTotal );
+        BenchResult( "channel_unpack", queueDepth, ChannelIterations, unpackTime, packetBytesTotal );
+
+        fprintf( stderr, "channel queue depth %d: %" PRIu64 " messages received\n", queueDepth, numMessagesReceived );
+
+        sender.Reset();
+        receiver.Reset();
+    }
+
+    free( packetData );
+}
+
+// -------------------------------------------------------------------------------------------
+
+const int BlockBytesPerSize = 16 * 1024 * 1024;
+
+static void BenchBlocks()
+{
+    if ( !BenchEnabled( "block" ) )
+        return;
+
+    static const int blockSizes[] = { 1024, 16 * 1024, 256 * 1024 };
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxBlockSize = 256 * 1024;
+    connectionConfig.channel[0].fragmentSize = 1024;
+
+    uint8_t * packetData = (uint8_t*) malloc( connectionConfig.maxPacketSize );
+
+    for ( int i = 0; i < int( sizeof( blockSizes ) / sizeof( int ) ); ++i )
+    {
+        const int blockSize = blockSizes[i];
+        const int numBlocks = BlockBytesPerSize / blockSize;
+
+        double time = 100.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        uint16_t packetSequence = 0;
+        int numBlocksReceived = 0;
+        uint64_t numPackets = 0;
+
+        double start = yojimbo_time();
+
+        for ( int j = 0; j < numBlocks; ++j )
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            yojimbo_assert( message );
+            message->sequence = uint16_t( j );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            yojimbo_assert( blockData );
+            memset( blockData, j, blockSize );
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 0, message );
+
+            // one block in flight at a time, so this measures fragmenting and reassembling a block, not queueing
+
+            while ( numBlocksReceived <= j )
+            {
+                int packetBytes = 0;
+                if ( sender.GeneratePacket( NULL, packetSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+                {
+                    receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes );
+                    sender.ProcessAcks( &packetSequence, 1 );
+                }
+
+                while ( Message * receivedMessage = receiver.ReceiveMessage( 0 ) )
+                {
+                    messageFactory.ReleaseMessage( receivedMessage );
+                    numBlocksReceived++;
+                }
+
+                packetSequence++;
+                numPackets++;
+                time += 0.01;
+                sender.AdvanceTime( time );
+                receiver.AdvanceTime( time );
+            }
+        }
+
+        double finish = yojimbo_time();
+
+        BenchResult( "block_fragment", blockSize, numBlocks, finish - start, uint64_t( numBlocks ) * blockSize );
+
+        fprintf( stderr, "block size %d: %" PRIu64 " packets\n", blockSize, numPackets );
+    }
+
+    free( packetData );
+}
+
+// -------------------------------------------------------------------------------------------
+
+const int ServerTickClients = 64;
+const int ServerTickWarmup = 100;
+const int ServerTickIterations = 2000;
+const int ServerTickMessagesPerClient = 4;
+
+static void BenchServerTick()
+{
+    if ( !BenchEnabled( "server" ) )
+        return;
+
+    ClientServerConfig config;
+    config.clientMemory = 2 * 1024 * 1024;
+    config.serverPerClientMemory = 2 * 1024 * 1024;
+    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    double time = 100.0;
+
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( ServerTickClients );
+
+    if ( !server.IsRunning() )
+    {
+        fprintf( stderr, "error: server failed to start\n" );
+        return;
+    }
+
+    Client * clients[ServerTickClients];
+
+    for ( int i = 0; i < ServerTickClients; ++i )
+    {
+        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), Address( "0.0.0.0", 0 ), config, adapter, time );
+        if ( !clients[i]->ConnectLoopback( server ) )
+            fprintf( stderr, "error: loopback client %d failed to connect\n", i );
+    }
+
+    uint16_t sequence = 0;
+    double tickTime = 0.0;
+
+    for ( int i = 0; i < ServerTickWarmup + ServerTickIterations; ++i )
+    {
+        for ( int j = 0; j < ServerTickClients; ++j )
+        {
+            for ( int k = 0; k < ServerTickMessagesPerClient; ++k )
+            {
+                if ( clients[j]->CanSendMessage( 0 ) )
+                {
+                    TestMessage * message = (TestMessage*) clients[j]->CreateMessage( TEST_MESSAGE );
+                    if ( message )
+                    {
+                        message->sequence = sequence;
+                        clients[j]->SendMessage( 0, message );
+                    }
+                }
+                if ( server.CanSendMessage( j, 0 ) )
+                {
+                    TestMessage * message = (TestMessage*) server.CreateMessage( j, TEST_MESSAGE );
+                    if ( message )
+                    {
+                        message->sequence = sequence;
+                        server.SendMessage( j, 0, message );
+                    }
+                }
+            }
+        }
+
+        sequence++;
+
+        // only the server side of the tick is timed. the loopback clients stand in for remote machines
+
+        for ( int j = 0; j < ServerTickClients; ++j )
+            clients[j]->SendPackets();
+
+        double start = yojimbo_time();
+
+        server.ReceivePackets();
+
+        for ( int j = 0; j < ServerTickClients; ++j )
+        {
+            while ( Message * message = server.ReceiveMessage( j, 0 ) )
+                server.ReleaseMessage( j, message );
+        }
+
+        server.SendPackets();
+
+        time += 1.0 / 60.0;
+
+        server.AdvanceTime( time );
+
+        double finish = yojimbo_time();
+
+        if ( i >= ServerTickWarmup )
+            tickTime += finish - start;
+
+        for ( int j = 0; j < ServerTickClients; ++j )
+        {
+            clients[j]->ReceivePackets();
+            while ( Message * message = clients[j]->ReceiveMessage( 0 ) )
+                clients[j]->ReleaseMessage( message );
+            clients[j]->AdvanceTime( time );
+        }
+    }
+
+    BenchResult( "server_tick", ServerTickClients, ServerTickIterations, tickTime, 0 );
+
+    fprintf( stderr, "server tick: %d clients connected\n", server.GetNumConnectedClients() );
+
+    for ( int i = 0; i < ServerTickClients; ++i )
+    {
+        clients[i]->Disconnect();
+        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+    }
+
+    server.Stop();
+}
+
+// -------------------------------------------------------------------------------------------
+
+int main( int argc, char ** argv )
+{
+    if ( !InitializeYojimbo() )
+    {
+        fprintf( stderr, "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_NONE );
+
+    if ( argc > 1 )
+        benchFilter = argv[1];
+
+    printf( "# yojimbo %d.%d.%d\n", YOJIMBO_MAJOR_VERSION, YOJIMBO_MINOR_VERSION, YOJIMBO_PATCH_VERSION );
+    printf( "benchmark,param,iterations,seconds,ns_per_op,mb_per_sec\n" );
+
+    BenchBitpacker();
+
+    BenchSerialize();
+
+    BenchChannel();
+
+    BenchBlocks();
+
+    BenchServerTick();
+
+    ShutdownYojimbo();
+
+    return 0;
+}
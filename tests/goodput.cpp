@@ -0,0 +1,369 @@
+/*
+    Goodput Benchmark
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared.h"
+#include <string.h>
+
+// Measures reliable-ordered message and block goodput, and delivery latency percentiles, for a set of channel
+// configurations across a matrix of simulated latency, jitter and packet loss. Two connections exchange packets
+// through a NetworkSimulator in simulated time, so every run is deterministic and much faster than real time.
+// Results go to stdout as CSV, one line per cell of the matrix, so channel tuning can be driven by data.
+
+const uint64_t GoodputSeed = 0x2545F4914F6CDD1DULL;
+const double TickRate = 60.0;
+const double RunTime = 30.0;
+const int MaxAcksPerPacket = 32;
+const int PacketHeaderBytes = 4 + MaxAcksPerPacket * 2;                // keeps the connection packet data 4 byte aligned, as BitWriter requires
+const int MessageQueueDepth = 256;
+const int BlockSize = 16 * 1024;
+const int MaxLatencySamples = 256 * 1024;
+
+struct GoodputConfig
+{
+    const char * name;
+    ChannelConfig channel;
+};
+
+static void InitGoodputConfigs( GoodputConfig * configs, int & numConfigs )
+{
+    numConfigs = 0;
+
+    GoodputConfig & defaults = configs[numConfigs++];
+    defaults.name = "default";
+
+    GoodputConfig & fastResend = configs[numConfigs++];
+    fastResend.name = "fast_resend";
+    fastResend.channel.messageResendTime = 0.05f;
+    fastResend.channel.fragmentResendTime = 0.1f;
+
+    GoodputConfig & largeFragments = configs[numConfigs++];
+    largeFragments.name = "large_fragments";
+    largeFragments.channel.fragmentSize = 4096;
+    largeFragments.channel.packetBudget = -1;
+
+    GoodputConfig & wideWindow = configs[numConfigs++];
+    wideWindow.name = "wide_window";
+    wideWindow.channel.maxBlocksInFlight = 4;
+    wideWindow.channel.maxFragmentsPerPacket = 4;
+    wideWindow.channel.packetBudget = -1;
+    wideWindow.channel.sentPacketBufferSize = 4096;
+}
+
+// One end of the simulated link. Packets carry a small header with the packet sequence and the most recent
+// received sequences, standing in for the acks reliable.io would provide to the connection.
+
+struct GoodputEndpoint
+{
+    Connection * connection;
+    uint16_t sequence;
+    uint16_t receivedSequences[MaxAcksPerPacket];
+    int numReceivedSequences;
+    bool ackPending[65536];
+};
+
+static void InitEndpoint( GoodputEndpoint & endpoint, Connection & connection )
+{
+    endpoint.connection = &connection;
+    endpoint.sequence = 0;
+    endpoint.numReceivedSequences = 0;
+    memset( endpoint.receivedSequences, 0, sizeof( endpoint.receivedSequences ) );
+    memset( endpoint.ackPending, 0, sizeof( endpoint.ackPending ) );
+}
+
+static void ReceiveEndpointPacket( GoodputEndpoint & endpoint, const uint8_t * packetData, int packetBytes )
+{
+    uint16_t sequence;
+    memcpy( &sequence, packetData, 2 );
+
+    const int numAcks = packetData[2];
+    for ( int i = 0; i < numAcks; ++i )
+    {
+        uint16_t ack;
+        memcpy( &ack, packetData + 4 + i * 2, 2 );
+        if ( endpoint.ackPending[ack] )
+        {
+            endpoint.ackPending[ack] = false;
+            endpoint.connection->ProcessAcks( &ack, 1 );
+        }
+    }
+
+    if ( endpoint.connection->ProcessPacket( NULL, sequence, packetData + PacketHeaderBytes, packetBytes - PacketHeaderBytes ) )
+    {
+        endpoint.receivedSequences[endpoint.numReceivedSequences % MaxAcksPerPacket] = sequence;
+        endpoint.numReceivedSequences++;
+    }
+}
+
+static void SendEndpointPacket( GoodputEndpoint & endpoint, GoodputEndpoint & receiver, NetworkSimulator & simulator, int to, uint8_t * packetData, int maxPacketBytes )
+{
+    int packetBytes = 0;
+    if ( !endpoint.connection->GeneratePacket( NULL, endpoint.sequence, packetData + PacketHeaderBytes, maxPacketBytes - PacketHeaderBytes, packetBytes ) )
+        return;
+
+    const int numAcks = yojimbo_min( endpoint.numReceivedSequences, MaxAcksPerPacket );
+    memcpy( packetData, &endpoint.sequence, 2 );
+    packetData[2] = uint8_t( numAcks );
+    packetData[3] = 0;
+    memcpy( packetData + 4, endpoint.receivedSequences, numAcks * 2 );
+
+    endpoint.ackPending[endpoint.sequence] = true;
+
+    // the simulator doesn't deliver anything while inactive, so with no impairment packets go straight to the receiver
+
+    if ( simulator.IsActive() )
+        simulator.SendPacket( to, packetData, PacketHeaderBytes + packetBytes );
+    else
+        ReceiveEndpointPacket( receiver, packetData, PacketHeaderBytes + packetBytes );
+
+    endpoint.sequence++;
+}
+
+static int CompareDouble( const void * a, const void * b )
+{
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return ( x < y ) ? -1 : ( ( x > y ) ? 1 : 0 );
+}
+
+static double GetPercentile( const double * sortedValues, int numValues, double percentile )
+{
+    if ( numValues == 0 )
+        return 0.0;
+    int index = int( percentile / 100.0 * ( numValues - 1 ) + 0.5 );
+    if ( index >= numValues )
+        index = numValues - 1;
+    return sortedValues[index];
+}
+
+static GoodputEndpoint endpointA;
+static GoodputEndpoint endpointB;
+static double sendTimes[65536];
+static double latencySamples[MaxLatencySamples];
+
+static void RunGoodput( const GoodputConfig & goodputConfig, bool blocks, float latency, float jitter, float packetLoss )
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0] = goodputConfig.channel;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxBlockSize = BlockSize;
+
+    double time = 100.0;
+
+    Connection connectionA( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection connectionB( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    InitEndpoint( endpointA, connectionA );
+    InitEndpoint( endpointB, connectionB );
+
+    NetworkSimulator simulator( GetDefaultAllocator(), 4 * 1024, time );
+    simulator.SetSeed( GoodputSeed );
+    simulator.SetLatency( latency );
+    simulator.SetJitter( jitter );
+    simulator.SetPacketLoss( packetLoss );
+
+    uint8_t * packetData = (uint8_t*) malloc( connectionConfig.maxPacketSize );
+
+    const int queueDepth = blocks ? connectionConfig.channel[0].maxBlocksInFlight * 2 : MessageQueueDepth;
+    const double finishTime = time + RunTime;
+    const double deltaTime = 1.0 / TickRate;
+
+    uint16_t sendSequence = 0;
+    uint16_t receiveSequence = 0;
+    uint64_t bytesDelivered = 0;
+    int numDelivered = 0;
+    int numLatencySamples = 0;
+    bool ordered = true;
+
+    while ( time < finishTime )
+    {
+        // A always has queueDepth messages waiting, so the channel, not the workload, limits goodput
+
+        ConnectionStats stats;
+        connectionA.GetStats( stats );
+        for ( int i = stats.channel[0].sendQueueDepth; i < queueDepth; ++i )
+        {
+            if ( !connectionA.CanSendMessage( 0 ) )
+                break;
+
+            Message * message;
+            if ( blocks )
+            {
+                TestBlockMessage * blockMessage = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                yojimbo_assert( blockMessage );
+                blockMessage->sequence = sendSequence;
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+                yojimbo_assert( blockData );
+                memset( blockData, int( sendSequence ), BlockSize );
+                blockMessage->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+                message = blockMessage;
+            }
+            else
+            {
+                TestMessage * testMessage = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                yojimbo_assert( testMessage );
+                testMessage->sequence = sendSequence;
+                message = testMessage;
+            }
+
+            sendTimes[sendSequence] = time;
+            sendSequence++;
+
+            connectionA.SendMessage( 0, message );
+        }
+
+        SendEndpointPacket( endpointA, endpointB, simulator, 1, packetData, connectionConfig.maxPacketSize );
+        SendEndpointPacket( endpointB, endpointA, simulator, 0, packetData, connectionConfig.maxPacketSize );
+
+        time += deltaTime;
+
+        simulator.AdvanceTime( time );
+
+        while ( true )
+        {
+            const int MaxPackets = 64;
+            uint8_t * receivedPacketData[MaxPackets];
+            int receivedPacketBytes[MaxPackets];
+            int to[MaxPackets];
+
+            const int numPackets = simulator.ReceivePackets( MaxPackets, receivedPacketData, receivedPacketBytes, to );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                ReceiveEndpointPacket( to[i] == 0 ? endpointA : endpointB, receivedPacketData[i], receivedPacketBytes[i] );
+                simulator.ReleasePacket( receivedPacketData[i] );
+            }
+
+            if ( numPackets < MaxPackets )
+                break;
+        }
+
+        while ( Message * message = connectionB.ReceiveMessage( 0 ) )
+        {
+            uint16_t sequence;
+            int bytes;
+            if ( message->GetType() == TEST_BLOCK_MESSAGE )
+            {
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                sequence = blockMessage->sequence;
+                bytes = 2 + blockMessage->GetBlockSize();
+            }
+            else
+            {
+                TestMessage * testMessage = (TestMessage*) message;
+                sequence = testMessage->sequence;
+                bytes = 2 + GetNumBitsForMessage( sequence ) / 8;
+            }
+
+            if ( sequence != receiveSequence )
+                ordered = false;
+            receiveSequence++;
+
+            bytesDelivered += bytes;
+            numDelivered++;
+
+            if ( numLatencySamples < MaxLatencySamples )
+                latencySamples[numLatencySamples++] = time - sendTimes[sequence];
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        connectionA.AdvanceTime( time );
+        connectionB.AdvanceTime( time );
+    }
+
+    if ( !ordered )
+        fprintf( stderr, "error: %s %s messages delivered out of order\n", goodputConfig.name, blocks ? "block" : "message" );
+
+    qsort( latencySamples, numLatencySamples, sizeof( double ), CompareDouble );
+
+    printf( "%s,%s,%.0f,%.0f,%.0f,%d,%.0f,%.1f,%.1f,%.1f,%.1f\n",
+        goodputConfig.name, blocks ? "blocks" : "messages",
+        latency, jitter, packetLoss,
+        numDelivered, bytesDelivered / RunTime,
+        GetPercentile( latencySamples, numLatencySamples, 50.0 ) * 1000.0,
+        GetPercentile( latencySamples, numLatencySamples, 90.0 ) * 1000.0,
+        GetPercentile( latencySamples, numLatencySamples, 99.0 ) * 1000.0,
+        GetPercentile( latencySamples, numLatencySamples, 100.0 ) * 1000.0 );
+
+    fflush( stdout );
+
+    simulator.DiscardPackets();
+
+    connectionA.Reset();
+    connectionB.Reset();
+
+    free( packetData );
+}
+
+int main( int argc, char ** argv )
+{
+    if ( !InitializeYojimbo() )
+    {
+        fprintf( stderr, "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_NONE );
+
+    const char * filter = ( argc > 1 ) ? argv[1] : NULL;
+
+    const int MaxConfigs = 16;
+    GoodputConfig configs[MaxConfigs];
+    int numConfigs = 0;
+    InitGoodputConfigs( configs, numConfigs );
+
+    // one way latency and jitter, applied to packets in both directions
+
+    static const float latencies[] = { 0.0f, 50.0f, 150.0f };
+    static const float jitters[] = { 0.0f, 20.0f };
+    static const float packetLosses[] = { 0.0f, 5.0f, 20.0f };
+
+    printf( "config,workload,latency_ms,jitter_ms,loss_percent,delivered,goodput_bytes_per_sec,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms\n" );
+
+    for ( int i = 0; i < numConfigs; ++i )
+    {
+        if ( filter && strstr( configs[i].name, filter ) == NULL )
+            continue;
+
+        for ( int workload = 0; workload < 2; ++workload )
+        {
+            for ( int j = 0; j < int( sizeof( latencies ) / sizeof( float ) ); ++j )
+            {
+                for ( int k = 0; k < int( sizeof( jitters ) / sizeof( float ) ); ++k )
+                {
+                    for ( int l = 0; l < int( sizeof( packetLosses ) / sizeof( float ) ); ++l )
+                    {
+                        RunGoodput( configs[i], workload == 1, latencies[j], jitters[k], packetLosses[l] );
+                    }
+                }
+            }
+        }
+    }
+
+    ShutdownYojimbo();
+
+    return 0;
+}
@@ -0,0 +1,611 @@
+/*
+    Load Test
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared.h"
+#include <signal.h>
+#include <string.h>
+
+// Runs many clients against one server under a configurable message mix and network simulator settings.
+// Every interval it reports sustained throughput, server tick time percentiles and allocator peaks, so
+// throughput regressions show up here and not just leaks. Messages are checked for order and content as they arrive.
+
+static const int UNRELIABLE_UNORDERED_CHANNEL = 0;
+static const int RELIABLE_ORDERED_CHANNEL = 1;
+
+struct LoadConfig
+{
+    int numClients;                 ///< Number of clients connecting to the server.
+    int tickRate;                   ///< Client and server ticks per second.
+    double duration;                ///< How long to run for (seconds). 0 runs until ctrl-c.
+    double reportInterval;          ///< Seconds between reports.
+    int reliableMessages;           ///< Reliable-ordered messages sent per tick, in each direction, for each client.
+    int unreliableMessages;         ///< Unreliable-unordered messages sent per tick, in each direction, for each client.
+    int blockPercent;               ///< Percent of reliable messages that are block messages.
+    int maxBlockSize;               ///< Block messages have blocks of size [1,maxBlockSize] (bytes).
+    float latency;                  ///< Simulated latency (milliseconds).
+    float jitter;                   ///< Simulated jitter (milliseconds).
+    float packetLoss;               ///< Simulated packet loss (percent).
+    float duplicates;               ///< Simulated duplicate packets (percent).
+    uint64_t seed;                  ///< Seed for everything randomized. 0 seeds from the current time.
+    bool virtualTime;               ///< Run on a virtual clock that steps one tick at a time without sleeping, with clients connected over loopback instead of sockets. Simulated time runs as fast as the CPU allows.
+
+    LoadConfig()
+    {
+        numClients = 64;
+        tickRate = 60;
+        duration = 0.0;
+        reportInterval = 5.0;
+        reliableMessages = 8;
+        unreliableMessages = 4;
+        blockPercent = 4;
+        maxBlockSize = 16 * 1024;
+        latency = 0.0f;
+        jitter = 0.0f;
+        packetLoss = 0.0f;
+        duplicates = 0.0f;
+        seed = 0;
+        virtualTime = false;
+    }
+};
+
+struct LoadCounters
+{
+    uint64_t messagesReceived;
+    uint64_t bytesReceived;
+    uint64_t blocksReceived;
+
+    LoadCounters()
+    {
+        messagesReceived = 0;
+        bytesReceived = 0;
+        blocksReceived = 0;
+    }
+};
+
+// Per-endpoint message state, one for each client and one for each server client slot.
+
+struct LoadEndpoint
+{
+    uint16_t reliableSent;
+    uint16_t reliableReceived;
+};
+
+static volatile int quit = 0;
+
+void interrupt_handler( int /*dummy*/ )
+{
+    quit = 1;
+}
+
+static bool ParseArgument( const char * argument, const char * name, const char ** value )
+{
+    const size_t length = strlen( name );
+    if ( strncmp( argument, name, length ) != 0 || argument[length] != '=' )
+        return false;
+    *value = argument + length + 1;
+    return true;
+}
+
+static bool ParseLoadConfig( int argc, char ** argv, LoadConfig & loadConfig )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        const char * value = NULL;
+        if ( ParseArgument( argv[i], "clients", &value ) )
+            loadConfig.numClients = atoi( value );
+        else if ( ParseArgument( argv[i], "rate", &value ) )
+            loadConfig.tickRate = atoi( value );
+        else if ( ParseArgument( argv[i], "duration", &value ) )
+            loadConfig.duration = atof( value );
+        else if ( ParseArgument( argv[i], "interval", &value ) )
+            loadConfig.reportInterval = atof( value );
+        else if ( ParseArgument( argv[i], "reliable", &value ) )
+            loadConfig.reliableMessages = atoi( value );
+        else if ( ParseArgument( argv[i], "unreliable", &value ) )
+            loadConfig.unreliableMessages = atoi( value );
+        else if ( ParseArgument( argv[i], "blocks", &value ) )
+            loadConfig.blockPercent = atoi( value );
+        else if ( ParseArgument( argv[i], "blocksize", &value ) )
+            loadConfig.maxBlockSize = atoi( value );
+        else if ( ParseArgument( argv[i], "latency", &value ) )
+            loadConfig.latency = float( atof( value ) );
+        else if ( ParseArgument( argv[i], "jitter", &value ) )
+            loadConfig.jitter = float( atof( value ) );
+        else if ( ParseArgument( argv[i], "loss", &value ) )
+            loadConfig.packetLoss = float( atof( value ) );
+        else if ( ParseArgument( argv[i], "duplicates", &value ) )
+            loadConfig.duplicates = float( atof( value ) );
+        else if ( ParseArgument( argv[i], "seed", &value ) )
+            loadConfig.seed = strtoull( value, NULL, 10 );
+        else if ( ParseArgument( argv[i], "virtual", &value ) )
+            loadConfig.virtualTime = atoi( value ) != 0;
+        else
+        {
+            printf( "error: unknown argument '%s'\n", argv[i] );
+            printf( "usage: load [clients=N] [rate=HZ] [duration=S] [interval=S] [reliable=N] [unreliable=N] [blocks=PERCENT] [blocksize=BYTES] [latency=MS] [jitter=MS] [loss=PERCENT] [duplicates=PERCENT] [seed=N] [virtual=0|1]\n" );
+            return false;
+        }
+    }
+
+    if ( loadConfig.numClients < 1 || loadConfig.tickRate < 1 || loadConfig.reportInterval <= 0.0 || loadConfig.maxBlockSize < 1 )
+    {
+        printf( "error: invalid load test configuration\n" );
+        return false;
+    }
+
+    return true;
+}
+
+static int GetBlockSize( uint16_t sequence, int maxBlockSize )
+{
+    return 1 + ( int( sequence ) * 33 ) % maxBlockSize;
+}
+
+static int GetMessageBytes( uint16_t sequence )
+{
+    return 2 + GetNumBitsForMessage( sequence ) / 8;
+}
+
+// Wraps a client, or a server client slot, so the same code creates messages on both sides.
+
+struct ClientMessageSource
+{
+    Client * client;
+
+    explicit ClientMessageSource( Client & c ) : client( &c ) {}
+    Message * CreateMessage( int type ) { return client->CreateMessage( type ); }
+    uint8_t * AllocateBlock( int bytes ) { return client->AllocateBlock( bytes ); }
+    void AttachBlockToMessage( Message * message, uint8_t * block, int bytes ) { client->AttachBlockToMessage( message, block, bytes ); }
+    void ReleaseMessage( Message * message ) { client->ReleaseMessage( message ); }
+};
+
+struct ServerMessageSource
+{
+    Server * server;
+    int clientIndex;
+
+    ServerMessageSource( Server & s, int index ) : server( &s ), clientIndex( index ) {}
+    Message * CreateMessage( int type ) { return server->CreateMessage( clientIndex, type ); }
+    uint8_t * AllocateBlock( int bytes ) { return server->AllocateBlock( clientIndex, bytes ); }
+    void AttachBlockToMessage( Message * message, uint8_t * block, int bytes ) { server->AttachBlockToMessage( clientIndex, message, block, bytes ); }
+    void ReleaseMessage( Message * message ) { server->ReleaseMessage( clientIndex, message ); }
+};
+
+template <typename Source> Message * CreateLoadMessage( Random & random, const LoadConfig & loadConfig, Source source, uint16_t sequence, bool reliable )
+{
+    if ( reliable && random.GetInt( 0, 99 ) < loadConfig.blockPercent )
+    {
+        TestBlockMessage * blockMessage = (TestBlockMessage*) source.CreateMessage( TEST_BLOCK_MESSAGE );
+        if ( !blockMessage )
+            return NULL;
+        blockMessage->sequence = sequence;
+        const int blockSize = GetBlockSize( sequence, loadConfig.maxBlockSize );
+        uint8_t * blockData = source.AllocateBlock( blockSize );
+        if ( !blockData )
+        {
+            source.ReleaseMessage( blockMessage );
+            return NULL;
+        }
+        for ( int i = 0; i < blockSize; ++i )
+            blockData[i] = uint8_t( sequence + i );
+        source.AttachBlockToMessage( blockMessage, blockData, blockSize );
+        return blockMessage;
+    }
+
+    TestMessage * message = (TestMessage*) source.CreateMessage( TEST_MESSAGE );
+    if ( message )
+        message->sequence = sequence;
+    return message;
+}
+
+static bool ProcessLoadMessage( const LoadConfig & loadConfig, Message * message, uint16_t & reliableReceived, LoadCounters & counters, bool reliable )
+{
+    if ( message->GetType() == TEST_BLOCK_MESSAGE )
+    {
+        TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+        if ( blockMessage->sequence != reliableReceived )
+        {
+            printf( "error: block message out of order. expected %d, got %d\n", reliableReceived, blockMessage->sequence );
+            return false;
+        }
+        const int blockSize = blockMessage->GetBlockSize();
+        const int expectedBlockSize = GetBlockSize( blockMessage->sequence, loadConfig.maxBlockSize );
+        if ( blockSize != expectedBlockSize )
+        {
+            printf( "error: block size mismatch. expected %d, got %d\n", expectedBlockSize, blockSize );
+            return false;
+        }
+        const uint8_t * blockData = blockMessage->GetBlockData();
+        for ( int i = 0; i < blockSize; ++i )
+        {
+            if ( blockData[i] != uint8_t( blockMessage->sequence + i ) )
+            {
+                printf( "error: block data mismatch. expected %d, but blockData[%d] = %d\n", uint8_t( blockMessage->sequence + i ), i, blockData[i] );
+                return false;
+            }
+        }
+        reliableReceived++;
+        counters.messagesReceived++;
+        counters.blocksReceived++;
+        counters.bytesReceived += 2 + blockSize;
+        return true;
+    }
+
+    TestMessage * testMessage = (TestMessage*) message;
+    if ( reliable )
+    {
+        if ( testMessage->sequence != reliableReceived )
+        {
+            printf( "error: message out of order. expected %d, got %d\n", reliableReceived, testMessage->sequence );
+            return false;
+        }
+        reliableReceived++;
+    }
+    counters.messagesReceived++;
+    counters.bytesReceived += GetMessageBytes( testMessage->sequence );
+    return true;
+}
+
+static int CompareDouble( const void * a, const void * b )
+{
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return ( x < y ) ? -1 : ( ( x > y ) ? 1 : 0 );
+}
+
+static double GetPercentile( const double * sortedValues, int numValues, double percentile )
+{
+    if ( numValues == 0 )
+        return 0.0;
+    int index = int( percentile / 100.0 * ( numValues - 1 ) + 0.5 );
+    if ( index >= numValues )
+        index = numValues - 1;
+    return sortedValues[index];
+}
+
+int LoadMain( const LoadConfig & loadConfig )
+{
+    printf( "clients %d, rate %d, reliable %d, unreliable %d, blocks %d%% up to %d bytes, latency %.1fms, jitter %.1fms, loss %.1f%%, duplicates %.1f%%, seed %" PRIu64 "%s\n", 
+        loadConfig.numClients, loadConfig.tickRate, loadConfig.reliableMessages, loadConfig.unreliableMessages, loadConfig.blockPercent, loadConfig.maxBlockSize, 
+        loadConfig.latency, loadConfig.jitter, loadConfig.packetLoss, loadConfig.duplicates, loadConfig.seed, loadConfig.virtualTime ? ", virtual time" : "" );
+
+    Random random( loadConfig.seed );
+
+    ClientServerConfig config;
+    config.simulatorSeed = loadConfig.seed;
+    config.maxPacketSize = 16 * 1024;
+    config.clientMemory = 10 * 1024 * 1024;
+    config.clientSharedMemory = true;
+    config.serverGlobalMemory = 10 * 1024 * 1024;
+    config.serverPerClientMemory = 10 * 1024 * 1024;
+    config.serverSharedClientMemory = true;
+    config.numChannels = 2;
+    config.channel[UNRELIABLE_UNORDERED_CHANNEL].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    config.channel[RELIABLE_ORDERED_CHANNEL].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    config.channel[RELIABLE_ORDERED_CHANNEL].maxBlockSize = loadConfig.maxBlockSize;
+    config.channel[RELIABLE_ORDERED_CHANNEL].fragmentSize = ( loadConfig.maxBlockSize < 1024 ) ? loadConfig.maxBlockSize : 1024;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    // the library only ever sees the time passed in, so a virtual clock is just a time that steps by one tick without sleeping
+
+    const double realStartTime = yojimbo_time();
+
+    double time = loadConfig.virtualTime ? 100.0 : realStartTime;
+
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( loadConfig.numClients );
+
+    if ( !server.IsRunning() )
+    {
+        printf( "error: server failed to start\n" );
+        return 1;
+    }
+
+    ClientPool clients( GetDefaultAllocator(), Address( "0.0.0.0" ), config, adapter, loadConfig.numClients, time );
+
+    for ( int i = 0; i < loadConfig.numClients; ++i )
+    {
+        Client & client = clients.GetClient( i );
+        client.SetLatency( loadConfig.latency );
+        client.SetJitter( loadConfig.jitter );
+        client.SetPacketLoss( loadConfig.packetLoss );
+        client.SetDuplicates( loadConfig.duplicates );
+    }
+
+    server.SetLatency( loadConfig.latency );
+    server.SetJitter( loadConfig.jitter );
+    server.SetPacketLoss( loadConfig.packetLoss );
+    server.SetDuplicates( loadConfig.duplicates );
+
+    if ( loadConfig.virtualTime )
+    {
+        // loopback skips the sockets, whose delivery depends on real time. packets still go through the network simulator
+
+        for ( int i = 0; i < loadConfig.numClients; ++i )
+        {
+            if ( !clients.GetClient( i ).ConnectLoopback( server ) )
+            {
+                printf( "error: loopback client %d failed to connect\n", i );
+                clients.Disconnect();
+                server.Stop();
+                return 1;
+            }
+        }
+    }
+    else
+    {
+        uint64_t firstClientId = 0;
+        random_bytes( (uint8_t*) &firstClientId, 8 );
+
+        clients.InsecureConnect( privateKey, firstClientId, &serverAddress, 1 );
+    }
+
+    LoadEndpoint * clientEndpoints = (LoadEndpoint*) calloc( loadConfig.numClients, sizeof( LoadEndpoint ) );
+    LoadEndpoint * serverEndpoints = (LoadEndpoint*) calloc( loadConfig.numClients, sizeof( LoadEndpoint ) );
+
+    const int maxTickSamples = int( loadConfig.reportInterval * loadConfig.tickRate ) + 16;
+    double * tickSamples = (double*) malloc( sizeof( double ) * maxTickSamples );
+    int numTickSamples = 0;
+
+    LoadCounters clientCounters;
+    LoadCounters serverCounters;
+    LoadCounters lastClientCounters;
+    LoadCounters lastServerCounters;
+
+    signal( SIGINT, interrupt_handler );
+
+    const double deltaTime = 1.0 / loadConfig.tickRate;
+    const double startTime = time;
+    double reportTime = time + loadConfig.reportInterval;
+    double lastReportTime = time;
+    bool allConnected = false;
+    int result = 0;
+
+    while ( !quit && result == 0 )
+    {
+        clients.SendPackets();
+        clients.ReceivePackets();
+
+        // only the server side of the tick counts towards the tick time percentiles
+
+        const double tickStart = yojimbo_time();
+
+        server.ReceivePackets();
+
+        for ( int i = 0; i < loadConfig.numClients && result == 0; ++i )
+        {
+            if ( !server.IsClientConnected( i ) )
+                continue;
+
+            LoadEndpoint & endpoint = serverEndpoints[i];
+
+            for ( int channelIndex = 0; channelIndex < config.numChannels; ++channelIndex )
+            {
+                const bool reliable = channelIndex == RELIABLE_ORDERED_CHANNEL;
+                while ( Message * message = server.ReceiveMessage( i, channelIndex ) )
+                {
+                    if ( !ProcessLoadMessage( loadConfig, message, endpoint.reliableReceived, serverCounters, reliable ) )
+                        result = 1;
+                    server.ReleaseMessage( i, message );
+                }
+            }
+
+            for ( int j = 0; j < loadConfig.reliableMessages && server.CanSendMessage( i, RELIABLE_ORDERED_CHANNEL ); ++j )
+            {
+                Message * message = CreateLoadMessage( random, loadConfig, ServerMessageSource( server, i ), endpoint.reliableSent, true );
+                if ( !message )
+                    break;
+                server.SendMessage( i, RELIABLE_ORDERED_CHANNEL, message );
+                endpoint.reliableSent++;
+            }
+
+            for ( int j = 0; j < loadConfig.unreliableMessages && server.CanSendMessage( i, UNRELIABLE_UNORDERED_CHANNEL ); ++j )
+            {
+                Message * message = CreateLoadMessage( random, loadConfig, ServerMessageSource( server, i ), uint16_t( random.GetUint32() ), false );
+                if ( !message )
+                    break;
+                server.SendMessage( i, UNRELIABLE_UNORDERED_CHANNEL, message );
+            }
+        }
+
+        server.SendPackets();
+
+        const double tickFinish = yojimbo_time();
+
+        if ( numTickSamples < maxTickSamples )
+            tickSamples[numTickSamples++] = tickFinish - tickStart;
+
+        for ( int i = 0; i < loadConfig.numClients && result == 0; ++i )
+        {
+            Client & client = clients.GetClient( i );
+
+            if ( !client.IsConnected() )
+            {
+                if ( allConnected || client.ConnectionFailed() )
+                {
+                    printf( "error: client %d disconnected\n", i );
+                    result = 1;
+                }
+                continue;
+            }
+
+            LoadEndpoint & endpoint = clientEndpoints[i];
+
+            for ( int channelIndex = 0; channelIndex < config.numChannels; ++channelIndex )
+            {
+                const bool reliable = channelIndex == RELIABLE_ORDERED_CHANNEL;
+                while ( Message * message = client.ReceiveMessage( channelIndex ) )
+                {
+                    if ( !ProcessLoadMessage( loadConfig, message, endpoint.reliableReceived, clientCounters, reliable ) )
+                        result = 1;
+                    client.ReleaseMessage( message );
+                }
+            }
+
+            for ( int j = 0; j < loadConfig.reliableMessages && client.CanSendMessage( RELIABLE_ORDERED_CHANNEL ); ++j )
+            {
+                Message * message = CreateLoadMessage( random, loadConfig, ClientMessageSource( client ), endpoint.reliableSent, true );
+                if ( !message )
+                    break;
+                client.SendMessage( RELIABLE_ORDERED_CHANNEL, message );
+                endpoint.reliableSent++;
+            }
+
+            for ( int j = 0; j < loadConfig.unreliableMessages && client.CanSendMessage( UNRELIABLE_UNORDERED_CHANNEL ); ++j )
+            {
+                Message * message = CreateLoadMessage( random, loadConfig, ClientMessageSource( client ), uint16_t( random.GetUint32() ), false );
+                if ( !message )
+                    break;
+                client.SendMessage( UNRELIABLE_UNORDERED_CHANNEL, message );
+            }
+        }
+
+        if ( !allConnected && clients.GetNumConnectedClients() == loadConfig.numClients )
+        {
+            printf( "all %d clients connected after %.2f seconds\n", loadConfig.numClients, time - startTime );
+            allConnected = true;
+        }
+
+        if ( loadConfig.virtualTime )
+        {
+            time += deltaTime;
+        }
+        else
+        {
+            yojimbo_sleep_until( time + deltaTime );
+
+            time = yojimbo_time();
+        }
+
+        clients.AdvanceTime( time );
+        server.AdvanceTime( time );
+
+        if ( time >= reportTime )
+        {
+            const double elapsed = time - lastReportTime;
+
+            const uint64_t messagesReceived = ( clientCounters.messagesReceived - lastClientCounters.messagesReceived ) + ( serverCounters.messagesReceived - lastServerCounters.messagesReceived );
+            const uint64_t bytesReceived = ( clientCounters.bytesReceived - lastClientCounters.bytesReceived ) + ( serverCounters.bytesReceived - lastServerCounters.bytesReceived );
+            const uint64_t blocksReceived = ( clientCounters.blocksReceived - lastClientCounters.blocksReceived ) + ( serverCounters.blocksReceived - lastServerCounters.blocksReceived );
+
+            qsort( tickSamples, numTickSamples, sizeof( double ), CompareDouble );
+
+            AllocatorStats globalStats;
+            server.GetGlobalAllocatorStats( globalStats );
+
+            size_t serverClientPeak = 0;
+            for ( int i = 0; i < loadConfig.numClients; ++i )
+            {
+                AllocatorStats clientStats;
+                server.GetClientAllocatorStats( i, clientStats );
+                if ( clientStats.peakBytesAllocated > serverClientPeak )
+                    serverClientPeak = clientStats.peakBytesAllocated;
+            }
+
+            AllocatorStats poolStats;
+            clients.GetAllocatorStats( poolStats );
+
+            printf( "%.1fs: %d/%d connected, %.0f messages/sec, %.0f bytes/sec, %.0f blocks/sec, tick p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms, peak server global %.1fkB, peak server client %.1fkB, peak client pool %.1fkB\n",
+                time - startTime,
+                server.GetNumConnectedClients(), loadConfig.numClients,
+                messagesReceived / elapsed, bytesReceived / elapsed, blocksReceived / elapsed,
+                GetPercentile( tickSamples, numTickSamples, 50.0 ) * 1000.0,
+                GetPercentile( tickSamples, numTickSamples, 90.0 ) * 1000.0,
+                GetPercentile( tickSamples, numTickSamples, 99.0 ) * 1000.0,
+                GetPercentile( tickSamples, numTickSamples, 100.0 ) * 1000.0,
+                globalStats.peakBytesAllocated / 1024.0, serverClientPeak / 1024.0, poolStats.peakBytesAllocated / 1024.0 );
+
+            fflush( stdout );
+
+            lastClientCounters = clientCounters;
+            lastServerCounters = serverCounters;
+            lastReportTime = time;
+            reportTime = time + loadConfig.reportInterval;
+            numTickSamples = 0;
+        }
+
+        if ( loadConfig.duration > 0.0 && time - startTime >= loadConfig.duration )
+            break;
+    }
+
+    if ( quit )
+    {
+        printf( "\nstopped\n" );
+    }
+
+    printf( "total: %" PRIu64 " messages and %" PRIu64 " bytes received by clients, %" PRIu64 " messages and %" PRIu64 " bytes received by server\n",
+        clientCounters.messagesReceived, clientCounters.bytesReceived, serverCounters.messagesReceived, serverCounters.bytesReceived );
+
+    if ( loadConfig.virtualTime )
+    {
+        const double realTime = yojimbo_time() - realStartTime;
+        printf( "simulated %.1f seconds in %.1f seconds (%.1fx)\n", time - startTime, realTime, ( time - startTime ) / yojimbo_max( realTime, 0.001 ) );
+    }
+
+    clients.Disconnect();
+
+    server.Stop();
+
+    free( tickSamples );
+    free( clientEndpoints );
+    free( serverEndpoints );
+
+    return result;
+}
+
+int main( int argc, char ** argv )
+{
+    printf( "\nload\n" );
+
+    LoadConfig loadConfig;
+
+    if ( !ParseLoadConfig( argc, argv, loadConfig ) )
+        return 1;
+
+    if ( loadConfig.seed == 0 )
+        loadConfig.seed = (uint64_t) time( NULL );
+
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_INFO );
+
+    srand( (unsigned int) loadConfig.seed );
+
+    int result = LoadMain( loadConfig );
+
+    ShutdownYojimbo();
+
+    printf( "\n" );
+
+    return result;
+}
@@ -0,0 +1,253 @@
+/*
+    Packet Replay
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared.h"
+#include <string.h>
+
+// Replays the packets received in a packet recording through Connection, with no sockets, crypto or timers.
+// Recordings are written by PacketRecorder. See BaseServer::SetPacketRecorder and BaseClient::SetPacketRecorder.
+//
+// Each received packet goes through Connection::ProcessPacket. The messages it delivers are sent back out through a second
+// connection with Connection::GeneratePacket, and acked straight away, so both directions of the channel code run on real traffic.
+// Connection time comes from the recording, so every pass does exactly the same work.
+//
+// The connection config and message factory must match the ones the recording was made with. This uses the test ones from shared.h.
+//
+// Results go to stdout as CSV, one line per phase, in the same layout as bench. Progress goes to stderr.
+//
+// usage: replay <recording> [passes]
+
+const int ReplayMaxClients = 256;
+const int ReplayAllocatorBytes = 64 * 1024 * 1024;
+
+struct ReplayPacket
+{
+    const uint8_t * packetData;
+    int packetBytes;
+    int clientIndex;
+    uint16_t packetSequence;
+    double time;
+};
+
+struct ReplayPhase
+{
+    const char * name;
+    double seconds;
+    uint64_t allocations;
+
+    ReplayPhase( const char * _name ) : name( _name ), seconds( 0.0 ), allocations( 0 ) {}
+};
+
+static uint64_t GetNumAllocations( Allocator & allocator )
+{
+    AllocatorStats stats;
+    allocator.GetStats( stats );
+    return stats.numAllocations;
+}
+
+static void ReplayResult( const ReplayPhase & phase, uint64_t packets, uint64_t bytes )
+{
+    const double nanosecondsPerOp = packets ? ( phase.seconds * 1000000000.0 ) / double( packets ) : 0.0;
+    const double megabytesPerSecond = ( phase.seconds > 0.0 ) ? ( double( bytes ) / ( 1024.0 * 1024.0 ) ) / phase.seconds : 0.0;
+    printf( "replay_%s,%" PRIu64 ",%" PRIu64 ",%.6f,%.2f,%.2f\n", phase.name, phase.allocations, packets, phase.seconds, nanosecondsPerOp, megabytesPerSecond );
+    fflush( stdout );
+}
+
+int main( int argc, char ** argv )
+{
+    if ( argc < 2 )
+    {
+        fprintf( stderr, "usage: replay <recording> [passes]\n" );
+        return 1;
+    }
+
+    const int numPasses = ( argc > 2 ) ? atoi( argv[2] ) : 10;
+
+    if ( !InitializeYojimbo() )
+    {
+        fprintf( stderr, "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_ERROR );
+
+    PacketPlayback playback( argv[1] );
+    if ( playback.IsError() )
+    {
+        ShutdownYojimbo();
+        return 1;
+    }
+
+    // index the received packets up front. they stay in the mapping, so a pass touches nothing but the connections
+
+    int numPackets = 0;
+    int maxPackets = 1024;
+    ReplayPacket * packets = (ReplayPacket*) malloc( sizeof( ReplayPacket ) * maxPackets );
+    uint64_t totalBytes = 0;
+
+    PacketRecordHeader header;
+    const uint8_t * packetData = NULL;
+    while ( playback.ReadPacket( header, packetData ) )
+    {
+        if ( header.direction != PACKET_DIRECTION_RECEIVE || header.clientIndex < 0 || header.clientIndex >= ReplayMaxClients )
+            continue;
+
+        if ( numPackets == maxPackets )
+        {
+            maxPackets *= 2;
+            packets = (ReplayPacket*) realloc( packets, sizeof( ReplayPacket ) * maxPackets );
+        }
+
+        ReplayPacket & packet = packets[numPackets++];
+        packet.packetData = packetData;
+        packet.packetBytes = int( header.packetBytes );
+        packet.clientIndex = header.clientIndex;
+        packet.packetSequence = header.packetSequence;
+        packet.time = header.time;
+        totalBytes += header.packetBytes;
+    }
+
+    fprintf( stderr, "%d received packets in %s\n", numPackets, argv[1] );
+
+    uint8_t * allocatorMemory = (uint8_t*) malloc( ReplayAllocatorBytes );
+    TLSF_Allocator * replayAllocator = YOJIMBO_NEW( GetDefaultAllocator(), TLSF_Allocator, allocatorMemory, ReplayAllocatorBytes );
+    TestMessageFactory * replayMessageFactory = YOJIMBO_NEW( *replayAllocator, TestMessageFactory, *replayAllocator );
+    Allocator & allocator = *replayAllocator;
+    MessageFactory & messageFactory = *replayMessageFactory;
+
+    ClientServerConfig config;
+
+    Connection * receivers[ReplayMaxClients];
+    Connection * senders[ReplayMaxClients];
+    uint16_t senderSequence[ReplayMaxClients];
+    memset( receivers, 0, sizeof( receivers ) );
+    memset( senders, 0, sizeof( senders ) );
+
+    uint8_t * generatedPacket = (uint8_t*) malloc( config.maxPacketSize );
+
+    ReplayPhase process( "process" );
+    ReplayPhase receive( "receive" );
+    ReplayPhase generate( "generate" );
+    uint64_t generatedBytes = 0;
+    uint64_t numFailed = 0;
+
+    for ( int pass = 0; pass < numPasses; ++pass )
+    {
+        for ( int i = 0; i < ReplayMaxClients; ++i )
+        {
+            if ( receivers[i] )
+            {
+                receivers[i]->Reset();
+                senders[i]->Reset();
+            }
+            senderSequence[i] = 0;
+        }
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            const ReplayPacket & packet = packets[i];
+            const int clientIndex = packet.clientIndex;
+
+            // connections are created on first use, outside the timed phases
+
+            if ( !receivers[clientIndex] )
+            {
+                receivers[clientIndex] = YOJIMBO_NEW( allocator, Connection, allocator, messageFactory, config, packet.time );
+                senders[clientIndex] = YOJIMBO_NEW( allocator, Connection, allocator, messageFactory, config, packet.time );
+            }
+
+            Connection & receiver = *receivers[clientIndex];
+            Connection & sender = *senders[clientIndex];
+
+            receiver.AdvanceTime( packet.time );
+            sender.AdvanceTime( packet.time );
+
+            uint64_t allocations = GetNumAllocations( allocator );
+            double start = yojimbo_time();
+            if ( !receiver.ProcessPacket( NULL, packet.packetSequence, packet.packetData, packet.packetBytes ) )
+                numFailed++;
+            double finish = yojimbo_time();
+            process.seconds += finish - start;
+            process.allocations += GetNumAllocations( allocator ) - allocations;
+
+            allocations = GetNumAllocations( allocator );
+            start = yojimbo_time();
+            for ( int j = 0; j < config.numChannels; ++j )
+            {
+                while ( Message * message = receiver.ReceiveMessage( j ) )
+                {
+                    if ( sender.CanSendMessage( j ) )
+                        sender.SendMessage( j, message );
+                    else
+                        messageFactory.ReleaseMessage( message );
+                }
+            }
+            finish = yojimbo_time();
+            receive.seconds += finish - start;
+            receive.allocations += GetNumAllocations( allocator ) - allocations;
+
+            allocations = GetNumAllocations( allocator );
+            start = yojimbo_time();
+            const uint16_t sequence = senderSequence[clientIndex]++;
+            int packetBytes = 0;
+            if ( sender.GeneratePacket( NULL, sequence, generatedPacket, config.maxPacketSize, packetBytes ) )
+            {
+                sender.ProcessAcks( &sequence, 1 );
+                generatedBytes += packetBytes;
+            }
+            finish = yojimbo_time();
+            generate.seconds += finish - start;
+            generate.allocations += GetNumAllocations( allocator ) - allocations;
+        }
+    }
+
+    if ( numFailed )
+        fprintf( stderr, "error: %" PRIu64 " packets failed to process. does the config and message factory match the recording?\n", numFailed );
+
+    const uint64_t totalPackets = uint64_t( numPackets ) * uint64_t( numPasses );
+
+    printf( "# yojimbo %d.%d.%d\n", YOJIMBO_MAJOR_VERSION, YOJIMBO_MINOR_VERSION, YOJIMBO_PATCH_VERSION );
+    printf( "phase,allocations,packets,seconds,ns_per_packet,mb_per_sec\n" );
+
+    ReplayResult( process, totalPackets, totalBytes * uint64_t( numPasses ) );
+    ReplayResult( receive, totalPackets, totalBytes * uint64_t( numPasses ) );
+    ReplayResult( generate, totalPackets, generatedBytes );
+
+    for ( int i = 0; i < ReplayMaxClients; ++i )
+    {
+        YOJIMBO_DELETE( allocator, Connection, receivers[i] );
+        YOJIMBO_DELETE( allocator, Connection, senders[i] );
+    }
+
+    YOJIMBO_DELETE( *replayAllocator, TestMessageFactory, replayMessageFactory );
+    YOJIMBO_DELETE( GetDefaultAllocator(), TLSF_Allocator, replayAllocator );
+
+    free( allocatorMemory );
+    free( generatedPacket );
+    free( packets );
+
+    ShutdownYojimbo();
+
+    return 0;
+}
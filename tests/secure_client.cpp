@@ -63,6 +63,11 @@ int ClientMain( int argc, char * argv[] )
 
     matcher.RequestMatch( ProtocolId, clientId );
 
+    while ( matcher.GetMatchStatus() == MATCH_BUSY )
+    {
+        yojimbo_sleep( 0.01 );
+    }
+
     if ( matcher.GetMatchStatus() == MATCH_FAILED )
     {
         printf( "\nRequest match failed. Is the matcher running? Please run \"premake5 matcher\" before you connect a secure client\n" );
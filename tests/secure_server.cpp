@@ -57,6 +57,8 @@ int ServerMain()
 
     const double deltaTime = 0.1;
 
+    double nextTickTime = yojimbo_time();
+
     signal( SIGINT, interrupt_handler );    
 
     while ( !quit )
@@ -72,7 +74,9 @@ int ServerMain()
         if ( !server.IsRunning() )
             break;
 
-        yojimbo_sleep( deltaTime );
+        nextTickTime += deltaTime;
+
+        yojimbo_sleep_until( nextTickTime );
     }
 
     server.Stop();
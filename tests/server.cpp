@@ -52,7 +52,10 @@ int ServerMain()
 
     server.Start( MaxClients );
 
-    const double deltaTime = 0.1;
+    // sleep until the server has something to do, but wake up at least this often to pick up packets from the network
+
+    const double maxSleepTime = 0.1;
+    const double minSleepTime = 0.001;
 
     signal( SIGINT, interrupt_handler );    
 
@@ -62,14 +65,16 @@ int ServerMain()
 
         server.ReceivePackets();
 
-        time += deltaTime;
-
         server.AdvanceTime( time );
 
         if ( !server.IsRunning() )
             break;
 
-        yojimbo_sleep( deltaTime );
+        const double sleepTime = yojimbo_max( minSleepTime, yojimbo_min( maxSleepTime, server.GetNextEventTime() - time ) );
+
+        yojimbo_sleep( sleepTime );
+
+        time += sleepTime;
     }
 
     server.Stop();
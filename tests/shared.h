@@ -91,6 +91,8 @@ struct TestBlockMessage : public BlockMessage
     }
 
     YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+
+    YOJIMBO_MESSAGE_MAX_BITS( 16 );
 };
 
 struct TestSerializeFailOnReadMessage : public Message
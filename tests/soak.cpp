@@ -39,11 +39,16 @@ void interrupt_handler( int /*dummy*/ )
 static const int UNRELIABLE_UNORDERED_CHANNEL = 0;
 static const int RELIABLE_ORDERED_CHANNEL = 1;
 
-int SoakMain()
+int SoakMain( uint64_t seed )
 {
-    srand( (unsigned int) time( NULL ) );
+    printf( "seed %" PRIu64 "\n", seed );
+
+    // everything the soak test randomizes comes from this seed, so a failing run can be repeated
+
+    Random random( seed );
 
     ClientServerConfig config;
+    config.simulatorSeed = seed;
     config.maxPacketSize = MaxPacketSize;
     config.clientMemory = 10 * 1024 * 1024;
     config.serverGlobalMemory = 10 * 1024 * 1024;
@@ -108,14 +113,14 @@ int SoakMain()
             clientConnected = true;
 
 			{
-				const int messagesToSend = random_int( 0, 64 );
+				const int messagesToSend = random.GetInt( 0, 64 );
 
 				for ( int i = 0; i < messagesToSend; ++i )
 				{
 					if ( !client.CanSendMessage( RELIABLE_ORDERED_CHANNEL ) )
 						break;
 
-					if ( rand() % 25 )
+					if ( random.GetInt( 0, 24 ) )
 					{
 						TestMessage * message = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
 						if ( message )
@@ -156,14 +161,14 @@ int SoakMain()
             {
                 serverConnected = true;
 
-                const int messagesToSend = random_int( 0, 64 );
+                const int messagesToSend = random.GetInt( 0, 64 );
 
                 for ( int i = 0; i < messagesToSend; ++i )
                 {
                     if ( !server.CanSendMessage( clientIndex, RELIABLE_ORDERED_CHANNEL ) )
                         break;
 
-                    if ( rand() % 25 )
+                    if ( random.GetInt( 0, 24 ) )
                     {
                         TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
                         if ( message )
@@ -320,7 +325,7 @@ int SoakMain()
     return 0;
 }
 
-int main()
+int main( int argc, char ** argv )
 {
     printf( "\nsoak\n" );
 
@@ -334,7 +339,11 @@ int main()
 
     srand( (unsigned int) time( NULL ) );
 
-    int result = SoakMain();
+    uint64_t seed = ( argc > 1 ) ? strtoull( argv[1], NULL, 10 ) : 0;
+    if ( seed == 0 )
+        seed = (uint64_t) time( NULL );
+
+    int result = SoakMain( seed );
 
     ShutdownYojimbo();
 
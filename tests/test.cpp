@@ -129,6 +129,74 @@ void test_queue()
     check( queue.GetSize() == QueueSize );
 }
 
+struct SPSCQueueTestData
+{
+    SPSCQueue<int> * queue;
+    int numValues;
+};
+
+static void spsc_queue_producer( void * context )
+{
+    SPSCQueueTestData * data = (SPSCQueueTestData*) context;
+    for ( int i = 0; i < data->numValues; ++i )
+    {
+        while ( !data->queue->Push( i ) )
+        {
+            // spin until the consumer catches up
+        }
+    }
+}
+
+void test_spsc_queue()
+{
+    const int QueueSize = 64;
+
+    SPSCQueue<int> queue( GetDefaultAllocator(), QueueSize );
+
+    check( queue.IsEmpty() );
+    check( !queue.IsFull() );
+    check( queue.GetSize() == QueueSize );
+
+    for ( int i = 0; i < QueueSize; ++i )
+        check( queue.Push( i ) );
+
+    check( queue.IsFull() );
+    check( !queue.Push( QueueSize ) );
+
+    int value = -1;
+    check( queue.Peek( value ) );
+    check( value == 0 );
+
+    for ( int i = 0; i < QueueSize; ++i )
+    {
+        check( queue.Pop( value ) );
+        check( value == i );
+    }
+
+    check( queue.IsEmpty() );
+    check( !queue.Pop( value ) );
+
+    SPSCQueueTestData data;
+    data.queue = &queue;
+    data.numValues = 100000;
+
+    yojimbo_thread_t * thread = yojimbo_thread_create( spsc_queue_producer, &data );
+    check( thread );
+
+    for ( int i = 0; i < data.numValues; ++i )
+    {
+        while ( !queue.Pop( value ) )
+        {
+            // spin until the producer pushes the next value
+        }
+        check( value == i );
+    }
+
+    yojimbo_thread_join( thread );
+
+    check( queue.IsEmpty() );
+}
+
 void test_base64()
 {
     const int BufferSize = 256;
@@ -163,6 +231,107 @@ void test_base64()
     base64_decode_data( base64_key, decoded_key, KeyBytes );
 
     check( memcmp( key, decoded_key, KeyBytes ) == 0 );
+
+    // every padding case round trips, and bad input or a short output buffer fails
+
+    uint8_t data[64];
+    random_bytes( data, sizeof( data ) );
+
+    for ( int length = 1; length <= (int) sizeof( data ); ++length )
+    {
+        char base64_data[128];
+        check( base64_encode_data( data, length, base64_data, (int) sizeof( base64_data ) ) == ( ( length + 2 ) / 3 ) * 4 );
+        check( base64_encode_data( data, length, base64_data, ( ( length + 2 ) / 3 ) * 4 ) == -1 );
+
+        uint8_t decoded_data[64];
+        check( base64_decode_data( base64_data, decoded_data, length ) == length );
+        check( memcmp( data, decoded_data, length ) == 0 );
+        if ( length > 1 )
+            check( base64_decode_data( base64_data, decoded_data, length - 1 ) == -1 );
+    }
+
+    check( base64_decode_data( "AA=A", (uint8_t*) decoded, sizeof( decoded ) ) == -1 );
+    check( base64_decode_data( "A$AA", (uint8_t*) decoded, sizeof( decoded ) ) == -1 );
+}
+
+void test_hash()
+{
+    const char * a = "The quick brown fox jumps over the lazy dog";
+
+    for ( int length = 0; length <= (int) strlen( a ); ++length )
+    {
+        check( wyhash_64( a, length, 0 ) == wyhash_64( a, length, 0 ) );
+        check( wyhash_64( a, length, 0 ) != wyhash_64( a, length, 1 ) );
+        if ( length > 0 )
+            check( wyhash_64( a, length, 0 ) != wyhash_64( a, length - 1, 0 ) );
+    }
+
+    char b[64];
+    strcpy( b, a );
+    b[20] ^= 1;
+    check( wyhash_64( a, (uint32_t) strlen( a ), 0 ) != wyhash_64( b, (uint32_t) strlen( b ), 0 ) );
+}
+
+void test_lz4()
+{
+    const int BufferSize = 64 * 1024;
+
+    uint8_t * input = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), BufferSize );
+    uint8_t * compressed = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), lz4_compress_bound( BufferSize ) );
+    uint8_t * decompressed = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), BufferSize );
+
+    // repetitive data compresses
+
+    for ( int i = 0; i < BufferSize; ++i )
+        input[i] = uint8_t( "the quick brown fox jumps over the lazy dog"[ ( i / 3 ) % 43 ] );
+
+    int compressedBytes = lz4_compress_data( input, BufferSize, compressed, lz4_compress_bound( BufferSize ) );
+    check( compressedBytes > 0 );
+    check( compressedBytes < BufferSize / 10 );
+    check( lz4_decompress_data( compressed, compressedBytes, decompressed, BufferSize ) == BufferSize );
+    check( memcmp( input, decompressed, BufferSize ) == 0 );
+
+    // so does data that is left too small for the output buffer
+
+    check( lz4_decompress_data( compressed, compressedBytes, decompressed, BufferSize - 1 ) == -1 );
+
+    // random data doesn't, but still fits in the bound and round trips
+
+    random_bytes( input, BufferSize );
+
+    compressedBytes = lz4_compress_data( input, BufferSize, compressed, lz4_compress_bound( BufferSize ) );
+    check( compressedBytes >= BufferSize );
+    check( compressedBytes <= lz4_compress_bound( BufferSize ) );
+    check( lz4_decompress_data( compressed, compressedBytes, decompressed, BufferSize ) == BufferSize );
+    check( memcmp( input, decompressed, BufferSize ) == 0 );
+
+    // compressing into a buffer that is too small fails cleanly
+
+    check( lz4_compress_data( input, BufferSize, compressed, BufferSize / 2 ) == 0 );
+
+    // inputs smaller than the minimum match are all literals
+
+    for ( int i = 0; i <= 16; ++i )
+    {
+        compressedBytes = lz4_compress_data( input, i, compressed, lz4_compress_bound( i ) );
+        check( compressedBytes > 0 );
+        check( lz4_decompress_data( compressed, compressedBytes, decompressed, BufferSize ) == i );
+        check( memcmp( input, decompressed, i ) == 0 );
+    }
+
+    // garbage input is rejected or decoded within bounds, never read or written out of range
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        const int bytes = random_int( 1, 256 );
+        random_bytes( compressed, bytes );
+        const int result = lz4_decompress_data( compressed, bytes, decompressed, 1024 );
+        check( result >= -1 && result <= 1024 );
+    }
+
+    YOJIMBO_FREE( GetDefaultAllocator(), input );
+    YOJIMBO_FREE( GetDefaultAllocator(), compressed );
+    YOJIMBO_FREE( GetDefaultAllocator(), decompressed );
 }
 
 void test_bitpacker()
@@ -224,6 +393,81 @@ void test_bitpacker()
     check( reader.GetBitsRemaining() == bytesWritten * 8 - bitsWritten );
 }
 
+void test_bitpacker_wire_format()
+{
+    // The bitpacker can flush 32 or 64 bits at a time. Either way, the bytes must match plain little endian, low bit first packing.
+
+    const int BufferSize = 1004;
+    const int NumValues = 200;
+
+    uint8_t buffer[BufferSize];
+    uint8_t expected[BufferSize];
+    memset( buffer, 0, sizeof( buffer ) );
+    memset( expected, 0, sizeof( expected ) );
+
+    uint32_t values[NumValues];
+    int bits[NumValues];
+
+    uint8_t bytes[37];
+    for ( int i = 0; i < (int) sizeof( bytes ); ++i )
+        bytes[i] = uint8_t( i * 7 + 1 );
+
+    const int BytesIndex = NumValues / 2;
+
+    BitWriter writer( buffer, BufferSize );
+
+    int expectedBits = 0;
+
+    for ( int i = 0; i < NumValues; ++i )
+    {
+        if ( i == BytesIndex )
+        {
+            int alignBits = writer.GetAlignBits();
+            writer.WriteAlign();
+            writer.WriteBytes( bytes, sizeof( bytes ) );
+            expectedBits += alignBits;
+            memcpy( expected + expectedBits / 8, bytes, sizeof( bytes ) );
+            expectedBits += sizeof( bytes ) * 8;
+        }
+
+        bits[i] = random_int( 1, 32 );
+        values[i] = ( bits[i] == 32 ) ? uint32_t( rand() ) * 65536 + uint32_t( rand() ) : uint32_t( rand() ) & ( ( 1U << bits[i] ) - 1 );
+        writer.WriteBits( values[i], bits[i] );
+
+        for ( int j = 0; j < bits[i]; ++j )
+        {
+            if ( values[i] & ( 1U << j ) )
+                expected[expectedBits / 8] |= uint8_t( 1 << ( expectedBits % 8 ) );
+            expectedBits++;
+        }
+    }
+
+    writer.FlushBits();
+
+    check( writer.GetBitsWritten() == expectedBits );
+
+    const int bytesWritten = writer.GetBytesWritten();
+
+    check( memcmp( buffer, expected, bytesWritten ) == 0 );
+
+    BitReader reader( buffer, bytesWritten );
+
+    for ( int i = 0; i < NumValues; ++i )
+    {
+        if ( i == BytesIndex )
+        {
+            uint8_t readBytes[sizeof( bytes )];
+            check( reader.ReadAlign() );
+            reader.ReadBytes( readBytes, sizeof( readBytes ) );
+            check( memcmp( readBytes, bytes, sizeof( bytes ) ) == 0 );
+        }
+
+        check( reader.ReadBits( bits[i] ) == values[i] );
+    }
+
+    check( reader.GetBitsRead() == expectedBits );
+}
+
 const int MaxItems = 11;
 
 struct TestData
@@ -362,87 +606,601 @@ void test_stream()
     check( readObject == writeObject );
 }
 
-bool parse_address( const char string[] )
+void test_stream_rollback()
 {
-    Address address( string );
-    return address.IsValid();
+    const int BufferSize = 16;
+
+    uint8_t buffer[BufferSize];
+    memset( buffer, 0, sizeof( buffer ) );
+
+    uint8_t bytes[BufferSize];
+    memset( bytes, 0xFF, sizeof( bytes ) );
+
+    WriteStream writeStream( GetDefaultAllocator(), buffer, BufferSize );
+
+    const int countBitIndex = writeStream.GetBitsProcessed();
+
+    check( writeStream.SerializeInteger( 0, 0, 10 ) );
+    check( writeStream.SerializeBits( 0xABCD, 16 ) );
+
+    WriteStream::Checkpoint checkpoint = writeStream.GetCheckpoint();
+
+    check( writeStream.SerializeBits( 0x1234, 16 ) );
+    check( !writeStream.SerializeBytes( bytes, BufferSize ) );
+    check( writeStream.IsOverflow() );
+
+    writeStream.Rollback( checkpoint );
+
+    check( !writeStream.IsOverflow() );
+    check( writeStream.SerializeBits( 0x5678, 16 ) );
+
+    writeStream.PatchInteger( countBitIndex, 7, 0, 10 );
+    writeStream.Flush();
+
+    ReadStream readStream( GetDefaultAllocator(), buffer, writeStream.GetBytesProcessed() );
+
+    int32_t count = 0;
+    uint32_t first = 0;
+    uint32_t second = 0;
+
+    check( readStream.SerializeInteger( count, 0, 10 ) );
+    check( readStream.SerializeBits( first, 16 ) );
+    check( readStream.SerializeBits( second, 16 ) );
+
+    check( count == 7 );
+    check( first == 0xABCD );
+    check( second == 0x5678 );
 }
 
-void test_address()
+struct TestRange
 {
-    check( parse_address( "" ) == false );
-    check( parse_address( "[" ) == false );
-    check( parse_address( "[]" ) == false );
-    check( parse_address( "[]:" ) == false );
-    check( parse_address( ":" ) == false );
-    check( parse_address( "1" ) == false );
-    check( parse_address( "12" ) == false );
-    check( parse_address( "123" ) == false );
-    check( parse_address( "1234" ) == false );
-    check( parse_address( "1234.0.12313.0000" ) == false );
-    check( parse_address( "1234.0.12313.0000.0.0.0.0.0" ) == false );
-    check( parse_address( "1312313:123131:1312313:123131:1312313:123131:1312313:123131:1312313:123131:1312313:123131" ) == false );
-    check( parse_address( "." ) == false );
-    check( parse_address( ".." ) == false );
-    check( parse_address( "..." ) == false );
-    check( parse_address( "...." ) == false );
-    check( parse_address( "....." ) == false );
+    int32_t value;
 
+    template <typename Stream> bool Serialize( Stream & stream )
     {
-        Address address( "107.77.207.77" );
-        check( address.IsValid() );
-        check( address.GetType() == ADDRESS_IPV4 );
-        check( address.GetPort() == 0 );
-        check( address.GetAddress4()[0] == 107 );
-        check( address.GetAddress4()[1] == 77 );
-        check( address.GetAddress4()[2] == 207 );
-        check( address.GetAddress4()[3] == 77 );
-        check( !address.IsLoopback() );
+        serialize_int( stream, value, 0, 10 );
+        return true;
     }
+};
+
+void test_stream_unchecked()
+{
+    const int BufferSize = 1024;
+
+    uint8_t buffer[BufferSize];
+
+    TestContext context;
+    context.min = -10;
+    context.max = +10;
+
+    WriteStream writeStream( GetDefaultAllocator(), buffer, BufferSize );
+    writeStream.SetContext( &context );
+
+    TestObject writeObject;
+    writeObject.Init();
+    check( writeStream.SerializeBits( 0x1234, 16 ) );
+    writeObject.Serialize( writeStream );
+    check( writeStream.SerializeBits( 0x5678, 16 ) );
+    check( writeStream.SerializeBits( 15, 4 ) );
+    writeStream.Flush();
+
+    const int bytesWritten = writeStream.GetBytesProcessed();
+
+    memset( buffer + bytesWritten, 0, BufferSize - bytesWritten );
+
+    ReadStream readStream( GetDefaultAllocator(), buffer, bytesWritten );
+    readStream.SetContext( &context );
+
+    uint32_t header = 0;
+    check( readStream.SerializeBits( header, 16 ) );
+    check( header == 0x1234 );
+
+    // the unchecked stream carries on from the read stream, and hands the read position back when finished
+
+    check( !readStream.WouldReadPastEnd( 64 ) );
+    check( readStream.WouldReadPastEnd( bytesWritten * 8 ) );
+
+    TestObject readObject;
+    UncheckedReadStream uncheckedStream( readStream );
+    check( uncheckedStream.GetContext() == &context );
+    check( readObject.Serialize( uncheckedStream ) );
+    check( readObject == writeObject );
+    check( readStream.GetBitsProcessed() == 16 );
+    uncheckedStream.Finish( readStream );
+    check( readStream.GetBitsProcessed() == uncheckedStream.GetBitsProcessed() );
+
+    uint32_t trailer = 0;
+    check( readStream.SerializeBits( trailer, 16 ) );
+    check( trailer == 0x5678 );
 
+    // values outside their range still fail the read
+
+    TestRange range;
+    UncheckedReadStream rangeStream( readStream );
+    check( !range.Serialize( rangeStream ) );
+}
+
+struct TestArrays
+{
+    enum { NumValues = 101 };
+
+    bool scalar;
+    uint32_t flags;
+    int32_t ids[NumValues];
+    uint32_t bytes[NumValues];
+    uint32_t shorts[NumValues];
+    uint32_t words[NumValues];
+    uint32_t packed[NumValues];
+
+    template <typename Stream> bool Serialize( Stream & stream )
     {
-        Address address( "127.0.0.1" );
-        check( address.IsValid() );
-        check( address.GetType() == ADDRESS_IPV4 );
-        check( address.GetPort() == 0 );
-        check( address.GetAddress4()[0] == 127 );
-        check( address.GetAddress4()[1] == 0 );
-        check( address.GetAddress4()[2] == 0 );
-        check( address.GetAddress4()[3] == 1 );
-        check( address.IsLoopback() );
+        // the first arrays start dword aligned, the rest don't
+
+        if ( scalar )
+        {
+            for ( int i = 0; i < NumValues; ++i )
+                serialize_bits( stream, bytes[i], 8 );
+            for ( int i = 0; i < NumValues; ++i )
+                serialize_bits( stream, shorts[i], 16 );
+            serialize_bits( stream, flags, 3 );
+            for ( int i = 0; i < NumValues; ++i )
+                serialize_int( stream, ids[i], -1000, 1000 );
+            for ( int i = 0; i < NumValues; ++i )
+                serialize_bits( stream, words[i], 32 );
+            for ( int i = 0; i < NumValues; ++i )
+                serialize_bits( stream, packed[i], 5 );
+        }
+        else
+        {
+            serialize_bits_array( stream, bytes, NumValues, 8 );
+            serialize_bits_array( stream, shorts, NumValues, 16 );
+            serialize_bits( stream, flags, 3 );
+            serialize_int_array( stream, ids, NumValues, -1000, 1000 );
+            serialize_bits_array( stream, words, NumValues, 32 );
+            serialize_bits_array( stream, packed, NumValues, 5 );
+        }
+        return true;
     }
+};
 
+void test_serialize_arrays()
+{
+    const int BufferSize = 4096;
+
+    uint8_t scalarBuffer[BufferSize];
+    uint8_t arrayBuffer[BufferSize];
+    memset( scalarBuffer, 0, sizeof( scalarBuffer ) );
+    memset( arrayBuffer, 0, sizeof( arrayBuffer ) );
+
+    TestArrays writeObject;
+    writeObject.flags = 5;
+    for ( int i = 0; i < TestArrays::NumValues; ++i )
     {
-        Address address( "107.77.207.77:40000" );
-        check( address.IsValid() );
-        check( address.GetType() == ADDRESS_IPV4 );
-        check( address.GetPort() == 40000 );
-        check( address.GetAddress4()[0] == 107 );
-        check( address.GetAddress4()[1] == 77 );
-        check( address.GetAddress4()[2] == 207 );
-        check( address.GetAddress4()[3] == 77 );
-        check( !address.IsLoopback() );
+        writeObject.ids[i] = random_int( -1000, 1000 );
+        writeObject.bytes[i] = uint32_t( rand() ) & 0xFF;
+        writeObject.shorts[i] = uint32_t( rand() ) & 0xFFFF;
+        writeObject.words[i] = uint32_t( rand() ) * 65536 + uint32_t( rand() );
+        writeObject.packed[i] = uint32_t( rand() ) & 31;
     }
 
+    // arrays must produce exactly the same bits as serializing each value
+
+    writeObject.scalar = true;
+    WriteStream scalarStream( GetDefaultAllocator(), scalarBuffer, BufferSize );
+    check( writeObject.Serialize( scalarStream ) );
+    scalarStream.Flush();
+
+    writeObject.scalar = false;
+    WriteStream arrayStream( GetDefaultAllocator(), arrayBuffer, BufferSize );
+    check( writeObject.Serialize( arrayStream ) );
+    arrayStream.Flush();
+
+    MeasureStream measureStream( GetDefaultAllocator() );
+    check( writeObject.Serialize( measureStream ) );
+
+    check( arrayStream.GetBitsProcessed() == scalarStream.GetBitsProcessed() );
+    check( measureStream.GetBitsProcessed() == scalarStream.GetBitsProcessed() );
+    check( memcmp( scalarBuffer, arrayBuffer, scalarStream.GetBytesProcessed() ) == 0 );
+
+    TestArrays readObject;
+    readObject.scalar = false;
+    ReadStream readStream( GetDefaultAllocator(), arrayBuffer, arrayStream.GetBytesProcessed() );
+    check( readObject.Serialize( readStream ) );
+
+    check( readObject.flags == writeObject.flags );
+    check( memcmp( readObject.ids, writeObject.ids, sizeof( writeObject.ids ) ) == 0 );
+    check( memcmp( readObject.bytes, writeObject.bytes, sizeof( writeObject.bytes ) ) == 0 );
+    check( memcmp( readObject.shorts, writeObject.shorts, sizeof( writeObject.shorts ) ) == 0 );
+    check( memcmp( readObject.words, writeObject.words, sizeof( writeObject.words ) ) == 0 );
+    check( memcmp( readObject.packed, writeObject.packed, sizeof( writeObject.packed ) ) == 0 );
+
+    // ids out of range are rejected on read
+
+    WriteStream badStream( GetDefaultAllocator(), arrayBuffer, BufferSize );
+    uint32_t badIds[TestArrays::NumValues];
+    const int idBits = bits_required( -1000, 1000 );
+    for ( int i = 0; i < TestArrays::NumValues; ++i )
+        badIds[i] = ( 1 << idBits ) - 1;
+    check( badStream.SerializeBitsArray( badIds, TestArrays::NumValues, idBits ) );
+    badStream.Flush();
+
+    int32_t ids[TestArrays::NumValues];
+    ReadStream badReadStream( GetDefaultAllocator(), arrayBuffer, badStream.GetBytesProcessed() );
+    check( !serialize_int_array_internal( badReadStream, ids, TestArrays::NumValues, -1000, 1000 ) );
+}
+
+struct TestBytesView
+{
+    uint32_t a;
+    int length;
+    const uint8_t * payload;
+    uint32_t b;
+
+    template <typename Stream> bool Serialize( Stream & stream )
     {
-        Address address( "127.0.0.1:40000" );
-        check( address.IsValid() );
-        check( address.GetType() == ADDRESS_IPV4 );
-        check( address.GetPort() == 40000 );
-        check( address.GetAddress4()[0] == 127 );
-        check( address.GetAddress4()[1] == 0 );
-        check( address.GetAddress4()[2] == 0 );
-        check( address.GetAddress4()[3] == 1 );
-        check( address.IsLoopback() );
+        serialize_bits( stream, a, 11 );
+        serialize_int( stream, length, 0, 256 );
+        serialize_bytes_view( stream, payload, length );
+        serialize_bits( stream, b, 13 );
+        return true;
     }
+};
+
+void test_serialize_bytes_view()
+{
+    const int BufferSize = 1024;
+
+    uint8_t buffer[BufferSize];
+
+    uint8_t payload[256];
+    for ( int i = 0; i < (int) sizeof( payload ); ++i )
+        payload[i] = uint8_t( i * 7 + 3 );
 
+    for ( int length = 0; length <= 256; length += 37 )
     {
-        Address address( "fe80::202:b3ff:fe1e:8329" );
-        check( address.IsValid() );
-        check( address.GetType() == ADDRESS_IPV6 );
-        check( address.GetPort() == 0 );
-        check( address.GetAddress6()[0] == 0xfe80 );
-        check( address.GetAddress6()[1] == 0x0000 );
+        memset( buffer, 0, sizeof( buffer ) );
+
+        TestBytesView writeObject;
+        writeObject.a = 1001;
+        writeObject.length = length;
+        writeObject.payload = payload;
+        writeObject.b = 7777;
+
+        WriteStream writeStream( GetDefaultAllocator(), buffer, BufferSize );
+        check( writeObject.Serialize( writeStream ) );
+        writeStream.Flush();
+
+        MeasureStream measureStream( GetDefaultAllocator() );
+        check( writeObject.Serialize( measureStream ) );
+        check( measureStream.GetBitsProcessed() >= writeStream.GetBitsProcessed() );
+
+        const int bytesWritten = writeStream.GetBytesProcessed();
+
+        TestBytesView readObject;
+        memset( &readObject, 0, sizeof( readObject ) );
+        ReadStream readStream( GetDefaultAllocator(), buffer, bytesWritten );
+        check( readObject.Serialize( readStream ) );
+
+        check( readObject.a == writeObject.a );
+        check( readObject.length == length );
+        check( readObject.b == writeObject.b );
+
+        // the payload is referenced in place, not copied
+
+        check( readObject.payload >= buffer );
+        check( readObject.payload + length <= buffer + bytesWritten );
+        check( memcmp( readObject.payload, payload, length ) == 0 );
+
+        // a view past the end of the packet fails to read
+
+        ReadStream truncatedStream( GetDefaultAllocator(), buffer, ( readObject.payload - buffer ) + length / 2 );
+        check( length < 2 || !readObject.Serialize( truncatedStream ) );
+    }
+}
+
+struct TestVarints
+{
+    uint16_t a;
+    uint32_t b;
+    uint64_t c;
+    int32_t d;
+    int64_t e;
+    uint32_t f;
+    uint32_t g;
+    uint32_t h;
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_varint( stream, a, 7 );
+        serialize_varint( stream, b, 5 );
+        serialize_varint( stream, c, 16 );
+        serialize_varint_signed( stream, d, 4 );
+        serialize_varint_signed( stream, e, 7 );
+        serialize_exp_golomb( stream, f, 0 );
+        serialize_exp_golomb( stream, g, 4 );
+        serialize_exp_golomb( stream, h, 31 );
+        return true;
+    }
+
+    int ExpectedBits() const
+    {
+        return varint_bits( a, 16, 7 ) + 
+               varint_bits( b, 32, 5 ) + 
+               varint_bits( c, 64, 16 ) + 
+               varint_bits( zigzag_encode( d ), 32, 4 ) + 
+               varint_bits( zigzag_encode( e ), 64, 7 ) + 
+               exp_golomb_bits( f, 0 ) + 
+               exp_golomb_bits( g, 4 ) + 
+               exp_golomb_bits( h, 31 );
+    }
+};
+
+void test_serialize_varint()
+{
+    check( zigzag_encode( 0 ) == 0 );
+    check( zigzag_encode( -1 ) == 1 );
+    check( zigzag_encode( 1 ) == 2 );
+    check( zigzag_encode( -2 ) == 3 );
+    check( zigzag_decode( zigzag_encode( INT64_MIN ) ) == INT64_MIN );
+    check( zigzag_decode( zigzag_encode( INT64_MAX ) ) == INT64_MAX );
+
+    check( varint_bits( 0, 32, 7 ) == 8 );
+    check( varint_bits( 127, 32, 7 ) == 8 );
+    check( varint_bits( 128, 32, 7 ) == 16 );
+    check( varint_bits( 0xFFFFFFFF, 32, 7 ) == 35 + 4 );
+    check( exp_golomb_bits( 0, 0 ) == 1 );
+    check( exp_golomb_bits( 1, 0 ) == 3 );
+    check( exp_golomb_bits( 0xFFFFFFFF, 0 ) == 65 );
+
+    const uint64_t values[] = { 0, 1, 2, 15, 16, 127, 128, 1000, 65535, 65536, 0x7FFFFFFF, 0xFFFFFFFF, 0x100000000ULL, 0xFFFFFFFFFFFFFFFFULL };
+    const int numValues = sizeof( values ) / sizeof( values[0] );
+
+    const int BufferSize = 256;
+    uint8_t buffer[BufferSize];
+
+    for ( int i = 0; i < numValues; ++i )
+    {
+        TestVarints writeObject;
+        writeObject.a = uint16_t( values[i] );
+        writeObject.b = uint32_t( values[i] );
+        writeObject.c = values[i];
+        writeObject.d = ( i & 1 ) ? -int32_t( values[i] & 0x7FFFFFFF ) : int32_t( values[i] & 0x7FFFFFFF );
+        writeObject.e = ( i & 1 ) ? int64_t( values[i] ) : -int64_t( values[i] >> 1 );
+        writeObject.f = uint32_t( values[i] );
+        writeObject.g = uint32_t( values[i] );
+        writeObject.h = uint32_t( values[i] );
+
+        memset( buffer, 0, sizeof( buffer ) );
+
+        WriteStream writeStream( GetDefaultAllocator(), buffer, BufferSize );
+        check( writeObject.Serialize( writeStream ) );
+        writeStream.Flush();
+
+        MeasureStream measureStream( GetDefaultAllocator() );
+        check( writeObject.Serialize( measureStream ) );
+
+        check( writeStream.GetBitsProcessed() == writeObject.ExpectedBits() );
+        check( measureStream.GetBitsProcessed() == writeObject.ExpectedBits() );
+
+        TestVarints readObject;
+        memset( &readObject, 0, sizeof( readObject ) );
+        ReadStream readStream( GetDefaultAllocator(), buffer, writeStream.GetBytesProcessed() );
+        check( readObject.Serialize( readStream ) );
+
+        check( readObject.a == writeObject.a );
+        check( readObject.b == writeObject.b );
+        check( readObject.c == writeObject.c );
+        check( readObject.d == writeObject.d );
+        check( readObject.e == writeObject.e );
+        check( readObject.f == writeObject.f );
+        check( readObject.g == writeObject.g );
+        check( readObject.h == writeObject.h );
+    }
+
+    // encodings longer than the value type are rejected on read
+
+    memset( buffer, 0xFF, sizeof( buffer ) );
+    {
+        uint32_t value = 0;
+        ReadStream readStream( GetDefaultAllocator(), buffer, BufferSize );
+        check( !serialize_varint_internal( readStream, value, 7 ) );
+    }
+
+    memset( buffer, 0, sizeof( buffer ) );
+    {
+        uint32_t value = 0;
+        ReadStream readStream( GetDefaultAllocator(), buffer, BufferSize );
+        check( !serialize_exp_golomb_internal( readStream, value, 3 ) );
+    }
+}
+
+struct TestCompressed
+{
+    float value;
+    float position[3];
+    float orientation[4];
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_compressed_float( stream, value, -10.0f, 10.0f, 0.01f );
+        serialize_compressed_vector( stream, position, -1000.0f, 1000.0f, 0.05f );
+        serialize_compressed_quaternion( stream, orientation, 10 );
+        return true;
+    }
+};
+
+void test_serialize_compressed()
+{
+    check( compressed_float_bits( -10.0f, 10.0f, 0.01f ) == 11 );
+    check( compressed_float_bits( -1000.0f, 1000.0f, 0.05f ) == 16 );
+
+    const int BufferSize = 256;
+    uint8_t buffer[BufferSize];
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        TestCompressed writeObject;
+        writeObject.value = random_float( -12.0f, 12.0f );
+        for ( int j = 0; j < 3; ++j )
+            writeObject.position[j] = random_float( -1000.0f, 1000.0f );
+
+        float length = 0.0f;
+        for ( int j = 0; j < 4; ++j )
+        {
+            writeObject.orientation[j] = random_float( -1.0f, 1.0f );
+            length += writeObject.orientation[j] * writeObject.orientation[j];
+        }
+        length = sqrtf( length );
+        for ( int j = 0; j < 4; ++j )
+            writeObject.orientation[j] /= length;
+
+        WriteStream writeStream( GetDefaultAllocator(), buffer, BufferSize );
+        check( writeObject.Serialize( writeStream ) );
+        writeStream.Flush();
+
+        MeasureStream measureStream( GetDefaultAllocator() );
+        check( writeObject.Serialize( measureStream ) );
+
+        check( writeStream.GetBitsProcessed() == 11 + 3 * 16 + 2 + 3 * 10 );
+        check( measureStream.GetBitsProcessed() == writeStream.GetBitsProcessed() );
+
+        TestCompressed readObject;
+        ReadStream readStream( GetDefaultAllocator(), buffer, writeStream.GetBytesProcessed() );
+        check( readObject.Serialize( readStream ) );
+
+        // values outside the range are clamped
+
+        const float expectedValue = yojimbo_max( -10.0f, yojimbo_min( 10.0f, writeObject.value ) );
+        check( fabsf( readObject.value - expectedValue ) <= 0.005f + 0.0001f );
+
+        for ( int j = 0; j < 3; ++j )
+            check( fabsf( readObject.position[j] - writeObject.position[j] ) <= 0.025f + 0.001f );
+
+        float dot = 0.0f;
+        for ( int j = 0; j < 4; ++j )
+            dot += readObject.orientation[j] * writeObject.orientation[j];
+        check( fabsf( dot ) > 0.999f );
+    }
+
+    // integer values past the maximum are rejected on read
+
+    memset( buffer, 0xFF, sizeof( buffer ) );
+    float value = 0.0f;
+    ReadStream readStream( GetDefaultAllocator(), buffer, BufferSize );
+    check( !serialize_compressed_float_internal( readStream, value, 0.0f, 10.0f, 1.0f ) );
+}
+
+bool parse_address( const char string[] )
+{
+    Address address( string );
+    return address.IsValid();
+}
+
+void test_serialize_relative_bits()
+{
+    for ( uint32_t difference = 1; difference < 100000; difference = ( difference < 300 ) ? difference + 1 : difference * 3 / 2 )
+    {
+        const uint32_t previous = 1000;
+        uint32_t current = previous + difference;
+        MeasureStream stream( GetDefaultAllocator() );
+        check( serialize_int_relative_internal( stream, previous, current ) );
+        check( stream.GetBitsProcessed() == int_relative_bits( previous, current ) );
+    }
+
+    for ( int i = 0; i < 65535; i += 17 )
+    {
+        const uint16_t sequence1 = 65000;
+        uint16_t sequence2 = uint16_t( sequence1 + 1 + i );
+        MeasureStream stream( GetDefaultAllocator() );
+        check( serialize_sequence_relative_internal( stream, sequence1, sequence2 ) );
+        check( stream.GetBitsProcessed() == sequence_relative_bits( sequence1, sequence2 ) );
+    }
+
+    for ( int i = 1; i < 65536; i += 13 )
+    {
+        const uint16_t sequence = 100;
+        uint16_t ack = uint16_t( sequence - i );
+        MeasureStream stream( GetDefaultAllocator() );
+        check( serialize_ack_relative_internal( stream, sequence, ack ) );
+        check( stream.GetBitsProcessed() == ack_relative_bits( sequence, ack ) );
+    }
+}
+
+void test_address()
+{
+    check( parse_address( "" ) == false );
+    check( parse_address( "[" ) == false );
+    check( parse_address( "[]" ) == false );
+    check( parse_address( "[]:" ) == false );
+    check( parse_address( ":" ) == false );
+    check( parse_address( "1" ) == false );
+    check( parse_address( "12" ) == false );
+    check( parse_address( "123" ) == false );
+    check( parse_address( "1234" ) == false );
+    check( parse_address( "1234.0.12313.0000" ) == false );
+    check( parse_address( "1234.0.12313.0000.0.0.0.0.0" ) == false );
+    check( parse_address( "1312313:123131:1312313:123131:1312313:123131:1312313:123131:1312313:123131:1312313:123131" ) == false );
+    check( parse_address( "." ) == false );
+    check( parse_address( ".." ) == false );
+    check( parse_address( "..." ) == false );
+    check( parse_address( "...." ) == false );
+    check( parse_address( "....." ) == false );
+
+    {
+        Address address( "107.77.207.77" );
+        check( address.IsValid() );
+        check( address.GetType() == ADDRESS_IPV4 );
+        check( address.GetPort() == 0 );
+        check( address.GetAddress4()[0] == 107 );
+        check( address.GetAddress4()[1] == 77 );
+        check( address.GetAddress4()[2] == 207 );
+        check( address.GetAddress4()[3] == 77 );
+        check( !address.IsLoopback() );
+    }
+
+    {
+        Address address( "127.0.0.1" );
+        check( address.IsValid() );
+        check( address.GetType() == ADDRESS_IPV4 );
+        check( address.GetPort() == 0 );
+        check( address.GetAddress4()[0] == 127 );
+        check( address.GetAddress4()[1] == 0 );
+        check( address.GetAddress4()[2] == 0 );
+        check( address.GetAddress4()[3] == 1 );
+        check( address.IsLoopback() );
+    }
+
+    {
+        Address address( "107.77.207.77:40000" );
+        check( address.IsValid() );
+        check( address.GetType() == ADDRESS_IPV4 );
+        check( address.GetPort() == 40000 );
+        check( address.GetAddress4()[0] == 107 );
+        check( address.GetAddress4()[1] == 77 );
+        check( address.GetAddress4()[2] == 207 );
+        check( address.GetAddress4()[3] == 77 );
+        check( !address.IsLoopback() );
+    }
+
+    {
+        Address address( "127.0.0.1:40000" );
+        check( address.IsValid() );
+        check( address.GetType() == ADDRESS_IPV4 );
+        check( address.GetPort() == 40000 );
+        check( address.GetAddress4()[0] == 127 );
+        check( address.GetAddress4()[1] == 0 );
+        check( address.GetAddress4()[2] == 0 );
+        check( address.GetAddress4()[3] == 1 );
+        check( address.IsLoopback() );
+    }
+
+    {
+        Address address( "fe80::202:b3ff:fe1e:8329" );
+        check( address.IsValid() );
+        check( address.GetType() == ADDRESS_IPV6 );
+        check( address.GetPort() == 0 );
+        check( address.GetAddress6()[0] == 0xfe80 );
+        check( address.GetAddress6()[1] == 0x0000 );
         check( address.GetAddress6()[2] == 0x0000 );
         check( address.GetAddress6()[3] == 0x0000 );
         check( address.GetAddress6()[4] == 0x0202 );
@@ -657,937 +1415,9196 @@ void test_address()
         check( address.GetPort() == 65535 );
         check( strcmp( address.ToString( buffer, MaxAddressLength ), "[::1]:65535" ) == 0 );
     }
+
+    {
+        check( Address( "127.0.0.1:40000" ).GetHash() == Address( 127, 0, 0, 1, 40000 ).GetHash() );
+        check( Address( "127.0.0.1:40000" ).GetHash() != Address( "127.0.0.1:40001" ).GetHash() );
+        check( Address( "127.0.0.1:40000" ).GetHash() != Address( "127.0.0.2:40000" ).GetHash() );
+        check( Address( "[::1]:40000" ).GetHash() == Address( 0, 0, 0, 0, 0, 0, 0, 1, 40000 ).GetHash() );
+        check( Address( "[::1]:40000" ).GetHash() != Address( "[::2]:40000" ).GetHash() );
+    }
 }
 
-void test_bit_array()
+void test_socket()
 {
-    const int Size = 300;
-
-    BitArray bit_array( GetDefaultAllocator(), Size );
+    Socket socket( Address( "127.0.0.1:0" ) );
+    check( !socket.IsError() );
+    check( socket.GetAddress().GetPort() != 0 );
 
-    // verify initial conditions
+    uint8_t packetData[256];
+    for ( int i = 0; i < (int) sizeof( packetData ); ++i )
+        packetData[i] = (uint8_t) i;
 
-    check( bit_array.GetSize() == Size );
+    check( socket.SendPacket( socket.GetAddress(), packetData, sizeof( packetData ) ) );
 
-    for ( int i = 0; i < Size; ++i )
+    Address from;
+    uint8_t receiveData[TrustedMaxPacketBytes];
+    int receiveBytes = 0;
+    for ( int i = 0; i < 100 && receiveBytes == 0; ++i )
     {
-        check( bit_array.GetBit(i) == 0 );
+        receiveBytes = socket.ReceivePacket( from, receiveData, sizeof( receiveData ) );
+        if ( receiveBytes == 0 )
+            yojimbo_sleep( 0.01 );
     }
 
-    // set every third bit and verify correct bits are set on read
+    check( receiveBytes == (int) sizeof( packetData ) );
+    check( from == socket.GetAddress() );
+    check( memcmp( receiveData, packetData, sizeof( packetData ) ) == 0 );
+    check( socket.ReceivePacket( from, receiveData, sizeof( receiveData ) ) == 0 );
 
-    for ( int i = 0; i < Size; ++i )
-    {
-        if ( ( i % 3 ) == 0 )
-            bit_array.SetBit( i );
-    }
+    // a header and payload sent as a gather list arrive as one packet
 
-    for ( int i = 0; i < Size; ++i )
+    const uint8_t header = 0xFF;
+    check( socket.SendPacket( socket.GetAddress(), &header, 1, packetData, sizeof( packetData ) ) );
+
+    receiveBytes = 0;
+    for ( int i = 0; i < 100 && receiveBytes == 0; ++i )
     {
-        if ( ( i % 3 ) == 0 )
-        {
-            check( bit_array.GetBit( i ) == 1 );
-        }
-        else
-        {
-            check( bit_array.GetBit( i ) == 0 );
-        }
+        receiveBytes = socket.ReceivePacket( from, receiveData, sizeof( receiveData ) );
+        if ( receiveBytes == 0 )
+            yojimbo_sleep( 0.01 );
     }
 
-    // now clear every third bit to zero and verify all bits are zero
+    check( receiveBytes == 1 + (int) sizeof( packetData ) );
+    check( receiveData[0] == header );
+    check( memcmp( receiveData + 1, packetData, sizeof( packetData ) ) == 0 );
 
-    for ( int i = 0; i < Size; ++i )
-    {
-        if ( ( i % 3 ) == 0 )
-            bit_array.ClearBit( i );
-    }
+    // batches larger than one system call are split up, and come back in order
 
-    for ( int i = 0; i < Size; ++i )
+    const int NumBatchPackets = SocketBatchSize + 5;
+
+    Address batchTo[NumBatchPackets];
+    uint8_t batchData[NumBatchPackets][16];
+    uint8_t * batchPacketData[NumBatchPackets];
+    int batchPacketBytes[NumBatchPackets];
+    for ( int i = 0; i < NumBatchPackets; ++i )
     {
-        check( bit_array.GetBit(i) == 0 );
+        batchTo[i] = socket.GetAddress();
+        memset( batchData[i], i, sizeof( batchData[i] ) );
+        batchPacketData[i] = batchData[i];
+        batchPacketBytes[i] = 1 + i % 16;
     }
 
-    // now set some more bits
+    check( socket.SendPackets( batchTo, batchPacketData, batchPacketBytes, NumBatchPackets ) == NumBatchPackets );
 
-    for ( int i = 0; i < Size; ++i )
+    Address batchFrom[NumBatchPackets];
+    uint8_t batchReceiveData[NumBatchPackets][64];
+    uint8_t * batchReceivePacketData[NumBatchPackets];
+    int batchReceivePacketBytes[NumBatchPackets];
+    for ( int i = 0; i < NumBatchPackets; ++i )
+        batchReceivePacketData[i] = batchReceiveData[i];
+
+    int numReceived = 0;
+    for ( int i = 0; i < 100 && numReceived < NumBatchPackets; ++i )
     {
-        if ( ( i % 10 ) == 0 )
-            bit_array.SetBit( i );
+        numReceived += socket.ReceivePackets( batchFrom + numReceived, batchReceivePacketData + numReceived, batchReceivePacketBytes + numReceived, 64, NumBatchPackets - numReceived );
+        if ( numReceived < NumBatchPackets )
+            yojimbo_sleep( 0.01 );
     }
 
-    for ( int i = 0; i < Size; ++i )
+    check( numReceived == NumBatchPackets );
+    for ( int i = 0; i < NumBatchPackets; ++i )
     {
-        if ( ( i % 10 ) == 0 )
-        {
-            check( bit_array.GetBit( i ) == 1 );
-        }
-        else
-        {
-            check( bit_array.GetBit( i ) == 0 );
-        }
+        check( batchFrom[i] == socket.GetAddress() );
+        check( batchReceivePacketBytes[i] == batchPacketBytes[i] );
+        check( memcmp( batchReceiveData[i], batchData[i], batchPacketBytes[i] ) == 0 );
     }
 
-    // clear and verify all bits are zero
+#if defined( __linux__ )
+    {
+        // with reuse port, shards bind the same port
 
-    bit_array.Clear();
+        Socket shard( Address( "127.0.0.1:0" ), 256 * 1024, 256 * 1024, false, true );
+        check( !shard.IsError() );
+        Socket otherShard( shard.GetAddress(), 256 * 1024, 256 * 1024, false, true );
+        check( !otherShard.IsError() );
+        check( otherShard.GetAddress() == shard.GetAddress() );
+    }
+#endif // #if defined( __linux__ )
 
-    for ( int i = 0; i < Size; ++i )
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 1, KeyBytes );
+    uint8_t auth[TrustedAuthBytes];
+    uint8_t otherAuth[TrustedAuthBytes];
+    trusted_connect_auth( privateKey, 1, 2, auth );
+    trusted_connect_auth( privateKey, 1, 2, otherAuth );
+    check( memcmp( auth, otherAuth, TrustedAuthBytes ) == 0 );
+    trusted_connect_auth( privateKey, 1, 3, otherAuth );
+    check( memcmp( auth, otherAuth, TrustedAuthBytes ) != 0 );
+}
+
+static int test_relay_receive( Relay & relay, Socket & socket, double time, Address & from, uint8_t * packetData, int maxPacketBytes )
+{
+    for ( int i = 0; i < 100; ++i )
     {
-        check( bit_array.GetBit(i) == 0 );
+        relay.Update( time );
+        const int packetBytes = socket.ReceivePacket( from, packetData, maxPacketBytes );
+        if ( packetBytes > 0 )
+            return packetBytes;
+        yojimbo_sleep( 0.01 );
     }
+    return 0;
 }
 
-struct TestSequenceData
+void test_relay()
 {
-    TestSequenceData() : sequence(0xFFFF) {}
-    explicit TestSequenceData( uint16_t _sequence ) : sequence( _sequence ) {}
-    uint16_t sequence;
-};
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 1, KeyBytes );
 
-void test_sequence_buffer()
-{
-    const int Size = 256;
+    ClientServerConfig config;
+    config.protocolId = 0x1122334455667788ULL;
 
-    SequenceBuffer<TestSequenceData> sequence_buffer( GetDefaultAllocator(), Size );
+    Socket upstream( Address( "127.0.0.1:0" ) );
+    check( !upstream.IsError() );
 
-    for ( int i = 0; i < Size; ++i )
-        check( sequence_buffer.Find(i) == NULL );
+    Relay relay( GetDefaultAllocator(), privateKey, Address( "127.0.0.1:0" ), upstream.GetAddress(), config, 2, 0.0 );
+    check( !relay.IsError() );
 
-    for ( int i = 0; i <= Size*4; ++i )
-    {
-        TestSequenceData * entry = sequence_buffer.Insert( i );
-        entry->sequence = i;
-        check( sequence_buffer.GetSequence() == i + 1 );
-    }
+    Socket client( Address( "127.0.0.1:0" ) );
+    check( !client.IsError() );
 
-    for ( int i = 0; i <= Size; ++i )
-    {
-        TestSequenceData * entry = sequence_buffer.Insert( i );
-        check( !entry );
-    }    
+    // connect requests with a bad auth are dropped without opening a session
 
-    int index = Size * 4;
-    for ( int i = 0; i < Size; ++i )
-    {
-        TestSequenceData * entry = sequence_buffer.Find( index );
-        check( entry );
-        check( entry->sequence == uint32_t( index ) );
-        index--;
-    }
+    uint8_t connectRequest[TrustedConnectRequestBytes];
+    connectRequest[0] = TRUSTED_PACKET_CONNECT_REQUEST;
+    const uint64_t protocolId = host_to_network( config.protocolId );
+    const uint64_t clientId = host_to_network( uint64_t( 1000 ) );
+    memcpy( connectRequest + 1, &protocolId, 8 );
+    memcpy( connectRequest + 1 + 8, &clientId, 8 );
+    memset( connectRequest + 1 + 8 + 8, 0, TrustedAuthBytes );
 
-    sequence_buffer.Reset();
+    check( client.SendPacket( relay.GetAddress(), connectRequest, TrustedConnectRequestBytes ) );
+    yojimbo_sleep( 0.01 );
+    relay.Update( 0.0 );
+    check( relay.GetNumSessions() == 0 );
 
-    check( sequence_buffer.GetSequence() == 0 );
+    // a good connect request opens a session and is forwarded upstream unchanged
 
-    for ( int i = 0; i < Size; ++i )
-        check( sequence_buffer.Find(i) == NULL );
+    trusted_connect_auth( privateKey, config.protocolId, 1000, connectRequest + 1 + 8 + 8 );
+    check( client.SendPacket( relay.GetAddress(), connectRequest, TrustedConnectRequestBytes ) );
+
+    Address from;
+    uint8_t packetData[TrustedMaxPacketBytes];
+    check( test_relay_receive( relay, upstream, 0.0, from, packetData, sizeof( packetData ) ) == TrustedConnectRequestBytes );
+    check( memcmp( packetData, connectRequest, TrustedConnectRequestBytes ) == 0 );
+    check( relay.GetNumSessions() == 1 );
+
+    const Address sessionAddress = from;
+    check( sessionAddress != client.GetAddress() );
+
+    // payloads go both ways untouched
+
+    uint8_t payload[100];
+    payload[0] = TRUSTED_PACKET_PAYLOAD;
+    for ( int i = 1; i < (int) sizeof( payload ); ++i )
+        payload[i] = (uint8_t) i;
+
+    check( upstream.SendPacket( sessionAddress, payload, sizeof( payload ) ) );
+    check( test_relay_receive( relay, client, 0.1, from, packetData, sizeof( packetData ) ) == (int) sizeof( payload ) );
+    check( from == relay.GetAddress() );
+    check( memcmp( packetData, payload, sizeof( payload ) ) == 0 );
+
+    payload[1] = 0xFF;
+    check( client.SendPacket( relay.GetAddress(), payload, sizeof( payload ) ) );
+    check( test_relay_receive( relay, upstream, 0.2, from, packetData, sizeof( packetData ) ) == (int) sizeof( payload ) );
+    check( from == sessionAddress );
+    check( memcmp( packetData, payload, sizeof( payload ) ) == 0 );
+
+    // a disconnect from the upstream server is forwarded and closes the session
+
+    const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+    check( upstream.SendPacket( sessionAddress, &disconnect, 1 ) );
+    check( test_relay_receive( relay, client, 0.3, from, packetData, sizeof( packetData ) ) == 1 );
+    check( packetData[0] == TRUSTED_PACKET_DISCONNECT );
+    check( relay.GetNumSessions() == 0 );
+
+    // sessions time out when one side goes quiet
+
+    check( client.SendPacket( relay.GetAddress(), connectRequest, TrustedConnectRequestBytes ) );
+    check( test_relay_receive( relay, upstream, 1.0, from, packetData, sizeof( packetData ) ) == TrustedConnectRequestBytes );
+    check( relay.GetNumSessions() == 1 );
+    relay.Update( 1.0 + config.trustedTimeout + 1.0 );
+    check( relay.GetNumSessions() == 0 );
 }
 
-void test_allocator_tlsf()
+void test_prober()
 {
-    const int NumBlocks = 256;
-    const int BlockSize = 1024;
-    const int MemorySize = NumBlocks * BlockSize;
+    const uint64_t ProberProtocolId = 0x1122334455667788ULL;
 
-    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+    Socket server( Address( "127.0.0.1:0" ) );
+    check( !server.IsError() );
 
-    TLSF_Allocator allocator( memory, MemorySize );
+    Prober prober( GetDefaultAllocator(), Address( "127.0.0.1:0" ), ProberProtocolId, 4 );
+    check( !prober.IsError() );
 
-    uint8_t * blockData[NumBlocks];
-    memset( blockData, 0, sizeof( blockData ) );
+    Address serverAddresses[] = { Address( "127.0.0.1:1" ), server.GetAddress() };
 
-    int stopIndex = 0;
+    prober.SetServers( serverAddresses, 2 );
+    prober.SendProbes( 1.0 );
 
-    for ( int i = 0; i < NumBlocks; ++i )
+    Address from;
+    uint8_t probe[TrustedMaxPacketBytes];
+    int probeBytes = 0;
+    for ( int i = 0; i < 100 && probeBytes <= 0; ++i )
     {
-        blockData[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BlockSize );
-        
-        if ( !blockData[i] )
-        {
-            check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_OUT_OF_MEMORY );
-            allocator.ClearError();
-            check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
-            stopIndex = i;
-            break;
-        }
-        
-        check( blockData[i] );
-        check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
-        
-        memset( blockData[i], i + 10, BlockSize );
+        probeBytes = server.ReceivePacket( from, probe, sizeof( probe ) );
+        if ( probeBytes <= 0 )
+            yojimbo_sleep( 0.01 );
     }
+    check( probeBytes == TrustedProbeBytes );
+    check( probe[0] == TRUSTED_PACKET_PROBE );
 
-    check( stopIndex > NumBlocks / 2 );
+    uint64_t protocolId;
+    memcpy( &protocolId, probe + 1, 8 );
+    check( network_to_host( protocolId ) == ProberProtocolId );
 
-    for ( int i = 0; i < NumBlocks - 1; ++i )
-    {
-        if ( blockData[i] )
-        {
-            for ( int j = 0; j < BlockSize; ++j )
-                check( blockData[i][j] == uint8_t( i + 10 ) );
-        }
+    // answer the way the server does: the token as is, then the load
 
-        YOJIMBO_FREE( allocator, blockData[i] );
+    uint8_t reply[TrustedProbeReplyBytes];
+    reply[0] = TRUSTED_PACKET_PROBE_REPLY;
+    memcpy( reply + 1, probe + 1 + 8, 8 );
+    const uint32_t numConnectedClients = host_to_network( uint32_t( 3 ) );
+    const uint32_t maxClients = host_to_network( uint32_t( 8 ) );
+    memcpy( reply + 1 + 8, &numConnectedClients, 4 );
+    memcpy( reply + 1 + 8 + 4, &maxClients, 4 );
+    check( server.SendPacket( from, reply, TrustedProbeReplyBytes ) );
+
+    for ( int i = 0; i < 100 && prober.GetRTT( 1 ) < 0.0; ++i )
+    {
+        yojimbo_sleep( 0.01 );
+        prober.ReceiveReplies( 1.05 );
     }
 
-    free( memory );
+    check( prober.GetRTT( 0 ) < 0.0 );
+    check( fabs( prober.GetRTT( 1 ) - 0.05 ) < 0.001 );
+    check( prober.GetBestServer() == 1 );
+
+    int numConnected = 0;
+    int numSlots = 0;
+    check( prober.GetServerLoad( 1, numConnected, numSlots ) );
+    check( numConnected == 3 );
+    check( numSlots == 8 );
+
+    // replies to an earlier round are ignored
+
+    prober.SendProbes( 2.0 );
+    check( server.SendPacket( from, reply, TrustedProbeReplyBytes ) );
+    yojimbo_sleep( 0.05 );
+    prober.ReceiveReplies( 2.01 );
+    check( fabs( prober.GetRTT( 1 ) - 0.05 ) < 0.001 );
 }
 
-void PumpConnectionUpdate( ConnectionConfig & connectionConfig, double & time, Connection & sender, Connection & receiver, uint16_t & senderSequence, uint16_t & receiverSequence, float deltaTime = 0.1f, int packetLossPercent = 90 )
+void test_packet_recorder()
 {
-    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+    const int PacketBytes = 40;
+    const int NumPackets = 20;
+
+    // three packets fit in each segment, so only the last four segments of packets survive
 
-    int packetBytes;
-    if ( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
     {
-        if ( random_int( 0, 100 ) >= packetLossPercent )
+        PacketRecorder recorder( "test_packet_recorder.bin", 256, 4 );
+        check( !recorder.IsError() );
+
+        uint8_t packetData[PacketBytes];
+        for ( int i = 0; i < NumPackets; ++i )
         {
-            receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes );
-            sender.ProcessAcks( &senderSequence, 1 );
+            memset( packetData, i, PacketBytes );
+            recorder.RecordPacket( i * 0.1, ( i % 2 ) ? PACKET_DIRECTION_RECEIVE : PACKET_DIRECTION_SEND, i % 3, uint16_t( i ), packetData, PacketBytes );
         }
+
+        uint8_t largePacket[256];
+        memset( largePacket, 0, sizeof( largePacket ) );
+        recorder.RecordPacket( 0.0, PACKET_DIRECTION_SEND, 0, 0, largePacket, sizeof( largePacket ) );
+
+        check( recorder.GetNumPacketsRecorded() == NumPackets );
     }
 
-    if ( receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+    PacketPlayback playback( "test_packet_recorder.bin" );
+    check( !playback.IsError() );
+
+    int expected = 9;
+    PacketRecordHeader header;
+    const uint8_t * packetData = NULL;
+    while ( playback.ReadPacket( header, packetData ) )
     {
-        if ( random_int( 0, 100 ) >= packetLossPercent )
+        check( header.packetBytes == PacketBytes );
+        check( header.clientIndex == expected % 3 );
+        check( header.packetSequence == uint16_t( expected ) );
+        check( header.direction == uint32_t( ( expected % 2 ) ? PACKET_DIRECTION_RECEIVE : PACKET_DIRECTION_SEND ) );
+        check( fabs( header.time - expected * 0.1 ) < 0.000001 );
+        for ( int i = 0; i < PacketBytes; ++i )
         {
-            sender.ProcessPacket( NULL, receiverSequence, packetData, packetBytes );
-            receiver.ProcessAcks( &receiverSequence, 1 );
+            check( packetData[i] == uint8_t( expected ) );
         }
+        expected++;
     }
 
-    time += deltaTime;
-
-    sender.AdvanceTime( time );
-    receiver.AdvanceTime( time );
+    check( expected == NumPackets );
 
-    senderSequence++;
-    receiverSequence++;
+    remove( "test_packet_recorder.bin" );
 }
 
-void test_connection_reliable_ordered_messages()
+void test_bit_array()
 {
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
+    const int Size = 300;
 
-    double time = 100.0;
+    BitArray bit_array( GetDefaultAllocator(), Size );
 
-    ConnectionConfig connectionConfig;
- 
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    // verify initial conditions
 
-    const int NumMessagesSent = 64;
+    check( bit_array.GetSize() == Size );
 
-    for ( int i = 0; i < NumMessagesSent; ++i )
+    for ( int i = 0; i < Size; ++i )
     {
-        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-        check( message );
-        message->sequence = i;
-        sender.SendMessage( 0, message );
+        check( bit_array.GetBit(i) == 0 );
     }
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
-
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
-
-    int numMessagesReceived = 0;
-
-    const int NumIterations = 1000;
-
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    // set every third bit and verify correct bits are set on read
 
-    for ( int i = 0; i < NumIterations; ++i )
+    for ( int i = 0; i < Size; ++i )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        if ( ( i % 3 ) == 0 )
+            bit_array.SetBit( i );
+    }
 
-        while ( true )
+    for ( int i = 0; i < Size; ++i )
+    {
+        if ( ( i % 3 ) == 0 )
         {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
-
-            check( message->GetId() == (int) numMessagesReceived );
-            check( message->GetType() == TEST_MESSAGE );
-
-            TestMessage * testMessage = (TestMessage*) message;
-
-            check( testMessage->sequence == numMessagesReceived );
-
-            ++numMessagesReceived;
-
-            messageFactory.ReleaseMessage( message );
+            check( bit_array.GetBit( i ) == 1 );
+        }
+        else
+        {
+            check( bit_array.GetBit( i ) == 0 );
         }
-
-        if ( numMessagesReceived == NumMessagesSent )
-            break;
     }
 
-    check( numMessagesReceived == NumMessagesSent );
-}
-
-void test_connection_reliable_ordered_blocks()
-{
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
-
-    double time = 100.0;
-
-    ConnectionConfig connectionConfig;
-    
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    // now clear every third bit to zero and verify all bits are zero
 
-    const int NumMessagesSent = 32;
+    for ( int i = 0; i < Size; ++i )
+    {
+        if ( ( i % 3 ) == 0 )
+            bit_array.ClearBit( i );
+    }
 
-    for ( int i = 0; i < NumMessagesSent; ++i )
+    for ( int i = 0; i < Size; ++i )
     {
-        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-        check( message );
-        message->sequence = i;
-        const int blockSize = 1 + ( ( i * 901 ) % 3333 );
-        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-        for ( int j = 0; j < blockSize; ++j )
-            blockData[j] = i + j;
-        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-        sender.SendMessage( 0, message );
+        check( bit_array.GetBit(i) == 0 );
     }
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    // now set some more bits
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    for ( int i = 0; i < Size; ++i )
+    {
+        if ( ( i % 10 ) == 0 )
+            bit_array.SetBit( i );
+    }
 
-    int numMessagesReceived = 0;
+    for ( int i = 0; i < Size; ++i )
+    {
+        if ( ( i % 10 ) == 0 )
+        {
+            check( bit_array.GetBit( i ) == 1 );
+        }
+        else
+        {
+            check( bit_array.GetBit( i ) == 0 );
+        }
+    }
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    // clear and verify all bits are zero
 
-    const int NumIterations = 10000;
+    bit_array.Clear();
 
-    for ( int i = 0; i < NumIterations; ++i )
+    for ( int i = 0; i < Size; ++i )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        check( bit_array.GetBit(i) == 0 );
+    }
+}
 
-        while ( true )
-        {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
+struct TestSequenceData
+{
+    TestSequenceData() : sequence(0xFFFF) {}
+    explicit TestSequenceData( uint16_t _sequence ) : sequence( _sequence ) {}
+    uint16_t sequence;
+};
 
-            check( message->GetId() == (int) numMessagesReceived );
+void test_bit_array_find()
+{
+    const int Size = 300;
 
-            check( message->GetType() == TEST_BLOCK_MESSAGE );
+    BitArray bit_array( GetDefaultAllocator(), Size );
 
-            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+    check( bit_array.FindFirstSet( 0 ) == -1 );
+    check( bit_array.FindFirstClear( 0 ) == 0 );
+    check( bit_array.CountSet() == 0 );
 
-            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+    // ranges that start and end inside words and span whole words
 
-            const int blockSize = blockMessage->GetBlockSize();
+    bit_array.SetRange( 10, 200 );
 
-            check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+    check( bit_array.CountSet() == 190 );
+    check( bit_array.FindFirstSet( 0 ) == 10 );
+    check( bit_array.FindFirstClear( 10 ) == 200 );
+    check( bit_array.GetBit( 9 ) == 0 );
+    check( bit_array.GetBit( 199 ) == 1 );
+    check( bit_array.GetBit( 200 ) == 0 );
 
-            const uint8_t * blockData = blockMessage->GetBlockData();
+    bit_array.ClearRange( 64, 128 );
 
-            check( blockData );
+    check( bit_array.CountSet() == 126 );
+    check( bit_array.FindFirstClear( 10 ) == 64 );
+    check( bit_array.FindFirstSet( 64 ) == 128 );
 
-            for ( int j = 0; j < blockSize; ++j )
-            {
-                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
-            }
+    // walk the set bits
 
-            ++numMessagesReceived;
+    bit_array.Clear();
 
-            messageFactory.ReleaseMessage( message );
-        }
+    for ( int i = 0; i < Size; i += 7 )
+        bit_array.SetBit( i );
 
-        if ( numMessagesReceived == NumMessagesSent )
-            break;
+    int expected = 0;
+    for ( int i = bit_array.FindFirstSet( 0 ); i >= 0; i = bit_array.FindFirstSet( i + 1 ) )
+    {
+        check( i == expected );
+        expected += 7;
     }
+    check( expected >= Size );
 
-    check( numMessagesReceived == NumMessagesSent );
+    // clear bits are never found past the end of the array
+
+    bit_array.SetRange( 0, Size );
+
+    check( bit_array.CountSet() == Size );
+    check( bit_array.FindFirstClear( 0 ) == -1 );
+    check( bit_array.FindFirstSet( Size ) == -1 );
 }
 
-void test_connection_reliable_ordered_messages_and_blocks()
+void test_sequence_buffer()
 {
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
-
-    double time = 100.0;
-    
-    ConnectionConfig connectionConfig;
-    
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    const int Size = 256;
 
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    SequenceBuffer<TestSequenceData> sequence_buffer( GetDefaultAllocator(), Size );
 
-    const int NumMessagesSent = 32;
+    for ( int i = 0; i < Size; ++i )
+        check( sequence_buffer.Find(i) == NULL );
+
+    for ( int i = 0; i <= Size*4; ++i )
+    {
+        TestSequenceData * entry = sequence_buffer.Insert( i );
+        entry->sequence = i;
+        check( sequence_buffer.GetSequence() == i + 1 );
+    }
+
+    for ( int i = 0; i <= Size; ++i )
+    {
+        TestSequenceData * entry = sequence_buffer.Insert( i );
+        check( !entry );
+    }    
+
+    int index = Size * 4;
+    for ( int i = 0; i < Size; ++i )
+    {
+        TestSequenceData * entry = sequence_buffer.Find( index );
+        check( entry );
+        check( entry->sequence == uint32_t( index ) );
+        index--;
+    }
+
+    sequence_buffer.Reset();
+
+    check( sequence_buffer.GetSequence() == 0 );
+
+    for ( int i = 0; i < Size; ++i )
+        check( sequence_buffer.Find(i) == NULL );
+}
+
+void test_sequence_buffer_wrap()
+{
+    // power of two sizes are masked and cleared with memset, other sizes take the modulo path
+
+    const int Sizes[] = { 256, 100 };
+
+    for ( int j = 0; j < 2; ++j )
+    {
+        const int Size = Sizes[j];
+
+        SequenceBuffer<TestSequenceData> sequence_buffer( GetDefaultAllocator(), Size );
+
+        // insert every other sequence until past the 16 bit wrap
+
+        uint16_t sequence = 0;
+        for ( int i = 0; i < 32768 + Size; ++i )
+        {
+            TestSequenceData * entry = sequence_buffer.Insert( sequence );
+            check( entry );
+            entry->sequence = sequence;
+            sequence += 2;
+        }
+
+        check( sequence_buffer.GetSequence() == uint16_t( sequence - 1 ) );
+
+        for ( int i = 1; i <= Size; ++i )
+        {
+            const uint16_t s = uint16_t( sequence - i );
+            TestSequenceData * entry = sequence_buffer.Find( s );
+            if ( i % 2 == 0 )
+            {
+                check( entry );
+                check( entry->sequence == s );
+            }
+            else
+            {
+                check( !entry );
+            }
+        }
+
+        // a jump of more than the buffer size clears everything
+
+        check( sequence_buffer.Insert( uint16_t( sequence + Size * 2 ) ) );
+        for ( int i = 1; i <= Size; ++i )
+            check( !sequence_buffer.Find( uint16_t( sequence - i ) ) );
+    }
+}
+
+void test_allocator_tlsf()
+{
+    const int NumBlocks = 256;
+    const int BlockSize = 1024;
+    const int MemorySize = NumBlocks * BlockSize;
+
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+
+    TLSF_Allocator allocator( memory, MemorySize );
+
+    uint8_t * blockData[NumBlocks];
+    memset( blockData, 0, sizeof( blockData ) );
+
+    int stopIndex = 0;
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        blockData[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BlockSize );
+        
+        if ( !blockData[i] )
+        {
+            check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            allocator.ClearError();
+            check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+            stopIndex = i;
+            break;
+        }
+        
+        check( blockData[i] );
+        check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+        
+        memset( blockData[i], i + 10, BlockSize );
+    }
+
+    check( stopIndex > NumBlocks / 2 );
+
+    for ( int i = 0; i < NumBlocks - 1; ++i )
+    {
+        if ( blockData[i] )
+        {
+            for ( int j = 0; j < BlockSize; ++j )
+                check( blockData[i][j] == uint8_t( i + 10 ) );
+        }
+
+        YOJIMBO_FREE( allocator, blockData[i] );
+    }
+
+    free( memory );
+}
+
+void test_allocator_tlsf_slabs()
+{
+    const int MemorySize = 1024 * 1024;
+    const int NumBlocks = 1024;
+
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+
+    TLSF_Allocator allocator( memory, MemorySize );
+
+    uint8_t * blockData[NumBlocks];
+    int blockSize[NumBlocks];
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        blockSize[i] = 1 + ( i * 37 ) % SlabMaxBytes;
+        blockData[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, blockSize[i] );
+        check( blockData[i] );
+        memset( blockData[i], uint8_t( i ), blockSize[i] );
+    }
+
+    // small blocks don't overlap, and are aligned to the size class step
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+#if YOJIMBO_TLSF_SLABS
+        check( ( (uintptr_t) blockData[i] ) % SlabClassBytes == 0 );
+#endif // #if YOJIMBO_TLSF_SLABS
+        for ( int j = 0; j < blockSize[i]; ++j )
+            check( blockData[i][j] == uint8_t( i ) );
+    }
+
+    // large blocks still come from the heap, alongside the slab pages
+
+    void * large = YOJIMBO_ALLOCATE( allocator, 4 * SlabPageBytes );
+    check( large );
+
+    // every other block freed, then allocated again in the holes left behind
+
+    for ( int i = 0; i < NumBlocks; i += 2 )
+        YOJIMBO_FREE( allocator, blockData[i] );
+
+    for ( int i = 0; i < NumBlocks; i += 2 )
+    {
+        blockData[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, blockSize[i] );
+        check( blockData[i] );
+        memset( blockData[i], uint8_t( i ), blockSize[i] );
+    }
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        for ( int j = 0; j < blockSize[i]; ++j )
+            check( blockData[i][j] == uint8_t( i ) );
+    }
+
+    // a block freed and allocated again at the same size reuses the same memory
+
+    void * p = blockData[NumBlocks-1];
+    YOJIMBO_FREE( allocator, blockData[NumBlocks-1] );
+    blockData[NumBlocks-1] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, blockSize[NumBlocks-1] );
+#if YOJIMBO_TLSF_SLABS
+    check( blockData[NumBlocks-1] == p );
+#else // #if YOJIMBO_TLSF_SLABS
+    (void) p;
+#endif // #if YOJIMBO_TLSF_SLABS
+
+    for ( int i = 0; i < NumBlocks; ++i )
+        YOJIMBO_FREE( allocator, blockData[i] );
+
+    YOJIMBO_FREE( allocator, large );
+
+    AllocatorStats stats;
+    allocator.GetStats( stats );
+    check( stats.bytesAllocated == 0 );
+    check( stats.numAllocations == stats.numFrees );
+
+    // once the slab pages go back to the heap, a block nearly the size of the heap fits again
+
+    void * huge = YOJIMBO_ALLOCATE( allocator, MemorySize / 2 );
+    check( huge );
+    YOJIMBO_FREE( allocator, huge );
+
+    free( memory );
+}
+
+void test_allocator_quota()
+{
+    const int NumBlocks = 64;
+    const int BlockSize = 1024;
+    const int Quota = NumBlocks * BlockSize;
+
+    QuotaAllocator allocator( GetDefaultAllocator(), Quota );
+
+    uint8_t * blockData[NumBlocks];
+    memset( blockData, 0, sizeof( blockData ) );
+
+    int stopIndex = 0;
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        blockData[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BlockSize );
+
+        if ( !blockData[i] )
+        {
+            check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            allocator.ClearError();
+            stopIndex = i;
+            break;
+        }
+
+        check( allocator.GetBytesAllocated() <= allocator.GetQuota() );
+
+        memset( blockData[i], i + 10, BlockSize );
+    }
+
+    check( stopIndex > NumBlocks / 2 );
+    check( stopIndex < NumBlocks );
+
+    YOJIMBO_FREE( allocator, blockData[0] );
+
+    blockData[0] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BlockSize );
+
+    check( blockData[0] );
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        if ( i > 0 && blockData[i] )
+        {
+            for ( int j = 0; j < BlockSize; ++j )
+                check( blockData[i][j] == uint8_t( i + 10 ) );
+        }
+
+        YOJIMBO_FREE( allocator, blockData[i] );
+    }
+
+    check( allocator.GetBytesAllocated() == 0 );
+}
+
+void test_allocator_frame()
+{
+    const int Capacity = 1024;
+
+    FrameAllocator allocator( GetDefaultAllocator(), Capacity );
+
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+    check( allocator.GetCapacity() == Capacity );
+    check( allocator.GetBytesUsed() == 0 );
+
+    // allocations are bumped forward and 8 byte aligned, after an 8 byte header holding the size
+
+    uint8_t * a = (uint8_t*) YOJIMBO_ALLOCATE( allocator, 10 );
+    uint8_t * b = (uint8_t*) YOJIMBO_ALLOCATE( allocator, 100 );
+    check( a );
+    check( b );
+    check( b == a + 8 + 16 );
+    check( ( uintptr_t( b ) % 8 ) == 0 );
+    check( allocator.GetBytesUsed() == ( 8 + 16 ) + ( 8 + 104 ) );
+
+    memset( a, 1, 10 );
+    memset( b, 2, 100 );
+
+    uint8_t * start = a;
+
+    // memory isn't reused until everything has been freed
+
+    YOJIMBO_FREE( allocator, a );
+    check( allocator.GetBytesUsed() == ( 8 + 16 ) + ( 8 + 104 ) );
+
+    void * c = YOJIMBO_ALLOCATE( allocator, Capacity - 8 );
+    check( !c );
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_OUT_OF_MEMORY );
+    allocator.ClearError();
+
+    YOJIMBO_FREE( allocator, b );
+    check( allocator.GetBytesUsed() == 0 );
+
+    c = YOJIMBO_ALLOCATE( allocator, Capacity - 8 );
+    check( c );
+    check( c == start );
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+    YOJIMBO_FREE( allocator, c );
+
+    allocator.Reset();
+    check( allocator.GetBytesUsed() == 0 );
+}
+
+void test_allocator_buffer_pool()
+{
+    const int BufferBytes = 16 * 1024;
+    const int NumBuffers = 2;
+
+    const size_t bytesBefore = GetDefaultAllocator().GetBytesAllocated();
+
+    {
+        BufferPoolAllocator allocator( GetDefaultAllocator(), BufferBytes, NumBuffers );
+
+        check( allocator.GetNumFreeBuffers() == NumBuffers );
+
+        // small allocations pass through, and nothing is reserved until a buffer is needed
+
+        void * small = YOJIMBO_ALLOCATE( allocator, 100 );
+        check( small );
+        check( GetDefaultAllocator().GetBytesAllocated() == bytesBefore + 100 );
+        YOJIMBO_FREE( allocator, small );
+        check( GetDefaultAllocator().GetBytesAllocated() == bytesBefore );
+
+        uint8_t * a = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BufferBytes );
+        uint8_t * b = (uint8_t*) YOJIMBO_ALLOCATE( allocator, BufferBytes / 2 + 1 );
+        check( a );
+        check( b );
+        check( allocator.GetNumFreeBuffers() == 0 );
+        check( allocator.GetBytesAllocated() == size_t( BufferBytes + BufferBytes / 2 + 1 ) );
+        memset( a, 1, BufferBytes );
+        memset( b, 2, BufferBytes / 2 + 1 );
+
+        const size_t bytesReserved = GetDefaultAllocator().GetBytesAllocated();
+
+        // with every buffer in use, large allocations pass through too
+
+        void * c = YOJIMBO_ALLOCATE( allocator, BufferBytes );
+        check( c );
+        check( GetDefaultAllocator().GetBytesAllocated() == bytesReserved + BufferBytes );
+        YOJIMBO_FREE( allocator, c );
+
+        // freed buffers are reused without touching the parent allocator
+
+        YOJIMBO_FREE( allocator, a );
+        check( allocator.GetNumFreeBuffers() == 1 );
+
+        for ( int i = 0; i < 10; ++i )
+        {
+            void * d = YOJIMBO_ALLOCATE( allocator, BufferBytes - i );
+            check( d );
+            check( GetDefaultAllocator().GetBytesAllocated() == bytesReserved );
+            YOJIMBO_FREE( allocator, d );
+        }
+
+        YOJIMBO_FREE( allocator, b );
+        check( allocator.GetNumFreeBuffers() == NumBuffers );
+        check( allocator.GetBytesAllocated() == 0 );
+        check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+    }
+
+    check( GetDefaultAllocator().GetBytesAllocated() == bytesBefore );
+}
+
+void test_allocator_steady_state()
+{
+#if YOJIMBO_DEBUG_STEADY_STATE
+
+    FrameAllocator frameAllocator( GetDefaultAllocator(), 1024 );
+
+    // allocations aren't caught until the check is armed, and only inside a steady state scope
+
+    {
+        YOJIMBO_STEADY_STATE_SCOPE( "test" );
+        void * p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 16 );
+        YOJIMBO_FREE( GetDefaultAllocator(), p );
+    }
+
+    ArmSteadyStateCheck();
+
+    void * p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 16 );
+    YOJIMBO_FREE( GetDefaultAllocator(), p );
+
+    SteadyStateReport report;
+    GetSteadyStateReport( report );
+    check( report.numAllocations == 0 );
+    check( report.file == NULL );
+
+    // frame allocations never reach a heap, so they are fine in steady state
+
+    {
+        YOJIMBO_STEADY_STATE_SCOPE( "outer" );
+        p = YOJIMBO_ALLOCATE( frameAllocator, 16 );
+        YOJIMBO_FREE( frameAllocator, p );
+
+        GetSteadyStateReport( report );
+        check( report.numAllocations == 0 );
+
+        {
+            YOJIMBO_STEADY_STATE_SCOPE( "inner" );
+            p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 32 ); const int line = __LINE__;
+            YOJIMBO_FREE( GetDefaultAllocator(), p );
+
+            GetSteadyStateReport( report );
+            check( report.numAllocations == 1 );
+            check( strcmp( report.scope, "inner" ) == 0 );
+            check( strcmp( report.file, __FILE__ ) == 0 );
+            check( report.line == line );
+            check( report.size == 32 );
+        }
+
+        p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 64 );
+        YOJIMBO_FREE( GetDefaultAllocator(), p );
+    }
+
+    // the first allocation caught is kept, the rest are counted
+
+    GetSteadyStateReport( report );
+    check( report.numAllocations == 2 );
+    check( strcmp( report.scope, "inner" ) == 0 );
+    check( report.size == 32 );
+
+    DisarmSteadyStateCheck();
+
+    {
+        YOJIMBO_STEADY_STATE_SCOPE( "test" );
+        p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 16 );
+        YOJIMBO_FREE( GetDefaultAllocator(), p );
+    }
+
+    GetSteadyStateReport( report );
+    check( report.numAllocations == 2 );
+
+    ArmSteadyStateCheck();
+    GetSteadyStateReport( report );
+    check( report.numAllocations == 0 );
+    DisarmSteadyStateCheck();
+
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+}
+
+void test_allocator_stats()
+{
+    const int MemorySize = 64 * 1024;
+
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+
+    TLSF_Allocator allocator( memory, MemorySize );
+
+    AllocatorStats stats;
+    allocator.GetStats( stats );
+    check( stats.bytesAllocated == 0 );
+    check( stats.peakBytesAllocated == 0 );
+    check( stats.numAllocations == 0 );
+    check( stats.numFrees == 0 );
+    check( stats.largestFreeBlock > 0 );
+
+    const size_t initialLargestFreeBlock = stats.largestFreeBlock;
+
+    void * a = YOJIMBO_ALLOCATE( allocator, 1000 );
+    void * b = YOJIMBO_ALLOCATE( allocator, 2000 );
+    check( a );
+    check( b );
+
+    allocator.GetStats( stats );
+    check( stats.bytesAllocated >= 3000 );
+    check( stats.peakBytesAllocated == stats.bytesAllocated );
+    check( stats.numAllocations == 2 );
+    check( stats.numFrees == 0 );
+    check( stats.largestFreeBlock < initialLargestFreeBlock );
+
+    const size_t peakBytesAllocated = stats.peakBytesAllocated;
+
+    YOJIMBO_FREE( allocator, a );
+    YOJIMBO_FREE( allocator, b );
+
+    allocator.GetStats( stats );
+    check( stats.bytesAllocated == 0 );
+    check( stats.peakBytesAllocated == peakBytesAllocated );
+    check( stats.numAllocations == 2 );
+    check( stats.numFrees == 2 );
+    check( stats.largestFreeBlock == initialLargestFreeBlock );
+
+    // allocators that don't know their largest free block report zero for it
+
+    QuotaAllocator quotaAllocator( GetDefaultAllocator(), MemorySize );
+
+    void * c = YOJIMBO_ALLOCATE( quotaAllocator, 100 );
+    check( c );
+
+    quotaAllocator.GetStats( stats );
+    check( stats.bytesAllocated == 100 );
+    check( stats.peakBytesAllocated == 100 );
+    check( stats.numAllocations == 1 );
+    check( stats.largestFreeBlock == 0 );
+
+    YOJIMBO_FREE( quotaAllocator, c );
+
+    quotaAllocator.GetStats( stats );
+    check( stats.bytesAllocated == 0 );
+    check( stats.numFrees == 1 );
+
+    free( memory );
+}
+
+void test_allocator_page_memory()
+{
+    const int MemorySize = 3 * 1024 * 1024 + 100;
+
+    for ( int hugePages = 0; hugePages <= 1; ++hugePages )
+    {
+        // numa node 0 always exists, so binding to it is safe on any machine
+
+        uint8_t * memory = (uint8_t*) yojimbo_page_allocate( MemorySize, hugePages != 0, 0 );
+        check( memory );
+        check( ( uintptr_t( memory ) % 4096 ) == 0 );
+
+        // prefaulting leaves the contents alone. locking may be refused by RLIMIT_MEMLOCK, so only unlock if it worked
+
+        yojimbo_page_prefault( memory, MemorySize );
+
+        if ( yojimbo_page_lock( memory, MemorySize ) )
+            yojimbo_page_unlock( memory, MemorySize );
+
+        for ( int i = 0; i < MemorySize; ++i )
+            check( memory[i] == 0 );
+
+        TLSF_Allocator allocator( memory, MemorySize );
+
+        void * p = YOJIMBO_ALLOCATE( allocator, 1024 * 1024 );
+        check( p );
+        memset( p, 1, 1024 * 1024 );
+        YOJIMBO_FREE( allocator, p );
+
+        yojimbo_page_free( memory, MemorySize, hugePages != 0 );
+    }
+}
+
+void test_allocator_thread_safe()
+{
+    ThreadSafeAllocator threadSafeAllocator( GetDefaultAllocator() );
+
+    void * p = YOJIMBO_ALLOCATE( threadSafeAllocator, 100 );
+    check( p );
+    memset( p, 0, 100 );
+    YOJIMBO_FREE( threadSafeAllocator, p );
+
+    // the calling thread gets its own heap, so this runs entirely inside the thread caching allocator
+
+    const int HeapBytes = 64 * 1024;
+
+    ThreadCachingAllocator allocator( GetDefaultAllocator(), HeapBytes, yojimbo_thread_index() + 1 );
+
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+
+    const int NumBlocks = 32;
+
+    uint8_t * blocks[NumBlocks];
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        blocks[i] = (uint8_t*) YOJIMBO_ALLOCATE( allocator, 100 + i );
+        check( blocks[i] );
+        check( ( uintptr_t( blocks[i] ) % 8 ) == 0 );
+        memset( blocks[i], i, 100 + i );
+    }
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        for ( int j = 0; j < 100 + i; ++j )
+            check( blocks[i][j] == i );
+        YOJIMBO_FREE( allocator, blocks[i] );
+    }
+
+    AllocatorStats stats;
+    allocator.GetStats( stats );
+    check( stats.numAllocations == NumBlocks );
+    check( stats.numFrees == NumBlocks );
+    check( stats.bytesAllocated == 0 );
+    check( stats.peakBytesAllocated > 0 );
+
+    check( !YOJIMBO_ALLOCATE( allocator, HeapBytes ) );
+    check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_OUT_OF_MEMORY );
+    allocator.ClearError();
+
+    // the default allocator can be overridden per thread
+
+    Allocator & defaultAllocator = GetDefaultAllocator();
+
+    SetThreadDefaultAllocator( &allocator );
+    check( &GetDefaultAllocator() == &allocator );
+
+    p = YOJIMBO_ALLOCATE( GetDefaultAllocator(), 256 );
+    check( p );
+    YOJIMBO_FREE( GetDefaultAllocator(), p );
+
+    SetThreadDefaultAllocator( NULL );
+    check( &GetDefaultAllocator() == &defaultAllocator );
+}
+
+struct ThreadPoolTestContext
+{
+    volatile int counts[256];
+};
+
+static void thread_pool_test_function( void * context, int index )
+{
+    ThreadPoolTestContext * testContext = (ThreadPoolTestContext*) context;
+    yojimbo_atomic_increment( &testContext->counts[index] );
+}
+
+void test_thread_pool()
+{
+    ThreadPoolTestContext context;
+
+    for ( int numThreads = 0; numThreads <= 3; ++numThreads )
+    {
+        ThreadPool threadPool( GetDefaultAllocator(), numThreads );
+        check( threadPool.GetNumThreads() == numThreads );
+
+        // every work item runs exactly once, whatever the number of work items compared to threads
+
+        for ( int iteration = 0; iteration < 100; ++iteration )
+        {
+            const int count = iteration % 2 ? iteration : 256 - iteration;
+
+            memset( (void*) context.counts, 0, sizeof( context.counts ) );
+
+            if ( iteration % 3 )
+            {
+                threadPool.ParallelFor( count, thread_pool_test_function, &context );
+            }
+            else
+            {
+                threadPool.Run( count, thread_pool_test_function, &context );
+                threadPool.Wait();
+            }
+
+            for ( int i = 0; i < 256; ++i )
+                check( context.counts[i] == ( i < count ? 1 : 0 ) );
+        }
+    }
+}
+
+void test_sleep_until()
+{
+    const double startTime = yojimbo_time();
+
+    for ( int i = 1; i <= 10; ++i )
+    {
+        const double tickTime = startTime + i * 0.002;
+        yojimbo_sleep_until( tickTime );
+        check( yojimbo_time() >= tickTime );
+    }
+
+    // a deadline in the past returns straight away
+
+    const double time = yojimbo_time();
+    yojimbo_sleep_until( time - 1.0 );
+    check( yojimbo_time() - time < 0.5 );
+}
+
+void test_time_cached()
+{
+    const double time = yojimbo_time_update();
+
+    check( yojimbo_time_cached() == time );
+
+    yojimbo_sleep_until( time + 0.002 );
+
+    check( yojimbo_time_cached() == time );
+    check( yojimbo_time_update() >= time + 0.002 );
+    check( yojimbo_time_cached() >= time + 0.002 );
+}
+
+static volatile int log_test_num_lines = 0;
+
+static int log_test_printf( const char * format, ... )
+{
+    (void) format;
+    log_test_num_lines++;
+    return 0;
+}
+
+void test_log_async()
+{
+    yojimbo_set_printf_function( log_test_printf );
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_DEBUG );
+
+    log_test_num_lines = 0;
+
+    check( yojimbo_log_start_async( 1000 ) );
+    check( !yojimbo_log_start_async( 1000 ) );
+
+    const int NumLines = 500;
+
+    for ( int i = 0; i < NumLines; ++i )
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "log line %d\n", i );
+
+    yojimbo_log_stop_async();
+
+    check( yojimbo_log_num_dropped() == 0 );
+    check( log_test_num_lines == NumLines );
+
+    // back to synchronous logging
+
+    yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "log line\n" );
+
+    check( log_test_num_lines == NumLines + 1 );
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_NONE );
+    yojimbo_set_printf_function( printf );
+}
+
+struct ProfileTestData
+{
+    int numZones;
+    const char * name;
+    uint64_t startTicks;
+    uint64_t endTicks;
+};
+
+static void profile_test_function( void * context, const char * name, uint64_t startTicks, uint64_t endTicks )
+{
+    ProfileTestData * data = (ProfileTestData*) context;
+    data->numZones++;
+    data->name = name;
+    data->startTicks = startTicks;
+    data->endTicks = endTicks;
+}
+
+void test_profile()
+{
+    ProfileTestData data;
+    memset( &data, 0, sizeof( data ) );
+
+    yojimbo_set_profile_function( profile_test_function, &data );
+
+    const uint64_t startTicks = yojimbo_profile_ticks();
+    yojimbo_sleep_until( yojimbo_time() + 0.001 );
+    const uint64_t endTicks = yojimbo_profile_ticks();
+
+    check( endTicks > startTicks );
+
+    yojimbo_profile_zone( "test", startTicks, endTicks );
+
+    check( data.numZones == 1 );
+    check( strcmp( data.name, "test" ) == 0 );
+    check( data.startTicks == startTicks );
+    check( data.endTicks == endTicks );
+
+    {
+        YOJIMBO_PROFILE_SCOPE( "scope" );
+    }
+
+    check( data.numZones == ( YOJIMBO_PROFILE ? 2 : 1 ) );
+
+    yojimbo_set_profile_function( NULL, NULL );
+
+    yojimbo_profile_zone( "test", startTicks, endTicks );
+
+    check( data.numZones == ( YOJIMBO_PROFILE ? 2 : 1 ) );
+}
+
+void test_random()
+{
+    Random a( 12345 );
+    Random b( 12345 );
+    Random c( 12345, 1 );
+
+    bool streamsDiffer = false;
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        const uint32_t value = a.GetUint32();
+        check( value == b.GetUint32() );
+        if ( value != c.GetUint32() )
+            streamsDiffer = true;
+    }
+
+    check( streamsDiffer );
+
+    // reseeding restarts the sequence
+
+    a.Seed( 1 );
+    b.Seed( 1 );
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        const int value = a.GetInt( -10, 10 );
+        check( value >= -10 );
+        check( value <= 10 );
+        check( value == b.GetInt( -10, 10 ) );
+
+        const float f = a.GetFloat( 5.0f, 6.0f );
+        check( f >= 5.0f );
+        check( f < 6.0f );
+        check( f == b.GetFloat( 5.0f, 6.0f ) );
+    }
+
+    check( a.GetInt( 7, 7 ) == 7 );
+
+    // simulators with the same seed drop the same packets
+
+    NetworkSimulator simulatorA( GetDefaultAllocator(), 256, 0.0 );
+    NetworkSimulator simulatorB( GetDefaultAllocator(), 256, 0.0 );
+
+    simulatorA.SetSeed( 1000 );
+    simulatorB.SetSeed( 1000 );
+
+    simulatorA.SetPacketLoss( 50.0f );
+    simulatorB.SetPacketLoss( 50.0f );
+
+    uint8_t packet[1] = { 0 };
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        simulatorA.SendPacket( 0, packet, sizeof( packet ) );
+        simulatorB.SendPacket( 0, packet, sizeof( packet ) );
+        check( simulatorA.GetNumPackets() == simulatorB.GetNumPackets() );
+    }
+
+    check( simulatorA.GetNumPackets() > 0 );
+    check( simulatorA.GetNumPackets() < 200 );
+}
+
+void test_network_simulator()
+{
+    const int NumPacketEntries = 8;
+
+    double time = 100.0;
+
+    NetworkSimulator simulator( GetDefaultAllocator(), NumPacketEntries, time );
+
+    simulator.SetLatency( 100.0f );
+
+    check( simulator.IsActive() );
+
+    // packets that don't fit are dropped, instead of overwriting packets waiting to be delivered
+
+    for ( int i = 0; i < NumPacketEntries + 2; ++i )
+    {
+        uint8_t packet[4] = { uint8_t( i ), 0, 0, 0 };
+        simulator.SendPacket( i % 2, packet, sizeof( packet ) );
+        time += 0.001;
+        simulator.AdvanceTime( time );
+    }
+
+    check( simulator.GetNumPackets() == NumPacketEntries );
+
+    uint8_t * packetData[NumPacketEntries];
+    int packetBytes[NumPacketEntries];
+    int to[NumPacketEntries];
+
+    check( simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to ) == 0 );
+
+    // discarding a client's packets keeps the rest in delivery order
+
+    simulator.DiscardClientPackets( 1 );
+
+    check( simulator.GetNumPackets() == NumPacketEntries / 2 );
+
+    // packets are only delivered once due, in the order they were sent
+
+    time += 0.095;
+    simulator.AdvanceTime( time );
+
+    const int numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to );
+
+    check( numPackets == 3 );
+
+    for ( int i = 0; i < numPackets; ++i )
+    {
+        check( packetBytes[i] == 4 );
+        check( packetData[i][0] == i * 2 );
+        check( to[i] == 0 );
+        simulator.ReleasePacket( packetData[i] );
+    }
+
+    check( simulator.GetNumPackets() == 1 );
+
+    time += 1.0;
+    simulator.AdvanceTime( time );
+
+    check( simulator.ReceivePackets( 1, packetData, packetBytes, NULL ) == 1 );
+    check( packetData[0][0] == 6 );
+    simulator.ReleasePacket( packetData[0] );
+
+    check( simulator.GetNumPackets() == 0 );
+
+    // with a packet buffer pool, packets that fit are sent without allocating
+
+    const int NumPacketBuffers = 4;
+    const int PacketBufferBytes = 64;
+
+    const int MemorySize = 64 * 1024;
+
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+
+    {
+        TLSF_Allocator allocator( memory, MemorySize );
+
+        NetworkSimulator pooledSimulator( allocator, NumPacketEntries, time, NumPacketBuffers, PacketBufferBytes );
+
+        pooledSimulator.SetLatency( 100.0f );
+
+        AllocatorStats stats;
+        allocator.GetStats( stats );
+
+        const uint64_t numAllocations = stats.numAllocations;
+
+        uint8_t packet[PacketBufferBytes + 1];
+        memset( packet, 0, sizeof( packet ) );
+
+        for ( int i = 0; i < NumPacketBuffers; ++i )
+            pooledSimulator.SendPacket( 0, packet, PacketBufferBytes );
+
+        allocator.GetStats( stats );
+        check( stats.numAllocations == numAllocations );
+
+        // packets too big for a buffer, or sent when the pool is empty, are allocated
+
+        pooledSimulator.SendPacket( 0, packet, PacketBufferBytes / 2 );
+        pooledSimulator.SendPacket( 0, packet, PacketBufferBytes + 1 );
+
+        allocator.GetStats( stats );
+        check( stats.numAllocations == numAllocations + 2 );
+
+        time += 1.0;
+        pooledSimulator.AdvanceTime( time );
+
+        const int numPooledPackets = pooledSimulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to );
+
+        check( numPooledPackets == NumPacketBuffers + 2 );
+
+        for ( int i = 0; i < numPooledPackets; ++i )
+            pooledSimulator.ReleasePacket( packetData[i] );
+
+        allocator.GetStats( stats );
+        check( stats.numFrees == 2 );
+    }
+
+    free( memory );
+}
+
+void test_network_simulator_link_conditions()
+{
+    const int NumPacketEntries = 64;
+
+    double time = 100.0;
+
+    NetworkSimulator simulator( GetDefaultAllocator(), NumPacketEntries, time );
+
+    check( !simulator.IsActive() );
+
+    // 80kbps is 10000 bytes per second, so each 1000 byte packet takes 100ms to go out
+
+    NetworkLinkConditions bandwidthLimited;
+    bandwidthLimited.bandwidth = 80.0f;
+    bandwidthLimited.queueBytes = 2500;
+
+    NetworkLinkConditions burstLoss;
+    burstLoss.burstLossEnter = 100.0f;
+    burstLoss.burstLossExit = 0.0f;
+
+    check( simulator.SetLinkConditions( 0, bandwidthLimited ) );
+    check( simulator.SetLinkConditions( 2, burstLoss ) );
+
+    check( simulator.IsActive() );
+
+    uint8_t packet[1000];
+    memset( packet, 0, sizeof( packet ) );
+
+    // the third packet would overflow the queue
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        packet[0] = uint8_t( i );
+        simulator.SendPacket( 0, packet, sizeof( packet ) );
+    }
+
+    check( simulator.GetNumPackets() == 2 );
+
+    // links without conditions are unaffected, and a link stuck in the bad state loses everything
+
+    simulator.SendPacket( 1, packet, sizeof( packet ) );
+
+    for ( int i = 0; i < 10; ++i )
+        simulator.SendPacket( 2, packet, sizeof( packet ) );
+
+    check( simulator.GetNumPackets() == 3 );
+
+    uint8_t * packetData[NumPacketEntries];
+    int packetBytes[NumPacketEntries];
+    int to[NumPacketEntries];
+
+    time += 0.05;
+    simulator.AdvanceTime( time );
+
+    int numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to );
+    check( numPackets == 1 );
+    check( to[0] == 1 );
+    simulator.ReleasePacket( packetData[0] );
+
+    // queued packets come out at the link rate
+
+    time += 0.1;
+    simulator.AdvanceTime( time );
+
+    numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to );
+    check( numPackets == 1 );
+    check( to[0] == 0 );
+    check( packetData[0][0] == 0 );
+    simulator.ReleasePacket( packetData[0] );
+
+    time += 0.1;
+    simulator.AdvanceTime( time );
+
+    numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, to );
+    check( numPackets == 1 );
+    check( to[0] == 0 );
+    check( packetData[0][0] == 1 );
+    simulator.ReleasePacket( packetData[0] );
+
+    check( simulator.GetNumPackets() == 0 );
+
+    // once the queue has drained, the link accepts packets again
+
+    simulator.SendPacket( 0, packet, sizeof( packet ) );
+    check( simulator.GetNumPackets() == 1 );
+}
+
+void test_network_simulator_trace()
+{
+    const int NumPacketEntries = 16;
+
+    double time = 100.0;
+
+    NetworkSimulator simulator( GetDefaultAllocator(), NumPacketEntries, time );
+
+    // the trace replaces the random loss, so this has no effect on the traced link
+
+    simulator.SetPacketLoss( 100.0f );
+
+    // 100ms, lost, 50ms
+
+    const uint8_t trace[] = { 0xE8, 0x03, 0xFF, 0xFF, 0xF4, 0x01 };
+
+    NetworkLinkConditions conditions;
+    conditions.trace = trace;
+    conditions.traceBytes = sizeof( trace );
+
+    check( simulator.SetLinkConditions( 0, conditions ) );
+
+    // the trace loops, so the fourth packet replays the first entry
+
+    for ( int i = 0; i < 4; ++i )
+    {
+        uint8_t packet[1] = { uint8_t( i ) };
+        simulator.SendPacket( 0, packet, sizeof( packet ) );
+    }
+
+    check( simulator.GetNumPackets() == 3 );
+
+    uint8_t * packetData[NumPacketEntries];
+    int packetBytes[NumPacketEntries];
+
+    time += 0.06;
+    simulator.AdvanceTime( time );
+
+    int numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, NULL );
+    check( numPackets == 1 );
+    check( packetData[0][0] == 2 );
+    simulator.ReleasePacket( packetData[0] );
+
+    time += 0.05;
+    simulator.AdvanceTime( time );
+
+    numPackets = simulator.ReceivePackets( NumPacketEntries, packetData, packetBytes, NULL );
+    check( numPackets == 2 );
+    check( packetData[0][0] == 0 );
+    check( packetData[1][0] == 3 );
+    simulator.ReleasePacket( packetData[0] );
+    simulator.ReleasePacket( packetData[1] );
+
+    // other links still get the random loss
+
+    uint8_t packet[1] = { 0 };
+    simulator.SendPacket( 1, packet, sizeof( packet ) );
+    check( simulator.GetNumPackets() == 0 );
+}
+
+void PumpConnectionUpdate( ConnectionConfig & connectionConfig, double & time, Connection & sender, Connection & receiver, uint16_t & senderSequence, uint16_t & receiverSequence, float deltaTime = 0.1f, int packetLossPercent = 90 )
+{
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes;
+    if ( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+    {
+        if ( random_int( 0, 100 ) >= packetLossPercent )
+        {
+            receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes );
+            sender.ProcessAcks( &senderSequence, 1 );
+        }
+    }
+
+    if ( receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+    {
+        if ( random_int( 0, 100 ) >= packetLossPercent )
+        {
+            sender.ProcessPacket( NULL, receiverSequence, packetData, packetBytes );
+            receiver.ProcessAcks( &receiverSequence, 1 );
+        }
+    }
+
+    time += deltaTime;
+
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    senderSequence++;
+    receiverSequence++;
+}
+
+struct TestFixedMessage : public Message
+{
+    int a;
+    bool b;
+    uint32_t c;
+
+    TestFixedMessage() : a( 0 ), b( false ), c( 0 ) {}
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_int( stream, a, -10, 1000 );
+        serialize_bool( stream, b );
+        serialize_bits( stream, c, 20 );
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+
+    YOJIMBO_MESSAGE_MAX_BITS( ( BitsRequired<-10,1000>::result + 1 + 20 ) );
+};
+
+YOJIMBO_MESSAGE_FACTORY_START( TestFixedMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestFixedMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+#define TEST_SCHEMA( field )                                    \
+    field( INT, a, -10, 1000 )                                  \
+    field( BITS, b, 20 )                                        \
+    field( BOOL, c )                                            \
+    field( FLOAT, d )                                           \
+    field( COMPRESSED_FLOAT, e, -1.0f, 1.0f, 0.01f )            \
+    field( UINT64, f )
+
+YOJIMBO_SCHEMA_MESSAGE( TestSchemaMessage, TEST_SCHEMA );
+
+YOJIMBO_MESSAGE_FACTORY_START( TestSchemaMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestSchemaMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+#if YOJIMBO_DEBUG_MEMORY_LEAKS
+
+void test_shared_memory_link()
+{
+    const char * path = "yojimbo_test_shared_memory";
+    const int RingBytes = 4096;
+
+    {
+        SharedMemoryLink server( path, RingBytes, 5 );
+        check( !server.IsError() );
+        check( !server.IsClosed() );
+
+        SharedMemoryLink client( path );
+        check( !client.IsError() );
+        check( client.GetClientIndex() == 5 );
+
+        // only one client can open the link
+
+        SharedMemoryLink other( path );
+        check( other.IsError() );
+
+        // send enough packets of odd sizes to wrap both rings several times
+
+        uint8_t packet[1024];
+        int packetBytes;
+        for ( int i = 0; i < 100; ++i )
+        {
+            const int bytes = 1 + ( i * 37 ) % 1000;
+            memset( packet, i, bytes );
+
+            check( server.SendPacket( packet, bytes ) );
+            check( client.SendPacket( packet, bytes ) );
+
+            uint8_t * data = client.ReceivePacket( packetBytes );
+            check( data );
+            check( packetBytes == bytes );
+            for ( int j = 0; j < bytes; ++j )
+                check( data[j] == uint8_t( i ) );
+            client.ReleasePacket();
+
+            data = server.ReceivePacket( packetBytes );
+            check( data );
+            check( packetBytes == bytes );
+            check( data[0] == uint8_t( i ) && data[bytes-1] == uint8_t( i ) );
+            server.ReleasePacket();
+
+            check( client.ReceivePacket( packetBytes ) == NULL );
+            check( server.ReceivePacket( packetBytes ) == NULL );
+        }
+
+        // a full ring drops the packet instead of overwriting unread ones. the wrap marker may take up to one record
+
+        memset( packet, 0, sizeof( packet ) );
+        int numSent = 0;
+        while ( server.SendPacket( packet, 1000 ) )
+            numSent++;
+        check( numSent >= 3 && numSent <= 4 );
+        for ( int i = 0; i < numSent; ++i )
+        {
+            check( client.ReceivePacket( packetBytes ) );
+            check( packetBytes == 1000 );
+            client.ReleasePacket();
+        }
+        check( client.ReceivePacket( packetBytes ) == NULL );
+
+        // packets larger than half the ring are never sent
+
+        uint8_t * large = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), RingBytes );
+        memset( large, 0, RingBytes );
+        check( !server.SendPacket( large, RingBytes / 2 ) );
+        YOJIMBO_FREE( GetDefaultAllocator(), large );
+    }
+
+    // the server removes the file, so nothing can open the link once it closes
+
+    {
+        SharedMemoryLink client( path );
+        check( client.IsError() );
+        check( client.IsClosed() );
+    }
+
+    // each end sees the other close
+
+    {
+        SharedMemoryLink * server = YOJIMBO_NEW( GetDefaultAllocator(), SharedMemoryLink, path, RingBytes, 0 );
+        SharedMemoryLink * client = YOJIMBO_NEW( GetDefaultAllocator(), SharedMemoryLink, path );
+        check( !client->IsClosed() );
+        YOJIMBO_DELETE( GetDefaultAllocator(), SharedMemoryLink, server );
+        check( client->IsClosed() );
+        YOJIMBO_DELETE( GetDefaultAllocator(), SharedMemoryLink, client );
+
+        server = YOJIMBO_NEW( GetDefaultAllocator(), SharedMemoryLink, path, RingBytes, 0 );
+        client = YOJIMBO_NEW( GetDefaultAllocator(), SharedMemoryLink, path );
+        check( !server->IsClosed() );
+        YOJIMBO_DELETE( GetDefaultAllocator(), SharedMemoryLink, client );
+        check( server->IsClosed() );
+        YOJIMBO_DELETE( GetDefaultAllocator(), SharedMemoryLink, server );
+    }
+}
+
+void test_pointer_hash_map()
+{
+    // insert and remove enough pointers to grow the map a few times, removing in a different order to exercise backward shift deletion
+
+    const int NumPointers = 2000;
+
+    uint8_t * pointers[NumPointers];
+    for ( int i = 0; i < NumPointers; ++i )
+        pointers[i] = (uint8_t*) malloc( 16 );
+
+    PointerHashMap<int> map;
+
+    check( map.GetSize() == 0 );
+    check( !map.Find( pointers[0] ) );
+    check( !map.Remove( pointers[0] ) );
+
+    for ( int i = 0; i < NumPointers; ++i )
+        map.Insert( pointers[i], i );
+
+    check( map.GetSize() == NumPointers );
+
+    for ( int i = 0; i < NumPointers; ++i )
+    {
+        const int * value = map.Find( pointers[i] );
+        check( value );
+        check( *value == i );
+    }
+
+    for ( int i = 0; i < NumPointers; i += 2 )
+        check( map.Remove( pointers[i] ) );
+
+    check( map.GetSize() == NumPointers / 2 );
+
+    for ( int i = 0; i < NumPointers; ++i )
+    {
+        const int * value = map.Find( pointers[i] );
+        if ( i % 2 )
+        {
+            check( value );
+            check( *value == i );
+        }
+        else
+        {
+            check( !value );
+        }
+    }
+
+    int numFound = 0;
+    for ( int i = 0; i < map.GetCapacity(); ++i )
+    {
+        if ( map.GetKeyAtIndex( i ) )
+        {
+            check( map.GetKeyAtIndex( i ) == pointers[map.GetValueAtIndex( i )] );
+            numFound++;
+        }
+    }
+
+    check( numFound == NumPointers / 2 );
+
+    for ( int i = NumPointers - 1; i >= 0; i -= 2 )
+        check( map.Remove( pointers[i] ) );
+
+    check( map.GetSize() == 0 );
+
+    for ( int i = 0; i < NumPointers; ++i )
+        free( pointers[i] );
+}
+
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
+
+void test_message_max_bits()
+{
+    check( TestFixedMessage::MaxBits == 10 + 1 + 20 );
+
+    TestFixedMessageFactory fixedMessageFactory( GetDefaultAllocator() );
+    TestFixedMessage * fixedMessage = (TestFixedMessage*) fixedMessageFactory.CreateMessage( 0 );
+    check( fixedMessage );
+    fixedMessage->a = 999;
+    fixedMessage->b = true;
+    fixedMessage->c = 12345;
+    check( fixedMessage->GetMaxBits() == TestFixedMessage::MaxBits );
+
+    MeasureStream measureStream( GetDefaultAllocator() );
+    check( fixedMessage->SerializeInternal( measureStream ) );
+    check( measureStream.GetBitsProcessed() <= fixedMessage->GetMaxBits() );
+    fixedMessageFactory.ReleaseMessage( fixedMessage );
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    Message * message = messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    check( message->GetMaxBits() < 0 );
+    messageFactory.ReleaseMessage( message );
+
+    message = messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    check( message->GetMaxBits() == 16 );
+    messageFactory.ReleaseMessage( message );
+}
+
+void test_schema_message()
+{
+    TestSchemaMessageFactory messageFactory( GetDefaultAllocator() );
+
+    TestSchemaMessage * writeMessage = (TestSchemaMessage*) messageFactory.CreateMessage( 0 );
+    check( writeMessage );
+    check( writeMessage->a == -10 );
+    check( writeMessage->b == 0 );
+    check( writeMessage->c == false );
+    check( writeMessage->GetMaxBits() == 10 + 20 + 1 + 32 + 8 + 64 );
+
+    writeMessage->a = 999;
+    writeMessage->b = 12345;
+    writeMessage->c = true;
+    writeMessage->d = 3.25f;
+    writeMessage->e = 0.5f;
+    writeMessage->f = 0x123456789ABCDEF0ULL;
+
+    MeasureStream measureStream( GetDefaultAllocator() );
+    check( writeMessage->SerializeInternal( measureStream ) );
+    check( measureStream.GetBitsProcessed() == writeMessage->GetMaxBits() );
+
+    uint8_t buffer[256];
+    WriteStream writeStream( GetDefaultAllocator(), buffer, sizeof( buffer ) );
+    check( writeMessage->SerializeInternal( writeStream ) );
+    writeStream.Flush();
+
+    TestSchemaMessage * readMessage = (TestSchemaMessage*) messageFactory.CreateMessage( 0 );
+    check( readMessage );
+    ReadStream readStream( GetDefaultAllocator(), buffer, writeStream.GetBytesProcessed() );
+    check( readMessage->SerializeInternal( readStream ) );
+
+    check( readMessage->a == 999 );
+    check( readMessage->b == 12345 );
+    check( readMessage->c == true );
+    check( readMessage->d == 3.25f );
+    check( fabs( readMessage->e - 0.5f ) <= 0.01f );
+    check( readMessage->f == 0x123456789ABCDEF0ULL );
+
+    messageFactory.ReleaseMessage( writeMessage );
+    messageFactory.ReleaseMessage( readMessage );
+}
+
+void test_message_factory_serialize()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    // the factory serializes each type directly, and must match the virtual serialize functions bit for bit
+
+    TestMessage * writeMessage = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( writeMessage );
+    writeMessage->sequence = 1000;
+
+    MeasureStream measureStream( GetDefaultAllocator() );
+    check( messageFactory.SerializeMessage( measureStream, writeMessage ) );
+    MeasureStream virtualMeasureStream( GetDefaultAllocator() );
+    check( writeMessage->SerializeInternal( virtualMeasureStream ) );
+    check( measureStream.GetBitsProcessed() == virtualMeasureStream.GetBitsProcessed() );
+
+    uint8_t buffer[1024];
+    WriteStream writeStream( GetDefaultAllocator(), buffer, sizeof( buffer ) );
+    check( messageFactory.SerializeMessage( writeStream, writeMessage ) );
+    writeStream.Flush();
+
+    TestMessage * readMessage = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( readMessage );
+    ReadStream readStream( GetDefaultAllocator(), buffer, writeStream.GetBytesProcessed() );
+    check( readMessage->SerializeInternal( readStream ) );
+    check( readMessage->sequence == 1000 );
+
+    messageFactory.ReleaseMessage( writeMessage );
+    messageFactory.ReleaseMessage( readMessage );
+
+    // a serialize failure is passed back through the factory
+
+    Message * failMessage = messageFactory.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
+    check( failMessage );
+    ReadStream failStream( GetDefaultAllocator(), buffer, sizeof( buffer ) );
+    check( !messageFactory.SerializeMessage( failStream, failMessage ) );
+    messageFactory.ReleaseMessage( failMessage );
+}
+
+void test_message_factory_pooling()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    // without a pool, released messages go straight back to the allocator
+
+    Message * message = messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    messageFactory.ReleaseMessage( message );
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == 0 );
+
+    const int PoolSize = 4;
+
+    messageFactory.SetMessagePoolSize( TEST_MESSAGE, PoolSize );
+
+    Message * messages[PoolSize+2];
+
+    for ( int i = 0; i < PoolSize + 2; ++i )
+    {
+        messages[i] = messageFactory.CreateMessage( TEST_MESSAGE );
+        check( messages[i] );
+        ( (TestMessage*) messages[i] )->sequence = uint16_t( i + 1 );
+    }
+
+    for ( int i = 0; i < PoolSize + 2; ++i )
+        messageFactory.ReleaseMessage( messages[i] );
+
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == PoolSize );
+    check( messageFactory.GetNumPooledMessages( TEST_BLOCK_MESSAGE ) == 0 );
+
+    // pooled memory is reused, and messages are constructed fresh in it
+
+    for ( int i = 0; i < PoolSize; ++i )
+    {
+        TestMessage * testMessage = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( testMessage );
+        check( testMessage == messages[PoolSize-1-i] );
+        check( testMessage->GetType() == TEST_MESSAGE );
+        check( testMessage->GetRefCount() == 1 );
+        check( testMessage->sequence == 0 );
+        messages[PoolSize-1-i] = testMessage;
+    }
+
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == 0 );
+
+    for ( int i = 0; i < PoolSize; ++i )
+        messageFactory.ReleaseMessage( messages[i] );
+
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == PoolSize );
+
+    // shrinking the pool frees the extra messages
+
+    messageFactory.SetMessagePoolSize( TEST_MESSAGE, 1 );
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == 1 );
+
+    messageFactory.SetMessagePoolSize( TEST_MESSAGE, 0 );
+    check( messageFactory.GetNumPooledMessages( TEST_MESSAGE ) == 0 );
+}
+
+void test_connection_reliable_ordered_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+ 
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+            check( message->GetType() == TEST_MESSAGE );
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( testMessage->sequence == numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // with 90% packet loss, messages have to be sent more than once
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_RESENT] > 0 );
+}
+
+void test_connection_common_message_types()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    check( messageFactory.GetMessageTypeBits( TEST_MESSAGE ) == 2 );
+
+    const int commonTypes[] = { TEST_BLOCK_MESSAGE };
+    messageFactory.SetCommonMessageTypes( commonTypes, 1 );
+
+    check( messageFactory.GetMessageTypeBits( TEST_BLOCK_MESSAGE ) == 1 );
+    check( messageFactory.GetMessageTypeBits( TEST_MESSAGE ) == 3 );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( i % 2 )
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 0, message );
+        }
+        else
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
+        }
+    }
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 10000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+            check( message->GetType() == ( ( numMessagesReceived % 2 ) ? TEST_BLOCK_MESSAGE : TEST_MESSAGE ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_unordered_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // messages in the second packet are delivered even though the first packet hasn't arrived yet
+
+    const int MessagesPerPacket = 4;
+
+    uint8_t * packetData[2];
+    int packetBytes[2];
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        for ( int j = 0; j < MessagesPerPacket; ++j )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = uint16_t( i * MessagesPerPacket + j );
+            sender.SendMessage( 0, message );
+        }
+
+        packetData[i] = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+        check( sender.GeneratePacket( NULL, uint16_t( i ), packetData[i], connectionConfig.maxPacketSize, packetBytes[i] ) );
+    }
+
+    const int order[] = { 1, 0, 1, 0 };
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < (int) ( sizeof( order ) / sizeof( order[0] ) ); ++i )
+    {
+        const int packetIndex = order[i];
+
+        check( receiver.ProcessPacket( NULL, uint16_t( packetIndex ), packetData[packetIndex], packetBytes[packetIndex] ) );
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            // duplicates from the repeated packets are never delivered
+
+            check( i < 2 );
+            check( message->GetId() / MessagesPerPacket == packetIndex );
+            check( ( (TestMessage*) message )->sequence == message->GetId() );
+
+            numMessagesReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        check( numMessagesReceived == yojimbo_min( i + 1, 2 ) * MessagesPerPacket );
+    }
+
+    // under heavy packet loss every message still arrives exactly once
+
+    sender.Reset();
+    receiver.Reset();
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    bool received[NumMessagesSent];
+    memset( received, 0, sizeof( received ) );
+
+    numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            check( message->GetType() == TEST_MESSAGE );
+            check( message->GetId() < NumMessagesSent );
+            check( !received[message->GetId()] );
+            check( ( (TestMessage*) message )->sequence == message->GetId() );
+
+            received[message->GetId()] = true;
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_ordered_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int j = 0; j < blockSize; ++j )
+            blockData[j] = i + j;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            const int blockSize = blockMessage->GetBlockSize();
+
+            check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+
+            const uint8_t * blockData = blockMessage->GetBlockData();
+
+            check( blockData );
+
+            for ( int j = 0; j < blockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+            }
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_FRAGMENTS_RESENT] > 0 );
+}
+
+void test_connection_reliable_ordered_blocks_heavy_loss()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    // several fragments per packet, so a packet lost takes several fragments in flight with it,
+    // and fast resend, so lost fragments are sent again while they are still in the sent queue
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].maxFragmentsPerPacket = 4;
+    connectionConfig.channel[0].packetBudget = -1;
+    connectionConfig.channel[0].fastResendThreshold = 1;
+
+    const int NumFragments = 64;
+    const int BlockSize = NumFragments * connectionConfig.channel[0].fragmentSize - 100;
+
+    const int PacketLossPercent[] = { 0, 80 };
+
+    for ( int pass = 0; pass < 2; ++pass )
+    {
+        double time = 100.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = 1000;
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        for ( int j = 0; j < BlockSize; ++j )
+            blockData[j] = uint8_t( j * 7 + j / 256 );
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        bool received = false;
+
+        const int NumIterations = 10000;
+
+        for ( int i = 0; i < NumIterations && !received; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, PacketLossPercent[pass] );
+
+            Message * receivedMessage = receiver.ReceiveMessage( 0 );
+            if ( !receivedMessage )
+                continue;
+
+            check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) receivedMessage;
+
+            check( blockMessage->sequence == 1000 );
+            check( blockMessage->GetBlockSize() == BlockSize );
+
+            const uint8_t * receivedBlockData = blockMessage->GetBlockData();
+
+            check( receivedBlockData );
+
+            for ( int j = 0; j < BlockSize; ++j )
+            {
+                check( receivedBlockData[j] == uint8_t( j * 7 + j / 256 ) );
+            }
+
+            messageFactory.ReleaseMessage( receivedMessage );
+
+            received = true;
+        }
+
+        check( received );
+
+        ConnectionStats stats;
+        sender.GetStats( stats );
+
+        const uint64_t fragmentsResent = stats.channel[0].counters[CHANNEL_COUNTER_FRAGMENTS_RESENT];
+
+        if ( PacketLossPercent[pass] == 0 )
+        {
+            // every fragment is acked before its resend time, so none goes out twice
+
+            check( fragmentsResent == 0 );
+            check( stats.channel[0].counters[CHANNEL_COUNTER_PACKETS_LOST] == 0 );
+        }
+        else
+        {
+            // fragments are resent, but never more often than the packets carrying them allow
+
+            check( fragmentsResent > 0 );
+            check( stats.channel[0].counters[CHANNEL_COUNTER_PACKETS_LOST] > 0 );
+            check( fragmentsResent + NumFragments <= stats.channel[0].counters[CHANNEL_COUNTER_PACKETS_SENT] * uint64_t( connectionConfig.channel[0].maxFragmentsPerPacket ) );
+        }
+    }
+}
+
+void test_connection_reliable_ordered_shared_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+
+    // one block shared by messages sent over two connections, as a server would to two clients
+
+    const int NumConnections = 2;
+
+    Connection * senders[NumConnections];
+    Connection * receivers[NumConnections];
+    for ( int i = 0; i < NumConnections; ++i )
+    {
+        senders[i] = YOJIMBO_NEW( GetDefaultAllocator(), Connection, GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        receivers[i] = YOJIMBO_NEW( GetDefaultAllocator(), Connection, GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    }
+
+    const int BlockSize = 10000;
+
+    SharedBlock * block = SharedBlock::Create( GetDefaultAllocator(), BlockSize );
+    check( block );
+    check( block->GetSize() == BlockSize );
+    for ( int i = 0; i < BlockSize; ++i )
+        block->GetData()[i] = uint8_t( i );
+
+    const int NumMessagesSent = 4;
+
+    for ( int i = 0; i < NumConnections; ++i )
+    {
+        for ( int j = 0; j < NumMessagesSent; ++j )
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = j;
+            message->AttachSharedBlock( block );
+            check( message->GetSharedBlock() == block );
+            check( message->GetBlockData() == block->GetData() );
+            check( message->GetBlockSize() == BlockSize );
+            senders[i]->SendMessage( 0, message );
+        }
+    }
+
+    // the messages hold their own references now
+
+    block->Release();
+
+    int numMessagesReceived[NumConnections];
+    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+
+    uint16_t senderSequence[NumConnections];
+    uint16_t receiverSequence[NumConnections];
+    memset( senderSequence, 0, sizeof( senderSequence ) );
+    memset( receiverSequence, 0, sizeof( receiverSequence ) );
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        bool done = true;
+
+        for ( int j = 0; j < NumConnections; ++j )
+        {
+            double connectionTime = time;
+
+            PumpConnectionUpdate( connectionConfig, connectionTime, *senders[j], *receivers[j], senderSequence[j], receiverSequence[j] );
+
+            while ( true )
+            {
+                Message * message = receivers[j]->ReceiveMessage( 0 );
+                if ( !message )
+                    break;
+
+                check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                check( blockMessage->sequence == uint16_t( numMessagesReceived[j] ) );
+                check( !blockMessage->GetSharedBlock() );
+                check( blockMessage->GetBlockSize() == BlockSize );
+
+                const uint8_t * blockData = blockMessage->GetBlockData();
+
+                check( blockData );
+
+                for ( int k = 0; k < BlockSize; ++k )
+                {
+                    check( blockData[k] == uint8_t( k ) );
+                }
+
+                ++numMessagesReceived[j];
+
+                messageFactory.ReleaseMessage( message );
+            }
+
+            if ( numMessagesReceived[j] != NumMessagesSent )
+                done = false;
+        }
+
+        time += 0.1;
+
+        if ( done )
+            break;
+    }
+
+    for ( int i = 0; i < NumConnections; ++i )
+    {
+        check( numMessagesReceived[i] == NumMessagesSent );
+        YOJIMBO_DELETE( GetDefaultAllocator(), Connection, senders[i] );
+        YOJIMBO_DELETE( GetDefaultAllocator(), Connection, receivers[i] );
+    }
+}
+
+void test_connection_reliable_ordered_large_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    // small fragments, so the block has more fragments than fit in 16 bit fragment ids
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].largeBlocks = true;
+    connectionConfig.channel[0].maxBlockSize = 8 * 1024 * 1024;
+    connectionConfig.channel[0].fragmentSize = 64;
+    connectionConfig.channel[0].maxFragmentsPerPacket = 16;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int BlockSize = 5000000;
+
+    check( BlockSize / connectionConfig.channel[0].fragmentSize > 65536 );
+
+    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    message->sequence = 1;
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    check( blockData );
+    for ( int i = 0; i < BlockSize; ++i )
+        blockData[i] = uint8_t( i + ( i >> 16 ) );
+    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    sender.SendMessage( 0, message );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    bool received = false;
+
+    const int NumIterations = 20000;
+
+    for ( int i = 0; i < NumIterations && !received; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 10 );
+
+        Message * receivedMessage = receiver.ReceiveMessage( 0 );
+        if ( !receivedMessage )
+            continue;
+
+        TestBlockMessage * blockMessage = (TestBlockMessage*) receivedMessage;
+
+        check( blockMessage->sequence == 1 );
+        check( blockMessage->GetBlockSize() == BlockSize );
+
+        const uint8_t * receivedData = blockMessage->GetBlockData();
+        for ( int j = 0; j < BlockSize; ++j )
+        {
+            check( receivedData[j] == uint8_t( j + ( j >> 16 ) ) );
+        }
+
+        messageFactory.ReleaseMessage( receivedMessage );
+
+        received = true;
+    }
+
+    check( received );
+}
+
+class TestMappedMessageFactory : public TestMessageFactory
+{
+public:
+
+    explicit TestMappedMessageFactory( Allocator & allocator ) : TestMessageFactory( allocator ) {}
+
+    SharedBlock * CreateReceiveBlock( int channelIndex, uint16_t messageId, int bytes )
+    {
+        (void) channelIndex;
+        (void) messageId;
+        return SharedBlock::CreateMapped( GetAllocator(), "test_block_receive.bin", 0, bytes, true );
+    }
+};
+
+void test_connection_reliable_ordered_mapped_blocks()
+{
+    // send a range of a file straight from a mapping, and receive it straight into another
+
+    const int FileSize = 50000;
+    const int BlockOffset = 1234;
+    const int BlockSize = 40000;
+
+    FILE * file = fopen( "test_block_send.bin", "wb" );
+    check( file );
+    for ( int i = 0; i < FileSize; ++i )
+        fputc( uint8_t( i * 7 ), file );
+    fclose( file );
+
+    {
+        TestMappedMessageFactory messageFactory( GetDefaultAllocator() );
+
+        double time = 100.0;
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.channel[0].reassembleBlocksInPlace = true;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        SharedBlock * block = SharedBlock::CreateMapped( GetDefaultAllocator(), "test_block_send.bin", BlockOffset, BlockSize );
+        check( block );
+
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->AttachSharedBlock( block );
+        block->Release();
+        sender.SendMessage( 0, message );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        bool received = false;
+
+        const int NumIterations = 10000;
+
+        for ( int i = 0; i < NumIterations && !received; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+            Message * receivedMessage = receiver.ReceiveMessage( 0 );
+            if ( !receivedMessage )
+                continue;
+
+            check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+
+            BlockMessage * blockMessage = (BlockMessage*) receivedMessage;
+
+            check( blockMessage->GetSharedBlock() );
+            check( blockMessage->GetBlockSize() == BlockSize );
+
+            const uint8_t * blockData = blockMessage->GetBlockData();
+            for ( int j = 0; j < BlockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( ( BlockOffset + j ) * 7 ) );
+            }
+
+            messageFactory.ReleaseMessage( receivedMessage );
+
+            received = true;
+        }
+
+        check( received );
+    }
+
+    // the mapping wrote the block through to the file
+
+    file = fopen( "test_block_receive.bin", "rb" );
+    check( file );
+    for ( int i = 0; i < BlockSize; ++i )
+    {
+        check( fgetc( file ) == uint8_t( ( BlockOffset + i ) * 7 ) );
+    }
+    fclose( file );
+
+    remove( "test_block_send.bin" );
+    remove( "test_block_receive.bin" );
+}
+
+class TestResumeMessageFactory : public TestMessageFactory
+{
+public:
+
+    explicit TestResumeMessageFactory( Allocator & allocator ) : TestMessageFactory( allocator ), m_block( NULL ) {}
+
+    ~TestResumeMessageFactory()
+    {
+        if ( m_block )
+            m_block->Release();
+    }
+
+    SharedBlock * CreateReceiveBlock( int channelIndex, uint16_t messageId, int bytes )
+    {
+        (void) channelIndex;
+        (void) messageId;
+        if ( m_block )
+            m_block->Release();
+        m_block = SharedBlock::Create( GetAllocator(), bytes );
+        if ( m_block )
+            m_block->Acquire();
+        return m_block;
+    }
+
+    SharedBlock * FindResumeBlock( int channelIndex, uint64_t blockHash, int bytes )
+    {
+        (void) channelIndex;
+        (void) bytes;
+        if ( !m_block || m_block->GetBlockHash() != blockHash )
+            return NULL;
+        m_block->Acquire();
+        return m_block;
+    }
+
+    int GetNumReceivedFragments()
+    {
+        BitArray * receivedFragments = m_block ? m_block->GetReceivedFragments() : NULL;
+        if ( !receivedFragments )
+            return 0;
+        int numReceivedFragments = 0;
+        for ( int i = 0; i < receivedFragments->GetSize(); ++i )
+        {
+            if ( receivedFragments->GetBit( i ) )
+                numReceivedFragments++;
+        }
+        return numReceivedFragments;
+    }
+
+private:
+
+    SharedBlock * m_block;
+};
+
+void test_connection_reliable_ordered_resume_blocks()
+{
+    TestResumeMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].resumableBlocks = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int BlockSize = 64 * 1024;
+    const int NumFragments = BlockSize / connectionConfig.channel[0].fragmentSize;
+
+    SharedBlock * block = SharedBlock::Create( GetDefaultAllocator(), BlockSize );
+    check( block );
+    for ( int i = 0; i < BlockSize; ++i )
+        block->GetData()[i] = uint8_t( i * 13 );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // get half of the block across, then drop the connection
+
+    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    message->AttachSharedBlock( block );
+    sender.SendMessage( 0, message );
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations && messageFactory.GetNumReceivedFragments() < NumFragments / 2; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+    }
+
+    check( messageFactory.GetNumReceivedFragments() >= NumFragments / 2 );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+
+    sender.Reset();
+    receiver.Reset();
+
+    // send the same block on the new connection. the fragments received before are skipped
+
+    message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    message->sequence = 1;
+    message->AttachSharedBlock( block );
+    sender.SendMessage( 0, message );
+
+    block->Release();
+
+    int numIterations = 0;
+
+    Message * receivedMessage = NULL;
+
+    while ( numIterations < NumIterations && !receivedMessage )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        receivedMessage = receiver.ReceiveMessage( 0 );
+        numIterations++;
+    }
+
+    check( receivedMessage );
+    check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+    check( ( (TestBlockMessage*) receivedMessage )->sequence == 1 );
+
+    // one fragment goes out per packet, so receiving the block from scratch would take NumFragments iterations
+
+    check( numIterations < NumFragments * 3 / 4 );
+
+    BlockMessage * blockMessage = (BlockMessage*) receivedMessage;
+    check( blockMessage->GetBlockSize() == BlockSize );
+    const uint8_t * blockData = blockMessage->GetBlockData();
+    for ( int i = 0; i < BlockSize; ++i )
+    {
+        check( blockData[i] == uint8_t( i * 13 ) );
+    }
+
+    messageFactory.ReleaseMessage( receivedMessage );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_reliable_ordered_compressed_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].compressBlocks = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // one compressible block and one that isn't, which goes out as is
+
+    const int NumMessagesSent = 2;
+    const int BlockSize = 64 * 1024;
+    const int NumFragments = BlockSize / connectionConfig.channel[0].fragmentSize;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        check( blockData );
+        if ( i == 0 )
+        {
+            for ( int j = 0; j < BlockSize; ++j )
+                blockData[j] = uint8_t( ( j / 100 ) % 7 );
+        }
+        else
+        {
+            random_bytes( blockData, BlockSize );
+        }
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numIterations = 0;
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations && numMessagesReceived < NumMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        numIterations++;
+
+        Message * message = receiver.ReceiveMessage( 0 );
+        if ( !message )
+            continue;
+
+        check( message->GetId() == (int) numMessagesReceived );
+        check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+        BlockMessage * blockMessage = (BlockMessage*) message;
+        check( blockMessage->GetBlockSize() == BlockSize );
+
+        if ( numMessagesReceived == 0 )
+        {
+            // one fragment goes out per packet, so the compressed block arrives in a fraction of the fragments
+
+            check( numIterations < NumFragments / 4 );
+
+            const uint8_t * blockData = blockMessage->GetBlockData();
+            for ( int j = 0; j < BlockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( ( j / 100 ) % 7 ) );
+            }
+        }
+
+        messageFactory.ReleaseMessage( message );
+
+        numMessagesReceived++;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+    check( numIterations >= NumFragments );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_reliable_ordered_blocks_in_flight()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].maxBlocksInFlight = 4;
+    connectionConfig.channel[0].maxFragmentsPerPacket = 4;
+    connectionConfig.channel[0].packetBudget = -1;
+    connectionConfig.channel[0].reassembleBlocksInPlace = true;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    // Every fifth message is a regular message, so runs of blocks in flight are broken up.
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( ( i % 5 ) == 4 )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
+            continue;
+        }
+
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int j = 0; j < blockSize; ++j )
+            blockData[j] = i + j;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            if ( ( numMessagesReceived % 5 ) == 4 )
+            {
+                check( message->GetType() == TEST_MESSAGE );
+
+                TestMessage * testMessage = (TestMessage*) message;
+
+                check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+            }
+            else
+            {
+                check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+                const int blockSize = blockMessage->GetBlockSize();
+
+                check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+
+                const uint8_t * blockData = blockMessage->GetBlockData();
+
+                check( blockData );
+
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+                }
+            }
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_ordered_block_fragments_per_packet()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].maxFragmentsPerPacket = 8;
+    connectionConfig.channel[0].packetBudget = -1;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int BlockSize = 32 * 1024;
+
+    TestBlockMessage * sendMessage = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( sendMessage );
+    sendMessage->sequence = 0;
+    uint8_t * sendBlockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    for ( int j = 0; j < BlockSize; ++j )
+        sendBlockData[j] = uint8_t( j );
+    sendMessage->AttachBlock( messageFactory.GetAllocator(), sendBlockData, BlockSize );
+    sender.SendMessage( 0, sendMessage );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // The block is 32 fragments. Sent one fragment per packet it would take at least 32 packets, 
+    // but several fragments fit in each packet, so it should arrive well before that.
+
+    const int NumIterations = 16;
+
+    Message * message = NULL;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        message = receiver.ReceiveMessage( 0 );
+        if ( message )
+            break;
+    }
+
+    check( message );
+    check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+    check( blockMessage->GetBlockSize() == BlockSize );
+
+    const uint8_t * blockData = blockMessage->GetBlockData();
+
+    check( blockData );
+
+    for ( int j = 0; j < BlockSize; ++j )
+    {
+        check( blockData[j] == uint8_t( j ) );
+    }
+
+    messageFactory.ReleaseMessage( message );
+}
+
+void test_connection_reliable_ordered_block_prefix()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int BlockSize = 16 * 1024 + 100;
+
+    TestBlockMessage * sendMessage = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( sendMessage );
+    uint8_t * sendBlockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    for ( int j = 0; j < BlockSize; ++j )
+        sendBlockData[j] = uint8_t( j * 3 );
+    sendMessage->AttachBlock( messageFactory.GetAllocator(), sendBlockData, BlockSize );
+    sender.SendMessage( 0, sendMessage );
+
+    const uint8_t * prefixData = NULL;
+    int prefixBytes = 0;
+
+    check( !receiver.GetReceivedBlockPrefix( 0, prefixData, prefixBytes ) );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    const int NumIterations = 256;
+
+    int previousPrefixBytes = 0;
+
+    bool sawPartialBlock = false;
+
+    Message * message = NULL;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        message = receiver.ReceiveMessage( 0 );
+        if ( message )
+            break;
+
+        if ( receiver.GetReceivedBlockPrefix( 0, prefixData, prefixBytes ) )
+        {
+            check( prefixBytes >= previousPrefixBytes );
+            check( prefixBytes < BlockSize );
+
+            for ( int j = 0; j < prefixBytes; ++j )
+            {
+                check( prefixData[j] == uint8_t( j * 3 ) );
+            }
+
+            if ( prefixBytes > 0 )
+                sawPartialBlock = true;
+
+            previousPrefixBytes = prefixBytes;
+        }
+    }
+
+    check( sawPartialBlock );
+
+    check( message );
+    check( message->GetType() == TEST_BLOCK_MESSAGE );
+    check( ( (TestBlockMessage*) message )->GetBlockSize() == BlockSize );
+
+    check( !receiver.GetReceivedBlockPrefix( 0, prefixData, prefixBytes ) );
+
+    messageFactory.ReleaseMessage( message );
+}
+
+void test_connection_reliable_ordered_messages_and_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( rand() % 2 )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 0, message );
+        }
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            switch ( message->GetType() )
+            {
+                case TEST_MESSAGE:
+                {
+                    TestMessage * testMessage = (TestMessage*) message;
+
+                    check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+
+                    ++numMessagesReceived;
+                }
+                break;
+
+                case TEST_BLOCK_MESSAGE:
+                {
+                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                    check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+                    const int blockSize = blockMessage->GetBlockSize();
+
+                    check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+        
+                    const uint8_t * blockData = blockMessage->GetBlockData();
+
+                    check( blockData );
+
+                    for ( int j = 0; j < blockSize; ++j )
+                    {
+                        check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+                    }
+
+                    ++numMessagesReceived;
+                }
+                break;
+            }
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_ordered_messages_and_blocks_multiple_channels()
+{
+    const int NumChannels = 2;
+
+    double time = 100.0;
+    
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = NumChannels;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxMessagesPerPacket = 8;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].maxMessagesPerPacket = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        for ( int i = 0; i < NumMessagesSent; ++i )
+        {
+            if ( rand() % 2 )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                check( message );
+                message->sequence = i;
+                sender.SendMessage( channelIndex, message );
+            }
+            else
+            {
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                check( message );
+                message->sequence = i;
+                const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+                for ( int j = 0; j < blockSize; ++j )
+                    blockData[j] = i + j;
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+                sender.SendMessage( channelIndex, message );
+            }
+        }
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 10000;
+
+    int numMessagesReceived[NumChannels];
+    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        {
+            while ( true )
+            {
+                Message * message = receiver.ReceiveMessage( channelIndex );
+                if ( !message )
+                    break;
+
+                check( message->GetId() == (int) numMessagesReceived[channelIndex] );
+
+                switch ( message->GetType() )
+                {
+                    case TEST_MESSAGE:
+                    {
+                        TestMessage * testMessage = (TestMessage*) message;
+
+                        check( testMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+
+                        ++numMessagesReceived[channelIndex];
+                    }
+                    break;
+
+                    case TEST_BLOCK_MESSAGE:
+                    {
+                        TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                        check( blockMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+
+                        const int blockSize = blockMessage->GetBlockSize();
+
+                        check( blockSize == 1 + ( ( numMessagesReceived[channelIndex] * 901 ) % 3333 ) );
+            
+                        const uint8_t * blockData = blockMessage->GetBlockData();
+
+                        check( blockData );
+
+                        for ( int j = 0; j < blockSize; ++j )
+                        {
+                            check( blockData[j] == uint8_t( numMessagesReceived[channelIndex] + j ) );
+                        }
+
+                        ++numMessagesReceived[channelIndex];
+                    }
+                    break;
+                }
+
+                messageFactory.ReleaseMessage( message );
+            }
+        }
+
+        bool receivedAllMessages = true;
+
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        {
+            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
+            {
+                receivedAllMessages = false;
+                break;
+            }
+        }
+
+        if ( receivedAllMessages )
+            break;
+    }
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+    }
+}
+
+void test_connection_compact_packet_header()
+{
+    const int NumChannels = 3;
+
+    double time = 100.0;
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = NumChannels;
+    connectionConfig.compactPacketHeader = true;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].disableBlocks = true;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[2].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+    connectionConfig.channel[2].disableBlocks = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        // only send on some channels at a time, so packets carry different channel masks
+
+        for ( int i = 0; i < NumMessagesSent; ++i )
+        {
+            if ( channelIndex == 1 && i % 4 == 0 )
+            {
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                check( message );
+                message->sequence = i;
+                const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+                for ( int j = 0; j < blockSize; ++j )
+                    blockData[j] = i + j;
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+                sender.SendMessage( channelIndex, message );
+            }
+            else
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                check( message );
+                message->sequence = i;
+                sender.SendMessage( channelIndex, message );
+            }
+        }
+    }
+
+    const int NumIterations = 10000;
+
+    int numMessagesReceived[NumChannels];
+    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        bool receivedAllMessages = true;
+
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        {
+            while ( true )
+            {
+                Message * message = receiver.ReceiveMessage( channelIndex );
+                if ( !message )
+                    break;
+
+                if ( message->GetType() == TEST_BLOCK_MESSAGE )
+                {
+                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                    check( channelIndex == 1 );
+                    check( blockMessage->GetBlockSize() == 1 + ( ( blockMessage->sequence * 901 ) % 3333 ) );
+                    for ( int j = 0; j < blockMessage->GetBlockSize(); ++j )
+                    {
+                        check( blockMessage->GetBlockData()[j] == uint8_t( blockMessage->sequence + j ) );
+                    }
+                }
+
+                if ( connectionConfig.channel[channelIndex].type == CHANNEL_TYPE_RELIABLE_ORDERED )
+                    check( message->GetId() == numMessagesReceived[channelIndex] );
+
+                ++numMessagesReceived[channelIndex];
+
+                messageFactory.ReleaseMessage( message );
+            }
+
+            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
+                receivedAllMessages = false;
+        }
+
+        if ( receivedAllMessages )
+            break;
+    }
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+    }
+}
+
+void test_connection_negotiate_serialize_checks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig releaseConfig;
+    releaseConfig.serializeChecks = false;
+    releaseConfig.negotiateSerializeChecks = true;
+
+    ConnectionConfig debugConfig;
+    debugConfig.serializeChecks = true;
+    debugConfig.negotiateSerializeChecks = true;
+
+    uint8_t packetData[1024];
+    int packetBytes = 0;
+
+    // release peers leave the checks out of their packets
+
+    Connection releaseSender( GetDefaultAllocator(), messageFactory, releaseConfig, time );
+    Connection releaseReceiver( GetDefaultAllocator(), messageFactory, releaseConfig, time );
+    Connection debugSender( GetDefaultAllocator(), messageFactory, debugConfig, time );
+
+    check( !releaseSender.GetSerializeChecks() );
+    check( debugSender.GetSerializeChecks() );
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 1;
+    releaseSender.SendMessage( 0, message );
+
+    message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 1;
+    debugSender.SendMessage( 0, message );
+
+    int debugPacketBytes = 0;
+    check( debugSender.GeneratePacket( NULL, 0, packetData, sizeof( packetData ), debugPacketBytes ) );
+    check( releaseSender.GeneratePacket( NULL, 0, packetData, sizeof( packetData ), packetBytes ) );
+    check( packetBytes < debugPacketBytes );
+
+    check( releaseReceiver.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+    Message * received = releaseReceiver.ReceiveMessage( 0 );
+    check( received );
+    check( ( (TestMessage*) received )->sequence == 1 );
+    messageFactory.ReleaseMessage( received );
+    check( !releaseReceiver.GetSerializeChecks() );
+
+    // a debug peer turns the checks on in both directions
+
+    Connection debugReceiver( GetDefaultAllocator(), messageFactory, debugConfig, time );
+
+    check( debugReceiver.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+    received = debugReceiver.ReceiveMessage( 0 );
+    check( received );
+    check( ( (TestMessage*) received )->sequence == 1 );
+    messageFactory.ReleaseMessage( received );
+
+    check( debugReceiver.GeneratePacket( NULL, 0, packetData, sizeof( packetData ), packetBytes ) );
+    check( releaseSender.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+    check( releaseSender.GetSerializeChecks() );
+
+    message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 2;
+    releaseSender.SendMessage( 0, message );
+
+    check( releaseSender.GeneratePacket( NULL, 1, packetData, sizeof( packetData ), packetBytes ) );
+    check( debugReceiver.ProcessPacket( NULL, 1, packetData, packetBytes ) );
+    received = debugReceiver.ReceiveMessage( 0 );
+    check( received );
+    check( ( (TestMessage*) received )->sequence == 2 );
+    messageFactory.ReleaseMessage( received );
+
+    releaseSender.Reset();
+    check( !releaseSender.GetSerializeChecks() );
+}
+
+void test_connection_unreliable_unordered_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 16;
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = j;
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_MESSAGE );
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_unreliable_sequenced()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_SEQUENCED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumPackets = 8;
+    const int MessagesPerPacket = 4;
+
+    uint8_t * packetData[NumPackets];
+    int packetBytes[NumPackets];
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        for ( int j = 0; j < MessagesPerPacket; ++j )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = uint16_t( i * MessagesPerPacket + j );
+            sender.SendMessage( 0, message );
+        }
+
+        packetData[i] = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+        check( sender.GeneratePacket( NULL, uint16_t( i ), packetData[i], connectionConfig.maxPacketSize, packetBytes[i] ) );
+    }
+
+    // packets arrive 1, 0, 3, 2, 2, 5, 4 ... so every other packet is stale or a duplicate
+
+    const int order[] = { 1, 0, 3, 2, 2, 5, 4, 7, 6 };
+
+    int numReceived = 0;
+    int lastReceived = -1;
+
+    for ( int i = 0; i < (int) ( sizeof( order ) / sizeof( order[0] ) ); ++i )
+    {
+        const int packetIndex = order[i];
+
+        check( receiver.ProcessPacket( NULL, uint16_t( packetIndex ), packetData[packetIndex], packetBytes[packetIndex] ) );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( testMessage->GetId() == packetIndex );
+            check( ( packetIndex % 2 ) == 1 );
+            check( testMessage->sequence / MessagesPerPacket == packetIndex );
+            check( int( testMessage->sequence ) > lastReceived );
+
+            lastReceived = testMessage->sequence;
+            numReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numReceived == NumPackets / 2 * MessagesPerPacket );
+
+    // after a reset older sequence numbers are accepted again
+
+    receiver.Reset();
+
+    check( receiver.ProcessPacket( NULL, 0, packetData[0], packetBytes[0] ) );
+
+    numReceived = 0;
+    while ( Message * message = receiver.ReceiveMessage( 0 ) )
+    {
+        numReceived++;
+        messageFactory.ReleaseMessage( message );
+    }
+
+    check( numReceived == MessagesPerPacket );
+}
+
+struct TestBatchEvent
+{
+    uint32_t entity;
+    int type;
+    bool flag;
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, entity, 20 );
+        serialize_int( stream, type, 0, 15 );
+        serialize_bool( stream, flag );
+        return true;
+    }
+};
+
+typedef BatchMessage<64> TestBatchMessage;
+
+YOJIMBO_MESSAGE_FACTORY_START( TestBatchMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestBatchMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+void test_connection_unreliable_redundant_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].redundantMessages = 4;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+    uint8_t * latePacketData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+    int latePacketBytes = 0;
+
+    const int NumPackets = 8;
+
+    // packets 2 and 3 are lost, and their messages go out again in packet 4. messages stop going out again once a packet carrying them is acked
+
+    const int expectedMessagesInPacket[NumPackets] = { 1, 1, 1, 2, 3, 1, 1, 1 };
+
+    int numReceived = 0;
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+
+        const uint16_t sequence = uint16_t( i );
+
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+        // a fresh connection keeps every message in the packet, copies included
+
+        {
+            Connection observer( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            check( observer.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+            int numMessages = 0;
+            while ( Message * observedMessage = observer.ReceiveMessage( 0 ) )
+            {
+                messageFactory.ReleaseMessage( observedMessage );
+                numMessages++;
+            }
+            check( numMessages == expectedMessagesInPacket[i] );
+        }
+
+        if ( i == 3 )
+        {
+            memcpy( latePacketData, packetData, packetBytes );
+            latePacketBytes = packetBytes;
+        }
+
+        if ( i == 2 || i == 3 )
+            continue;
+
+        check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+
+        sender.ProcessAcks( &sequence, 1 );
+
+        while ( true )
+        {
+            Message * receivedMessage = receiver.ReceiveMessage( 0 );
+            if ( !receivedMessage )
+                break;
+
+            TestMessage * testMessage = (TestMessage*) receivedMessage;
+            check( testMessage->sequence == numReceived );
+            check( testMessage->GetId() == numReceived );
+            numReceived++;
+
+            messageFactory.ReleaseMessage( receivedMessage );
+        }
+    }
+
+    check( numReceived == NumPackets );
+
+    // packet 3 turns up late. messages 2 and 3 were already received, so they are dropped
+
+    check( receiver.ProcessPacket( NULL, 3, latePacketData, latePacketBytes ) );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+}
+
+void test_connection_unreliable_jitter_buffer()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].jitterBuffer = true;
+    connectionConfig.channel[0].jitterBufferTickRate = 60.0f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // one packet per tick, with 50ms latency and up to 40ms of jitter, so packets arrive out of order
+
+    const int NumTicks = 180;
+    const double TickTime = 1.0 / 60.0;
+
+    uint8_t * packetData[NumTicks];
+    int packetBytes[NumTicks];
+    double arrivalTime[NumTicks];
+
+    for ( int i = 0; i < NumTicks; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        message->SetTick( uint32_t( 1000 + i ) );
+        sender.SendMessage( 0, message );
+
+        packetData[i] = (uint8_t*) malloc( connectionConfig.maxPacketSize );
+        packetBytes[i] = 0;
+        check( sender.GeneratePacket( NULL, uint16_t( i ), packetData[i], connectionConfig.maxPacketSize, packetBytes[i] ) );
+
+        arrivalTime[i] = time + i * TickTime + 0.05 + ( ( i * 7 ) % 5 ) * 0.01;
+    }
+
+    const int WarmupTicks = 60;
+
+    int numReceived = 0;
+    int lastTick = -1;
+    double minLatency = 1000.0;
+    double maxLatency = 0.0;
+
+    for ( int step = 0; step < 4000; ++step )
+    {
+        const double receiveTime = time + step * 0.001;
+
+        receiver.AdvanceTime( receiveTime );
+
+        for ( int i = 0; i < NumTicks; ++i )
+        {
+            if ( packetData[i] && arrivalTime[i] <= receiveTime )
+            {
+                check( receiver.ProcessPacket( NULL, uint16_t( i ), packetData[i], packetBytes[i] ) );
+                free( packetData[i] );
+                packetData[i] = NULL;
+            }
+        }
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            // messages come out in tick order, and never before they arrive
+
+            TestMessage * testMessage = (TestMessage*) message;
+            const int tick = int( testMessage->GetTick() ) - 1000;
+            check( tick == testMessage->sequence );
+            check( tick > lastTick );
+            check( arrivalTime[tick] <= receiveTime );
+            lastTick = tick;
+
+            if ( tick >= WarmupTicks )
+            {
+                const double latency = receiveTime - ( time + tick * TickTime );
+                minLatency = yojimbo_min( minLatency, latency );
+                maxLatency = yojimbo_max( maxLatency, latency );
+                numReceived++;
+            }
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    // once the jitter is measured, no tick arrives too late to play, and each is played out at about the same latency.
+    // without the jitter buffer the latency would vary by the full 40ms of jitter
+
+    check( numReceived == NumTicks - WarmupTicks );
+    check( maxLatency - minLatency < 0.02 );
+    check( maxLatency < 0.25 );
+}
+
+void test_connection_batch_messages()
+{
+    TestBatchMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // each event is 25 bits, so 20 events fit in a batch and the last one is left over for the next batch
+
+    const int NumEvents = 200;
+
+    TestBatchMessage * batch = NULL;
+    int numBatchesSent = 0;
+
+    for ( int i = 0; i < NumEvents; ++i )
+    {
+        TestBatchEvent event;
+        event.entity = uint32_t( i * 1000 );
+        event.type = i % 16;
+        event.flag = ( i % 3 ) == 0;
+
+        if ( batch && !batch->AddSubMessage( event ) )
+        {
+            check( batch->GetNumSubMessages() == 20 );
+            check( batch->GetNumBytes() == 63 );
+            sender.SendMessage( 0, batch );
+            numBatchesSent++;
+            batch = NULL;
+        }
+
+        if ( !batch )
+        {
+            batch = (TestBatchMessage*) messageFactory.CreateMessage( 0 );
+            check( batch );
+            check( batch->AddSubMessage( event ) );
+        }
+    }
+
+    sender.SendMessage( 0, batch );
+    numBatchesSent++;
+
+    check( numBatchesSent == 10 );
+
+    int numEventsReceived = 0;
+    int numBatchesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            TestBatchMessage * receivedBatch = (TestBatchMessage*) message;
+
+            TestBatchEvent event;
+            while ( receivedBatch->ReadSubMessage( event ) )
+            {
+                check( event.entity == uint32_t( numEventsReceived * 1000 ) );
+                check( event.type == numEventsReceived % 16 );
+                check( event.flag == ( ( numEventsReceived % 3 ) == 0 ) );
+                numEventsReceived++;
+            }
+
+            numBatchesReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numBatchesReceived == numBatchesSent )
+            break;
+    }
+
+    check( numBatchesReceived == numBatchesSent );
+    check( numEventsReceived == NumEvents );
+}
+
+struct TestSnapshotMessage : public SnapshotMessage
+{
+    enum { NumValues = 32 };
+
+    uint32_t tick;
+    uint32_t values[NumValues];
+
+    TestSnapshotMessage()
+    {
+        tick = 0;
+        memset( values, 0, sizeof( values ) );
+    }
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, tick, 32 );
+
+        const TestSnapshotMessage * baseline = (const TestSnapshotMessage*) GetBaseline();
+
+        for ( int i = 0; i < NumValues; ++i )
+        {
+            bool changed = true;
+            if ( baseline )
+            {
+                if ( Stream::IsWriting )
+                    changed = values[i] != baseline->values[i];
+                serialize_bool( stream, changed );
+            }
+
+            if ( changed )
+                serialize_bits( stream, values[i], 16 );
+            else if ( Stream::IsReading )
+                values[i] = baseline->values[i];
+        }
+
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+};
+
+YOJIMBO_MESSAGE_FACTORY_START( TestSnapshotMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestSnapshotMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+static void SetSnapshotValues( TestSnapshotMessage * message, uint32_t tick )
+{
+    // only a few values change each tick
+
+    message->tick = tick;
+    for ( int i = 0; i < TestSnapshotMessage::NumValues; ++i )
+        message->values[i] = ( tick / ( i + 1 ) ) & 0xFFFF;
+}
+
+struct TestStringMessage : public Message
+{
+    uint16_t sequence;
+    char text[32];
+    uint32_t flags;
+
+    TestStringMessage() : sequence( 0 ), flags( 0 ) { text[0] = '\0'; }
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, sequence, 16 );
+        serialize_string( stream, text, sizeof( text ) );
+        // end off the byte boundary, so the next message in the packet starts at a different bit position
+        serialize_bits( stream, flags, 3 );
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+};
+
+YOJIMBO_MESSAGE_FACTORY_START( TestStringMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestStringMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+void test_connection_serialized_messages()
+{
+    // fixed size messages serialize to the same bits wherever they start in a packet
+
+    {
+        TestFixedMessageFactory messageFactory( GetDefaultAllocator() );
+        TestFixedMessage * message = (TestFixedMessage*) messageFactory.CreateMessage( 0 );
+        check( message );
+        SerializedMessage * serializedMessage = SerializedMessage::Create( GetDefaultAllocator(), *message );
+        check( serializedMessage );
+        check( serializedMessage->GetMaxBits() == message->GetMaxBits() );
+        serializedMessage->Release();
+        messageFactory.ReleaseMessage( message );
+    }
+
+    // string messages pad to a byte, so the serialized bits must land at any bit position in the packet
+
+    TestStringMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestStringMessage * message = (TestStringMessage*) messageFactory.CreateMessage( 0 );
+        check( message );
+        message->sequence = i;
+        message->flags = i % 8;
+        snprintf( message->text, sizeof( message->text ), "message %d", i );
+
+        SerializedMessage * serializedMessage = SerializedMessage::Create( GetDefaultAllocator(), *message );
+        check( serializedMessage );
+        messageFactory.ReleaseMessage( message );
+
+        // the message sent is empty, only the serialized bits carry its contents
+
+        Message * sendMessage = messageFactory.CreateMessage( 0 );
+        check( sendMessage );
+        sendMessage->AttachSerializedMessage( serializedMessage );
+        serializedMessage->Release();
+        sender.SendMessage( 0, sendMessage );
+    }
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            TestStringMessage * stringMessage = (TestStringMessage*) message;
+
+            char text[32];
+            snprintf( text, sizeof( text ), "message %d", numMessagesReceived );
+
+            check( stringMessage->sequence == numMessagesReceived );
+            check( strcmp( stringMessage->text, text ) == 0 );
+            check( stringMessage->flags == uint32_t( numMessagesReceived % 8 ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+struct TestDictionaryMessage : public Message
+{
+    uint16_t sequence;
+    char name[64];
+
+    TestDictionaryMessage() : sequence( 0 ) { name[0] = '\0'; }
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, sequence, 16 );
+        serialize_dictionary_string( stream, name, sizeof( name ) );
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+};
+
+YOJIMBO_MESSAGE_FACTORY_START( TestDictionaryMessageFactory, 1 );
+    YOJIMBO_DECLARE_MESSAGE_TYPE( 0, TestDictionaryMessage );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+static const char * TestDictionaryNames[] = { "sword of a thousand truths", "bag of holding", "potion of healing", "ring of invisibility", "scroll of fireball" };
+
+static int SendDictionaryMessage( Connection & sender, Connection & receiver, MessageFactory & messageFactory, uint16_t packetSequence, uint16_t messageSequence, const char * name )
+{
+    TestDictionaryMessage * message = (TestDictionaryMessage*) messageFactory.CreateMessage( 0 );
+    check( message );
+    message->sequence = messageSequence;
+    strcpy( message->name, name );
+    sender.SendMessage( 0, message );
+
+    uint8_t packetData[1024];
+    int packetBytes = 0;
+    check( sender.GeneratePacket( NULL, packetSequence, packetData, sizeof( packetData ), packetBytes ) );
+    check( receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes ) );
+    sender.ProcessAcks( &packetSequence, 1 );
+
+    TestDictionaryMessage * received = (TestDictionaryMessage*) receiver.ReceiveMessage( 0 );
+    check( received );
+    check( received->sequence == messageSequence );
+    check( strcmp( received->name, name ) == 0 );
+    messageFactory.ReleaseMessage( received );
+
+    return packetBytes;
+}
+
+void test_connection_string_table()
+{
+    TestDictionaryMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    // one less entry than names, so the last name never fits in the table and always goes out in full
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.stringTableSize = 4;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumNames = sizeof( TestDictionaryNames ) / sizeof( TestDictionaryNames[0] );
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestDictionaryMessage * message = (TestDictionaryMessage*) messageFactory.CreateMessage( 0 );
+        check( message );
+        message->sequence = i;
+        strcpy( message->name, TestDictionaryNames[i%NumNames] );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            TestDictionaryMessage * dictionaryMessage = (TestDictionaryMessage*) message;
+
+            check( dictionaryMessage->sequence == numMessagesReceived );
+            check( strcmp( dictionaryMessage->name, TestDictionaryNames[numMessagesReceived%NumNames] ) == 0 );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // once the definitions are acked, names in the table cost an id, while the name that didn't fit still goes out in full
+
+    for ( int i = 0; i < 16; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    const int referenceBytes = SendDictionaryMessage( sender, receiver, messageFactory, senderSequence++, NumMessagesSent, TestDictionaryNames[0] );
+    const int fullBytes = SendDictionaryMessage( sender, receiver, messageFactory, senderSequence++, NumMessagesSent + 1, TestDictionaryNames[NumNames-1] );
+
+    check( fullBytes - referenceBytes >= (int) strlen( TestDictionaryNames[NumNames-1] ) - 2 );
+
+    // after a reset, strings are defined again from scratch
+
+    sender.Reset();
+    receiver.Reset();
+
+    const int definitionBytes = SendDictionaryMessage( sender, receiver, messageFactory, senderSequence++, 0, TestDictionaryNames[0] );
+    const int secondBytes = SendDictionaryMessage( sender, receiver, messageFactory, senderSequence++, 1, TestDictionaryNames[0] );
+
+    check( definitionBytes > secondBytes + (int) strlen( TestDictionaryNames[0] ) - 2 );
+}
+
+void test_connection_reliable_ordered_serialize_once()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].serializeMessagesOnce = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+        check( message->GetSerializedMessage() );
+    }
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+            check( message->GetType() == TEST_MESSAGE );
+            check( !message->GetSerializedMessage() );
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( testMessage->sequence == numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_snapshot()
+{
+    TestSnapshotMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_SNAPSHOT;
+    connectionConfig.channel[0].baselineBufferSize = 32;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t senderSequence = 0;
+
+    uint32_t lastTickReceived = 0;
+    int numReceived = 0;
+    int numDeltaPackets = 0;
+
+    const int NumIterations = 400;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        // the receiver loses all its state half way through, so the sender's baselines go missing
+
+        if ( i == NumIterations / 2 )
+        {
+            receiver.Reset();
+            lastTickReceived = 0;
+        }
+
+        // queue two snapshots per packet. only the newest goes out
+
+        for ( int j = 0; j < 2; ++j )
+        {
+            TestSnapshotMessage * message = (TestSnapshotMessage*) messageFactory.CreateMessage( 0 );
+            check( message );
+            SetSnapshotValues( message, uint32_t( i * 2 + j + 1 ) );
+            sender.SendMessage( 0, message );
+        }
+
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+        if ( packetBytes < 40 )
+            numDeltaPackets++;
+
+        if ( random_int( 0, 100 ) >= 30 )
+        {
+            // only packets that were processed are acked, just like the reliable endpoint
+
+            if ( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) )
+                sender.ProcessAcks( &senderSequence, 1 );
+        }
+
+        check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+        Message * message = receiver.ReceiveMessage( 0 );
+        if ( message )
+        {
+            TestSnapshotMessage * snapshot = (TestSnapshotMessage*) message;
+            check( snapshot->tick == uint32_t( i * 2 + 2 ) );
+            check( snapshot->tick > lastTickReceived );
+            for ( int j = 0; j < TestSnapshotMessage::NumValues; ++j )
+                check( snapshot->values[j] == ( ( snapshot->tick / ( j + 1 ) ) & 0xFFFF ) );
+            lastTickReceived = snapshot->tick;
+            numReceived++;
+            messageFactory.ReleaseMessage( message );
+        }
+
+        check( receiver.ReceiveMessage( 0 ) == NULL );
+
+        time += 0.1;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+        senderSequence++;
+    }
+
+    // delta encoding kicks in, and recovers after the receiver reset
+
+    check( numReceived > NumIterations / 2 );
+    check( numDeltaPackets > NumIterations / 2 );
+    check( lastTickReceived > uint32_t( NumIterations * 2 ) - 20 );
+}
+
+void test_connection_unreliable_unordered_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 8;
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = j;
+        const int blockSize = 1 + ( j * 7 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int k = 0; k < blockSize; ++k )
+            blockData[k] = j + k;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            const int blockSize = blockMessage->GetBlockSize();
+
+            check( blockSize == 1 + ( numMessagesReceived * 7 ) );
+
+            const uint8_t * blockData = blockMessage->GetBlockData();
+
+            check( blockData );
+
+            for ( int j = 0; j < blockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+            }
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_unreliable_unordered_defer()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].packetBudget = 128;
+    connectionConfig.channel[0].messageMaxDeferTime = 10.0f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 8;
+
+    const int BlockSize = 100;
+
+    // Only one of these messages fits in the channel packet budget at a time.
+    // Without deferral all but the first would be dropped by the first packet.
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = j;
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        for ( int k = 0; k < BlockSize; ++k )
+            blockData[k] = j + k;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            check( blockMessage->GetBlockSize() == BlockSize );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_unreliable_priority_accumulator()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].packetBudget = 128;
+    connectionConfig.channel[0].priorityAccumulator = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 8;
+
+    const int BlockSize = 100;
+
+    // Only one of these messages fits in the channel packet budget at a time, so they
+    // should arrive highest priority first, and none should be dropped while waiting.
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = j;
+        message->SetPriority( float( j ) );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        for ( int k = 0; k < BlockSize; ++k )
+            blockData[k] = j + k;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( NumMessagesSent - 1 - numMessagesReceived ) );
+
+            check( blockMessage->GetBlockSize() == BlockSize );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_latency_histograms()
+{
+    LatencyHistogram histogram;
+    check( histogram.GetPercentile( 0.5 ) == 0.0 );
+    for ( int i = 1; i <= 100; ++i )
+        histogram.Record( i * 0.001 );
+    check( histogram.count == 100 );
+    check( fabs( histogram.GetMean() - 0.0505 ) < 0.0001 );
+    check( fabs( histogram.GetPercentile( 0.5 ) - 0.050 ) < 0.050 * 0.125 );
+    check( fabs( histogram.GetPercentile( 0.99 ) - 0.099 ) < 0.099 * 0.125 );
+    check( histogram.GetPercentile( 1.0 ) <= 0.1 );
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].latencyHistograms = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    check( sender.GetLatencyHistogram( 0, CHANNEL_LATENCY_QUEUED ) );
+    check( sender.GetLatencyHistogram( 0, CHANNEL_LATENCY_ACKED ) );
+
+    const int NumMessagesSent = 8;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 16; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    const LatencyHistogram * queued = sender.GetLatencyHistogram( 0, CHANNEL_LATENCY_QUEUED );
+    const LatencyHistogram * acked = sender.GetLatencyHistogram( 0, CHANNEL_LATENCY_ACKED );
+    check( queued->count == NumMessagesSent );
+    check( acked->count == NumMessagesSent );
+    check( acked->GetMean() >= queued->GetMean() );
+}
+
+void test_connection_steady_state()
+{
+#if YOJIMBO_DEBUG_STEADY_STATE
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+    messageFactory.SetMessagePoolSize( TEST_MESSAGE, 64 );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.frameAllocatorBytes = 16 * 1024;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // once warmed up, sending and receiving messages with pooled messages and a frame allocator doesn't allocate
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        if ( i == 100 )
+            ArmSteadyStateCheck();
+
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * received = receiver.ReceiveMessage( 0 );
+            if ( !received )
+                break;
+            messageFactory.ReleaseMessage( received );
+        }
+    }
+
+    DisarmSteadyStateCheck();
+
+    SteadyStateReport report;
+    GetSteadyStateReport( report );
+    check( report.numAllocations == 0 );
+
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+}
+
+void test_server_metrics()
+{
+    ServerMetrics metrics;
+    metrics.time = 10.0;
+    metrics.maxClients = 4;
+    metrics.numConnectedClients = 3;
+    metrics.numPacketsSent = 300;
+    metrics.numChannels = 2;
+    metrics.channel[1].sendQueueDepth = 7;
+    metrics.rtt.Record( 0.05 );
+    metrics.lossBuckets[2] = 3;
+
+    ServerMetrics previous = metrics;
+    previous.time = 9.0;
+    previous.numPacketsSent = 200;
+
+    char text[16*1024];
+    int textBytes = WriteServerMetrics( METRICS_FORMAT_PROMETHEUS, "yojimbo", metrics, &previous, text, sizeof( text ) );
+    check( textBytes > 0 );
+    check( textBytes == (int) strlen( text ) );
+    check( strstr( text, "# TYPE yojimbo_connected_clients gauge\nyojimbo_connected_clients 3\n" ) );
+    check( strstr( text, "yojimbo_packets_sent_per_second 100\n" ) );
+    check( strstr( text, "yojimbo_channel_send_queue_depth{channel=\"1\"} 7\n" ) );
+    check( strstr( text, "yojimbo_packet_loss_percent_bucket{le=\"+Inf\"} 3\n" ) );
+
+    textBytes = WriteServerMetrics( METRICS_FORMAT_STATSD, "game", metrics, NULL, text, sizeof( text ) );
+    check( textBytes > 0 );
+    check( strstr( text, "game.connected_clients:3|g\n" ) );
+    check( strstr( text, "game.rtt_seconds.quantile_0_5:" ) );
+    check( !strstr( text, "per_second" ) );
+
+    check( WriteServerMetrics( METRICS_FORMAT_PROMETHEUS, "yojimbo", metrics, NULL, text, 64 ) == -1 );
+    check( text[0] == '\0' );
+
+    // without an export function, snapshots are polled. the reader only ever sees the latest one
+
+    {
+        MetricsExporter exporter( GetDefaultAllocator() );
+
+        ServerMetrics latest;
+        check( !exporter.GetLatest( latest ) );
+
+        exporter.Publish( previous );
+        exporter.Publish( metrics );
+        check( exporter.GetLatest( latest ) );
+        check( latest.time == metrics.time );
+        check( latest.numPacketsSent == metrics.numPacketsSent );
+        check( !exporter.GetLatest( latest ) );
+
+        for ( int i = 0; i < 10; ++i )
+        {
+            metrics.time = 20.0 + i;
+            exporter.Publish( metrics );
+            if ( i % 3 == 0 )
+            {
+                check( exporter.GetLatest( latest ) );
+                check( latest.time == metrics.time );
+            }
+        }
+    }
+
+    // with an export function, snapshots are written out on the export thread
+
+    struct ExportContext
+    {
+        volatile int numExports;
+        char text[16*1024];
+
+        static void Export( void * context, const ServerMetrics & metrics, const char * text, int textBytes )
+        {
+            (void) metrics;
+            ExportContext * exportContext = (ExportContext*) context;
+            check( textBytes < (int) sizeof( exportContext->text ) );
+            memcpy( exportContext->text, text, textBytes + 1 );
+            yojimbo_atomic_increment( &exportContext->numExports );
+        }
+    };
+
+    ExportContext exportContext;
+    exportContext.numExports = 0;
+
+    {
+        MetricsConfig metricsConfig;
+        metricsConfig.exportFunction = ExportContext::Export;
+        metricsConfig.exportContext = &exportContext;
+
+        MetricsExporter exporter( GetDefaultAllocator(), metricsConfig );
+
+        exporter.Publish( metrics );
+
+        for ( int i = 0; i < 1000 && exportContext.numExports == 0; ++i )
+            yojimbo_sleep( 0.01 );
+    }
+
+    check( exportContext.numExports == 1 );
+    check( strstr( exportContext.text, "yojimbo_packets_sent 300\n" ) );
+}
+
+void test_connection_packet_telemetry()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].packetBudget = 128;
+    connectionConfig.channel[0].messageMaxDeferTime = 10.0f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 4;
+
+    const int BlockSize = 100;
+
+    // only one message fits in the packet budget, so every packet but the last is out of space
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = j;
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        memset( blockData, j, BlockSize );
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+
+    check( stats.numPacketsGenerated >= uint64_t( NumMessagesSent ) );
+    check( stats.packetBytesGenerated > 0 );
+    check( stats.packetBytesGenerated <= stats.packetBytesCapacity );
+    check( stats.generatePacketTime > 0.0 );
+
+    ConnectionStats receiverStats;
+    receiver.GetStats( receiverStats );
+
+    check( receiverStats.numPacketsProcessed == stats.numPacketsGenerated );
+    check( receiverStats.packetBytesProcessed == stats.packetBytesGenerated );
+    check( receiverStats.processPacketTime > 0.0 );
+
+    const uint64_t * counters = stats.channel[0].counters;
+    check( counters[CHANNEL_COUNTER_PACKETS_SENT] == uint64_t( NumMessagesSent ) );
+    check( counters[CHANNEL_COUNTER_MESSAGES_PACKED] == uint64_t( NumMessagesSent ) );
+    check( counters[CHANNEL_COUNTER_BITS_SENT] > uint64_t( NumMessagesSent * BlockSize * 8 ) );
+    check( counters[CHANNEL_COUNTER_BITS_SENT] <= uint64_t( NumMessagesSent * connectionConfig.channel[0].packetBudget * 8 ) );
+    check( counters[CHANNEL_COUNTER_OUT_OF_SPACE] == uint64_t( NumMessagesSent - 1 ) );
+}
+
+void test_connection_coalesce()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.coalesceTime = 0.25f;
+    connectionConfig.coalesceBytes = 16;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // a single small message waits for the coalescing delay to run out
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 0;
+    sender.SendMessage( 0, message );
+
+    check( sender.GetNextSendTime() <= time );
+
+    int numPumps = 0;
+    Message * received = NULL;
+    while ( !received && numPumps < 10 )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        numPumps++;
+        received = receiver.ReceiveMessage( 0 );
+        if ( !received )
+        {
+            ConnectionStats stats;
+            sender.GetStats( stats );
+            check( stats.numPacketsGenerated == 0 );
+            check( sender.GetNextSendTime() > time - 0.1 );
+        }
+    }
+
+    check( received );
+    check( numPumps == 4 );
+    messageFactory.ReleaseMessage( received );
+
+    // enough small messages to pass the byte threshold go out straight away, in one packet
+
+    const int NumMessagesSent = 16;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i + 1 );
+        sender.SendMessage( 0, message );
+    }
+
+    ConnectionStats before;
+    sender.GetStats( before );
+
+    PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    ConnectionStats after;
+    sender.GetStats( after );
+    check( after.numPacketsGenerated == before.numPacketsGenerated + 1 );
+
+    int numMessagesReceived = 0;
+    while ( true )
+    {
+        received = receiver.ReceiveMessage( 0 );
+        if ( !received )
+            break;
+        check( received->GetType() == TEST_MESSAGE );
+        check( ( (TestMessage*) received )->sequence == uint16_t( numMessagesReceived + 1 ) );
+        numMessagesReceived++;
+        messageFactory.ReleaseMessage( received );
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_path_packet_bytes()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    // without blocks the limit is only rounded down to a multiple of four
+
+    ConnectionConfig messageConfig;
+    messageConfig.channel[0].disableBlocks = true;
+
+    Connection messageConnection( GetDefaultAllocator(), messageFactory, messageConfig, time );
+
+    check( messageConnection.GetPathPacketBytes() == 0 );
+    messageConnection.SetPathPacketBytes( 603 );
+    check( messageConnection.GetPathPacketBytes() == 600 );
+    messageConnection.SetPathPacketBytes( 0 );
+    check( messageConnection.GetPathPacketBytes() == 0 );
+
+    // with blocks the limit leaves room for a whole fragment, so blocks keep moving over a path smaller than the fragment size allows for
+
+    ConnectionConfig connectionConfig;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    sender.SetPathPacketBytes( 600 );
+
+    const int pathPacketBytes = sender.GetPathPacketBytes();
+    check( pathPacketBytes > connectionConfig.channel[0].fragmentSize );
+    check( pathPacketBytes < connectionConfig.maxPacketSize );
+    check( ( pathPacketBytes % 4 ) == 0 );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int j = 0; j < blockSize; ++j )
+            blockData[j] = i + j;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+            check( blockMessage->GetBlockSize() == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+            ++numMessagesReceived;
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // every packet was generated against the limit instead of maxPacketSize
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.numPacketsGenerated > 0 );
+    check( stats.packetBytesCapacity == stats.numPacketsGenerated * uint64_t( pathPacketBytes ) );
+    check( stats.packetBytesGenerated <= stats.packetBytesCapacity );
+
+    // reset clears the limit
+
+    sender.Reset();
+    check( sender.GetPathPacketBytes() == 0 );
+}
+
+void test_connection_urgent_data()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[1].urgent = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    check( !sender.HasUrgentDataToSend() );
+
+    // data on a channel that isn't urgent can wait
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    sender.SendMessage( 0, message );
+
+    check( !sender.HasUrgentDataToSend() );
+
+    message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    sender.SendMessage( 1, message );
+
+    check( sender.HasUrgentDataToSend() );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    check( !sender.HasUrgentDataToSend() );
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        Message * received = receiver.ReceiveMessage( i );
+        check( received );
+        messageFactory.ReleaseMessage( received );
+    }
+}
+
+void test_connection_drop_duplicate_packets()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].urgent = true;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.dropDuplicatePackets = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    // the same packet arriving over two paths is only processed once
+
+    for ( int channelIndex = 0; channelIndex < 2; ++channelIndex )
+    {
+        Message * message = messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        sender.SendMessage( channelIndex, message );
+
+        const uint16_t sequence = uint16_t( channelIndex );
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( sender.IsLastPacketUrgent() == ( channelIndex == 0 ) );
+
+        check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+        check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+
+        Message * received = receiver.ReceiveMessage( channelIndex );
+        check( received );
+        messageFactory.ReleaseMessage( received );
+        check( receiver.ReceiveMessage( channelIndex ) == NULL );
+    }
+
+    ConnectionStats stats;
+    receiver.GetStats( stats );
+    check( stats.numDuplicatePackets == 2 );
+}
+
+void test_connection_high_bandwidth_delay()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.SetHighBandwidthDelay( 4096 );
+
+    check( connectionConfig.slidingWindowSize == 4096 );
+    check( connectionConfig.channel[0].sendQueueSize == 4096 );
+    check( connectionConfig.channel[0].receiveQueueSize == 4096 );
+    check( connectionConfig.channel[0].sentPacketBufferSize == 4096 );
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // more messages in flight than the default windows hold
+
+    const int NumMessagesSent = 3000;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        check( sender.CanSendMessage( 0 ) );
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < NumMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.01f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == uint16_t( numMessagesReceived ) );
+            numMessagesReceived++;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_extended_acks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxMessagesPerPacket = 2;
+    connectionConfig.extendedAckBits = 64;
+    connectionConfig.extendedAckInterval = 4;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumPackets = 16;
+    const int NumMessagesSent = NumPackets * 2;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    // every packet arrives, but the packet level acks are all lost. only the extended acks get through
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        int packetBytes;
+        check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+        senderSequence++;
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+            check( ( (TestMessage*) message )->sequence == uint16_t( numMessagesReceived ) );
+            numMessagesReceived++;
+            messageFactory.ReleaseMessage( message );
+        }
+
+        check( receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( sender.ProcessPacket( NULL, receiverSequence, packetData, packetBytes ) );
+        receiverSequence++;
+
+        time += 0.001;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // only the messages sent since the last extended ack are left unacked
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].sendQueueDepth <= connectionConfig.extendedAckInterval * 2 );
+
+    // acks for packets already acked by an extended ack are ignored
+
+    uint16_t acks[4];
+    for ( int i = 0; i < 4; ++i )
+        acks[i] = uint16_t( i );
+    sender.ProcessAcks( acks, 4 );
+}
+
+void test_connection_lazy_block_buffers()
+{
+    const int MemorySize = 4 * 1024 * 1024;
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+    check( memory );
+
+    {
+        TLSF_Allocator allocator( memory, MemorySize );
+
+        TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+        double time = 100.0;
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.channel[0].lazyBlockBuffers = true;
+        connectionConfig.channel[0].blockBufferIdleTime = 1.0f;
+
+        const size_t bytesBefore = allocator.GetBytesAllocated();
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( allocator, messageFactory, connectionConfig, time );
+
+        // nothing is reserved for blocks until the first one arrives
+
+        const size_t bytesIdle = allocator.GetBytesAllocated() - bytesBefore;
+        check( bytesIdle < size_t( connectionConfig.channel[0].maxBlockSize ) );
+
+        const int BlockSize = 3000;
+
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        for ( int i = 0; i < BlockSize; ++i )
+            blockData[i] = uint8_t( i );
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        Message * received = NULL;
+        for ( int i = 0; i < 100 && !received; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.01f, 0 );
+            received = receiver.ReceiveMessage( 0 );
+        }
+
+        check( received );
+        check( received->GetType() == TEST_BLOCK_MESSAGE );
+        check( ( (TestBlockMessage*) received )->GetBlockSize() == BlockSize );
+        const uint8_t * receivedBlockData = ( (TestBlockMessage*) received )->GetBlockData();
+        for ( int i = 0; i < BlockSize; ++i )
+            check( receivedBlockData[i] == uint8_t( i ) );
+        messageFactory.ReleaseMessage( received );
+
+        // the receive buffer is kept for a while in case more blocks follow, then freed
+
+        check( allocator.GetBytesAllocated() - bytesBefore > size_t( connectionConfig.channel[0].maxBlockSize ) );
+
+        for ( int i = 0; i < 20; ++i )
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        check( allocator.GetBytesAllocated() - bytesBefore < size_t( connectionConfig.channel[0].maxBlockSize ) );
+    }
+
+    free( memory );
+}
+
+void test_connection_memory_footprint()
+{
+    ClientServerConfig config;
+    config.numChannels = 2;
+    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    config.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    config.channel[1].lazyBlockBuffers = true;
+
+    ConnectionMemoryFootprint footprint;
+    GetConnectionMemoryFootprint( GetDefaultAllocator(), adapter, config, false, footprint );
+
+    check( footprint.channel[0] > size_t( config.channel[0].maxBlockSize ) );
+    check( footprint.channel[1] > 0 );
+    check( footprint.channels == footprint.channel[0] + footprint.channel[1] );
+    check( footprint.blockData >= size_t( config.channel[0].maxBlockSize ) );
+    check( footprint.connection > 0 );
+    check( footprint.messageFactory > 0 );
+    check( footprint.endpoint > 0 );
+    check( footprint.networkSimulator == 0 );
+    check( footprint.total == footprint.channels + footprint.blockData + footprint.connection + footprint.messageFactory + footprint.endpoint + footprint.networkSimulator + footprint.allocatorOverhead );
+
+    // a connection fits in exactly the memory the footprint asks for
+
+    uint8_t * memory = (uint8_t*) malloc( footprint.total );
+    check( memory );
+
+    {
+        TLSF_Allocator allocator( memory, footprint.total );
+        MessageFactory * messageFactory = adapter.CreateMessageFactory( allocator );
+        check( messageFactory );
+        Connection * connection = YOJIMBO_NEW( allocator, Connection, allocator, *messageFactory, config, 100.0 );
+        check( connection );
+        check( allocator.GetErrorLevel() == ALLOCATOR_ERROR_NONE );
+        YOJIMBO_DELETE( allocator, Connection, connection );
+        YOJIMBO_DELETE( allocator, MessageFactory, messageFactory );
+    }
+
+    free( memory );
+
+    ServerMemoryFootprint serverFootprint;
+    GetServerMemoryFootprint( GetDefaultAllocator(), adapter, config, 8, serverFootprint );
+    check( serverFootprint.client.total == footprint.total );
+    check( serverFootprint.clientSlots == footprint.total * 8 );
+
+    check( CheckMemoryFootprint( "test", footprint.total, footprint.total ) );
+    check( !CheckMemoryFootprint( "test", footprint.total - 1, footprint.total ) );
+    check( !CheckMemoryFootprint( "test", footprint.total * ( MemoryOversizeFactor + 1 ), footprint.total ) );
+}
+
+void test_server_environment()
+{
+    ServerEnvironment environment;
+    GetServerEnvironment( environment );
+    check( environment.numCpus >= 1 );
+
+    ClientServerConfig config;
+
+    ConnectionMemoryFootprint footprint;
+    GetConnectionMemoryFootprint( GetDefaultAllocator(), adapter, config, false, footprint );
+
+    const int MaxServerClients = 16;
+
+    // plenty of memory: every client fits, with the per-client memory asked for
+
+    environment.numCpus = 4;
+    environment.memoryLimit = uint64_t( 64 ) * 1024 * 1024 * 1024;
+    check( ConfigureServerForEnvironment( GetDefaultAllocator(), adapter, config, MaxServerClients, 0.5f, environment ) );
+    check( environment.numWorkerThreads == 3 );
+    check( environment.maxClients == MaxServerClients );
+    check( config.serverPerClientMemory == ClientServerConfig().serverPerClientMemory );
+
+    // tight memory: per-client memory shrinks down to twice the footprint, then clients are dropped
+
+    const uint64_t fixedMemory = uint64_t( config.serverGlobalMemory ) + uint64_t( config.serverBroadcastMemory );
+    environment.memoryLimit = fixedMemory + uint64_t( footprint.total ) * 2 * ( MaxServerClients / 2 );
+    check( !ConfigureServerForEnvironment( GetDefaultAllocator(), adapter, config, MaxServerClients, 1.0f, environment ) );
+    check( config.serverPerClientMemory == int( footprint.total * 2 ) );
+    check( environment.maxClients == MaxServerClients / 2 );
+
+    // an unknown memory limit leaves the memory config alone
+
+    environment.memoryLimit = 0;
+    check( ConfigureServerForEnvironment( GetDefaultAllocator(), adapter, config, MaxServerClients, 0.5f, environment ) );
+    check( environment.maxClients == MaxServerClients );
+    check( config.serverPerClientMemory == int( footprint.total * 2 ) );
+}
+
+void test_connection_channel_weights()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.maxPacketSize = 1024;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].packetBudget = -1;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[1].packetBudget = -1;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumIterations = 64;
+
+    const int NumBulkMessagesPerIteration = 8;
+
+    const int BulkBlockSize = 120;
+
+    const int BlockSize = 100;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    // Channel 0 queues close to a full packet of bulk data every iteration.
+    // Without sharing by weight, it would fill every packet and channel 1 would never get its messages through.
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        for ( int j = 0; j < NumBulkMessagesPerIteration; ++j )
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BulkBlockSize );
+            memset( blockData, 0, BulkBlockSize );
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, BulkBlockSize );
+            sender.SendMessage( 0, message );
+        }
+
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        memset( blockData, 0, BlockSize );
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 1, message );
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( Message * bulkMessage = receiver.ReceiveMessage( 0 ) )
+            messageFactory.ReleaseMessage( bulkMessage );
+
+        while ( true )
+        {
+            Message * receivedMessage = receiver.ReceiveMessage( 1 );
+            if ( !receivedMessage )
+                break;
+
+            check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+            check( ( (TestBlockMessage*) receivedMessage )->sequence == uint16_t( numMessagesReceived ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( receivedMessage );
+        }
+    }
+
+    check( numMessagesReceived == NumIterations );
+}
+
+void test_connection_bandwidth_limit()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.bandwidthLimit = 1000;
+    connectionConfig.bandwidthBurstBytes = 200;
+    connectionConfig.channel[0].packetBudget = -1;
+ 
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 512;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    const int NumIterations = 1000;
+
+    const float DeltaTime = 0.1f;
+
+    const int MaxHeaderBytes = 8;
+
+    int numMessagesReceived = 0;
+
+    int totalPacketBytes = 0;
+
+    int numPacketsWithData = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        const uint16_t sequence = uint16_t( i );
+
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+        totalPacketBytes += packetBytes;
+
+        if ( packetBytes > MaxHeaderBytes )
+            numPacketsWithData++;
+
+        // never more than the burst plus the rate since the start, give or take a packet header per packet
+
+        check( totalPacketBytes <= connectionConfig.bandwidthBurstBytes + (int) ( i * DeltaTime * connectionConfig.bandwidthLimit ) + ( i + 1 ) * MaxHeaderBytes );
+
+        receiver.ProcessPacket( NULL, sequence, packetData, packetBytes );
+        sender.ProcessAcks( &sequence, 1 );
+
+        time += DeltaTime;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // without the limit, every message would have gone out in the first packet
+
+    check( numPacketsWithData > 1 );
+}
+
+void test_connection_adaptive_bandwidth()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.bandwidthLimit = 8000;
+    connectionConfig.adaptiveBandwidth = true;
+ 
+    Connection connection( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    check( connection.GetBandwidthLimit() == 8000.0f );
+
+    // heavy packet loss backs off, down to the minimum
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        time += 0.1;
+        connection.AdvanceTime( time );
+        connection.UpdateNetworkConditions( 50.0f, 20.0f );
+    }
+
+    check( connection.GetBandwidthLimit() == 1000.0f );
+
+    // a clean link probes back up to the configured limit
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        time += 0.1;
+        connection.AdvanceTime( time );
+        connection.UpdateNetworkConditions( 50.0f, 0.0f );
+    }
+
+    check( connection.GetBandwidthLimit() == 8000.0f );
+
+    // rising RTT counts as congestion too
+
+    time += 0.1;
+    connection.AdvanceTime( time );
+    connection.UpdateNetworkConditions( 500.0f, 0.0f );
+
+    check( connection.GetBandwidthLimit() == 4000.0f );
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        time += 0.1;
+        connection.AdvanceTime( time );
+        connection.UpdateNetworkConditions( 50.0f, 0.0f );
+
+        check( connection.GetBandwidthLimit() <= 8000.0f );
+    }
+
+    check( connection.GetBandwidthLimit() == 8000.0f );
+}
+
+void test_connection_scavenger()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[1].scavenger = true;
+
+    Connection connection( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    ConnectionStats stats;
+    connection.GetStats( stats );
+    check( stats.scavengerBandwidth == connectionConfig.scavengerMinBandwidth );
+
+    const int BlockSize = 128 * 1024;
+
+    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    memset( blockData, 0, BlockSize );
+    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    connection.SendMessage( 1, message );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    // while queuing delay stays under the target, the scavenger rate grows, and the block is sent no faster than it
+
+    double maxBytes = connectionConfig.maxPacketSize;
+
+    for ( int i = 0; i < 20; ++i )
+    {
+        int packetBytes = 0;
+        check( connection.GeneratePacket( NULL, uint16_t( i ), packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+        connection.GetStats( stats );
+        maxBytes += stats.scavengerBandwidth * 0.1;
+
+        time += 0.1;
+        connection.AdvanceTime( time );
+        connection.UpdateNetworkConditions( 50.0f, 0.0f );
+    }
+
+    connection.GetStats( stats );
+    check( stats.scavengerBandwidth > connectionConfig.scavengerMinBandwidth * 2 );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_BITS_SENT] > 0 );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_BITS_SENT] <= uint64_t( maxBytes * 8 ) );
+
+    // queuing delay at twice the target halves the rate, and it backs off no further than the minimum
+
+    const float scavengerBandwidth = stats.scavengerBandwidth;
+
+    time += 0.1;
+    connection.AdvanceTime( time );
+    connection.UpdateNetworkConditions( 50.0f + connectionConfig.scavengerTargetDelay * 2, 0.0f );
+
+    connection.GetStats( stats );
+    check( fabsf( stats.scavengerBandwidth - scavengerBandwidth * 0.5f ) < 1.0f );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        time += 0.1;
+        connection.AdvanceTime( time );
+        connection.UpdateNetworkConditions( 500.0f, 0.0f );
+    }
+
+    connection.GetStats( stats );
+    check( stats.scavengerBandwidth == connectionConfig.scavengerMinBandwidth );
+}
+
+void test_connection_overload_controls()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[1].scavenger = true;
+
+    Connection connection( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    // a paused scavenger channel keeps its block queued, and sends it once unpaused
+
+    const int BlockSize = 1024;
+
+    TestBlockMessage * blockMessage = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( blockMessage );
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    memset( blockData, 0, BlockSize );
+    blockMessage->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    connection.SendMessage( 1, blockMessage );
+
+    connection.SetScavengerPaused( true );
+    check( connection.IsScavengerPaused() );
+
+    ConnectionStats stats;
+    uint16_t packetSequence = 0;
+    int packetBytes = 0;
+
+    connection.GeneratePacket( NULL, packetSequence++, packetData, connectionConfig.maxPacketSize, packetBytes );
+    connection.GetStats( stats );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_BITS_SENT] == 0 );
+
+    connection.SetScavengerPaused( false );
+
+    check( connection.GeneratePacket( NULL, packetSequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    connection.GetStats( stats );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_BITS_SENT] > 0 );
+
+    // a scaled down unreliable channel writes no more than its share of the packet budget, and goes back to the whole budget at a scale of 1
+
+    const int NumMessages = 64;
+
+    for ( int i = 0; i < NumMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        connection.SendMessage( 0, message );
+    }
+
+    const float Scale = 0.25f;
+
+    connection.SetUnreliableBudgetScale( Scale );
+    check( connection.GetUnreliableBudgetScale() == Scale );
+
+    check( connection.GeneratePacket( NULL, packetSequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    connection.GetStats( stats );
+    const uint64_t scaledBits = stats.channel[0].counters[CHANNEL_COUNTER_BITS_SENT];
+    check( scaledBits > 0 );
+    check( scaledBits <= uint64_t( connectionConfig.channel[0].packetBudget * 8 * Scale ) );
+
+    for ( int i = 0; i < NumMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        connection.SendMessage( 0, message );
+    }
+
+    connection.SetUnreliableBudgetScale( 1.0f );
+
+    check( connection.GeneratePacket( NULL, packetSequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    connection.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_BITS_SENT] - scaledBits > scaledBits );
+
+    // reset clears both controls
+
+    connection.SetScavengerPaused( true );
+    connection.SetUnreliableBudgetScale( Scale );
+    connection.Reset();
+    check( !connection.IsScavengerPaused() );
+    check( connection.GetUnreliableBudgetScale() == 1.0f );
+}
+
+void test_connection_adaptive_resend_time()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].adaptiveResendTime = true;
+
+    Connection connection( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t sequence = 0;
+
+    int packetBytes = 0;
+
+    // on a fast link the message is resent well before messageResendTime
+
+    for ( int i = 0; i < 20; ++i )
+        connection.UpdateNetworkConditions( 20.0f, 0.0f );
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    connection.SendMessage( 0, message );
+
+    check( connection.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    const int messagePacketBytes = packetBytes;
+
+    time += 0.03;
+    connection.AdvanceTime( time );
+
+    check( connection.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes == messagePacketBytes );
+
+    // on a slow link it waits for the RTT to pass
+
+    for ( int i = 0; i < 20; ++i )
+        connection.UpdateNetworkConditions( 300.0f, 0.0f );
+
+    time += 0.15;
+    connection.AdvanceTime( time );
+
+    check( connection.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes < messagePacketBytes );
+
+    time += 0.16;
+    connection.AdvanceTime( time );
+
+    check( connection.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes == messagePacketBytes );
+}
+
+void test_connection_fast_resend()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].fastResendThreshold = 3;
+
+    Connection connection( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes = 0;
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    connection.SendMessage( 0, message );
+
+    // the packet carrying the message is lost
+
+    check( connection.GeneratePacket( NULL, 0, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    const int messagePacketBytes = packetBytes;
+
+    // the next packets are acked, but that doesn't count as a loss until the third
+
+    for ( uint16_t sequence = 1; sequence <= 3; ++sequence )
+    {
+        check( connection.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( packetBytes < messagePacketBytes );
+        connection.ProcessAcks( &sequence, 1 );
+    }
+
+    ConnectionStats stats;
+    connection.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_PACKETS_LOST] == 1 );
+
+    // the message goes out again straight away, well before messageResendTime
+
+    check( connection.GeneratePacket( NULL, 4, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes == messagePacketBytes );
+
+    // once it is acked, nothing is resent again
+
+    const uint16_t ack = 4;
+    connection.ProcessAcks( &ack, 1 );
+
+    time += 1.0;
+    connection.AdvanceTime( time );
+
+    check( connection.GeneratePacket( NULL, 5, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes < messagePacketBytes );
+
+    connection.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_PACKETS_LOST] == 1 );
+}
+
+void test_connection_fragment_parity()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].fragmentSize = 100;
+    connectionConfig.channel[0].fragmentParityGroupSize = 4;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int BlockSize = 950;
+
+    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    message->sequence = 1;
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    for ( int i = 0; i < BlockSize; ++i )
+        blockData[i] = uint8_t( i * 7 + 3 );
+    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    sender.SendMessage( 0, message );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    // one fragment goes in each packet. the packet carrying fragment 2 is lost, and the parity of fragments 1-4 rebuilds it
+
+    const double startTime = time;
+
+    Message * receivedMessage = NULL;
+
+    for ( uint16_t sequence = 0; sequence < 20 && !receivedMessage; ++sequence )
+    {
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+        if ( sequence != 2 )
+        {
+            check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+            sender.ProcessAcks( &sequence, 1 );
+        }
+
+        receivedMessage = receiver.ReceiveMessage( 0 );
+
+        time += 0.01;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+    }
+
+    check( receivedMessage );
+    check( time - startTime < connectionConfig.channel[0].fragmentResendTime );
+    check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+
+    TestBlockMessage * blockMessage = (TestBlockMessage*) receivedMessage;
+    check( blockMessage->sequence == 1 );
+    check( blockMessage->GetBlockSize() == BlockSize );
+    for ( int i = 0; i < BlockSize; ++i )
+        check( blockMessage->GetBlockData()[i] == uint8_t( i * 7 + 3 ) );
+
+    messageFactory.ReleaseMessage( receivedMessage );
+
+    ConnectionStats stats;
+    receiver.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_FRAGMENTS_RECOVERED] == 1 );
+}
+
+void test_connection_supersede_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].supersedeMessages = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // four rounds of four keyed messages and one without a key. only the last round of keyed messages is delivered
+
+    const int NumRounds = 4;
+    const int NumKeys = 4;
+
+    for ( int i = 0; i < NumRounds; ++i )
+    {
+        for ( int j = 0; j <= NumKeys; ++j )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = uint16_t( i * ( NumKeys + 1 ) + j );
+            if ( j < NumKeys )
+                message->SetKey( j + 1 );
+            sender.SendMessage( 0, message );
+        }
+    }
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_SUPERSEDED] == ( NumRounds - 1 ) * NumKeys );
+
+    const int expectedSequence[] = { 4, 9, 14, 15, 16, 17, 18, 19 };
+    const int NumExpected = sizeof( expectedSequence ) / sizeof( int );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < NumExpected; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( numMessagesReceived < NumExpected );
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == expectedSequence[numMessagesReceived] );
+            check( message->GetId() == expectedSequence[numMessagesReceived] );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == NumExpected );
+}
+
+void test_connection_skip_received_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].messageLengthBits = 16;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    const int NumFirstMessages = 4;
+    const int NumSecondMessages = 2;
+
+    for ( int i = 0; i < NumFirstMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    int packetBytes = 0;
+    check( sender.GeneratePacket( NULL, 0, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+
+    // the ack is lost, so the first messages are resent along with new ones, and the receiver skips over them
+
+    for ( int i = 0; i < NumSecondMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( NumFirstMessages + i );
+        sender.SendMessage( 0, message );
+    }
+
+    time += 1.0;
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    check( sender.GeneratePacket( NULL, 1, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, 1, packetData, packetBytes ) );
+
+    ConnectionStats stats;
+    receiver.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_SKIPPED] == NumFirstMessages );
+
+    int numMessagesReceived = 0;
+
+    while ( true )
+    {
+        Message * message = receiver.ReceiveMessage( 0 );
+        if ( !message )
+            break;
+
+        check( message->GetId() == numMessagesReceived );
+        check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+
+        ++numMessagesReceived;
+
+        messageFactory.ReleaseMessage( message );
+    }
+
+    check( numMessagesReceived == NumFirstMessages + NumSecondMessages );
+
+    // a packet carrying only messages already received is skipped over entirely
+
+    time += 1.0;
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    check( sender.GeneratePacket( NULL, 2, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, 2, packetData, packetBytes ) );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+
+    receiver.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_SKIPPED] == 2 * NumFirstMessages + NumSecondMessages );
+}
+
+void test_connection_lazy_decode()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].messageLengthBits = 16;
+    connectionConfig.channel[0].lazyDecode = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < NumMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( !message->IsEncoded() );
+            check( message->GetId() == numMessagesReceived );
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    // a message that fails to read gets through ProcessPacket, and puts the channel in error when it is received
+
+    Message * message = messageFactory.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
+    check( message );
+    sender.SendMessage( 0, message );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes = 0;
+
+    check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+
+    time += 1.0;
+    receiver.AdvanceTime( time );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_CHANNEL );
+}
+
+void test_connection_message_time_to_live()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].messageTimeToLive = 0.5f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    const int NumStaleMessages = 4;
+    const int NumFreshMessages = 2;
+
+    for ( int i = 0; i < NumStaleMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    // every packet is lost for a second, so the messages queued before it expire
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 10; ++i )
+    {
+        int packetBytes = 0;
+        sender.GeneratePacket( NULL, senderSequence++, packetData, connectionConfig.maxPacketSize, packetBytes );
+        time += 0.1;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+    }
+
+    for ( int i = 0; i < NumFreshMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( NumStaleMessages + i );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < NumFreshMessages; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.01f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( ( (TestMessage*) message )->sequence == NumStaleMessages + numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == NumFreshMessages );
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_EXPIRED] == NumStaleMessages );
+}
+
+void test_connection_flow_control()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].flowControl = true;
+    connectionConfig.channel[0].receiveQueueSize = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 0, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // the receiver doesn't dequeue anything for a while. the sender fills its receive queue and then waits, instead of overflowing it
+
+    for ( int i = 0; i < 100; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].sendQueueDepth == NumMessagesSent - connectionConfig.channel[0].receiveQueueSize );
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < NumMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        Message * message = receiver.ReceiveMessage( 0 );
+        if ( !message )
+            continue;
+
+        check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+
+        ++numMessagesReceived;
+
+        messageFactory.ReleaseMessage( message );
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_runtime_limits()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].flowControl = true;
+    connectionConfig.channel[0].runtimeLimits = true;
+    connectionConfig.channel[0].sendQueueSize = 64;
+    connectionConfig.channel[0].receiveQueueSize = 64;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    check( sender.GetChannelLimits( 0 ).receiveQueueSize == 64 );
+
+    // shrink the queues for an idle phase: the sender stops taking messages at its new send queue size, and only sends what fits in the receive window the receiver advertises
+
+    ChannelLimits senderLimits = sender.GetChannelLimits( 0 );
+    senderLimits.sendQueueSize = 16;
+    senderLimits.packetBudget = 256;
+    sender.SetChannelLimits( 0, senderLimits );
+
+    ChannelLimits receiverLimits = receiver.GetChannelLimits( 0 );
+    receiverLimits.receiveQueueSize = 8;
+    receiverLimits.maxBlockSize = 1024;
+    receiver.SetChannelLimits( 0, receiverLimits );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 10; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    int numMessagesSent = 0;
+    while ( sender.CanSendMessage( 0 ) )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( numMessagesSent++ );
+        sender.SendMessage( 0, message );
+    }
+
+    check( numMessagesSent == 16 );
+
+    for ( int i = 0; i < 100; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+    check( stats.channel[0].sendQueueDepth == 16 - 8 );
+
+    // a block larger than the receiver takes waits, without holding up the channel in error
+
+    TestBlockMessage * blockMessage = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( blockMessage );
+    blockMessage->sequence = uint16_t( numMessagesSent++ );
+    const int BlockSize = 4000;
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    for ( int i = 0; i < BlockSize; ++i )
+        blockData[i] = uint8_t( i );
+    blockMessage->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    sender.SendMessage( 0, blockMessage );
+
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+            ++numMessagesReceived;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == 16 );
+
+    sender.GetStats( stats );
+    check( stats.channel[0].sendQueueDepth == 1 );
+
+    // grow everything back for the match. the block goes through, and the sender can fill the full window again
+
+    receiver.SetChannelLimits( 0, ChannelLimits( connectionConfig.channel[0] ) );
+    sender.SetChannelLimits( 0, ChannelLimits( connectionConfig.channel[0] ) );
+
+    while ( sender.CanSendMessage( 0 ) )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( numMessagesSent++ );
+        sender.SendMessage( 0, message );
+    }
+
+    check( numMessagesSent == 16 + 1 + 63 );
+
+    for ( int i = 0; i < 1000 && numMessagesReceived < numMessagesSent; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            if ( numMessagesReceived == 16 )
+            {
+                check( message->GetType() == TEST_BLOCK_MESSAGE );
+                check( ( (TestBlockMessage*) message )->GetBlockSize() == BlockSize );
+                check( ( (TestBlockMessage*) message )->GetBlockData()[BlockSize-1] == uint8_t( BlockSize - 1 ) );
+            }
+            else
+            {
+                check( message->GetType() == TEST_MESSAGE );
+                check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+            }
+            ++numMessagesReceived;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived == numMessagesSent );
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    // a new connection starts out with the config limits again
+
+    receiver.SetChannelLimits( 0, receiverLimits );
+    receiver.Reset();
+    check( receiver.GetChannelLimits( 0 ).receiveQueueSize == 64 );
+    check( receiver.GetChannelLimits( 0 ).maxBlockSize == connectionConfig.channel[0].maxBlockSize );
+}
+
+void test_connection_auto_tune()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    // 10 packets per second at 20000 bytes per second leaves 2000 bytes per packet, less than the two channels could use
+
+    const int BandwidthLimit = 20000;
+    const int MinPacketBudget = 64;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.bandwidthLimit = BandwidthLimit;
+    for ( int i = 0; i < connectionConfig.numChannels; ++i )
+    {
+        connectionConfig.channel[i].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+        connectionConfig.channel[i].packetBudget = 4000;
+        connectionConfig.channel[i].autoTune = true;
+        connectionConfig.channel[i].autoTuneMinPacketBudget = MinPacketBudget;
+    }
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    // idle channels give their budget back
+
+    for ( int i = 0; i < 100; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    check( sender.GetChannelLimits( 0 ).packetBudget == MinPacketBudget );
+    check( sender.GetChannelLimits( 1 ).packetBudget == MinPacketBudget );
+
+    // a busy channel takes what it uses, up to what the bandwidth limit allows, while the idle one stays at its minimum
+
+    int numMessagesSent = 0;
+
+    for ( int phase = 0; phase < 2; ++phase )
+    {
+        const int numBusyChannels = phase + 1;
+
+        for ( int i = 0; i < 100; ++i )
+        {
+            for ( int channelIndex = 0; channelIndex < numBusyChannels; ++channelIndex )
+            {
+                for ( int j = 0; j < 100 && sender.CanSendMessage( channelIndex ); ++j )
+                {
+                    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                    check( message );
+                    message->sequence = uint16_t( numMessagesSent++ );
+                    sender.SendMessage( channelIndex, message );
+                }
+            }
+
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+            for ( int channelIndex = 0; channelIndex < numBusyChannels; ++channelIndex )
+            {
+                while ( Message * message = receiver.ReceiveMessage( channelIndex ) )
+                    messageFactory.ReleaseMessage( message );
+            }
+        }
+
+        check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+        const ChannelLimits & limits0 = sender.GetChannelLimits( 0 );
+        const ChannelLimits & limits1 = sender.GetChannelLimits( 1 );
+
+        if ( phase == 0 )
+        {
+            check( limits0.packetBudget > MinPacketBudget * 4 );
+            check( limits0.packetBudget <= BandwidthLimit / 10 );
+            check( limits1.packetBudget == MinPacketBudget );
+        }
+        else
+        {
+            // with both busy, they share it
+
+            check( limits0.packetBudget > BandwidthLimit / 10 / 4 );
+            check( limits1.packetBudget > BandwidthLimit / 10 / 4 );
+            check( limits0.packetBudget + limits1.packetBudget <= BandwidthLimit / 10 );
+        }
+
+        // the most messages per packet follows the budget at the average message size
+
+        check( limits0.maxMessagesPerPacket >= 1 );
+        check( limits0.maxMessagesPerPacket <= connectionConfig.channel[0].maxMessagesPerPacket );
+    }
+
+    // reset goes back to the config limits
+
+    sender.Reset();
+
+    check( sender.GetChannelLimits( 0 ).packetBudget == connectionConfig.channel[0].packetBudget );
+    check( sender.GetChannelLimits( 0 ).maxMessagesPerPacket == connectionConfig.channel[0].maxMessagesPerPacket );
+}
+
+void test_connection_memory_watermark()
+{
+    const int MemorySize = 4 * 1024 * 1024;
+    uint8_t * memory = (uint8_t*) malloc( MemorySize );
+    check( memory );
+
+    {
+        TLSF_Allocator allocator( memory, MemorySize );
+
+        TestMessageFactory senderMessageFactory( allocator );
+        TestMessageFactory receiverMessageFactory( GetDefaultAllocator() );
+
+        double time = 100.0;
+
+        // set the watermark a little above what the connection itself takes
+
+        ConnectionConfig connectionConfig;
+        const size_t bytesBefore = allocator.GetBytesAllocated();
+        {
+            Connection connection( allocator, senderMessageFactory, connectionConfig, time );
+            connectionConfig.memoryWatermark = int( allocator.GetBytesAllocated() - bytesBefore ) + 4096;
+        }
+        check( allocator.GetBytesAllocated() == bytesBefore );
+        connectionConfig.memoryWatermark += int( bytesBefore );
+
+        Connection sender( allocator, senderMessageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), receiverMessageFactory, connectionConfig, time );
+
+        // a burst of sends stops at the watermark, well before the send queue is full
+
+        check( !sender.IsMemoryLow() );
+        check( !sender.UpdateMemoryLow() );
+
+        int numMessagesSent = 0;
+        while ( sender.CanSendMessage( 0 ) )
+        {
+            TestMessage * message = (TestMessage*) senderMessageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = uint16_t( numMessagesSent );
+            sender.SendMessage( 0, message );
+            ++numMessagesSent;
+        }
+
+        check( numMessagesSent > 0 );
+        check( numMessagesSent < connectionConfig.channel[0].sendQueueSize );
+        check( sender.IsMemoryLow() );
+        check( sender.UpdateMemoryLow() );
+        check( !sender.UpdateMemoryLow() );
+
+        // once the messages are acked and freed, the sender recovers
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        int numMessagesReceived = 0;
+
+        for ( int i = 0; i < 1000 && numMessagesReceived < numMessagesSent; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+            while ( Message * message = receiver.ReceiveMessage( 0 ) )
+            {
+                check( ( (TestMessage*) message )->sequence == numMessagesReceived );
+                ++numMessagesReceived;
+                receiverMessageFactory.ReleaseMessage( message );
+            }
+        }
+
+        for ( int i = 0; i < 10; ++i )
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        check( numMessagesReceived == numMessagesSent );
+        check( !sender.IsMemoryLow() );
+        check( sender.UpdateMemoryLow() );
+        check( sender.CanSendMessage( 0 ) );
+        check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+        check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    }
+
+    free( memory );
+}
+
+void test_connection_channels_with_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    check( receiver.GetChannelsWithMessages() == 0 );
+
+    const int NumMessagesSent = 8;
 
     for ( int i = 0; i < NumMessagesSent; ++i )
     {
-        if ( rand() % 2 )
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        sender.SendMessage( 1, message );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 10 && !receiver.GetChannelsWithMessages(); ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    // only the channel messages were sent on is flagged, and it stays flagged until drained
+
+    check( receiver.GetChannelsWithMessages() == ( uint64_t(1) << 1 ) );
+
+    int numMessagesReceived = 0;
+
+    while ( Message * message = receiver.ReceiveMessage( 1 ) )
+    {
+        ++numMessagesReceived;
+        messageFactory.ReleaseMessage( message );
+        check( receiver.GetChannelsWithMessages() == ( uint64_t(1) << 1 ) );
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+    check( receiver.GetChannelsWithMessages() == 0 );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_send_receive_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].sendQueueSize = 8;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[1].sendQueueSize = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessages = 12;
+
+    for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+    {
+        Message * messages[NumMessages];
+        for ( int i = 0; i < NumMessages; ++i )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = uint16_t( i );
+            messages[i] = message;
+        }
+
+        // only what fits in the send queue is taken. the rest stay with the caller
+
+        const int numSent = sender.SendMessages( channelIndex, messages, NumMessages );
+        check( numSent == connectionConfig.channel[channelIndex].sendQueueSize );
+        check( !sender.CanSendMessage( channelIndex ) );
+        sender.ReleaseMessages( messages + numSent, NumMessages - numSent );
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived[2] = { 0, 0 };
+
+    for ( int i = 0; i < 100 && ( numMessagesReceived[0] < 8 || numMessagesReceived[1] < 8 ); ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+        {
+            Message * messages[3];
+            int numReceived;
+            while ( ( numReceived = receiver.ReceiveMessages( channelIndex, messages, 3 ) ) > 0 )
+            {
+                for ( int j = 0; j < numReceived; ++j )
+                {
+                    check( ( (TestMessage*) messages[j] )->sequence == numMessagesReceived[channelIndex] );
+                    numMessagesReceived[channelIndex]++;
+                }
+                receiver.ReleaseMessages( messages, numReceived );
+            }
+        }
+    }
+
+    check( numMessagesReceived[0] == 8 );
+    check( numMessagesReceived[1] == 8 );
+    check( receiver.GetChannelsWithMessages() == 0 );
+
+    ConnectionStats stats;
+    receiver.GetStats( stats );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] == 8 );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] == 8 );
+}
+
+void test_connection_suppress_idle_packets()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.suppressIdlePackets = true;
+    connectionConfig.idlePacketInterval = 1.0f;
+ 
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int packetBytes = 0;
+
+    // nothing to send: no packets until the idle interval has passed
+
+    for ( int i = 0; i < 9; ++i )
+    {
+        check( !sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        time += 0.1;
+        sender.AdvanceTime( time );
+    }
+
+    time += 0.2;
+    sender.AdvanceTime( time );
+
+    check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, senderSequence++, packetData, packetBytes ) );
+
+    // a header-only packet doesn't need an ack
+
+    check( !receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+    // a packet with channel data is sent straight away, and acked by the next receiver packet
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 0;
+    sender.SendMessage( 0, message );
+
+    check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+    sender.ProcessAcks( &senderSequence, 1 );
+    senderSequence++;
+
+    check( receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( sender.ProcessPacket( NULL, receiverSequence++, packetData, packetBytes ) );
+
+    check( !receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( !sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+    Message * receivedMessage = receiver.ReceiveMessage( 0 );
+    check( receivedMessage );
+    check( receivedMessage->GetType() == TEST_MESSAGE );
+    messageFactory.ReleaseMessage( receivedMessage );
+}
+
+void test_connection_next_send_time()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.suppressIdlePackets = true;
+    connectionConfig.idlePacketInterval = 1.0f;
+
+    const double messageResendTime = connectionConfig.channel[0].messageResendTime;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t senderSequence = 0;
+
+    int packetBytes = 0;
+
+    // nothing to send: the next packet is the idle packet
+
+    check( fabs( sender.GetNextSendTime() - ( time + 1.0 ) ) < 0.0001 );
+
+    // a queued message is due now, then again once it can be resent
+
+    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 0;
+    sender.SendMessage( 0, message );
+
+    check( sender.GetNextSendTime() <= time );
+
+    check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+    check( fabs( sender.GetNextSendTime() - ( time + messageResendTime ) ) < 0.0001 );
+
+    // the receiver owes an ack straight away
+
+    check( receiver.GetNextSendTime() > time );
+    check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+    check( receiver.GetNextSendTime() <= time );
+
+    // once the message is acked, the sender is back to the idle packet
+
+    sender.ProcessAcks( &senderSequence, 1 );
+
+    check( fabs( sender.GetNextSendTime() - ( time + 1.0 ) ) < 0.0001 );
+
+    Message * receivedMessage = receiver.ReceiveMessage( 0 );
+    check( receivedMessage );
+    messageFactory.ReleaseMessage( receivedMessage );
+}
+
+void test_connection_channel_errors()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 3;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[2].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    time += 1.0;
+
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    // no channel here has timers, so AdvanceTime doesn't visit them. an error in the last channel must still put the connection in error
+
+    Message * message = messageFactory.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
+    check( message );
+    sender.SendMessage( 2, message );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes = 0;
+
+    check( sender.GeneratePacket( NULL, 0, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( !receiver.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+
+    time += 1.0;
+
+    receiver.AdvanceTime( time );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_CHANNEL );
+
+    // resetting the connection clears the channel errors
+
+    receiver.Reset();
+
+    time += 1.0;
+
+    receiver.AdvanceTime( time );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_stats()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessages = 8;
+
+    for ( int channelIndex = 0; channelIndex < 2; ++channelIndex )
+    {
+        for ( int i = 0; i < NumMessages; ++i )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( channelIndex, message );
+        }
+    }
+
+    ConnectionStats stats;
+    sender.GetStats( stats );
+
+    check( stats.numChannels == 2 );
+    check( stats.channel[0].sendQueueDepth == NumMessages );
+    check( stats.channel[1].sendQueueDepth == NumMessages );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_SENT] == NumMessages );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_MESSAGES_SENT] == NumMessages );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes = 0;
+
+    check( sender.GeneratePacket( NULL, 0, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, 0, packetData, packetBytes ) );
+
+    // reliable messages stay queued until acked. unreliable messages are gone once sent
+
+    sender.GetStats( stats );
+
+    check( stats.channel[0].sendQueueDepth == NumMessages );
+    check( stats.channel[1].sendQueueDepth == 0 );
+
+    receiver.GetStats( stats );
+
+    check( stats.channel[0].receiveQueueDepth == NumMessages );
+    check( stats.channel[1].receiveQueueDepth == NumMessages );
+
+    const uint16_t ack = 0;
+    sender.ProcessAcks( &ack, 1 );
+
+    sender.GetStats( stats );
+
+    check( stats.channel[0].sendQueueDepth == 0 );
+
+    for ( int channelIndex = 0; channelIndex < 2; ++channelIndex )
+    {
+        for ( int i = 0; i < NumMessages; ++i )
+        {
+            Message * message = receiver.ReceiveMessage( channelIndex );
+            check( message );
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    receiver.GetStats( stats );
+
+    check( stats.channel[0].receiveQueueDepth == 0 );
+    check( stats.channel[1].receiveQueueDepth == 0 );
+    check( stats.channel[0].counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] == NumMessages );
+    check( stats.channel[1].counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] == NumMessages );
+}
+
+void PumpClientServerUpdate( double & time, Client ** client, int numClients, Server ** server, int numServers, float deltaTime = 0.1f )
+{
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->SendPackets();
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->SendPackets();
+
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->ReceivePackets();
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->ReceivePackets();
+
+    time += deltaTime;
+
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->AdvanceTime( time );
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->AdvanceTime( time );
+
+    yojimbo_sleep( 0.0f );
+}
+
+void SendClientToServerMessages( Client & client, int numMessagesToSend, int channelIndex = 0 )
+{
+    for ( int i = 0; i < numMessagesToSend; ++i )
+    {
+        if ( !client.CanSendMessage( channelIndex ) )
+            break;
+
+        if ( rand() % 10 )
+        {
+            TestMessage * message = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            client.SendMessage( channelIndex, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) client.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
+            uint8_t * blockData = client.AllocateBlock( blockSize );
+            check( blockData );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            client.AttachBlockToMessage( message, blockData, blockSize );
+            client.SendMessage( channelIndex, message );
+        }
+    }
+}
+
+void SendServerToClientMessages( Server & server, int clientIndex, int numMessagesToSend, int channelIndex = 0 )
+{
+    for ( int i = 0; i < numMessagesToSend; ++i )
+    {
+        if ( !server.CanSendMessage( clientIndex, channelIndex ) )
+            break;
+
+        if ( rand() % 10 )
+        {
+            TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            server.SendMessage( clientIndex, channelIndex, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( clientIndex, TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
+            uint8_t * blockData = server.AllocateBlock( clientIndex, blockSize );
+            check( blockData );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            server.AttachBlockToMessage( clientIndex, message, blockData, blockSize );
+            server.SendMessage( clientIndex, channelIndex, message );
+        }
+    }
+}
+
+void ProcessServerToClientMessages( Client & client, int & numMessagesReceivedFromServer )
+{
+    while ( true )
+    {
+        Message * message = client.ReceiveMessage( 0 );
+
+        if ( !message )
+            break;
+
+        check( message->GetId() == (int) numMessagesReceivedFromServer );
+        
+        switch ( message->GetType() )
+        {
+            case TEST_MESSAGE:
+            {
+                TestMessage * testMessage = (TestMessage*) message;
+                check( !message->IsBlockMessage() );
+                check( testMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
+                ++numMessagesReceivedFromServer;
+            }
+            break;
+
+            case TEST_BLOCK_MESSAGE:
+            {
+                check( message->IsBlockMessage() );
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
+                const int blockSize = blockMessage->GetBlockSize();
+                check( blockSize == 1 + ( ( numMessagesReceivedFromServer * 901 ) % 1001 ) );
+                const uint8_t * blockData = blockMessage->GetBlockData();
+                check( blockData );
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceivedFromServer + j ) );
+                }
+                ++numMessagesReceivedFromServer;
+            }
+            break;
+        }
+
+        client.ReleaseMessage( message );
+    }
+}
+
+void ProcessClientToServerMessages( Server & server, int clientIndex, int & numMessagesReceivedFromClient )
+{
+    while ( true )
+    {
+        Message * message = server.ReceiveMessage( clientIndex, 0 );
+
+        if ( !message )
+            break;
+
+        check( message->GetId() == (int) numMessagesReceivedFromClient );
+
+        switch ( message->GetType() )
+        {
+            case TEST_MESSAGE:
+            {
+                check( !message->IsBlockMessage() );
+                TestMessage * testMessage = (TestMessage*) message;
+                check( testMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
+                ++numMessagesReceivedFromClient;
+            }
+            break;
+
+            case TEST_BLOCK_MESSAGE:
+            {
+                check( message->IsBlockMessage() );
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
+                const int blockSize = blockMessage->GetBlockSize();
+                check( blockSize == 1 + ( ( numMessagesReceivedFromClient * 901 ) % 1001 ) );
+                const uint8_t * blockData = blockMessage->GetBlockData();
+                check( blockData );
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceivedFromClient + j ) );
+                }
+                ++numMessagesReceivedFromClient;
+            }
+            break;
+        }
+
+        server.ReleaseMessage( clientIndex, message );
+    }
+}
+
+void test_client_server_messages()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].fragmentSize = 200;
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    client.SetLatency( 250 );
+    client.SetJitter( 100 );
+    client.SetPacketLoss( 25 );
+    client.SetDuplicates( 25 );
+
+    server.SetLatency( 250 );
+    server.SetJitter( 100 );
+    server.SetPacketLoss( 25 );
+    server.SetDuplicates( 25 );
+
+    for ( int iteration = 0; iteration < 2; ++iteration )
+    {
+        client.InsecureConnect( privateKey, clientId, serverAddress );
+
+        const int NumIterations = 10000;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+            
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( client.ConnectionFailed() )
+                break;
+
+            if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+                break;
+        }
+
+        check( !client.IsConnecting() );
+        check( client.IsConnected() );
+        check( server.GetNumConnectedClients() == 1 );
+        check( client.GetClientIndex() == 0 );
+        check( server.IsClientConnected(0) );
+
+        const int NumMessagesSent = config.channel[0].sendQueueSize;
+
+        SendClientToServerMessages( client, NumMessagesSent );
+
+        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+
+        int numMessagesReceivedFromClient = 0;
+        int numMessagesReceivedFromServer = 0;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            if ( !client.IsConnected() )
+                break;
+
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+
+            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+                break;
+        }
+
+        check( client.IsConnected() );
+        check( server.IsClientConnected( client.GetClientIndex() ) );
+        check( numMessagesReceivedFromClient == NumMessagesSent );
+        check( numMessagesReceivedFromServer == NumMessagesSent );
+
+        client.Disconnect();
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+                break;
+        }
+
+        check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+    }
+
+    server.Stop();
+}
+
+bool PumpTrustedConnect( double & time, Client & client, Server & server )
+{
+    Client * clients[] = { &client };
+    Server * servers[] = { &server };
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( !client.IsConnecting() )
+            break;
+    }
+
+    return client.IsConnected();
+}
+
+void test_client_server_trusted()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.trustedTimeout = 2.0f;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].fragmentSize = 200;
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    Client * clients[] = { &client };
+    Server * servers[] = { &server };
+
+    const int NumIterations = 10000;
+
+    // connect and exchange messages both ways
+
+    client.ConnectTrusted( privateKey, clientId, serverAddress );
+
+    check( PumpTrustedConnect( time, client, server ) );
+    check( server.GetNumConnectedClients() == 1 );
+    check( server.IsClientConnected( client.GetClientIndex() ) );
+
+    const int NumMessagesSent = config.channel[0].sendQueueSize;
+
+    SendClientToServerMessages( client, NumMessagesSent );
+
+    SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+
+    int numMessagesReceivedFromClient = 0;
+    int numMessagesReceivedFromServer = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        if ( !client.IsConnected() )
+            break;
+
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+        ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+
+        if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+            break;
+    }
+
+    check( client.IsConnected() );
+    check( numMessagesReceivedFromClient == NumMessagesSent );
+    check( numMessagesReceivedFromServer == NumMessagesSent );
+
+    // a disconnect reaches the server
+
+    client.Disconnect();
+
+    for ( int i = 0; i < NumIterations && server.GetNumConnectedClients() > 0; ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+    check( client.IsDisconnected() );
+    check( server.GetNumConnectedClients() == 0 );
+
+    // a client that goes quiet times out on the server, and the server going quiet times out the client
+
+    client.ConnectTrusted( privateKey, clientId, serverAddress );
+
+    check( PumpTrustedConnect( time, client, server ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    for ( int i = 0; i < NumIterations && server.GetNumConnectedClients() > 0; ++i )
+        PumpClientServerUpdate( time, NULL, 0, servers, 1 );
+
+    check( server.GetNumConnectedClients() == 0 );
+    check( time - 100.0 > config.trustedTimeout );
+
+    for ( int i = 0; i < NumIterations && client.IsConnected(); ++i )
+        PumpClientServerUpdate( time, clients, 1, NULL, 0 );
+
+    check( client.IsDisconnected() );
+
+    // a connect request signed with the wrong key gets no answer, and the connect attempt times out
+
+    uint8_t wrongPrivateKey[KeyBytes];
+    memset( wrongPrivateKey, 1, KeyBytes );
+
+    const double connectTime = time;
+
+    client.ConnectTrusted( wrongPrivateKey, clientId, serverAddress );
+
+    for ( int i = 0; i < NumIterations && client.IsConnecting(); ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+    check( client.ConnectionFailed() );
+    check( time - connectTime > config.trustedTimeout );
+    check( server.GetNumConnectedClients() == 0 );
+
+    client.Disconnect();
+
+    server.Stop();
+}
+
+static void test_trusted_connect_request( uint8_t * packetData, const uint8_t * privateKey, uint64_t clientId )
+{
+    packetData[0] = TRUSTED_PACKET_CONNECT_REQUEST;
+    const uint64_t protocolId = host_to_network( ClientServerConfig().protocolId );
+    const uint64_t id = host_to_network( clientId );
+    memcpy( packetData + 1, &protocolId, 8 );
+    memcpy( packetData + 1 + 8, &id, 8 );
+    trusted_connect_auth( privateKey, ClientServerConfig().protocolId, clientId, packetData + 1 + 8 + 8 );
+}
+
+static int test_trusted_receive( Socket & socket, uint8_t packetType, uint8_t * packetData, int maxPacketBytes )
+{
+    // loopback delivers on send, but give it a few goes. keep alives and anything else not asked for are skipped
+    for ( int i = 0; i < 10; ++i )
+    {
+        Address from;
+        int packetBytes;
+        while ( ( packetBytes = socket.ReceivePacket( from, packetData, maxPacketBytes ) ) > 0 )
+        {
+            if ( packetData[0] == packetType )
+                return packetBytes;
+        }
+        yojimbo_sleep( 0.001 );
+    }
+    return 0;
+}
+
+void test_client_server_trusted_connect_flood()
+{
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.serverConnectRequestBudget = 4;
+    config.serverConnectRequestRate = 1.0f;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    const int NumSockets = 8;
+
+    Socket * sockets[NumSockets];
+    for ( int i = 0; i < NumSockets; ++i )
+    {
+        sockets[i] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+        check( !sockets[i]->IsError() );
+    }
+
+    uint8_t request[TrustedConnectRequestBytes];
+    uint8_t packetData[TrustedMaxPacketBytes];
+
+    // more valid requests arrive in one tick than the budget allows. the requests over budget are dropped before auth, with no answer
+
+    for ( int i = 0; i < NumSockets; ++i )
+    {
+        test_trusted_connect_request( request, privateKey, i + 1 );
+        check( sockets[i]->SendPacket( serverAddress, request, TrustedConnectRequestBytes ) );
+    }
+
+    server.ReceivePackets();
+
+    check( server.GetNumConnectedClients() == config.serverConnectRequestBudget );
+
+    for ( int i = 0; i < NumSockets; ++i )
+    {
+        const bool accepted = test_trusted_receive( *sockets[i], TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) == TrustedConnectAcceptedBytes;
+        check( accepted == ( i < config.serverConnectRequestBudget ) );
+    }
+
+    // dropping a request over budget costs the address nothing, so the retries get in on the next tick
+
+    for ( int i = config.serverConnectRequestBudget; i < NumSockets; ++i )
+    {
+        test_trusted_connect_request( request, privateKey, i + 1 );
+        check( sockets[i]->SendPacket( serverAddress, request, TrustedConnectRequestBytes ) );
+    }
+
+    server.ReceivePackets();
+
+    check( server.GetNumConnectedClients() == NumSockets );
+
+    for ( int i = config.serverConnectRequestBudget; i < NumSockets; ++i )
+        check( test_trusted_receive( *sockets[i], TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) == TrustedConnectAcceptedBytes );
+
+    // a connected client resending its request gets the accept again without spending tokens
+
+    test_trusted_connect_request( request, privateKey, 1 );
+    check( sockets[0]->SendPacket( serverAddress, request, TrustedConnectRequestBytes ) );
+
+    server.ReceivePackets();
+
+    check( test_trusted_receive( *sockets[0], TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) == TrustedConnectAcceptedBytes );
+
+    // an address that disconnects and floods the server with requests is held to the per-address rate
+
+    const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+    check( sockets[0]->SendPacket( serverAddress, &disconnect, 1 ) );
+
+    server.ReceivePackets();
+
+    check( server.GetNumConnectedClients() == NumSockets - 1 );
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        check( sockets[0]->SendPacket( serverAddress, request, TrustedConnectRequestBytes ) );
+        server.ReceivePackets();
+    }
+
+    check( server.GetNumConnectedClients() == NumSockets - 1 );
+    check( test_trusted_receive( *sockets[0], TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) == 0 );
+
+    // once the address has earned a token back, its request is accepted
+
+    time += 1.0 / config.serverConnectRequestRate;
+    server.AdvanceTime( time );
+
+    check( sockets[0]->SendPacket( serverAddress, request, TrustedConnectRequestBytes ) );
+
+    server.ReceivePackets();
+
+    check( server.GetNumConnectedClients() == NumSockets );
+    check( test_trusted_receive( *sockets[0], TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) == TrustedConnectAcceptedBytes );
+
+    for ( int i = 0; i < NumSockets; ++i )
+        YOJIMBO_DELETE( GetDefaultAllocator(), Socket, sockets[i] );
+
+    server.Stop();
+}
+
+struct TestTrustedPathProxy
+{
+    Socket * front;                                 // the address clients send to, in place of the server
+    Socket * back[2];                               // one upstream socket per path, so the server sees two client addresses
+    Address clientAddress[2];
+    Address serverAddress;
+    bool down[2];
+    int maxPacketBytes;                             // packets larger than this are dropped, as by a link with a smaller MTU. 0 for no limit
+    int numPacketsForwarded[2];
+    int numConnectAcceptedForwarded[2];
+    int largestPayloadForwarded;
+};
+
+static void test_trusted_proxy_forward( TestTrustedPathProxy & proxy )
+{
+    Address from;
+    uint8_t packetData[TrustedMaxPacketBytes];
+    int packetBytes;
+
+    while ( ( packetBytes = proxy.front->ReceivePacket( from, packetData, sizeof( packetData ) ) ) > 0 )
+    {
+        for ( int path = 0; path < 2; ++path )
+        {
+            if ( from == proxy.clientAddress[path] && !proxy.down[path] )
+            {
+                if ( proxy.maxPacketBytes > 0 && packetBytes > proxy.maxPacketBytes )
+                    continue;
+                proxy.back[path]->SendPacket( proxy.serverAddress, packetData, packetBytes );
+                proxy.numPacketsForwarded[path]++;
+                if ( packetData[0] == TRUSTED_PACKET_PAYLOAD )
+                    proxy.largestPayloadForwarded = yojimbo_max( proxy.largestPayloadForwarded, packetBytes );
+            }
+        }
+    }
+
+    for ( int path = 0; path < 2; ++path )
+    {
+        while ( ( packetBytes = proxy.back[path]->ReceivePacket( from, packetData, sizeof( packetData ) ) ) > 0 )
+        {
+            if ( proxy.down[path] || ( proxy.maxPacketBytes > 0 && packetBytes > proxy.maxPacketBytes ) )
+                continue;
+            proxy.front->SendPacket( proxy.clientAddress[path], packetData, packetBytes );
+            proxy.numPacketsForwarded[path]++;
+            if ( packetData[0] == TRUSTED_PACKET_PAYLOAD )
+                proxy.largestPayloadForwarded = yojimbo_max( proxy.largestPayloadForwarded, packetBytes );
+            if ( packetData[0] == TRUSTED_PACKET_CONNECT_ACCEPTED )
+                proxy.numConnectAcceptedForwarded[path]++;
+        }
+    }
+}
+
+static void test_trusted_proxy_update( double & time, Client & client, Server & server, TestTrustedPathProxy & proxy )
+{
+    client.SendPackets();
+    server.SendPackets();
+
+    test_trusted_proxy_forward( proxy );
+
+    client.ReceivePackets();
+    server.ReceivePackets();
+
+    time += 0.1;
+
+    client.AdvanceTime( time );
+    server.AdvanceTime( time );
+}
+
+static bool test_trusted_proxy_messages( double & time, Client & client, Server & server, TestTrustedPathProxy & proxy, uint16_t & sequence, int numMessages )
+{
+    const int clientIndex = client.GetClientIndex();
+
+    for ( int i = 0; i < numMessages; ++i )
+    {
+        TestMessage * clientMessage = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
+        TestMessage * serverMessage = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
+        check( clientMessage );
+        check( serverMessage );
+        clientMessage->sequence = uint16_t( sequence + i );
+        serverMessage->sequence = uint16_t( sequence + i );
+        client.SendMessage( 0, clientMessage );
+        server.SendMessage( clientIndex, 0, serverMessage );
+    }
+
+    int numMessagesReceivedFromClient = 0;
+    int numMessagesReceivedFromServer = 0;
+
+    for ( int i = 0; i < 1000 && client.IsConnected(); ++i )
+    {
+        test_trusted_proxy_update( time, client, server, proxy );
+
+        Message * message;
+
+        while ( ( message = client.ReceiveMessage( 0 ) ) != NULL )
+        {
+            check( ( (TestMessage*) message )->sequence == uint16_t( sequence + numMessagesReceivedFromServer ) );
+            numMessagesReceivedFromServer++;
+            client.ReleaseMessage( message );
+        }
+
+        while ( ( message = server.ReceiveMessage( clientIndex, 0 ) ) != NULL )
+        {
+            check( ( (TestMessage*) message )->sequence == uint16_t( sequence + numMessagesReceivedFromClient ) );
+            numMessagesReceivedFromClient++;
+            server.ReleaseMessage( clientIndex, message );
+        }
+
+        if ( numMessagesReceivedFromClient == numMessages && numMessagesReceivedFromServer == numMessages )
+        {
+            sequence += numMessages;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void test_client_server_trusted_multipath()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "127.0.0.1", ClientPort );
+    Address secondaryAddress( "127.0.0.1", ClientPort + 1 );
+    Address serverAddress( "127.0.0.1", ServerPort );
+    Address proxyAddress( "127.0.0.1", ServerPort + 1 );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.trustedMultipath = true;
+    config.trustedTimeout = 2.0f;
+    config.dropDuplicatePackets = true;
+
+    // the client reaches the server through a proxy that can cut either path
+
+    TestTrustedPathProxy proxy = TestTrustedPathProxy();
+    proxy.front = YOJIMBO_NEW( GetDefaultAllocator(), Socket, proxyAddress );
+    proxy.back[0] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+    proxy.back[1] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+    proxy.clientAddress[0] = clientAddress;
+    proxy.clientAddress[1] = secondaryAddress;
+    proxy.serverAddress = serverAddress;
+
+    check( !proxy.front->IsError() );
+    check( !proxy.back[0]->IsError() );
+    check( !proxy.back[1]->IsError() );
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    // the client connects over the first path, then adds the second
+
+    client.ConnectTrusted( privateKey, clientId, proxyAddress, secondaryAddress );
+
+    for ( int i = 0; i < 100 && proxy.numConnectAcceptedForwarded[1] == 0; ++i )
+        test_trusted_proxy_update( time, client, server, proxy );
+
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( proxy.numConnectAcceptedForwarded[0] > 0 );
+    check( proxy.numConnectAcceptedForwarded[1] > 0 );
+
+    const int NumMessages = 32;
+
+    uint16_t sequence = 0;
+
+    check( test_trusted_proxy_messages( time, client, server, proxy, sequence, NumMessages ) );
+
+    // cut the first path. both ends fail over to the second once nothing has come in over the first for TrustedPathTimeout, well inside the connection timeout
+
+    proxy.down[0] = true;
+
+    const int numPacketsForwarded = proxy.numPacketsForwarded[1];
+    const double failTime = time;
+
+    check( test_trusted_proxy_messages( time, client, server, proxy, sequence, NumMessages ) );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( time - failTime < config.trustedTimeout );
+    check( proxy.numPacketsForwarded[1] > numPacketsForwarded );
+
+    for ( int i = 0; i < 30; ++i )
+        test_trusted_proxy_update( time, client, server, proxy );
+
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // bring the first path back and cut the second. traffic moves back to the first
+
+    proxy.down[0] = false;
+    proxy.down[1] = true;
+
+    check( test_trusted_proxy_messages( time, client, server, proxy, sequence, NumMessages ) );
+
+    for ( int i = 0; i < 30; ++i )
+        test_trusted_proxy_update( time, client, server, proxy );
+
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // with both paths cut, the connection times out
+
+    proxy.down[0] = true;
+
+    for ( int i = 0; i < 1000 && client.IsConnected(); ++i )
+        test_trusted_proxy_update( time, client, server, proxy );
+
+    check( client.IsDisconnected() );
+    check( server.GetNumConnectedClients() == 0 );
+
+    server.Stop();
+
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.front );
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.back[0] );
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.back[1] );
+}
+
+void test_client_server_trusted_path_mtu()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "127.0.0.1", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+    Address proxyAddress( "127.0.0.1", ServerPort + 1 );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.trustedPathMtuDiscovery = true;
+    config.channel[0].packetBudget = -1;
+    config.channel[0].maxMessagesPerPacket = 256;
+
+    // the client reaches the server through a proxy that can drop packets too large for a smaller MTU
+
+    TestTrustedPathProxy proxy = TestTrustedPathProxy();
+    proxy.front = YOJIMBO_NEW( GetDefaultAllocator(), Socket, proxyAddress );
+    proxy.back[0] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+    proxy.back[1] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+    proxy.clientAddress[0] = clientAddress;
+    proxy.serverAddress = serverAddress;
+
+    check( !proxy.front->IsError() );
+    check( !proxy.back[0]->IsError() );
+    check( !proxy.back[1]->IsError() );
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    // every probe succeeds on a path that carries the largest size. on a path that drops larger packets, probes over the limit fail and the search settles just under it
+
+    const int PathLimits[] = { 0, 1300 };
+
+    for ( int i = 0; i < (int) ( sizeof( PathLimits ) / sizeof( int ) ); ++i )
+    {
+        proxy.maxPacketBytes = PathLimits[i];
+        proxy.largestPayloadForwarded = 0;
+
+        client.ConnectTrusted( privateKey, clientId, proxyAddress );
+
+        for ( int j = 0; j < 100 && client.IsConnecting(); ++j )
+            test_trusted_proxy_update( time, client, server, proxy );
+
+        check( client.IsConnected() );
+
+        const int clientIndex = client.GetClientIndex();
+
+        // until a probe is acked, both ends stick to the size every path carries
+
+        check( client.GetTrustedPathBytes() == TrustedMinPathBytes );
+        check( server.GetClientPathBytes( clientIndex ) == TrustedMinPathBytes );
+
+        for ( int j = 0; j < 60; ++j )
+            test_trusted_proxy_update( time, client, server, proxy );
+
+        check( client.IsConnected() );
+
+        const int pathBytes = client.GetTrustedPathBytes();
+
+        if ( PathLimits[i] == 0 )
+            check( pathBytes == TrustedMaxPathBytes );
+        else
+            check( pathBytes <= PathLimits[i] && pathBytes > PathLimits[i] - TrustedPathSearchGranularity );
+
+        check( server.GetClientPathBytes( clientIndex ) == pathBytes );
+
+        // packets fill up to the size found, and no larger, so nothing is lost to the limit
+
+        uint16_t sequence = 0;
+
+        check( test_trusted_proxy_messages( time, client, server, proxy, sequence, 256 ) );
+        check( proxy.largestPayloadForwarded > TrustedMinPathBytes );
+        check( proxy.largestPayloadForwarded <= pathBytes );
+
+        client.Disconnect();
+
+        for ( int j = 0; j < 100 && server.GetNumConnectedClients() > 0; ++j )
+            test_trusted_proxy_update( time, client, server, proxy );
+
+        check( server.GetNumConnectedClients() == 0 );
+    }
+
+    server.Stop();
+
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.front );
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.back[0] );
+    YOJIMBO_DELETE( GetDefaultAllocator(), Socket, proxy.back[1] );
+}
+
+static void test_trusted_resume_request( uint8_t * packetData, uint32_t clientIndex, uint64_t ticket )
+{
+    packetData[0] = TRUSTED_PACKET_RESUME_REQUEST;
+    const uint64_t protocolId = host_to_network( ClientServerConfig().protocolId );
+    clientIndex = host_to_network( clientIndex );
+    ticket = host_to_network( ticket );
+    memcpy( packetData + 1, &protocolId, 8 );
+    memcpy( packetData + 1 + 8, &clientIndex, 4 );
+    memcpy( packetData + 1 + 8 + 4, &ticket, 8 );
+}
+
+static bool test_trusted_accepted( Socket & socket, uint32_t & clientIndex, uint64_t & ticket )
+{
+    uint8_t packetData[TrustedMaxPacketBytes];
+    if ( test_trusted_receive( socket, TRUSTED_PACKET_CONNECT_ACCEPTED, packetData, sizeof( packetData ) ) != TrustedConnectAcceptedBytes )
+        return false;
+    memcpy( &clientIndex, packetData + 1, 4 );
+    memcpy( &ticket, packetData + 1 + 4, 8 );
+    clientIndex = network_to_host( clientIndex );
+    ticket = network_to_host( ticket );
+    return true;
+}
+
+static bool test_trusted_disconnected( Socket & socket )
+{
+    uint8_t packetData[TrustedMaxPacketBytes];
+    return test_trusted_receive( socket, TRUSTED_PACKET_DISCONNECT, packetData, sizeof( packetData ) ) == 1;
+}
+
+void test_client_server_trusted_resume()
+{
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.trustedTimeout = 1.0f;
+    config.trustedResumeTime = 2.0f;
+    config.serverConnectRequestRate = 0.0f;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    const int NumSockets = 3;
+
+    Socket * sockets[NumSockets];
+    for ( int i = 0; i < NumSockets; ++i )
+    {
+        sockets[i] = YOJIMBO_NEW( GetDefaultAllocator(), Socket, Address( "127.0.0.1:0" ) );
+        check( !sockets[i]->IsError() );
+    }
+
+    uint8_t connectRequest[TrustedConnectRequestBytes];
+    uint8_t resumeRequest[TrustedResumeRequestBytes];
+
+    uint32_t clientIndex = 0;
+    uint64_t ticket = 0;
+
+    test_trusted_connect_request( connectRequest, privateKey, 1 );
+    check( sockets[0]->SendPacket( serverAddress, connectRequest, TrustedConnectRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_accepted( *sockets[0], clientIndex, ticket ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // a valid ticket moves the connection to the new address, and is replaced with a new one
+
+    uint32_t resumedClientIndex = 0;
+    uint64_t resumedTicket = 0;
+
+    test_trusted_resume_request( resumeRequest, clientIndex, ticket );
+    check( sockets[1]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_accepted( *sockets[1], resumedClientIndex, resumedTicket ) );
+    check( resumedClientIndex == clientIndex );
+    check( resumedTicket != ticket );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // the old address no longer speaks for the client
+
+    const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+    check( sockets[0]->SendPacket( serverAddress, &disconnect, 1 ) );
+    server.ReceivePackets();
+
+    check( server.GetNumConnectedClients() == 1 );
+
+    // the resumed address resending its request gets the accept again. the ticket it redeemed is no good from anywhere else
+
+    check( sockets[1]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    uint32_t resentClientIndex = 0;
+    uint64_t resentTicket = 0;
+    check( test_trusted_accepted( *sockets[1], resentClientIndex, resentTicket ) );
+    check( resentClientIndex == clientIndex );
+    check( resentTicket == resumedTicket );
+
+    check( test_trusted_disconnected( *sockets[2] ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    ticket = resumedTicket;
+
+    // a tampered ticket, or the right ticket for the wrong slot, gets a disconnect and changes nothing
+
+    test_trusted_resume_request( resumeRequest, clientIndex, ticket ^ 1 );
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_disconnected( *sockets[2] ) );
+
+    test_trusted_resume_request( resumeRequest, clientIndex + 1, ticket );
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_disconnected( *sockets[2] ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // a client that times out is suspended, and can resume within the resume time
+
+    for ( int i = 0; i < 15; ++i )
+    {
+        time += 0.1;
+        server.AdvanceTime( time );
+    }
+
+    check( server.GetNumConnectedClients() == 1 );
+
+    test_trusted_resume_request( resumeRequest, clientIndex, ticket );
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_accepted( *sockets[2], resumedClientIndex, resumedTicket ) );
+    check( resumedClientIndex == clientIndex );
+    check( resumedTicket != ticket );
+
+    ticket = resumedTicket;
+
+    // past the resume time, the slot is freed and the ticket has expired
+
+    for ( int i = 0; i < 40; ++i )
+    {
+        time += 0.1;
+        server.AdvanceTime( time );
+    }
+
+    check( server.GetNumConnectedClients() == 0 );
+
+    test_trusted_resume_request( resumeRequest, clientIndex, ticket );
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_disconnected( *sockets[2] ) );
+    check( server.GetNumConnectedClients() == 0 );
+
+    // once another client takes the slot, the last ticket issued for it doesn't resume into someone else's connection
+
+    test_trusted_connect_request( connectRequest, privateKey, 2 );
+    check( sockets[0]->SendPacket( serverAddress, connectRequest, TrustedConnectRequestBytes ) );
+    server.ReceivePackets();
+
+    uint32_t otherClientIndex = 0;
+    uint64_t otherTicket = 0;
+    check( test_trusted_accepted( *sockets[0], otherClientIndex, otherTicket ) );
+    check( otherClientIndex == clientIndex );
+
+    check( sockets[2]->SendPacket( serverAddress, resumeRequest, TrustedResumeRequestBytes ) );
+    server.ReceivePackets();
+
+    check( test_trusted_disconnected( *sockets[2] ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    for ( int i = 0; i < NumSockets; ++i )
+        YOJIMBO_DELETE( GetDefaultAllocator(), Socket, sockets[i] );
+
+    server.Stop();
+
+    // end to end: a client resumes on request, and on its own when the connection times out
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    Client * clients[] = { &client };
+    Server * servers[] = { &server };
+
+    client.ConnectTrusted( privateKey, 1, serverAddress );
+
+    check( PumpTrustedConnect( time, client, server ) );
+
+    const int connectedClientIndex = client.GetClientIndex();
+
+    client.ResumeTrusted();
+
+    check( client.IsResumingTrusted() );
+
+    for ( int i = 0; i < 100 && client.IsResumingTrusted(); ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+    check( !client.IsResumingTrusted() );
+    check( client.IsConnected() );
+    check( client.GetClientIndex() == connectedClientIndex );
+    check( server.GetNumConnectedClients() == 1 );
+
+    for ( int i = 0; i < 15; ++i )
+        PumpClientServerUpdate( time, NULL, 0, servers, 1 );
+
+    check( server.GetNumConnectedClients() == 1 );
+
+    for ( int i = 0; i < 100 && !client.IsResumingTrusted(); ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+    check( client.IsResumingTrusted() );
+
+    for ( int i = 0; i < 100 && client.IsResumingTrusted(); ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+    check( !client.IsResumingTrusted() );
+    check( client.IsConnected() );
+    check( client.GetClientIndex() == connectedClientIndex );
+    check( server.GetNumConnectedClients() == 1 );
+
+    client.Disconnect();
+
+    server.Stop();
+}
+
+void test_client_server_trusted_groups()
+{
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.serverMaxClientGroups = 2;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+    check( server.GetNumClientGroups() == 2 );
+
+    const int NumClients = 4;
+
+    Client * clients[NumClients];
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), Address( "0.0.0.0", ClientPort + i ), config, adapter, time );
+        clients[i]->ConnectTrusted( privateKey, i + 1, serverAddress );
+    }
+
+    Server * servers[] = { &server };
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+
+        int numConnected = 0;
+        for ( int j = 0; j < NumClients; ++j )
+            numConnected += clients[j]->IsConnected() ? 1 : 0;
+        if ( numConnected == NumClients )
+            break;
+    }
+
+    for ( int i = 0; i < NumClients; ++i )
+        check( clients[i]->IsConnected() );
+
+    check( server.GetNumConnectedClients() == NumClients );
+
+    // group 0 holds clients 0 and 2, group 1 holds clients 1 and 2. client 3 is in neither
+
+    check( server.AddClientToGroup( 0, clients[0]->GetClientIndex() ) );
+    check( server.AddClientToGroup( 0, clients[2]->GetClientIndex() ) );
+    check( server.AddClientToGroup( 1, clients[1]->GetClientIndex() ) );
+    check( server.AddClientToGroup( 1, clients[2]->GetClientIndex() ) );
+
+    check( server.GetNumClientsInGroup( 0 ) == 2 );
+    check( server.GetNumClientsInGroup( 1 ) == 2 );
+    check( !server.IsClientInGroup( 0, clients[3]->GetClientIndex() ) );
+    check( !server.IsClientInGroup( 1, clients[3]->GetClientIndex() ) );
+
+    // messages to group 0 have sequence [0,NumMessages-1], messages to group 1 have sequence [NumMessages,2*NumMessages-1]
+
+    const int NumMessages = 16;
+
+    for ( int i = 0; i < 2 * NumMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        check( server.SendMessageToGroup( i / NumMessages, 0, message ) == 2 );
+    }
+
+    int numReceived[NumClients][2 * NumMessages];
+    memset( numReceived, 0, sizeof( numReceived ) );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+
+        for ( int j = 0; j < NumClients; ++j )
         {
-            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            sender.SendMessage( 0, message );
+            Message * message;
+            while ( ( message = clients[j]->ReceiveMessage( 0 ) ) != NULL )
+            {
+                check( message->GetType() == TEST_MESSAGE );
+                const int sequence = ( (TestMessage*) message )->sequence;
+                check( sequence < 2 * NumMessages );
+                numReceived[j][sequence]++;
+                clients[j]->ReleaseMessage( message );
+            }
         }
-        else
+    }
+
+    // each member gets each message sent to its groups exactly once, and nobody else gets it
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        for ( int j = 0; j < 2 * NumMessages; ++j )
         {
-            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
-            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-            sender.SendMessage( 0, message );
+            const int groupIndex = j / NumMessages;
+            const bool member = server.IsClientInGroup( groupIndex, clients[i]->GetClientIndex() );
+            check( numReceived[i][j] == ( member ? 1 : 0 ) );
+        }
+    }
+
+    // a client removed from a group, or that disconnects, gets nothing more sent to it
+
+    server.RemoveClientFromGroup( 0, clients[2]->GetClientIndex() );
+
+    check( server.GetNumClientsInGroup( 0 ) == 1 );
+
+    clients[1]->Disconnect();
+
+    for ( int i = 0; i < 100 && server.GetNumConnectedClients() == NumClients; ++i )
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+
+    check( server.GetNumClientsInGroup( 1 ) == 1 );
+
+    TestMessage * message = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 0;
+    check( server.SendMessageToGroup( 0, 0, message ) == 1 );
+
+    memset( numReceived, 0, sizeof( numReceived ) );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+
+        for ( int j = 0; j < NumClients; ++j )
+        {
+            if ( !clients[j]->IsConnected() )
+                continue;
+            Message * received;
+            while ( ( received = clients[j]->ReceiveMessage( 0 ) ) != NULL )
+            {
+                numReceived[j][0]++;
+                clients[j]->ReleaseMessage( received );
+            }
+        }
+    }
+
+    check( numReceived[0][0] == 1 );
+    check( numReceived[1][0] == 0 );
+    check( numReceived[2][0] == 0 );
+    check( numReceived[3][0] == 0 );
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clients[i]->Disconnect();
+        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+    }
+
+    server.Stop();
+}
+
+class AdmissionTestAdapter : public TestAdapter
+{
+public:
+
+    bool AdmitClient( int clientIndex, bool admit )
+    {
+        (void) clientIndex;
+        numRefusedByPolicy += admit ? 0 : 1;
+        return admit || admitAll;
+    }
+
+    bool admitAll;
+    int numRefusedByPolicy;
+};
+
+void test_client_server_trusted_admission()
+{
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.trustedNetwork = true;
+    config.serverAdmissionTickTime = 0.05f;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    AdmissionTestAdapter admissionAdapter;
+    admissionAdapter.admitAll = false;
+    admissionAdapter.numRefusedByPolicy = 0;
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, admissionAdapter, time );
+
+    server.Start( MaxClients );
+
+    check( server.IsRunning() );
+
+    Client client( GetDefaultAllocator(), Address( "0.0.0.0", ClientPort ), config, adapter, time );
+    Client otherClient( GetDefaultAllocator(), Address( "0.0.0.0", ClientPort + 1 ), config, adapter, time );
+
+    // while the tick time is over the limit, new clients are refused straight away instead of timing out
+
+    server.SetTickTime( 0.1 );
+
+    check( !server.IsAdmittingClients() );
+
+    const double connectTime = time;
+
+    client.ConnectTrusted( privateKey, 1, serverAddress );
+
+    check( !PumpTrustedConnect( time, client, server ) );
+    check( client.ConnectionFailed() );
+    check( time - connectTime < config.trustedTimeout );
+    check( server.GetNumConnectedClients() == 0 );
+    check( admissionAdapter.numRefusedByPolicy > 0 );
+
+    // once the tick time drops back under the limit, clients are let in again
+
+    server.SetTickTime( 0.01 );
+
+    check( server.IsAdmittingClients() );
+
+    client.ConnectTrusted( privateKey, 1, serverAddress );
+
+    check( PumpTrustedConnect( time, client, server ) );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // going over the limit keeps clients that are already connected, and refuses the next one
+
+    server.SetTickTime( 0.1 );
+
+    otherClient.ConnectTrusted( privateKey, 2, serverAddress );
+
+    Client * clients[] = { &client, &otherClient };
+    Server * servers[] = { &server };
+
+    for ( int i = 0; i < 100 && otherClient.IsConnecting(); ++i )
+        PumpClientServerUpdate( time, clients, 2, servers, 1 );
+
+    check( otherClient.ConnectionFailed() );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+
+    // the adapter has the final say
+
+    admissionAdapter.admitAll = true;
+
+    otherClient.ConnectTrusted( privateKey, 2, serverAddress );
+
+    for ( int i = 0; i < 100 && otherClient.IsConnecting(); ++i )
+        PumpClientServerUpdate( time, clients, 2, servers, 1 );
+
+    check( otherClient.IsConnected() );
+    check( server.GetNumConnectedClients() == 2 );
+
+    client.Disconnect();
+    otherClient.Disconnect();
+
+    server.Stop();
+
+    // with a fixed shared client pool, clients are refused once less than the headroom is free
+
+    ClientServerConfig memoryConfig = config;
+    memoryConfig.serverAdmissionTickTime = 0.0f;
+    memoryConfig.serverSharedClientMemory = true;
+    memoryConfig.serverSharedClientPoolMemory = 4 * config.serverPerClientMemory;
+    memoryConfig.serverAdmissionMemoryHeadroom = memoryConfig.serverSharedClientPoolMemory - 1;
+
+    admissionAdapter.admitAll = false;
+    admissionAdapter.numRefusedByPolicy = 0;
+
+    Server memoryServer( GetDefaultAllocator(), privateKey, serverAddress, memoryConfig, admissionAdapter, time );
+
+    memoryServer.Start( MaxClients );
+
+    check( memoryServer.IsRunning() );
+    check( memoryServer.IsAdmittingClients() );
+
+    client.ConnectTrusted( privateKey, 1, serverAddress );
+
+    check( PumpTrustedConnect( time, client, memoryServer ) );
+    check( memoryServer.GetNumConnectedClients() == 1 );
+
+    check( memoryServer.GetSharedClientMemoryFree() < memoryConfig.serverAdmissionMemoryHeadroom );
+    check( !memoryServer.IsAdmittingClients() );
+
+    servers[0] = &memoryServer;
+
+    otherClient.ConnectTrusted( privateKey, 2, serverAddress );
+
+    for ( int i = 0; i < 100 && otherClient.IsConnecting(); ++i )
+        PumpClientServerUpdate( time, clients, 2, servers, 1 );
+
+    check( otherClient.ConnectionFailed() );
+    check( client.IsConnected() );
+    check( memoryServer.GetNumConnectedClients() == 1 );
+    check( admissionAdapter.numRefusedByPolicy > 0 );
+
+    client.Disconnect();
+    otherClient.Disconnect();
+
+    memoryServer.Stop();
+}
+
+void test_client_server_connect_race()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+    Address deadServerAddress( "127.0.0.1", ServerPort + 1 );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.clientConnectRace = 2;
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    // the dead server is first in the list. racing connects to the live one without waiting for the first to time out
+
+    Address serverAddresses[] = { deadServerAddress, serverAddress };
+
+    client.InsecureConnect( privateKey, clientId, serverAddresses, 2 );
+
+    const double startTime = time;
+
+    const int NumIterations = 100;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( client.ConnectionFailed() )
+            break;
+
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+            break;
+    }
+
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( time - startTime < 1.0 );
+
+    client.Disconnect();
+
+    server.Stop();
+}
+
+class SpectatorTestAdapter : public TestAdapter
+{
+public:
+
+    bool IsSpectator( int clientIndex )
+    {
+        (void) clientIndex;
+        return spectators;
+    }
+
+    bool spectators;
+};
+
+void test_client_server_spectators()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.channel[0].sendQueueSize = 256;
+    config.channel[0].receiveQueueSize = 256;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.serverSharedClientMemory = true;
+    config.serverSpectatorQueueSize = 16;
+
+    SpectatorTestAdapter spectatorAdapter;
+
+    Client client( GetDefaultAllocator(), clientAddress, config, spectatorAdapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, spectatorAdapter, time );
+
+    server.Start( MaxClients );
+
+    // connect as a spectator, then as a player, then as a spectator again, so the slot is rebuilt each time
+
+    for ( int iteration = 0; iteration < 3; ++iteration )
+    {
+        spectatorAdapter.spectators = iteration != 1;
+
+        client.InsecureConnect( privateKey, clientId, serverAddress );
+
+        const int NumIterations = 10000;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( client.ConnectionFailed() )
+                break;
+
+            if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+                break;
+        }
+
+        check( client.IsConnected() );
+        check( server.GetNumConnectedClients() == 1 );
+
+        const int clientIndex = client.GetClientIndex();
+
+        check( server.IsClientSpectator( clientIndex ) == spectatorAdapter.spectators );
+
+        // spectator channel queues are capped at serverSpectatorQueueSize
+
+        const int NumMessagesSent = spectatorAdapter.spectators ? config.serverSpectatorQueueSize : config.channel[0].sendQueueSize;
+
+        SendServerToClientMessages( server, clientIndex, NumMessagesSent );
+
+        check( server.CanSendMessage( clientIndex, 0 ) == !spectatorAdapter.spectators );
+
+        SendClientToServerMessages( client, config.serverSpectatorQueueSize );
+
+        int numMessagesReceivedFromClient = 0;
+        int numMessagesReceivedFromServer = 0;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            if ( !client.IsConnected() )
+                break;
+
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+            ProcessClientToServerMessages( server, clientIndex, numMessagesReceivedFromClient );
+
+            if ( numMessagesReceivedFromClient == config.serverSpectatorQueueSize && numMessagesReceivedFromServer == NumMessagesSent )
+                break;
+        }
+
+        check( client.IsConnected() );
+        check( numMessagesReceivedFromClient == config.serverSpectatorQueueSize );
+        check( numMessagesReceivedFromServer == NumMessagesSent );
+
+        client.Disconnect();
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+                break;
         }
+
+        check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
     }
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    server.Stop();
+}
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+void test_client_server_loopback()
+{
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
-    int numMessagesReceived = 0;
+    double time = 100.0;
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    ClientServerConfig config;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].fragmentSize = 200;
 
-    const int NumIterations = 10000;
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-    for ( int i = 0; i < NumIterations; ++i )
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    for ( int iteration = 0; iteration < 2; ++iteration )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        // loopback clients are connected immediately and take the highest free slot
 
-        while ( true )
-        {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
+        check( client.ConnectLoopback( server ) );
+        check( client.IsConnected() );
+        check( client.IsLoopback() );
+        check( client.GetClientIndex() == MaxClients - 1 );
+        check( server.GetNumConnectedClients() == 1 );
+        check( server.IsClientConnected( MaxClients - 1 ) );
+        check( server.IsLoopbackClient( MaxClients - 1 ) );
 
-            check( message->GetId() == (int) numMessagesReceived );
+        const int NumMessagesSent = config.channel[0].sendQueueSize;
 
-            switch ( message->GetType() )
-            {
-                case TEST_MESSAGE:
-                {
-                    TestMessage * testMessage = (TestMessage*) message;
+        SendClientToServerMessages( client, NumMessagesSent );
 
-                    check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
 
-                    ++numMessagesReceived;
-                }
-                break;
+        int numMessagesReceivedFromClient = 0;
+        int numMessagesReceivedFromServer = 0;
 
-                case TEST_BLOCK_MESSAGE:
-                {
-                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+        const int NumIterations = 10000;
 
-                    check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            if ( !client.IsConnected() )
+                break;
 
-                    const int blockSize = blockMessage->GetBlockSize();
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
 
-                    check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
-        
-                    const uint8_t * blockData = blockMessage->GetBlockData();
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-                    check( blockData );
+            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
 
-                    for ( int j = 0; j < blockSize; ++j )
-                    {
-                        check( blockData[j] == uint8_t( numMessagesReceived + j ) );
-                    }
+            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
 
-                    ++numMessagesReceived;
-                }
+            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
                 break;
-            }
+        }
 
-            messageFactory.ReleaseMessage( message );
+        check( client.IsConnected() );
+        check( numMessagesReceivedFromClient == NumMessagesSent );
+        check( numMessagesReceivedFromServer == NumMessagesSent );
+
+        // the first time around the client disconnects, the second time the server disconnects it
+
+        if ( iteration == 0 )
+        {
+            client.Disconnect();
+        }
+        else
+        {
+            server.DisconnectClient( MaxClients - 1 );
         }
 
-        if ( numMessagesReceived == NumMessagesSent )
-            break;
+        check( client.IsDisconnected() );
+        check( !client.IsLoopback() );
+        check( server.GetNumConnectedClients() == 0 );
+        check( !server.IsLoopbackClient( MaxClients - 1 ) );
     }
 
-    check( numMessagesReceived == NumMessagesSent );
+    server.Stop();
 }
 
-void test_connection_reliable_ordered_messages_and_blocks_multiple_channels()
+void test_client_server_shared_memory()
 {
-    const int NumChannels = 2;
-
-    double time = 100.0;
-    
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
-
-    ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = NumChannels;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    connectionConfig.channel[0].maxMessagesPerPacket = 8;
-    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    connectionConfig.channel[1].maxMessagesPerPacket = 8;
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    const char * path = "yojimbo_test_shared_memory";
 
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    double time = 100.0;
 
-    const int NumMessagesSent = 32;
+    ClientServerConfig config;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].fragmentSize = 200;
+    config.sharedMemoryRingBytes = 64 * 1024;
 
-    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
-    {
-        for ( int i = 0; i < NumMessagesSent; ++i )
-        {
-            if ( rand() % 2 )
-            {
-                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-                check( message );
-                message->sequence = i;
-                sender.SendMessage( channelIndex, message );
-            }
-            else
-            {
-                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-                check( message );
-                message->sequence = i;
-                const int blockSize = 1 + ( ( i * 901 ) % 3333 );
-                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-                for ( int j = 0; j < blockSize; ++j )
-                    blockData[j] = i + j;
-                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-                sender.SendMessage( channelIndex, message );
-            }
-        }
-    }
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
 
-    const int NumIterations = 10000;
+    server.Start( MaxClients );
 
-    int numMessagesReceived[NumChannels];
-    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+    // nothing to connect to until the server opens the link
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    check( !client.ConnectSharedMemory( path ) );
+    check( client.ConnectionFailed() );
 
-    for ( int i = 0; i < NumIterations; ++i )
+    for ( int iteration = 0; iteration < 2; ++iteration )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        // the link takes the highest free slot, like a loopback client
 
-        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
-        {
-            while ( true )
-            {
-                Message * message = receiver.ReceiveMessage( channelIndex );
-                if ( !message )
-                    break;
+        check( server.ConnectSharedMemoryClient( path ) == MaxClients - 1 );
+        check( server.IsLoopbackClient( MaxClients - 1 ) );
 
-                check( message->GetId() == (int) numMessagesReceived[channelIndex] );
+        check( client.ConnectSharedMemory( path ) );
+        check( client.IsConnected() );
+        check( client.IsLoopback() );
+        check( client.GetClientIndex() == MaxClients - 1 );
+        check( server.GetNumConnectedClients() == 1 );
 
-                switch ( message->GetType() )
-                {
-                    case TEST_MESSAGE:
-                    {
-                        TestMessage * testMessage = (TestMessage*) message;
+        const int NumMessagesSent = config.channel[0].sendQueueSize;
 
-                        check( testMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+        SendClientToServerMessages( client, NumMessagesSent );
 
-                        ++numMessagesReceived[channelIndex];
-                    }
-                    break;
+        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
 
-                    case TEST_BLOCK_MESSAGE:
-                    {
-                        TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+        int numMessagesReceivedFromClient = 0;
+        int numMessagesReceivedFromServer = 0;
 
-                        check( blockMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+        const int NumIterations = 10000;
 
-                        const int blockSize = blockMessage->GetBlockSize();
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            if ( !client.IsConnected() )
+                break;
 
-                        check( blockSize == 1 + ( ( numMessagesReceived[channelIndex] * 901 ) % 3333 ) );
-            
-                        const uint8_t * blockData = blockMessage->GetBlockData();
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
 
-                        check( blockData );
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-                        for ( int j = 0; j < blockSize; ++j )
-                        {
-                            check( blockData[j] == uint8_t( numMessagesReceived[channelIndex] + j ) );
-                        }
+            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
 
-                        ++numMessagesReceived[channelIndex];
-                    }
-                    break;
-                }
+            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
 
-                messageFactory.ReleaseMessage( message );
-            }
+            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+                break;
         }
 
-        bool receivedAllMessages = true;
+        check( client.IsConnected() );
+        check( numMessagesReceivedFromClient == NumMessagesSent );
+        check( numMessagesReceivedFromServer == NumMessagesSent );
 
-        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        // the first time around the client closes the link, the second time the server does. the other end sees it on its next update
+
+        if ( iteration == 0 )
         {
-            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
-            {
-                receivedAllMessages = false;
-                break;
-            }
+            client.Disconnect();
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        }
+        else
+        {
+            server.DisconnectClient( MaxClients - 1 );
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+            check( client.IsDisconnected() );
+            client.Disconnect();
         }
 
-        if ( receivedAllMessages )
-            break;
+        check( client.IsDisconnected() );
+        check( !client.IsLoopback() );
+        check( server.GetNumConnectedClients() == 0 );
+        check( !server.IsLoopbackClient( MaxClients - 1 ) );
     }
 
-    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    // a link no client opens times out
+
+    check( server.ConnectSharedMemoryClient( path ) == MaxClients - 1 );
+    for ( int i = 0; i < 1000 && server.IsClientConnected( MaxClients - 1 ); ++i )
     {
-        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+        Server * servers[] = { &server };
+        PumpClientServerUpdate( time, NULL, 0, servers, 1 );
     }
+    check( !server.IsClientConnected( MaxClients - 1 ) );
+
+    server.Stop();
 }
 
-void test_connection_unreliable_unordered_messages()
+void test_client_server_loopback_simulator()
 {
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
     double time = 100.0;
 
-    ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = 1;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
-
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    ClientServerConfig config;
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
 
-    const int NumIterations = 256;
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
 
-    const int NumMessagesSent = 16;
+    server.Start( MaxClients );
 
-    for ( int j = 0; j < NumMessagesSent; ++j )
-    {
-        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-        check( message );
-        message->sequence = j;
-        sender.SendMessage( 0, message );
-    }
+    // loopback packets go through the simulator, so latency is in virtual time and nothing sleeps
 
-    int numMessagesReceived = 0;
+    client.SetLatency( 1000.0f );
+    server.SetLatency( 1000.0f );
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    check( client.ConnectLoopback( server ) );
 
-    for ( int i = 0; i < NumIterations; ++i )
-    {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+    const int clientIndex = client.GetClientIndex();
 
-        while ( true )
-        {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
+    SendClientToServerMessages( client, 1 );
 
-            check( message->GetType() == TEST_MESSAGE );
+    const double sendTime = time;
 
-            TestMessage * testMessage = (TestMessage*) message;
+    int numMessagesReceivedFromClient = 0;
 
-            check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+    for ( int i = 0; i < 100; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
 
-            ++numMessagesReceived;
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-            messageFactory.ReleaseMessage( message );
-        }
+        ProcessClientToServerMessages( server, clientIndex, numMessagesReceivedFromClient );
 
-        if ( numMessagesReceived == NumMessagesSent )
+        if ( numMessagesReceivedFromClient == 1 )
             break;
+
+        check( time - sendTime < 1.0 + 0.5 );
     }
 
-    check( numMessagesReceived == NumMessagesSent );
+    check( numMessagesReceivedFromClient == 1 );
+    check( time - sendTime >= 1.0 );
+    check( client.IsConnected() );
+
+    client.Disconnect();
+
+    server.Stop();
 }
 
-void test_connection_unreliable_unordered_blocks()
+void test_client_server_ingress_budget()
 {
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
-
-    double time = 100.0;
-    
-    ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = 1;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    const uint64_t clientId = 1;
 
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    double time = 100.0;
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    ClientServerConfig config;
+    config.serverClientPacketRate = 10.0f;
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-    const int NumIterations = 256;
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
 
-    const int NumMessagesSent = 8;
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
 
-    for ( int j = 0; j < NumMessagesSent; ++j )
-    {
-        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-        check( message );
-        message->sequence = j;
-        const int blockSize = 1 + ( j * 7 );
-        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-        for ( int k = 0; k < blockSize; ++k )
-            blockData[k] = j + k;
-        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-        sender.SendMessage( 0, message );
-    }
+    server.Start( MaxClients );
 
-    int numMessagesReceived = 0;
+    client.InsecureConnect( privateKey, clientId, serverAddress );
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+    Client * clients[] = { &client };
+    Server * servers[] = { &server };
 
-    for ( int i = 0; i < NumIterations; ++i )
+    for ( int i = 0; i < 10000; ++i )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-        while ( true )
-        {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
+        if ( client.ConnectionFailed() )
+            break;
 
-            check( message->GetType() == TEST_BLOCK_MESSAGE );
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+            break;
+    }
 
-            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+    check( client.IsConnected() );
 
-            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+    const int clientIndex = client.GetClientIndex();
 
-            const int blockSize = blockMessage->GetBlockSize();
+    uint64_t numPacketsDropped = 0;
+    uint64_t numBytesDropped = 0;
 
-            check( blockSize == 1 + ( numMessagesReceived * 7 ) );
+    // a client sending 1000 packets a second against a budget of 10 has most of them dropped, and stays connected
 
-            const uint8_t * blockData = blockMessage->GetBlockData();
+    for ( int i = 0; i < 1000; ++i )
+        PumpClientServerUpdate( time, clients, 1, servers, 1, 0.001f );
 
-            check( blockData );
+    check( client.IsConnected() );
+    check( server.IsClientConnected( clientIndex ) );
 
-            for ( int j = 0; j < blockSize; ++j )
-            {
-                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
-            }
+    server.GetClientIngressStats( clientIndex, numPacketsDropped, numBytesDropped );
 
-            ++numMessagesReceived;
+    check( numPacketsDropped > 900 );
+    check( numBytesDropped > 0 );
 
-            messageFactory.ReleaseMessage( message );
-        }
+    ConnectionStats stats;
+    server.GetConnectionStats( clientIndex, stats );
+    check( stats.numPacketsReceived < 100 );
 
-        if ( numMessagesReceived == NumMessagesSent )
-            break;
-    }
+    ServerMetrics metrics;
+    CollectServerMetrics( server, time, metrics );
+    check( metrics.numIngressPacketsDropped == numPacketsDropped );
 
-    check( numMessagesReceived == NumMessagesSent );
+    client.Disconnect();
+
+    server.Stop();
 }
 
-void PumpClientServerUpdate( double & time, Client ** client, int numClients, Server ** server, int numServers, float deltaTime = 0.1f )
+class TickOverrunTestAdapter : public TestAdapter
 {
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->SendPackets();
+public:
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->SendPackets();
+    void OnTickPhaseOverrun( const TickOverrunReport & report )
+    {
+        numReports++;
+        lastReport = report;
+    }
 
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->ReceivePackets();
+    int numReports;
+    TickOverrunReport lastReport;
+};
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->ReceivePackets();
+void test_client_server_tick_overrun()
+{
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
-    time += deltaTime;
+    double time = 100.0;
 
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->AdvanceTime( time );
+    ClientServerConfig config;
+    config.channel[0].sendQueueSize = 32;
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->AdvanceTime( time );
+    TickOverrunTestAdapter overrunAdapter;
+    overrunAdapter.numReports = 0;
 
-    yojimbo_sleep( 0.0f );
-}
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-void SendClientToServerMessages( Client & client, int numMessagesToSend, int channelIndex = 0 )
-{
-    for ( int i = 0; i < numMessagesToSend; ++i )
-    {
-        if ( !client.CanSendMessage( channelIndex ) )
-            break;
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
 
-        if ( rand() % 10 )
-        {
-            TestMessage * message = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            client.SendMessage( channelIndex, message );
-        }
-        else
-        {
-            TestBlockMessage * message = (TestBlockMessage*) client.CreateMessage( TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
-            uint8_t * blockData = client.AllocateBlock( blockSize );
-            check( blockData );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            client.AttachBlockToMessage( message, blockData, blockSize );
-            client.SendMessage( channelIndex, message );
-        }
-    }
-}
+    // within budget, nothing is reported
 
-void SendServerToClientMessages( Server & server, int clientIndex, int numMessagesToSend, int channelIndex = 0 )
-{
-    for ( int i = 0; i < numMessagesToSend; ++i )
     {
-        if ( !server.CanSendMessage( clientIndex, channelIndex ) )
-            break;
-
-        if ( rand() % 10 )
-        {
-            TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            server.SendMessage( clientIndex, channelIndex, message );
-        }
-        else
-        {
-            TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( clientIndex, TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
-            uint8_t * blockData = server.AllocateBlock( clientIndex, blockSize );
-            check( blockData );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            server.AttachBlockToMessage( clientIndex, message, blockData, blockSize );
-            server.SendMessage( clientIndex, channelIndex, message );
-        }
-    }
-}
+        Server server( GetDefaultAllocator(), privateKey, serverAddress, config, overrunAdapter, time );
 
-void ProcessServerToClientMessages( Client & client, int & numMessagesReceivedFromServer )
-{
-    while ( true )
-    {
-        Message * message = client.ReceiveMessage( 0 );
+        server.Start( MaxClients );
 
-        if ( !message )
-            break;
+        check( client.ConnectLoopback( server ) );
 
-        check( message->GetId() == (int) numMessagesReceivedFromServer );
-        
-        switch ( message->GetType() )
-        {
-            case TEST_MESSAGE:
-            {
-                TestMessage * testMessage = (TestMessage*) message;
-                check( !message->IsBlockMessage() );
-                check( testMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
-                ++numMessagesReceivedFromServer;
-            }
-            break;
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
 
-            case TEST_BLOCK_MESSAGE:
-            {
-                check( message->IsBlockMessage() );
-                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
-                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
-                const int blockSize = blockMessage->GetBlockSize();
-                check( blockSize == 1 + ( ( numMessagesReceivedFromServer * 901 ) % 1001 ) );
-                const uint8_t * blockData = blockMessage->GetBlockData();
-                check( blockData );
-                for ( int j = 0; j < blockSize; ++j )
-                {
-                    check( blockData[j] == uint8_t( numMessagesReceivedFromServer + j ) );
-                }
-                ++numMessagesReceivedFromServer;
-            }
-            break;
-        }
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-        client.ReleaseMessage( message );
+        check( overrunAdapter.numReports == 0 );
+
+        client.Disconnect();
+
+        server.Stop();
     }
-}
 
-void ProcessClientToServerMessages( Server & server, int clientIndex, int & numMessagesReceivedFromClient )
-{
-    while ( true )
+    // every phase runs over a budget this small. the report names the client with the most messages queued
+
+    config.serverTickPhaseBudget = 1.0e-9f;
+
     {
-        Message * message = server.ReceiveMessage( clientIndex, 0 );
+        Server server( GetDefaultAllocator(), privateKey, serverAddress, config, overrunAdapter, time );
 
-        if ( !message )
-            break;
+        server.Start( MaxClients );
 
-        check( message->GetId() == (int) numMessagesReceivedFromClient );
+        check( client.ConnectLoopback( server ) );
 
-        switch ( message->GetType() )
-        {
-            case TEST_MESSAGE:
-            {
-                check( !message->IsBlockMessage() );
-                TestMessage * testMessage = (TestMessage*) message;
-                check( testMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
-                ++numMessagesReceivedFromClient;
-            }
-            break;
+        SendServerToClientMessages( server, client.GetClientIndex(), 10 );
 
-            case TEST_BLOCK_MESSAGE:
-            {
-                check( message->IsBlockMessage() );
-                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
-                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
-                const int blockSize = blockMessage->GetBlockSize();
-                check( blockSize == 1 + ( ( numMessagesReceivedFromClient * 901 ) % 1001 ) );
-                const uint8_t * blockData = blockMessage->GetBlockData();
-                check( blockData );
-                for ( int j = 0; j < blockSize; ++j )
-                {
-                    check( blockData[j] == uint8_t( numMessagesReceivedFromClient + j ) );
-                }
-                ++numMessagesReceivedFromClient;
-            }
-            break;
-        }
+        server.ReceivePackets();
 
-        server.ReleaseMessage( clientIndex, message );
+        check( overrunAdapter.numReports == 1 );
+        check( overrunAdapter.lastReport.phase == SERVER_TICK_PHASE_RECEIVE_PACKETS );
+        check( overrunAdapter.lastReport.phaseTime > overrunAdapter.lastReport.budget );
+        check( overrunAdapter.lastReport.numConnectedClients == 1 );
+        check( overrunAdapter.lastReport.clientIndex == client.GetClientIndex() );
+        check( overrunAdapter.lastReport.sendQueueDepth == 10 );
+        check( overrunAdapter.lastReport.totalSendQueueDepth == 10 );
+
+        time += 0.1;
+        server.AdvanceTime( time );
+        check( overrunAdapter.numReports == 2 );
+        check( overrunAdapter.lastReport.phase == SERVER_TICK_PHASE_ADVANCE_TIME );
+
+        server.SendPackets();
+        check( overrunAdapter.numReports == 3 );
+        check( overrunAdapter.lastReport.phase == SERVER_TICK_PHASE_SEND_PACKETS );
+
+        client.Disconnect();
+
+        server.Stop();
     }
 }
 
-void test_client_server_messages()
+struct SubmitMessagesJobData
 {
-    const uint64_t clientId = 1;
+    Server * server;
+    int clientIndex;
+    int firstSequence;
+    int numMessages;
+    int numSubmitted;
+};
+
+static void submit_messages_job( void * context )
+{
+    SubmitMessagesJobData * data = (SubmitMessagesJobData*) context;
+    data->numSubmitted = 0;
+    for ( int i = 0; i < data->numMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) data->server->CreateMessageConcurrent( data->clientIndex, TEST_MESSAGE );
+        if ( !message )
+            continue;
+        message->sequence = uint16_t( data->firstSequence + i );
+        if ( data->server->SubmitMessage( data->clientIndex, 0, message ) )
+            data->numSubmitted++;
+    }
+}
 
+void test_client_server_submit_messages()
+{
     Address clientAddress( "0.0.0.0", ClientPort );
     Address serverAddress( "127.0.0.1", ServerPort );
 
     double time = 100.0;
-    
+
+    const int NumJobs = 4;
+    const int NumMessagesPerJob = 8;
+    const int NumMessages = NumJobs * NumMessagesPerJob;
+
     ClientServerConfig config;
-    config.channel[0].sendQueueSize = 32;
-    config.channel[0].maxMessagesPerPacket = 8;
-    config.channel[0].maxBlockSize = 1024;
-    config.channel[0].fragmentSize = 200;
+    config.channel[0].sendQueueSize = 64;
+    config.channel[0].receiveQueueSize = 64;
+    config.serverSubmitQueueSize = NumMessages;
 
     Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
@@ -1598,93 +10615,212 @@ void test_client_server_messages()
 
     server.Start( MaxClients );
 
-    client.SetLatency( 250 );
-    client.SetJitter( 100 );
-    client.SetPacketLoss( 25 );
-    client.SetDuplicates( 25 );
+    check( client.ConnectLoopback( server ) );
 
-    server.SetLatency( 250 );
-    server.SetJitter( 100 );
-    server.SetPacketLoss( 25 );
-    server.SetDuplicates( 25 );
+    const int clientIndex = client.GetClientIndex();
 
-    for ( int iteration = 0; iteration < 2; ++iteration )
+    // jobs submit to the same client at once, taking turns on its lock
+
+    SubmitMessagesJobData jobData[NumJobs];
+    yojimbo_thread_t * threads[NumJobs];
+
+    for ( int i = 0; i < NumJobs; ++i )
     {
-        client.InsecureConnect( privateKey, clientId, serverAddress );
+        jobData[i].server = &server;
+        jobData[i].clientIndex = clientIndex;
+        jobData[i].firstSequence = i * NumMessagesPerJob;
+        jobData[i].numMessages = NumMessagesPerJob;
+        jobData[i].numSubmitted = 0;
+        threads[i] = yojimbo_thread_create( submit_messages_job, &jobData[i] );
+        check( threads[i] );
+    }
 
-        const int NumIterations = 10000;
+    for ( int i = 0; i < NumJobs; ++i )
+    {
+        yojimbo_thread_join( threads[i] );
+        check( jobData[i].numSubmitted == NumMessagesPerJob );
+    }
 
-        for ( int i = 0; i < NumIterations; ++i )
-        {
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
-            
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    // the queue is full, so one more message is released instead of queued
 
-            if ( client.ConnectionFailed() )
-                break;
+    Message * extraMessage = server.CreateMessageConcurrent( clientIndex, TEST_MESSAGE );
+    check( extraMessage );
+    check( !server.SubmitMessage( clientIndex, 0, extraMessage ) );
 
-            if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+    bool received[NumMessages];
+    memset( received, 0, sizeof( received ) );
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < 10000 && numMessagesReceived < NumMessages; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        while ( true )
+        {
+            Message * message = client.ReceiveMessage( 0 );
+            if ( !message )
                 break;
+            check( message->GetType() == TEST_MESSAGE );
+            const int sequence = ( (TestMessage*) message )->sequence;
+            check( sequence >= 0 && sequence < NumMessages );
+            check( !received[sequence] );
+            received[sequence] = true;
+            numMessagesReceived++;
+            client.ReleaseMessage( message );
         }
+    }
 
-        check( !client.IsConnecting() );
-        check( client.IsConnected() );
-        check( server.GetNumConnectedClients() == 1 );
-        check( client.GetClientIndex() == 0 );
-        check( server.IsClientConnected(0) );
+    check( numMessagesReceived == NumMessages );
 
-        const int NumMessagesSent = config.channel[0].sendQueueSize;
+    // messages submitted for a client that disconnects are released with the slot
 
-        SendClientToServerMessages( client, NumMessagesSent );
+    Message * message = server.CreateMessageConcurrent( clientIndex, TEST_MESSAGE );
+    check( message );
+    check( server.SubmitMessage( clientIndex, 0, message ) );
 
-        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+    client.Disconnect();
 
-        int numMessagesReceivedFromClient = 0;
-        int numMessagesReceivedFromServer = 0;
+    server.Stop();
+}
 
-        for ( int i = 0; i < NumIterations; ++i )
-        {
-            if ( !client.IsConnected() )
-                break;
+void test_client_server_reuse_connection()
+{
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
 
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
+    double time = 100.0;
 
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    ClientServerConfig config;
+    config.clientReuseConnection = true;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
 
-            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
 
-            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
 
-            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
-                break;
-        }
+    server.Start( MaxClients );
 
-        check( client.IsConnected() );
-        check( server.IsClientConnected( client.GetClientIndex() ) );
-        check( numMessagesReceivedFromClient == NumMessagesSent );
-        check( numMessagesReceivedFromServer == NumMessagesSent );
+    const size_t bytesBeforeClient = GetDefaultAllocator().GetBytesAllocated();
 
-        client.Disconnect();
+    {
+        Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-        for ( int i = 0; i < NumIterations; ++i )
+        size_t bytesDisconnected = 0;
+
+        for ( int iteration = 0; iteration < 3; ++iteration )
         {
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
+            check( client.ConnectLoopback( server ) );
+            check( client.IsConnected() );
 
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+            // reconnecting takes nothing more from the parent allocator
 
-            if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
-                break;
-        }
+            if ( iteration > 0 )
+                check( GetDefaultAllocator().GetBytesAllocated() == bytesDisconnected );
 
-        check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+            const int NumMessagesSent = config.channel[0].sendQueueSize;
+
+            SendClientToServerMessages( client, NumMessagesSent );
+
+            SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+
+            int numMessagesReceivedFromClient = 0;
+            int numMessagesReceivedFromServer = 0;
+
+            for ( int i = 0; i < 10000; ++i )
+            {
+                if ( !client.IsConnected() )
+                    break;
+
+                Client * clients[] = { &client };
+                Server * servers[] = { &server };
+
+                PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+                ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+                ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+
+                if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+                    break;
+            }
+
+            check( client.IsConnected() );
+            check( numMessagesReceivedFromClient == NumMessagesSent );
+            check( numMessagesReceivedFromServer == NumMessagesSent );
+
+            client.Disconnect();
+
+            check( client.IsDisconnected() );
+
+            // the client memory is kept while disconnected
+
+            check( GetDefaultAllocator().GetBytesAllocated() >= bytesBeforeClient + size_t( config.clientMemory ) );
+
+            bytesDisconnected = GetDefaultAllocator().GetBytesAllocated();
+        }
     }
 
+    // and freed with the client
+
+    check( GetDefaultAllocator().GetBytesAllocated() == bytesBeforeClient );
+
     server.Stop();
 }
 
+void test_client_pool()
+{
+    const int NumClients = 16;
+    const int PoolMemory = 16 * 1024 * 1024;
+
+    Address clientAddress( "0.0.0.0", 0 );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.clientSharedMemory = true;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    for ( int parallel = 0; parallel < 2; ++parallel )
+    {
+        ClientPool pool( GetDefaultAllocator(), clientAddress, config, adapter, NumClients, time, PoolMemory, parallel != 0 );
+
+        check( pool.GetNumClients() == NumClients );
+        check( pool.GetNumConnectedClients() == 0 );
+
+        // there is no server, so nobody connects, but each client allocates from the pool as it starts connecting
+
+        pool.InsecureConnect( privateKey, 1, &serverAddress, 1 );
+
+        for ( int i = 0; i < 10; ++i )
+        {
+            pool.SendPackets();
+            pool.ReceivePackets();
+            time += 0.1;
+            pool.AdvanceTime( time );
+        }
+
+        check( pool.GetNumConnectedClients() == 0 );
+
+        pool.Disconnect();
+
+        // with shared client memory, clients only take what they use from the pool, instead of clientMemory each
+
+        AllocatorStats stats;
+        pool.GetAllocatorStats( stats );
+        check( stats.bytesAllocated == 0 );
+        check( stats.peakBytesAllocated > 0 );
+        check( stats.peakBytesAllocated < size_t( config.clientMemory ) * NumClients );
+    }
+}
+
 void CreateClients( int numClients, Client ** clients, const Address & address, const ClientServerConfig & config, Adapter & _adapter, double time )
 {
     for ( int i = 0; i < numClients; ++i )
@@ -1849,6 +10985,100 @@ void test_client_server_start_stop_restart()
     }
 }
 
+void test_client_server_warm_restart()
+{
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+
+    ClientServerConfig config;
+    config.serverWarmRestart = true;
+    config.serverPerClientMemory = 2 * 1024 * 1024;
+    config.channel[0].sendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    const size_t bytesBeforeServer = GetDefaultAllocator().GetBytesAllocated();
+
+    {
+        Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+        int numClients[] = { 4, 2, 3, 4 };
+
+        const int NumIterations = sizeof( numClients ) / sizeof( int );
+
+        size_t bytesStopped = 0;
+
+        for ( int iteration = 0; iteration < NumIterations; ++iteration )
+        {
+            server.Start( numClients[iteration] );
+
+            {
+                Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+                check( client.ConnectLoopback( server ) );
+                check( client.IsConnected() );
+
+                const int NumMessagesSent = config.channel[0].sendQueueSize;
+
+                SendClientToServerMessages( client, NumMessagesSent );
+
+                SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+
+                int numMessagesReceivedFromClient = 0;
+                int numMessagesReceivedFromServer = 0;
+
+                for ( int i = 0; i < 10000; ++i )
+                {
+                    if ( !client.IsConnected() )
+                        break;
+
+                    Client * clients[] = { &client };
+                    Server * servers[] = { &server };
+
+                    PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+                    ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+                    ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+
+                    if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+                        break;
+                }
+
+                check( client.IsConnected() );
+                check( numMessagesReceivedFromClient == NumMessagesSent );
+                check( numMessagesReceivedFromServer == NumMessagesSent );
+
+                client.Disconnect();
+            }
+
+            server.Stop();
+
+            // the slots up to the high-water mark are kept, and restarts with fewer clients allocate nothing new
+
+            check( server.GetNumWarmClientSlots() == 4 );
+
+            if ( iteration > 0 )
+                check( GetDefaultAllocator().GetBytesAllocated() == bytesStopped );
+
+            bytesStopped = GetDefaultAllocator().GetBytesAllocated();
+
+            check( bytesStopped >= bytesBeforeServer + 4 * size_t( config.serverPerClientMemory ) );
+        }
+
+        server.ReleaseWarmClientSlots();
+
+        check( server.GetNumWarmClientSlots() == 0 );
+        check( GetDefaultAllocator().GetBytesAllocated() == bytesBeforeServer );
+    }
+
+    check( GetDefaultAllocator().GetBytesAllocated() == bytesBeforeServer );
+}
+
 void test_client_server_message_failed_to_serialize_reliable_ordered()
 {
     const uint64_t clientId = 1;
@@ -2207,23 +11437,142 @@ int main()
 
         RUN_TEST( test_endian );
         RUN_TEST( test_queue );
+        RUN_TEST( test_spsc_queue );
         RUN_TEST( test_base64 );
+        RUN_TEST( test_hash );
+        RUN_TEST( test_lz4 );
         RUN_TEST( test_bitpacker );
+        RUN_TEST( test_bitpacker_wire_format );
         RUN_TEST( test_stream );
+        RUN_TEST( test_stream_rollback );
+        RUN_TEST( test_stream_unchecked );
+        RUN_TEST( test_serialize_relative_bits );
+        RUN_TEST( test_serialize_arrays );
+        RUN_TEST( test_serialize_bytes_view );
+        RUN_TEST( test_serialize_varint );
+        RUN_TEST( test_serialize_compressed );
         RUN_TEST( test_address );
+        RUN_TEST( test_socket );
+        RUN_TEST( test_relay );
+        RUN_TEST( test_prober );
+        RUN_TEST( test_packet_recorder );
         RUN_TEST( test_bit_array );
+        RUN_TEST( test_bit_array_find );
         RUN_TEST( test_sequence_buffer );
+        RUN_TEST( test_sequence_buffer_wrap );
         RUN_TEST( test_allocator_tlsf );
+        RUN_TEST( test_allocator_tlsf_slabs );
+        RUN_TEST( test_allocator_quota );
+        RUN_TEST( test_allocator_frame );
+        RUN_TEST( test_allocator_buffer_pool );
+        RUN_TEST( test_allocator_steady_state );
+        RUN_TEST( test_allocator_stats );
+        RUN_TEST( test_allocator_page_memory );
+        RUN_TEST( test_allocator_thread_safe );
+        RUN_TEST( test_thread_pool );
+        RUN_TEST( test_random );
+        RUN_TEST( test_sleep_until );
+        RUN_TEST( test_time_cached );
+        RUN_TEST( test_log_async );
+        RUN_TEST( test_profile );
+        RUN_TEST( test_network_simulator );
+        RUN_TEST( test_network_simulator_link_conditions );
+        RUN_TEST( test_network_simulator_trace );
+        RUN_TEST( test_shared_memory_link );
+#if YOJIMBO_DEBUG_MEMORY_LEAKS
+        RUN_TEST( test_pointer_hash_map );
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
+
+        RUN_TEST( test_message_max_bits );
+        RUN_TEST( test_schema_message );
+        RUN_TEST( test_message_factory_serialize );
+        RUN_TEST( test_message_factory_pooling );
 
         RUN_TEST( test_connection_reliable_ordered_messages );
+        RUN_TEST( test_connection_common_message_types );
+        RUN_TEST( test_connection_reliable_unordered_messages );
         RUN_TEST( test_connection_reliable_ordered_blocks );
+        RUN_TEST( test_connection_reliable_ordered_blocks_heavy_loss );
+        RUN_TEST( test_connection_reliable_ordered_shared_blocks );
+        RUN_TEST( test_connection_reliable_ordered_large_blocks );
+        RUN_TEST( test_connection_reliable_ordered_mapped_blocks );
+        RUN_TEST( test_connection_reliable_ordered_resume_blocks );
+        RUN_TEST( test_connection_reliable_ordered_compressed_blocks );
+        RUN_TEST( test_connection_reliable_ordered_blocks_in_flight );
+        RUN_TEST( test_connection_reliable_ordered_block_fragments_per_packet );
+        RUN_TEST( test_connection_reliable_ordered_block_prefix );
         RUN_TEST( test_connection_reliable_ordered_messages_and_blocks );
         RUN_TEST( test_connection_reliable_ordered_messages_and_blocks_multiple_channels );
+        RUN_TEST( test_connection_compact_packet_header );
+        RUN_TEST( test_connection_negotiate_serialize_checks );
         RUN_TEST( test_connection_unreliable_unordered_messages );
         RUN_TEST( test_connection_unreliable_unordered_blocks );
+        RUN_TEST( test_connection_unreliable_unordered_defer );
+        RUN_TEST( test_connection_unreliable_priority_accumulator );
+        RUN_TEST( test_connection_latency_histograms );
+        RUN_TEST( test_connection_steady_state );
+        RUN_TEST( test_server_metrics );
+        RUN_TEST( test_connection_packet_telemetry );
+        RUN_TEST( test_connection_coalesce );
+        RUN_TEST( test_connection_path_packet_bytes );
+        RUN_TEST( test_connection_urgent_data );
+        RUN_TEST( test_connection_drop_duplicate_packets );
+        RUN_TEST( test_connection_high_bandwidth_delay );
+        RUN_TEST( test_connection_extended_acks );
+        RUN_TEST( test_connection_lazy_block_buffers );
+        RUN_TEST( test_connection_memory_footprint );
+        RUN_TEST( test_server_environment );
+        RUN_TEST( test_connection_unreliable_sequenced );
+        RUN_TEST( test_connection_unreliable_redundant_messages );
+        RUN_TEST( test_connection_unreliable_jitter_buffer );
+        RUN_TEST( test_connection_batch_messages );
+        RUN_TEST( test_connection_serialized_messages );
+        RUN_TEST( test_connection_reliable_ordered_serialize_once );
+        RUN_TEST( test_connection_string_table );
+        RUN_TEST( test_connection_snapshot );
+        RUN_TEST( test_connection_channel_weights );
+        RUN_TEST( test_connection_bandwidth_limit );
+        RUN_TEST( test_connection_adaptive_bandwidth );
+        RUN_TEST( test_connection_scavenger );
+        RUN_TEST( test_connection_overload_controls );
+        RUN_TEST( test_connection_adaptive_resend_time );
+        RUN_TEST( test_connection_fast_resend );
+        RUN_TEST( test_connection_fragment_parity );
+        RUN_TEST( test_connection_supersede_messages );
+        RUN_TEST( test_connection_skip_received_messages );
+        RUN_TEST( test_connection_lazy_decode );
+        RUN_TEST( test_connection_message_time_to_live );
+        RUN_TEST( test_connection_flow_control );
+        RUN_TEST( test_connection_runtime_limits );
+        RUN_TEST( test_connection_auto_tune );
+        RUN_TEST( test_connection_memory_watermark );
+        RUN_TEST( test_connection_channels_with_messages );
+        RUN_TEST( test_connection_send_receive_messages );
+        RUN_TEST( test_connection_suppress_idle_packets );
+        RUN_TEST( test_connection_next_send_time );
+        RUN_TEST( test_connection_channel_errors );
+        RUN_TEST( test_connection_stats );
 
         RUN_TEST( test_client_server_messages );
+        RUN_TEST( test_client_server_trusted );
+        RUN_TEST( test_client_server_trusted_connect_flood );
+        RUN_TEST( test_client_server_trusted_multipath );
+        RUN_TEST( test_client_server_trusted_path_mtu );
+        RUN_TEST( test_client_server_trusted_resume );
+        RUN_TEST( test_client_server_trusted_groups );
+        RUN_TEST( test_client_server_trusted_admission );
+        RUN_TEST( test_client_server_connect_race );
+        RUN_TEST( test_client_server_spectators );
+        RUN_TEST( test_client_server_loopback );
+        RUN_TEST( test_client_server_shared_memory );
+        RUN_TEST( test_client_server_loopback_simulator );
+        RUN_TEST( test_client_server_ingress_budget );
+        RUN_TEST( test_client_server_tick_overrun );
+        RUN_TEST( test_client_server_submit_messages );
+        RUN_TEST( test_client_server_reuse_connection );
+        RUN_TEST( test_client_pool );
         RUN_TEST( test_client_server_start_stop_restart );
+        RUN_TEST( test_client_server_warm_restart );
         RUN_TEST( test_client_server_message_failed_to_serialize_reliable_ordered );
         RUN_TEST( test_client_server_message_failed_to_serialize_unreliable_unordered );
         RUN_TEST( test_client_server_message_exhaust_stream_allocator );
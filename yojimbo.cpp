@@ -13,19 +13,24 @@
 
 #include <sodium.h>
 
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-#include <map>
-#endif // YOJIMBO_DEBUG_MEMORY_LEAKS
-
 static yojimbo::Allocator * g_defaultAllocator = NULL;
 
+static YOJIMBO_THREAD_LOCAL yojimbo::Allocator * g_threadDefaultAllocator = NULL;
+
 namespace yojimbo
 {
     Allocator & GetDefaultAllocator()
     {
+        if ( g_threadDefaultAllocator )
+            return *g_threadDefaultAllocator;
         yojimbo_assert( g_defaultAllocator );
         return *g_defaultAllocator;
     }
+
+    void SetThreadDefaultAllocator( Allocator * allocator )
+    {
+        g_threadDefaultAllocator = allocator;
+    }
 }
 
 extern "C" int netcode_init();
@@ -40,6 +45,9 @@ bool InitializeYojimbo()
 {
     g_defaultAllocator = new yojimbo::DefaultAllocator();
 
+    // start the clock, and calibrate the time stamp counter if enabled, before any other thread reads the time
+    yojimbo_time();
+
     if ( netcode_init() != NETCODE_OK )
         return false;
 
@@ -14,9 +14,22 @@
 #include "yojimbo_platform.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_client.h"
+#include "yojimbo_client_pool.h"
 #include "yojimbo_server.h"
 #include "yojimbo_message.h"
+#include "yojimbo_schema.h"
 #include "yojimbo_connection.h"
+#include "yojimbo_string_table.h"
+#include "yojimbo_simulator.h"
+#include "yojimbo_socket.h"
+#include "yojimbo_shared_memory.h"
+#include "yojimbo_relay.h"
+#include "yojimbo_probe.h"
+#include "yojimbo_recorder.h"
+#include "yojimbo_thread_pool.h"
+#include "yojimbo_histogram.h"
+#include "yojimbo_metrics.h"
+#include "yojimbo_footprint.h"
 
 /** @file */
 
@@ -16,6 +16,37 @@
 
 namespace yojimbo
 {
+    /**
+        Function called for each index by Adapter::ParallelFor.
+
+        @param context The context pointer passed in to Adapter::ParallelFor.
+        @param index The index of the work item in [0,count-1].
+     */
+
+    typedef void (*ParallelForFunction)( void * context, int index );
+
+    /**
+        What the server was doing when a tick phase ran over BaseClientServerConfig::serverTickPhaseBudget. See Adapter::OnTickPhaseOverrun.
+
+        The busiest client is the one with the most messages queued, summed over its send and receive queues. It is picked when the report is made, so it costs nothing while the server stays within budget.
+     */
+
+    struct TickOverrunReport
+    {
+        int phase;                                                  ///< The phase that ran over. See ServerTickPhase.
+        double phaseTime;                                           ///< How long the phase took (seconds).
+        double budget;                                              ///< The budget it ran over (seconds).
+        double time;                                                ///< The server time.
+        int numConnectedClients;                                    ///< Number of connected clients.
+        int totalSendQueueDepth;                                    ///< Messages queued for sending, summed over connected clients.
+        int totalReceiveQueueDepth;                                 ///< Messages waiting to be received, summed over connected clients.
+        int clientIndex;                                            ///< The busiest client slot, or -1 if no client is connected.
+        int sendQueueDepth;                                         ///< Messages queued for sending to the busiest client, summed over its channels.
+        int receiveQueueDepth;                                      ///< Messages from the busiest client waiting to be received, summed over its channels.
+        uint64_t numMessagesSent;                                   ///< Messages sent to the busiest client since it connected.
+        uint64_t numMessagesReceived;                               ///< Messages received from the busiest client since it connected.
+    };
+
     /** 
         Adapter class
      */
@@ -31,12 +62,111 @@ namespace yojimbo
             return YOJIMBO_NEW( allocator, TLSF_Allocator, memory, bytes );
         }
 
+        /**
+            Get the NUMA node to place server allocator memory on.
+
+            Only called when BaseClientServerConfig::serverPageMemory is true. Override this to keep each client's memory on the node of the thread that services that client.
+
+            @param clientIndex The client slot the memory is for, or -1 for the server global and shared allocators.
+
+            @returns The NUMA node, or -1 for the default placement.
+         */
+
+        virtual int GetServerMemoryNumaNode( int clientIndex )
+        {
+            (void) clientIndex;
+            return -1;
+        }
+
+        /**
+            Called when a connection goes above ConnectionConfig::memoryWatermark, and again when it drops back below.
+
+            While memory is low, CanSendMessage returns false. Override this to shed load until the connection recovers, eg. skip cosmetic messages and hold back block messages.
+
+            @param clientIndex The client slot on the server, or -1 on the client.
+            @param memoryLow True if the connection went low on memory, false if it recovered.
+         */
+
+        virtual void OnConnectionMemoryLow( int clientIndex, bool memoryLow )
+        {
+            (void) clientIndex;
+            (void) memoryLow;
+        }
+
+        /**
+            Decide whether to let a new client connect to the server.
+
+            Called when a client connects, before its connection is created. Loopback clients are always let in. Override this for your own admission policy, eg. based on BaseServer::GetSharedClientMemoryFree or per-player reservations. A refused client is disconnected straight away.
+
+            @param clientIndex The client slot the client is connecting to.
+            @param admit The verdict of the built-in policy: false if BaseClientServerConfig::serverAdmissionMemoryHeadroom or serverAdmissionTickTime is exceeded.
+
+            @returns True to let the client connect.
+         */
+
+        virtual bool AdmitClient( int clientIndex, bool admit )
+        {
+            (void) clientIndex;
+            return admit;
+        }
+
+        /**
+            Decide whether a new client is a spectator.
+
+            Called when a client connects, after AdmitClient, before its connection is created. Spectator connections are built for clients that mostly receive broadcast messages: every channel queue is capped at BaseClientServerConfig::serverSpectatorQueueSize, block buffers are allocated lazily, and with shared client memory the slot is limited to serverSpectatorMemory instead of serverPerClientMemory. The channels themselves are unchanged, so spectators connect with the same config as players. Override this to pick out spectators, eg. from slots you reserved for them. Loopback clients are never spectators.
+
+            @param clientIndex The client slot the client is connecting to.
+
+            @returns True if the client is a spectator.
+         */
+
+        virtual bool IsSpectator( int clientIndex )
+        {
+            (void) clientIndex;
+            return false;
+        }
+
+        /**
+            Called when a phase of the server tick ran over BaseClientServerConfig::serverTickPhaseBudget, straight after the phase.
+
+            The overrun is logged as well. Override this to record reports, eg. to a ring buffer dumped with your crash reports. Keep it cheap: it runs on the tick that is already late.
+
+            @param report What the server was doing. See TickOverrunReport.
+         */
+
+        virtual void OnTickPhaseOverrun( const TickOverrunReport & report )
+        {
+            (void) report;
+        }
+
         virtual MessageFactory * CreateMessageFactory( Allocator & allocator )
         {
             (void) allocator;
             yojimbo_assert( false );
             return NULL;
         }
+
+        /**
+            Run a function over a range of independent work items, possibly in parallel.
+
+            The server calls this when BaseClientServerConfig::serverParallelSend or serverParallelReceive is true, with one work item per client.
+
+            The default implementation runs each work item in order on the calling thread. Override it to dispatch work items to your own job system, or to a ThreadPool. 
+            
+            IMPORTANT: This function must not return until every work item has completed.
+
+            @param count The number of work items.
+            @param function The function to call for each work item.
+            @param context Context pointer passed to the function.
+         */
+
+        virtual void ParallelFor( int count, ParallelForFunction function, void * context )
+        {
+            for ( int i = 0; i < count; ++i )
+            {
+                function( context, i );
+            }
+        }
     };
 }
 
@@ -43,6 +43,7 @@
 #include <string.h>
 
 #include "yojimbo_address.h"
+#include "yojimbo_utility.h"
 
 
 namespace yojimbo
@@ -215,6 +216,26 @@ namespace yojimbo
         return m_type;
     }
 
+    uint64_t Address::GetHash() const
+    {
+        uint8_t data[1+2+16];
+        data[0] = (uint8_t) m_type;
+        data[1] = (uint8_t) ( m_port & 0xFF );
+        data[2] = (uint8_t) ( m_port >> 8 );
+        int bytes = 3;
+        if ( m_type == ADDRESS_IPV4 )
+        {
+            memcpy( data + bytes, m_address.ipv4, 4 );
+            bytes += 4;
+        }
+        else if ( m_type == ADDRESS_IPV6 )
+        {
+            memcpy( data + bytes, m_address.ipv6, 16 );
+            bytes += 16;
+        }
+        return wyhash_64( data, bytes, 0 );
+    }
+
     const char * Address::ToString( char buffer[], int bufferSize ) const
     {
         yojimbo_assert( bufferSize >= MaxAddressLength );
@@ -310,7 +331,7 @@ namespace yojimbo
             return false;
         if ( m_port != other.m_port )
             return false;
-        if ( m_type == ADDRESS_IPV4 && m_address.ipv4 == other.m_address.ipv4 )
+        if ( m_type == ADDRESS_IPV4 && memcmp( m_address.ipv4, other.m_address.ipv4, sizeof( m_address.ipv4 ) ) == 0 )
             return true;
         else if ( m_type == ADDRESS_IPV6 && memcmp( m_address.ipv6, other.m_address.ipv6, sizeof( m_address.ipv6 ) ) == 0 )
             return true;
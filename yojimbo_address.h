@@ -226,6 +226,16 @@ namespace yojimbo
 
         const char * ToString( char buffer[], int bufferSize ) const;
 
+        /**
+            Hash the address, for looking up per-address state in a hash table.
+
+            Covers the address type, the address bytes and the port, so equal addresses hash to the same value. The hash is only stable within one process, so don't send it over the network.
+
+            @returns The hash of the address.
+         */
+
+        uint64_t GetHash() const;
+
         /**
             True if the address is valid.
 
@@ -8,6 +8,7 @@
 #include "yojimbo_allocator.h"
 #include "yojimbo_platform.h"
 #include <stdlib.h>
+#include <string.h>
 
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
 #include <stdio.h>
@@ -17,22 +18,109 @@
 
 namespace yojimbo
 {
+#if YOJIMBO_DEBUG_STEADY_STATE
+
+    static volatile int steady_state_armed = 0;                     // 1 while the steady state check is armed
+    static volatile int steady_state_assert = 0;                    // 1 to assert on the first allocation caught
+    static volatile int steady_state_num_allocations = 0;           // allocations caught since the check was armed
+    static volatile int steady_state_first_written = 0;             // 1 once the first allocation caught is in steady_state_first
+    static SteadyStateReport steady_state_first;                    // the first allocation caught. written once, by the thread that caught it
+
+    static YOJIMBO_THREAD_LOCAL const char * steady_state_scope = NULL;
+
+    const char * PushSteadyStateScope( const char * name )
+    {
+        const char * previous = steady_state_scope;
+        steady_state_scope = name;
+        return previous;
+    }
+
+    void PopSteadyStateScope( const char * previous )
+    {
+        steady_state_scope = previous;
+    }
+
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+
+    void ArmSteadyStateCheck( bool assertOnAllocation )
+    {
+#if YOJIMBO_DEBUG_STEADY_STATE
+        steady_state_num_allocations = 0;
+        steady_state_first_written = 0;
+        steady_state_first = SteadyStateReport();
+        steady_state_assert = assertOnAllocation ? 1 : 0;
+        yojimbo_memory_barrier();
+        steady_state_armed = 1;
+        yojimbo_memory_barrier();
+#else // #if YOJIMBO_DEBUG_STEADY_STATE
+        (void) assertOnAllocation;
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+    }
+
+    void DisarmSteadyStateCheck()
+    {
+#if YOJIMBO_DEBUG_STEADY_STATE
+        steady_state_armed = 0;
+        yojimbo_memory_barrier();
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+    }
+
+    void GetSteadyStateReport( SteadyStateReport & report )
+    {
+        report = SteadyStateReport();
+#if YOJIMBO_DEBUG_STEADY_STATE
+        yojimbo_memory_barrier();
+        if ( steady_state_first_written )
+            report = steady_state_first;
+        report.numAllocations = steady_state_num_allocations;
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+    }
+
+    void Allocator::CheckSteadyStateAllocation( size_t size, const char * file, int line )
+    {
+#if YOJIMBO_DEBUG_STEADY_STATE
+        if ( !steady_state_scope || !steady_state_armed || m_steadyStateExempt )
+            return;
+        if ( yojimbo_atomic_increment( &steady_state_num_allocations ) == 1 )
+        {
+            steady_state_first.scope = steady_state_scope;
+            steady_state_first.file = file;
+            steady_state_first.line = line;
+            steady_state_first.size = size;
+            yojimbo_memory_barrier();
+            steady_state_first_written = 1;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: allocated %d bytes in steady state, inside %s - %s:%d\n", (int) size, steady_state_scope, file, line );
+            yojimbo_assert( !steady_state_assert );
+        }
+#else // #if YOJIMBO_DEBUG_STEADY_STATE
+        (void) size;
+        (void) file;
+        (void) line;
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+    }
+
     Allocator::Allocator() 
     {
         m_errorLevel = ALLOCATOR_ERROR_NONE;
+        m_steadyStateExempt = false;
+        m_bytesAllocated = 0;
+        m_peakBytesAllocated = 0;
+        m_numAllocations = 0;
+        m_numFrees = 0;
     }
 
     Allocator::~Allocator()
     {
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
-        if ( m_alloc_map.size() )
+        if ( m_alloc_map.GetSize() )
         {
             printf( "you leaked memory!\n\n" );
-            typedef std::map<void*,AllocatorEntry>::iterator itor_type;
-            for ( itor_type i = m_alloc_map.begin(); i != m_alloc_map.end(); ++i )
+            for ( int i = 0; i < m_alloc_map.GetCapacity(); ++i )
             {
-                void * p = i->first;
-                AllocatorEntry entry = i->second;
+                const void * p = m_alloc_map.GetKeyAtIndex( i );
+                if ( !p )
+                    continue;
+                const AllocatorEntry & entry = m_alloc_map.GetValueAtIndex( i );
                 printf( "leaked block %p (%d bytes) - %s:%d\n", p, (int) entry.size, entry.file, entry.line );
             }
             printf( "\n" );
@@ -50,17 +138,33 @@ namespace yojimbo
         m_errorLevel = errorLevel;
     }
 
+    void Allocator::GetStats( AllocatorStats & stats ) const
+    {
+        stats.bytesAllocated = m_bytesAllocated;
+        stats.peakBytesAllocated = m_peakBytesAllocated;
+        stats.numAllocations = m_numAllocations;
+        stats.numFrees = m_numFrees;
+        stats.largestFreeBlock = 0;
+    }
+
     void Allocator::TrackAlloc( void * p, size_t size, const char * file, int line )
     {
+        m_bytesAllocated += size;
+        m_numAllocations++;
+        if ( m_bytesAllocated > m_peakBytesAllocated )
+            m_peakBytesAllocated = m_bytesAllocated;
+
+        CheckSteadyStateAllocation( size, file, line );
+
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
-        yojimbo_assert( m_alloc_map.find( p ) == m_alloc_map.end() );
+        yojimbo_assert( !m_alloc_map.Find( p ) );
 
         AllocatorEntry entry;
         entry.size = size;
         entry.file = file;
         entry.line = line;
-        m_alloc_map[p] = entry;
+        m_alloc_map.Insert( p, entry );
 
 #else // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
@@ -72,29 +176,42 @@ namespace yojimbo
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
     }
 
-    void Allocator::TrackFree( void * p, const char * file, int line )
+    void Allocator::TrackFree( void * p, size_t size, const char * file, int line )
     {
         (void) p;
         (void) file;
         (void) line;
+
+        yojimbo_assert( size <= m_bytesAllocated );
+        m_bytesAllocated -= size;
+        m_numFrees++;
+
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
-        yojimbo_assert( m_alloc_map.find( p ) != m_alloc_map.end() );
-        m_alloc_map.erase( p );
+        yojimbo_assert( !m_alloc_map.Find( p ) || m_alloc_map.Find( p )->size == size );
+        const bool found = m_alloc_map.Remove( p );
+        yojimbo_assert( found );
+        (void) found;
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
     }
 
     // =============================================
 
+    static const size_t DefaultHeaderBytes = 16;            // remembers the allocation size for the statistics. keeps allocations 16 byte aligned, like malloc.
+
     void * DefaultAllocator::Allocate( size_t size, const char * file, int line )
     {
-        void * p = malloc( size );
+        uint8_t * block = (uint8_t*) malloc( size + DefaultHeaderBytes );
 
-        if ( !p )
+        if ( !block )
         {
             SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
             return NULL;
         }
 
+        *( (size_t*) block ) = size;
+
+        void * p = block + DefaultHeaderBytes;
+
         TrackAlloc( p, size, file, line );
 
         return p;
@@ -105,9 +222,11 @@ namespace yojimbo
         if ( !p )
             return;
 
-        TrackFree( p, file, line );
+        uint8_t * block = ( (uint8_t*) p ) - DefaultHeaderBytes;
 
-        free( p );
+        TrackFree( p, *( (size_t*) block ), file, line );
+
+        free( block );
     }
 
     // =============================================
@@ -126,6 +245,35 @@ namespace yojimbo
         return (void*) ( p - ( p & ( align - 1 ) ) );
     }
 
+#if YOJIMBO_TLSF_SLABS
+
+    static const int SlabNumClasses = SlabMaxBytes / SlabClassBytes;
+    static const int SlabPageHeaderBytes = 48;              // keeps slab blocks SlabClassBytes aligned.
+
+    /// The header at the start of each slab page. The rest of the page is blocks of one size class.
+
+    struct TLSF_Allocator::SlabPage
+    {
+        SlabPage * prev;                                    ///< The previous page in the list of pages with a free block for this size class.
+        SlabPage * next;                                    ///< The next page in the list of pages with a free block for this size class.
+        void * freeList;                                    ///< Blocks freed back to the page. Each free block stores the pointer to the next one.
+        int sizeClass;                                      ///< The size class of the blocks in this page.
+        int numUsed;                                        ///< The number of blocks currently allocated from the page.
+        int numCarved;                                      ///< The number of blocks carved from the page so far. Blocks past this have never been used, so new pages don't need a free list built up-front.
+    };
+
+    static inline int SlabBlockBytes( int sizeClass )
+    {
+        return ( sizeClass + 1 ) * SlabClassBytes;
+    }
+
+    static inline int SlabBlocksPerPage( int sizeClass )
+    {
+        return ( SlabPageBytes - SlabPageHeaderBytes ) / SlabBlockBytes( sizeClass );
+    }
+
+#endif // #if YOJIMBO_TLSF_SLABS
+
     TLSF_Allocator::TLSF_Allocator( void * memory, size_t size ) 
     {
         yojimbo_assert( size > 0 );
@@ -142,15 +290,41 @@ namespace yojimbo
         size_t aligned_memory_size = aligned_memory_finish - aligned_memory_start;
 
         m_tlsf = tlsf_create_with_pool( aligned_memory_start, aligned_memory_size );
+
+#if YOJIMBO_TLSF_SLABS
+        yojimbo_assert( sizeof( SlabPage ) <= (size_t) SlabPageHeaderBytes );
+        memset( m_slabPages, 0, sizeof( m_slabPages ) );
+        memset( m_emptySlabPages, 0, sizeof( m_emptySlabPages ) );
+        m_slabPageBase = (uintptr_t) AlignPointerDown( aligned_memory_start, SlabPageBytes );
+        m_numSlabPageEntries = int( ( (uintptr_t) AlignPointerUp( aligned_memory_finish, SlabPageBytes ) - m_slabPageBase ) / SlabPageBytes );
+        m_slabPageTable = (uint8_t*) tlsf_malloc( m_tlsf, m_numSlabPageEntries );
+        if ( m_slabPageTable )
+            memset( m_slabPageTable, 0, m_numSlabPageEntries );
+#endif // #if YOJIMBO_TLSF_SLABS
     }
 
     TLSF_Allocator::~TLSF_Allocator()
     {
+        // the empty slab pages and the slab page table are left in the heap. the heap memory may already be gone by now
+
         tlsf_destroy( m_tlsf );
     }
 
     void * TLSF_Allocator::Allocate( size_t size, const char * file, int line )
     {
+#if YOJIMBO_TLSF_SLABS
+        if ( size <= (size_t) SlabMaxBytes && m_slabPageTable )
+        {
+            const int sizeClass = size > 0 ? int( ( size - 1 ) / SlabClassBytes ) : 0;
+            void * p = AllocateSlab( sizeClass );
+            if ( p )
+            {
+                TrackAlloc( p, SlabBlockBytes( sizeClass ), file, line );
+                return p;
+            }
+        }
+#endif // #if YOJIMBO_TLSF_SLABS
+
         void * p = tlsf_malloc( m_tlsf, size );
 
         if ( !p )
@@ -159,7 +333,7 @@ namespace yojimbo
             return NULL;
         }
 
-        TrackAlloc( p, size, file, line );
+        TrackAlloc( p, tlsf_block_size( p ), file, line );
         
         return p;
     }
@@ -169,8 +343,643 @@ namespace yojimbo
         if ( !p )
             return;
 
-        TrackFree( p, file, line );
+#if YOJIMBO_TLSF_SLABS
+        if ( m_slabPageTable && (uintptr_t) p >= m_slabPageBase )
+        {
+            const uintptr_t pageIndex = ( (uintptr_t) p - m_slabPageBase ) / SlabPageBytes;
+            if ( pageIndex < (uintptr_t) m_numSlabPageEntries && m_slabPageTable[pageIndex] )
+            {
+                SlabPage * page = (SlabPage*) ( m_slabPageBase + pageIndex * SlabPageBytes );
+                TrackFree( p, SlabBlockBytes( page->sizeClass ), file, line );
+                FreeSlab( page, p );
+                return;
+            }
+        }
+#endif // #if YOJIMBO_TLSF_SLABS
+
+        TrackFree( p, tlsf_block_size( p ), file, line );
 
         tlsf_free( m_tlsf, p );
     }
+
+#if YOJIMBO_TLSF_SLABS
+
+    void * TLSF_Allocator::AllocateSlab( int sizeClass )
+    {
+        yojimbo_assert( sizeClass >= 0 );
+        yojimbo_assert( sizeClass < SlabNumClasses );
+
+        SlabPage * page = m_slabPages[sizeClass];
+
+        if ( !page )
+        {
+            page = m_emptySlabPages[sizeClass];
+            m_emptySlabPages[sizeClass] = NULL;
+
+            if ( !page )
+            {
+                page = (SlabPage*) tlsf_memalign( m_tlsf, SlabPageBytes, SlabPageBytes );
+                if ( !page )
+                    return NULL;
+
+                const uintptr_t pageIndex = ( (uintptr_t) page - m_slabPageBase ) / SlabPageBytes;
+                yojimbo_assert( pageIndex < (uintptr_t) m_numSlabPageEntries );
+                m_slabPageTable[pageIndex] = 1;
+
+                page->freeList = NULL;
+                page->sizeClass = sizeClass;
+                page->numUsed = 0;
+                page->numCarved = 0;
+            }
+
+            page->prev = NULL;
+            page->next = NULL;
+            m_slabPages[sizeClass] = page;
+        }
+
+        void * p;
+        if ( page->freeList )
+        {
+            p = page->freeList;
+            page->freeList = *( (void**) p );
+        }
+        else
+        {
+            yojimbo_assert( page->numCarved < SlabBlocksPerPage( sizeClass ) );
+            p = ( (uint8_t*) page ) + SlabPageHeaderBytes + page->numCarved * SlabBlockBytes( sizeClass );
+            page->numCarved++;
+        }
+
+        page->numUsed++;
+
+        if ( page->numUsed == SlabBlocksPerPage( sizeClass ) )
+        {
+            yojimbo_assert( page->prev == NULL );
+            m_slabPages[sizeClass] = page->next;
+            if ( page->next )
+                page->next->prev = NULL;
+            page->next = NULL;
+        }
+
+        return p;
+    }
+
+    void TLSF_Allocator::FreeSlab( SlabPage * page, void * p )
+    {
+        yojimbo_assert( page->numUsed > 0 );
+
+        const int sizeClass = page->sizeClass;
+        const bool wasFull = page->numUsed == SlabBlocksPerPage( sizeClass );
+
+        *( (void**) p ) = page->freeList;
+        page->freeList = p;
+        page->numUsed--;
+
+        if ( wasFull )
+        {
+            page->prev = NULL;
+            page->next = m_slabPages[sizeClass];
+            if ( page->next )
+                page->next->prev = page;
+            m_slabPages[sizeClass] = page;
+        }
+
+        if ( page->numUsed > 0 )
+            return;
+
+        if ( page->prev )
+            page->prev->next = page->next;
+        else
+            m_slabPages[sizeClass] = page->next;
+        if ( page->next )
+            page->next->prev = page->prev;
+
+        if ( !m_emptySlabPages[sizeClass] )
+        {
+            m_emptySlabPages[sizeClass] = page;
+            return;
+        }
+
+        const uintptr_t pageIndex = ( (uintptr_t) page - m_slabPageBase ) / SlabPageBytes;
+        m_slabPageTable[pageIndex] = 0;
+        tlsf_free( m_tlsf, page );
+    }
+
+#endif // #if YOJIMBO_TLSF_SLABS
+
+    static void FindLargestFreeBlock( void * ptr, size_t size, int used, void * user )
+    {
+        (void) ptr;
+        size_t * largestFreeBlock = (size_t*) user;
+        if ( !used && size > *largestFreeBlock )
+            *largestFreeBlock = size;
+    }
+
+    void TLSF_Allocator::GetStats( AllocatorStats & stats ) const
+    {
+        Allocator::GetStats( stats );
+        tlsf_walk_pool( tlsf_get_pool( m_tlsf ), FindLargestFreeBlock, &stats.largestFreeBlock );
+    }
+
+    // =============================================
+
+    static const size_t QuotaHeaderBytes = 16;              // keeps allocations returned to the caller 16 byte aligned, provided the parent allocation is.
+
+    QuotaAllocator::QuotaAllocator( Allocator & parent, size_t quota )
+    {
+        m_parent = &parent;
+        m_quota = quota;
+        m_steadyStateExempt = true;
+        m_bytesAllocated = 0;
+    }
+
+    void * QuotaAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        const size_t totalBytes = size + QuotaHeaderBytes;
+
+        if ( m_bytesAllocated + totalBytes > m_quota )
+        {
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            return NULL;
+        }
+
+        uint8_t * block = (uint8_t*) m_parent->Allocate( totalBytes, file, line );
+
+        if ( !block )
+        {
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            return NULL;
+        }
+
+        *( (size_t*) block ) = totalBytes;
+
+        m_bytesAllocated += totalBytes;
+
+        void * p = block + QuotaHeaderBytes;
+
+        TrackAlloc( p, size, file, line );
+
+        return p;
+    }
+
+    void QuotaAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        uint8_t * block = ( (uint8_t*) p ) - QuotaHeaderBytes;
+
+        const size_t totalBytes = *( (size_t*) block );
+
+        TrackFree( p, totalBytes - QuotaHeaderBytes, file, line );
+
+        yojimbo_assert( totalBytes <= m_bytesAllocated );
+
+        m_bytesAllocated -= totalBytes;
+
+        m_parent->Free( block, file, line );
+    }
+
+    // =============================================
+
+    static const size_t FrameAlignBytes = 8;
+
+    FrameAllocator::FrameAllocator( Allocator & parent, size_t bytes )
+    {
+        yojimbo_assert( bytes > 0 );
+
+        m_parent = &parent;
+        m_steadyStateExempt = true;
+        m_memory = (uint8_t*) YOJIMBO_ALLOCATE( parent, bytes );
+        m_capacity = m_memory ? bytes : 0;
+        m_bytesUsed = 0;
+        m_numLiveAllocations = 0;
+
+        if ( !m_memory )
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+    }
+
+    FrameAllocator::~FrameAllocator()
+    {
+        yojimbo_assert( m_numLiveAllocations == 0 );
+
+        YOJIMBO_FREE( *m_parent, m_memory );
+    }
+
+    void * FrameAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        const size_t alignedSize = FrameAlignBytes + ( ( size + FrameAlignBytes - 1 ) & ~( FrameAlignBytes - 1 ) );
+
+        if ( alignedSize < size || alignedSize > m_capacity - m_bytesUsed )
+        {
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            return NULL;
+        }
+
+        uint8_t * block = m_memory + m_bytesUsed;
+
+        *( (size_t*) block ) = size;
+
+        void * p = block + FrameAlignBytes;
+
+        m_bytesUsed += alignedSize;
+        m_numLiveAllocations++;
+
+        TrackAlloc( p, size, file, line );
+
+        return p;
+    }
+
+    void FrameAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        yojimbo_assert( (uint8_t*) p >= m_memory + FrameAlignBytes && (uint8_t*) p < m_memory + m_bytesUsed );
+
+        TrackFree( p, *( (size_t*) ( ( (uint8_t*) p ) - FrameAlignBytes ) ), file, line );
+        yojimbo_assert( m_numLiveAllocations > 0 );
+
+        m_numLiveAllocations--;
+
+        if ( m_numLiveAllocations == 0 )
+            m_bytesUsed = 0;
+    }
+
+    void FrameAllocator::Reset()
+    {
+        yojimbo_assert( m_numLiveAllocations == 0 );
+
+        m_numLiveAllocations = 0;
+        m_bytesUsed = 0;
+    }
+
+    // =============================================
+
+    BufferPoolAllocator::BufferPoolAllocator( Allocator & parent, size_t bufferBytes, int numBuffers )
+    {
+        yojimbo_assert( bufferBytes > 0 );
+        yojimbo_assert( numBuffers > 0 );
+
+        m_parent = &parent;
+        m_steadyStateExempt = true;
+        m_bufferBytes = ( bufferBytes + 7 ) & ~size_t( 7 );
+        m_numBuffers = numBuffers;
+        m_memory = NULL;
+        m_freeBuffers = NULL;
+        m_numFreeBuffers = numBuffers;
+    }
+
+    BufferPoolAllocator::~BufferPoolAllocator()
+    {
+        yojimbo_assert( m_numFreeBuffers == m_numBuffers );
+
+        YOJIMBO_FREE( *m_parent, m_memory );
+        YOJIMBO_FREE( *m_parent, m_freeBuffers );
+    }
+
+    void * BufferPoolAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        if ( size > m_bufferBytes / 2 && size <= m_bufferBytes && m_numFreeBuffers > 0 )
+        {
+            if ( !m_memory )
+            {
+                // reserved on first use, so endpoints that never see a large packet cost nothing
+
+                m_memory = (uint8_t*) YOJIMBO_ALLOCATE( *m_parent, m_bufferBytes * m_numBuffers );
+                m_freeBuffers = (int*) YOJIMBO_ALLOCATE( *m_parent, sizeof( int ) * m_numBuffers * 2 );
+
+                if ( !m_memory || !m_freeBuffers )
+                {
+                    YOJIMBO_FREE( *m_parent, m_memory );
+                    YOJIMBO_FREE( *m_parent, m_freeBuffers );
+                    SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+                    return NULL;
+                }
+
+                for ( int i = 0; i < m_numBuffers; ++i )
+                    m_freeBuffers[i] = m_numBuffers - 1 - i;
+            }
+
+            const int index = m_freeBuffers[--m_numFreeBuffers];
+
+            m_freeBuffers[m_numBuffers+index] = int( size );
+
+            void * p = m_memory + m_bufferBytes * index;
+
+            TrackAlloc( p, size, file, line );
+
+            return p;
+        }
+
+        void * p = m_parent->Allocate( size, file, line );
+
+        if ( !p )
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+
+        return p;
+    }
+
+    void BufferPoolAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        if ( m_memory && (uint8_t*) p >= m_memory && (uint8_t*) p < m_memory + m_bufferBytes * m_numBuffers )
+        {
+            const int index = int( ( (uint8_t*) p - m_memory ) / m_bufferBytes );
+
+            yojimbo_assert( (uint8_t*) p == m_memory + m_bufferBytes * index );
+            yojimbo_assert( m_numFreeBuffers < m_numBuffers );
+
+            TrackFree( p, size_t( m_freeBuffers[m_numBuffers+index] ), file, line );
+
+            m_freeBuffers[m_numFreeBuffers++] = index;
+
+            return;
+        }
+
+        m_parent->Free( p, file, line );
+    }
+
+    // =============================================
+
+    static void SpinLock( volatile int & lock )
+    {
+        while ( yojimbo_atomic_compare_exchange( &lock, 1, 0 ) != 0 )
+        {
+            // spin
+        }
+    }
+
+    static void SpinUnlock( volatile int & lock )
+    {
+        const int previous = yojimbo_atomic_compare_exchange( &lock, 0, 1 );
+        yojimbo_assert( previous == 1 );
+        (void) previous;
+    }
+
+    ThreadSafeAllocator::ThreadSafeAllocator( Allocator & parent )
+    {
+        m_parent = &parent;
+        m_lock = 0;
+    }
+
+    void ThreadSafeAllocator::Lock() const
+    {
+        SpinLock( m_lock );
+    }
+
+    void ThreadSafeAllocator::Unlock() const
+    {
+        SpinUnlock( m_lock );
+    }
+
+    void * ThreadSafeAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        Lock();
+
+        void * p = m_parent->Allocate( size, file, line );
+
+        Unlock();
+
+        if ( !p )
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+
+        return p;
+    }
+
+    void ThreadSafeAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        Lock();
+
+        m_parent->Free( p, file, line );
+
+        Unlock();
+    }
+
+    void ThreadSafeAllocator::GetStats( AllocatorStats & stats ) const
+    {
+        Lock();
+
+        m_parent->GetStats( stats );
+
+        Unlock();
+    }
+
+    size_t ThreadSafeAllocator::GetBytesAllocated() const
+    {
+        Lock();
+
+        const size_t bytesAllocated = m_parent->GetBytesAllocated();
+
+        Unlock();
+
+        return bytesAllocated;
+    }
+
+    // =============================================
+
+    static const size_t ThreadCachingHeaderBytes = 16;      // owning heap, then the next pointer while queued as a remote free. keeps allocations 8 byte aligned.
+
+    ThreadCachingAllocator::ThreadCachingAllocator( Allocator & parent, size_t heapBytes, int maxThreads )
+    {
+        yojimbo_assert( heapBytes > 0 );
+        yojimbo_assert( maxThreads > 0 );
+
+        m_parent = &parent;
+        m_lock = 0;
+        m_numHeaps = 0;
+
+        m_heaps = (ThreadHeap*) YOJIMBO_ALLOCATE( parent, sizeof( ThreadHeap ) * maxThreads );
+
+        if ( !m_heaps )
+        {
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            return;
+        }
+
+        const int AlignBytes = 8;
+
+        for ( int i = 0; i < maxThreads; ++i )
+        {
+            ThreadHeap & heap = m_heaps[i];
+
+            heap.memory = YOJIMBO_ALLOCATE( parent, heapBytes );
+
+            if ( !heap.memory )
+            {
+                SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+                break;
+            }
+
+            uint8_t * aligned_memory_start = (uint8_t*) AlignPointerUp( heap.memory, AlignBytes );
+            uint8_t * aligned_memory_finish = (uint8_t*) AlignPointerDown( ( (uint8_t*) heap.memory ) + heapBytes, AlignBytes );
+
+            yojimbo_assert( aligned_memory_start < aligned_memory_finish );
+
+            heap.tlsf = tlsf_create_with_pool( aligned_memory_start, aligned_memory_finish - aligned_memory_start );
+            heap.remoteFrees = NULL;
+            heap.bytesAllocated = 0;
+            heap.peakBytesAllocated = 0;
+            heap.numAllocations = 0;
+            heap.numFrees = 0;
+
+            m_numHeaps++;
+        }
+    }
+
+    ThreadCachingAllocator::~ThreadCachingAllocator()
+    {
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            ThreadHeap & heap = m_heaps[i];
+
+            CollectRemoteFrees( heap );
+
+            yojimbo_assert( heap.numAllocations == heap.numFrees );
+
+            tlsf_destroy( heap.tlsf );
+
+            YOJIMBO_FREE( *m_parent, heap.memory );
+        }
+
+        YOJIMBO_FREE( *m_parent, m_heaps );
+    }
+
+    void ThreadCachingAllocator::CollectRemoteFrees( ThreadHeap & heap )
+    {
+        // take the whole stack in one go. other threads push onto an empty stack from here on
+
+        void * block = heap.remoteFrees;
+        while ( true )
+        {
+            void * previous = yojimbo_atomic_compare_exchange_pointer( &heap.remoteFrees, NULL, block );
+            if ( previous == block )
+                break;
+            block = previous;
+        }
+
+        while ( block )
+        {
+            void * next = ( (void**) block )[1];
+            heap.bytesAllocated -= tlsf_block_size( block );
+            heap.numFrees++;
+            tlsf_free( heap.tlsf, block );
+            block = next;
+        }
+    }
+
+    void * ThreadCachingAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        const size_t totalBytes = size + ThreadCachingHeaderBytes;
+
+        const int threadIndex = yojimbo_thread_index();
+
+        ThreadHeap * heap = ( threadIndex < m_numHeaps ) ? &m_heaps[threadIndex] : NULL;
+
+        uint8_t * block;
+
+        if ( heap )
+        {
+            if ( heap->remoteFrees )
+                CollectRemoteFrees( *heap );
+
+            block = (uint8_t*) tlsf_malloc( heap->tlsf, totalBytes );
+
+            if ( block )
+            {
+                CheckSteadyStateAllocation( size, file, line );
+                heap->bytesAllocated += tlsf_block_size( block );
+                heap->numAllocations++;
+                if ( heap->bytesAllocated > heap->peakBytesAllocated )
+                    heap->peakBytesAllocated = heap->bytesAllocated;
+            }
+        }
+        else
+        {
+            SpinLock( m_lock );
+            block = (uint8_t*) m_parent->Allocate( totalBytes, file, line );
+            SpinUnlock( m_lock );
+        }
+
+        if ( !block )
+        {
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+            return NULL;
+        }
+
+        ( (ThreadHeap**) block )[0] = heap;
+
+        return block + ThreadCachingHeaderBytes;
+    }
+
+    void ThreadCachingAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        uint8_t * block = ( (uint8_t*) p ) - ThreadCachingHeaderBytes;
+
+        ThreadHeap * heap = ( (ThreadHeap**) block )[0];
+
+        if ( !heap )
+        {
+            SpinLock( m_lock );
+            m_parent->Free( block, file, line );
+            SpinUnlock( m_lock );
+            return;
+        }
+
+        const int threadIndex = yojimbo_thread_index();
+
+        if ( threadIndex < m_numHeaps && heap == &m_heaps[threadIndex] )
+        {
+            heap->bytesAllocated -= tlsf_block_size( block );
+            heap->numFrees++;
+            tlsf_free( heap->tlsf, block );
+            return;
+        }
+
+        // freed on another thread: push it onto the owning heap's remote free stack
+
+        void * head = heap->remoteFrees;
+        while ( true )
+        {
+            ( (void**) block )[1] = head;
+            void * previous = yojimbo_atomic_compare_exchange_pointer( &heap->remoteFrees, block, head );
+            if ( previous == head )
+                break;
+            head = previous;
+        }
+    }
+
+    void ThreadCachingAllocator::GetStats( AllocatorStats & stats ) const
+    {
+        stats = AllocatorStats();
+
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            const ThreadHeap & heap = m_heaps[i];
+            stats.bytesAllocated += heap.bytesAllocated;
+            stats.peakBytesAllocated += heap.peakBytesAllocated;
+            stats.numAllocations += heap.numAllocations;
+            stats.numFrees += heap.numFrees;
+        }
+    }
+
+    size_t ThreadCachingAllocator::GetBytesAllocated() const
+    {
+        size_t bytesAllocated = 0;
+
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            bytesAllocated += m_heaps[i].bytesAllocated;
+        }
+
+        return bytesAllocated;
+    }
 }
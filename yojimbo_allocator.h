@@ -10,9 +10,10 @@
 #include "yojimbo_platform.h"
 #include <stdint.h>
 #include <new>
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-#include <map>
-#endif // YOJIMBO_DEBUG_MEMORY_LEAKS
+#if YOJIMBO_DEBUG_MEMORY_LEAKS || YOJIMBO_DEBUG_MESSAGE_LEAKS
+#include <stdlib.h>
+#include <string.h>
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS || YOJIMBO_DEBUG_MESSAGE_LEAKS
 
 /** @file */
 
@@ -34,6 +35,100 @@ namespace yojimbo
 
     class Allocator & GetDefaultAllocator();
 
+    /**
+        Override the default allocator for the calling thread.
+
+        Worker threads that do yojimbo work, like generating packets in parallel, should set this to a thread safe allocator such as ThreadCachingAllocator, because the default allocator is shared by all threads.
+
+        @param allocator The allocator GetDefaultAllocator returns on this thread. Pass NULL to go back to the default allocator.
+     */
+
+    void SetThreadDefaultAllocator( class Allocator * allocator );
+
+    /**
+        Where the first allocation caught by the steady state check came from. See ArmSteadyStateCheck.
+     */
+
+    struct SteadyStateReport
+    {
+        int numAllocations;                                     ///< Number of allocations caught since the check was armed.
+        const char * scope;                                     ///< The innermost steady state scope of the first allocation caught, eg. "Connection::GeneratePacket". NULL if none were caught.
+        const char * file;                                      ///< The source file passed to YOJIMBO_ALLOCATE for the first allocation caught.
+        int line;                                               ///< The source line passed to YOJIMBO_ALLOCATE for the first allocation caught.
+        size_t size;                                            ///< The size of the first allocation caught (bytes).
+
+        SteadyStateReport()
+        {
+            numAllocations = 0;
+            scope = NULL;
+            file = NULL;
+            line = 0;
+            size = 0;
+        }
+    };
+
+    /**
+        Arm the steady state allocation check. Call this after warm-up, once clients are connected and message pools are filled.
+
+        While armed, every allocation tracked by an allocator inside GeneratePacket, ProcessPacket, SendPackets or ReceivePackets, on any thread, is counted and attributed to its file and line. The first one is logged. Allocations from frame allocators and pooled buffers don't count, since they never reach a heap.
+
+        Connecting and disconnecting clients allocates, so disarm the check around those, or expect them in the report.
+
+        Only available with YOJIMBO_DEBUG_STEADY_STATE, which is on in debug builds. Does nothing otherwise.
+
+        @param assertOnAllocation Assert on the first allocation caught, instead of counting them.
+     */
+
+    void ArmSteadyStateCheck( bool assertOnAllocation = false );
+
+    /**
+        Disarm the steady state allocation check. The report is kept until the check is armed again.
+     */
+
+    void DisarmSteadyStateCheck();
+
+    /**
+        Get the allocations caught by the steady state check since it was armed.
+
+        @param report The report (out). numAllocations is zero if the steady state is allocation free.
+     */
+
+    void GetSteadyStateReport( SteadyStateReport & report );
+
+#if YOJIMBO_DEBUG_STEADY_STATE
+
+    /// Enter a steady state scope on the calling thread. Use YOJIMBO_STEADY_STATE_SCOPE instead of calling this directly. Returns the enclosing scope.
+
+    const char * PushSteadyStateScope( const char * name );
+
+    /// Leave a steady state scope on the calling thread, going back to the enclosing scope returned by PushSteadyStateScope.
+
+    void PopSteadyStateScope( const char * previous );
+
+    /// Marks the calling thread as in steady state until the end of the scope. See YOJIMBO_STEADY_STATE_SCOPE.
+
+    struct SteadyStateScope
+    {
+        const char * previous;
+
+        explicit SteadyStateScope( const char * name ) : previous( PushSteadyStateScope( name ) ) {}
+
+        ~SteadyStateScope() { PopSteadyStateScope( previous ); }
+    };
+
+    #define YOJIMBO_STEADY_STATE_CONCAT_INTERNAL( a, b ) a##b
+    #define YOJIMBO_STEADY_STATE_CONCAT( a, b ) YOJIMBO_STEADY_STATE_CONCAT_INTERNAL( a, b )
+
+    /// Macro marking the rest of a scope as steady state, where allocations are caught once ArmSteadyStateCheck is called. The name must be a string literal.
+
+    #define YOJIMBO_STEADY_STATE_SCOPE( name ) yojimbo::SteadyStateScope YOJIMBO_STEADY_STATE_CONCAT( yojimbo_steady_state_scope_, __LINE__ )( name )
+
+#else // #if YOJIMBO_DEBUG_STEADY_STATE
+
+    #define YOJIMBO_STEADY_STATE_SCOPE( name ) do {} while(0)
+
+#endif // #if YOJIMBO_DEBUG_STEADY_STATE
+
     /// Macro for creating a new object instance with a yojimbo allocator.
 
     #define YOJIMBO_NEW( a, T, ... ) ( new ( (a).Allocate( sizeof(T), __FILE__, __LINE__ ) ) T(__VA_ARGS__) )
@@ -72,6 +167,182 @@ namespace yojimbo
         }
     }
 
+#if YOJIMBO_DEBUG_MEMORY_LEAKS || YOJIMBO_DEBUG_MESSAGE_LEAKS
+
+    /**
+        Open addressing hash map from pointers to values, used to track live allocations and messages in debug builds.
+
+        Uses linear probing with backward shift deletion, so there are no tombstones and lookups stay short under heavy insert and remove traffic. 
+        
+        Storage comes straight from malloc and free, because the map is used to track the allocators themselves.
+     */
+
+    template <typename T> class PointerHashMap
+    {
+    public:
+
+        PointerHashMap() : m_keys( NULL ), m_values( NULL ), m_capacity( 0 ), m_size( 0 ) {}
+
+        ~PointerHashMap()
+        {
+            free( m_keys );
+            free( m_values );
+        }
+
+        /**
+            Add a pointer to the map.
+
+            @param key The pointer. Must not be NULL, and must not already be in the map.
+            @param value The value to store with the pointer.
+         */
+
+        void Insert( const void * key, const T & value )
+        {
+            yojimbo_assert( key );
+
+            if ( ( m_size + 1 ) * 2 > m_capacity )
+                Grow();
+
+            int index = GetIndex( key );
+            while ( m_keys[index] )
+            {
+                yojimbo_assert( m_keys[index] != key );
+                index = ( index + 1 ) & ( m_capacity - 1 );
+            }
+
+            m_keys[index] = key;
+            m_values[index] = value;
+            m_size++;
+        }
+
+        /**
+            Find the value stored for a pointer.
+
+            @param key The pointer to look up.
+
+            @returns The value stored with the pointer, or NULL if the pointer is not in the map.
+         */
+
+        T * Find( const void * key ) const
+        {
+            if ( !m_size )
+                return NULL;
+
+            int index = GetIndex( key );
+            while ( m_keys[index] )
+            {
+                if ( m_keys[index] == key )
+                    return &m_values[index];
+                index = ( index + 1 ) & ( m_capacity - 1 );
+            }
+
+            return NULL;
+        }
+
+        /**
+            Remove a pointer from the map.
+
+            @param key The pointer to remove.
+
+            @returns True if the pointer was in the map and has been removed, false if it wasn't in the map.
+         */
+
+        bool Remove( const void * key )
+        {
+            if ( !m_size )
+                return false;
+
+            int index = GetIndex( key );
+            while ( m_keys[index] != key )
+            {
+                if ( !m_keys[index] )
+                    return false;
+                index = ( index + 1 ) & ( m_capacity - 1 );
+            }
+
+            // shift later entries in the same probe run back into the hole, so lookups never stop early
+
+            int hole = index;
+            while ( true )
+            {
+                index = ( index + 1 ) & ( m_capacity - 1 );
+                if ( !m_keys[index] )
+                    break;
+                const int ideal = GetIndex( m_keys[index] );
+                if ( ( ( index - ideal ) & ( m_capacity - 1 ) ) >= ( ( index - hole ) & ( m_capacity - 1 ) ) )
+                {
+                    m_keys[hole] = m_keys[index];
+                    m_values[hole] = m_values[index];
+                    hole = index;
+                }
+            }
+
+            m_keys[hole] = NULL;
+            m_size--;
+
+            return true;
+        }
+
+        /// Get the number of pointers in the map.
+
+        int GetSize() const { return m_size; }
+
+        /// Get the number of slots in the map. Iterate over slots in [0,capacity-1] with GetKeyAtIndex and GetValueAtIndex.
+
+        int GetCapacity() const { return m_capacity; }
+
+        /// Get the pointer stored in a slot, or NULL if the slot is empty.
+
+        const void * GetKeyAtIndex( int index ) const { yojimbo_assert( index >= 0 && index < m_capacity ); return m_keys[index]; }
+
+        /// Get the value stored in a slot. Only valid if the slot isn't empty.
+
+        const T & GetValueAtIndex( int index ) const { yojimbo_assert( index >= 0 && index < m_capacity ); return m_values[index]; }
+
+    private:
+
+        int GetIndex( const void * key ) const
+        {
+            uint64_t hash = uint64_t( uintptr_t( key ) ) * 0x9E3779B97F4A7C15ULL;
+            return int( hash >> 32 ) & ( m_capacity - 1 );
+        }
+
+        void Grow()
+        {
+            const void ** oldKeys = m_keys;
+            T * oldValues = m_values;
+            const int oldCapacity = m_capacity;
+
+            m_capacity = m_capacity ? m_capacity * 2 : 256;
+            m_keys = (const void**) malloc( sizeof( void* ) * m_capacity );
+            m_values = (T*) malloc( sizeof( T ) * m_capacity );
+            yojimbo_assert( m_keys );
+            yojimbo_assert( m_values );
+            memset( m_keys, 0, sizeof( void* ) * m_capacity );
+            m_size = 0;
+
+            for ( int i = 0; i < oldCapacity; ++i )
+            {
+                if ( oldKeys[i] )
+                    Insert( oldKeys[i], oldValues[i] );
+            }
+
+            free( oldKeys );
+            free( oldValues );
+        }
+
+        const void ** m_keys;                                                       ///< The pointer stored in each slot. NULL for empty slots.
+        T * m_values;                                                               ///< The value stored in each slot.
+        int m_capacity;                                                             ///< The number of slots. Always a power of two.
+        int m_size;                                                                 ///< The number of pointers in the map.
+
+        PointerHashMap( const PointerHashMap & other );
+
+        PointerHashMap & operator = ( const PointerHashMap & other );
+    };
+
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS || YOJIMBO_DEBUG_MESSAGE_LEAKS
+
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
     /**
@@ -89,12 +360,34 @@ namespace yojimbo
 
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
+    /**
+        Allocator statistics. See Allocator::GetStats.
+     */
+
+    struct AllocatorStats
+    {
+        size_t bytesAllocated;                                                      ///< Bytes currently allocated, not counting allocator overhead. TLSF based allocators count the usable size of each block, which includes rounding.
+        size_t peakBytesAllocated;                                                  ///< Highest value bytesAllocated has reached.
+        uint64_t numAllocations;                                                    ///< Number of allocations made since the allocator was created.
+        uint64_t numFrees;                                                          ///< Number of allocations freed since the allocator was created.
+        size_t largestFreeBlock;                                                    ///< Size of the largest free block, ie. roughly the largest allocation that could succeed right now (bytes). Zero if the allocator can't tell.
+
+        AllocatorStats()
+        {
+            bytesAllocated = 0;
+            peakBytesAllocated = 0;
+            numAllocations = 0;
+            numFrees = 0;
+            largestFreeBlock = 0;
+        }
+    };
+
     /**
         Functionality common to all allocators.
 
         Extend this class to hook up your own allocator to yojimbo.
 
-        IMPORTANT: This allocator is not yet thread safe. Only call it from one thread!
+        IMPORTANT: Allocators are not thread safe unless stated otherwise. Only call them from one thread! To share an allocator between threads, wrap it in a ThreadSafeAllocator, or use a ThreadCachingAllocator.
      */
 
     class Allocator
@@ -167,6 +460,26 @@ namespace yojimbo
 
         void ClearError() { m_errorLevel = ALLOCATOR_ERROR_NONE; }
 
+        /**
+            Get allocator statistics.
+
+            The counters are always on, and are updated by Allocator::TrackAlloc and Allocator::TrackFree. Use the peak to size the memory given to client and server allocators.
+
+            @param stats The statistics (out).
+         */
+
+        virtual void GetStats( AllocatorStats & stats ) const;
+
+        /**
+            Get the number of bytes currently allocated.
+
+            Unlike GetStats, this never walks the heap, so it is cheap enough to call every time a message is sent. Used by the connection memory watermark. See ConnectionConfig::memoryWatermark.
+
+            @returns The bytes allocated, as in AllocatorStats::bytesAllocated.
+         */
+
+        virtual size_t GetBytesAllocated() const { return m_bytesAllocated; }
+
     protected:
 
         /**
@@ -182,7 +495,7 @@ namespace yojimbo
         /**
             Call this function to track an allocation made by your derived allocator class.
 
-            In debug build, tracked allocations are automatically checked for leaks when the allocator is destroyed.
+            Updates the allocator statistics. In debug build, tracked allocations are automatically checked for leaks when the allocator is destroyed.
 
             @param p Pointer to the memory that was allocated.
             @param size The size of the allocation in bytes.
@@ -195,19 +508,39 @@ namespace yojimbo
         /**
             Call this function to track a free made by your derived allocator class.
 
-            In debug build, any allocation tracked without a corresponding free is considered a memory leak when the allocator is destroyed.
+            Updates the allocator statistics. In debug build, any allocation tracked without a corresponding free is considered a memory leak when the allocator is destroyed.
 
             @param p Pointer to the memory that was allocated.
+            @param size The size of the allocation in bytes. Must match the size passed to TrackAlloc for this allocation.
             @param file The source code file that is calling in to free the memory.
             @param line The line number in the source file where the free is being called from.
          */
 
-        void TrackFree( void * p, const char * file, int line );
+        void TrackFree( void * p, size_t size, const char * file, int line );
+
+        /**
+            Report an allocation to the steady state check. TrackAlloc calls this, so only allocators that hand out memory without calling TrackAlloc need to call it themselves.
+
+            @param size The size of the allocation in bytes.
+            @param file The source code file that performed the allocation.
+            @param line The line number in the source file where the allocation was performed.
+
+            @see ArmSteadyStateCheck
+         */
+
+        void CheckSteadyStateAllocation( size_t size, const char * file, int line );
 
         AllocatorErrorLevel m_errorLevel;                                       ///< The allocator error level.
 
+        bool m_steadyStateExempt;                                               ///< True for allocators ignored by the steady state check, because they never reach a heap, or their parent allocator is checked instead. See ArmSteadyStateCheck.
+
+        size_t m_bytesAllocated;                                                ///< Bytes currently allocated. See AllocatorStats::bytesAllocated.
+        size_t m_peakBytesAllocated;                                            ///< Highest value of m_bytesAllocated so far.
+        uint64_t m_numAllocations;                                              ///< Number of allocations tracked so far.
+        uint64_t m_numFrees;                                                    ///< Number of frees tracked so far.
+
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
-        std::map<void*,AllocatorEntry> m_alloc_map;                             ///< Debug only data structure used to find and report memory leaks.
+        PointerHashMap<AllocatorEntry> m_alloc_map;                             ///< Debug only data structure used to find and report memory leaks.
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
     private:
@@ -269,6 +602,8 @@ namespace yojimbo
 
         This is a fast allocator that supports multiple heaps. It's used inside the yojimbo server to silo allocations for each client to their own heap.
 
+        When YOJIMBO_TLSF_SLABS is enabled, allocations up to SlabMaxBytes are rounded up to a multiple of SlabClassBytes and served from slab pages of that size class, carved from the TLSF heap. Small allocations and frees are then a free list push or pop, with no per-block header, and many small blocks don't fragment the heap. A page goes back to the heap once all its blocks are freed, except for one empty page kept per size class. If no aligned page can be found, small allocations fall back to TLSF blocks.
+
         See https://github.com/mattconte/tlsf for details on this allocator implementation.
      */
 
@@ -326,14 +661,463 @@ namespace yojimbo
 
         void Free( void * p, const char * file, int line );
 
+        /**
+            Get allocator statistics, including the largest free block in the TLSF heap.
+
+            Finding the largest free block walks the heap, so this costs time proportional to the number of blocks in the heap.
+
+            @param stats The statistics (out).
+         */
+
+        void GetStats( AllocatorStats & stats ) const;
+
     private:
 
         tlsf_t m_tlsf;                                                  ///< The TLSF allocator instance backing this allocator.
 
+#if YOJIMBO_TLSF_SLABS
+
+        struct SlabPage;
+
+        void * AllocateSlab( int sizeClass );
+
+        void FreeSlab( SlabPage * page, void * p );
+
+        SlabPage * m_slabPages[SlabMaxBytes/SlabClassBytes];            ///< Per size class, the list of slab pages with a free block.
+        SlabPage * m_emptySlabPages[SlabMaxBytes/SlabClassBytes];       ///< Per size class, an empty page kept back from the heap so freeing and allocating one block doesn't churn pages. May be NULL.
+        uintptr_t m_slabPageBase;                                       ///< Address of the first page-aligned page overlapping the heap.
+        int m_numSlabPageEntries;                                       ///< The number of entries in the slab page table.
+        uint8_t * m_slabPageTable;                                      ///< One entry per page-aligned page of the heap. Non-zero if the page is a slab page, so Free can tell slab blocks apart from TLSF blocks.
+
+#endif // #if YOJIMBO_TLSF_SLABS
+
         TLSF_Allocator( const TLSF_Allocator & other );
 
         TLSF_Allocator & operator = ( const TLSF_Allocator & other );
     };
+
+    /**
+        Allocator that draws memory from a shared parent allocator, up to a fixed quota.
+
+        This is used by the server when BaseClientServerConfig::serverSharedClientMemory is true. Instead of reserving a fixed block of memory for each client slot up-front, 
+        each client allocates from a pool shared by all clients on demand and returns memory to it when freed, while the quota keeps one client from starving the others.
+
+        Allocations that would take the allocator over its quota fail and set the error level to ALLOCATOR_ERROR_OUT_OF_MEMORY, just like an exhausted TLSF_Allocator.
+     */
+
+    class QuotaAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Quota allocator constructor.
+
+            @param parent The shared allocator to draw memory from. Must remain valid while this allocator exists.
+            @param quota The maximum number of bytes this allocator may have allocated from the parent at any time, including per-allocation overhead.
+         */
+
+        QuotaAllocator( Allocator & parent, size_t quota );
+
+        /**
+            Allocates a block of memory from the parent allocator, if it fits in the quota.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory back to the parent allocator.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the number of bytes currently drawn from the parent allocator, including per-allocation overhead. This is what counts against the quota.
+         */
+
+        size_t GetBytesAllocated() const { return m_bytesAllocated; }
+
+        /**
+            Get the quota passed in to the constructor, or set with SetQuota (bytes).
+         */
+
+        size_t GetQuota() const { return m_quota; }
+
+        /**
+            Change the quota. Memory already allocated stays allocated, even if it is over the new quota.
+
+            @param quota The maximum number of bytes this allocator may have allocated from the parent at any time.
+         */
+
+        void SetQuota( size_t quota ) { m_quota = quota; }
+
+    private:
+
+        Allocator * m_parent;                                           ///< The shared allocator memory is drawn from.
+        size_t m_quota;                                                 ///< Maximum number of bytes that may be drawn from the parent allocator.
+        size_t m_bytesAllocated;                                        ///< Number of bytes currently drawn from the parent allocator.
+
+        QuotaAllocator( const QuotaAllocator & other );
+
+        QuotaAllocator & operator = ( const QuotaAllocator & other );
+    };
+
+    /**
+        Bump pointer allocator for short lived allocations, like temporaries made while reading and writing a packet.
+
+        Memory comes from one block reserved up-front from a parent allocator. Allocating just moves a pointer forward and freeing only counts down the number of live allocations. 
+        Once every allocation has been freed, the whole block is available again. Call FrameAllocator::Reset once per frame to make that explicit.
+
+        Allocations that don't fit in the block fail and set the error level to ALLOCATOR_ERROR_OUT_OF_MEMORY. Memory is never handed back until everything allocated has been freed, so don't use it for anything that lives longer than a frame.
+     */
+
+    class FrameAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Frame allocator constructor.
+
+            @param parent The allocator to reserve the block of memory from. Must remain valid while this allocator exists.
+            @param bytes The size of the block of memory (bytes). This is the most that can be allocated at the same time.
+         */
+
+        FrameAllocator( Allocator & parent, size_t bytes );
+
+        /**
+            Frame allocator destructor.
+
+            Returns the block of memory to the parent allocator. Free all memory allocated by this allocator before destroying.
+         */
+
+        ~FrameAllocator();
+
+        /**
+            Allocates memory from the block by bumping a pointer. The memory is 8 byte aligned.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if it doesn't fit in what is left of the block. If NULL is returned, the error level is set to ALLOCATOR_ERROR_OUT_OF_MEMORY.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free memory allocated from the block. The memory is only reused once every allocation has been freed.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Start a new frame. All memory allocated in the previous frame must have been freed.
+         */
+
+        void Reset();
+
+        /**
+            Get the number of bytes of the block in use, including alignment padding.
+         */
+
+        size_t GetBytesUsed() const { return m_bytesUsed; }
+
+        /**
+            Get the size of the block of memory passed in to the constructor (bytes).
+         */
+
+        size_t GetCapacity() const { return m_capacity; }
+
+    private:
+
+        Allocator * m_parent;                                           ///< The allocator the block of memory was reserved from.
+        uint8_t * m_memory;                                             ///< The block of memory allocations are made from.
+        size_t m_capacity;                                              ///< The size of the block of memory (bytes).
+        size_t m_bytesUsed;                                             ///< Offset of the next allocation in the block (bytes).
+        int m_numLiveAllocations;                                       ///< The number of allocations not freed yet. The block is rewound when this drops to zero.
+
+        FrameAllocator( const FrameAllocator & other );
+
+        FrameAllocator & operator = ( const FrameAllocator & other );
+    };
+
+    /**
+        Allocator that keeps a few large buffers of one size for reuse, and passes everything else through to a parent allocator.
+
+        Allocations larger than half the buffer size, up to the buffer size, take a free buffer if there is one. The buffers are reserved from the parent in one block the first time one is needed, and kept until the allocator is destroyed, so a steady stream of large allocations and frees doesn't churn the parent allocator.
+
+        This is used for the reassembly and send buffers of reliable.io endpoints. See BaseClientServerConfig::packetBufferPoolSize.
+     */
+
+    class BufferPoolAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Buffer pool allocator constructor. Nothing is reserved until the first allocation that fits in a buffer.
+
+            @param parent The allocator to reserve the buffers from, and to pass other allocations through to. Must remain valid while this allocator exists.
+            @param bufferBytes The size of each buffer (bytes).
+            @param numBuffers The number of buffers.
+         */
+
+        BufferPoolAllocator( Allocator & parent, size_t bufferBytes, int numBuffers );
+
+        /**
+            Buffer pool allocator destructor.
+
+            Returns the buffers to the parent allocator. Free all memory allocated by this allocator before destroying.
+         */
+
+        ~BufferPoolAllocator();
+
+        /**
+            Allocates a free buffer if the size fits, otherwise passes the allocation through to the parent allocator.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATOR_ERROR_OUT_OF_MEMORY.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory, putting it back in the pool if it is a buffer.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the number of buffers not in use.
+
+            @returns The number of free buffers. All of them before the buffers are reserved.
+         */
+
+        int GetNumFreeBuffers() const { return m_numFreeBuffers; }
+
+    private:
+
+        Allocator * m_parent;                                           ///< The allocator the buffers are reserved from, and other allocations pass through to.
+        size_t m_bufferBytes;                                           ///< The size of each buffer (bytes).
+        int m_numBuffers;                                               ///< The number of buffers.
+        uint8_t * m_memory;                                             ///< The block of memory the buffers are carved from. NULL until the first buffer is needed.
+        int * m_freeBuffers;                                            ///< Stack of the indices of the free buffers, followed by the size allocated in each buffer.
+        int m_numFreeBuffers;                                           ///< Number of entries in the free buffer stack.
+
+        BufferPoolAllocator( const BufferPoolAllocator & other );
+
+        BufferPoolAllocator & operator = ( const BufferPoolAllocator & other );
+    };
+
+    /**
+        Allocator that makes another allocator safe to call from multiple threads, by holding a spin lock around each call.
+
+        Use this for allocators that are shared between threads but not used heavily, otherwise threads will spend their time waiting for each other. See ThreadCachingAllocator for that case.
+     */
+
+    class ThreadSafeAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Thread safe allocator constructor.
+
+            @param parent The allocator to forward to. Must remain valid while this allocator exists, and must only be called through this allocator from now on.
+         */
+
+        explicit ThreadSafeAllocator( Allocator & parent );
+
+        /**
+            Allocates a block of memory from the parent allocator, while holding the lock.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATOR_ERROR_OUT_OF_MEMORY.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory back to the parent allocator, while holding the lock.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the statistics of the parent allocator, while holding the lock.
+
+            @param stats The statistics (out).
+         */
+
+        void GetStats( AllocatorStats & stats ) const;
+
+        /**
+            Get the number of bytes allocated from the parent allocator, while holding the lock.
+
+            @returns The bytes allocated.
+         */
+
+        size_t GetBytesAllocated() const;
+
+    private:
+
+        void Lock() const;
+
+        void Unlock() const;
+
+        Allocator * m_parent;                                           ///< The allocator calls are forwarded to.
+        mutable volatile int m_lock;                                    ///< Spin lock. 1 while a thread is inside the parent allocator, 0 otherwise.
+
+        ThreadSafeAllocator( const ThreadSafeAllocator & other );
+
+        ThreadSafeAllocator & operator = ( const ThreadSafeAllocator & other );
+    };
+
+    /**
+        Thread safe allocator that gives each thread its own TLSF heap.
+
+        Allocations and frees on the thread that made the allocation never synchronize with other threads. Memory freed on another thread is pushed onto a lock-free queue owned by the heap it came from, and handed back to that heap the next time its thread allocates.
+
+        Heaps are assigned by yojimbo_thread_index, so this is designed for a fixed set of worker threads. Threads numbered maxThreads or above share the parent allocator behind a lock.
+
+        Allocations are not tracked for leaks individually, because the leak tracker is not thread safe. Instead, the destructor checks that every heap is empty.
+
+        Statistics are summed over the thread heaps, so the peak is the sum of the per-heap peaks: an upper bound on the true peak. Each heap counts its own allocations, so the per-heap counters never synchronize, but the sums read from another thread may be slightly stale. Allocations by threads without a heap are counted by the parent allocator.
+     */
+
+    class ThreadCachingAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Thread caching allocator constructor.
+
+            All heaps are reserved up-front from the parent allocator, so the parent is only called from other threads by threads without a heap.
+
+            @param parent The allocator to reserve heaps from. Must remain valid while this allocator exists.
+            @param heapBytes The size of the heap for each thread (bytes).
+            @param maxThreads The number of thread heaps. Threads with yojimbo_thread_index in [0,maxThreads-1] get their own heap.
+         */
+
+        ThreadCachingAllocator( Allocator & parent, size_t heapBytes, int maxThreads );
+
+        /**
+            Thread caching allocator destructor.
+
+            Make sure all allocations have been freed, and that no other thread is using the allocator.
+         */
+
+        ~ThreadCachingAllocator();
+
+        /**
+            Allocates a block of memory from the heap of the calling thread.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATOR_ERROR_OUT_OF_MEMORY.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory. May be called from any thread.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator.
+            @param file The source code filename that is performing the free.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get allocator statistics, summed over the thread heaps.
+
+            @param stats The statistics (out).
+         */
+
+        void GetStats( AllocatorStats & stats ) const;
+
+        /**
+            Get the number of bytes allocated, summed over the thread heaps.
+
+            @returns The bytes allocated.
+         */
+
+        size_t GetBytesAllocated() const;
+
+    private:
+
+        /// A heap owned by one thread.
+
+        struct ThreadHeap
+        {
+            tlsf_t tlsf;                                                ///< The TLSF allocator for the heap. Only touched by the owning thread.
+            void * memory;                                              ///< The memory backing the heap.
+            void * volatile remoteFrees;                                ///< Lock-free stack of blocks freed by other threads, waiting to be returned to the heap.
+            size_t bytesAllocated;                                      ///< Usable bytes of the blocks allocated from the heap and not yet returned. Only touched by the owning thread.
+            size_t peakBytesAllocated;                                  ///< Highest value of bytesAllocated so far.
+            uint64_t numAllocations;                                    ///< The number of blocks allocated from the heap so far. Only touched by the owning thread.
+            uint64_t numFrees;                                          ///< The number of blocks returned to the heap so far. Only touched by the owning thread.
+        };
+
+        void CollectRemoteFrees( ThreadHeap & heap );
+
+        Allocator * m_parent;                                           ///< The allocator heaps are reserved from. Also used, behind a lock, by threads without a heap.
+        ThreadHeap * m_heaps;                                           ///< The per-thread heaps, indexed by yojimbo_thread_index.
+        int m_numHeaps;                                                 ///< The number of per-thread heaps.
+        volatile int m_lock;                                            ///< Spin lock around the parent allocator, for threads without a heap.
+
+        ThreadCachingAllocator( const ThreadCachingAllocator & other );
+
+        ThreadCachingAllocator & operator = ( const ThreadCachingAllocator & other );
+    };
 }
 
 #endif
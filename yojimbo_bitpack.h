@@ -22,6 +22,9 @@ namespace yojimbo
 
         Once the low 32 bits of the scratch is filled with bits it is flushed to memory as a dword and the scratch value is shifted right by 32.
 
+        With YOJIMBO_BITPACKER_64BIT_WORDS, the whole 64 bit scratch is filled before it is flushed to memory in one go. This halves the number of flushes and byte swaps. 
+        Because the stream is little endian and bits are packed from the low end, the bytes written are exactly the same in both modes.
+
         The bit stream is written to memory in little endian order, which is considered network byte order for this library.
 
         @see BitReader
@@ -73,6 +76,29 @@ namespace yojimbo
             yojimbo_assert( m_bitsWritten + bits <= m_numBits );
             yojimbo_assert( uint64_t( value ) <= ( ( 1ULL << bits ) - 1 ) );
 
+#if YOJIMBO_BITPACKER_64BIT_WORDS
+
+            // Bits that don't fit in the scratch are shifted out here, and carried over into the next scratch below.
+
+            m_scratch |= uint64_t( value ) << m_scratchBits;
+
+            if ( m_scratchBits + bits >= 64 )
+            {
+                yojimbo_assert( m_wordIndex + 1 < m_numWords );
+                const uint64_t word = host_to_network( m_scratch );
+                memcpy( &m_data[m_wordIndex], &word, 8 );
+                m_wordIndex += 2;
+                // m_scratchBits >= 32 here, so the shift is in [1,32]
+                m_scratch = uint64_t( value ) >> ( 64 - m_scratchBits );
+                m_scratchBits = m_scratchBits + bits - 64;
+            }
+            else
+            {
+                m_scratchBits += bits;
+            }
+
+#else // #if YOJIMBO_BITPACKER_64BIT_WORDS
+
             m_scratch |= uint64_t( value ) << m_scratchBits;
 
             m_scratchBits += bits;
@@ -86,9 +112,85 @@ namespace yojimbo
                 m_wordIndex++;
             }
 
+#endif // #if YOJIMBO_BITPACKER_64BIT_WORDS
+
             m_bitsWritten += bits;
         }
 
+        /**
+            Write an array of values with the same number of bits each.
+
+            Writes exactly the same bits as calling BitWriter::WriteBits for each value, but checks for space once for the whole array.
+
+            When the write position is dword aligned and the values are 8, 16 or 32 bits wide, whole dwords of values are stored 
+            straight to memory without going through the scratch. This loop is simple enough for the compiler to vectorize.
+
+            @param values The values to write. Each must be in [0,(1<<bits)-1].
+            @param count The number of values to write.
+            @param bits The number of bits to write per value, in [1,32].
+
+            @see BitReader::ReadBitsArray
+         */
+
+        void WriteBitsArray( const uint32_t * values, int count, int bits )
+        {
+            yojimbo_assert( values );
+            yojimbo_assert( count >= 0 );
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( m_bitsWritten + count * bits <= m_numBits );
+
+            int i = 0;
+
+            if ( ( bits == 8 || bits == 16 || bits == 32 ) && ( m_bitsWritten % 32 ) == 0 )
+            {
+                FlushBits();
+
+                const int valuesPerWord = 32 / bits;
+                const int numWords = count / valuesPerWord;
+                const int numValues = numWords * valuesPerWord;
+
+                uint8_t * p = (uint8_t*) &m_data[m_wordIndex];
+
+                switch ( bits )
+                {
+                    case 8:
+                        for ( int j = 0; j < numValues; ++j )
+                        {
+                            yojimbo_assert( values[j] <= 0xFF );
+                            p[j] = uint8_t( values[j] );
+                        }
+                        break;
+
+                    case 16:
+                        for ( int j = 0; j < numValues; ++j )
+                        {
+                            yojimbo_assert( values[j] <= 0xFFFF );
+                            const uint16_t value = host_to_network( uint16_t( values[j] ) );
+                            memcpy( p + j * 2, &value, 2 );
+                        }
+                        break;
+
+                    default:
+                        for ( int j = 0; j < numValues; ++j )
+                        {
+                            const uint32_t value = host_to_network( values[j] );
+                            memcpy( p + j * 4, &value, 4 );
+                        }
+                        break;
+                }
+
+                m_wordIndex += numWords;
+                m_bitsWritten += numWords * 32;
+                m_scratch = 0;
+
+                i = numValues;
+            }
+
+            for ( ; i < count; ++i )
+                WriteBits( values[i], bits );
+        }
+
         /**
             Write an alignment to the bit stream, padding zeros so the bit index becomes is a multiple of 8.
 
@@ -175,6 +277,17 @@ namespace yojimbo
 
         void FlushBits()
         {
+#if YOJIMBO_BITPACKER_64BIT_WORDS
+            // The scratch may hold up to 63 bits. Flush it a dword at a time, so we never write past a buffer that isn't a multiple of 8 bytes.
+            while ( m_scratchBits > 0 )
+            {
+                yojimbo_assert( m_wordIndex < m_numWords );
+                m_data[m_wordIndex] = host_to_network( uint32_t( m_scratch & 0xFFFFFFFF ) );
+                m_scratch >>= 32;
+                m_scratchBits = m_scratchBits > 32 ? m_scratchBits - 32 : 0;
+                m_wordIndex++;                
+            }
+#else // #if YOJIMBO_BITPACKER_64BIT_WORDS
             if ( m_scratchBits != 0 )
             {
                 yojimbo_assert( m_scratchBits <= 32 );
@@ -184,6 +297,7 @@ namespace yojimbo
                 m_scratchBits = 0;
                 m_wordIndex++;                
             }
+#endif // #if YOJIMBO_BITPACKER_64BIT_WORDS
         }
 
         /**
@@ -249,6 +363,90 @@ namespace yojimbo
             return ( m_bitsWritten + 7 ) / 8;
         }
 
+        /**
+            A saved write position. See BitWriter::GetCheckpoint and BitWriter::Rollback.
+         */
+
+        struct Checkpoint
+        {
+            uint64_t scratch;                               ///< Scratch value at the checkpoint.
+            int scratchBits;                                ///< Number of bits in scratch at the checkpoint.
+            int wordIndex;                                  ///< Word index at the checkpoint.
+            int bitsWritten;                                ///< Number of bits written at the checkpoint.
+        };
+
+        /**
+            Save the current write position, so everything written after it can be discarded with BitWriter::Rollback.
+
+            @returns The checkpoint for the current write position.
+         */
+
+        Checkpoint GetCheckpoint() const
+        {
+            Checkpoint checkpoint;
+            checkpoint.scratch = m_scratch;
+            checkpoint.scratchBits = m_scratchBits;
+            checkpoint.wordIndex = m_wordIndex;
+            checkpoint.bitsWritten = m_bitsWritten;
+            return checkpoint;
+        }
+
+        /**
+            Discard everything written since the checkpoint.
+
+            Words flushed to memory after the checkpoint are simply overwritten by later writes.
+
+            @param checkpoint A checkpoint previously returned by BitWriter::GetCheckpoint on this bit writer.
+         */
+
+        void Rollback( const Checkpoint & checkpoint )
+        {
+            yojimbo_assert( checkpoint.bitsWritten <= m_bitsWritten );
+            m_scratch = checkpoint.scratch;
+            m_scratchBits = checkpoint.scratchBits;
+            m_wordIndex = checkpoint.wordIndex;
+            m_bitsWritten = checkpoint.bitsWritten;
+        }
+
+        /**
+            Overwrite bits that were already written.
+
+            Lets you reserve space for a value that isn't known until later, for example a count of entries that follow it.
+
+            @param bitIndex The bit index the value was originally written at. The value may not straddle a dword boundary.
+            @param value The value to write. Must be in [0,(1<<bits)-1].
+            @param bits The number of bits the value was originally written with, in [1,32].
+         */
+
+        void PatchBits( int bitIndex, uint32_t value, int bits )
+        {
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( bitIndex >= 0 );
+            yojimbo_assert( bitIndex + bits <= m_bitsWritten );
+            yojimbo_assert( ( bitIndex % 32 ) + bits <= 32 );
+            yojimbo_assert( uint64_t( value ) <= ( ( 1ULL << bits ) - 1 ) );
+
+            const int wordIndex = bitIndex / 32;
+            const int shift = bitIndex % 32;
+            const uint64_t mask = ( ( 1ULL << bits ) - 1 ) << shift;
+
+            if ( wordIndex < m_wordIndex )
+            {
+                uint64_t word = network_to_host( m_data[wordIndex] );
+                word = ( word & ~mask ) | ( uint64_t( value ) << shift );
+                m_data[wordIndex] = host_to_network( uint32_t( word & 0xFFFFFFFF ) );
+            }
+            else
+            {
+                // the bits are still in scratch, which starts at m_wordIndex
+                const int scratchShift = bitIndex - m_wordIndex * 32;
+                yojimbo_assert( scratchShift >= 0 && scratchShift + bits <= m_scratchBits );
+                const uint64_t scratchMask = ( ( 1ULL << bits ) - 1 ) << scratchShift;
+                m_scratch = ( m_scratch & ~scratchMask ) | ( uint64_t( value ) << scratchShift );
+            }
+        }
+
     private:
 
         uint32_t * m_data;                                  ///< The buffer we are writing to, as a uint32_t * because we're writing dwords at a time.
@@ -285,11 +483,7 @@ namespace yojimbo
             @see BitWriter
          */
 
-#ifndef NDEBUG
         BitReader( const void * data, int bytes ) : m_data( (const uint32_t*) data ), m_numBytes( bytes ), m_numWords( ( bytes + 3 ) / 4)
-#else // #ifndef NDEBUG
-        BitReader( const void * data, int bytes ) : m_data( (const uint32_t*) data ), m_numBytes( bytes )
-#endif // #ifndef NDEBUG
         {
             yojimbo_assert( data );
             m_numBits = m_numBytes * 8;
@@ -337,6 +531,41 @@ namespace yojimbo
 
             yojimbo_assert( m_scratchBits >= 0 && m_scratchBits <= 64 );
 
+#if YOJIMBO_BITPACKER_64BIT_WORDS
+
+            if ( m_scratchBits < bits )
+            {
+                // Fetch the next 64 bits, or the last dword at the very end of the buffer. The low bits of the output come from 
+                // what is left in scratch, the rest from the new word, which then becomes the scratch.
+
+                uint64_t next;
+                int nextBits;
+                if ( m_wordIndex + 1 < m_numWords )
+                {
+                    memcpy( &next, &m_data[m_wordIndex], 8 );
+                    next = network_to_host( next );
+                    nextBits = 64;
+                    m_wordIndex += 2;
+                }
+                else
+                {
+                    yojimbo_assert( m_wordIndex < m_numWords );
+                    next = network_to_host( m_data[m_wordIndex] );
+                    nextBits = 32;
+                    m_wordIndex++;
+                }
+
+                const uint32_t output = uint32_t( ( m_scratch | ( next << m_scratchBits ) ) & ( (uint64_t(1)<<bits) - 1 ) );
+
+                const int nextBitsUsed = bits - m_scratchBits;
+                m_scratch = next >> nextBitsUsed;
+                m_scratchBits = nextBits - nextBitsUsed;
+
+                return output;
+            }
+
+#else // #if YOJIMBO_BITPACKER_64BIT_WORDS
+
             if ( m_scratchBits < bits )
             {
                 yojimbo_assert( m_wordIndex < m_numWords );
@@ -345,6 +574,8 @@ namespace yojimbo
                 m_wordIndex++;
             }
 
+#endif // #if YOJIMBO_BITPACKER_64BIT_WORDS
+
             yojimbo_assert( m_scratchBits >= bits );
 
             const uint32_t output = m_scratch & ( (uint64_t(1)<<bits) - 1 );
@@ -355,6 +586,81 @@ namespace yojimbo
             return output;
         }
 
+        /**
+            Read an array of values with the same number of bits each.
+
+            Reads exactly the same bits as calling BitReader::ReadBits for each value. The caller checks for the whole array up front with BitReader::WouldReadPastEnd.
+
+            When the read position is dword aligned and the values are 8, 16 or 32 bits wide, whole dwords of values are loaded 
+            straight from memory without going through the scratch.
+
+            @param values The array to read values into. Each value read is in [0,(1<<bits)-1].
+            @param count The number of values to read.
+            @param bits The number of bits per value, in [1,32].
+
+            @see BitWriter::WriteBitsArray
+         */
+
+        void ReadBitsArray( uint32_t * values, int count, int bits )
+        {
+            yojimbo_assert( values );
+            yojimbo_assert( count >= 0 );
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( m_bitsRead + count * bits <= m_numBits );
+
+            int i = 0;
+
+            if ( ( bits == 8 || bits == 16 || bits == 32 ) && ( m_bitsRead % 32 ) == 0 )
+            {
+                // any whole dwords still in scratch are re-read straight from memory
+
+                m_wordIndex = m_bitsRead / 32;
+                m_scratch = 0;
+                m_scratchBits = 0;
+
+                const int valuesPerWord = 32 / bits;
+                const int numWords = count / valuesPerWord;
+                const int numValues = numWords * valuesPerWord;
+
+                const uint8_t * p = (const uint8_t*) &m_data[m_wordIndex];
+
+                switch ( bits )
+                {
+                    case 8:
+                        for ( int j = 0; j < numValues; ++j )
+                            values[j] = p[j];
+                        break;
+
+                    case 16:
+                        for ( int j = 0; j < numValues; ++j )
+                        {
+                            uint16_t value;
+                            memcpy( &value, p + j * 2, 2 );
+                            values[j] = network_to_host( value );
+                        }
+                        break;
+
+                    default:
+                        for ( int j = 0; j < numValues; ++j )
+                        {
+                            uint32_t value;
+                            memcpy( &value, p + j * 4, 4 );
+                            values[j] = network_to_host( value );
+                        }
+                        break;
+                }
+
+                m_wordIndex += numWords;
+                m_bitsRead += numWords * 32;
+
+                i = numValues;
+            }
+
+            for ( ; i < count; ++i )
+                values[i] = ReadBits( bits );
+        }
+
         /**
             Read an align.
 
@@ -408,6 +714,9 @@ namespace yojimbo
             if ( numWords > 0 )
             {
                 yojimbo_assert( ( m_bitsRead % 32 ) == 0 );
+                // any whole dwords still in scratch are re-read straight from memory
+                m_wordIndex = m_bitsRead / 32;
+                m_scratch = 0;
                 memcpy( data + headBytes, &m_data[m_wordIndex], numWords * 4 );
                 m_bitsRead += numWords * 32;
                 m_wordIndex += numWords;
@@ -427,6 +736,53 @@ namespace yojimbo
             yojimbo_assert( headBytes + numWords * 4 + tailBytes == bytes );
         }
 
+        /**
+            Skip over bytes in the bitpacked data and return a pointer to them, without copying.
+
+            The wire format is byte-for-byte identical to the buffer in memory once aligned, so written bytes can be referenced in place. The pointer is only valid while the buffer passed in to the bit reader is alive.
+
+            @param bytes The number of bytes to skip.
+
+            @returns Pointer to the bytes inside the buffer being read.
+
+            @see BitReader::ReadBytes
+         */
+
+        const uint8_t * SkipBytes( int bytes )
+        {
+            yojimbo_assert( GetAlignBits() == 0 );
+            yojimbo_assert( m_bitsRead + bytes * 8 <= m_numBits );
+
+            const uint8_t * data = ( (const uint8_t*) m_data ) + m_bitsRead / 8;
+
+            int headBytes = ( 4 - ( m_bitsRead % 32 ) / 8 ) % 4;
+            if ( headBytes > bytes )
+                headBytes = bytes;
+            for ( int i = 0; i < headBytes; ++i )
+                ReadBits( 8 );
+            if ( headBytes == bytes )
+                return data;
+
+            int numWords = ( bytes - headBytes ) / 4;
+            if ( numWords > 0 )
+            {
+                yojimbo_assert( ( m_bitsRead % 32 ) == 0 );
+                m_bitsRead += numWords * 32;
+                m_wordIndex = m_bitsRead / 32;
+                m_scratch = 0;
+                m_scratchBits = 0;
+            }
+
+            int tailBytes = bytes - headBytes - numWords * 4;
+            yojimbo_assert( tailBytes >= 0 && tailBytes < 4 );
+            for ( int i = 0; i < tailBytes; ++i )
+                ReadBits( 8 );
+
+            yojimbo_assert( GetAlignBits() == 0 );
+
+            return data;
+        }
+
         /**
             How many align bits would be read, if we were to read an align right now?
 
@@ -468,9 +824,7 @@ namespace yojimbo
         uint64_t m_scratch;                                 ///< The scratch value. New data is read in 32 bits at a top to the left of this buffer, and data is read off to the right.
         int m_numBits;                                      ///< Number of bits to read in the buffer. Of course, we can't *really* know this so it's actually m_numBytes * 8.
         int m_numBytes;                                     ///< Number of bytes to read in the buffer. We know this, and this is the non-rounded up version.
-#ifndef NDEBUG
         int m_numWords;                                     ///< Number of words to read in the buffer. This is rounded up to the next word if necessary.
-#endif // #ifndef NDEBUG
         int m_bitsRead;                                     ///< Number of bits read from the buffer so far.
         int m_scratchBits;                                  ///< Number of bits currently in the scratch value. If the user wants to read more bits than this, we have to go fetch another dword from memory.
         int m_wordIndex;                                    ///< Index of the next word to read from memory.
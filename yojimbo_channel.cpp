@@ -8,18 +8,50 @@
 #include "yojimbo_channel.h"
 #include "yojimbo_platform.h"
 #include "yojimbo_allocator.h"
+#include <float.h>
 
 namespace yojimbo
 {
+    void ChannelPacketData::SetScratch( Message ** messages, BlockFragmentData * fragments, uint8_t * fragmentData )
+    {
+        messageScratch = messages;
+        fragmentScratch = fragments;
+        fragmentDataScratch = fragmentData;
+    }
+
     void ChannelPacketData::Initialize()
     {
         channelIndex = 0;
         blockMessage = 0;
         messageFailedToSerialize = 0;
+        borrowedFragmentData = 0;
+        missingBaseline = 0;
+        blockResume = 0;
+        hasReceiveWindow = 0;
+        receiveWindowStart = 0;
+        limitsEpoch = 0;
+        receiveWindowSize = 0;
+        receiveMaxBlockSize = 0;
         message.numMessages = 0;
         initialized = 1;
     }
 
+    Message ** ChannelPacketData::AllocateMessages( MessageFactory & messageFactory, int numMessages )
+    {
+        if ( messageScratch )
+            return messageScratch;
+
+        return (Message**) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), sizeof( Message* ) * numMessages );
+    }
+
+    ChannelPacketData::BlockFragmentData * ChannelPacketData::AllocateFragments( MessageFactory & messageFactory, int numFragments )
+    {
+        if ( fragmentScratch )
+            return fragmentScratch;
+
+        return (BlockFragmentData*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), sizeof( BlockFragmentData ) * numFragments );
+    }
+
     void ChannelPacketData::Free( MessageFactory & messageFactory )
     {
         yojimbo_assert( initialized );
@@ -38,27 +70,334 @@ namespace yojimbo
                     }
                 }
 
-                YOJIMBO_FREE( allocator, message.messages );
+                if ( message.messages != messageScratch )
+                {
+                    YOJIMBO_FREE( allocator, message.messages );
+                }
             }
         }
         else
         {
-            if ( block.message )
+            if ( block.numFragmentsInPacket > 0 )
             {
-                messageFactory.ReleaseMessage( block.message );
-                block.message = NULL;
-            }
+                for ( int i = 0; i < block.numFragmentsInPacket; ++i )
+                {
+                    BlockFragmentData & fragment = block.fragments[i];
 
-            YOJIMBO_FREE( allocator, block.fragmentData );
+                    if ( fragment.message )
+                    {
+                        messageFactory.ReleaseMessage( fragment.message );
+                        fragment.message = NULL;
+                    }
+
+                    if ( !borrowedFragmentData )
+                    {
+                        YOJIMBO_FREE( allocator, fragment.fragmentData );
+                    }
+                }
+
+                if ( block.fragments != fragmentScratch )
+                {
+                    YOJIMBO_FREE( allocator, block.fragments );
+                }
+            }
         }
 
         initialized = 0;
     }
 
-    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket )
+    static bool WriteSerializedMessageVariant( Allocator & allocator, Message & message, void * context, uint8_t * buffer, int bytes, int paddingBits, int & numBits, int & numAligns )
+    {
+        WriteStream stream( allocator, buffer, bytes );
+        stream.SetContext( context );
+        if ( paddingBits > 0 )
+            stream.SerializeBits( 0, paddingBits );
+        if ( !message.SerializeInternal( stream ) || stream.IsOverflow() )
+            return false;
+        stream.Flush();
+        numBits = stream.GetBitsProcessed() - paddingBits;
+        numAligns = stream.GetNumAligns();
+        return true;
+    }
+
+    SerializedMessage * SerializedMessage::Create( Allocator & allocator, Message & message, void * context )
+    {
+        MeasureStream measureStream( allocator );
+        measureStream.SetContext( context );
+        if ( !message.SerializeInternal( measureStream ) )
+            return NULL;
+
+        // checks are 32 bits or more each, so a message that serializes any measures differently with them off
+
+        MeasureStream checksStream( allocator );
+        checksStream.SetContext( context );
+        checksStream.SetSerializeChecks( !measureStream.GetSerializeChecks() );
+        if ( !message.SerializeInternal( checksStream ) )
+            return NULL;
+
+        // measure counts 7 bits for each align, so with up to 7 padding bits in front any variant fits
+        const int variantBytes = ( ( measureStream.GetBitsProcessed() + 7 + 31 ) / 32 ) * 4;
+
+        SerializedMessage * serializedMessage = YOJIMBO_NEW( allocator, SerializedMessage );
+        if ( !serializedMessage )
+            return NULL;
+
+        serializedMessage->m_allocator = &allocator;
+        serializedMessage->m_variantBytes = variantBytes;
+        serializedMessage->m_numVariants = 1;
+        serializedMessage->m_serializeChecks = measureStream.GetSerializeChecks();
+        serializedMessage->m_hasChecks = checksStream.GetBitsProcessed() != measureStream.GetBitsProcessed();
+        serializedMessage->m_data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, variantBytes );
+
+        int numAligns = 0;
+        if ( !serializedMessage->m_data || !WriteSerializedMessageVariant( allocator, message, context, serializedMessage->m_data, variantBytes, 0, serializedMessage->m_numBits[0], numAligns ) )
+        {
+            serializedMessage->Release();
+            return NULL;
+        }
+
+        serializedMessage->m_maxBits = serializedMessage->m_numBits[0];
+
+        if ( numAligns == 0 )
+            return serializedMessage;
+
+        // the bits depend on where the message starts, so write it once for each bit position in a byte
+
+        uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, variantBytes * 8 );
+        if ( !data )
+        {
+            serializedMessage->Release();
+            return NULL;
+        }
+
+        memcpy( data, serializedMessage->m_data, variantBytes );
+        YOJIMBO_FREE( allocator, serializedMessage->m_data );
+        serializedMessage->m_data = data;
+        serializedMessage->m_numVariants = 8;
+
+        for ( int i = 1; i < 8; ++i )
+        {
+            if ( !WriteSerializedMessageVariant( allocator, message, context, data + i * variantBytes, variantBytes, i, serializedMessage->m_numBits[i], numAligns ) )
+            {
+                serializedMessage->Release();
+                return NULL;
+            }
+            if ( serializedMessage->m_numBits[i] > serializedMessage->m_maxBits )
+                serializedMessage->m_maxBits = serializedMessage->m_numBits[i];
+        }
+
+        return serializedMessage;
+    }
+
+    static bool SerializeMessage( ReadStream & stream, MessageFactory & messageFactory, Message * message )
+    {
+        // messages with a declared size check the end of the packet once, instead of once per field
+
+        const int maxBits = message->GetMaxBits();
+        if ( maxBits >= 0 && !stream.WouldReadPastEnd( maxBits ) )
+        {
+            const int startBits = stream.GetBitsProcessed();
+            UncheckedReadStream uncheckedStream( stream );
+            if ( !messageFactory.SerializeMessage( uncheckedStream, message ) )
+                return false;
+            if ( uncheckedStream.GetBitsProcessed() - startBits > maxBits )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: message type %d read %d bits, more than its max bits (%d)\n", message->GetType(), uncheckedStream.GetBitsProcessed() - startBits, maxBits );
+                return false;
+            }
+            uncheckedStream.Finish( stream );
+            return true;
+        }
+
+        return messageFactory.SerializeMessage( stream, message );
+    }
+
+    struct EncodedMessageHeader
+    {
+        void * context;                                                     ///< The stream context of the packet the message arrived in.
+        int numBits;                                                        ///< The length of the message body (bits).
+        int paddingBits;                                                    ///< Bits in front of the body, so it starts at the same bit position in a byte as it did in the packet. Keeps serialize_align working.
+        bool serializeChecks;                                               ///< The serialize checks setting of the packet the message arrived in.
+    };
+
+    static const int EncodedMessageHeaderBytes = ( sizeof( EncodedMessageHeader ) + 7 ) & ~7;
+
+    static int GetEncodedMessageBytes( int paddingBits, int numBits )
+    {
+        return ( ( paddingBits + numBits + 31 ) / 32 ) * 4;
+    }
+
+    bool MessageFactory::EncodeMessage( ReadStream & stream, Message * message, int numBits )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( !message->m_encodedData );
+        yojimbo_assert( numBits >= 0 );
+
+        const int paddingBits = stream.GetBitsProcessed() % 8;
+        const int dataBytes = yojimbo_max( GetEncodedMessageBytes( paddingBits, numBits ), 4 );
+
+        uint8_t * encodedData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, EncodedMessageHeaderBytes + dataBytes );
+        if ( !encodedData )
+            return false;
+
+        EncodedMessageHeader * header = (EncodedMessageHeader*) encodedData;
+        header->context = stream.GetContext();
+        header->numBits = numBits;
+        header->paddingBits = paddingBits;
+        header->serializeChecks = stream.GetSerializeChecks();
+
+        BitWriter writer( encodedData + EncodedMessageHeaderBytes, dataBytes );
+
+        if ( paddingBits > 0 )
+            writer.WriteBits( 0, paddingBits );
+
+        for ( int bits = numBits; bits > 0; bits -= 32 )
+        {
+            const int chunkBits = yojimbo_min( bits, 32 );
+            uint32_t value = 0;
+            if ( !stream.SerializeBits( value, chunkBits ) )
+            {
+                YOJIMBO_FREE( *m_allocator, encodedData );
+                return false;
+            }
+            writer.WriteBits( value, chunkBits );
+        }
+
+        writer.FlushBits();
+
+        message->m_encodedData = encodedData;
+
+        return true;
+    }
+
+    bool MessageFactory::DecodeMessage( Message * message )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( message->m_encodedData );
+
+        const EncodedMessageHeader * header = (const EncodedMessageHeader*) message->m_encodedData;
+        const int dataBytes = yojimbo_max( GetEncodedMessageBytes( header->paddingBits, header->numBits ), 4 );
+
+        ReadStream stream( *m_allocator, message->m_encodedData + EncodedMessageHeaderBytes, dataBytes );
+        stream.SetContext( header->context );
+        stream.SetSerializeChecks( header->serializeChecks );
+
+        uint32_t padding = 0;
+        if ( header->paddingBits > 0 )
+            stream.SerializeBits( padding, header->paddingBits );
+
+        const bool result = yojimbo::SerializeMessage( stream, *this, message ) && stream.GetBitsProcessed() - header->paddingBits == header->numBits;
+
+        YOJIMBO_FREE( *m_allocator, message->m_encodedData );
+
+        return result;
+    }
+
+    static bool SerializeMessage( WriteStream & stream, MessageFactory & messageFactory, Message * message )
+    {
+        SerializedMessage * serializedMessage = message->GetSerializedMessage();
+        if ( serializedMessage && serializedMessage->CanWrite( stream ) )
+            return serializedMessage->Write( stream );
+        return messageFactory.SerializeMessage( stream, message );
+    }
+
+    static bool SerializeMessage( MeasureStream & stream, MessageFactory & messageFactory, Message * message )
+    {
+        SerializedMessage * serializedMessage = message->GetSerializedMessage();
+        if ( serializedMessage && serializedMessage->CanWrite( stream ) )
+            return serializedMessage->Write( stream );
+        const int maxBits = message->GetMaxBits();
+        if ( maxBits >= 0 )
+        {
+            stream.AddBits( maxBits );
+            return true;
+        }
+        return messageFactory.SerializeMessage( stream, message );
+    }
+
+    template <typename Stream> bool SerializeMessageType( Stream & stream, const MessageFactory & messageFactory, int & messageType )
     {
+        const int numCommonTypes = messageFactory.GetNumCommonMessageTypes();
+
+        if ( numCommonTypes > 0 )
+        {
+            // the common type ranked r is r zero bits then a one. numCommonTypes zero bits escape to the full type
+
+            const int rank = Stream::IsWriting ? messageFactory.GetCommonMessageTypeRank( messageType ) : -1;
+
+            for ( int i = 0; i < numCommonTypes; ++i )
+            {
+                bool common = Stream::IsWriting && rank == i;
+                serialize_bool( stream, common );
+                if ( common )
+                {
+                    if ( Stream::IsReading )
+                        messageType = messageFactory.GetCommonMessageType( i );
+                    return true;
+                }
+            }
+        }
+
         const int maxMessageType = messageFactory.GetNumTypes() - 1;
 
+        if ( maxMessageType > 0 )
+        {
+            serialize_int( stream, messageType, 0, maxMessageType );
+        }
+        else
+        {
+            messageType = 0;
+        }
+
+        return true;
+    }
+
+    template <typename Stream> void PatchMessageLength( Stream & stream, int bitIndex, uint32_t length, int bits )
+    {
+        (void) stream;
+        (void) bitIndex;
+        (void) length;
+        (void) bits;
+    }
+
+    static void PatchMessageLength( WriteStream & stream, int bitIndex, uint32_t length, int bits )
+    {
+        // the length may straddle a word boundary, and bits are patched one word at a time
+
+        const int firstBits = yojimbo_min( bits, 32 - bitIndex % 32 );
+        stream.PatchBits( bitIndex, uint32_t( length & ( ( 1ULL << firstBits ) - 1 ) ), firstBits );
+        if ( bits > firstBits )
+            stream.PatchBits( bitIndex + firstBits, length >> firstBits, bits - firstBits );
+    }
+
+    template <typename Stream> bool EncodeMessageBody( Stream & stream, MessageFactory & messageFactory, Message * message, int numBits )
+    {
+        (void) stream;
+        (void) messageFactory;
+        (void) message;
+        (void) numBits;
+        return false;
+    }
+
+    static bool EncodeMessageBody( ReadStream & stream, MessageFactory & messageFactory, Message * message, int numBits )
+    {
+        return messageFactory.EncodeMessage( stream, message, numBits );
+    }
+
+    template <typename Stream> bool SkipMessageBody( Stream & stream, uint32_t bits )
+    {
+        while ( bits > 0 )
+        {
+            const int chunkBits = int( yojimbo_min( bits, uint32_t( 32 ) ) );
+            uint32_t value = 0;
+            serialize_bits( stream, value, chunkBits );
+            bits -= chunkBits;
+        }
+        return true;
+    }
+
+    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket, bool placeholders, int messageLengthBits, bool lazyDecode, ReliableOrderedChannel * channel )
+    {
         bool hasMessages = Stream::IsWriting && numMessages != 0;
 
         serialize_bool( stream, hasMessages );
@@ -74,6 +413,8 @@ namespace yojimbo
             memset( messageTypes, 0, sizeof( int ) * numMessages );
             memset( messageIds, 0, sizeof( uint16_t ) * numMessages );
 
+            bool allocatedMessages = false;
+
             if ( Stream::IsWriting )
             {
                 yojimbo_assert( messages );
@@ -87,9 +428,14 @@ namespace yojimbo
             }
             else
             {
-                Allocator & allocator = messageFactory.GetAllocator();
+                // messages may already point to scratch memory provided by the connection
 
-                messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+                if ( !messages )
+                {
+                    Allocator & allocator = messageFactory.GetAllocator();
+                    messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+                    allocatedMessages = true;
+                }
 
                 for ( int i = 0; i < numMessages; ++i )
                 {
@@ -102,37 +448,123 @@ namespace yojimbo
             for ( int i = 1; i < numMessages; ++i )
                 serialize_sequence_relative( stream, messageIds[i-1], messageIds[i] );
 
+            int numSkipped = 0;
+
             for ( int i = 0; i < numMessages; ++i )
             {
-                if ( maxMessageType > 0 )
-                {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
-                }
-                else
+                if ( !SerializeMessageType( stream, messageFactory, messageTypes[i] ) )
+                    return false;
+
+                // with a length prefix, messages that were already received are skipped over without being created or read
+
+                if ( Stream::IsReading && messageLengthBits > 0 && channel && channel->SkipReceivedMessage( messageIds[i] ) )
                 {
-                    messageTypes[i] = 0;
+                    bool superseded = false;
+
+                    if ( placeholders )
+                        serialize_bool( stream, superseded );
+
+                    if ( !superseded )
+                    {
+                        uint32_t length = 0;
+                        serialize_bits( stream, length, messageLengthBits );
+                        if ( !SkipMessageBody( stream, length ) )
+                            return false;
+                    }
+
+                    numSkipped++;
+                    continue;
                 }
 
                 if ( Stream::IsReading )
                 {
-                    messages[i] = messageFactory.CreateMessage( messageTypes[i] );
+                    messages[i-numSkipped] = messageFactory.CreateMessage( messageTypes[i] );
 
-                    if ( !messages[i] )
+                    if ( !messages[i-numSkipped] )
                     {
                         yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create message of type %d (SerializeOrderedMessages)\n", messageTypes[i] );
                         return false;
                     }
 
-                    messages[i]->SetId( messageIds[i] );
+                    messages[i-numSkipped]->SetId( messageIds[i] );
                 }
 
-                yojimbo_assert( messages[i] );
+                Message * message = messages[i-numSkipped];
+
+                yojimbo_assert( message );
+
+                // superseded and expired messages keep their place in the message order, but their contents aren't sent
+
+                if ( placeholders )
+                {
+                    bool superseded = Stream::IsWriting && message->IsSuperseded();
+
+                    serialize_bool( stream, superseded );
+
+                    if ( superseded )
+                    {
+                        if ( Stream::IsReading )
+                            message->SetSuperseded();
+                        continue;
+                    }
+                }
+
+                uint32_t length = 0;
+
+                const int lengthBitIndex = stream.GetBitsProcessed();
+
+                if ( messageLengthBits > 0 )
+                    serialize_bits( stream, length, messageLengthBits );
+
+                // lazy decode copies the body out as is, and the channel reads it on ReceiveMessage
+
+                if ( Stream::IsReading && lazyDecode && messageLengthBits > 0 )
+                {
+                    if ( !EncodeMessageBody( stream, messageFactory, message, length ) )
+                    {
+                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to copy body of message type %d (SerializeOrderedMessages)\n", messageTypes[i] );
+                        return false;
+                    }
+                    continue;
+                }
+
+                const int bodyBitIndex = stream.GetBitsProcessed();
 
-                if ( !messages[i]->SerializeInternal( stream ) )
+                if ( !SerializeMessage( stream, messageFactory, message ) )
                 {
                     yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize message of type %d (SerializeOrderedMessages)\n", messageTypes[i] );
                     return false;
                 }
+
+                if ( messageLengthBits > 0 )
+                {
+                    const uint32_t bodyBits = uint32_t( stream.GetBitsProcessed() - bodyBitIndex );
+
+                    if ( Stream::IsWriting )
+                    {
+                        if ( uint64_t( bodyBits ) > ( ( 1ULL << messageLengthBits ) - 1 ) )
+                        {
+                            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: message of type %d is %d bits, too long for its %d bit length prefix (SerializeOrderedMessages)\n", messageTypes[i], bodyBits, messageLengthBits );
+                            return false;
+                        }
+                        PatchMessageLength( stream, lengthBitIndex, bodyBits, messageLengthBits );
+                    }
+                    else if ( bodyBits != length )
+                    {
+                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: message of type %d read %d bits, but its length prefix says %d (SerializeOrderedMessages)\n", messageTypes[i], bodyBits, length );
+                        return false;
+                    }
+                }
+            }
+
+            numMessages -= numSkipped;
+
+            // ChannelPacketData::Free only frees the message array when there are messages in it
+
+            if ( numMessages == 0 && allocatedMessages )
+            {
+                YOJIMBO_FREE( messageFactory.GetAllocator(), messages );
+                messages = NULL;
             }
         }
 
@@ -168,10 +600,8 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool SerializeUnorderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket, int maxBlockSize )
+    template <typename Stream> bool SerializeUnorderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket, int maxBlockSize, bool messageIds, bool messageTicks )
     {
-        const int maxMessageType = messageFactory.GetNumTypes() - 1;
-
         bool hasMessages = Stream::IsWriting && numMessages != 0;
 
         serialize_bool( stream, hasMessages );
@@ -196,25 +626,45 @@ namespace yojimbo
             }
             else
             {
-                Allocator & allocator = messageFactory.GetAllocator();
+                // messages may already point to scratch memory provided by the connection
 
-                messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+                if ( !messages )
+                {
+                    Allocator & allocator = messageFactory.GetAllocator();
+                    messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+                }
 
                 for ( int i = 0; i < numMessages; ++i )
                     messages[i] = NULL;
             }
 
-            for ( int i = 0; i < numMessages; ++i )
+            // message ids are only sent with ChannelConfig::redundantMessages, so the receiver can drop copies
+
+            uint16_t * ids = NULL;
+
+            if ( messageIds )
             {
-                if ( maxMessageType > 0 )
-                {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
-                }
-                else
+                ids = (uint16_t*) alloca( sizeof( uint16_t ) * numMessages );
+
+                memset( ids, 0, sizeof( uint16_t ) * numMessages );
+
+                if ( Stream::IsWriting )
                 {
-                    messageTypes[i] = 0;
+                    for ( int i = 0; i < numMessages; ++i )
+                        ids[i] = messages[i]->GetId();
                 }
 
+                serialize_bits( stream, ids[0], 16 );
+
+                for ( int i = 1; i < numMessages; ++i )
+                    serialize_sequence_relative( stream, ids[i-1], ids[i] );
+            }
+
+            for ( int i = 0; i < numMessages; ++i )
+            {
+                if ( !SerializeMessageType( stream, messageFactory, messageTypes[i] ) )
+                    return false;
+
                 if ( Stream::IsReading )
                 {
                     messages[i] = messageFactory.CreateMessage( messageTypes[i] );
@@ -224,11 +674,24 @@ namespace yojimbo
                         yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
                         return false;
                     }
+
+                    if ( ids )
+                        messages[i]->SetId( ids[i] );
                 }
 
                 yojimbo_assert( messages[i] );
 
-                if ( !messages[i]->SerializeInternal( stream ) )
+                // sender ticks are only sent with ChannelConfig::jitterBuffer
+
+                if ( messageTicks )
+                {
+                    uint32_t tick = Stream::IsWriting ? messages[i]->GetTick() : 0;
+                    serialize_uint32( stream, tick );
+                    if ( Stream::IsReading )
+                        messages[i]->SetTick( tick );
+                }
+
+                if ( !SerializeMessage( stream, messageFactory, messages[i] ) )
                 {
                     yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
                     return false;
@@ -249,12 +712,13 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockData & block, const ChannelConfig & channelConfig )
+    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockFragmentData & block, const ChannelConfig & channelConfig )
     {
-        const int maxMessageType = messageFactory.GetNumTypes() - 1;
-
         serialize_bits( stream, block.messageId, 16 );
 
+        if ( channelConfig.resumableBlocks )
+            serialize_uint64( stream, block.blockHash );
+
         if ( channelConfig.GetMaxFragmentsPerBlock() > 1 )
         {
             serialize_int( stream, block.numFragments, 1, channelConfig.GetMaxFragmentsPerBlock() );
@@ -265,7 +729,38 @@ namespace yojimbo
                 block.numFragments = 1;
         }
 
-        if ( block.numFragments > 1 )
+        if ( channelConfig.fragmentParityGroupSize > 0 )
+        {
+            serialize_bool( stream, block.parity );
+        }
+        else
+        {
+            if ( Stream::IsReading )
+                block.parity = false;
+        }
+
+        if ( block.parity )
+        {
+            // parity fragments carry the group index in place of the fragment id
+
+            const int numParityGroups = channelConfig.GetNumParityGroups( block.numFragments );
+
+            if ( numParityGroups <= 0 )
+                return false;
+
+            if ( numParityGroups > 1 )
+            {
+                serialize_int( stream, block.fragmentId, 0, numParityGroups - 1 );
+            }
+            else
+            {
+                if ( Stream::IsReading )
+                    block.fragmentId = 0;
+            }
+
+            serialize_bits( stream, block.paritySizes, 16 );
+        }
+        else if ( block.numFragments > 1 )
         {
             serialize_int( stream, block.fragmentId, 0, block.numFragments - 1 );
         }
@@ -277,7 +772,7 @@ namespace yojimbo
 
         serialize_int( stream, block.fragmentSize, 1, channelConfig.fragmentSize );
 
-        if ( Stream::IsReading )
+        if ( Stream::IsReading && !block.fragmentData )
         {
             block.fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), block.fragmentSize );
 
@@ -290,13 +785,26 @@ namespace yojimbo
 
         serialize_bytes( stream, block.fragmentData, block.fragmentSize );
 
-        if ( block.fragmentId == 0 )
+        if ( block.fragmentId == 0 && !block.parity )
         {
             // block message
 
-            serialize_int( stream, block.messageType, 0, maxMessageType );
+            if ( !SerializeMessageType( stream, messageFactory, block.messageType ) )
+                return false;
 
-            if ( Stream::IsReading )
+            if ( channelConfig.compressBlocks )
+            {
+                bool compressed = Stream::IsWriting && block.uncompressedSize > 0;
+
+                serialize_bool( stream, compressed );
+
+                if ( compressed )
+                    serialize_int( stream, block.uncompressedSize, 1, channelConfig.maxBlockSize );
+                else if ( Stream::IsReading )
+                    block.uncompressedSize = 0;
+            }
+
+            if ( Stream::IsReading )
             {
                 Message * message = messageFactory.CreateMessage( block.messageType );
 
@@ -317,7 +825,7 @@ namespace yojimbo
 
             yojimbo_assert( block.message );
 
-            if ( !block.message->SerializeInternal( stream ) )
+            if ( !SerializeMessage( stream, messageFactory, block.message ) )
             {
                 yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize block message of type %d (SerializeBlockFragment)\n", block.messageType );
                 return false;
@@ -332,7 +840,116 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool ChannelPacketData::Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    template <typename Stream> bool SerializeBlockResume( Stream & stream, ChannelPacketData::BlockResumeData & resume, const ChannelConfig & channelConfig )
+    {
+        serialize_bits( stream, resume.messageId, 16 );
+
+        serialize_uint64( stream, resume.blockHash );
+
+        const int maxFragmentsPerBlock = channelConfig.GetMaxFragmentsPerBlock();
+
+        if ( maxFragmentsPerBlock > MaxResumeFragmentsPerPacket )
+        {
+            serialize_int( stream, resume.firstFragment, 0, maxFragmentsPerBlock - 1 );
+        }
+        else
+        {
+            if ( Stream::IsReading )
+                resume.firstFragment = 0;
+        }
+
+        serialize_int( stream, resume.numFragments, 1, MaxResumeFragmentsPerPacket );
+
+        const int numWords = ( resume.numFragments + 31 ) / 32;
+
+        for ( int i = 0; i < numWords; ++i )
+            serialize_bits( stream, resume.receivedFragments[i], 32 );
+
+        return true;
+    }
+
+    template <typename Stream> bool SerializeSnapshotMessage( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, const SnapshotChannel * channel, bool & missingBaseline )
+    {
+        // snapshot channel packet data always carries exactly one message
+
+        int messageType = 0;
+        bool hasBaseline = false;
+        uint32_t baselineSequence = 0;
+
+        if ( Stream::IsWriting )
+        {
+            yojimbo_assert( numMessages == 1 );
+            yojimbo_assert( messages && messages[0] );
+            const SnapshotMessage * snapshot = (const SnapshotMessage*) messages[0];
+            messageType = snapshot->GetType();
+            hasBaseline = snapshot->GetBaseline() != NULL;
+            baselineSequence = snapshot->GetBaselineSequence();
+        }
+        else
+        {
+            // messages may already point to scratch memory provided by the connection
+
+            numMessages = 1;
+            if ( !messages )
+                messages = (Message**) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), sizeof( Message* ) );
+            if ( !messages )
+            {
+                numMessages = 0;
+                return false;
+            }
+            messages[0] = NULL;
+        }
+
+        if ( !SerializeMessageType( stream, messageFactory, messageType ) )
+            return false;
+
+        serialize_bool( stream, hasBaseline );
+
+        if ( hasBaseline )
+            serialize_bits( stream, baselineSequence, 16 );
+
+        if ( Stream::IsReading )
+        {
+            const SnapshotMessage * baseline = NULL;
+
+            if ( hasBaseline )
+            {
+                baseline = channel ? channel->FindReceivedBaseline( uint16_t( baselineSequence ) ) : NULL;
+                if ( !baseline || baseline->GetType() != messageType )
+                {
+                    missingBaseline = true;
+                    return false;
+                }
+            }
+
+            messages[0] = messageFactory.CreateMessage( messageType );
+
+            if ( !messages[0] )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create message type %d (SerializeSnapshotMessage)\n", messageType );
+                return false;
+            }
+
+            ( (SnapshotMessage*) messages[0] )->SetBaseline( baseline, uint16_t( baselineSequence ) );
+        }
+
+        const bool result = messageFactory.SerializeMessage( stream, messages[0] );
+
+        // the baseline is only held while the message is being read
+
+        if ( Stream::IsReading )
+            ( (SnapshotMessage*) messages[0] )->SetBaseline( NULL, uint16_t( baselineSequence ) );
+
+        if ( !result )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize message type %d (SerializeSnapshotMessage)\n", messageType );
+            return false;
+        }
+
+        return true;
+    }
+
+    template <typename Stream> bool ChannelPacketData::Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels, bool compactHeader )
     {
         yojimbo_assert( initialized );
 
@@ -340,22 +957,66 @@ namespace yojimbo
         int startBits = stream.GetBitsProcessed();
 #endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
 
-        if ( numChannels > 1 )
+        if ( compactHeader )
+            yojimbo_assert( (int) channelIndex < numChannels );
+        else if ( numChannels > 1 )
             serialize_int( stream, channelIndex, 0, numChannels - 1 );
         else
             channelIndex = 0;
 
         const ChannelConfig & channelConfig = channelConfigs[channelIndex];
 
-        serialize_bool( stream, blockMessage );
+        if ( !compactHeader || ( !channelConfig.disableBlocks && channelConfig.type != CHANNEL_TYPE_SNAPSHOT ) )
+            serialize_bool( stream, blockMessage );
+        else if ( Stream::IsReading )
+            blockMessage = 0;
+
+        if ( channelConfig.resumableBlocks && channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED && !channelConfig.disableBlocks )
+        {
+            bool hasBlockResume = Stream::IsWriting && blockResume;
+
+            serialize_bool( stream, hasBlockResume );
+
+            blockResume = hasBlockResume;
+
+            if ( blockResume && !SerializeBlockResume( stream, resume, channelConfig ) )
+                return false;
+        }
+
+        if ( channelConfig.flowControl && ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED || channelConfig.type == CHANNEL_TYPE_RELIABLE_UNORDERED ) )
+        {
+            bool receiveWindow = Stream::IsWriting && hasReceiveWindow;
+
+            serialize_bool( stream, receiveWindow );
+
+            hasReceiveWindow = receiveWindow;
+
+            if ( receiveWindow )
+            {
+                serialize_bits( stream, receiveWindowStart, 16 );
+
+                if ( channelConfig.runtimeLimits )
+                {
+                    serialize_bits( stream, limitsEpoch, 16 );
+                    serialize_int( stream, receiveWindowSize, 0, channelConfig.receiveQueueSize );
+                    if ( !channelConfig.disableBlocks )
+                        serialize_int( stream, receiveMaxBlockSize, 0, channelConfig.maxBlockSize );
+                }
+            }
+        }
 
         if ( !blockMessage )
         {
+            if ( Stream::IsReading )
+                message.messages = messageScratch;
+
             switch ( channelConfig.type )
             {
                 case CHANNEL_TYPE_RELIABLE_ORDERED:
+                case CHANNEL_TYPE_RELIABLE_UNORDERED:
                 {
-                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket ) )
+                    ReliableOrderedChannel * channel = channels ? (ReliableOrderedChannel*) channels[channelIndex] : NULL;
+                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.SendsMessagePlaceholders(), channelConfig.messageLengthBits, channelConfig.lazyDecode && !stream.GetStringTable(), channel ) )
                     {
                         messageFailedToSerialize = 1;
                         return true;
@@ -364,9 +1025,28 @@ namespace yojimbo
                 break;
 
                 case CHANNEL_TYPE_UNRELIABLE_UNORDERED:
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:
+                {
+                    if ( !SerializeUnorderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.maxBlockSize, channelConfig.redundantMessages > 0, channelConfig.jitterBuffer ) )
+                    {
+                        messageFailedToSerialize = 1;
+                        return true;
+                    }
+                }
+                break;
+
+                case CHANNEL_TYPE_SNAPSHOT:
                 {
-                    if ( !SerializeUnorderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.maxBlockSize ) )
+                    const SnapshotChannel * channel = channels ? (const SnapshotChannel*) channels[channelIndex] : NULL;
+                    bool baselineNotFound = false;
+                    if ( !SerializeSnapshotMessage( stream, messageFactory, message.numMessages, message.messages, channel, baselineNotFound ) )
                     {
+                        // without the baseline the rest of the packet can't be read, so the whole packet is dropped
+                        if ( baselineNotFound )
+                        {
+                            missingBaseline = 1;
+                            return false;
+                        }
                         messageFailedToSerialize = 1;
                         return true;
                     }
@@ -383,34 +1063,94 @@ namespace yojimbo
         }
         else
         {
-            if ( channelConfig.disableBlocks )
+            if ( channelConfig.disableBlocks || channelConfig.type == CHANNEL_TYPE_SNAPSHOT )
                 return false;
 
-            if ( !SerializeBlockFragment( stream, messageFactory, block, channelConfig ) )
-                return false;
+            if ( channelConfig.maxFragmentsPerPacket > 1 )
+            {
+                serialize_int( stream, block.numFragmentsInPacket, 1, channelConfig.maxFragmentsPerPacket );
+            }
+            else
+            {
+                if ( Stream::IsReading )
+                    block.numFragmentsInPacket = 1;
+            }
+
+            if ( Stream::IsReading )
+            {
+                block.fragments = AllocateFragments( messageFactory, block.numFragmentsInPacket );
+
+                if ( !block.fragments )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate block fragments (ChannelPacketData)\n" );
+                    block.numFragmentsInPacket = 0;
+                    return false;
+                }
+
+                memset( block.fragments, 0, sizeof( BlockFragmentData ) * block.numFragmentsInPacket );
+
+                // read fragment data straight into scratch memory when the connection provides it
+
+                if ( fragmentDataScratch )
+                {
+                    borrowedFragmentData = 1;
+                    for ( int i = 0; i < block.numFragmentsInPacket; ++i )
+                        block.fragments[i].fragmentData = fragmentDataScratch + i * channelConfig.fragmentSize;
+                }
+            }
+
+            for ( int i = 0; i < block.numFragmentsInPacket; ++i )
+            {
+                if ( !SerializeBlockFragment( stream, messageFactory, block.fragments[i], channelConfig ) )
+                    return false;
+            }
         }
 
         return true;
     }
 
-    bool ChannelPacketData::SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    bool ChannelPacketData::SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels, bool compactHeader )
+    {
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, channels, compactHeader );
+    }
+
+    bool ChannelPacketData::SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels, bool compactHeader )
     {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, channels, compactHeader );
     }
 
-    bool ChannelPacketData::SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    bool ChannelPacketData::SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels, bool compactHeader )
     {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, channels, compactHeader );
     }
 
-    bool ChannelPacketData::SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    static int MeasureMessage( Message * message, MessageFactory & messageFactory )
     {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
+        if ( message->GetSerializedMessage() )
+            return message->GetSerializedMessage()->GetMaxBits();
+
+        const int maxBits = message->GetMaxBits();
+
+#if YOJIMBO_DEBUG_MESSAGE_BUDGET
+        if ( maxBits >= 0 )
+        {
+            MeasureStream measureStream( messageFactory.GetAllocator() );
+            messageFactory.SerializeMessage( measureStream, message );
+            yojimbo_assert( measureStream.GetBitsProcessed() <= maxBits );
+        }
+#endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
+
+        if ( maxBits >= 0 )
+            return maxBits;
+
+        MeasureStream measureStream( messageFactory.GetAllocator() );
+        messageFactory.SerializeMessage( measureStream, message );
+        return measureStream.GetBitsProcessed();
     }
 
     // ------------------------------------------------------------------------------------
 
-    Channel::Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time ) : m_config( config )
+    Channel::Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time ) : m_config( config ), m_time( time )
     {
         yojimbo_assert( channelIndex >= 0 );
         yojimbo_assert( channelIndex < MaxChannels );
@@ -418,10 +1158,22 @@ namespace yojimbo
         m_allocator = &allocator;
         m_messageFactory = &messageFactory;
         m_errorLevel = CHANNEL_ERROR_NONE;
-        m_time = time;
+        m_errorMask = NULL;
+        m_latencyHistograms = NULL;
+        if ( m_config.latencyHistograms )
+        {
+            m_latencyHistograms = (LatencyHistogram*) YOJIMBO_ALLOCATE( allocator, sizeof( LatencyHistogram ) * CHANNEL_LATENCY_NUM_HISTOGRAMS );
+            yojimbo_assert( m_latencyHistograms );
+        }
+        m_limits = ChannelLimits( config );
         ResetCounters();
     }
 
+    Channel::~Channel()
+    {
+        YOJIMBO_FREE( *m_allocator, m_latencyHistograms );
+    }
+
     uint64_t Channel::GetCounter( int index ) const
     {
         yojimbo_assert( index >= 0 );
@@ -432,6 +1184,18 @@ namespace yojimbo
     void Channel::ResetCounters()
     { 
         memset( m_counters, 0, sizeof( m_counters ) ); 
+        if ( m_latencyHistograms )
+        {
+            for ( int i = 0; i < CHANNEL_LATENCY_NUM_HISTOGRAMS; ++i )
+                m_latencyHistograms[i].Clear();
+        }
+    }
+
+    const LatencyHistogram * Channel::GetLatencyHistogram( int index ) const
+    {
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < CHANNEL_LATENCY_NUM_HISTOGRAMS );
+        return m_latencyHistograms ? &m_latencyHistograms[index] : NULL;
     }
 
     int Channel::GetChannelIndex() const 
@@ -446,6 +1210,13 @@ namespace yojimbo
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "channel went into error state: %s\n", GetChannelErrorString( errorLevel ) );
         }
         m_errorLevel = errorLevel;
+        if ( m_errorMask )
+        {
+            if ( errorLevel != CHANNEL_ERROR_NONE )
+                *m_errorMask |= uint64_t(1) << m_channelIndex;
+            else
+                *m_errorMask &= ~( uint64_t(1) << m_channelIndex );
+        }
     }
 
     ChannelErrorLevel Channel::GetErrorLevel() const
@@ -453,36 +1224,131 @@ namespace yojimbo
         return m_errorLevel;
     }
 
+    int Channel::SendMessages( Message ** messages, int numMessages )
+    {
+        yojimbo_assert( messages || numMessages == 0 );
+        int numSent = 0;
+        while ( numSent < numMessages && CanSendMessage() )
+        {
+            SendMessage( messages[numSent] );
+            numSent++;
+        }
+        return numSent;
+    }
+
+    int Channel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+        int numReceived = 0;
+        while ( numReceived < maxMessages )
+        {
+            Message * message = ReceiveMessage();
+            if ( !message )
+                break;
+            messages[numReceived++] = message;
+        }
+        return numReceived;
+    }
+
+    double Channel::GetNextSendTime() const
+    {
+        return HasDataToSend() ? m_time : DBL_MAX;
+    }
+
+    int Channel::GetUnsentBits() const
+    {
+        return HasDataToSend() ? -1 : 0;
+    }
+
+    void Channel::UpdateRoundTripTime( double rtt, double rttVariance )
+    {
+        (void) rtt;
+        (void) rttVariance;
+    }
+
+    void Channel::SetLimits( const ChannelLimits & limits )
+    {
+        yojimbo_assert( limits.sendQueueSize >= 1 && limits.sendQueueSize <= m_config.sendQueueSize );
+        yojimbo_assert( limits.receiveQueueSize >= 1 && limits.receiveQueueSize <= m_config.receiveQueueSize );
+        yojimbo_assert( ( 65536 % limits.sendQueueSize ) == 0 );
+        yojimbo_assert( ( 65536 % limits.receiveQueueSize ) == 0 );
+        yojimbo_assert( limits.maxBlockSize >= 1 && limits.maxBlockSize <= m_config.maxBlockSize );
+        yojimbo_assert( m_config.packetBudget <= 0 || ( limits.packetBudget > 0 && limits.packetBudget <= m_config.packetBudget ) );
+        yojimbo_assert( limits.maxMessagesPerPacket >= 1 && limits.maxMessagesPerPacket <= m_config.maxMessagesPerPacket );
+
+        m_limits.packetBudget = limits.packetBudget;
+        m_limits.maxMessagesPerPacket = limits.maxMessagesPerPacket;
+    }
+
     // ------------------------------------------------------------------------------------
 
-    ReliableOrderedChannel::ReliableOrderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time ) : Channel( allocator, messageFactory, config, channelIndex, time )
+    ReliableOrderedChannel::ReliableOrderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time ) : Channel( allocator, messageFactory, config, channelIndex, time )
     {
-        yojimbo_assert( config.type == CHANNEL_TYPE_RELIABLE_ORDERED );
+        yojimbo_assert( config.type == CHANNEL_TYPE_RELIABLE_ORDERED || config.type == CHANNEL_TYPE_RELIABLE_UNORDERED );
 
         yojimbo_assert( ( 65536 % config.sendQueueSize ) == 0 );
         yojimbo_assert( ( 65536 % config.receiveQueueSize ) == 0 );
         yojimbo_assert( ( 65536 % config.sentPacketBufferSize ) == 0 );
+        yojimbo_assert( config.sendQueueSize <= MaxSequenceWindow );
+        yojimbo_assert( config.receiveQueueSize <= MaxSequenceWindow );
+        yojimbo_assert( config.sentPacketBufferSize <= MaxSequenceWindow );
+        yojimbo_assert( config.messageLengthBits >= 0 && config.messageLengthBits <= 32 );
+        yojimbo_assert( !config.runtimeLimits || config.flowControl );
 
         m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
         
         m_messageSendQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, *m_allocator, m_config.sendQueueSize );
         
         m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, *m_allocator, m_config.receiveQueueSize );
+
+        m_messageDeliveryQueue = NULL;
+
+        if ( config.type == CHANNEL_TYPE_RELIABLE_UNORDERED )
+            m_messageDeliveryQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.receiveQueueSize );
         
-        m_sentPacketMessageIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_config.maxMessagesPerPacket * m_config.sentPacketBufferSize );
+        m_sentPacketIdStride = m_config.maxMessagesPerPacket;
+
+        if ( !config.disableBlocks )
+            m_sentPacketIdStride = yojimbo_max( m_sentPacketIdStride, 3 * m_config.maxFragmentsPerPacket );
+
+        m_sentPacketIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_sentPacketIdStride * m_config.sentPacketBufferSize );
+
+        m_parityScratch = ( !config.disableBlocks && config.fragmentParityGroupSize > 0 ) ? (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, config.fragmentSize ) : NULL;
 
         if ( !config.disableBlocks )
         {
-            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+            yojimbo_assert( config.maxBlocksInFlight > 0 );
+            yojimbo_assert( ( 65536 % config.maxBlocksInFlight ) == 0 );
+            yojimbo_assert( config.maxFragmentsPerPacket > 0 );
+
+            m_sendBlocks = (SendBlockData**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SendBlockData* ) * m_config.maxBlocksInFlight );
+
+            m_receiveBlocks = (ReceiveBlockData**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( ReceiveBlockData* ) * m_config.maxBlocksInFlight );
+
+            // in large block mode fragment tracking is allocated per block, so nothing is reserved here. with lazy block buffers it waits for the first block
+
+            const bool lazy = m_config.lazyBlockBuffers;
+
+            const int maxFragmentsPerBlock = ( m_config.largeBlocks || lazy ) ? 0 : m_config.GetMaxFragmentsPerBlock();
+
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+            {
+                m_sendBlocks[i] = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, maxFragmentsPerBlock );
             
-            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+                m_receiveBlocks[i] = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, ( ReassemblesBlocksInPlace() || lazy ) ? 0 : m_config.maxBlockSize, maxFragmentsPerBlock );
+            }
+
+            m_blockBuffersAllocated = !lazy;
         }
         else
         {
-            m_sendBlock = NULL;
-            m_receiveBlock = NULL;
+            m_sendBlocks = NULL;
+            m_receiveBlocks = NULL;
+            m_blockBuffersAllocated = false;
         }
 
+        m_lastBlockTime = time;
+
         Reset();
     }
 
@@ -490,15 +1356,29 @@ namespace yojimbo
     {
         Reset();
 
-        YOJIMBO_DELETE( *m_allocator, SendBlockData, m_sendBlock );
-        YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlock );
+        if ( m_sendBlocks )
+        {
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+            {
+                YOJIMBO_DELETE( *m_allocator, SendBlockData, m_sendBlocks[i] );
+                YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlocks[i] );
+            }
+
+            YOJIMBO_FREE( *m_allocator, m_sendBlocks );
+            YOJIMBO_FREE( *m_allocator, m_receiveBlocks );
+        }
+
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, m_messageSendQueue );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, m_messageReceiveQueue );
-        
-        YOJIMBO_FREE( *m_allocator, m_sentPacketMessageIds );
 
-        m_sentPacketMessageIds = NULL;
+        if ( m_messageDeliveryQueue )
+        {
+            YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageDeliveryQueue );
+        }
+        
+        YOJIMBO_FREE( *m_allocator, m_sentPacketIds );
+        YOJIMBO_FREE( *m_allocator, m_parityScratch );
     }
 
     void ReliableOrderedChannel::Reset()
@@ -508,6 +1388,20 @@ namespace yojimbo
         m_sendMessageId = 0;
         m_receiveMessageId = 0;
         m_oldestUnackedMessageId = 0;
+        m_nextMessageResendTime = -1.0;
+        m_messageResendTime = m_config.messageResendTime;
+        m_fragmentResendTime = m_config.fragmentResendTime;
+        m_receivedAck = false;
+        m_highestAck = 0;
+        m_lossScanSequence = 0;
+        m_sendWindowStart = 0;
+        m_ackedReceiveWindowStart = 0;
+        m_sendWindowSize = m_config.receiveQueueSize;
+        m_remoteMaxBlockSize = m_config.maxBlockSize;
+        m_remoteLimitsEpoch = 0;
+        m_limitsEpoch = 0;
+        m_ackedLimitsEpoch = 0;
+        m_receiveWindowEnd = uint16_t( m_config.receiveQueueSize );
 
         for ( int i = 0; i < m_messageSendQueue->GetSize(); ++i )
         {
@@ -527,19 +1421,52 @@ namespace yojimbo
         m_messageSendQueue->Reset();
         m_messageReceiveQueue->Reset();
 
-        if ( m_sendBlock )
+        if ( m_messageDeliveryQueue )
         {
-            m_sendBlock->Reset();
+            for ( int i = 0; i < m_messageDeliveryQueue->GetNumEntries(); ++i )
+                m_messageFactory->ReleaseMessage( (*m_messageDeliveryQueue)[i] );
+
+            m_messageDeliveryQueue->Clear();
         }
 
-        if ( m_receiveBlock )
+        // the queues are empty, so they grow back to the config sizes straight away
+
+        m_limits = ChannelLimits( m_config );
+
+        ApplyQueueLimits();
+
+        if ( m_sendBlocks )
         {
-            m_receiveBlock->Reset();
-            if ( m_receiveBlock->blockMessage )
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
             {
-                m_messageFactory->ReleaseMessage( m_receiveBlock->blockMessage );
-                m_receiveBlock->blockMessage = NULL;
+                m_sendBlocks[i]->Reset();
+
+                ReceiveBlockData * receiveBlock = m_receiveBlocks[i];
+                receiveBlock->Reset();
+                if ( m_config.largeBlocks )
+                {
+                    m_sendBlocks[i]->FreeFragments();
+                    YOJIMBO_DELETE( *m_allocator, BitArray, receiveBlock->receivedFragment );
+                }
+                if ( receiveBlock->sharedBlock )
+                {
+                    receiveBlock->sharedBlock->Release();
+                    receiveBlock->sharedBlock = NULL;
+                    receiveBlock->blockData = NULL;
+                }
+                else if ( ReassemblesBlocksInPlace() )
+                {
+                    YOJIMBO_FREE( m_messageFactory->GetAllocator(), receiveBlock->blockData );
+                }
+                if ( receiveBlock->blockMessage )
+                {
+                    m_messageFactory->ReleaseMessage( receiveBlock->blockMessage );
+                    receiveBlock->blockMessage = NULL;
+                }
             }
+
+            if ( m_config.lazyBlockBuffers && m_blockBuffersAllocated )
+                FreeBlockBuffers();
         }
 
         ResetCounters();
@@ -548,7 +1475,7 @@ namespace yojimbo
     bool ReliableOrderedChannel::CanSendMessage() const
     {
         yojimbo_assert( m_messageSendQueue );
-        return m_messageSendQueue->Available( m_sendMessageId );
+        return m_messageSendQueue->Available( m_sendMessageId ) && (int) uint16_t( m_sendMessageId - m_oldestUnackedMessageId ) < m_limits.sendQueueSize;
     }
 
     void ReliableOrderedChannel::SendMessage( Message * message )
@@ -581,6 +1508,9 @@ namespace yojimbo
             return;
         }
 
+        if ( m_config.supersedeMessages && message->GetKey() != 0 && !message->IsBlockMessage() )
+            SupersedeMessage( message->GetKey() );
+
         message->SetId( m_sendMessageId );
 
         MessageSendQueueEntry * entry = m_messageSendQueue->Insert( m_sendMessageId );
@@ -590,7 +1520,9 @@ namespace yojimbo
         entry->block = message->IsBlockMessage();
         entry->message = message;
         entry->measuredBits = 0;
-        entry->timeLastSent = -1.0;
+        entry->sent = 0;
+        entry->timeLastSent = -1.0f;
+        entry->timeQueued = m_time;
 
         if ( message->IsBlockMessage() )
         {
@@ -598,88 +1530,501 @@ namespace yojimbo
             yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
         }
 
-        MeasureStream measureStream( m_messageFactory->GetAllocator() );
+        if ( m_config.serializeMessagesOnce && !message->GetSerializedMessage() )
+        {
+            // if this fails, the message is serialized as usual and fails in the packet instead
+            SerializedMessage * serializedMessage = SerializedMessage::Create( m_messageFactory->GetAllocator(), *message );
+            if ( serializedMessage )
+            {
+                message->AttachSerializedMessage( serializedMessage );
+                serializedMessage->Release();
+            }
+        }
 
-        message->SerializeInternal( measureStream );
+        entry->measuredBits = MeasureMessage( message, *m_messageFactory );
 
-        entry->measuredBits = measureStream.GetBitsProcessed();
+        m_nextMessageResendTime = -1.0;
 
         m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
 
         m_sendMessageId++;
     }
 
-    Message * ReliableOrderedChannel::ReceiveMessage()
+    void ReliableOrderedChannel::SupersedeMessage( uint32_t key )
     {
-        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
-            return NULL;
+        // walk back from the newest message. only the last message sent with a key can be live, since sending it superseded any before it
 
-        MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( m_receiveMessageId );
-        if ( !entry )
-            return NULL;
+        for ( uint16_t messageId = m_sendMessageId; messageId != m_oldestUnackedMessageId; )
+        {
+            messageId--;
 
-        Message * message = entry->message;
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+            if ( !entry || entry->block || entry->message->GetKey() != key )
+                continue;
 
-        yojimbo_assert( message );
-        yojimbo_assert( message->GetId() == m_receiveMessageId );
+            if ( !entry->message->IsSuperseded() && ReplaceWithPlaceholder( messageId ) )
+                m_counters[CHANNEL_COUNTER_MESSAGES_SUPERSEDED]++;
 
-        m_messageReceiveQueue->Remove( m_receiveMessageId );
+            return;
+        }
+    }
 
-        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+    bool ReliableOrderedChannel::ReplaceWithPlaceholder( uint16_t messageId )
+    {
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
 
-        m_receiveMessageId++;
+        yojimbo_assert( entry );
+        yojimbo_assert( !entry->block );
 
-        return message;
-    }
+        // the placeholder takes the place of the message in the send queue, so its id is still sent and delivery stays in order
 
-    void ReliableOrderedChannel::AdvanceTime( double time )
-    {
-        m_time = time;
+        Message * placeholder = m_messageFactory->CreateMessage( entry->message->GetType() );
+        if ( !placeholder )
+            return false;
+
+        placeholder->SetId( messageId );
+        placeholder->SetKey( entry->message->GetKey() );
+        placeholder->SetSuperseded();
+
+        m_messageFactory->ReleaseMessage( entry->message );
+
+        entry->message = placeholder;
+        entry->measuredBits = 0;
+
+        return true;
     }
-    
-    int ReliableOrderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+
+    Message * ReliableOrderedChannel::ReceiveMessage()
     {
-        if ( !HasMessagesToSend() )
-            return 0;
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return NULL;
 
-        if ( SendingBlockMessage() )
+        if ( m_messageDeliveryQueue )
         {
-            uint16_t messageId;
-            uint16_t fragmentId;
-            int fragmentBytes;
-            int numFragments;
-            int messageType;
+            if ( m_messageDeliveryQueue->IsEmpty() )
+                return NULL;
 
-            uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType );
+            Message * message = m_messageDeliveryQueue->Pop();
 
-            if ( fragmentData )
-            {
-                const int fragmentBits = GetFragmentPacketData( packetData, messageId, fragmentId, fragmentData, fragmentBytes, numFragments, messageType );
+            if ( !DecodeReceivedMessage( message ) )
+                return NULL;
 
-                AddFragmentPacketEntry( messageId, fragmentId, packetSequence );
+            m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
 
-                return fragmentBits;
-            }
+            return message;
         }
-        else
+
+        while ( true )
         {
-            int numMessageIds = 0;
+            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( m_receiveMessageId );
+            if ( !entry )
+                return NULL;
 
-            uint16_t * messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
-            
-            const int messageBits = GetMessagesToSend( messageIds, numMessageIds, availableBits );
+            Message * message = entry->message;
 
-            if ( numMessageIds > 0 )
-            {
-                GetMessagePacketData( packetData, messageIds, numMessageIds );
+            yojimbo_assert( message );
+            yojimbo_assert( message->GetId() == m_receiveMessageId );
+
+            m_messageReceiveQueue->Remove( m_receiveMessageId );
+
+            m_receiveMessageId++;
+
+            // placeholders for superseded messages only hold their place in the order
+
+            if ( message->IsSuperseded() )
+            {
+                m_messageFactory->ReleaseMessage( message );
+                continue;
+            }
+
+            if ( !DecodeReceivedMessage( message ) )
+                return NULL;
+
+            m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+            return message;
+        }
+    }
+
+    int ReliableOrderedChannel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return 0;
+
+        int numReceived = 0;
+
+        if ( m_messageDeliveryQueue )
+        {
+            while ( numReceived < maxMessages && !m_messageDeliveryQueue->IsEmpty() )
+            {
+                Message * message = m_messageDeliveryQueue->Pop();
+                if ( !DecodeReceivedMessage( message ) )
+                    break;
+                messages[numReceived++] = message;
+            }
+
+            m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] += numReceived;
+
+            return numReceived;
+        }
+
+        while ( numReceived < maxMessages )
+        {
+            Message * message = ReliableOrderedChannel::ReceiveMessage();
+            if ( !message )
+                break;
+            messages[numReceived++] = message;
+        }
+
+        return numReceived;
+    }
+
+    void ReliableOrderedChannel::AdvanceTime( double time )
+    {
+        if ( !m_config.lazyBlockBuffers || !m_blockBuffersAllocated )
+            return;
+
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+        {
+            if ( m_sendBlocks[i]->active || m_receiveBlocks[i]->active )
+            {
+                m_lastBlockTime = time;
+                return;
+            }
+        }
+
+        if ( time - m_lastBlockTime >= m_config.blockBufferIdleTime )
+            FreeBlockBuffers();
+    }
+
+    bool ReliableOrderedChannel::HasTimers() const
+    {
+        return m_config.lazyBlockBuffers;
+    }
+
+    bool ReliableOrderedChannel::DecodeReceivedMessage( Message * message )
+    {
+        if ( !message->IsEncoded() )
+            return true;
+
+        if ( m_messageFactory->DecodeMessage( message ) )
+            return true;
+
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to decode message type %d on receive (DecodeReceivedMessage)\n", message->GetType() );
+        m_messageFactory->ReleaseMessage( message );
+        SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+        return false;
+    }
+
+    bool ReliableOrderedChannel::SkipReceivedMessage( uint16_t messageId )
+    {
+        if ( !sequence_less_than( messageId, m_receiveMessageId ) && !m_messageReceiveQueue->Find( messageId ) )
+            return false;
+        m_counters[CHANNEL_COUNTER_MESSAGES_SKIPPED]++;
+        return true;
+    }
+
+    bool ReliableOrderedChannel::AllocateBlockBuffers()
+    {
+        yojimbo_assert( m_sendBlocks );
+        yojimbo_assert( !m_blockBuffersAllocated );
+
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+        {
+            if ( !m_config.largeBlocks )
+            {
+                if ( !m_sendBlocks[i]->AllocateFragments( m_config.GetMaxFragmentsPerBlock() ) )
+                    break;
+                m_receiveBlocks[i]->receivedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, m_config.GetMaxFragmentsPerBlock() );
+                if ( !m_receiveBlocks[i]->receivedFragment )
+                    break;
+            }
+            if ( !ReassemblesBlocksInPlace() )
+            {
+                m_receiveBlocks[i]->blockData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.maxBlockSize );
+                if ( !m_receiveBlocks[i]->blockData )
+                    break;
+            }
+            if ( i == m_config.maxBlocksInFlight - 1 )
+            {
+                m_blockBuffersAllocated = true;
+                m_lastBlockTime = m_time;
+                return true;
+            }
+        }
+
+        // leave nothing half allocated
+
+        FreeBlockBuffers();
+        return false;
+    }
+
+    void ReliableOrderedChannel::FreeBlockBuffers()
+    {
+        yojimbo_assert( m_sendBlocks );
+
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+        {
+            yojimbo_assert( !m_sendBlocks[i]->active );
+            yojimbo_assert( !m_receiveBlocks[i]->active );
+            if ( !m_config.largeBlocks )
+            {
+                m_sendBlocks[i]->FreeFragments();
+                YOJIMBO_DELETE( *m_allocator, BitArray, m_receiveBlocks[i]->receivedFragment );
+            }
+            if ( !ReassemblesBlocksInPlace() )
+                YOJIMBO_FREE( *m_allocator, m_receiveBlocks[i]->blockData );
+        }
+
+        m_blockBuffersAllocated = false;
+    }
+    
+    int ReliableOrderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        YOJIMBO_PROFILE_SCOPE( "ReliableOrderedChannel::GetPacketData" );
+
+        ApplyQueueLimits();
+
+        // while resuming a block, a window of the received fragment bitmap goes out alongside whatever else is sent
+
+        uint16_t resumeMessageId = 0;
+        int resumeWindow = 0;
+        int resumeBits = 0;
+
+        if ( m_config.resumableBlocks && GetBlockResumeToSend( resumeMessageId, resumeWindow ) )
+        {
+            resumeBits = GetBlockResumeBits();
+            if ( resumeBits <= availableBits )
+                availableBits -= resumeBits;
+            else
+                resumeBits = 0;
+        }
+
+        int bits = 0;
+
+        const int receiveWindowBits = HasReceiveWindowToSend() ? GetReceiveWindowBits() : 0;
+
+        availableBits -= receiveWindowBits;
+
+        if ( !HasMessagesToSend() )
+        {
+            // nothing else to send
+        }
+        else if ( SendingBlockMessage() && ( !InSendWindow( m_oldestUnackedMessageId ) || !InRemoteBlockLimit( m_oldestUnackedMessageId ) ) )
+        {
+            // with flow control, the block waits until it fits in the receive window, and with runtime limits until the other side takes blocks this large
+        }
+        else if ( SendingBlockMessage() )
+        {
+            int numFragments = 0;
+
+            uint16_t * messageIds = (uint16_t*) alloca( m_config.maxFragmentsPerPacket * sizeof( uint16_t ) );
+            uint32_t * fragmentIds = (uint32_t*) alloca( m_config.maxFragmentsPerPacket * sizeof( uint32_t ) );
+            int * fragmentBytes = (int*) alloca( m_config.maxFragmentsPerPacket * sizeof( int ) );
+
+            const int fragmentBits = GetFragmentsToSend( messageIds, fragmentIds, fragmentBytes, numFragments, availableBits );
+
+            if ( numFragments > 0 )
+            {
+                if ( !GetFragmentPacketData( packetData, messageIds, fragmentIds, fragmentBytes, numFragments ) )
+                    return 0;
+
+                AddFragmentPacketEntry( messageIds, fragmentIds, numFragments, packetSequence );
+
+                bits = fragmentBits;
+            }
+        }
+        else
+        {
+            int numMessageIds = 0;
+
+            uint16_t * messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
+            
+            const int messageBits = GetMessagesToSend( messageIds, numMessageIds, availableBits );
+
+            if ( numMessageIds > 0 )
+            {
+                GetMessagePacketData( packetData, messageIds, numMessageIds );
 
                 AddMessagePacketEntry( messageIds, numMessageIds, packetSequence );
 
-                return messageBits;
+                bits = messageBits;
+            }
+        }
+
+        if ( resumeBits > 0 )
+        {
+            if ( bits == 0 )
+            {
+                packetData.Initialize();
+                packetData.channelIndex = GetChannelIndex();
+                AddMessagePacketEntry( NULL, 0, packetSequence );
+            }
+
+            packetData.blockResume = 1;
+
+            GetBlockResumeData( packetData.resume, resumeMessageId, resumeWindow );
+
+            SentPacketEntry * sentPacket = m_sentPackets->Find( packetSequence );
+            yojimbo_assert( sentPacket );
+            if ( sentPacket )
+            {
+                sentPacket->resume = 1;
+                sentPacket->resumeMessageId = resumeMessageId;
+                sentPacket->resumeWindow = resumeWindow;
+            }
+
+            bits += resumeBits;
+        }
+
+        if ( receiveWindowBits > 0 )
+        {
+            if ( bits == 0 )
+            {
+                packetData.Initialize();
+                packetData.channelIndex = GetChannelIndex();
+                AddMessagePacketEntry( NULL, 0, packetSequence );
+            }
+
+            packetData.hasReceiveWindow = 1;
+            packetData.receiveWindowStart = GetReceiveWindowStart();
+
+            if ( m_config.runtimeLimits )
+            {
+                packetData.limitsEpoch = m_limitsEpoch;
+                packetData.receiveWindowSize = uint16_t( yojimbo_min( m_limits.receiveQueueSize, m_messageReceiveQueue->GetSize() ) );
+                packetData.receiveMaxBlockSize = m_limits.maxBlockSize;
+
+                // the other side may send up to the end of any window advertised, until it hears of a later one
+
+                const uint16_t receiveWindowEnd = packetData.receiveWindowStart + packetData.receiveWindowSize;
+                if ( sequence_greater_than( receiveWindowEnd, m_receiveWindowEnd ) )
+                    m_receiveWindowEnd = receiveWindowEnd;
+            }
+
+            SentPacketEntry * sentPacket = m_sentPackets->Find( packetSequence );
+            yojimbo_assert( sentPacket );
+            if ( sentPacket )
+            {
+                sentPacket->receiveWindow = 1;
+                sentPacket->receiveWindowStart = packetData.receiveWindowStart;
+                sentPacket->limitsEpoch = packetData.limitsEpoch;
+            }
+
+            bits += receiveWindowBits;
+        }
+
+        return bits;
+    }
+
+    void ReliableOrderedChannel::DiscardPacketData( uint16_t packetSequence )
+    {
+        SentPacketEntry * sentPacketEntry = m_sentPackets->Find( packetSequence );
+        if ( !sentPacketEntry )
+            return;
+
+        const uint16_t * sentPacketIds = GetSentPacketIds( packetSequence );
+
+        for ( int i = 0; i < (int) sentPacketEntry->numMessageIds; ++i )
+        {
+            MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( sentPacketIds[i] );
+            if ( sendQueueEntry )
+                sendQueueEntry->timeLastSent = -1.0f;
+        }
+
+        if ( sentPacketEntry->numMessageIds > 0 )
+            m_nextMessageResendTime = -1.0;
+
+        if ( !m_config.disableBlocks && sentPacketEntry->block )
+        {
+            const int numBlockFragments = sentPacketEntry->numBlockFragments;
+
+            for ( int i = 0; i < numBlockFragments; ++i )
+            {
+                const uint16_t messageId = sentPacketIds[i];
+                const uint32_t fragmentId = GetSentFragmentId( sentPacketIds, numBlockFragments, i );
+
+                SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+                if ( fragmentId & ParityFragmentFlag )
+                    continue;
+
+                if ( sendBlock->active && sendBlock->blockMessageId == messageId )
+                {
+                    sendBlock->fragmentSendTime[fragmentId] = -FLT_MAX;
+                    if ( !sendBlock->ackedFragment->GetBit( fragmentId ) )
+                        sendBlock->pendingFragment->SetBit( fragmentId );
+                }
             }
         }
 
-        return 0;
+        m_sentPackets->Remove( packetSequence );
+    }
+
+    bool ReliableOrderedChannel::HasDataToSend() const
+    {
+        return HasMessagesToSend() || HasBlockResumeToSend() || HasReceiveWindowToSend();
+    }
+
+    double ReliableOrderedChannel::GetNextSendTime() const
+    {
+        if ( HasBlockResumeToSend() || HasReceiveWindowToSend() )
+            return m_time;
+
+        if ( !HasMessagesToSend() )
+            return DBL_MAX;
+
+        // The resend time is only known after a full walk of the send queue. Otherwise, eg. while a block is being sent, assume there is something to send now.
+
+        return m_nextMessageResendTime >= 0.0 ? m_nextMessageResendTime : m_time;
+    }
+
+    int ReliableOrderedChannel::GetUnsentBits() const
+    {
+        if ( HasBlockResumeToSend() || HasReceiveWindowToSend() )
+            return -1;
+
+        int unsentBits = 0;
+        for ( uint16_t messageId = m_oldestUnackedMessageId; messageId != m_sendMessageId; ++messageId )
+        {
+            const MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+            if ( !entry || entry->sent )
+                continue;
+            if ( entry->block )
+                return -1;
+            unsentBits += entry->measuredBits;
+        }
+        return unsentBits;
+    }
+
+    void ReliableOrderedChannel::UpdateRoundTripTime( double rtt, double rttVariance )
+    {
+        if ( !m_config.adaptiveResendTime )
+            return;
+
+        const double resendTime = yojimbo_max( (double) m_config.minResendTime, yojimbo_min( rtt + 4.0 * rttVariance, (double) m_config.maxResendTime ) );
+
+        // messages already sent become eligible sooner, so the cached earliest resend time no longer holds
+
+        if ( resendTime < m_messageResendTime )
+            m_nextMessageResendTime = -1.0;
+
+        m_messageResendTime = resendTime;
+        m_fragmentResendTime = resendTime;
+    }
+
+    int ReliableOrderedChannel::GetSendQueueDepth() const
+    {
+        return (int) uint16_t( m_sendMessageId - m_oldestUnackedMessageId );
+    }
+
+    int ReliableOrderedChannel::GetReceiveQueueDepth() const
+    {
+        if ( m_messageDeliveryQueue )
+            return m_messageDeliveryQueue->GetNumEntries();
+        return (int) uint16_t( m_messageReceiveQueue->GetSequence() - m_receiveMessageId );
     }
 
     bool ReliableOrderedChannel::HasMessagesToSend() const
@@ -693,14 +2038,24 @@ namespace yojimbo
 
         numMessageIds = 0;
 
-        if ( m_config.packetBudget > 0 )
-            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
+        // Every message in the send queue was sent recently and none can be resent yet, so there is no need to walk the send queue.
+
+        if ( m_time < m_nextMessageResendTime )
+            return 0;
+
+        if ( m_limits.packetBudget > 0 )
+            availableBits = yojimbo_min( m_limits.packetBudget * 8, availableBits );
 
         const int giveUpBits = 4 * 8;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        // Only walk messages that are actually in flight, rather than the whole send window.
+
+        int messageLimit = yojimbo_min( yojimbo_min( m_messageSendQueue->GetSize(), m_sendWindowSize ), (int) uint16_t( m_sendMessageId - m_oldestUnackedMessageId ) );
 
-        const int messageLimit = yojimbo_min( m_config.sendQueueSize, m_config.receiveQueueSize );
+        // with flow control, stop at the end of the receive window the other side advertised
+
+        if ( m_config.flowControl )
+            messageLimit = yojimbo_min( messageLimit, yojimbo_max( 0, (int) int16_t( uint16_t( m_sendWindowStart + m_sendWindowSize - m_oldestUnackedMessageId ) ) ) );
 
         uint16_t previousMessageId = 0;
 
@@ -708,13 +2063,21 @@ namespace yojimbo
 
         int giveUpCounter = 0;
 
+        bool visitedAllMessages = true;
+
+        bool outOfSpace = false;
+
+        double nextMessageResendTime = DBL_MAX;
+
         for ( int i = 0; i < messageLimit; ++i )
         {
-            if ( availableBits - usedBits < giveUpBits )
-                break;
-
-            if ( giveUpCounter > m_config.sendQueueSize )
+            if ( availableBits - usedBits < giveUpBits || giveUpCounter > m_config.sendQueueSize || numMessageIds == m_limits.maxMessagesPerPacket )
+            {
+                if ( availableBits - usedBits < giveUpBits )
+                    outOfSpace = true;
+                visitedAllMessages = false;
                 break;
+            }
 
             uint16_t messageId = m_oldestUnackedMessageId + i;
 
@@ -724,11 +2087,30 @@ namespace yojimbo
                 continue;
 
             if ( entry->block )
+            {
+                visitedAllMessages = false;
                 break;
+            }
+
+            if ( m_config.messageTimeToLive > 0.0f && !entry->message->IsSuperseded() && entry->timeQueued + m_config.messageTimeToLive < m_time && ReplaceWithPlaceholder( messageId ) )
+                m_counters[CHANNEL_COUNTER_MESSAGES_EXPIRED]++;
+
+            if ( entry->timeLastSent >= 0.0f )
+            {
+                const double resendTime = entry->timeQueued + entry->timeLastSent + m_messageResendTime;
+                if ( resendTime > m_time )
+                {
+                    nextMessageResendTime = yojimbo_min( nextMessageResendTime, resendTime );
+                    continue;
+                }
+            }
             
-            if ( entry->timeLastSent + m_config.messageResendTime <= m_time && availableBits >= (int) entry->measuredBits )
+            if ( availableBits >= (int) entry->measuredBits )
             {                
-                int messageBits = entry->measuredBits + messageTypeBits;
+                int messageBits = entry->measuredBits + m_messageFactory->GetMessageTypeBits( entry->message->GetType() ) + m_config.messageLengthBits;
+
+                if ( m_config.SendsMessagePlaceholders() )
+                    messageBits += 1;
                 
                 if ( numMessageIds == 0 )
                 {
@@ -736,14 +2118,14 @@ namespace yojimbo
                 }
                 else
                 {
-                    MeasureStream stream( GetDefaultAllocator() );
-                    serialize_sequence_relative_internal( stream, previousMessageId, messageId );
-                    messageBits += stream.GetBitsProcessed();
+                    messageBits += sequence_relative_bits( previousMessageId, messageId );
                 }
 
                 if ( usedBits + messageBits > availableBits )
                 {
                     giveUpCounter++;
+                    outOfSpace = true;
+                    nextMessageResendTime = m_time;
                     continue;
                 }
 
@@ -751,15 +2133,34 @@ namespace yojimbo
 
                 messageIds[numMessageIds++] = messageId;
                 
-                entry->timeLastSent = m_time;
+                entry->timeLastSent = float( m_time - entry->timeQueued );
+
+                if ( !entry->sent )
+                {
+                    entry->sent = 1;
+                    RecordLatency( CHANNEL_LATENCY_QUEUED, m_time - entry->timeQueued );
+                }
+                else
+                {
+                    m_counters[CHANNEL_COUNTER_MESSAGES_RESENT]++;
+                }
+
+                nextMessageResendTime = yojimbo_min( nextMessageResendTime, m_time + m_messageResendTime );
 
                 previousMessageId = messageId;
             }
-
-            if ( numMessageIds == m_config.maxMessagesPerPacket )
-                break;
+            else
+            {
+                outOfSpace = true;
+                nextMessageResendTime = m_time;
+            }
         }
 
+        if ( outOfSpace )
+            m_counters[CHANNEL_COUNTER_OUT_OF_SPACE]++;
+
+        m_nextMessageResendTime = visitedAllMessages ? nextMessageResendTime : -1.0;
+
         return usedBits;
     }
 
@@ -774,7 +2175,7 @@ namespace yojimbo
         if ( numMessageIds == 0 )
             return;
 
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), sizeof( Message* ) * numMessageIds );
+        packetData.message.messages = packetData.AllocateMessages( *m_messageFactory, numMessageIds );
 
         for ( int i = 0; i < numMessageIds; ++i )
         {
@@ -795,12 +2196,14 @@ namespace yojimbo
         {
             sentPacket->acked = 0;
             sentPacket->block = 0;
-            sentPacket->timeSent = m_time;
-            sentPacket->messageIds = &m_sentPacketMessageIds[ ( sequence % m_config.sentPacketBufferSize ) * m_config.maxMessagesPerPacket ];
+            sentPacket->numBlockFragments = 0;
+            sentPacket->resume = 0;
+            sentPacket->receiveWindow = 0;
             sentPacket->numMessageIds = numMessageIds;            
+            uint16_t * sentPacketMessageIds = GetSentPacketIds( sequence );
             for ( int i = 0; i < numMessageIds; ++i )
             {
-                sentPacket->messageIds[i] = messageIds[i];
+                sentPacketMessageIds[i] = messageIds[i];
             }
         }
     }
@@ -808,7 +2211,7 @@ namespace yojimbo
     void ReliableOrderedChannel::ProcessPacketMessages( int numMessages, Message ** messages )
     {
         const uint16_t minMessageId = m_receiveMessageId;
-        const uint16_t maxMessageId = m_receiveMessageId + m_config.receiveQueueSize - 1;
+        const uint16_t maxMessageId = m_receiveMessageId + m_messageReceiveQueue->GetSize() - 1;
 
         for ( int i = 0; i < (int) numMessages; ++i )
         {
@@ -833,37 +2236,118 @@ namespace yojimbo
 
             yojimbo_assert( !m_messageReceiveQueue->GetAtIndex( m_messageReceiveQueue->GetIndex( messageId ) ) );
 
-            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
-            if ( !entry )
-            {
-                // For some reason we can't insert the message in the receive queue
-                SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                return;
-            }
-
-            entry->message = message;
-
             m_messageFactory->AcquireMessage( message );
+
+            if ( !AddReceivedMessage( messageId, message ) )
+                return;
         }
     }
 
-    void ReliableOrderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    bool ReliableOrderedChannel::AddReceivedMessage( uint16_t messageId, Message * message )
     {
-        if ( m_errorLevel != CHANNEL_ERROR_NONE )
-            return;
-        
-        if ( packetData.messageFailedToSerialize )
+        MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+        if ( !entry )
         {
-            // A message failed to serialize read for some reason, eg. mismatched read/write.
+            // For some reason we can't insert the message in the receive queue
+            m_messageFactory->ReleaseMessage( message );
+            SetErrorLevel( CHANNEL_ERROR_DESYNC );
+            return false;
+        }
+
+        if ( !m_messageDeliveryQueue )
+        {
+            entry->message = message;
+            return true;
+        }
+
+        // unordered: deliver the message right away. the receive queue entry only remembers that this 
+        // message id has arrived, so duplicates are dropped until the window moves past it.
+
+        entry->message = NULL;
+
+        if ( message->IsSuperseded() )
+        {
+            // placeholders for superseded messages only need to be marked as arrived
+            m_messageFactory->ReleaseMessage( message );
+        }
+        else
+        {
+            if ( m_messageDeliveryQueue->IsFull() )
+            {
+                // Did you forget to dequeue messages on the receiver?
+                m_messageFactory->ReleaseMessage( message );
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return false;
+            }
+
+            m_messageDeliveryQueue->Push( message );
+        }
+
+        while ( m_messageReceiveQueue->Find( m_receiveMessageId ) )
+        {
+            m_messageReceiveQueue->Remove( m_receiveMessageId );
+            m_receiveMessageId++;
+        }
+
+        return true;
+    }
+
+    void ReliableOrderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        YOJIMBO_PROFILE_SCOPE( "ReliableOrderedChannel::ProcessPacketData" );
+        if ( m_errorLevel != CHANNEL_ERROR_NONE )
+            return;
+        
+        if ( packetData.messageFailedToSerialize )
+        {
+            // A message failed to serialize read for some reason, eg. mismatched read/write.
             SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
             return;
         }
 
         (void)packetSequence;
 
+        if ( packetData.hasReceiveWindow && sequence_greater_than( packetData.receiveWindowStart, m_sendWindowStart ) )
+        {
+            // the window moved on, so messages held back may go out now
+            m_sendWindowStart = packetData.receiveWindowStart;
+            m_nextMessageResendTime = -1.0;
+        }
+
+        if ( packetData.hasReceiveWindow && m_config.runtimeLimits && sequence_greater_than( packetData.limitsEpoch, m_remoteLimitsEpoch ) )
+        {
+            // the other side changed its limits. older advertisements arriving late are ignored
+
+            m_remoteLimitsEpoch = packetData.limitsEpoch;
+            m_sendWindowSize = packetData.receiveWindowSize;
+            if ( !m_config.disableBlocks )
+                m_remoteMaxBlockSize = packetData.receiveMaxBlockSize;
+            m_nextMessageResendTime = -1.0;
+        }
+
+        if ( packetData.blockResume )
+        {
+            if ( ProcessBlockResume( packetData.resume ) )
+                UpdateOldestUnackedMessageId();
+
+            if ( m_errorLevel != CHANNEL_ERROR_NONE )
+                return;
+        }
+
         if ( packetData.blockMessage )
         {
-            ProcessPacketFragment( packetData.block.messageType, packetData.block.messageId, packetData.block.numFragments, packetData.block.fragmentId, packetData.block.fragmentData, packetData.block.fragmentSize, packetData.block.message );
+            for ( int i = 0; i < packetData.block.numFragmentsInPacket; ++i )
+            {
+                const ChannelPacketData::BlockFragmentData & fragment = packetData.block.fragments[i];
+
+                if ( fragment.parity )
+                    ProcessParityFragment( fragment.messageId, fragment.numFragments, int( fragment.fragmentId ), fragment.fragmentData, fragment.fragmentSize, fragment.paritySizes, fragment.blockHash );
+                else
+                    ProcessPacketFragment( fragment.messageType, fragment.messageId, fragment.numFragments, fragment.fragmentId, fragment.fragmentData, fragment.fragmentSize, fragment.message, fragment.blockHash, fragment.uncompressedSize );
+
+                if ( m_errorLevel != CHANNEL_ERROR_NONE )
+                    return;
+            }
         }
         else
         {
@@ -872,399 +2356,2173 @@ namespace yojimbo
     }
 
     void ReliableOrderedChannel::ProcessAck( uint16_t ack )
+    {
+        if ( ProcessSentPacketAck( ack ) )
+            UpdateOldestUnackedMessageId();
+
+        DetectPacketLoss();
+    }
+
+    void ReliableOrderedChannel::ProcessAcks( const uint16_t * acks, int numAcks )
+    {
+        bool removedMessages = false;
+
+        for ( int i = 0; i < numAcks; ++i )
+        {
+            if ( ProcessSentPacketAck( acks[i] ) )
+                removedMessages = true;
+        }
+
+        if ( removedMessages )
+            UpdateOldestUnackedMessageId();
+
+        DetectPacketLoss();
+    }
+
+    void ReliableOrderedChannel::DetectPacketLoss()
+    {
+        if ( m_config.fastResendThreshold <= 0 || !m_receivedAck )
+            return;
+
+        const uint16_t lossSequence = uint16_t( m_highestAck - m_config.fastResendThreshold );
+
+        if ( sequence_greater_than( m_lossScanSequence, lossSequence ) )
+            return;
+
+        // sent packets older than the sent packet buffer are gone anyway, so the scan never covers more than that
+
+        int numToScan = int( uint16_t( lossSequence - m_lossScanSequence ) ) + 1;
+        if ( numToScan > m_config.sentPacketBufferSize )
+            numToScan = m_config.sentPacketBufferSize;
+
+        uint16_t sequence = uint16_t( lossSequence - numToScan + 1 );
+
+        for ( int i = 0; i < numToScan; ++i, ++sequence )
+        {
+            SentPacketEntry * sentPacketEntry = m_sentPackets->Find( sequence );
+            if ( !sentPacketEntry || sentPacketEntry->acked )
+                continue;
+
+            // resend everything the lost packet carried in the next packet, the same as a packet that was never sent
+
+            DiscardPacketData( sequence );
+
+            m_counters[CHANNEL_COUNTER_PACKETS_LOST]++;
+        }
+
+        m_lossScanSequence = uint16_t( lossSequence + 1 );
+    }
+
+    bool ReliableOrderedChannel::ProcessSentPacketAck( uint16_t ack )
     {
         // todo
         // printf( "%p: process ack %d\n", this, ack );
 
+        if ( !m_receivedAck )
+        {
+            // the first scan goes a full sent packet buffer back, which covers every sent packet still tracked
+
+            m_receivedAck = true;
+            m_highestAck = ack;
+            m_lossScanSequence = uint16_t( ack - m_config.sentPacketBufferSize );
+        }
+        else if ( sequence_greater_than( ack, m_highestAck ) )
+        {
+            m_highestAck = ack;
+        }
+
         SentPacketEntry * sentPacketEntry = m_sentPackets->Find( ack );
         if ( !sentPacketEntry )
-            return;
+            return false;
+
+        bool removedMessages = false;
 
         yojimbo_assert( !sentPacketEntry->acked );
 
+        sentPacketEntry->acked = 1;
+
+        const uint16_t * sentPacketIds = GetSentPacketIds( ack );
+
         for ( int i = 0; i < (int) sentPacketEntry->numMessageIds; ++i )
         {
-            const uint16_t messageId = sentPacketEntry->messageIds[i];
+            const uint16_t messageId = sentPacketIds[i];
             MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
             if ( sendQueueEntry )
             {
                 yojimbo_assert( sendQueueEntry->message );
                 yojimbo_assert( sendQueueEntry->message->GetId() == messageId );
+                if ( !sendQueueEntry->message->IsSuperseded() )
+                    RecordLatency( CHANNEL_LATENCY_ACKED, m_time - sendQueueEntry->timeQueued );
                 m_messageFactory->ReleaseMessage( sendQueueEntry->message );
                 m_messageSendQueue->Remove( messageId );
-                UpdateOldestUnackedMessageId();
+                removedMessages = true;
             }
         }
 
-        if ( !m_config.disableBlocks && sentPacketEntry->block && m_sendBlock->active && m_sendBlock->blockMessageId == sentPacketEntry->blockMessageId )
+        if ( !m_config.disableBlocks && sentPacketEntry->block )
         {        
-            const int messageId = sentPacketEntry->blockMessageId;
-            const int fragmentId = sentPacketEntry->blockFragmentId;
+            const int numBlockFragments = sentPacketEntry->numBlockFragments;
 
-            // todo
-            //printf( "%p: process ack for block message: ack = %d, messageId = %d, fragmentId = %d\n", this, ack, messageId, fragmentId );
+            for ( int i = 0; i < numBlockFragments; ++i )
+            {
+                const uint16_t messageId = sentPacketIds[i];
+                const uint32_t fragmentId = GetSentFragmentId( sentPacketIds, numBlockFragments, i );
+
+                // todo
+                //printf( "%p: process ack for block message: ack = %d, messageId = %d, fragmentId = %d\n", this, ack, messageId, fragmentId );
+
+                if ( AckBlockFragment( messageId, fragmentId ) )
+                    removedMessages = true;
+            }
+        }
+
+        if ( sentPacketEntry->receiveWindow && sequence_greater_than( sentPacketEntry->receiveWindowStart, m_ackedReceiveWindowStart ) )
+            m_ackedReceiveWindowStart = sentPacketEntry->receiveWindowStart;
 
-            if ( !m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+        if ( sentPacketEntry->receiveWindow && sequence_greater_than( sentPacketEntry->limitsEpoch, m_ackedLimitsEpoch ) )
+            m_ackedLimitsEpoch = sentPacketEntry->limitsEpoch;
+
+        if ( sentPacketEntry->resume )
+        {
+            ReceiveBlockData * receiveBlock = m_receiveBlocks[ sentPacketEntry->resumeMessageId % m_config.maxBlocksInFlight ];
+
+            if ( receiveBlock->active && receiveBlock->messageId == sentPacketEntry->resumeMessageId && receiveBlock->resumeWindowAcked )
             {
-                m_sendBlock->ackedFragment->SetBit( fragmentId );
-                m_sendBlock->numAckedFragments++;
-                if ( m_sendBlock->numAckedFragments == m_sendBlock->numFragments )
+                if ( !receiveBlock->resumeWindowAcked->GetBit( sentPacketEntry->resumeWindow ) )
                 {
-                    m_sendBlock->active = false;
-                    MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
-                    yojimbo_assert( sendQueueEntry );
-                    m_messageFactory->ReleaseMessage( sendQueueEntry->message );
-                    m_messageSendQueue->Remove( messageId );
-                    UpdateOldestUnackedMessageId();
+                    receiveBlock->resumeWindowAcked->SetBit( sentPacketEntry->resumeWindow );
+                    receiveBlock->numResumeWindowsAcked++;
+                    if ( receiveBlock->numResumeWindowsAcked == receiveBlock->numResumeWindows )
+                        receiveBlock->FreeResume();
                 }
             }
         }
+
+        return removedMessages;
     }
 
-    void ReliableOrderedChannel::UpdateOldestUnackedMessageId()
+    bool ReliableOrderedChannel::AckBlockFragment( uint16_t messageId, uint32_t fragmentId )
     {
-        const uint16_t stopMessageId = m_messageSendQueue->GetSequence();
+        // parity only stands in for lost fragments on the receiver. the fragments themselves are still acked one by one
 
-        while ( true )
+        if ( fragmentId & ParityFragmentFlag )
+            return false;
+
+        SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        if ( !sendBlock->active || sendBlock->blockMessageId != messageId )
+            return false;
+
+        if ( sendBlock->ackedFragment->GetBit( fragmentId ) )
+            return false;
+
+        sendBlock->ackedFragment->SetBit( fragmentId );
+        sendBlock->pendingFragment->ClearBit( fragmentId );
+        sendBlock->numAckedFragments++;
+        if ( fragmentId == uint32_t( sendBlock->firstUnackedFragment ) )
         {
-            if ( m_oldestUnackedMessageId == stopMessageId || m_messageSendQueue->Find( m_oldestUnackedMessageId ) )
-            {
-                break;
-            }
-            ++m_oldestUnackedMessageId;
+            const int firstUnackedFragment = sendBlock->ackedFragment->FindFirstClear( sendBlock->firstUnackedFragment );
+            sendBlock->firstUnackedFragment = firstUnackedFragment >= 0 ? yojimbo_min( firstUnackedFragment, sendBlock->numFragments ) : sendBlock->numFragments;
         }
 
-        yojimbo_assert( !sequence_greater_than( m_oldestUnackedMessageId, stopMessageId ) );
+        if ( sendBlock->numAckedFragments < sendBlock->numFragments )
+            return false;
+
+        sendBlock->active = false;
+        sendBlock->FreeCompressedData();
+        if ( m_config.largeBlocks )
+            sendBlock->FreeFragments();
+        MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
+        yojimbo_assert( sendQueueEntry );
+        RecordLatency( CHANNEL_LATENCY_ACKED, m_time - sendQueueEntry->timeQueued );
+        m_messageFactory->ReleaseMessage( sendQueueEntry->message );
+        m_messageSendQueue->Remove( messageId );
+        return true;
     }
 
-    bool ReliableOrderedChannel::SendingBlockMessage()
+    uint16_t ReliableOrderedChannel::GetReceiveWindowStart() const
     {
-        yojimbo_assert( HasMessagesToSend() );
+        if ( m_messageDeliveryQueue )
+            return uint16_t( m_receiveMessageId - m_messageDeliveryQueue->GetNumEntries() );
 
-        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+        return m_receiveMessageId;
+    }
 
-        return entry ? entry->block : false;
+    bool ReliableOrderedChannel::HasReceiveWindowToSend() const
+    {
+        return m_config.flowControl && m_errorLevel == CHANNEL_ERROR_NONE && ( sequence_greater_than( GetReceiveWindowStart(), m_ackedReceiveWindowStart ) || m_limitsEpoch != m_ackedLimitsEpoch );
     }
 
-    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType )
+    bool ReliableOrderedChannel::InSendWindow( uint16_t messageId ) const
     {
-        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+        return !m_config.flowControl || int( uint16_t( messageId - m_sendWindowStart ) ) < m_sendWindowSize;
+    }
+
+    bool ReliableOrderedChannel::InRemoteBlockLimit( uint16_t messageId ) const
+    {
+        if ( !m_config.runtimeLimits )
+            return true;
+
+        const SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        if ( sendBlock->active && sendBlock->blockMessageId == messageId )
+            return true;
+
+        const MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
 
         yojimbo_assert( entry );
         yojimbo_assert( entry->block );
 
-        BlockMessage * blockMessage = (BlockMessage*) entry->message;
+        return ( (const BlockMessage*) entry->message )->GetBlockSize() <= m_remoteMaxBlockSize;
+    }
 
-        yojimbo_assert( blockMessage );
+    int ReliableOrderedChannel::GetReceiveWindowBits() const
+    {
+        int bits = 17;
 
-        messageId = blockMessage->GetId();
+        if ( m_config.runtimeLimits )
+        {
+            bits += 16 + bits_required( 0, m_config.receiveQueueSize );
 
-        const int blockSize = blockMessage->GetBlockSize();
+            if ( !m_config.disableBlocks )
+                bits += bits_required( 0, m_config.maxBlockSize );
+        }
 
-        if ( !m_sendBlock->active )
-        {
-            // start sending this block
+        return bits;
+    }
 
-            // todo
-            //printf( "%p: start sending block: messageId = %d\n", this, messageId );
+    void ReliableOrderedChannel::SetLimits( const ChannelLimits & limits )
+    {
+        Channel::SetLimits( limits );
 
-            m_sendBlock->active = true;
-            m_sendBlock->blockSize = blockSize;
-            m_sendBlock->blockMessageId = messageId;
-            m_sendBlock->numFragments = (int) ceil( blockSize / float( m_config.fragmentSize ) );
-            m_sendBlock->numAckedFragments = 0;
+        m_limits.sendQueueSize = limits.sendQueueSize;
 
-            const int MaxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
+        // the receive limits are advertised to the other side, so they need runtime limits on both ends
 
-            yojimbo_assert( m_sendBlock->numFragments > 0 );
-            yojimbo_assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock );
+        const bool receiveLimitsChanged = limits.receiveQueueSize != m_limits.receiveQueueSize || limits.maxBlockSize != m_limits.maxBlockSize;
 
-            m_sendBlock->ackedFragment->Clear();
+        yojimbo_assert( m_config.runtimeLimits || !receiveLimitsChanged );
 
-            for ( int i = 0; i < MaxFragmentsPerBlock; ++i )
-                m_sendBlock->fragmentSendTime[i] = -1.0;
+        if ( m_config.runtimeLimits && receiveLimitsChanged )
+        {
+            m_limits.receiveQueueSize = limits.receiveQueueSize;
+            m_limits.maxBlockSize = limits.maxBlockSize;
+            m_limitsEpoch++;
         }
 
-        numFragments = m_sendBlock->numFragments;
-
-        // find the next fragment to send (there may not be one)
+        ApplyQueueLimits();
+    }
 
-        fragmentId = 0xFFFF;
+    void ReliableOrderedChannel::ApplyQueueLimits()
+    {
+        // the send queue shrinks once the unacked messages fit
 
-        for ( int i = 0; i < m_sendBlock->numFragments; ++i )
+        if ( m_limits.sendQueueSize != m_messageSendQueue->GetSize() && (int) uint16_t( m_sendMessageId - m_oldestUnackedMessageId ) <= m_limits.sendQueueSize )
         {
-            if ( !m_sendBlock->ackedFragment->GetBit( i ) && m_sendBlock->fragmentSendTime[i] + m_config.fragmentResendTime < m_time )
+            if ( !m_messageSendQueue->Resize( m_limits.sendQueueSize ) )
             {
-                fragmentId = uint16_t( i );
-                break;
+                // Not enough memory to resize the send queue
+                SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                return;
             }
         }
 
-        if ( fragmentId == 0xFFFF )
-            return NULL;
+        // the receive queue grows straight away, and shrinks once every message the other side may still send under an earlier advertisement fits
 
-        // allocate and return a copy of the fragment data
+        const int receiveQueueSize = m_messageReceiveQueue->GetSize();
 
-        messageType = blockMessage->GetType();
+        if ( m_limits.receiveQueueSize == receiveQueueSize )
+            return;
 
-        fragmentBytes = m_config.fragmentSize;
-        
-        const int fragmentRemainder = blockSize % m_config.fragmentSize;
+        if ( m_limits.receiveQueueSize < receiveQueueSize && sequence_greater_than( m_receiveWindowEnd, uint16_t( GetReceiveWindowStart() + m_limits.receiveQueueSize ) ) )
+            return;
 
-        if ( fragmentRemainder && fragmentId == m_sendBlock->numFragments - 1 )
-            fragmentBytes = fragmentRemainder;
+        if ( !m_messageReceiveQueue->Resize( m_limits.receiveQueueSize ) || ( m_messageDeliveryQueue && !m_messageDeliveryQueue->Resize( m_limits.receiveQueueSize ) ) )
+        {
+            // Not enough memory to resize the receive queue
+            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+        }
+    }
 
-        uint8_t * fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), fragmentBytes );
+    bool ReliableOrderedChannel::HasBlockResumeToSend() const
+    {
+        if ( !m_config.resumableBlocks || m_errorLevel != CHANNEL_ERROR_NONE )
+            return false;
 
-        if ( fragmentData )
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
         {
-            memcpy( fragmentData, blockMessage->GetBlockData() + fragmentId * m_config.fragmentSize, fragmentBytes );
-
-            m_sendBlock->fragmentSendTime[fragmentId] = m_time;
+            if ( m_receiveBlocks[i]->resumeWindowAcked )
+                return true;
         }
 
-        // todo
-        //printf( "%p: send block fragment: messageId = %d, fragmentId = %d\n", this, messageId, fragmentId );
-
-        return fragmentData;
+        return false;
     }
 
-    int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType )
+    bool ReliableOrderedChannel::GetBlockResumeToSend( uint16_t & messageId, int & window )
     {
-        packetData.Initialize();
+        if ( !HasBlockResumeToSend() )
+            return false;
 
-        packetData.channelIndex = GetChannelIndex();
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+        {
+            ReceiveBlockData * receiveBlock = m_receiveBlocks[i];
 
-        packetData.blockMessage = 1;
+            if ( !receiveBlock->resumeWindowAcked )
+                continue;
+
+            for ( int j = 0; j < receiveBlock->numResumeWindows; ++j )
+            {
+                const int index = ( receiveBlock->nextResumeWindow + j ) % receiveBlock->numResumeWindows;
 
-        packetData.block.fragmentData = fragmentData;
-        packetData.block.messageId = messageId;
-        packetData.block.fragmentId = fragmentId;
-        packetData.block.fragmentSize = fragmentSize;
-        packetData.block.numFragments = numFragments;
-        packetData.block.messageType = messageType;
+                if ( !receiveBlock->resumeWindowAcked->GetBit( index ) )
+                {
+                    messageId = receiveBlock->messageId;
+                    window = index;
+                    receiveBlock->nextResumeWindow = ( index + 1 ) % receiveBlock->numResumeWindows;
+                    return true;
+                }
+            }
+        }
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        return false;
+    }
 
-        int fragmentBits = ConservativeFragmentHeaderEstimate + fragmentSize;
+    int ReliableOrderedChannel::GetBlockResumeBits() const
+    {
+        const int maxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
 
-        if ( fragmentId == 0 )
-        {
-            MessageSendQueueEntry * entry = m_messageSendQueue->Find( packetData.block.messageId );
+        int bits = 16 + 64 + bits_required( 1, MaxResumeFragmentsPerPacket ) + MaxResumeFragmentsPerPacket;
 
-            yojimbo_assert( entry );
-            yojimbo_assert( entry->message );
+        if ( maxFragmentsPerBlock > MaxResumeFragmentsPerPacket )
+            bits += bits_required( 0, maxFragmentsPerBlock - 1 );
 
-            packetData.block.message = (BlockMessage*) entry->message;
+        return bits;
+    }
 
-            m_messageFactory->AcquireMessage( packetData.block.message );
+    void ReliableOrderedChannel::GetBlockResumeData( ChannelPacketData::BlockResumeData & resume, uint16_t messageId, int window ) const
+    {
+        const ReceiveBlockData * receiveBlock = m_receiveBlocks[ messageId % m_config.maxBlocksInFlight ];
 
-            fragmentBits += entry->measuredBits + messageTypeBits;
-        }
-        else
+        yojimbo_assert( receiveBlock->active );
+        yojimbo_assert( receiveBlock->messageId == messageId );
+
+        resume.messageId = messageId;
+        resume.blockHash = receiveBlock->blockHash;
+        resume.firstFragment = uint32_t( window ) * MaxResumeFragmentsPerPacket;
+        resume.numFragments = yojimbo_min( MaxResumeFragmentsPerPacket, receiveBlock->numFragments - int( resume.firstFragment ) );
+
+        yojimbo_assert( resume.numFragments > 0 );
+
+        memset( resume.receivedFragments, 0, sizeof( resume.receivedFragments ) );
+
+        for ( int i = 0; i < resume.numFragments; ++i )
         {
-            packetData.block.message = NULL;
+            if ( receiveBlock->receivedFragment->GetBit( resume.firstFragment + i ) )
+                resume.receivedFragments[i>>5] |= uint32_t(1) << ( i & 31 );
         }
-
-        return fragmentBits;
     }
 
-    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence )
+    bool ReliableOrderedChannel::ProcessBlockResume( const ChannelPacketData::BlockResumeData & resume )
     {
-        // todo
-        //printf( "%p: add fragment packet entry: messageId = %d, fragmentId = %d, sequence = %d\n", this, messageId, fragmentId, sequence );
-        SentPacketEntry * sentPacket = m_sentPackets->Insert( sequence );
-        yojimbo_assert( sentPacket );
-        if ( sentPacket )
+        SendBlockData * sendBlock = m_sendBlocks[ resume.messageId % m_config.maxBlocksInFlight ];
+
+        // the block may already be done, or this may be for a block sent on an earlier connection
+
+        if ( !sendBlock->active || sendBlock->blockMessageId != resume.messageId || sendBlock->blockHash != resume.blockHash )
+            return false;
+
+        if ( int64_t( resume.firstFragment ) + resume.numFragments > sendBlock->numFragments )
         {
-            sentPacket->numMessageIds = 0;
-            sentPacket->messageIds = NULL;
-            sentPacket->timeSent = m_time;
-            sentPacket->acked = 0;
-            sentPacket->block = 1;
-            sentPacket->blockMessageId = messageId;
-            sentPacket->blockFragmentId = fragmentId;
+            // The received fragment bitmap is out of range.
+            SetErrorLevel( CHANNEL_ERROR_DESYNC );
+            return false;
+        }
+
+        for ( int i = 0; i < resume.numFragments; ++i )
+        {
+            if ( resume.receivedFragments[i>>5] & ( uint32_t(1) << ( i & 31 ) ) )
+            {
+                if ( AckBlockFragment( resume.messageId, resume.firstFragment + i ) )
+                    return true;
+            }
         }
+
+        return false;
     }
 
-    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage )
-    {  
-        yojimbo_assert( !m_config.disableBlocks );
+    void ReliableOrderedChannel::UpdateOldestUnackedMessageId()
+    {
+        const uint16_t stopMessageId = m_messageSendQueue->GetSequence();
 
-        if ( fragmentData )
+        while ( true )
         {
-            const uint16_t expectedMessageId = m_messageReceiveQueue->GetSequence();
-
-            if ( messageId != expectedMessageId )
+            if ( m_oldestUnackedMessageId == stopMessageId || m_messageSendQueue->Find( m_oldestUnackedMessageId ) )
             {
-                // todo
-                //printf( "%p: wrong block message id: expected %d, got %d\n", this, expectedMessageId, messageId );
-                return;
+                break;
             }
+            ++m_oldestUnackedMessageId;
+        }
 
-            // start receiving a new block
+        yojimbo_assert( !sequence_greater_than( m_oldestUnackedMessageId, stopMessageId ) );
+    }
 
-            if ( !m_receiveBlock->active )
-            {
-                // todo
-                // printf( "%p: start receiving new block: messageId = %d\n", this, messageId );
+    bool ReliableOrderedChannel::SendingBlockMessage()
+    {
+        yojimbo_assert( HasMessagesToSend() );
 
-                yojimbo_assert( numFragments >= 0 );
-                yojimbo_assert( numFragments <= m_config.GetMaxFragmentsPerBlock() );
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
 
-                m_receiveBlock->active = true;
-                m_receiveBlock->numFragments = numFragments;
-                m_receiveBlock->numReceivedFragments = 0;
-                m_receiveBlock->messageId = messageId;
-                m_receiveBlock->blockSize = 0;
-                m_receiveBlock->receivedFragment->Clear();
-            }
+        return entry ? entry->block : false;
+    }
 
-            // validate fragment
+    int ReliableOrderedChannel::GetFragmentsToSend( uint16_t * messageIds, uint32_t * fragmentIds, int * fragmentBytes, int & numFragments, int availableBits )
+    {
+        yojimbo_assert( SendingBlockMessage() );
 
-            if ( fragmentId >= m_receiveBlock->numFragments )
-            {
-                // The fragment id is out of range.
-                SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                return;
-            }
+        numFragments = 0;
 
-            if ( numFragments != m_receiveBlock->numFragments )
-            {
-                // The number of fragments is out of range.
-                SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                return;
-            }
+        if ( m_limits.packetBudget > 0 )
+            availableBits = yojimbo_min( m_limits.packetBudget * 8, availableBits );
 
-            // receive the fragment
+        int usedBits = ( m_config.maxFragmentsPerPacket > 1 ) ? bits_required( 1, m_config.maxFragmentsPerPacket ) : 0;
 
-            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId ) )
-            {
-                // todo
-                // printf( "%p: received fragment: messageId = %d, fragmentId = %d\n", this, messageId, fragmentId );
+        // Blocks in flight are the consecutive block messages starting at the oldest unacked message.
+        // Holes are blocks that have already been fully acked. Stop at the first regular message.
 
-                m_receiveBlock->receivedFragment->SetBit( fragmentId );
+        const int messageLimit = yojimbo_min( m_config.maxBlocksInFlight, (int) uint16_t( m_sendMessageId - m_oldestUnackedMessageId ) );
 
-                memcpy( m_receiveBlock->blockData + fragmentId * m_config.fragmentSize, fragmentData, fragmentBytes );
+        // Fill the packet from the oldest block first, so blocks complete in the order they are delivered.
+        // Each fragment is marked as sent when it is selected, so the next pick from the same block moves on to the next due fragment.
 
-                if ( fragmentId == 0 )
+        bool packetFull = false;
+
+        for ( int i = 0; i < messageLimit && !packetFull; ++i )
+        {
+            const uint16_t messageId = m_oldestUnackedMessageId + i;
+
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+
+            if ( !entry )
+                continue;
+
+            if ( !entry->block || !InRemoteBlockLimit( messageId ) )
+                break;
+
+            SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+            while ( true )
+            {
+                if ( numFragments == m_config.maxFragmentsPerPacket )
+                {
+                    packetFull = true;
+                    break;
+                }
+
+                uint32_t fragmentId;
+                int bytes;
+
+                const bool parity = GetParityToSend( messageId, fragmentId, bytes );
+
+                if ( !parity && !GetFragmentToSend( messageId, fragmentId, bytes ) )
+                    break;
+
+                int fragmentBits = ConservativeFragmentHeaderEstimate + bytes * 8;
+
+                if ( m_config.resumableBlocks )
+                    fragmentBits += 64;
+
+                if ( m_config.fragmentParityGroupSize > 0 )
+                    fragmentBits += parity ? 17 : 1;
+
+                if ( fragmentId == 0 )
+                    fragmentBits += entry->measuredBits + m_messageFactory->GetMessageTypeBits( entry->message->GetType() );
+
+                if ( fragmentId == 0 && m_config.compressBlocks )
+                    fragmentBits += 1 + bits_required( 1, m_config.maxBlockSize );
+
+                if ( numFragments > 0 && usedBits + fragmentBits > availableBits )
+                {
+                    // a parity fragment that doesn't fit goes in the next packet instead
+                    if ( parity )
+                        sendBlock->nextParityGroup--;
+                    packetFull = true;
+                    break;
+                }
+
+                usedBits += fragmentBits;
+
+                if ( !parity )
+                {
+                    if ( sendBlock->fragmentSendTime[fragmentId] != -FLT_MAX )
+                        m_counters[CHANNEL_COUNTER_FRAGMENTS_RESENT]++;
+                    sendBlock->fragmentSendTime[fragmentId] = float( m_time - sendBlock->startTime );
+                    sendBlock->pendingFragment->ClearBit( fragmentId );
+                    if ( !sendBlock->queuedFragment->GetBit( fragmentId ) )
+                        sendBlock->PushSentFragment( fragmentId, sendBlock->fragmentSendTime[fragmentId] );
+                }
+
+                messageIds[numFragments] = messageId;
+                fragmentIds[numFragments] = fragmentId;
+                fragmentBytes[numFragments] = bytes;
+                numFragments++;
+            }
+        }
+
+        return usedBits;
+    }
+
+    bool ReliableOrderedChannel::GetFragmentToSend( uint16_t messageId, uint32_t & fragmentId, int & fragmentBytes )
+    {
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+
+        yojimbo_assert( entry );
+        yojimbo_assert( entry->block );
+
+        BlockMessage * blockMessage = (BlockMessage*) entry->message;
+
+        yojimbo_assert( blockMessage );
+
+        SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        const int blockSize = blockMessage->GetBlockSize();
+
+        if ( !sendBlock->active )
+        {
+            // start sending this block
+
+            // todo
+            //printf( "%p: start sending block: messageId = %d\n", this, messageId );
+
+            if ( !m_blockBuffersAllocated && !AllocateBlockBuffers() )
+            {
+                // Not enough memory for the block buffers
+                SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                return false;
+            }
+
+            sendBlock->active = true;
+            sendBlock->blockSize = blockSize;
+            sendBlock->blockMessageId = messageId;
+
+            // the block is compressed once up front, and fragments are cut from the compressed data
+
+            if ( m_config.compressBlocks && !sendBlock->CompressBlock( blockMessage->GetBlockData(), blockSize ) )
+            {
+                // Not enough memory to compress this block
+                sendBlock->active = false;
+                SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                return false;
+            }
+
+            sendBlock->numFragments = (int) ceil( sendBlock->blockSize / float( m_config.fragmentSize ) );
+            sendBlock->numAckedFragments = 0;
+            sendBlock->firstUnackedFragment = 0;
+
+            yojimbo_assert( sendBlock->numFragments > 0 );
+            yojimbo_assert( sendBlock->numFragments <= m_config.GetMaxFragmentsPerBlock() );
+
+            if ( m_config.largeBlocks && !sendBlock->AllocateFragments( sendBlock->numFragments ) )
+            {
+                // Not enough memory to track the fragments of this block
+                sendBlock->active = false;
+                sendBlock->FreeCompressedData();
+                SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                return false;
+            }
+
+            sendBlock->ackedFragment->Clear();
+            sendBlock->pendingFragment->Clear();
+            sendBlock->pendingFragment->SetRange( 0, sendBlock->numFragments );
+            sendBlock->queuedFragment->Clear();
+            sendBlock->sentQueueHead = 0;
+            sendBlock->numSentQueue = 0;
+
+            sendBlock->startTime = m_time;
+
+            for ( int i = 0; i < sendBlock->numFragments; ++i )
+                sendBlock->fragmentSendTime[i] = -FLT_MAX;
+
+            if ( m_config.fragmentParityGroupSize > 0 )
+            {
+                const uint8_t * blockData = sendBlock->compressedData ? sendBlock->compressedData : blockMessage->GetBlockData();
+
+                if ( !sendBlock->ComputeParity( blockData, m_config.fragmentSize, m_config.GetNumParityGroups( sendBlock->numFragments ), m_config.fragmentParityGroupSize ) )
+                {
+                    // Not enough memory for the parity of this block
+                    sendBlock->active = false;
+                    sendBlock->FreeCompressedData();
+                    if ( m_config.largeBlocks )
+                        sendBlock->FreeFragments();
+                    SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return false;
+                }
+            }
+
+            // message ids start over on a new connection, so the receiver recognizes a block it can resume by its content
+
+            if ( m_config.resumableBlocks )
+                sendBlock->blockHash = murmur_hash_64( blockMessage->GetBlockData(), blockSize, 0 );
+        }
+
+        yojimbo_assert( sendBlock->blockMessageId == messageId );
+
+        // find the next fragment to send (there may not be one)
+
+        bool found = false;
+
+        const float resendBefore = float( m_time - sendBlock->startTime - m_fragmentResendTime );
+
+        // fragments in flight go back to pending once their resend time passes. the sent queue is in send order, so only its head needs checking
+
+        while ( sendBlock->numSentQueue > 0 )
+        {
+            const SendBlockData::SentFragment sent = sendBlock->sentQueue[sendBlock->sentQueueHead];
+            if ( sent.sendTime >= resendBefore )
+                break;
+            sendBlock->sentQueueHead = ( sendBlock->sentQueueHead + 1 ) % sendBlock->numFragments;
+            sendBlock->numSentQueue--;
+            sendBlock->queuedFragment->ClearBit( sent.fragmentId );
+            if ( sendBlock->ackedFragment->GetBit( sent.fragmentId ) || sendBlock->fragmentSendTime[sent.fragmentId] == -FLT_MAX )
+                continue;
+            // a fragment lost and sent again while it was queued goes back in the queue at the time it was sent last
+            if ( sendBlock->fragmentSendTime[sent.fragmentId] == sent.sendTime )
+                sendBlock->pendingFragment->SetBit( sent.fragmentId );
+            else
+                sendBlock->PushSentFragment( sent.fragmentId, sendBlock->fragmentSendTime[sent.fragmentId] );
+        }
+
+        const int i = sendBlock->pendingFragment->FindFirstSet( sendBlock->firstUnackedFragment );
+        if ( i >= 0 && i < sendBlock->numFragments )
+        {
+            fragmentId = uint32_t( i );
+            found = true;
+        }
+
+        if ( !found )
+            return false;
+
+        fragmentBytes = m_config.fragmentSize;
+        
+        const int fragmentRemainder = sendBlock->blockSize % m_config.fragmentSize;
+
+        if ( fragmentRemainder && int( fragmentId ) == sendBlock->numFragments - 1 )
+            fragmentBytes = fragmentRemainder;
+
+        return true;
+    }
+
+    bool ReliableOrderedChannel::GetParityToSend( uint16_t messageId, uint32_t & fragmentId, int & fragmentBytes )
+    {
+        SendBlockData * sendBlock = m_sendBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        if ( !sendBlock->active || !sendBlock->parityData || sendBlock->blockMessageId != messageId )
+            return false;
+
+        const int groupSize = m_config.fragmentParityGroupSize;
+
+        while ( sendBlock->nextParityGroup < sendBlock->numParityGroups )
+        {
+            const int group = sendBlock->nextParityGroup;
+            const int firstFragment = 1 + group * groupSize;
+            const int lastFragment = yojimbo_min( firstFragment + groupSize, sendBlock->numFragments ) - 1;
+
+            if ( sendBlock->fragmentSendTime[lastFragment] == -FLT_MAX )
+                return false;
+
+            sendBlock->nextParityGroup++;
+
+            const int unackedFragment = sendBlock->ackedFragment->FindFirstClear( firstFragment );
+
+            if ( unackedFragment < 0 || unackedFragment > lastFragment )
+                continue;
+
+            fragmentId = ParityFragmentFlag | uint32_t( group );
+
+            // the parity is as long as the longest fragment in the group. only the last fragment of the block can be short
+
+            fragmentBytes = m_config.fragmentSize;
+
+            if ( firstFragment == lastFragment && lastFragment == sendBlock->numFragments - 1 )
+                fragmentBytes = sendBlock->blockSize - lastFragment * m_config.fragmentSize;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    bool ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, const uint16_t * messageIds, const uint32_t * fragmentIds, const int * fragmentBytes, int numFragments )
+    {
+        yojimbo_assert( numFragments > 0 );
+
+        packetData.Initialize();
+
+        packetData.channelIndex = GetChannelIndex();
+
+        packetData.blockMessage = 1;
+
+        // fragment data points directly into the block, which stays alive in the send queue while the packet is written
+
+        packetData.borrowedFragmentData = 1;
+
+        packetData.block.fragments = packetData.AllocateFragments( *m_messageFactory, numFragments );
+
+        if ( !packetData.block.fragments )
+        {
+            packetData.block.numFragmentsInPacket = 0;
+            return false;
+        }
+
+        packetData.block.numFragmentsInPacket = numFragments;
+
+        memset( packetData.block.fragments, 0, sizeof( ChannelPacketData::BlockFragmentData ) * numFragments );
+
+        for ( int i = 0; i < numFragments; ++i )
+        {
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageIds[i] );
+
+            yojimbo_assert( entry );
+            yojimbo_assert( entry->message );
+            yojimbo_assert( entry->block );
+
+            BlockMessage * blockMessage = (BlockMessage*) entry->message;
+
+            ChannelPacketData::BlockFragmentData & fragment = packetData.block.fragments[i];
+
+            const SendBlockData * sendBlock = m_sendBlocks[ messageIds[i] % m_config.maxBlocksInFlight ];
+
+            const uint8_t * blockData = sendBlock->compressedData ? sendBlock->compressedData : blockMessage->GetBlockData();
+
+            if ( fragmentIds[i] & ParityFragmentFlag )
+            {
+                const int group = int( fragmentIds[i] & ~ParityFragmentFlag );
+                const int firstFragment = 1 + group * m_config.fragmentParityGroupSize;
+                const int lastFragment = yojimbo_min( firstFragment + m_config.fragmentParityGroupSize, sendBlock->numFragments ) - 1;
+
+                uint16_t paritySizes = 0;
+                for ( int j = firstFragment; j <= lastFragment; ++j )
+                    paritySizes ^= uint16_t( ( j == sendBlock->numFragments - 1 ) ? sendBlock->blockSize - j * m_config.fragmentSize : m_config.fragmentSize );
+
+                fragment.fragmentData = sendBlock->parityData + size_t( group ) * m_config.fragmentSize;
+                fragment.messageId = messageIds[i];
+                fragment.fragmentId = uint32_t( group );
+                fragment.fragmentSize = fragmentBytes[i];
+                fragment.numFragments = sendBlock->numFragments;
+                fragment.messageType = blockMessage->GetType();
+                fragment.blockHash = sendBlock->blockHash;
+                fragment.uncompressedSize = 0;
+                fragment.parity = true;
+                fragment.paritySizes = paritySizes;
+                fragment.message = NULL;
+                continue;
+            }
+
+            fragment.fragmentData = (uint8_t*) blockData + size_t( fragmentIds[i] ) * m_config.fragmentSize;
+
+            fragment.messageId = messageIds[i];
+            fragment.fragmentId = fragmentIds[i];
+            fragment.fragmentSize = fragmentBytes[i];
+            fragment.numFragments = sendBlock->numFragments;
+            fragment.messageType = blockMessage->GetType();
+            fragment.blockHash = sendBlock->blockHash;
+            fragment.uncompressedSize = sendBlock->uncompressedSize;
+            fragment.parity = false;
+            fragment.paritySizes = 0;
+
+            if ( fragmentIds[i] == 0 )
+            {
+                fragment.message = blockMessage;
+                m_messageFactory->AcquireMessage( fragment.message );
+            }
+            else
+            {
+                fragment.message = NULL;
+            }
+
+            // todo
+            //printf( "%p: send block fragment: messageId = %d, fragmentId = %d\n", this, messageIds[i], fragmentIds[i] );
+        }
+
+        return true;
+    }
+
+    void ReliableOrderedChannel::AddFragmentPacketEntry( const uint16_t * messageIds, const uint32_t * fragmentIds, int numFragments, uint16_t sequence )
+    {
+        SentPacketEntry * sentPacket = m_sentPackets->Insert( sequence );
+        yojimbo_assert( sentPacket );
+        if ( sentPacket )
+        {
+            sentPacket->numMessageIds = 0;
+            sentPacket->acked = 0;
+            sentPacket->block = 1;
+            sentPacket->numBlockFragments = numFragments;
+            sentPacket->resume = 0;
+            sentPacket->receiveWindow = 0;
+            uint16_t * sentPacketIds = GetSentPacketIds( sequence );
+            for ( int i = 0; i < numFragments; ++i )
+            {
+                sentPacketIds[i] = messageIds[i];
+                sentPacketIds[numFragments + i] = uint16_t( fragmentIds[i] );
+                sentPacketIds[numFragments * 2 + i] = uint16_t( fragmentIds[i] >> 16 );
+            }
+        }
+    }
+
+    void ReliableOrderedChannel::ProcessParityFragment( uint16_t messageId, int numFragments, int group, const uint8_t * parityData, int parityBytes, uint16_t paritySizes, uint64_t blockHash )
+    {
+        yojimbo_assert( m_parityScratch );
+
+        if ( !parityData )
+            return;
+
+        ReceiveBlockData * receiveBlock = m_receiveBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        if ( !receiveBlock->active || receiveBlock->messageId != messageId || receiveBlock->numFragments != numFragments || receiveBlock->blockHash != blockHash )
+            return;
+
+        const int fragmentSize = m_config.fragmentSize;
+        const int firstFragment = 1 + group * m_config.fragmentParityGroupSize;
+        const int lastFragment = yojimbo_min( firstFragment + m_config.fragmentParityGroupSize, numFragments ) - 1;
+
+        const int missingFragment = receiveBlock->receivedFragment->FindFirstClear( firstFragment );
+
+        if ( missingFragment < 0 || missingFragment > lastFragment )
+            return;
+
+        // with more than one fragment missing the parity can't rebuild either of them
+
+        const int nextMissingFragment = receiveBlock->receivedFragment->FindFirstClear( missingFragment + 1 );
+
+        if ( nextMissingFragment >= 0 && nextMissingFragment <= lastFragment )
+            return;
+
+        memset( m_parityScratch, 0, fragmentSize );
+        memcpy( m_parityScratch, parityData, parityBytes );
+
+        uint16_t missingBytes = paritySizes;
+
+        for ( int i = firstFragment; i <= lastFragment; ++i )
+        {
+            if ( i == missingFragment )
+                continue;
+
+            const int bytes = ( i == numFragments - 1 ) ? int( receiveBlock->blockSize ) - i * fragmentSize : fragmentSize;
+
+            missingBytes ^= uint16_t( bytes );
+
+            const uint8_t * fragmentData = receiveBlock->blockData + size_t( i ) * fragmentSize;
+            for ( int j = 0; j < bytes; ++j )
+                m_parityScratch[j] ^= fragmentData[j];
+        }
+
+        if ( missingBytes < 1 || missingBytes > fragmentSize || ( missingFragment != numFragments - 1 && missingBytes != fragmentSize ) )
+        {
+            // The parity doesn't match the fragments it covers.
+            SetErrorLevel( CHANNEL_ERROR_DESYNC );
+            return;
+        }
+
+        m_counters[CHANNEL_COUNTER_FRAGMENTS_RECOVERED]++;
+
+        ProcessPacketFragment( 0, messageId, numFragments, uint32_t( missingFragment ), m_parityScratch, missingBytes, NULL, blockHash, 0 );
+    }
+
+    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint32_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage, uint64_t blockHash, int uncompressedSize )
+    {  
+        yojimbo_assert( !m_config.disableBlocks );
+
+        if ( fragmentData )
+        {
+            // Blocks are only sent once every message before them has been received, so fragments
+            // for message ids we have already received, or that are outside the receive window, are stale.
+
+            const uint16_t minMessageId = m_receiveMessageId;
+            const uint16_t maxMessageId = m_receiveMessageId + m_messageReceiveQueue->GetSize() - 1;
+
+            if ( sequence_less_than( messageId, minMessageId ) || sequence_greater_than( messageId, maxMessageId ) )
+                return;
+
+            if ( m_messageReceiveQueue->Find( messageId ) )
+                return;
+
+            ReceiveBlockData * receiveBlock = m_receiveBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+            if ( receiveBlock->active && receiveBlock->messageId != messageId )
+            {
+                // todo
+                //printf( "%p: wrong block message id: expected %d, got %d\n", this, receiveBlock->messageId, messageId );
+                return;
+            }
+
+            // start receiving a new block
+
+            if ( !receiveBlock->active )
+            {
+                // todo
+                // printf( "%p: start receiving new block: messageId = %d\n", this, messageId );
+
+                yojimbo_assert( numFragments >= 0 );
+                yojimbo_assert( numFragments <= m_config.GetMaxFragmentsPerBlock() );
+
+                if ( !m_blockBuffersAllocated && !AllocateBlockBuffers() )
+                {
+                    // Not enough memory for the block buffers
+                    SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
+
+                bool resumed = false;
+
+                if ( ReassemblesBlocksInPlace() )
+                {
+                    if ( numFragments <= 0 || numFragments > m_config.GetMaxFragmentsPerBlock() )
+                    {
+                        // The number of fragments is out of range.
+                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+
+                    if ( m_config.largeBlocks )
+                    {
+                        yojimbo_assert( !receiveBlock->receivedFragment );
+
+                        receiveBlock->receivedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, numFragments );
+
+                        if ( !receiveBlock->receivedFragment )
+                        {
+                            // Not enough memory to track the fragments of this block
+                            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                            return;
+                        }
+                    }
+
+                    // The final block size isn't known until the last fragment arrives, so allocate for the worst case.
+
+                    yojimbo_assert( !receiveBlock->blockData );
+                    yojimbo_assert( !receiveBlock->sharedBlock );
+
+                    const int maxBytes = numFragments * m_config.fragmentSize;
+
+                    if ( m_config.resumableBlocks )
+                    {
+                        receiveBlock->sharedBlock = m_messageFactory->FindResumeBlock( m_channelIndex, blockHash, maxBytes );
+
+                        if ( receiveBlock->sharedBlock )
+                        {
+                            SharedBlock * sharedBlock = receiveBlock->sharedBlock;
+
+                            BitArray * receivedFragments = sharedBlock->GetReceivedFragments();
+
+                            resumed = sharedBlock->GetSize() >= maxBytes && sharedBlock->GetBlockHash() == blockHash && receivedFragments && receivedFragments->GetSize() == numFragments;
+
+                            if ( !resumed )
+                            {
+                                // not a partial copy of this block after all, so receive it from scratch
+                                sharedBlock->Release();
+                                receiveBlock->sharedBlock = NULL;
+                            }
+                        }
+                    }
+
+                    if ( !receiveBlock->sharedBlock )
+                        receiveBlock->sharedBlock = m_messageFactory->CreateReceiveBlock( m_channelIndex, messageId, maxBytes );
+
+                    if ( receiveBlock->sharedBlock )
+                    {
+                        yojimbo_assert( receiveBlock->sharedBlock->GetSize() >= maxBytes );
+                        receiveBlock->blockData = receiveBlock->sharedBlock->GetData();
+                    }
+                    else
+                    {
+                        receiveBlock->blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), maxBytes );
+                    }
+
+                    if ( !receiveBlock->blockData )
+                    {
+                        // Not enough memory to allocate block data
+                        SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                        return;
+                    }
+
+                    if ( m_config.resumableBlocks && receiveBlock->sharedBlock && !resumed && !receiveBlock->sharedBlock->InitializeResume( blockHash, numFragments ) )
+                    {
+                        // Not enough memory to track the fragments of this block
+                        SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                        return;
+                    }
+                }
+
+                receiveBlock->active = true;
+                receiveBlock->numFragments = numFragments;
+                receiveBlock->numReceivedFragments = 0;
+                receiveBlock->numContiguousFragments = 0;
+                receiveBlock->messageId = messageId;
+                receiveBlock->blockSize = 0;
+                receiveBlock->blockHash = blockHash;
+                receiveBlock->receivedFragment->Clear();
+
+                if ( resumed && !RestoreReceiveBlock( messageId ) )
+                {
+                    // Not enough memory to track the received fragment bitmap
+                    SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
+            }
+
+            // validate fragment
+
+            if ( fragmentId >= uint32_t( receiveBlock->numFragments ) )
+            {
+                // The fragment id is out of range.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            if ( numFragments != receiveBlock->numFragments )
+            {
+                // The number of fragments is out of range.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            if ( blockHash != receiveBlock->blockHash )
+            {
+                // The fragment belongs to a different block.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            // receive the fragment
+
+            if ( !receiveBlock->receivedFragment->GetBit( fragmentId ) )
+            {
+                // todo
+                // printf( "%p: received fragment: messageId = %d, fragmentId = %d\n", this, messageId, fragmentId );
+
+                receiveBlock->receivedFragment->SetBit( fragmentId );
+
+                memcpy( receiveBlock->blockData + size_t( fragmentId ) * m_config.fragmentSize, fragmentData, fragmentBytes );
+
+                if ( m_config.resumableBlocks && receiveBlock->sharedBlock )
+                    receiveBlock->sharedBlock->GetReceivedFragments()->SetBit( fragmentId );
+
+                if ( fragmentId == 0 )
+                {
+                    receiveBlock->messageType = messageType;
+                    receiveBlock->uncompressedSize = uncompressedSize;
+                }
+
+                if ( fragmentId == uint32_t( receiveBlock->numFragments - 1 ) )
+                {
+                    receiveBlock->blockSize = ( receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
+
+                    if ( receiveBlock->blockSize > (uint32_t) m_config.maxBlockSize )
+                    {
+                        // The block size is outside range
+                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+                }
+
+                receiveBlock->numReceivedFragments++;
+
+                if ( fragmentId == uint32_t( receiveBlock->numContiguousFragments ) )
+                {
+                    const int numContiguousFragments = receiveBlock->receivedFragment->FindFirstClear( receiveBlock->numContiguousFragments );
+                    receiveBlock->numContiguousFragments = numContiguousFragments >= 0 ? yojimbo_min( numContiguousFragments, receiveBlock->numFragments ) : receiveBlock->numFragments;
+                }
+
+                if ( fragmentId == 0 )
+                {
+                    // save block message (sent with fragment 0)
+
+                    receiveBlock->blockMessage = blockMessage;
+
+                    m_messageFactory->AcquireMessage( receiveBlock->blockMessage );
+                }
+
+                if ( receiveBlock->numReceivedFragments == receiveBlock->numFragments )
+                {
+                    // todo
+                    // printf( "%p: finished receiving block: messageId = %d, fragmentId = %d\n", this, messageId, fragmentId );
+
+                    // finished receiving block
+
+                    if ( m_messageReceiveQueue->GetAtIndex( m_messageReceiveQueue->GetIndex( messageId ) ) )
+                    {
+                        // Did you forget to dequeue messages on the receiver?
+                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+
+                    blockMessage = receiveBlock->blockMessage;
+
+                    yojimbo_assert( blockMessage );
+
+                    if ( receiveBlock->uncompressedSize > 0 )
+                    {
+                        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), receiveBlock->uncompressedSize );
+
+                        if ( !blockData )
+                        {
+                            // Not enough memory to allocate block data
+                            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                            return;
+                        }
+
+                        if ( lz4_decompress_data( receiveBlock->blockData, receiveBlock->blockSize, blockData, receiveBlock->uncompressedSize ) != receiveBlock->uncompressedSize )
+                        {
+                            // The block failed to decompress
+                            YOJIMBO_FREE( m_messageFactory->GetAllocator(), blockData );
+                            SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                            return;
+                        }
+
+                        // the compressed data isn't needed anymore
+
+                        if ( receiveBlock->sharedBlock )
+                        {
+                            receiveBlock->sharedBlock->Release();
+                            receiveBlock->sharedBlock = NULL;
+                            receiveBlock->blockData = NULL;
+                        }
+                        else if ( ReassemblesBlocksInPlace() )
+                        {
+                            YOJIMBO_FREE( m_messageFactory->GetAllocator(), receiveBlock->blockData );
+                        }
+
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, receiveBlock->uncompressedSize );
+                    }
+                    else if ( receiveBlock->sharedBlock )
+                    {
+                        // hand the shared block over to the block message
+
+                        blockMessage->AttachSharedBlock( receiveBlock->sharedBlock, receiveBlock->blockSize );
+
+                        receiveBlock->sharedBlock->Release();
+                        receiveBlock->sharedBlock = NULL;
+                        receiveBlock->blockData = NULL;
+                    }
+                    else if ( ReassemblesBlocksInPlace() )
+                    {
+                        // hand the reassembly allocation over to the block message
+
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), receiveBlock->blockData, receiveBlock->blockSize );
+
+                        receiveBlock->blockData = NULL;
+                    }
+                    else
+                    {
+                        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), receiveBlock->blockSize );
+
+                        if ( !blockData )
+                        {
+                            // Not enough memory to allocate block data
+                            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                            return;
+                        }
+
+                        memcpy( blockData, receiveBlock->blockData, receiveBlock->blockSize );
+
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, receiveBlock->blockSize );
+                    }
+
+                    blockMessage->SetId( messageId );
+
+                    receiveBlock->active = false;
+                    receiveBlock->blockMessage = NULL;
+                    receiveBlock->FreeResume();
+
+                    if ( m_config.largeBlocks )
+                        YOJIMBO_DELETE( *m_allocator, BitArray, receiveBlock->receivedFragment );
+
+                    AddReceivedMessage( messageId, blockMessage );
+                }
+            }
+        }
+    }
+
+    bool ReliableOrderedChannel::RestoreReceiveBlock( uint16_t messageId )
+    {
+        ReceiveBlockData * receiveBlock = m_receiveBlocks[ messageId % m_config.maxBlocksInFlight ];
+
+        yojimbo_assert( receiveBlock->active );
+        yojimbo_assert( receiveBlock->sharedBlock );
+
+        BitArray * receivedFragments = receiveBlock->sharedBlock->GetReceivedFragments();
+
+        yojimbo_assert( receivedFragments );
+        yojimbo_assert( receivedFragments->GetSize() == receiveBlock->numFragments );
+
+        // the block message comes with the first fragment and the block size with the last, so those are always received again
+
+        receivedFragments->ClearBit( 0 );
+        receivedFragments->ClearBit( receiveBlock->numFragments - 1 );
+
+        receiveBlock->numResumeWindows = ( receiveBlock->numFragments + MaxResumeFragmentsPerPacket - 1 ) / MaxResumeFragmentsPerPacket;
+        receiveBlock->resumeWindowAcked = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, receiveBlock->numResumeWindows );
+
+        if ( !receiveBlock->resumeWindowAcked )
+            return false;
+
+        // windows without any fragments to skip don't need to be sent
+
+        receiveBlock->resumeWindowAcked->SetRange( 0, receiveBlock->numResumeWindows );
+
+        for ( int i = receivedFragments->FindFirstSet( 0 ); i >= 0; i = receivedFragments->FindFirstSet( i + 1 ) )
+        {
+            receiveBlock->receivedFragment->SetBit( i );
+            receiveBlock->numReceivedFragments++;
+            receiveBlock->resumeWindowAcked->ClearBit( i / MaxResumeFragmentsPerPacket );
+        }
+
+        receiveBlock->numResumeWindowsAcked = receiveBlock->resumeWindowAcked->CountSet();
+
+        if ( receiveBlock->numResumeWindowsAcked == receiveBlock->numResumeWindows )
+            receiveBlock->FreeResume();
+
+        return true;
+    }
+
+    bool ReliableOrderedChannel::GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const
+    {
+        blockData = NULL;
+        blockBytes = 0;
+
+        if ( m_config.disableBlocks || m_errorLevel != CHANNEL_ERROR_NONE )
+            return false;
+
+        const ReceiveBlockData * receiveBlock = m_receiveBlocks[ m_receiveMessageId % m_config.maxBlocksInFlight ];
+
+        if ( !receiveBlock->active || receiveBlock->messageId != m_receiveMessageId || receiveBlock->uncompressedSize > 0 )
+            return false;
+
+        blockData = receiveBlock->blockData;
+        blockBytes = receiveBlock->numContiguousFragments * m_config.fragmentSize;
+
+        return true;
+    }
+
+    // ------------------------------------------------
+
+    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time ) : Channel( allocator, messageFactory, config, channelIndex, time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED || config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED );
+
+        m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<MessageSendQueueEntry>, *m_allocator, m_config.sendQueueSize );
+        
+        m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.receiveQueueSize );
+
+        m_redundantMessages = NULL;
+        m_sentPackets = NULL;
+        m_receivedMessageIds = NULL;
+
+        if ( m_config.redundantMessages > 0 )
+        {
+            yojimbo_assert( m_config.redundantMessages < 32768 );
+
+            m_redundantMessages = (RedundantMessageEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( RedundantMessageEntry ) * m_config.redundantMessages );
+
+            memset( m_redundantMessages, 0, sizeof( RedundantMessageEntry ) * m_config.redundantMessages );
+
+            m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
+
+            m_receivedMessageIds = YOJIMBO_NEW( *m_allocator, SequenceBuffer<uint8_t>, *m_allocator, m_config.receiveQueueSize );
+        }
+
+        m_jitterBuffer = NULL;
+        m_numJitterBufferEntries = 0;
+
+        if ( m_config.jitterBuffer )
+        {
+            yojimbo_assert( m_config.jitterBufferTickRate > 0.0f );
+            yojimbo_assert( m_config.jitterBufferMinDelay <= m_config.jitterBufferMaxDelay );
+
+            m_jitterBuffer = (JitterBufferEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( JitterBufferEntry ) * m_config.receiveQueueSize );
+        }
+
+        Reset();
+    }
+
+    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
+    {
+        Reset();
+
+        YOJIMBO_DELETE( *m_allocator, Queue<MessageSendQueueEntry>, m_messageSendQueue );
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
+        YOJIMBO_FREE( *m_allocator, m_redundantMessages );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<uint8_t>, m_receivedMessageIds );
+        YOJIMBO_FREE( *m_allocator, m_jitterBuffer );
+    }
+
+    void UnreliableUnorderedChannel::Reset()
+    {
+        SetErrorLevel( CHANNEL_ERROR_NONE );
+
+        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+            m_messageFactory->ReleaseMessage( (*m_messageSendQueue)[i].message );
+
+        for ( int i = 0; i < m_messageReceiveQueue->GetNumEntries(); ++i )
+            m_messageFactory->ReleaseMessage( (*m_messageReceiveQueue)[i] );
+
+        m_messageSendQueue->Clear();
+        m_messageReceiveQueue->Clear();
+
+        if ( !m_messageSendQueue->Resize( m_config.sendQueueSize ) || !m_messageReceiveQueue->Resize( m_config.receiveQueueSize ) )
+        {
+            // Not enough memory to grow the queues back
+            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+        }
+
+        m_limits = ChannelLimits( m_config );
+
+        m_sendMessageId = 0;
+
+        if ( m_redundantMessages )
+        {
+            for ( int i = 0; i < m_config.redundantMessages; ++i )
+            {
+                if ( m_redundantMessages[i].message )
+                    m_messageFactory->ReleaseMessage( m_redundantMessages[i].message );
+            }
+
+            memset( m_redundantMessages, 0, sizeof( RedundantMessageEntry ) * m_config.redundantMessages );
+
+            m_sentPackets->Reset();
+            m_receivedMessageIds->Reset();
+        }
+
+        for ( int i = 0; i < m_numJitterBufferEntries; ++i )
+            m_messageFactory->ReleaseMessage( m_jitterBuffer[i].message );
+
+        m_numJitterBufferEntries = 0;
+        m_hasJitterTick = false;
+        m_jitterBaseTick = 0;
+        m_jitterLastTick = 0;
+        m_jitterLastTransit = 0.0;
+        m_jitterTransit = 0.0;
+        m_jitter = 0.0;
+        m_hasPlayoutTick = false;
+        m_playoutTick = 0;
+
+        m_priorityTime = m_time;
+  
+        ResetCounters();
+    }
+
+    bool UnreliableUnorderedChannel::CanSendMessage() const
+    {
+        yojimbo_assert( m_messageSendQueue );
+        return !m_messageSendQueue->IsFull();
+    }
+
+    void UnreliableUnorderedChannel::SendMessage( Message * message )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( CanSendMessage() );
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+        {
+            m_messageFactory->ReleaseMessage( message );
+            return;
+        }
+
+        if ( !CanSendMessage() )
+        {
+            SetErrorLevel( CHANNEL_ERROR_SEND_QUEUE_FULL );
+            m_messageFactory->ReleaseMessage( message );
+            return;
+        }
+
+        yojimbo_assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+
+        if ( message->IsBlockMessage() && m_config.disableBlocks )
+        {
+            SetErrorLevel( CHANNEL_ERROR_BLOCKS_DISABLED );
+            m_messageFactory->ReleaseMessage( message );
+            return;
+        }
+
+        if ( message->IsBlockMessage() )
+        {
+            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
+            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
+        }
+
+        int measuredBits = MeasureMessage( message, *m_messageFactory );
+
+        if ( message->IsBlockMessage() )
+        {
+            MeasureStream measureStream( m_messageFactory->GetAllocator() );
+            BlockMessage * blockMessage = (BlockMessage*) message;
+            SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
+            measuredBits += measureStream.GetBitsProcessed();
+        }
+
+        if ( m_config.jitterBuffer )
+            measuredBits += 32;
+
+        MessageSendQueueEntry entry;
+        entry.message = message;
+        entry.timeQueued = m_time;
+        entry.measuredBits = measuredBits;
+        entry.accumulatedPriority = message->GetPriority();
+
+        m_messageSendQueue->Push( entry );
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+    }
+
+    Message * UnreliableUnorderedChannel::ReceiveMessage()
+    {
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return NULL;
+
+        if ( m_messageReceiveQueue->IsEmpty() )
+            return NULL;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+        return m_messageReceiveQueue->Pop();
+    }
+
+    int UnreliableUnorderedChannel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return 0;
+
+        int numReceived = 0;
+        while ( numReceived < maxMessages && !m_messageReceiveQueue->IsEmpty() )
+            messages[numReceived++] = m_messageReceiveQueue->Pop();
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] += numReceived;
+
+        return numReceived;
+    }
+
+    void UnreliableUnorderedChannel::AdvanceTime( double time )
+    {
+        if ( m_config.priorityAccumulator && time > m_priorityTime )
+        {
+            const float deltaTime = float( time - m_priorityTime );
+            for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+            {
+                MessageSendQueueEntry & entry = (*m_messageSendQueue)[i];
+                entry.accumulatedPriority += entry.message->GetPriority() * deltaTime;
+            }
+        }
+
+        m_priorityTime = time;
+
+        if ( m_jitterBuffer )
+            UpdateJitterBuffer();
+    }
+    
+    bool UnreliableUnorderedChannel::HasTimers() const
+    {
+        return m_config.priorityAccumulator || m_jitterBuffer;
+    }
+
+    int UnreliableUnorderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        YOJIMBO_PROFILE_SCOPE( "UnreliableUnorderedChannel::GetPacketData" );
+
+        if ( m_messageSendQueue->IsEmpty() && !m_redundantMessages )
+            return 0;
+
+        if ( m_limits.packetBudget > 0 )
+            availableBits = yojimbo_min( m_limits.packetBudget * 8, availableBits );
+
+        int usedBits = ConservativeMessageHeaderEstimate;
+
+        int numMessages = 0;
+
+        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
+
+        uint32_t * measuredBits = (uint32_t*) alloca( sizeof( uint32_t ) * m_config.maxMessagesPerPacket );
+
+        if ( m_config.priorityAccumulator )
+        {
+            numMessages = GetPriorityMessagesToSend( messages, measuredBits, usedBits, availableBits );
+        }
+        else
+        {
+            const int giveUpBits = 4 * 8;
+
+            const int numEntries = m_messageSendQueue->GetNumEntries();
+
+            int numVisited = 0;
+            int numDeferred = 0;
+            bool outOfSpace = false;
+
+            while ( numVisited < numEntries )
+            {
+                if ( availableBits - usedBits < giveUpBits )
+                {
+                    outOfSpace = true;
+                    break;
+                }
+
+                if ( numMessages == m_limits.maxMessagesPerPacket )
+                    break;
+
+                MessageSendQueueEntry entry = m_messageSendQueue->Pop();
+
+                numVisited++;
+
+                Message * message = entry.message;
+
+                yojimbo_assert( message );
+
+                int messageBits = m_messageFactory->GetMessageTypeBits( message->GetType() ) + (int) entry.measuredBits;
+
+                if ( m_redundantMessages )
+                    messageBits += ( numMessages == 0 ) ? 16 : sequence_relative_bits( 0, 1 );
+            
+                if ( usedBits + messageBits > availableBits )
+                {
+                    outOfSpace = true;
+
+                    // Optionally keep the message around for a later packet instead of dropping it.
+                    // Messages that could never fit in the channel packet budget are dropped regardless.
+
+                    const bool canFitLater = m_limits.packetBudget <= 0 || ConservativeMessageHeaderEstimate + messageBits <= m_limits.packetBudget * 8;
+
+                    if ( canFitLater && m_time - entry.timeQueued < m_config.messageMaxDeferTime )
+                    {
+                        m_messageSendQueue->Push( entry );
+                        numDeferred++;
+                        continue;
+                    }
+
+                    m_messageFactory->ReleaseMessage( message );
+                    continue;
+                }
+
+                usedBits += messageBits;
+            
+                yojimbo_assert( usedBits <= availableBits );
+            
+                RecordLatency( CHANNEL_LATENCY_QUEUED, m_time - entry.timeQueued );
+
+                measuredBits[numMessages] = entry.measuredBits;
+                messages[numMessages++] = message;
+            }
+
+            // Deferred messages were pushed to the back of the queue behind the entries we didn't get to.
+            // Rotate those unvisited entries around so the deferred messages go out first next time.
+
+            if ( numDeferred > 0 )
+            {
+                for ( int i = numVisited; i < numEntries; ++i )
+                    m_messageSendQueue->Push( m_messageSendQueue->Pop() );
+            }
+
+            if ( outOfSpace )
+                m_counters[CHANNEL_COUNTER_OUT_OF_SPACE]++;
+        }
+
+        int numRedundantMessages = 0;
+
+        uint16_t * redundantMessageIds = NULL;
+
+        if ( m_redundantMessages )
+        {
+            redundantMessageIds = (uint16_t*) alloca( sizeof( uint16_t ) * m_config.maxMessagesPerPacket );
+
+            usedBits += GetRedundantMessagesToSend( m_sendMessageId, numMessages > 0, redundantMessageIds, numRedundantMessages, m_limits.maxMessagesPerPacket - numMessages, availableBits - usedBits );
+        }
+
+        if ( numMessages + numRedundantMessages == 0 )
+            return 0;
+
+        packetData.Initialize();
+        packetData.channelIndex = GetChannelIndex();
+        packetData.message.numMessages = numMessages + numRedundantMessages;
+        packetData.message.messages = packetData.AllocateMessages( *m_messageFactory, numMessages + numRedundantMessages );
+
+        // messages sent again go first, oldest first, so message ids go up through the packet
+
+        for ( int i = 0; i < numRedundantMessages; ++i )
+        {
+            Message * message = m_redundantMessages[ redundantMessageIds[numRedundantMessages-1-i] % m_config.redundantMessages ].message;
+            m_messageFactory->AcquireMessage( message );
+            packetData.message.messages[i] = message;
+        }
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            packetData.message.messages[numRedundantMessages+i] = messages[i];
+
+            if ( m_redundantMessages )
+            {
+                const uint16_t messageId = m_sendMessageId++;
+
+                messages[i]->SetId( messageId );
+
+                RedundantMessageEntry & entry = m_redundantMessages[ messageId % m_config.redundantMessages ];
+
+                if ( entry.message )
+                    m_messageFactory->ReleaseMessage( entry.message );
+
+                m_messageFactory->AcquireMessage( messages[i] );
+
+                entry.message = messages[i];
+                entry.measuredBits = measuredBits[i];
+                entry.messageId = messageId;
+                entry.acked = false;
+            }
+        }
+
+        if ( m_redundantMessages )
+        {
+            SentPacketEntry * sentPacket = m_sentPackets->Insert( packetSequence );
+            if ( sentPacket )
+            {
+                sentPacket->firstMessageId = packetData.message.messages[0]->GetId();
+                sentPacket->lastMessageId = packetData.message.messages[numMessages+numRedundantMessages-1]->GetId();
+            }
+        }
+
+        return usedBits;
+    }
+
+    static void priority_heap_sift_down( int * heap, int numHeap, const float * priorities, int index )
+    {
+        // min-heap of send queue indices, keyed by accumulated priority
+        while ( true )
+        {
+            const int left = index * 2 + 1;
+            if ( left >= numHeap )
+                break;
+            int smallest = left;
+            const int right = left + 1;
+            if ( right < numHeap && priorities[heap[right]] < priorities[heap[left]] )
+                smallest = right;
+            if ( priorities[heap[smallest]] >= priorities[heap[index]] )
+                break;
+            const int temp = heap[index];
+            heap[index] = heap[smallest];
+            heap[smallest] = temp;
+            index = smallest;
+        }
+    }
+
+    int UnreliableUnorderedChannel::GetPriorityMessagesToSend( Message ** messages, uint32_t * measuredBits, int & usedBits, int availableBits )
+    {
+        yojimbo_assert( m_config.priorityAccumulator );
+
+        const int numEntries = m_messageSendQueue->GetNumEntries();
+
+        if ( numEntries == 0 )
+            return 0;
+
+        float * priorities = (float*) alloca( sizeof( float ) * numEntries );
+
+        uint8_t * picked = (uint8_t*) alloca( numEntries );
+
+        for ( int i = 0; i < numEntries; ++i )
+        {
+            priorities[i] = (*m_messageSendQueue)[i].accumulatedPriority;
+            picked[i] = 0;
+        }
+
+        // keep the maxMessagesPerPacket entries with the most priority in a min-heap, so the root is the one to evict
+
+        const int maxCandidates = yojimbo_min( numEntries, m_limits.maxMessagesPerPacket );
+
+        int * heap = (int*) alloca( sizeof( int ) * maxCandidates );
+
+        int numHeap = 0;
+
+        for ( int i = 0; i < numEntries; ++i )
+        {
+            if ( numHeap < maxCandidates )
+            {
+                int index = numHeap++;
+                heap[index] = i;
+                while ( index > 0 && priorities[heap[(index-1)/2]] > priorities[heap[index]] )
                 {
-                    m_receiveBlock->messageType = messageType;
+                    const int parent = ( index - 1 ) / 2;
+                    const int temp = heap[parent];
+                    heap[parent] = heap[index];
+                    heap[index] = temp;
+                    index = parent;
                 }
+            }
+            else if ( priorities[i] > priorities[heap[0]] )
+            {
+                heap[0] = i;
+                priority_heap_sift_down( heap, numHeap, priorities, 0 );
+            }
+        }
+
+        // popping the min-heap gives the candidates lowest priority first, so fill the list from the back
+
+        int * candidates = (int*) alloca( sizeof( int ) * maxCandidates );
+
+        const int numCandidates = numHeap;
+
+        while ( numHeap > 0 )
+        {
+            candidates[numHeap-1] = heap[0];
+            heap[0] = heap[--numHeap];
+            priority_heap_sift_down( heap, numHeap, priorities, 0 );
+        }
+
+        const int giveUpBits = 4 * 8;
+
+        int numMessages = 0;
+
+        bool outOfSpace = false;
+
+        for ( int i = 0; i < numCandidates; ++i )
+        {
+            if ( availableBits - usedBits < giveUpBits )
+            {
+                outOfSpace = true;
+                break;
+            }
+
+            const MessageSendQueueEntry & entry = (*m_messageSendQueue)[candidates[i]];
+
+            int messageBits = m_messageFactory->GetMessageTypeBits( entry.message->GetType() ) + (int) entry.measuredBits;
+
+            if ( m_redundantMessages )
+                messageBits += ( numMessages == 0 ) ? 16 : sequence_relative_bits( 0, 1 );
+
+            if ( usedBits + messageBits > availableBits )
+            {
+                outOfSpace = true;
+                continue;
+            }
+
+            usedBits += messageBits;
+
+            RecordLatency( CHANNEL_LATENCY_QUEUED, m_time - entry.timeQueued );
+
+            measuredBits[numMessages] = entry.measuredBits;
+            messages[numMessages++] = entry.message;
+            picked[candidates[i]] = 1;
+        }
+
+        if ( outOfSpace )
+            m_counters[CHANNEL_COUNTER_OUT_OF_SPACE]++;
+
+        // take out the messages picked, keeping the rest in order. messages too old or too large to ever be sent are dropped
+
+        for ( int i = 0; i < numEntries; ++i )
+        {
+            MessageSendQueueEntry entry = m_messageSendQueue->Pop();
+
+            if ( picked[i] )
+                continue;
+
+            const int messageBits = m_messageFactory->GetMessageTypeBits( entry.message->GetType() ) + (int) entry.measuredBits;
+
+            const bool canFitLater = m_limits.packetBudget <= 0 || ConservativeMessageHeaderEstimate + messageBits <= m_limits.packetBudget * 8;
+
+            const bool expired = m_config.messageMaxDeferTime > 0.0f && m_time - entry.timeQueued >= m_config.messageMaxDeferTime;
+
+            if ( !canFitLater || expired )
+            {
+                m_messageFactory->ReleaseMessage( entry.message );
+                continue;
+            }
+
+            m_messageSendQueue->Push( entry );
+        }
+
+        return numMessages;
+    }
+
+    int UnreliableUnorderedChannel::GetRedundantMessagesToSend( uint16_t firstMessageId, bool hasMessages, uint16_t * messageIds, int & numMessageIds, int maxMessageIds, int availableBits )
+    {
+        yojimbo_assert( m_redundantMessages );
+
+        numMessageIds = 0;
+
+        int usedBits = 0;
+
+        uint16_t nextMessageId = firstMessageId;
+
+        // walk back from the newest message sent. stopping at the first message that doesn't fit keeps the ids in the
+        // packet a contiguous range, apart from messages already acked, so one range per packet is enough to ack them
+
+        for ( int i = 1; i <= m_config.redundantMessages && numMessageIds < maxMessageIds; ++i )
+        {
+            const uint16_t messageId = uint16_t( m_sendMessageId - i );
+
+            const RedundantMessageEntry & entry = m_redundantMessages[ messageId % m_config.redundantMessages ];
+
+            if ( entry.messageId != messageId || ( !entry.message && !entry.acked ) )
+                break;
+
+            if ( entry.acked )
+                continue;
+
+            // the first message id in a packet takes 16 bits, the rest are relative to the one before
+
+            int messageBits = m_messageFactory->GetMessageTypeBits( entry.message->GetType() ) + (int) entry.measuredBits;
+
+            messageBits += ( hasMessages || numMessageIds > 0 ) ? sequence_relative_bits( messageId, nextMessageId ) : 16;
+
+            if ( usedBits + messageBits > availableBits )
+                break;
+
+            usedBits += messageBits;
+
+            messageIds[numMessageIds++] = messageId;
+
+            nextMessageId = messageId;
+        }
+
+        return usedBits;
+    }
+
+    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        YOJIMBO_PROFILE_SCOPE( "UnreliableUnorderedChannel::ProcessPacketData" );
+        if ( m_errorLevel != CHANNEL_ERROR_NONE )
+            return;
+        
+        if ( packetData.messageFailedToSerialize )
+        {
+            SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            return;
+        }
+
+        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        {
+            Message * message = packetData.message.messages[i];
+            yojimbo_assert( message );  
+
+            if ( m_receivedMessageIds )
+            {
+                // drop copies of messages already received, and messages too old to tell
+
+                const uint16_t messageId = message->GetId();
+                if ( m_receivedMessageIds->Exists( messageId ) || !m_receivedMessageIds->Insert( messageId ) )
+                    continue;
+            }
+            else
+            {
+                message->SetId( packetSequence );
+            }
+
+            if ( m_jitterBuffer )
+            {
+                AddJitterBufferMessage( message );
+                continue;
+            }
+
+            if ( !m_messageReceiveQueue->IsFull() )
+            {
+                m_messageFactory->AcquireMessage( message );
+                m_messageReceiveQueue->Push( message );
+            }
+        }
+
+        // messages already due, eg. late ones, are handed out straight away instead of waiting for the next AdvanceTime
+
+        if ( m_jitterBuffer )
+            UpdateJitterBuffer();
+    }
+
+    void UnreliableUnorderedChannel::AddJitterBufferMessage( Message * message )
+    {
+        yojimbo_assert( m_jitterBuffer );
+
+        const uint32_t tick = message->GetTick();
+
+        if ( m_hasPlayoutTick && int32_t( tick - m_playoutTick ) < 0 )
+            return;
+
+        if ( m_numJitterBufferEntries == m_config.receiveQueueSize )
+            return;
+
+        if ( !m_hasJitterTick )
+        {
+            m_hasJitterTick = true;
+            m_jitterBaseTick = tick;
+            m_jitterLastTick = tick;
+            m_jitterLastTransit = m_time;
+            m_jitterTransit = m_time;
+        }
+
+        const double senderTime = int32_t( tick - m_jitterBaseTick ) / double( m_config.jitterBufferTickRate );
+
+        // jitter is measured once per tick, on the first message of each newer tick to arrive.
+        // messages from the same tick arrive together, so measuring each of them would understate it
+
+        if ( int32_t( tick - m_jitterLastTick ) > 0 )
+        {
+            const double transit = m_time - senderTime;
+            const double deviation = transit - m_jitterLastTransit;
+            m_jitter += ( ( deviation < 0.0 ? -deviation : deviation ) - m_jitter ) / 16.0;
+            m_jitterTransit += ( transit - m_jitterTransit ) / 16.0;
+            m_jitterLastTick = tick;
+            m_jitterLastTransit = transit;
+        }
+
+        // messages mostly arrive in tick order, so the insertion point is found walking back from the newest
+
+        int index = m_numJitterBufferEntries;
+        while ( index > 0 && m_jitterBuffer[index-1].senderTime > senderTime )
+        {
+            m_jitterBuffer[index] = m_jitterBuffer[index-1];
+            index--;
+        }
 
-                if ( fragmentId == m_receiveBlock->numFragments - 1 )
-                {
-                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
+        m_messageFactory->AcquireMessage( message );
 
-                    if ( m_receiveBlock->blockSize > (uint32_t) m_config.maxBlockSize )
-                    {
-                        // The block size is outside range
-                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                        return;
-                    }
-                }
+        m_jitterBuffer[index].message = message;
+        m_jitterBuffer[index].senderTime = senderTime;
 
-                m_receiveBlock->numReceivedFragments++;
+        m_numJitterBufferEntries++;
+    }
 
-                if ( fragmentId == 0 )
-                {
-                    // save block message (sent with fragment 0)
+    void UnreliableUnorderedChannel::UpdateJitterBuffer()
+    {
+        yojimbo_assert( m_jitterBuffer );
 
-                    m_receiveBlock->blockMessage = blockMessage;
+        if ( m_numJitterBufferEntries == 0 )
+            return;
 
-                    m_messageFactory->AcquireMessage( m_receiveBlock->blockMessage );
-                }
+        double playoutDelay = m_config.jitterBufferDelayScale * m_jitter;
+        playoutDelay = yojimbo_max( playoutDelay, double( m_config.jitterBufferMinDelay ) );
+        playoutDelay = yojimbo_min( playoutDelay, double( m_config.jitterBufferMaxDelay ) );
 
-                if ( m_receiveBlock->numReceivedFragments == m_receiveBlock->numFragments )
-                {
-                    // todo
-                    // printf( "%p: finished receiving block: messageId = %d, fragmentId = %d\n", this, messageId, fragmentId );
+        // the sender time due for playout now, in the timeline of the sender ticks
 
-                    // finished receiving block
+        const double playoutTime = m_time - m_jitterTransit - playoutDelay;
 
-                    if ( m_messageReceiveQueue->GetAtIndex( m_messageReceiveQueue->GetIndex( messageId ) ) )
-                    {
-                        // Did you forget to dequeue messages on the receiver?
-                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                        return;
-                    }
+        int numReleased = 0;
+        while ( numReleased < m_numJitterBufferEntries && m_jitterBuffer[numReleased].senderTime <= playoutTime && !m_messageReceiveQueue->IsFull() )
+        {
+            Message * message = m_jitterBuffer[numReleased].message;
+            m_messageReceiveQueue->Push( message );
+            m_hasPlayoutTick = true;
+            m_playoutTick = message->GetTick();
+            numReleased++;
+        }
 
-                    blockMessage = m_receiveBlock->blockMessage;
+        if ( numReleased == 0 )
+            return;
 
-                    yojimbo_assert( blockMessage );
+        m_numJitterBufferEntries -= numReleased;
 
-                    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), m_receiveBlock->blockSize );
+        memmove( m_jitterBuffer, m_jitterBuffer + numReleased, sizeof( JitterBufferEntry ) * m_numJitterBufferEntries );
+    }
 
-                    if ( !blockData )
-                    {
-                        // Not enough memory to allocate block data
-                        SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
-                        return;
-                    }
+    void UnreliableUnorderedChannel::DiscardPacketData( uint16_t packetSequence )
+    {
+        (void) packetSequence;
+    }
 
-                    memcpy( blockData, m_receiveBlock->blockData, m_receiveBlock->blockSize );
+    bool UnreliableUnorderedChannel::HasDataToSend() const
+    {
+        return !m_messageSendQueue->IsEmpty();
+    }
 
-                    blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, m_receiveBlock->blockSize );
+    int UnreliableUnorderedChannel::GetUnsentBits() const
+    {
+        int unsentBits = 0;
+        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+        {
+            unsentBits += (*m_messageSendQueue)[i].measuredBits;
+        }
+        return unsentBits;
+    }
 
-                    blockMessage->SetId( messageId );
+    int UnreliableUnorderedChannel::GetSendQueueDepth() const
+    {
+        return m_messageSendQueue->GetNumEntries();
+    }
 
-                    MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
-                    yojimbo_assert( entry );
-                    entry->message = blockMessage;
-                    m_receiveBlock->active = false;
-                    m_receiveBlock->blockMessage = NULL;
-                }
+    int UnreliableUnorderedChannel::GetReceiveQueueDepth() const
+    {
+        return m_messageReceiveQueue->GetNumEntries();
+    }
+
+    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    {
+        if ( !m_sentPackets )
+            return;
+
+        SentPacketEntry * sentPacket = m_sentPackets->Find( ack );
+        if ( !sentPacket )
+            return;
+
+        // the messages are delivered, so stop sending them again
+
+        for ( uint16_t messageId = sentPacket->firstMessageId; ; ++messageId )
+        {
+            RedundantMessageEntry & entry = m_redundantMessages[ messageId % m_config.redundantMessages ];
+
+            if ( entry.messageId == messageId && entry.message )
+            {
+                m_messageFactory->ReleaseMessage( entry.message );
+                entry.message = NULL;
+                entry.acked = true;
             }
+
+            if ( messageId == sentPacket->lastMessageId )
+                break;
         }
+
+        m_sentPackets->Remove( ack );
     }
 
-    // ------------------------------------------------
+    void UnreliableUnorderedChannel::ProcessAcks( const uint16_t * acks, int numAcks )
+    {
+        for ( int i = 0; i < numAcks; ++i )
+            ProcessAck( acks[i] );
+    }
 
-    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time ) : Channel( allocator, messageFactory, config, channelIndex, time )
+    bool UnreliableUnorderedChannel::GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const
     {
-        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED );
+        blockData = NULL;
+        blockBytes = 0;
+        return false;
+    }
 
-        m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.sendQueueSize );
-        
-        m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.receiveQueueSize );
+    void UnreliableUnorderedChannel::SetLimits( const ChannelLimits & limits )
+    {
+        Channel::SetLimits( limits );
+
+        // unreliable messages may be dropped anyway, so the oldest make room instead of the queues waiting to drain
+
+        while ( m_messageSendQueue->GetNumEntries() > limits.sendQueueSize )
+            m_messageFactory->ReleaseMessage( m_messageSendQueue->Pop().message );
+
+        while ( m_messageReceiveQueue->GetNumEntries() > limits.receiveQueueSize )
+            m_messageFactory->ReleaseMessage( m_messageReceiveQueue->Pop() );
+
+        if ( !m_messageSendQueue->Resize( limits.sendQueueSize ) || !m_messageReceiveQueue->Resize( limits.receiveQueueSize ) )
+        {
+            // Not enough memory to resize the queues
+            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+            return;
+        }
+
+        m_limits.sendQueueSize = limits.sendQueueSize;
+        m_limits.receiveQueueSize = limits.receiveQueueSize;
+    }
+
+    // ------------------------------------------------------------------------------------
+
+    UnreliableSequencedChannel::UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time ) : UnreliableUnorderedChannel( allocator, messageFactory, config, channelIndex, time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED );
+
+        m_hasReceiveSequence = false;
+        m_receiveSequence = 0;
+    }
+
+    void UnreliableSequencedChannel::Reset()
+    {
+        UnreliableUnorderedChannel::Reset();
+
+        m_hasReceiveSequence = false;
+        m_receiveSequence = 0;
+    }
+
+    void UnreliableSequencedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( m_errorLevel == CHANNEL_ERROR_NONE && !packetData.messageFailedToSerialize )
+        {
+            // stale messages are released along with the packet data, without touching the receive queue
+
+            if ( m_hasReceiveSequence && !sequence_greater_than( packetSequence, m_receiveSequence ) )
+                return;
+
+            m_hasReceiveSequence = true;
+            m_receiveSequence = packetSequence;
+        }
+
+        UnreliableUnorderedChannel::ProcessPacketData( packetData, packetSequence );
+    }
+
+    // ------------------------------------------------------------------------------------
+
+    SnapshotChannel::SnapshotChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time ) : Channel( allocator, messageFactory, config, channelIndex, time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_SNAPSHOT );
+        yojimbo_assert( config.baselineBufferSize > 0 );
+        yojimbo_assert( config.baselineBufferSize < 32768 );
+
+        m_sendMessage = NULL;
+        m_receiveMessage = NULL;
+
+        m_sentSnapshots = (SnapshotEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SnapshotEntry ) * m_config.baselineBufferSize );
+        m_receivedSnapshots = (SnapshotEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SnapshotEntry ) * m_config.baselineBufferSize );
+
+        memset( m_sentSnapshots, 0, sizeof( SnapshotEntry ) * m_config.baselineBufferSize );
+        memset( m_receivedSnapshots, 0, sizeof( SnapshotEntry ) * m_config.baselineBufferSize );
 
         Reset();
     }
 
-    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
+    SnapshotChannel::~SnapshotChannel()
     {
         Reset();
 
-        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageSendQueue );
-        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
+        YOJIMBO_FREE( *m_allocator, m_sentSnapshots );
+        YOJIMBO_FREE( *m_allocator, m_receivedSnapshots );
     }
 
-    void UnreliableUnorderedChannel::Reset()
+    void SnapshotChannel::ClearEntry( SnapshotEntry & entry )
+    {
+        if ( entry.message )
+            m_messageFactory->ReleaseMessage( entry.message );
+        entry.message = NULL;
+        entry.sequence = 0;
+        entry.acked = false;
+    }
+
+    void SnapshotChannel::Reset()
     {
         SetErrorLevel( CHANNEL_ERROR_NONE );
 
-        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
-            m_messageFactory->ReleaseMessage( (*m_messageSendQueue)[i] );
+        if ( m_sendMessage )
+        {
+            m_messageFactory->ReleaseMessage( m_sendMessage );
+            m_sendMessage = NULL;
+        }
 
-        for ( int i = 0; i < m_messageReceiveQueue->GetNumEntries(); ++i )
-            m_messageFactory->ReleaseMessage( (*m_messageReceiveQueue)[i] );
+        if ( m_receiveMessage )
+        {
+            m_messageFactory->ReleaseMessage( m_receiveMessage );
+            m_receiveMessage = NULL;
+        }
+
+        m_hasReceiveSequence = false;
+        m_receiveSequence = 0;
+
+        m_limits = ChannelLimits( m_config );
+
+        for ( int i = 0; i < m_config.baselineBufferSize; ++i )
+        {
+            ClearEntry( m_sentSnapshots[i] );
+            ClearEntry( m_receivedSnapshots[i] );
+        }
 
-        m_messageSendQueue->Clear();
-        m_messageReceiveQueue->Clear();
-  
         ResetCounters();
     }
 
-    bool UnreliableUnorderedChannel::CanSendMessage() const
+    bool SnapshotChannel::CanSendMessage() const
     {
-        yojimbo_assert( m_messageSendQueue );
-        return !m_messageSendQueue->IsFull();
+        // a new snapshot always replaces one that hasn't been sent yet
+        return true;
     }
 
-    void UnreliableUnorderedChannel::SendMessage( Message * message )
+    void SnapshotChannel::SendMessage( Message * message )
     {
         yojimbo_assert( message );
-        yojimbo_assert( CanSendMessage() );
 
         if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
         {
@@ -1272,130 +4530,142 @@ namespace yojimbo
             return;
         }
 
-        if ( !CanSendMessage() )
-        {
-            SetErrorLevel( CHANNEL_ERROR_SEND_QUEUE_FULL );
-            m_messageFactory->ReleaseMessage( message );
-            return;
-        }
-
-        yojimbo_assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+        yojimbo_assert( !message->IsBlockMessage() );
 
-        if ( message->IsBlockMessage() && m_config.disableBlocks )
+        if ( message->IsBlockMessage() )
         {
             SetErrorLevel( CHANNEL_ERROR_BLOCKS_DISABLED );
             m_messageFactory->ReleaseMessage( message );
             return;
         }
 
-        if ( message->IsBlockMessage() )
-        {
-            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
-            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
-        }
+        if ( m_sendMessage )
+            m_messageFactory->ReleaseMessage( m_sendMessage );
 
-        m_messageSendQueue->Push( message );
+        m_sendMessage = (SnapshotMessage*) message;
 
         m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
     }
 
-    Message * UnreliableUnorderedChannel::ReceiveMessage()
+    Message * SnapshotChannel::ReceiveMessage()
     {
         if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
             return NULL;
 
-        if ( m_messageReceiveQueue->IsEmpty() )
+        if ( !m_receiveMessage )
             return NULL;
 
+        Message * message = m_receiveMessage;
+
+        m_receiveMessage = NULL;
+
         m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
 
-        return m_messageReceiveQueue->Pop();
+        return message;
     }
 
-    void UnreliableUnorderedChannel::AdvanceTime( double time )
-    {
-        (void) time;
-    }
-    
-    int UnreliableUnorderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    int SnapshotChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
     {
-        (void) packetSequence;
-
-        if ( m_messageSendQueue->IsEmpty() )
+        YOJIMBO_PROFILE_SCOPE( "SnapshotChannel::GetPacketData" );
+        if ( !m_sendMessage )
             return 0;
 
-        if ( m_config.packetBudget > 0 )
-            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
-
-        const int giveUpBits = 4 * 8;
-
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        if ( m_limits.packetBudget > 0 )
+            availableBits = yojimbo_min( m_limits.packetBudget * 8, availableBits );
 
-        int usedBits = ConservativeMessageHeaderEstimate;
+        // The baseline is the most recent acked snapshot of the same type that the receiver still holds.
 
-        int numMessages = 0;
+        const int bufferSize = m_config.baselineBufferSize;
 
-        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
+        const SnapshotEntry * baseline = NULL;
 
-        while ( true )
+        for ( int i = 0; i < bufferSize; ++i )
         {
-            if ( m_messageSendQueue->IsEmpty() )
-                break;
+            const SnapshotEntry & entry = m_sentSnapshots[i];
 
-            if ( availableBits - usedBits < giveUpBits )
-                break;
+            if ( !entry.message || !entry.acked || entry.message->GetType() != m_sendMessage->GetType() )
+                continue;
 
-            if ( numMessages == m_config.maxMessagesPerPacket )
-                break;
+            const int age = uint16_t( packetSequence - entry.sequence );
 
-            Message * message = m_messageSendQueue->Pop();
+            if ( age == 0 || age >= bufferSize )
+                continue;
 
-            yojimbo_assert( message );
+            if ( !baseline || sequence_greater_than( entry.sequence, baseline->sequence ) )
+                baseline = &entry;
+        }
 
-            MeasureStream measureStream( m_messageFactory->GetAllocator() );
-            
-            message->SerializeInternal( measureStream );
-            
-            if ( message->IsBlockMessage() )
-            {
-                BlockMessage * blockMessage = (BlockMessage*) message;
-                SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
-            }
+        if ( baseline )
+            m_sendMessage->SetBaseline( baseline->message, baseline->sequence );
+        else
+            m_sendMessage->SetBaseline( NULL, 0 );
 
-            const int messageBits = messageTypeBits + measureStream.GetBitsProcessed();
-            
-            if ( usedBits + messageBits > availableBits )
-            {
-                m_messageFactory->ReleaseMessage( message );
-                continue;
-            }
+        const int baselineBits = baseline ? 17 : 1;
 
-            usedBits += messageBits;
-            
-            yojimbo_assert( usedBits <= availableBits );
-            
-            messages[numMessages++] = message;
-        }
+        const int usedBits = ConservativeMessageHeaderEstimate + m_messageFactory->GetMessageTypeBits( m_sendMessage->GetType() ) + baselineBits + MeasureMessage( m_sendMessage, *m_messageFactory );
 
-        if ( numMessages == 0 )
+        if ( usedBits > availableBits )
             return 0;
 
-        Allocator & allocator = m_messageFactory->GetAllocator();
+        // the sent snapshot moves from the send slot to the sent buffer, and the packet takes a reference of its own
+
+        SnapshotEntry & entry = m_sentSnapshots[packetSequence % bufferSize];
+
+        ClearEntry( entry );
+
+        entry.message = m_sendMessage;
+        entry.sequence = packetSequence;
+        entry.acked = false;
+
+        m_sendMessage = NULL;
 
         packetData.Initialize();
         packetData.channelIndex = GetChannelIndex();
-        packetData.message.numMessages = numMessages;
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
-        for ( int i = 0; i < numMessages; ++i )
+        packetData.message.numMessages = 1;
+        packetData.message.messages = packetData.AllocateMessages( *m_messageFactory, 1 );
+        packetData.message.messages[0] = entry.message;
+
+        m_messageFactory->AcquireMessage( entry.message );
+
+        return usedBits;
+    }
+
+    void SnapshotChannel::DiscardPacketData( uint16_t packetSequence )
+    {
+        // the snapshot didn't go out after all, so queue it again unless something newer was queued since
+
+        SnapshotEntry & entry = m_sentSnapshots[packetSequence % m_config.baselineBufferSize];
+
+        if ( !entry.message || entry.sequence != packetSequence )
+            return;
+
+        if ( !m_sendMessage )
         {
-            packetData.message.messages[i] = messages[i];
+            m_sendMessage = entry.message;
+            entry.message = NULL;
         }
 
-        return usedBits;
+        ClearEntry( entry );
     }
 
-    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    bool SnapshotChannel::HasDataToSend() const
+    {
+        return m_sendMessage != NULL;
+    }
+
+    int SnapshotChannel::GetSendQueueDepth() const
+    {
+        return m_sendMessage ? 1 : 0;
+    }
+
+    int SnapshotChannel::GetReceiveQueueDepth() const
+    {
+        return m_receiveMessage ? 1 : 0;
+    }
+
+    void SnapshotChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
     {
+        YOJIMBO_PROFILE_SCOPE( "SnapshotChannel::ProcessPacketData" );
         if ( m_errorLevel != CHANNEL_ERROR_NONE )
             return;
         
@@ -1405,21 +4675,70 @@ namespace yojimbo
             return;
         }
 
-        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        if ( packetData.message.numMessages != 1 )
+            return;
+
+        SnapshotMessage * message = (SnapshotMessage*) packetData.message.messages[0];
+
+        yojimbo_assert( message );
+
+        message->SetId( packetSequence );
+
+        // keep the snapshot as a baseline for later packets, unless the slot already holds a newer one
+
+        SnapshotEntry & entry = m_receivedSnapshots[packetSequence % m_config.baselineBufferSize];
+
+        if ( !entry.message || sequence_greater_than( packetSequence, entry.sequence ) )
         {
-            Message * message = packetData.message.messages[i];
-            yojimbo_assert( message );  
-            message->SetId( packetSequence );
-            if ( !m_messageReceiveQueue->IsFull() )
-            {
-                m_messageFactory->AcquireMessage( message );
-                m_messageReceiveQueue->Push( message );
-            }
+            ClearEntry( entry );
+            m_messageFactory->AcquireMessage( message );
+            entry.message = message;
+            entry.sequence = packetSequence;
         }
+
+        // only deliver snapshots newer than the last one received
+
+        if ( m_hasReceiveSequence && !sequence_greater_than( packetSequence, m_receiveSequence ) )
+            return;
+
+        if ( m_receiveMessage )
+            m_messageFactory->ReleaseMessage( m_receiveMessage );
+
+        m_messageFactory->AcquireMessage( message );
+
+        m_receiveMessage = message;
+        m_receiveSequence = packetSequence;
+        m_hasReceiveSequence = true;
     }
 
-    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    void SnapshotChannel::ProcessAck( uint16_t ack )
+    {
+        SnapshotEntry & entry = m_sentSnapshots[ack % m_config.baselineBufferSize];
+
+        if ( entry.message && entry.sequence == ack )
+            entry.acked = true;
+    }
+
+    void SnapshotChannel::ProcessAcks( const uint16_t * acks, int numAcks )
     {
-        (void) ack;
+        for ( int i = 0; i < numAcks; ++i )
+            ProcessAck( acks[i] );
+    }
+
+    bool SnapshotChannel::GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const
+    {
+        blockData = NULL;
+        blockBytes = 0;
+        return false;
+    }
+
+    const SnapshotMessage * SnapshotChannel::FindReceivedBaseline( uint16_t packetSequence ) const
+    {
+        const SnapshotEntry & entry = m_receivedSnapshots[packetSequence % m_config.baselineBufferSize];
+
+        if ( entry.message && entry.sequence == packetSequence )
+            return entry.message;
+
+        return NULL;
     }
 }
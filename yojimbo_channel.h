@@ -9,6 +9,7 @@
 
 #include "yojimbo_message.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_histogram.h"
 
 // windows =p
 #ifdef SendMessage
@@ -19,12 +20,22 @@
 
 namespace yojimbo
 {
+    class Channel;
+
     struct ChannelPacketData
     {
         uint32_t channelIndex : 16;
         uint32_t initialized : 1;
         uint32_t blockMessage : 1;
         uint32_t messageFailedToSerialize : 1;
+        uint32_t borrowedFragmentData : 1;
+        uint32_t missingBaseline : 1;
+        uint32_t blockResume : 1;
+        uint32_t hasReceiveWindow : 1;
+        uint16_t receiveWindowStart;
+        uint16_t limitsEpoch;
+        uint16_t receiveWindowSize;
+        int receiveMaxBlockSize;
 
         struct MessageData
         {
@@ -32,15 +43,34 @@ namespace yojimbo
             Message ** messages;
         };
 
-        struct BlockData
+        struct BlockFragmentData
         {
             BlockMessage * message;
             uint8_t * fragmentData;
-            uint64_t messageId : 16;
-            uint64_t fragmentId : 16;
-            uint64_t fragmentSize : 16;
-            uint64_t numFragments : 16;
+            uint16_t messageId;
+            uint16_t fragmentSize;
+            uint32_t fragmentId;
+            uint32_t numFragments;
             int messageType;
+            uint64_t blockHash;
+            int uncompressedSize;
+            bool parity;
+            uint16_t paritySizes;
+        };
+
+        struct BlockData
+        {
+            int numFragmentsInPacket;
+            BlockFragmentData * fragments;
+        };
+
+        struct BlockResumeData
+        {
+            uint16_t messageId;
+            uint64_t blockHash;
+            uint32_t firstFragment;
+            int numFragments;
+            uint32_t receivedFragments[MaxResumeFragmentsPerPacket/32];
         };
 
         union
@@ -49,17 +79,45 @@ namespace yojimbo
             BlockData block;
         };
 
+        /*
+            The fragments of a resumed block the receiver already has, starting at firstFragment. Sent alongside the messages or fragments of any entry when blockResume is set. See ChannelConfig::resumableBlocks.
+         */
+
+        BlockResumeData resume;
+
+        /*
+            Optional scratch memory owned by the connection, so steady state packet generation and processing doesn't allocate. 
+            
+            Set once with SetScratch when the packet data is created. Initialize leaves it alone. Each array must be large enough for any channel the packet data may be used for.
+         */
+
+        Message ** messageScratch;                      
+        BlockFragmentData * fragmentScratch;
+        uint8_t * fragmentDataScratch;
+
+        void SetScratch( Message ** messages, BlockFragmentData * fragments, uint8_t * fragmentData );
+
         void Initialize();
 
         void Free( MessageFactory & messageFactory );
 
-        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        Message ** AllocateMessages( MessageFactory & messageFactory, int numMessages );
+
+        BlockFragmentData * AllocateFragments( MessageFactory & messageFactory, int numFragments );
+
+        /*
+            Channels are only needed on read, to look up snapshot baselines. Pass NULL on write and measure.
+
+            With a compact header the channel index isn't serialized, so set it before reading. See ConnectionConfig::compactPacketHeader.
+         */
+
+        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels, bool compactHeader );
 
-        bool SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels = NULL, bool compactHeader = false );
 
-        bool SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels = NULL, bool compactHeader = false );
 
-        bool SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, Channel * const * channels = NULL, bool compactHeader = false );
     };
 
     /**
@@ -72,9 +130,33 @@ namespace yojimbo
     {
         CHANNEL_COUNTER_MESSAGES_SENT,                          ///< Number of messages sent over this channel.
         CHANNEL_COUNTER_MESSAGES_RECEIVED,                      ///< Number of messages received over this channel.
+        CHANNEL_COUNTER_PACKETS_LOST,                           ///< Number of sent packets with data for this channel that were inferred lost from later acks. See ChannelConfig::fastResendThreshold.
+        CHANNEL_COUNTER_FRAGMENTS_RECOVERED,                    ///< Number of block fragments rebuilt from parity instead of received. See ChannelConfig::fragmentParityGroupSize.
+        CHANNEL_COUNTER_MESSAGES_SUPERSEDED,                    ///< Number of unacked messages superseded by a newer message with the same key. See ChannelConfig::supersedeMessages.
+        CHANNEL_COUNTER_MESSAGES_EXPIRED,                       ///< Number of unacked messages dropped because they outlived ChannelConfig::messageTimeToLive.
+        CHANNEL_COUNTER_PACKETS_SENT,                           ///< Number of packets generated with data for this channel.
+        CHANNEL_COUNTER_BITS_SENT,                              ///< Number of bits this channel wrote into generated packets, including its channel entry header. Divide by CHANNEL_COUNTER_PACKETS_SENT for the average compared to ChannelConfig::packetBudget.
+        CHANNEL_COUNTER_MESSAGES_PACKED,                        ///< Number of messages written into generated packets. Messages sent again count again.
+        CHANNEL_COUNTER_OUT_OF_SPACE,                           ///< Number of packets the channel couldn't fit everything it wanted to send in, because of the packet budget or the space left in the packet. A channel that goes up here on most packets is starved.
+        CHANNEL_COUNTER_MESSAGES_RESENT,                        ///< Number of times reliable messages were written into generated packets again, after they were first sent.
+        CHANNEL_COUNTER_FRAGMENTS_RESENT,                       ///< Number of times block fragments were written into generated packets again because they weren't acked within the fragment resend time.
+        CHANNEL_COUNTER_MESSAGES_SKIPPED,                       ///< Number of reliable messages received again after they were already received, and skipped over without being read. See ChannelConfig::messageLengthBits.
         CHANNEL_COUNTER_NUM_COUNTERS                            ///< The number of channel counters.
     };
 
+    /**
+        Latency histograms kept by a channel with ChannelConfig::latencyHistograms.
+
+        @see Channel::GetLatencyHistogram
+     */
+
+    enum ChannelLatencyHistograms
+    {
+        CHANNEL_LATENCY_QUEUED,                                 ///< Time from SendMessage until the message was first put in a packet.
+        CHANNEL_LATENCY_ACKED,                                  ///< Time from SendMessage until a packet carrying the message was acked. Reliable channels only.
+        CHANNEL_LATENCY_NUM_HISTOGRAMS                          ///< The number of channel latency histograms.
+    };
+
     /**
         Channel error level.
 
@@ -123,15 +205,18 @@ namespace yojimbo
 
         /**
             Channel constructor.
+
+            @param config The channel config. The channel keeps a reference to it, so the connection's config is read in place rather than copied into every channel. Must outlive the channel.
+            @param time The clock of the connection. The channel keeps a reference to it, so it sees time pass without being told. Must outlive the channel.
          */
 
-        Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time );
+        Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time );
 
         /**
             Channel destructor.
          */
 
-        virtual ~Channel() {}
+        virtual ~Channel();
 
         /**
             Reset the channel. 
@@ -162,12 +247,54 @@ namespace yojimbo
         virtual Message * ReceiveMessage() = 0;
 
         /**
-            Advance channel time.
+            Queue messages to be sent across this channel, until it can't take any more.
+
+            The default implementation calls SendMessage for each message while CanSendMessage is true.
+
+            @param messages The messages to send.
+            @param numMessages The number of messages.
+
+            @returns The number of messages queued, from the start of the array. The channel owns those. The rest still belong to the caller.
+         */
+
+        virtual int SendMessages( Message ** messages, int numMessages );
+
+        /**
+            Pop received messages off the receive queue, in the order ReceiveMessage would return them.
+
+            The default implementation calls ReceiveMessage until it returns NULL.
+
+            @param messages The received messages (out). The caller owns them, and releases them like messages returned by ReceiveMessage.
+            @param maxMessages The size of the messages array.
+
+            @returns The number of messages received. Less than maxMessages if the receive queue was drained.
+         */
+
+        virtual int ReceiveMessages( Message ** messages, int maxMessages );
+
+        /**
+            Run the timers of the channel, after the connection clock moved on to the new time.
+
+            Called by Connection::AdvanceTime for channels that return true from HasTimers. Channels read the current time from the connection clock, so the rest are not called at all.
+         */
+
+        virtual void AdvanceTime( double time ) { (void) time; }
+
+        /**
+            Does the channel need AdvanceTime calls? See AdvanceTime.
+
+            @returns True if the channel has timers that run as time passes, eg. lazy block buffers being freed, or messages becoming due in a jitter buffer.
+         */
+
+        virtual bool HasTimers() const { return false; }
+
+        /**
+            Report errors to a mask of channels in error, so the owner doesn't have to poll each channel.
 
-            Called by Connection::AdvanceTime for each channel configured on the connection.
+            @param errorMask The mask. The bit of this channel is set while the channel is in an error state. May be NULL.
          */
 
-        virtual void AdvanceTime( double time ) = 0;
+        void SetErrorMask( uint64_t * errorMask ) { m_errorMask = errorMask; }
 
         /**
             Get channel packet data for this channel.
@@ -184,6 +311,89 @@ namespace yojimbo
 
         virtual int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits ) = 0;
 
+        /**
+            Discard packet data previously returned by GetPacketData, because it didn't fit in the connection packet after all.
+
+            The connection writes channel data straight into the packet and rolls it back out if it overflows. This undoes the channel side of that, so nothing is considered sent in a packet that doesn't contain it.
+
+            Depending on the channel type:
+
+                1. Forgets the sent packet entry and lets the messages or fragments go out again in the next packet (reliable-ordered channel)
+
+                2. Does nothing at all. The messages are dropped, just like a lost packet (unreliable-unordered).
+
+            The caller is still responsible for freeing the packet data.
+
+            @param packetSequence The sequence number passed to GetPacketData.
+
+            @see Connection::GeneratePacket
+         */
+
+        virtual void DiscardPacketData( uint16_t packetSequence ) = 0;
+
+        /**
+            Does the channel have data waiting to be sent?
+
+            Used by the connection to share packet space only between channels that can use it. A channel may still return no packet data, eg. when every message in flight was sent too recently to be resent.
+
+            @returns True if the channel has messages queued for sending (unacked messages, for reliable-ordered channels).
+
+            @see Connection::GeneratePacket
+         */
+
+        virtual bool HasDataToSend() const = 0;
+
+        /**
+            Get the earliest time the channel will have packet data to send.
+
+            Lets the host sleep until a packet is needed, instead of polling at a fixed rate. The default is now if the channel has data to send.
+
+            @returns The time in seconds. May be in the past, if data is ready to send now. DBL_MAX if the channel has nothing to send.
+
+            @see Connection::GetNextSendTime
+         */
+
+        virtual double GetNextSendTime() const;
+
+        /**
+            Get the size of the messages waiting that have never been sent.
+
+            Used by the connection to coalesce small messages into fuller packets. See ConnectionConfig::coalesceTime. The default is -1 if the channel has data to send, so it goes out straight away.
+
+            @returns The number of bits of message data queued and not yet sent in any packet. -1 if the channel has data that shouldn't wait, eg. a block.
+
+            @see Connection::GeneratePacket
+         */
+
+        virtual int GetUnsentBits() const;
+
+        /**
+            Update the round trip time estimate of the connection. Called each time the connection measures it.
+
+            The default does nothing. Reliable channels use it to time resends when ChannelConfig::adaptiveResendTime is set.
+
+            @param rtt The smoothed round trip time (seconds).
+            @param rttVariance The round trip time variance (seconds).
+         */
+
+        virtual void UpdateRoundTripTime( double rtt, double rttVariance );
+
+        /**
+            Get the number of messages queued for sending on this channel.
+
+            @returns The number of messages in the send queue. For reliable-ordered channels this includes messages sent, but not acked yet.
+         */
+
+        virtual int GetSendQueueDepth() const = 0;
+
+        /**
+            Get the number of messages received on this channel, waiting for ReceiveMessage.
+
+            @returns The number of messages in the receive queue. For reliable-ordered channels this is the part of the receive window in use, including gaps waiting for a resend.
+         */
+
+        virtual int GetReceiveQueueDepth() const = 0;
+
         /**
             Process packet data included in a connection packet.
 
@@ -210,8 +420,56 @@ namespace yojimbo
 
         virtual void ProcessAck( uint16_t sequence ) = 0;
 
+        /**
+            Process a set of connection packet acks in one go.
+
+            Equivalent to calling ProcessAck for each ack, but lets the channel do per-call bookkeeping once for the whole set. Called by Connection::ProcessAcks.
+
+            @param acks Array of sequence numbers of the connection packets that were acked.
+            @param numAcks The number of acks in the array.
+         */
+
+        virtual void ProcessAcks( const uint16_t * acks, int numAcks ) = 0;
+
+        /**
+            Get the part of a block received so far, for the next message to be received.
+
+            Lets large blocks be consumed progressively, eg. decompressed or parsed while the rest of the block is still arriving.
+
+            Only the contiguous range of fragments starting at the beginning of the block is returned. The block message itself becomes available via ReceiveMessage once all fragments have arrived.
+
+            Blocks sent compressed (see ChannelConfig::compressBlocks) can only be read once they are complete.
+
+            IMPORTANT: The block data pointer is only valid until the next packet is processed for this channel.
+
+            @param blockData Pointer to the start of the block data being received [out].
+            @param blockBytes The number of bytes of block data received contiguously from the start of the block [out].
+
+            @returns True if the next message to be received is a block message that is currently being received. False otherwise (always false for unreliable-unordered channels).
+         */
+
+        virtual bool GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const = 0;
+
+        /**
+            Change the limits the channel runs with. See ChannelLimits.
+
+            The base channel only applies the packet budget. Channel types override this for the limits they support.
+
+            @param limits The new limits, within the channel config.
+         */
+
+        virtual void SetLimits( const ChannelLimits & limits );
+
     public:
 
+        /**
+            Get the limits the channel runs with. Reset restores the limits of the channel config.
+
+            @returns The limits last set with SetLimits.
+         */
+
+        const ChannelLimits & GetLimits() const { return m_limits; }
+
         /**
             Get the channel error level.
 
@@ -245,8 +503,49 @@ namespace yojimbo
 
         void ResetCounters();
 
+        /**
+            Add to a counter. The connection counts the packet data it writes for the channel with this.
+
+            @param index The index of the counter. See ChannelCounters.
+            @param value The value to add.
+         */
+
+        void AddCounter( int index, uint64_t value )
+        {
+            yojimbo_assert( index >= 0 );
+            yojimbo_assert( index < CHANNEL_COUNTER_NUM_COUNTERS );
+            m_counters[index] += value;
+        }
+
+        /**
+            Get a latency histogram.
+
+            Histograms are cleared along with the counters.
+
+            @param index The histogram to get. See ChannelLatencyHistograms.
+
+            @returns The histogram, or NULL if ChannelConfig::latencyHistograms is false.
+         */
+
+        const LatencyHistogram * GetLatencyHistogram( int index ) const;
+
     protected:
 
+        /**
+            Record a latency in one of the channel latency histograms. Does nothing without ChannelConfig::latencyHistograms.
+
+            @param index The histogram to record in. See ChannelLatencyHistograms.
+            @param seconds The latency (seconds).
+         */
+
+        void RecordLatency( int index, double seconds )
+        {
+            yojimbo_assert( index >= 0 );
+            yojimbo_assert( index < CHANNEL_LATENCY_NUM_HISTOGRAMS );
+            if ( m_latencyHistograms )
+                m_latencyHistograms[index].Record( seconds );
+        }
+
         /**
             Set the channel error level.
 
@@ -257,19 +556,25 @@ namespace yojimbo
 
     protected:
 
-        const ChannelConfig m_config;                                                   ///< Channel configuration data.
+        const ChannelConfig & m_config;                                                 ///< Channel configuration data. Refers to the config passed in to the constructor, which must outlive the channel, like the clock.
+
+        ChannelLimits m_limits;                                                         ///< The limits the channel runs with. See SetLimits.
 
         Allocator * m_allocator;                                                        ///< Allocator for allocations matching life cycle of this channel.
 
         int m_channelIndex;                                                             ///< The channel index in [0,numChannels-1].
 
-        double m_time;                                                                  ///< The current time.
+        const double & m_time;                                                          ///< The current time. A reference to the clock of the connection.
+
+        uint64_t * m_errorMask;                                                         ///< Mask of channels in error, set with SetErrorMask. May be NULL.
         
         ChannelErrorLevel m_errorLevel;                                                 ///< The channel error level.
 
         MessageFactory * m_messageFactory;                                              ///< Message factory for creating and destroying messages.
 
         uint64_t m_counters[CHANNEL_COUNTER_NUM_COUNTERS];                              ///< Counters for unit testing, stats etc.
+
+        LatencyHistogram * m_latencyHistograms;                                         ///< The latency histograms, CHANNEL_LATENCY_NUM_HISTOGRAMS of them. NULL without ChannelConfig::latencyHistograms.
     };
 
     /**
@@ -281,7 +586,9 @@ namespace yojimbo
 
         Blocks attached to messages sent over this channel are split up into fragments. Each fragment of the block is included in a connection packet until one of those packets are acked. Eventually, all fragments are received on the other side, and block is reassembled and attached to the message.
 
-        Only one message block may be in flight over the network at any time, so blocks stall out message delivery slightly. Therefore, only use blocks for large data that won't fit inside a single connection packet where you actually need the channel to split it up into fragments. If your block fits inside a packet, just serialize it inside your message serialize via serialize_bytes instead.
+        When the channel is configured as CHANNEL_TYPE_RELIABLE_UNORDERED, messages are acked and resent the same way, but each message is delivered as soon as it arrives instead of waiting for the messages sent before it.
+
+        By default only one message block may be in flight over the network at any time, so blocks stall out message delivery slightly. Consecutive block messages can be sent at the same time by increasing ChannelConfig::maxBlocksInFlight, and fragments from each of them share packets up to ChannelConfig::maxFragmentsPerPacket. Even so, only use blocks for large data that won't fit inside a single connection packet where you actually need the channel to split it up into fragments. If your block fits inside a packet, just serialize it inside your message serialize via serialize_bytes instead.
      */
 
     class ReliableOrderedChannel : public Channel
@@ -297,7 +604,7 @@ namespace yojimbo
             @param channelIndex The channel index in [0,numChannels-1].
          */
 
-        ReliableOrderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time );
+        ReliableOrderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time );
 
         /**
             Reliable ordered channel destructor.
@@ -317,14 +624,50 @@ namespace yojimbo
 
         Message * ReceiveMessage();
 
+        int ReceiveMessages( Message ** messages, int maxMessages );
+
         void AdvanceTime( double time );
 
+        bool HasTimers() const;
+
+        /**
+            Check whether a message being read from a packet was already received, so it can be skipped over instead of read. Counts skipped messages.
+
+            Called while reading packets when ChannelConfig::messageLengthBits is set. You should not need to call it yourself.
+
+            @param messageId The id of the message.
+
+            @returns True if the message was already received.
+         */
+
+        bool SkipReceivedMessage( uint16_t messageId );
+
         int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
 
+        void DiscardPacketData( uint16_t packetSequence );
+
+        bool HasDataToSend() const;
+
+        double GetNextSendTime() const;
+
+        int GetUnsentBits() const;
+
+        void UpdateRoundTripTime( double rtt, double rttVariance );
+
+        int GetSendQueueDepth() const;
+
+        int GetReceiveQueueDepth() const;
+
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
         void ProcessAck( uint16_t ack );
 
+        void ProcessAcks( const uint16_t * acks, int numAcks );
+
+        bool GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const;
+
+        void SetLimits( const ChannelLimits & limits );
+
         // -----------------------------
 
         /**
@@ -394,6 +737,39 @@ namespace yojimbo
 
         void ProcessPacketMessages( int numMessages, Message ** messages );
 
+        /**
+            Add a newly received message to the receive queue.
+
+            For reliable-unordered channels the message goes straight to the delivery queue. The receive queue entry is kept only to drop duplicates, until every message before it has arrived too.
+
+            @param messageId The id of the message.
+            @param message The message. The channel takes over the reference passed in, and releases it on failure.
+
+            @returns True if the message was added, false if the receive queues are full. The channel error level is set to CHANNEL_ERROR_DESYNC on failure.
+         */
+
+        bool AddReceivedMessage( uint16_t messageId, Message * message );
+
+        /**
+            Supersede the last message sent with a key, if it hasn't been acked yet.
+
+            The message is released, and replaced in the send queue with a placeholder that keeps its message id. See ChannelConfig::supersedeMessages.
+
+            @param key The message key.
+         */
+
+        void SupersedeMessage( uint32_t key );
+
+        /**
+            Replace a message in the send queue with a placeholder of the same type that keeps its message id. Its contents are never sent, and the receiver drops it on delivery.
+
+            @param messageId The id of the message. Must be in the send queue, and not a block message.
+
+            @returns True if the message was replaced, false if the placeholder couldn't be created.
+         */
+
+        bool ReplaceWithPlaceholder( uint16_t messageId );
+
         /**
             Track the oldest unacked message id in the send queue.
 
@@ -408,6 +784,26 @@ namespace yojimbo
 
         void UpdateOldestUnackedMessageId();
 
+        /**
+            Ack the messages and block fragments included in a sent connection packet.
+
+            Does not update the oldest unacked message id. Callers do this once after processing all their acks. See UpdateOldestUnackedMessageId.
+
+            @param ack The sequence number of the connection packet that was acked.
+
+            @returns True if any messages were removed from the send queue.
+         */
+
+        bool ProcessSentPacketAck( uint16_t ack );
+
+        /**
+            Resend the data in sent packets that later acks show were lost.
+
+            Sent packets more than ChannelConfig::fastResendThreshold packets older than the most recent ack, and not acked themselves, are treated as lost: their messages and fragments go out again in the next packet. Each sent packet is checked once.
+         */
+
+        void DetectPacketLoss();
+
         /**
             True if we are currently sending a block message.
 
@@ -417,7 +813,7 @@ namespace yojimbo
 
             Blocks attached to block messages are usually larger than the maximum packet size or channel budget, so they are split up fragments. 
 
-            While in the mode of sending a block message, each channel packet data generated has exactly one fragment from the current block in it. Fragments keep getting included in packets until all fragments of that block are acked.
+            While in the mode of sending block messages, each channel packet data generated contains fragments from the blocks in flight, and nothing else. Up to ChannelConfig::maxBlocksInFlight consecutive block messages starting at the oldest unacked message are sent at the same time. Fragments keep getting included in packets until all fragments of a block are acked.
 
             @returns True if currently sending a block message over the network, false otherwise.
 
@@ -428,50 +824,71 @@ namespace yojimbo
         bool SendingBlockMessage();
 
         /**
-            Get the next block fragment to send.
+            Get the blocks fragments to include in a packet.
 
-            The next block fragment is selected by scanning left to right over the set of fragments in the block, skipping over any fragments that have already been acked or have been sent within ChannelConfig::fragmentResendTime.
+            Takes fragments that are due to be sent from the blocks in flight, oldest block first, until ChannelConfig::maxFragmentsPerPacket fragments have been selected or the next fragment doesn't fit in the channel packet budget. Several fragments of the same block may be included. The first fragment is always included, even if it exceeds the budget.
 
-            @param messageId The id of the message that the block is attached to [out].
+            @param messageIds Array of message ids that each fragment belongs to [out]. Make sure your array is at least ChannelConfig::maxFragmentsPerPacket in size.
+            @param fragmentIds Array of fragment ids [out].
+            @param fragmentBytes Array of fragment sizes in bytes [out].
+            @param numFragments The number of fragments written to the arrays [out].
+            @param availableBits Number of bits remaining in the packet.
+
+            @returns Estimate of the number of bits required to serialize the fragments (upper bound).
+
+            @see GetFragmentPacketData
+         */
+
+        int GetFragmentsToSend( uint16_t * messageIds, uint32_t * fragmentIds, int * fragmentBytes, int & numFragments, int availableBits );
+
+        /**
+            Get the next fragment to send for a block message.
+
+            Starts tracking the block if this is the first time a fragment is requested for it. 
+
+            The next block fragment is the first one, from the first unacked fragment on, that is not acked and has not been sent within ChannelConfig::fragmentResendTime. Those fragments are kept in a bit array that is searched a word at a time, and fragments in flight go back into it from a queue in send order once their resend time passes, so the cost doesn't grow with the number of fragments in flight.
+
+            @param messageId The id of the message that the block is attached to.
             @param fragmentId The id of the fragment to send [out].
-            @param fragmentBytes The size of the fragment in bytes.
-            @param numFragments The total number of fragments in this block.
-            @param messageType The type of message the block is attached to. See MessageFactory.
+            @param fragmentBytes The size of the fragment in bytes [out].
 
-            @returns Pointer to the fragment data.
+            @returns True if there is a fragment to send, false if all fragments are acked or were sent recently.
          */
 
-        uint8_t * GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType );
+        bool GetFragmentToSend( uint16_t messageId, uint32_t & fragmentId, int & fragmentBytes );
 
         /**
             Fill the packet data with block and fragment data.
 
-            This is the payload function that fills the channel packet data while we are sending a block message.
+            This is the payload function that fills the channel packet data while we are sending block messages.
+
+            The block message is included along with fragment 0 of its block.
 
             @param packetData The packet data to fill [out]
-            @param messageId The id of the message that the block is attached to.
-            @param fragmentId The id of the block fragment being sent.
-            @param fragmentData The fragment data.
-            @param fragmentSize The size of the fragment data (bytes).
-            @param numFragments The number of fragments in the block.
-            @param messageType The type of message the block is attached to.
+            @param messageIds The ids of the messages that each fragment belongs to.
+            @param fragmentIds The ids of the block fragments being sent.
+            @param fragmentBytes The size of each fragment (bytes).
+            @param numFragments The number of fragments to include.
 
-            @returns An estimate of the number of bits required to serialize the block message and fragment data (upper bound).
+            @returns True if the packet data was filled, false if fragment data could not be allocated.
+
+            @see GetFragmentsToSend
          */
 
-        int GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType );
+        bool GetFragmentPacketData( ChannelPacketData & packetData, const uint16_t * messageIds, const uint32_t * fragmentIds, const int * fragmentBytes, int numFragments );
 
         /**
-            Adds a packet entry for the fragment.
+            Adds a packet entry for the set of fragments included in a packet.
 
-            This lets us look up the fragment that was in the packet later on when it is acked, so we can ack that block fragment.
+            This lets us look up the fragments that were in the packet later on when it is acked, so we can ack those block fragments.
 
-            @param messageId The message id that the block was attached to.
-            @param fragmentId The fragment id.
-            @param sequence The sequence number of the packet the fragment was included in.
+            @param messageIds The message ids that each fragment belongs to.
+            @param fragmentIds The fragment ids.
+            @param numFragments The number of fragments in the arrays.
+            @param sequence The sequence number of the packet the fragments were included in.
          */
 
-        void AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence );
+        void AddFragmentPacketEntry( const uint16_t * messageIds, const uint32_t * fragmentIds, int numFragments, uint16_t sequence );
 
         /**
             Process a packet fragment.
@@ -485,77 +902,422 @@ namespace yojimbo
             @param fragmentData The fragment data.
             @param fragmentBytes The size of the fragment data in bytes.
             @param blockMessage Pointer to the block message. Passed this in only with the first fragment (0), pass NULL for all other fragments.
+            @param blockHash The content hash of the block. Only sent with ChannelConfig::resumableBlocks, 0 otherwise.
+            @param uncompressedSize The size of the block once decompressed (bytes). Only sent with fragment 0, when the block was compressed. 0 otherwise.
+
+            Fragments for up to ChannelConfig::maxBlocksInFlight blocks may be received at the same time.
          */
 
-        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage );
+        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint32_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage, uint64_t blockHash, int uncompressedSize );
 
-    protected:
+        /**
+            Ack a fragment of a block being sent. Completes the block send once all fragments are acked.
+
+            @param messageId The id of the message the block is attached to.
+            @param fragmentId The id of the fragment.
+
+            @returns True if this completed the block send and the block message was removed from the send queue.
+         */
+
+        bool AckBlockFragment( uint16_t messageId, uint32_t fragmentId );
 
         /**
-            An entry in the send queue of the reliable-ordered channel.
+            Get the parity fragment to send next for a block, if one is due.
 
-            Messages stay into the send queue until acked. Each message is acked individually, so there can be "holes" in the message send queue.
+            The parity of a group is sent once, as soon as every fragment in the group has been sent. See ChannelConfig::fragmentParityGroupSize.
+
+            @param messageId The id of the message the block is attached to.
+            @param fragmentId The parity group, with ParityFragmentFlag set (out).
+            @param fragmentBytes The size of the parity data (out).
+
+            @returns True if a parity fragment should be sent.
          */
 
-        struct MessageSendQueueEntry
-        {
-            Message * message;                                                          ///< Pointer to the message. When inserted in the send queue the message has one reference. It is released when the message is acked and removed from the send queue.
-            double timeLastSent;                                                        ///< The time the message was last sent. Used to implement ChannelConfig::messageResendTime.
-            uint32_t measuredBits : 31;                                                 ///< The number of bits the message takes up in a bit stream.
-            uint32_t block : 1;                                                         ///< 1 if this is a block message. Block messages are treated differently to regular messages when sent over a reliable-ordered channel.
-        };
+        bool GetParityToSend( uint16_t messageId, uint32_t & fragmentId, int & fragmentBytes );
 
         /**
-            An entry in the receive queue of the reliable-ordered channel.
+            Process a parity fragment. If exactly one fragment of the group is missing, it is rebuilt and processed as if it was received.
+
+            Parity is not kept, so it only helps when it arrives after the rest of its group, which is the order it is sent in.
+
+            @param messageId The id of the message the block is attached to.
+            @param numFragments The number of fragments in the block.
+            @param group The parity group.
+            @param parityData The XOR of the fragments in the group, each padded to the fragment size.
+            @param parityBytes The size of the parity data (bytes).
+            @param paritySizes The XOR of the sizes of the fragments in the group.
+            @param blockHash The content hash of the block. Only sent with ChannelConfig::resumableBlocks, 0 otherwise.
          */
 
-        struct MessageReceiveQueueEntry
-        {
-            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued.
-        };
+        void ProcessParityFragment( uint16_t messageId, int numFragments, int group, const uint8_t * parityData, int parityBytes, uint16_t paritySizes, uint64_t blockHash );
 
         /**
-            Maps packet level acks to messages and fragments for the reliable-ordered channel.
+            Are there windows of the received fragment bitmap of a resumed block still waiting to be acked by the sender?
+
+            @returns True if there is a window to send.
          */
 
-        struct SentPacketEntry
-        {
-            double timeSent;                                                            ///< The time the packet was sent. Used to estimate round trip time.
-            uint16_t * messageIds;                                                      ///< Pointer to an array of message ids. Dynamically allocated because the user can configure the maximum number of messages in a packet per-channel with ChannelConfig::maxMessagesPerPacket.
-            uint32_t numMessageIds : 16;                                                ///< The number of message ids in in the array.
-            uint32_t acked : 1;                                                         ///< 1 if this packet has been acked.
-            uint64_t block : 1;                                                         ///< 1 if this packet contains a fragment of a block message.
-            uint64_t blockMessageId : 16;                                               ///< The block message id. Valid only if "block" is 1.
-            uint64_t blockFragmentId : 16;                                              ///< The block fragment id. Valid only if "block" is 1.
-        };
+        bool HasBlockResumeToSend() const;
 
         /**
-            Internal state for a block being sent across the reliable ordered channel.
-            
-            Stores the block data and tracks which fragments have been acked. The block send completes when all fragments have been acked.
+            Get the start of our receive window: the oldest message id the application hasn't dequeued yet, counting messages waiting in the delivery queue of reliable-unordered channels.
 
-            IMPORTANT: Although there can be multiple block messages in the message send and receive queues, only one data block can be in flights over the wire at a time.
+            @returns The receive window start. See ChannelConfig::flowControl.
+         */
+
+        uint16_t GetReceiveWindowStart() const;
+
+        /**
+            Does our receive window need advertising, because it moved on since the other side last acked it?
+
+            @returns True if the receive window should be included in the next packet.
+         */
+
+        bool HasReceiveWindowToSend() const;
+
+        /**
+            Is a message inside the receive window the other side advertised?
+
+            @param messageId The message id.
+
+            @returns True if the message can be sent. Always true without ChannelConfig::flowControl.
+         */
+
+        bool InSendWindow( uint16_t messageId ) const;
+
+        /**
+            Is a block message within the largest block the other side takes? Blocks it has already started are always let through.
+
+            @param messageId The id of the block message.
+
+            @returns True if the block can be sent. Always true without ChannelConfig::runtimeLimits.
+         */
+
+        bool InRemoteBlockLimit( uint16_t messageId ) const;
+
+        /**
+            Get the number of bits the receive window advertisement takes up in a packet.
+
+            @returns The number of bits.
+         */
+
+        int GetReceiveWindowBits() const;
+
+        /**
+            Resize the send and receive queues to the current limits, where the messages they hold allow it. See ChannelLimits.
+         */
+
+        void ApplyQueueLimits();
+
+        /**
+            Get the window of the received fragment bitmap of a resumed block to include in the next packet, if any.
+
+            Windows of MaxResumeFragmentsPerPacket fragments are sent in rotation, until each has been acked. See ChannelConfig::resumableBlocks.
+
+            @param messageId The id of the resumed block message [out].
+            @param window The window of the bitmap to send [out].
+
+            @returns True if there is a window to send.
+         */
+
+        bool GetBlockResumeToSend( uint16_t & messageId, int & window );
+
+        /**
+            Fill in a window of the received fragment bitmap of a resumed block.
+
+            @param resume The window of the received fragment bitmap [out].
+            @param messageId The id of the resumed block message.
+            @param window The window to fill in.
+         */
+
+        void GetBlockResumeData( ChannelPacketData::BlockResumeData & resume, uint16_t messageId, int window ) const;
+
+        /**
+            Get the number of bits a window of the received fragment bitmap takes up in a packet (upper bound).
+
+            @returns The number of bits.
+         */
+
+        int GetBlockResumeBits() const;
+
+        /**
+            Process a window of the received fragment bitmap for a resumed block, sent by the receiver. Fragments the receiver already has are acked.
+
+            @param resume The window of the received fragment bitmap.
+
+            @returns True if this completed the block send and the block message was removed from the send queue.
+         */
+
+        bool ProcessBlockResume( const ChannelPacketData::BlockResumeData & resume );
+
+        /**
+            Restore the fragments already received into a shared block returned by MessageFactory::FindResumeBlock, when a resumed block starts arriving.
+
+            The first and last fragments are always received again, since they carry the block message and the block size.
+
+            @param messageId The id of the block message. The block must be active, with the shared block set.
+
+            @returns True if successful, false if memory could not be allocated.
+         */
+
+        bool RestoreReceiveBlock( uint16_t messageId );
+
+        /**
+            Are the buffers for sending and receiving blocks allocated?
+
+            @returns True unless ChannelConfig::lazyBlockBuffers is set and no block has been sent or received for ChannelConfig::blockBufferIdleTime. False if blocks are disabled.
+         */
+
+        bool HasBlockBuffers() const { return m_blockBuffersAllocated; }
+
+    protected:
+
+        /**
+            An entry in the send queue of the reliable-ordered channel.
+
+            Messages stay into the send queue until acked. Each message is acked individually, so there can be "holes" in the message send queue.
+         */
+
+        struct MessageSendQueueEntry
+        {
+            Message * message;                                                          ///< Pointer to the message. When inserted in the send queue the message has one reference. It is released when the message is acked and removed from the send queue.
+            double timeQueued;                                                          ///< The time the message was added to the send queue. Used to implement ChannelConfig::messageTimeToLive.
+            float timeLastSent;                                                         ///< The time the message was last sent, relative to timeQueued (seconds). Negative if the message should be sent now. Used to implement ChannelConfig::messageResendTime. 32 bits, so the entry fits in 24 bytes.
+            uint32_t measuredBits : 30;                                                 ///< The number of bits the message takes up in a bit stream.
+            uint32_t sent : 1;                                                          ///< 1 once the message has been put in a packet. Used to record CHANNEL_LATENCY_QUEUED.
+            uint32_t block : 1;                                                         ///< 1 if this is a block message. Block messages are treated differently to regular messages when sent over a reliable-ordered channel.
+        };
+
+        /**
+            An entry in the receive queue of the reliable-ordered channel.
+         */
+
+        struct MessageReceiveQueueEntry
+        {
+            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued.
+        };
+
+        /**
+            Maps packet level acks to messages and fragments for the reliable-ordered channel.
+
+            The ids for each sent packet live in a single slab owned by the channel, at a fixed stride indexed by packet sequence. See GetSentPacketIds.
+         */
+
+        struct SentPacketEntry
+        {
+            uint32_t numMessageIds : 16;                                                ///< The number of message ids for this packet.
+            uint32_t acked : 1;                                                         ///< 1 if this packet has been acked.
+            uint32_t block : 1;                                                         ///< 1 if this packet contains fragments of block messages.
+            uint32_t numBlockFragments : 16;                                            ///< The number of block fragments in this packet. Valid only if "block" is 1.
+            uint32_t resume : 1;                                                        ///< 1 if this packet contains a received fragment bitmap for a resumed block.
+            uint32_t receiveWindow : 1;                                                 ///< 1 if this packet advertises the receive window. See ChannelConfig::flowControl.
+            uint16_t receiveWindowStart;                                                ///< The start of the receive window advertised. Valid only if "receiveWindow" is 1.
+            uint16_t limitsEpoch;                                                       ///< The limits epoch advertised with the receive window. Valid only if "receiveWindow" is 1. See ChannelConfig::runtimeLimits.
+            uint16_t resumeMessageId;                                                   ///< The message id of the resumed block. Valid only if "resume" is 1.
+            int resumeWindow;                                                           ///< The window of the received fragment bitmap included in this packet. Valid only if "resume" is 1.
+        };
+
+        /**
+            Get the ids stored for a sent packet.
+
+            For packets containing messages, this is the array of message ids. For packets containing block fragments, this is the message id of each fragment, followed by the low 16 bits of each fragment id, then the high 16 bits.
+
+            @param sequence The sequence number of the sent connection packet.
+
+            @returns Pointer to the ids for this packet in the sent packet id slab.
+         */
+
+        uint16_t * GetSentPacketIds( uint16_t sequence )
+        {
+            return &m_sentPacketIds[ ( sequence % m_config.sentPacketBufferSize ) * m_sentPacketIdStride ];
+        }
+
+        /**
+            Get a fragment id stored for a sent packet containing block fragments.
+
+            @param sentPacketIds The ids stored for the packet. See GetSentPacketIds.
+            @param numBlockFragments The number of block fragments in the packet.
+            @param index The index of the fragment in the packet.
+
+            @returns The fragment id.
+         */
+
+        static uint32_t GetSentFragmentId( const uint16_t * sentPacketIds, int numBlockFragments, int index )
+        {
+            return uint32_t( sentPacketIds[numBlockFragments + index] ) | ( uint32_t( sentPacketIds[numBlockFragments * 2 + index] ) << 16 );
+        }
+
+        /**
+            Are received blocks reassembled straight into the block attached to the message?
+
+            @returns True if ChannelConfig::reassembleBlocksInPlace, ChannelConfig::largeBlocks or ChannelConfig::resumableBlocks is set.
+         */
+
+        bool ReassemblesBlocksInPlace() const { return m_config.reassembleBlocksInPlace || m_config.largeBlocks || m_config.resumableBlocks; }
+
+        /**
+            Allocate the receive buffer and fragment tracking of every block in flight. Blocks reassembled in place have no receive buffer, and with ChannelConfig::largeBlocks fragment tracking is allocated per block instead.
+
+            @returns True if successful, false if memory could not be allocated.
+         */
+
+        bool AllocateBlockBuffers();
+
+        /**
+            Free the buffers allocated by AllocateBlockBuffers. No block may be active.
+         */
+
+        void FreeBlockBuffers();
+
+        /**
+            Decode a message received with ChannelConfig::lazyDecode, before it is returned from ReceiveMessage.
+
+            On failure the message is released and the channel error level is set to CHANNEL_ERROR_FAILED_TO_SERIALIZE.
+
+            @param message The received message. Messages that aren't encoded are left alone.
+
+            @returns True if the message is ready to return.
+         */
+
+        bool DecodeReceivedMessage( Message * message );
+
+        /**
+            Internal state for a block being sent across the reliable ordered channel.
+            
+            Stores the block data and tracks which fragments have been acked. The block send completes when all fragments have been acked.
+
+            There is one of these per block in flight. See ChannelConfig::maxBlocksInFlight. Fragment data is read directly from the block attached to the message in the send queue.
          */
 
         struct SendBlockData
         {
-            SendBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+            /// A fragment waiting in the sent queue for its resend time.
+
+            struct SentFragment
+            {
+                int fragmentId;                                                         ///< The fragment.
+                float sendTime;                                                         ///< The time it was sent, relative to startTime (seconds).
+            };
+
+            SendBlockData( Allocator & allocator, int maxFragmentsPerBlock )
             {
                 m_allocator = &allocator;
-                ackedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-                fragmentSendTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double) * maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
-                yojimbo_assert( ackedFragment );
-                yojimbo_assert( fragmentSendTime );
-                yojimbo_assert( blockData );
+                ackedFragment = NULL;
+                pendingFragment = NULL;
+                queuedFragment = NULL;
+                fragmentSendTime = NULL;
+                compressedData = NULL;
+                parityData = NULL;
+                sentQueue = NULL;
+                if ( maxFragmentsPerBlock > 0 )
+                {
+                    const bool result = AllocateFragments( maxFragmentsPerBlock );
+                    yojimbo_assert( result );
+                    (void) result;
+                }
                 Reset();
             }
 
             ~SendBlockData()
+            {
+                FreeFragments();
+                FreeCompressedData();
+                FreeParityData();
+            }
+
+            bool AllocateFragments( int count )
+            {
+                yojimbo_assert( count > 0 );
+                yojimbo_assert( !ackedFragment );
+                yojimbo_assert( !pendingFragment );
+                yojimbo_assert( !queuedFragment );
+                yojimbo_assert( !fragmentSendTime );
+                yojimbo_assert( !sentQueue );
+                ackedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, count );
+                pendingFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, count );
+                queuedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, count );
+                fragmentSendTime = (float*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( float ) * count );
+                sentQueue = (SentFragment*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SentFragment ) * count );
+                if ( !ackedFragment || !pendingFragment || !queuedFragment || !fragmentSendTime || !sentQueue )
+                {
+                    FreeFragments();
+                    return false;
+                }
+                return true;
+            }
+
+            void FreeFragments()
             {
                 YOJIMBO_DELETE( *m_allocator, BitArray, ackedFragment );
-                YOJIMBO_FREE( *m_allocator, blockData );
+                YOJIMBO_DELETE( *m_allocator, BitArray, pendingFragment );
+                YOJIMBO_DELETE( *m_allocator, BitArray, queuedFragment );
                 YOJIMBO_FREE( *m_allocator, fragmentSendTime );
+                YOJIMBO_FREE( *m_allocator, sentQueue );
+            }
+
+            void PushSentFragment( int fragmentId, float sendTime )
+            {
+                yojimbo_assert( numSentQueue < numFragments );
+                yojimbo_assert( !queuedFragment->GetBit( fragmentId ) );
+                const int index = ( sentQueueHead + numSentQueue ) % numFragments;
+                sentQueue[index].fragmentId = fragmentId;
+                sentQueue[index].sendTime = sendTime;
+                numSentQueue++;
+                queuedFragment->SetBit( fragmentId );
+            }
+
+            bool CompressBlock( const uint8_t * blockData, int bytes )
+            {
+                yojimbo_assert( !compressedData );
+                const int maxCompressedBytes = lz4_compress_bound( bytes );
+                compressedData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, maxCompressedBytes );
+                if ( !compressedData )
+                    return false;
+                const int compressedBytes = lz4_compress_data( blockData, bytes, compressedData, maxCompressedBytes );
+                if ( compressedBytes <= 0 || compressedBytes >= bytes )
+                {
+                    // not worth it. send the block as is
+                    FreeCompressedData();
+                    return true;
+                }
+                uncompressedSize = bytes;
+                blockSize = compressedBytes;
+                return true;
+            }
+
+            void FreeCompressedData()
+            {
+                YOJIMBO_FREE( *m_allocator, compressedData );
+                uncompressedSize = 0;
+            }
+
+            bool ComputeParity( const uint8_t * data, int fragmentSize, int numGroups, int groupSize )
+            {
+                yojimbo_assert( !parityData );
+                numParityGroups = numGroups;
+                nextParityGroup = 0;
+                if ( numGroups == 0 )
+                    return true;
+                parityData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, size_t( numGroups ) * fragmentSize );
+                if ( !parityData )
+                    return false;
+                memset( parityData, 0, size_t( numGroups ) * fragmentSize );
+                for ( int i = 1; i < numFragments; ++i )
+                {
+                    const int bytes = ( i == numFragments - 1 ) ? blockSize - i * fragmentSize : fragmentSize;
+                    const uint8_t * fragment = data + size_t( i ) * fragmentSize;
+                    uint8_t * parity = parityData + size_t( ( i - 1 ) / groupSize ) * fragmentSize;
+                    for ( int j = 0; j < bytes; ++j )
+                        parity[j] ^= fragment[j];
+                }
+                return true;
+            }
+
+            void FreeParityData()
+            {
+                YOJIMBO_FREE( *m_allocator, parityData );
+                numParityGroups = 0;
+                nextParityGroup = 0;
             }
 
             void Reset()
@@ -563,18 +1325,37 @@ namespace yojimbo
                 active = false;
                 numFragments = 0;
                 numAckedFragments = 0;
+                firstUnackedFragment = 0;
+                sentQueueHead = 0;
+                numSentQueue = 0;
                 blockMessageId = 0;
                 blockSize = 0;
+                blockHash = 0;
+                startTime = 0.0;
+                FreeCompressedData();
+                FreeParityData();
             }
 
             bool active;                                                                ///< True if we are currently sending a block.
             int blockSize;                                                              ///< The size of the block (bytes).
             int numFragments;                                                           ///< Number of fragments in the block being sent.
             int numAckedFragments;                                                      ///< Number of acked fragments in the block being sent.
+            int firstUnackedFragment;                                                   ///< Every fragment before this one has been acked. Fragment scans start here, so they don't walk the acked start of large blocks.
             uint16_t blockMessageId;                                                    ///< The message id the block is attached to.
-            BitArray * ackedFragment;                                                   ///< Has fragment n been received?
-            double * fragmentSendTime;                                                  ///< Last time fragment was sent.
-            uint8_t * blockData;                                                        ///< The block data.
+            uint64_t blockHash;                                                         ///< The content hash of the block. Only set with ChannelConfig::resumableBlocks.
+            uint8_t * compressedData;                                                   ///< The compressed block, which fragments are sent from instead of the block attached to the message. Only set with ChannelConfig::compressBlocks, for blocks that compress. NULL otherwise.
+            int uncompressedSize;                                                       ///< The size of the block before compression (bytes). 0 if the block is sent uncompressed. blockSize is the size sent.
+            BitArray * ackedFragment;                                                   ///< Has fragment n been received? With ChannelConfig::largeBlocks this is sized to the block being sent, and NULL between blocks.
+            double startTime;                                                           ///< The time the block started sending.
+            float * fragmentSendTime;                                                   ///< Last time fragment was sent, relative to startTime (seconds). -FLT_MAX if the fragment should be sent now. 32 bits, so fragment scans touch half the cache lines. With ChannelConfig::largeBlocks this is sized to the block being sent, and NULL between blocks.
+            BitArray * pendingFragment;                                                 ///< Is fragment n not acked and due to be sent? GetFragmentToSend jumps to the next set bit instead of checking the send time of every fragment in flight. Sized like ackedFragment.
+            BitArray * queuedFragment;                                                  ///< Is fragment n in the sent queue? Sized like ackedFragment.
+            SentFragment * sentQueue;                                                   ///< Ring of the fragments in flight, in the order they were sent, so the ones past their resend time are found at the head. One entry per fragment at most. Sized like ackedFragment.
+            int sentQueueHead;                                                          ///< The entry at the head of the sent queue.
+            int numSentQueue;                                                           ///< The number of entries in the sent queue.
+            uint8_t * parityData;                                                       ///< The parity of each group of fragments, fragmentSize bytes per group. Only set with ChannelConfig::fragmentParityGroupSize, NULL otherwise.
+            int numParityGroups;                                                        ///< The number of parity groups in the block being sent.
+            int nextParityGroup;                                                        ///< The next parity group to send. Groups are sent in order, once each.
 
         private:
 
@@ -590,7 +1371,7 @@ namespace yojimbo
 
             Stores the fragments received over the network for the block, and completes once all fragments have been received.
 
-            IMPORTANT: Although there can be multiple block messages in the message send and receive queues, only one data block can be in flights over the wire at a time.
+            There is one of these per block in flight. See ChannelConfig::maxBlocksInFlight.
          */
 
         struct ReceiveBlockData
@@ -598,10 +1379,13 @@ namespace yojimbo
             ReceiveBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
             {
                 m_allocator = &allocator;
-                receivedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
-                yojimbo_assert( receivedFragment && blockData );
+                receivedFragment = maxFragmentsPerBlock > 0 ? YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock ) : NULL;
+                blockData = maxBlockSize > 0 ? (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize ) : NULL;
+                yojimbo_assert( receivedFragment || maxFragmentsPerBlock == 0 );
+                yojimbo_assert( blockData || maxBlockSize == 0 );
                 blockMessage = NULL;
+                sharedBlock = NULL;
+                resumeWindowAcked = NULL;
                 Reset();
             }
 
@@ -609,6 +1393,7 @@ namespace yojimbo
             {
                 YOJIMBO_DELETE( *m_allocator, BitArray, receivedFragment );
                 YOJIMBO_FREE( *m_allocator, blockData );
+                FreeResume();
             }
 
             void Reset()
@@ -616,20 +1401,40 @@ namespace yojimbo
                 active = false;
                 numFragments = 0;
                 numReceivedFragments = 0;
+                numContiguousFragments = 0;
                 messageId = 0;
                 messageType = 0;
                 blockSize = 0;
+                blockHash = 0;
+                uncompressedSize = 0;
+                FreeResume();
+            }
+
+            void FreeResume()
+            {
+                YOJIMBO_DELETE( *m_allocator, BitArray, resumeWindowAcked );
+                numResumeWindows = 0;
+                numResumeWindowsAcked = 0;
+                nextResumeWindow = 0;
             }
 
             bool active;                                                                ///< True if we are currently receiving a block.
             int numFragments;                                                           ///< The number of fragments in this block
             int numReceivedFragments;                                                   ///< The number of fragments received.
+            int numContiguousFragments;                                                 ///< The number of fragments received contiguously from the start of the block. See ReliableOrderedChannel::GetReceivedBlockPrefix.
             uint16_t messageId;                                                         ///< The message id corresponding to the block.
             int messageType;                                                            ///< Message type of the block being received.
             uint32_t blockSize;                                                         ///< Block size in bytes.
-            BitArray * receivedFragment;                                                ///< Has fragment n been received?
-            uint8_t * blockData;                                                        ///< Block data for receive.
+            BitArray * receivedFragment;                                                ///< Has fragment n been received? With ChannelConfig::largeBlocks this is sized to the block being received, and NULL between blocks.
+            uint8_t * blockData;                                                        ///< Block data for receive. With ChannelConfig::reassembleBlocksInPlace this is allocated per block from the message factory allocator and handed over to the block message on completion.
             BlockMessage * blockMessage;                                                ///< Block message (sent with fragment 0).
+            SharedBlock * sharedBlock;                                                  ///< The shared block blockData points into, when the message factory creates receive blocks. See MessageFactory::CreateReceiveBlock. NULL otherwise.
+            uint64_t blockHash;                                                         ///< The content hash of the block. Only set with ChannelConfig::resumableBlocks.
+            int uncompressedSize;                                                       ///< The size of the block once decompressed (bytes), sent with fragment 0. 0 if the block was sent uncompressed. See ChannelConfig::compressBlocks.
+            BitArray * resumeWindowAcked;                                               ///< Has window n of the received fragment bitmap been acked by the sender? Only allocated while a resumed block has windows left to send, NULL otherwise.
+            int numResumeWindows;                                                       ///< The number of windows of MaxResumeFragmentsPerPacket fragments in the received fragment bitmap.
+            int numResumeWindowsAcked;                                                  ///< The number of windows acked by the sender. Resume is done once all windows are acked.
+            int nextResumeWindow;                                                       ///< The window to try sending next. Windows are sent in rotation.
 
         private:
 
@@ -643,14 +1448,33 @@ namespace yojimbo
     private:
 
         uint16_t m_sendMessageId;                                                       ///< Id of the next message to be added to the send queue.
-        uint16_t m_receiveMessageId;                                                    ///< Id of the next message to be added to the receive queue.
+        uint16_t m_receiveMessageId;                                                    ///< Id of the next message to be added to the receive queue. For reliable-unordered channels, the oldest message id not received yet.
         uint16_t m_oldestUnackedMessageId;                                              ///< Id of the oldest unacked message in the send queue.
+        double m_nextMessageResendTime;                                                 ///< Earliest time any message in the send queue can next be sent. Lets GetMessagesToSend skip scanning the send queue when no message is eligible yet.
+        bool m_receivedAck;                                                             ///< True once any ack has been processed. Until then m_highestAck and m_lossScanSequence are not valid.
+        uint16_t m_highestAck;                                                          ///< The most recent packet sequence acked.
+        uint16_t m_lossScanSequence;                                                    ///< The next sent packet sequence to check for loss. See ChannelConfig::fastResendThreshold.
+        uint16_t m_sendWindowStart;                                                     ///< The start of the receive window the other side last advertised. Only messages up to ChannelConfig::receiveQueueSize past it are sent. See ChannelConfig::flowControl.
+        uint16_t m_ackedReceiveWindowStart;                                             ///< The start of our own receive window, as of the last advertisement the other side acked. See ChannelConfig::flowControl.
+        int m_sendWindowSize;                                                           ///< The size of the receive window the other side last advertised. ChannelConfig::receiveQueueSize unless ChannelConfig::runtimeLimits is set.
+        int m_remoteMaxBlockSize;                                                       ///< The largest block the other side last advertised it takes. See ChannelLimits::maxBlockSize.
+        uint16_t m_remoteLimitsEpoch;                                                   ///< The limits epoch of the other side, as of its last advertisement applied.
+        uint16_t m_limitsEpoch;                                                         ///< Bumped each time our receive queue size or largest block changes, so the other side applies advertisements in order.
+        uint16_t m_ackedLimitsEpoch;                                                    ///< Our limits epoch, as of the last advertisement the other side acked.
+        uint16_t m_receiveWindowEnd;                                                    ///< The furthest end of any receive window we advertised. The other side may send messages up to here, so the receive queue only shrinks once they fit.
+        double m_messageResendTime;                                                     ///< Delay before an unacked message is resent (seconds). ChannelConfig::messageResendTime, or derived from the RTT with ChannelConfig::adaptiveResendTime.
+        uint8_t * m_parityScratch;                                                      ///< Buffer a fragment is rebuilt into from parity. ChannelConfig::fragmentSize bytes, only allocated with ChannelConfig::fragmentParityGroupSize.
+        double m_fragmentResendTime;                                                    ///< Delay before an unacked block fragment is resent (seconds). ChannelConfig::fragmentResendTime, or derived from the RTT with ChannelConfig::adaptiveResendTime.
         SequenceBuffer<SentPacketEntry> * m_sentPackets;                                ///< Stores information per sent connection packet about messages and block data included in each packet. Used to walk from connection packet level acks to message and data block fragment level acks.
         SequenceBuffer<MessageSendQueueEntry> * m_messageSendQueue;                     ///< Message send queue.
         SequenceBuffer<MessageReceiveQueueEntry> * m_messageReceiveQueue;               ///< Message receive queue.
-        uint16_t * m_sentPacketMessageIds;                                              ///< Array of n message ids per sent connection packet. Allows the maximum number of messages per-packet to be allocated dynamically.
-        SendBlockData * m_sendBlock;                                                    ///< Data about the block being currently sent.
-        ReceiveBlockData * m_receiveBlock;                                              ///< Data about the block being currently received.
+        Queue<Message*> * m_messageDeliveryQueue;                                       ///< Messages received and ready to be dequeued, in arrival order. Reliable-unordered channels only, NULL otherwise.
+        int m_sentPacketIdStride;                                                       ///< Number of ids reserved per sent connection packet in m_sentPacketIds. Large enough for ChannelConfig::maxMessagesPerPacket message ids, or a message id and fragment id for each of ChannelConfig::maxFragmentsPerPacket fragments.
+        uint16_t * m_sentPacketIds;                                                     ///< One contiguous slab of ids for all sent connection packets, m_sentPacketIdStride per packet, indexed by sequence modulo ChannelConfig::sentPacketBufferSize.
+        SendBlockData ** m_sendBlocks;                                                  ///< Data about the blocks currently being sent. Indexed by block message id modulo ChannelConfig::maxBlocksInFlight. NULL if blocks are disabled.
+        ReceiveBlockData ** m_receiveBlocks;                                            ///< Data about the blocks currently being received. Indexed by block message id modulo ChannelConfig::maxBlocksInFlight. NULL if blocks are disabled.
+        bool m_blockBuffersAllocated;                                                   ///< True while the block buffers are allocated. See ChannelConfig::lazyBlockBuffers.
+        double m_lastBlockTime;                                                         ///< The last time a block was being sent or received. See ChannelConfig::blockBufferIdleTime.
 
     private:
 
@@ -678,7 +1502,7 @@ namespace yojimbo
             @param channelIndex The channel index in [0,numChannels-1].
          */
 
-        UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time );
+        UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time );
 
         /**
             Unreliable unordered channel destructor.
@@ -696,18 +1520,146 @@ namespace yojimbo
 
         Message * ReceiveMessage();
 
+        int ReceiveMessages( Message ** messages, int maxMessages );
+
         void AdvanceTime( double time );
 
+        bool HasTimers() const;
+
         int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
 
+        void DiscardPacketData( uint16_t packetSequence );
+
+        bool HasDataToSend() const;
+
+        int GetUnsentBits() const;
+
+        int GetSendQueueDepth() const;
+
+        int GetReceiveQueueDepth() const;
+
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
         void ProcessAck( uint16_t ack );
 
+        void ProcessAcks( const uint16_t * acks, int numAcks );
+
+        bool GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const;
+
+        void SetLimits( const ChannelLimits & limits );
+
     protected:
 
-        Queue<Message*> * m_messageSendQueue;                                           ///< Message send queue.
+        /**
+            An entry in the send queue of the unreliable-unordered channel.
+
+            The message is measured once when it is queued, so GetPacketData can decide whether it fits without serializing it twice.
+         */
+
+        struct MessageSendQueueEntry
+        {
+            Message * message;                                                          ///< Pointer to the message. It has one reference while it sits in the send queue.
+            double timeQueued;                                                          ///< The time the message was added to the send queue. Used to implement ChannelConfig::messageMaxDeferTime.
+            uint32_t measuredBits;                                                      ///< The number of bits the message (including its block and tick, if any) takes up in a bit stream. Excludes the message type.
+            float accumulatedPriority;                                                  ///< The priority the message has accumulated while queued. See ChannelConfig::priorityAccumulator.
+        };
+
+        /**
+            A recently sent message, kept to send again in later packets until a packet carrying it is acked. See ChannelConfig::redundantMessages.
+         */
+
+        struct RedundantMessageEntry
+        {
+            Message * message;                                                          ///< Pointer to the message. It has one reference until it is acked or a newer message takes its slot. NULL once acked.
+            uint32_t measuredBits;                                                      ///< The number of bits the message takes up in a bit stream. Excludes the message type.
+            uint16_t messageId;                                                         ///< The message sequence number.
+            bool acked;                                                                 ///< True once a packet carrying the message has been acked.
+        };
+
+        /**
+            The range of messages sent in a connection packet. Every message in the range that isn't in the packet was acked before the packet was sent.
+         */
+
+        struct SentPacketEntry
+        {
+            uint16_t firstMessageId;                                                    ///< Id of the oldest message in the packet.
+            uint16_t lastMessageId;                                                     ///< Id of the newest message in the packet.
+        };
+
+        /**
+            Pick the recent unacked messages to send again in a packet, newest first.
+
+            @param firstMessageId The id of the oldest message already in the packet. Messages picked go in front of it.
+            @param hasMessages True if the packet already has messages.
+            @param messageIds The ids of the messages picked, newest first (out).
+            @param numMessageIds The number of messages picked (out).
+            @param maxMessageIds The most messages to pick.
+            @param availableBits The bits left in the packet for them.
+
+            @returns The number of bits the picked messages take up, including the change in message id encoding.
+         */
+
+        int GetRedundantMessagesToSend( uint16_t firstMessageId, bool hasMessages, uint16_t * messageIds, int & numMessageIds, int maxMessageIds, int availableBits );
+
+        /**
+            Pick the queued messages with the most accumulated priority that fit in a packet, with ChannelConfig::priorityAccumulator.
+
+            Only the maxMessagesPerPacket messages with the most priority are considered, found with a heap in O(n log k). They are taken highest priority first, skipping those that don't fit. The messages picked leave the send queue. The rest stay queued, except those too old or too large to ever be sent, which are released.
+
+            @param messages The messages picked, highest priority first (out).
+            @param measuredBits The measured bits of each message picked (out).
+            @param usedBits The bits used in the packet so far. Goes up by the bits the picked messages take (in/out).
+            @param availableBits The bits available in the packet.
+
+            @returns The number of messages picked.
+         */
+
+        int GetPriorityMessagesToSend( Message ** messages, uint32_t * measuredBits, int & usedBits, int availableBits );
+
+        /**
+            A received message held back by the jitter buffer until its tick is due. See ChannelConfig::jitterBuffer.
+         */
+
+        struct JitterBufferEntry
+        {
+            Message * message;                                                          ///< Pointer to the message. It has one reference while it sits in the jitter buffer.
+            double senderTime;                                                          ///< The sender tick of the message, as a time relative to the first tick received (seconds).
+        };
+
+        /**
+            Measure the jitter on a received message and add it to the jitter buffer, in tick order.
+
+            Messages with a tick older than the last tick handed out are released instead.
+
+            @param message The received message.
+         */
+
+        void AddJitterBufferMessage( Message * message );
+
+        /**
+            Move the messages in the jitter buffer whose tick is due for playout to the receive queue.
+         */
+
+        void UpdateJitterBuffer();
+
+        Queue<MessageSendQueueEntry> * m_messageSendQueue;                              ///< Message send queue.
         Queue<Message*> * m_messageReceiveQueue;                                        ///< Message receive queue.
+        uint16_t m_sendMessageId;                                                       ///< Id of the next message sent, with ChannelConfig::redundantMessages.
+        RedundantMessageEntry * m_redundantMessages;                                    ///< The last ChannelConfig::redundantMessages messages sent, indexed by message id modulo their number. NULL without ChannelConfig::redundantMessages.
+        SequenceBuffer<SentPacketEntry> * m_sentPackets;                                ///< The messages sent in each connection packet, to walk from packet acks to message acks. NULL without ChannelConfig::redundantMessages.
+        SequenceBuffer<uint8_t> * m_receivedMessageIds;                                 ///< Ids of the messages received recently, so copies are dropped. NULL without ChannelConfig::redundantMessages.
+        JitterBufferEntry * m_jitterBuffer;                                             ///< Received messages not due for playout yet, in tick order. NULL without ChannelConfig::jitterBuffer.
+        int m_numJitterBufferEntries;                                                   ///< Number of messages in the jitter buffer.
+
+        double m_priorityTime;                                                          ///< The time priority was last accumulated. See ChannelConfig::priorityAccumulator.
+        bool m_hasJitterTick;                                                           ///< True once a message has been received into the jitter buffer.
+        uint32_t m_jitterBaseTick;                                                      ///< The tick of the first message received. Sender times are measured from it.
+        uint32_t m_jitterLastTick;                                                      ///< The newest tick the jitter was measured on.
+        double m_jitterLastTransit;                                                     ///< Transit time of the newest tick: the local time it arrived minus its sender time (seconds). Includes the clock offset between sender and receiver.
+        double m_jitterTransit;                                                         ///< Smoothed transit time (seconds).
+        double m_jitter;                                                                ///< Smoothed mean deviation of the transit time between ticks (seconds), as in RFC 3550.
+        bool m_hasPlayoutTick;                                                          ///< True once a message has been handed out of the jitter buffer.
+        uint32_t m_playoutTick;                                                         ///< The tick of the last message handed out of the jitter buffer. Older messages are dropped.
 
     private:
 
@@ -715,6 +1667,147 @@ namespace yojimbo
 
         UnreliableUnorderedChannel & operator = ( const UnreliableUnorderedChannel & other );
     };
+
+    /**
+        Messages are sent unreliably, and messages older than the newest received are dropped.
+
+        This is an unreliable-unordered channel that remembers the sequence number of the newest connection packet it has received data in. Messages in packets with an older (or the same) sequence number are released as soon as the packet is processed, instead of going into the receive queue.
+
+        Use this channel type for streams where only the newest data matters, like inputs or object state, so you don't have to sort and discard stale messages after receiving them.
+     */
+
+    class UnreliableSequencedChannel : public UnreliableUnorderedChannel
+    {
+    public:
+
+        /** 
+            Unreliable sequenced channel constructor.
+
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelIndex The channel index in [0,numChannels-1].
+         */
+
+        UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time );
+
+        void Reset();
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+    protected:
+
+        bool m_hasReceiveSequence;                                                      ///< True once data has been received on this channel since reset.
+        uint16_t m_receiveSequence;                                                     ///< Sequence number of the newest packet data was received in. Messages from this packet or older are dropped.
+
+    private:
+
+        UnreliableSequencedChannel( const UnreliableSequencedChannel & other );
+
+        UnreliableSequencedChannel & operator = ( const UnreliableSequencedChannel & other );
+    };
+
+    /**
+        Sends the most recent message every packet, unreliably, delta encoded against the last message the other side acked.
+
+        This channel type is designed for snapshots of world state sent rapidly from server to client. Only the latest message queued is sent: queueing a new message replaces one not sent yet. Only the newest message received is delivered: older messages arriving out of order are never returned by ReceiveMessage.
+
+        Messages sent over this channel must derive from SnapshotMessage. The channel tracks which packets carrying snapshots were acked, and before serializing each snapshot, sets the most recent acked snapshot of the same type as its baseline on both sides. The message serialize function then only needs to write what changed since the baseline.
+
+        Both sides keep the last ChannelConfig::baselineBufferSize packets worth of snapshots as baselines. A packet referring to a baseline the receiver doesn't have (eg. after one side resets) is dropped without acking it, so the sender falls back to an older baseline or none at all.
+
+        Blocks are not supported over this channel.
+     */
+
+    class SnapshotChannel : public Channel
+    {
+    public:
+
+        /** 
+            Snapshot channel constructor.
+
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelIndex The channel index in [0,numChannels-1].
+         */
+
+        SnapshotChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, const double & time );
+
+        /**
+            Snapshot channel destructor.
+
+            Any messages still queued or held as baselines will be released.
+         */
+
+        ~SnapshotChannel();
+
+        void Reset();
+
+        bool CanSendMessage() const;
+
+        void SendMessage( Message * message );
+
+        Message * ReceiveMessage();
+
+        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
+        void DiscardPacketData( uint16_t packetSequence );
+
+        bool HasDataToSend() const;
+
+        int GetSendQueueDepth() const;
+
+        int GetReceiveQueueDepth() const;
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+        void ProcessAck( uint16_t ack );
+
+        void ProcessAcks( const uint16_t * acks, int numAcks );
+
+        bool GetReceivedBlockPrefix( const uint8_t * & blockData, int & blockBytes ) const;
+
+        /**
+            Find a received snapshot to use as the baseline for a snapshot being read.
+
+            @param packetSequence The sequence number of the packet the baseline was received in.
+
+            @returns The baseline message, or NULL if it isn't held anymore (or was never received).
+
+            @see ChannelPacketData::Serialize
+         */
+
+        const SnapshotMessage * FindReceivedBaseline( uint16_t packetSequence ) const;
+
+    protected:
+
+        /**
+            A snapshot held as a potential baseline, indexed by packet sequence modulo ChannelConfig::baselineBufferSize.
+         */
+
+        struct SnapshotEntry
+        {
+            SnapshotMessage * message;                                                  ///< The snapshot message. Holds one reference. NULL if the entry is empty.
+            uint16_t sequence;                                                          ///< The sequence number of the packet the snapshot was sent or received in.
+            bool acked;                                                                 ///< Sent snapshots only. True once the packet carrying the snapshot was acked.
+        };
+
+        void ClearEntry( SnapshotEntry & entry );
+
+        SnapshotMessage * m_sendMessage;                                                ///< The snapshot to send in the next packet. NULL if none is queued.
+        SnapshotMessage * m_receiveMessage;                                             ///< The newest snapshot received, until it is popped by ReceiveMessage. NULL if none.
+        bool m_hasReceiveSequence;                                                      ///< True once a snapshot has been received since reset.
+        uint16_t m_receiveSequence;                                                     ///< Packet sequence of the newest snapshot received. Older snapshots are not delivered.
+        SnapshotEntry * m_sentSnapshots;                                                ///< Snapshots sent recently, candidate baselines once acked.
+        SnapshotEntry * m_receivedSnapshots;                                            ///< Snapshots received recently, looked up when the sender refers to them as a baseline.
+
+    private:
+
+        SnapshotChannel( const SnapshotChannel & other );
+
+        SnapshotChannel & operator = ( const SnapshotChannel & other );
+    };
 }
 
 #endif
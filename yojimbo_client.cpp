@@ -6,8 +6,11 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_client.h"
+#include "yojimbo_server.h"
 #include "yojimbo_connection.h"
 #include "yojimbo_simulator.h"
+#include "yojimbo_footprint.h"
+#include "yojimbo_shared_memory.h"
 #include "netcode.h"
 #include "reliable.h"
 #include <stdint.h>
@@ -18,57 +21,253 @@ namespace yojimbo
 {
     // ------------------------------------------------------------------------------------------------------------------
 
+    void InitializeEndpointConfig( const BaseClientServerConfig & config, reliable_config_t & endpointConfig )
+    {
+        yojimbo_assert( config.packetFragmentSize > 0 );
+        yojimbo_assert( config.maxPacketFragments > 0 );
+        yojimbo_assert( config.maxPacketSize <= config.maxPacketFragments * config.packetFragmentSize );
+        reliable_default_config( &endpointConfig );
+        endpointConfig.max_packet_size = config.maxPacketFragments * config.packetFragmentSize;
+        endpointConfig.fragment_above = config.packetFragmentAbove;
+        if ( config.trustedPathMtuDiscovery )
+        {
+            // the connection keeps packets within the path it discovered, so only packets too large for any path need splitting
+            endpointConfig.fragment_above = yojimbo_max( config.packetFragmentAbove, TrustedMaxPathBytes - TrustedPacketHeaderBytes - TrustedReliableHeaderBytes );
+        }
+        endpointConfig.fragment_size = config.packetFragmentSize;
+        endpointConfig.max_fragments = config.maxPacketFragments;
+        endpointConfig.fragment_reassembly_buffer_size = config.packetReassemblyBufferSize;
+        endpointConfig.ack_buffer_size = config.slidingWindowSize;
+        endpointConfig.sent_packets_buffer_size = config.slidingWindowSize;
+        endpointConfig.received_packets_buffer_size = config.slidingWindowSize;
+    }
+
+    Allocator * CreateEndpointAllocator( Allocator & allocator, const BaseClientServerConfig & config )
+    {
+        if ( config.packetBufferPoolSize <= 0 )
+            return NULL;
+        // big enough to reassemble a packet split into the most fragments, or to send the largest packet in one piece
+        const size_t bufferBytes = size_t( config.maxPacketFragments ) * size_t( config.packetFragmentSize ) + EndpointPacketHeaderBytes;
+        return YOJIMBO_NEW( allocator, BufferPoolAllocator, allocator, bufferBytes, config.packetBufferPoolSize );
+    }
+
+    // ------------------------------------------------------------------------------------------------------------------
+
     BaseClient::BaseClient( Allocator & allocator, const BaseClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
     {
         m_allocator = &allocator;
         m_adapter = &adapter;
         m_time = time;
+        m_powerSave = false;
+        m_nextPowerSaveSendTime = time;
         m_context = NULL;
         m_clientMemory = NULL;
         m_clientAllocator = NULL;
         m_endpoint = NULL;
+        m_endpointAllocator = NULL;
         m_connection = NULL;
         m_messageFactory = NULL;
         m_networkSimulator = NULL;
+        m_packetRecorder = NULL;
         m_clientState = CLIENT_STATE_DISCONNECTED;
         m_clientIndex = -1;
+        m_loopbackServer = NULL;
+        m_loopbackPackets = NULL;
+        m_sharedMemoryLink = NULL;
+        m_sharedMemoryReceiveTime = 0.0;
+        m_clientParentAllocator = NULL;
+        m_sendMessageQueue = NULL;
+        m_receiveMessageQueues = NULL;
+        m_messageFactoryLock = 0;
     }
 
     BaseClient::~BaseClient()
     {
         // IMPORTANT: Please disconnect the client before destroying it
         yojimbo_assert( m_clientState <= CLIENT_STATE_DISCONNECTED );
+        // a connection kept for reuse lives until the client is destroyed
+        DestroyInternal();
         m_allocator = NULL;
     }
 
     void BaseClient::Disconnect()
     {
+        if ( m_loopbackServer )
+        {
+            // unlink first, so the server doesn't disconnect this client again
+            BaseServer * server = m_loopbackServer;
+            m_loopbackServer = NULL;
+            server->DisconnectLoopbackClient( m_clientIndex );
+            m_clientIndex = -1;
+        }
+        if ( m_sharedMemoryLink )
+        {
+            // closing the link tells the server, which frees the client slot on its next update
+            YOJIMBO_DELETE( *m_clientAllocator, SharedMemoryLink, m_sharedMemoryLink );
+            m_clientIndex = -1;
+        }
         SetClientState( CLIENT_STATE_DISCONNECTED );
     }
 
+    bool BaseClient::ConnectLoopback( BaseServer & server )
+    {
+        yojimbo_assert( server.IsRunning() );
+        Disconnect();
+        CreateInternal();
+        m_loopbackPackets = YOJIMBO_NEW( *m_clientAllocator, Queue<LoopbackPacket>, *m_clientAllocator, m_config.maxLoopbackPackets );
+        const int clientIndex = server.ConnectLoopbackClient( *this );
+        if ( clientIndex < 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: loopback connect failed. server is full\n" );
+            Disconnect();
+            SetClientState( CLIENT_STATE_ERROR );
+            return false;
+        }
+        m_loopbackServer = &server;
+        m_clientIndex = clientIndex;
+        SetClientState( CLIENT_STATE_CONNECTED );
+        return true;
+    }
+
+    bool BaseClient::ConnectSharedMemory( const char * path )
+    {
+        yojimbo_assert( path );
+        Disconnect();
+        CreateInternal();
+        SharedMemoryLink * link = YOJIMBO_NEW( *m_clientAllocator, SharedMemoryLink, path );
+        if ( !link || link->IsError() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: shared memory connect failed\n" );
+            YOJIMBO_DELETE( *m_clientAllocator, SharedMemoryLink, link );
+            Disconnect();
+            SetClientState( CLIENT_STATE_ERROR );
+            return false;
+        }
+        m_sharedMemoryLink = link;
+        m_sharedMemoryReceiveTime = m_time;
+        m_clientIndex = link->GetClientIndex();
+        SetClientState( CLIENT_STATE_CONNECTED );
+        return true;
+    }
+
+    void BaseClient::QueueLoopbackPacket( const uint8_t * packetData, int packetBytes )
+    {
+        yojimbo_assert( m_loopbackPackets );
+        if ( m_loopbackPackets->IsFull() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "loopback packet queue is full. dropping packet\n" );
+            return;
+        }
+        LoopbackPacket packet;
+        packet.packetData = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator, packetBytes );
+        if ( !packet.packetData )
+            return;
+        memcpy( packet.packetData, packetData, packetBytes );
+        packet.packetBytes = packetBytes;
+        m_loopbackPackets->Push( packet );
+    }
+
+    void BaseClient::SendLoopbackPacket( const uint8_t * packetData, int packetBytes )
+    {
+        if ( m_sharedMemoryLink )
+        {
+            if ( !m_sharedMemoryLink->SendPacket( packetData, packetBytes ) )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "shared memory ring is full. dropping packet\n" );
+            return;
+        }
+        yojimbo_assert( m_loopbackServer );
+        m_loopbackServer->QueueLoopbackPacket( m_clientIndex, packetData, packetBytes );
+    }
+
+    void BaseClient::ReceiveLoopbackPackets()
+    {
+        if ( m_sharedMemoryLink )
+        {
+            int packetBytes;
+            uint8_t * packetData;
+            while ( ( packetData = m_sharedMemoryLink->ReceivePacket( packetBytes ) ) != NULL )
+            {
+                reliable_endpoint_receive_packet( m_endpoint, packetData, packetBytes );
+                m_sharedMemoryLink->ReleasePacket();
+                m_sharedMemoryReceiveTime = m_time;
+            }
+            // like a netcode.io timeout, the link stays until Disconnect is called
+            if ( m_sharedMemoryLink->IsClosed() )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server closed the shared memory link\n" );
+                SetClientState( CLIENT_STATE_DISCONNECTED );
+            }
+            else if ( m_config.sharedMemoryTimeout > 0.0f && m_time - m_sharedMemoryReceiveTime > m_config.sharedMemoryTimeout )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "shared memory link timed out\n" );
+                SetClientState( CLIENT_STATE_DISCONNECTED );
+            }
+            return;
+        }
+        yojimbo_assert( m_loopbackPackets );
+        while ( !m_loopbackPackets->IsEmpty() )
+        {
+            LoopbackPacket packet = m_loopbackPackets->Pop();
+            reliable_endpoint_receive_packet( m_endpoint, packet.packetData, packet.packetBytes );
+            YOJIMBO_FREE( *m_clientAllocator, packet.packetData );
+        }
+    }
+
     void BaseClient::AdvanceTime( double time )
+    {
+        if ( !AdvanceTimeInternal( time ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connection error. disconnecting client\n" );
+            Disconnect();
+        }
+    }
+
+    void BaseClient::SetPowerSave( bool powerSave )
+    {
+        yojimbo_assert( !powerSave || m_config.clientPowerSaveInterval > 0.0f );
+        yojimbo_assert( !powerSave || m_config.clientPowerSaveBurstPackets > 0 );
+        if ( powerSave && !m_powerSave )
+            m_nextPowerSaveSendTime = m_time;
+        m_powerSave = powerSave;
+    }
+
+    int BaseClient::GetNumPacketsToSend()
+    {
+        if ( !m_powerSave )
+            return 1;
+
+        if ( m_time < m_nextPowerSaveSendTime && !( m_connection && m_connection->HasUrgentDataToSend() ) )
+            return 0;
+
+        // the interval runs from the last burst, so an urgent burst pushes the next one back
+
+        m_nextPowerSaveSendTime = m_time + m_config.clientPowerSaveInterval;
+        return m_config.clientPowerSaveBurstPackets;
+    }
+
+    bool BaseClient::AdvanceTimeInternal( double time )
     {
         m_time = time;
         if ( m_endpoint )
         {
             m_connection->AdvanceTime( time );
             if ( m_connection->GetErrorLevel() != CONNECTION_ERROR_NONE )
-            {
-                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connection error. disconnecting client\n" );
-                Disconnect();
-                return;
-            }
+                return false;
+            if ( m_connection->UpdateMemoryLow() )
+                m_adapter->OnConnectionMemoryLow( -1, m_connection->IsMemoryLow() );
             reliable_endpoint_update( m_endpoint );
             int numAcks;
             const uint16_t * acks = reliable_endpoint_get_acks( m_endpoint, &numAcks );
             m_connection->ProcessAcks( acks, numAcks );
             reliable_endpoint_clear_acks( m_endpoint );
+            m_connection->UpdateNetworkConditions( reliable_endpoint_rtt( m_endpoint ), reliable_endpoint_packet_loss( m_endpoint ) );
         }
         NetworkSimulator * networkSimulator = GetNetworkSimulator();
         if ( networkSimulator )
         {
             networkSimulator->AdvanceTime( time );
         }
+        return true;
     }
 
     void BaseClient::SetLatency( float milliseconds )
@@ -103,6 +302,14 @@ namespace yojimbo
         }
     }
 
+    void BaseClient::SetLinkConditions( const NetworkLinkConditions & conditions )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLinkConditions( 0, conditions );
+        }
+    }
+
     void BaseClient::SetClientState( ClientState clientState )
     {
         m_clientState = clientState;
@@ -112,51 +319,195 @@ namespace yojimbo
     {
         yojimbo_assert( m_allocator );
         yojimbo_assert( m_adapter );
+        if ( m_connection )
+        {
+            // kept from the last connect and already reset. see BaseClientServerConfig::clientReuseConnection
+            yojimbo_assert( m_config.clientReuseConnection );
+            return;
+        }
         yojimbo_assert( m_clientMemory == NULL );
         yojimbo_assert( m_clientAllocator == NULL );
         yojimbo_assert( m_messageFactory == NULL );
-        m_clientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.clientMemory );
-        m_clientAllocator = m_adapter->CreateAllocator( *m_allocator, m_clientMemory, m_config.clientMemory );
+        if ( m_config.checkMemory )
+        {
+            ConnectionMemoryFootprint footprint;
+            GetConnectionMemoryFootprint( *m_allocator, *m_adapter, m_config, true, footprint );
+            CheckMemoryFootprint( "clientMemory", m_config.clientMemory, footprint.total );
+        }
+        if ( m_config.clientSharedMemory )
+        {
+            m_clientAllocator = YOJIMBO_NEW( *m_allocator, QuotaAllocator, *m_allocator, m_config.clientMemory );
+        }
+        else
+        {
+            m_clientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.clientMemory );
+            m_clientAllocator = m_adapter->CreateAllocator( *m_allocator, m_clientMemory, m_config.clientMemory );
+        }
+        if ( m_config.clientNetworkThread )
+        {
+            // the game thread allocates blocks and messages while the network thread processes packets
+            m_clientParentAllocator = m_clientAllocator;
+            m_clientAllocator = YOJIMBO_NEW( *m_allocator, ThreadSafeAllocator, *m_clientParentAllocator );
+        }
         m_messageFactory = m_adapter->CreateMessageFactory( *m_clientAllocator );
         m_connection = YOJIMBO_NEW( *m_clientAllocator, Connection, *m_clientAllocator, *m_messageFactory, m_config, m_time );
         yojimbo_assert( m_connection );
         if ( m_config.networkSimulator )
         {
-            m_networkSimulator = YOJIMBO_NEW( *m_clientAllocator, NetworkSimulator, *m_clientAllocator, m_config.maxSimulatorPackets, m_time );
+            m_networkSimulator = YOJIMBO_NEW( *m_clientAllocator, NetworkSimulator, *m_clientAllocator, m_config.maxSimulatorPackets, m_time, m_config.simulatorPacketBuffers, m_config.simulatorPacketBufferBytes );
+            if ( m_config.simulatorSeed )
+                m_networkSimulator->SetSeed( m_config.simulatorSeed );
         }
-        // todo: fully setup endpoint config from client/server config
+        m_endpointAllocator = CreateEndpointAllocator( *m_clientAllocator, m_config );
         reliable_config_t config;
-        reliable_default_config( &config );
+        InitializeEndpointConfig( m_config, config );
         strcpy( config.name, "client endpoint" );
         config.context = (void*) this;
         config.transmit_packet_function = BaseClient::StaticTransmitPacketFunction;
         config.process_packet_function = BaseClient::StaticProcessPacketFunction;
-        config.allocator_context = m_clientAllocator;
+        config.allocator_context = m_endpointAllocator ? m_endpointAllocator : m_clientAllocator;
         config.allocate_function = BaseClient::StaticAllocateFunction;
         config.free_function = BaseClient::StaticFreeFunction;
         m_endpoint = reliable_endpoint_create( &config );
         reliable_endpoint_reset( m_endpoint );
     }
 
+    void BaseClient::DestroyLoopbackPackets()
+    {
+        if ( !m_loopbackPackets )
+            return;
+        while ( !m_loopbackPackets->IsEmpty() )
+        {
+            LoopbackPacket packet = m_loopbackPackets->Pop();
+            YOJIMBO_FREE( *m_clientAllocator, packet.packetData );
+        }
+        YOJIMBO_DELETE( *m_clientAllocator, Queue<LoopbackPacket>, m_loopbackPackets );
+    }
+
+    void BaseClient::ResetInternal()
+    {
+        if ( !m_connection )
+            return;
+        // start the next connection with a fresh arena if this one ran out
+        if ( m_clientAllocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE || ( m_clientParentAllocator && m_clientParentAllocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE ) )
+        {
+            DestroyInternal();
+            return;
+        }
+        DestroyLoopbackPackets();
+        reliable_endpoint_reset( m_endpoint );
+        m_connection->Reset();
+        if ( m_networkSimulator )
+            m_networkSimulator->DiscardPackets();
+    }
+
     void BaseClient::DestroyInternal()
     {
         yojimbo_assert( m_allocator );
+        DestroyLoopbackPackets();
         if ( m_endpoint )
         {
             reliable_endpoint_destroy( m_endpoint ); 
             m_endpoint = NULL;
         }
+        YOJIMBO_DELETE( *m_clientAllocator, Allocator, m_endpointAllocator );
         YOJIMBO_DELETE( *m_clientAllocator, NetworkSimulator, m_networkSimulator );
         YOJIMBO_DELETE( *m_clientAllocator, Connection, m_connection );
         YOJIMBO_DELETE( *m_clientAllocator, MessageFactory, m_messageFactory );
         YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator );
+        YOJIMBO_DELETE( *m_allocator, Allocator, m_clientParentAllocator );
         YOJIMBO_FREE( *m_allocator, m_clientMemory );
     }
 
+    void BaseClient::CreateMessageQueues()
+    {
+        yojimbo_assert( m_clientAllocator );
+        yojimbo_assert( !m_sendMessageQueue );
+        int sendQueueSize = 0;
+        for ( int i = 0; i < m_config.numChannels; ++i )
+        {
+            sendQueueSize += m_config.channel[i].sendQueueSize;
+        }
+        m_sendMessageQueue = YOJIMBO_NEW( *m_clientAllocator, SPSCQueue<QueuedMessage>, *m_clientAllocator, sendQueueSize );
+        m_receiveMessageQueues = (SPSCQueue<Message*>**) YOJIMBO_ALLOCATE( *m_clientAllocator, sizeof( SPSCQueue<Message*>* ) * m_config.numChannels );
+        for ( int i = 0; i < m_config.numChannels; ++i )
+        {
+            m_receiveMessageQueues[i] = YOJIMBO_NEW( *m_clientAllocator, SPSCQueue<Message*>, *m_clientAllocator, m_config.channel[i].receiveQueueSize );
+        }
+    }
+
+    void BaseClient::DestroyMessageQueues()
+    {
+        if ( !m_sendMessageQueue )
+            return;
+        QueuedMessage queuedMessage;
+        while ( m_sendMessageQueue->Pop( queuedMessage ) )
+        {
+            m_messageFactory->ReleaseMessage( queuedMessage.message );
+        }
+        YOJIMBO_DELETE( *m_clientAllocator, SPSCQueue<QueuedMessage>, m_sendMessageQueue );
+        for ( int i = 0; i < m_config.numChannels; ++i )
+        {
+            Message * message;
+            while ( m_receiveMessageQueues[i]->Pop( message ) )
+            {
+                m_messageFactory->ReleaseMessage( message );
+            }
+            YOJIMBO_DELETE( *m_clientAllocator, SPSCQueue<Message*>, m_receiveMessageQueues[i] );
+        }
+        YOJIMBO_FREE( *m_clientAllocator, m_receiveMessageQueues );
+    }
+
+    void BaseClient::FlushSendMessageQueue()
+    {
+        yojimbo_assert( m_sendMessageQueue );
+        QueuedMessage queuedMessage;
+        while ( m_sendMessageQueue->Peek( queuedMessage ) )
+        {
+            // leave the rest queued until the channel has room, rather than failing the send
+            if ( !m_connection->CanSendMessage( queuedMessage.channelIndex ) )
+                break;
+            m_sendMessageQueue->Pop( queuedMessage );
+            m_connection->SendMessage( queuedMessage.channelIndex, queuedMessage.message );
+        }
+    }
+
+    void BaseClient::FillReceiveMessageQueues()
+    {
+        yojimbo_assert( m_receiveMessageQueues );
+        for ( int i = 0; i < m_config.numChannels; ++i )
+        {
+            while ( !m_receiveMessageQueues[i]->IsFull() )
+            {
+                Message * message = m_connection->ReceiveMessage( i );
+                if ( !message )
+                    break;
+                m_receiveMessageQueues[i]->Push( message );
+            }
+        }
+    }
+
+    void BaseClient::LockMessageFactory()
+    {
+        while ( yojimbo_atomic_compare_exchange( &m_messageFactoryLock, 1, 0 ) != 0 )
+        {
+            // spin
+        }
+    }
+
+    void BaseClient::UnlockMessageFactory()
+    {
+        const int previous = yojimbo_atomic_compare_exchange( &m_messageFactoryLock, 0, 1 );
+        yojimbo_assert( previous == 1 );
+        (void) previous;
+    }
+
     void BaseClient::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
         (void) index;
         BaseClient * client = (BaseClient*) context;
+        if ( client->m_packetRecorder )
+            client->m_packetRecorder->RecordPacket( client->m_time, PACKET_DIRECTION_SEND, client->m_clientIndex, packetSequence, packetData, packetBytes );
         client->TransmitPacketFunction( packetSequence, packetData, packetBytes );
     }
     
@@ -164,6 +515,8 @@ namespace yojimbo
     {
         (void) index;
         BaseClient * client = (BaseClient*) context;
+        if ( client->m_packetRecorder )
+            client->m_packetRecorder->RecordPacket( client->m_time, PACKET_DIRECTION_RECEIVE, client->m_clientIndex, packetSequence, packetData, packetBytes );
         return client->ProcessPacketFunction( packetSequence, packetData, packetBytes );
     }
 
@@ -185,6 +538,13 @@ namespace yojimbo
     Message * BaseClient::CreateMessage( int type )
     {
         yojimbo_assert( m_messageFactory );
+        if ( HasMessageQueues() )
+        {
+            LockMessageFactory();
+            Message * message = m_messageFactory->CreateMessage( type );
+            UnlockMessageFactory();
+            return message;
+        }
         return m_messageFactory->CreateMessage( type );
     }
 
@@ -211,39 +571,232 @@ namespace yojimbo
     bool BaseClient::CanSendMessage( int channelIndex ) const
     {
         yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+            return !m_sendMessageQueue->IsFull();
         return m_connection->CanSendMessage( channelIndex );
     }
 
+    bool BaseClient::IsMemoryLow() const
+    {
+        yojimbo_assert( m_connection );
+        return m_connection->IsMemoryLow();
+    }
+
+    uint64_t BaseClient::GetChannelsWithMessages() const
+    {
+        yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            // the connection belongs to the network thread, so look at the queues it fills instead
+            uint64_t channels = 0;
+            for ( int i = 0; i < m_config.numChannels; ++i )
+            {
+                if ( !m_receiveMessageQueues[i]->IsEmpty() )
+                    channels |= uint64_t(1) << i;
+            }
+            return channels;
+        }
+        return m_connection->GetChannelsWithMessages();
+    }
+
     void BaseClient::SendMessage( int channelIndex, Message * message )
     {
         yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            yojimbo_assert( channelIndex >= 0 );
+            yojimbo_assert( channelIndex < m_config.numChannels );
+            QueuedMessage queuedMessage;
+            queuedMessage.channelIndex = channelIndex;
+            queuedMessage.message = message;
+            if ( !m_sendMessageQueue->Push( queuedMessage ) )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: client send message queue is full. dropping message\n" );
+                ReleaseMessage( message );
+            }
+            return;
+        }
         m_connection->SendMessage( channelIndex, message );
     }
 
     Message * BaseClient::ReceiveMessage( int channelIndex )
     {
         yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            yojimbo_assert( channelIndex >= 0 );
+            yojimbo_assert( channelIndex < m_config.numChannels );
+            Message * message;
+            return m_receiveMessageQueues[channelIndex]->Pop( message ) ? message : NULL;
+        }
         return m_connection->ReceiveMessage( channelIndex );
     }
 
     void BaseClient::ReleaseMessage( Message * message )
     {
         yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            LockMessageFactory();
+            m_connection->ReleaseMessage( message );
+            UnlockMessageFactory();
+            return;
+        }
         m_connection->ReleaseMessage( message );
     }
 
+    int BaseClient::SendMessages( int channelIndex, Message ** messages, int numMessages )
+    {
+        yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            yojimbo_assert( channelIndex >= 0 );
+            yojimbo_assert( channelIndex < m_config.numChannels );
+            int numSent = 0;
+            while ( numSent < numMessages )
+            {
+                QueuedMessage queuedMessage;
+                queuedMessage.channelIndex = channelIndex;
+                queuedMessage.message = messages[numSent];
+                if ( !m_sendMessageQueue->Push( queuedMessage ) )
+                    break;
+                numSent++;
+            }
+            return numSent;
+        }
+        return m_connection->SendMessages( channelIndex, messages, numMessages );
+    }
+
+    int BaseClient::ReceiveMessages( int channelIndex, Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            yojimbo_assert( channelIndex >= 0 );
+            yojimbo_assert( channelIndex < m_config.numChannels );
+            int numReceived = 0;
+            while ( numReceived < maxMessages && m_receiveMessageQueues[channelIndex]->Pop( messages[numReceived] ) )
+                numReceived++;
+            return numReceived;
+        }
+        return m_connection->ReceiveMessages( channelIndex, messages, maxMessages );
+    }
+
+    void BaseClient::ReleaseMessages( Message ** messages, int numMessages )
+    {
+        yojimbo_assert( m_connection );
+        if ( HasMessageQueues() )
+        {
+            LockMessageFactory();
+            m_connection->ReleaseMessages( messages, numMessages );
+            UnlockMessageFactory();
+            return;
+        }
+        m_connection->ReleaseMessages( messages, numMessages );
+    }
+
+    bool BaseClient::GetReceivedBlockPrefix( int channelIndex, const uint8_t * & blockData, int & blockBytes ) const
+    {
+        yojimbo_assert( m_connection );
+        // the receive state belongs to the network thread
+        if ( HasMessageQueues() )
+            return false;
+        return m_connection->GetReceivedBlockPrefix( channelIndex, blockData, blockBytes );
+    }
+
+    void BaseClient::GetAllocatorStats( AllocatorStats & stats ) const
+    {
+        stats = AllocatorStats();
+        if ( m_clientAllocator )
+            m_clientAllocator->GetStats( stats );
+    }
+
+    void BaseClient::GetConnectionStats( ConnectionStats & stats ) const
+    {
+        stats = ConnectionStats();
+        if ( !m_endpoint )
+            return;
+        stats.rtt = reliable_endpoint_rtt( m_endpoint );
+        stats.packetLoss = reliable_endpoint_packet_loss( m_endpoint );
+        reliable_endpoint_bandwidth( m_endpoint, &stats.sentBandwidth, &stats.receivedBandwidth, &stats.ackedBandwidth );
+        const uint64_t * counters = reliable_endpoint_counters( m_endpoint );
+        stats.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
+        stats.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
+        stats.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
+        m_connection->GetStats( stats );
+    }
+
+    bool BaseClient::GetLatencyHistogram( int channelIndex, int index, LatencyHistogram & histogram ) const
+    {
+        histogram.Clear();
+        if ( !m_connection )
+            return false;
+        const LatencyHistogram * channelHistogram = m_connection->GetLatencyHistogram( channelIndex, index );
+        if ( !channelHistogram )
+            return false;
+        histogram = *channelHistogram;
+        return true;
+    }
+
+    bool BaseClient::SetChannelLimits( int channelIndex, const ChannelLimits & limits )
+    {
+        // the connection belongs to the network thread
+        if ( !m_connection || HasMessageQueues() )
+            return false;
+        m_connection->SetChannelLimits( channelIndex, limits );
+        return true;
+    }
+
+    void BaseClient::GetChannelLimits( int channelIndex, ChannelLimits & limits ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_config.numChannels );
+        limits = m_connection ? m_connection->GetChannelLimits( channelIndex ) : ChannelLimits( m_config.channel[channelIndex] );
+    }
+
     // ------------------------------------------------------------------------------------------------------------------
 
     Client::Client( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) : BaseClient( allocator, config, adapter, time ), m_config( config ), m_address( address )
     {
         m_clientId = 0;
         m_client = NULL;
+        m_numRaceClients = 0;
+        m_networkThread = NULL;
+        m_networkThreadQuit = 0;
+        m_networkThreadDone = 0;
+        m_trustedSocket = NULL;
+        m_trustedSecondarySocket = NULL;
+        m_trustedSecondaryConnected = false;
+        m_trustedNextPath = 0;
+        m_trustedResumeTicket = 0;
+        m_trustedResuming = false;
+        m_trustedResumeStartTime = 0.0;
+        m_trustedResumeRequestTime = 0.0;
+        m_trustedClientIndex = -1;
+        m_trustedDenied = false;
+        m_trustedRemoteDisconnect = false;
+        m_trustedConnectStartTime = 0.0;
+        m_trustedLastPacketSendTime = 0.0;
+        m_trustedLastPacketReceiveTime = 0.0;
+        m_trustedPathBytes = 0;
+        m_trustedPathFailedBytes = 0;
+        m_trustedPathProbeBytes = 0;
+        m_trustedPathProbeAttempts = 0;
+        m_trustedPathProbeTime = 0.0;
+        m_trustedPathSearching = false;
+        m_trustedPathConfirmsLeft = 0;
+        m_trustedPathSearchTime = 0.0;
+        m_packetBufferMemory = (uint8_t*) YOJIMBO_ALLOCATE( GetAllocator(), m_config.maxPacketSize + CacheLineBytes - 1 );
+        m_packetBuffer = (uint8_t*) ( ( uintptr_t( m_packetBufferMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
     }
 
     Client::~Client()
     {
         // IMPORTANT: Please disconnect the client before destroying it
         yojimbo_assert( m_client == NULL );
+        yojimbo_assert( m_trustedSocket == NULL );
+        m_packetBuffer = NULL;
+        YOJIMBO_FREE( GetAllocator(), m_packetBufferMemory );
     }
 
     void Client::InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address & address )
@@ -256,6 +809,30 @@ namespace yojimbo
         yojimbo_assert( serverAddresses );
         yojimbo_assert( numServerAddresses > 0 );
         yojimbo_assert( numServerAddresses <= NETCODE_MAX_SERVERS_PER_CONNECT );
+        yojimbo_assert( m_config.clientConnectRace >= 1 );
+        yojimbo_assert( m_config.clientConnectRace <= MaxConnectRace );
+        const int numRaceClients = m_config.clientConnectRace < numServerAddresses ? m_config.clientConnectRace : numServerAddresses;
+        if ( numRaceClients > 1 )
+        {
+            // each attempt gets its own token with every numRaceClients-th address, so all addresses are still tried
+            uint8_t * connectTokens = (uint8_t*) alloca( size_t( numRaceClients ) * ConnectTokenBytes );
+            for ( int i = 0; i < numRaceClients; ++i )
+            {
+                Address raceAddresses[NETCODE_MAX_SERVERS_PER_CONNECT];
+                int numRaceAddresses = 0;
+                for ( int j = i; j < numServerAddresses; j += numRaceClients )
+                    raceAddresses[numRaceAddresses++] = serverAddresses[j];
+                if ( !GenerateInsecureConnectToken( connectTokens + size_t( i ) * ConnectTokenBytes, privateKey, clientId, raceAddresses, numRaceAddresses ) )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to generate insecure connect token\n" );
+                    Disconnect();
+                    SetClientState( CLIENT_STATE_ERROR );
+                    return;
+                }
+            }
+            Connect( clientId, connectTokens, numRaceClients );
+            return;
+        }
         Disconnect();
         CreateInternal();
         m_clientId = clientId;
@@ -274,10 +851,24 @@ namespace yojimbo
         }
         netcode_client_connect( m_client, connectToken );
         SetClientState( CLIENT_STATE_CONNECTING );
+        if ( m_config.clientNetworkThread )
+        {
+            StartNetworkThread();
+        }
     }
 
     bool Client::GenerateInsecureConnectToken( uint8_t * connectToken, const uint8_t privateKey[], uint64_t clientId, const Address serverAddresses[], int numServerAddresses, int timeout )
     {
+        return GenerateInsecureConnectTokens( connectToken, privateKey, &clientId, 1, serverAddresses, numServerAddresses, timeout );
+    }
+
+    bool Client::GenerateInsecureConnectTokens( uint8_t * connectTokens, const uint8_t privateKey[], const uint64_t clientIds[], int numClients, const Address serverAddresses[], int numServerAddresses, int timeout )
+    {
+        yojimbo_assert( connectTokens );
+        yojimbo_assert( clientIds );
+        yojimbo_assert( numClients > 0 );
+        yojimbo_assert( numServerAddresses > 0 );
+        yojimbo_assert( numServerAddresses <= NETCODE_MAX_SERVERS_PER_CONNECT );
         char serverAddressStrings[NETCODE_MAX_SERVERS_PER_CONNECT][MaxAddressLength];
         char * serverAddressStringPointers[NETCODE_MAX_SERVERS_PER_CONNECT];
         for ( int i = 0; i < numServerAddresses; ++i ) 
@@ -285,7 +876,12 @@ namespace yojimbo
             serverAddresses[i].ToString( serverAddressStrings[i], MaxAddressLength );
             serverAddressStringPointers[i] = serverAddressStrings[i];
         }
-        return netcode_generate_connect_token( numServerAddresses, serverAddressStringPointers, timeout, clientId, m_config.protocolId, 0, (uint8_t*)privateKey, connectToken ) == NETCODE_OK;
+        for ( int i = 0; i < numClients; ++i )
+        {
+            if ( netcode_generate_connect_token( numServerAddresses, serverAddressStringPointers, timeout, clientIds[i], m_config.protocolId, 0, (uint8_t*)privateKey, connectTokens + size_t( i ) * ConnectTokenBytes ) != NETCODE_OK )
+                return false;
+        }
+        return true;
     }
 
     void Client::Connect( uint64_t clientId, uint8_t * connectToken )
@@ -297,37 +893,170 @@ namespace yojimbo
         CreateClient( m_address );
         netcode_client_connect( m_client, connectToken );
         SetClientState( CLIENT_STATE_CONNECTING );
-    }
-
-    void Client::Disconnect()
-    {
-        BaseClient::Disconnect();
-        DestroyClient();
-        DestroyInternal();
-        m_clientId = 0;
-    }
-
-    void Client::SendPackets()
-    {
-        if ( !IsConnected() )
-            return;
-        yojimbo_assert( m_client );
-        // todo: we don't want to allocate this on the stack, as packet size can be larger than that now
-        uint8_t * packetData = (uint8_t*) alloca( m_config.maxPacketSize );
-        int packetBytes;
-        uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetEndpoint() );
-        if ( GetConnection().GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
+        if ( m_config.clientNetworkThread && m_client )
         {
-            reliable_endpoint_send_packet( GetEndpoint(), packetData, packetBytes );
+            StartNetworkThread();
         }
     }
 
-    void Client::ReceivePackets()
+    void Client::Connect( uint64_t clientId, uint8_t * connectTokens, int numConnectTokens )
     {
-        if ( !IsConnected() )
-            return;
-        yojimbo_assert( m_client );
-        while ( true )
+        yojimbo_assert( connectTokens );
+        yojimbo_assert( numConnectTokens >= 1 );
+        yojimbo_assert( numConnectTokens <= MaxConnectRace );
+        if ( numConnectTokens == 1 )
+        {
+            Connect( clientId, connectTokens );
+            return;
+        }
+        Disconnect();
+        CreateInternal();
+        m_clientId = clientId;
+        if ( !StartConnectRace( connectTokens, numConnectTokens ) )
+        {
+            Disconnect();
+            SetClientState( CLIENT_STATE_ERROR );
+            return;
+        }
+        SetClientState( CLIENT_STATE_CONNECTING );
+        if ( m_config.clientNetworkThread )
+        {
+            StartNetworkThread();
+        }
+    }
+
+    void Client::ConnectTrusted( const uint8_t privateKey[], uint64_t clientId, const Address & serverAddress, const Address & secondaryAddress )
+    {
+        yojimbo_assert( privateKey );
+        yojimbo_assert( serverAddress.IsValid() );
+        Disconnect();
+        CreateInternal();
+        m_clientId = clientId;
+        m_trustedSocket = YOJIMBO_NEW( GetClientAllocator(), Socket, m_address );
+        if ( !m_trustedSocket || m_trustedSocket->IsError() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create trusted network socket\n" );
+            Disconnect();
+            SetClientState( CLIENT_STATE_ERROR );
+            return;
+        }
+        if ( m_config.trustedPathMtuDiscovery && !m_trustedSocket->SetDontFragment() )
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "warning: failed to set don't fragment on trusted network socket\n" );
+        if ( secondaryAddress.IsValid() && m_config.trustedMultipath )
+        {
+            yojimbo_assert( m_config.dropDuplicatePackets );
+            m_trustedSecondarySocket = YOJIMBO_NEW( GetClientAllocator(), Socket, secondaryAddress );
+            if ( !m_trustedSecondarySocket || m_trustedSecondarySocket->IsError() )
+            {
+                // the primary path works without it
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create trusted network secondary socket\n" );
+                YOJIMBO_DELETE( GetClientAllocator(), Socket, m_trustedSecondarySocket );
+            }
+        }
+        m_trustedServerAddress = serverAddress;
+        m_trustedResuming = false;
+        m_trustedSecondaryConnected = false;
+        m_trustedNextPath = 0;
+        m_trustedPathSendTime[0] = m_trustedPathSendTime[1] = 0.0;
+        m_trustedPathReceiveTime[0] = m_trustedPathReceiveTime[1] = GetTime();
+        m_trustedClientIndex = -1;
+        m_trustedDenied = false;
+        m_trustedRemoteDisconnect = false;
+        m_trustedConnectStartTime = GetTime();
+        m_trustedLastPacketReceiveTime = GetTime();
+        m_trustedPathBytes = 0;
+        m_trustedPathSearching = false;
+        const uint64_t protocolId = host_to_network( m_config.protocolId );
+        const uint64_t networkClientId = host_to_network( clientId );
+        m_trustedConnectRequest[0] = TRUSTED_PACKET_CONNECT_REQUEST;
+        memcpy( m_trustedConnectRequest + 1, &protocolId, 8 );
+        memcpy( m_trustedConnectRequest + 1 + 8, &networkClientId, 8 );
+        trusted_connect_auth( privateKey, m_config.protocolId, clientId, m_trustedConnectRequest + 1 + 8 + 8 );
+        SetClientState( CLIENT_STATE_CONNECTING );
+        SendTrustedPacket( TRUSTED_PACKET_CONNECT_REQUEST, m_trustedConnectRequest + 1, TrustedConnectRequestBytes - 1 );
+        if ( m_config.clientNetworkThread )
+        {
+            StartNetworkThread();
+        }
+    }
+
+    void Client::ResumeTrusted()
+    {
+        if ( !m_trustedSocket || !IsConnected() || m_config.trustedResumeTime <= 0.0f || m_trustedResuming )
+            return;
+        m_trustedResuming = true;
+        m_trustedResumeStartTime = GetTime();
+        SendTrustedResumeRequest();
+    }
+
+    void Client::Disconnect()
+    {
+        StopNetworkThread();
+        DestroyTrustedSocket();
+        BaseClient::Disconnect();
+        DestroyClient();
+        if ( m_config.clientReuseConnection )
+            ResetInternal();
+        else
+            DestroyInternal();
+        m_clientId = 0;
+    }
+
+    void Client::SendPackets()
+    {
+        if ( m_networkThread )
+            return;
+        SendPacketsInternal();
+    }
+
+    void Client::SendPacketsInternal()
+    {
+        YOJIMBO_PROFILE_SCOPE( "Client::SendPackets" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Client::SendPackets" );
+        if ( !IsConnected() )
+            return;
+        yojimbo_assert( m_client || m_trustedSocket || IsLoopback() );
+        yojimbo_assert( m_packetBuffer );
+        uint8_t * packetData = m_packetBuffer;
+        const int numPackets = GetNumPacketsToSend();
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            if ( i > 0 && GetConnection().GetNextSendTime() > GetTime() )
+                break;
+            int packetBytes;
+            uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetEndpoint() );
+            if ( !GetConnection().GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
+                break;
+            reliable_endpoint_send_packet( GetEndpoint(), packetData, packetBytes );
+        }
+    }
+
+    void Client::ReceivePackets()
+    {
+        if ( m_networkThread )
+            return;
+        ReceivePacketsInternal();
+    }
+
+    void Client::ReceivePacketsInternal()
+    {
+        YOJIMBO_PROFILE_SCOPE( "Client::ReceivePackets" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Client::ReceivePackets" );
+        if ( m_trustedSocket )
+        {
+            // the connect accepted packet arrives while still connecting
+            ReceiveTrustedPackets();
+            return;
+        }
+        if ( !IsConnected() )
+            return;
+        if ( IsLoopback() )
+        {
+            ReceiveLoopbackPackets();
+            return;
+        }
+        yojimbo_assert( m_client );
+        while ( true )
         {
             int packetBytes;
             uint64_t packetSequence;
@@ -341,25 +1070,52 @@ namespace yojimbo
 
     void Client::AdvanceTime( double time )
     {
-        BaseClient::AdvanceTime( time );
-        if ( m_client )
+        if ( m_networkThread )
         {
-            netcode_client_update( m_client, time );
-            const int state = netcode_client_state( m_client );
-            if ( state < NETCODE_CLIENT_STATE_DISCONNECTED )
+            if ( m_networkThreadDone )
             {
+                // the network thread exited because the client disconnected. keep the state it left behind
+                const ClientState state = GetClientState();
                 Disconnect();
-                SetClientState( CLIENT_STATE_ERROR );
+                SetClientState( state );
             }
-            else if ( state == NETCODE_CLIENT_STATE_DISCONNECTED )
+            return;
+        }
+        ClientState state;
+        if ( !UpdateInternal( time, state ) )
+        {
+            Disconnect();
+            SetClientState( state );
+        }
+    }
+
+    bool Client::UpdateInternal( double time, ClientState & state )
+    {
+        if ( !AdvanceTimeInternal( time ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connection error. disconnecting client\n" );
+            state = CLIENT_STATE_DISCONNECTED;
+            return false;
+        }
+        if ( m_numRaceClients > 0 && !UpdateConnectRace( time, state ) )
+        {
+            return false;
+        }
+        if ( m_client )
+        {
+            netcode_client_update( m_client, time );
+            const int netcodeState = netcode_client_state( m_client );
+            if ( netcodeState < NETCODE_CLIENT_STATE_DISCONNECTED )
             {
-                Disconnect();
-                SetClientState( CLIENT_STATE_DISCONNECTED );
+                state = CLIENT_STATE_ERROR;
+                return false;
             }
-            else
+            else if ( netcodeState == NETCODE_CLIENT_STATE_DISCONNECTED )
             {
-                SetClientState( CLIENT_STATE_CONNECTED );
+                state = CLIENT_STATE_DISCONNECTED;
+                return false;
             }
+            SetClientState( CLIENT_STATE_CONNECTED );
             NetworkSimulator * networkSimulator = GetNetworkSimulator();
             if ( networkSimulator && networkSimulator->IsActive() )
             {
@@ -369,31 +1125,129 @@ namespace yojimbo
                 for ( int i = 0; i < numPackets; ++i )
                 {
                     netcode_client_send_packet( m_client, (uint8_t*) packetData[i], packetBytes[i] );
-                    YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
+                    networkSimulator->ReleasePacket( packetData[i] );
+                }
+            }
+        }
+        else if ( m_trustedSocket )
+        {
+            return UpdateTrusted( time, state );
+        }
+        else if ( IsLoopback() )
+        {
+            NetworkSimulator * networkSimulator = GetNetworkSimulator();
+            if ( networkSimulator && networkSimulator->IsActive() )
+            {
+                uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
+                int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
+                int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, NULL );
+                for ( int i = 0; i < numPackets; ++i )
+                {
+                    SendLoopbackPacket( packetData[i], packetBytes[i] );
+                    networkSimulator->ReleasePacket( packetData[i] );
                 }
             }
         }
+        return true;
+    }
+
+    void Client::StartNetworkThread()
+    {
+        yojimbo_assert( !m_networkThread );
+        yojimbo_assert( m_config.clientNetworkRate > 0.0f );
+        CreateMessageQueues();
+        m_networkThreadQuit = 0;
+        m_networkThreadDone = 0;
+        m_networkThread = yojimbo_thread_create( StaticNetworkThreadFunction, this );
+        if ( !m_networkThread )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create client network thread\n" );
+            DestroyMessageQueues();
+        }
+    }
+
+    void Client::StopNetworkThread()
+    {
+        if ( !m_networkThread )
+            return;
+        m_networkThreadQuit = 1;
+        yojimbo_memory_barrier();
+        yojimbo_thread_join( m_networkThread );
+        m_networkThread = NULL;
+        DestroyMessageQueues();
+    }
+
+    void Client::NetworkThreadFunction()
+    {
+        const double startTime = GetTime();
+        const double startClock = yojimbo_time();
+        const double deltaTime = 1.0 / m_config.clientNetworkRate;
+        double nextTick = startClock;
+        while ( !m_networkThreadQuit )
+        {
+            // the connection creates and releases messages while processing packets, and the message factory isn't thread safe
+            LockMessageFactory();
+            FlushSendMessageQueue();
+            SendPacketsInternal();
+            ReceivePacketsInternal();
+            FillReceiveMessageQueues();
+            ClientState state;
+            const bool ok = UpdateInternal( startTime + ( yojimbo_time_update() - startClock ), state );
+            UnlockMessageFactory();
+            if ( !ok )
+            {
+                // leave the teardown to the game thread. see Client::AdvanceTime
+                SetClientState( state );
+                break;
+            }
+            nextTick += deltaTime;
+            if ( nextTick < yojimbo_time_cached() )
+            {
+                // fell behind. don't try to catch up with a burst of ticks
+                nextTick = yojimbo_time_cached();
+            }
+            yojimbo_sleep_until( nextTick );
+        }
+        yojimbo_memory_barrier();
+        m_networkThreadDone = 1;
+    }
+
+    void Client::StaticNetworkThreadFunction( void * context )
+    {
+        Client * client = (Client*) context;
+        client->NetworkThreadFunction();
     }
 
     int Client::GetClientIndex() const
     {
+        if ( IsLoopback() )
+            return BaseClient::GetClientIndex();
+        if ( m_trustedSocket )
+            return m_trustedClientIndex;
         return m_client ? netcode_client_index( m_client ) : -1;
     }
 
     void Client::CreateClient( const Address & address )
     {
         DestroyClient();
+        m_client = CreateNetcodeClient( address );
+    }
+
+    netcode_client_t * Client::CreateNetcodeClient( const Address & address )
+    {
         char addressString[MaxAddressLength];
         address.ToString( addressString, MaxAddressLength );
-        m_client = netcode_client_create_with_allocator( addressString, GetTime(), &GetClientAllocator(), StaticAllocateFunction, StaticFreeFunction );
-        if ( m_client )
+        netcode_client_t * client = netcode_client_create_with_allocator( addressString, GetTime(), &GetClientAllocator(), StaticAllocateFunction, StaticFreeFunction );
+        if ( client )
         {
-            netcode_client_state_change_callback( m_client, this, StaticStateChangeCallbackFunction );
+            netcode_client_state_change_callback( client, this, StaticStateChangeCallbackFunction );
         }
+        return client;
     }
 
     void Client::DestroyClient()
     {
+        DestroyConnectRace();
         if ( m_client )
         {
             netcode_client_destroy( m_client );
@@ -401,6 +1255,437 @@ namespace yojimbo
         }
     }
 
+    bool Client::StartConnectRace( uint8_t * connectTokens, int numConnectTokens )
+    {
+        yojimbo_assert( !m_client );
+        yojimbo_assert( m_numRaceClients == 0 );
+        for ( int i = 0; i < numConnectTokens; ++i )
+        {
+            // only one socket can bind a fixed client port. the other attempts take an ephemeral port
+            Address address = m_address;
+            if ( i > 0 )
+                address.SetPort( 0 );
+            netcode_client_t * client = CreateNetcodeClient( address );
+            if ( !client )
+                continue;
+            netcode_client_connect( client, connectTokens + size_t( i ) * ConnectTokenBytes );
+            m_raceClients[m_numRaceClients++] = client;
+        }
+        return m_numRaceClients > 0;
+    }
+
+    bool Client::UpdateConnectRace( double time, ClientState & state )
+    {
+        int i = 0;
+        while ( i < m_numRaceClients )
+        {
+            netcode_client_t * client = m_raceClients[i];
+            netcode_client_update( client, time );
+            const int netcodeState = netcode_client_state( client );
+            if ( netcodeState >= NETCODE_CLIENT_STATE_SENDING_CONNECTION_RESPONSE )
+            {
+                // a server answered with a challenge. commit to it and drop the other attempts
+                m_raceClients[i] = m_raceClients[--m_numRaceClients];
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connect race won. dropping %d other attempts\n", m_numRaceClients );
+                DestroyConnectRace();
+                m_client = client;
+                return true;
+            }
+            if ( netcodeState <= NETCODE_CLIENT_STATE_DISCONNECTED )
+            {
+                netcode_client_destroy( client );
+                m_raceClients[i] = m_raceClients[--m_numRaceClients];
+                continue;
+            }
+            ++i;
+        }
+        if ( m_numRaceClients == 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "every connect attempt failed\n" );
+            state = CLIENT_STATE_ERROR;
+            return false;
+        }
+        return true;
+    }
+
+    void Client::DestroyConnectRace()
+    {
+        for ( int i = 0; i < m_numRaceClients; ++i )
+        {
+            netcode_client_destroy( m_raceClients[i] );
+            m_raceClients[i] = NULL;
+        }
+        m_numRaceClients = 0;
+    }
+
+    void Client::SendTrustedPacket( TrustedPacketType type, const uint8_t * packetData, int packetBytes, int path )
+    {
+        yojimbo_assert( m_trustedSocket );
+        yojimbo_assert( packetBytes >= 0 );
+        yojimbo_assert( path == 0 || m_trustedSecondarySocket );
+        if ( TrustedPacketHeaderBytes + packetBytes > TrustedMaxPacketBytes )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: trusted packet too large (%d bytes)\n", packetBytes );
+            return;
+        }
+        const uint8_t header = (uint8_t) type;
+        Socket * socket = path ? m_trustedSecondarySocket : m_trustedSocket;
+        if ( !socket->SendPacket( m_trustedServerAddress, &header, TrustedPacketHeaderBytes, packetData, packetBytes ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to send trusted packet (%d bytes)\n", packetBytes );
+        }
+        m_trustedPathSendTime[path] = GetTime();
+        if ( path == 0 )
+            m_trustedLastPacketSendTime = GetTime();
+    }
+
+    void Client::SendTrustedPayload( const uint8_t * packetData, int packetBytes )
+    {
+        if ( !m_trustedSecondaryConnected )
+        {
+            SendTrustedPacket( TRUSTED_PACKET_PAYLOAD, packetData, packetBytes );
+            return;
+        }
+
+        // urgent data goes over every path that is up. the rest goes over one, preferring the first
+
+        const bool pathUp[2] = { IsTrustedPathUp( 0 ), IsTrustedPathUp( 1 ) };
+
+        if ( GetConnection().IsLastPacketUrgent() && pathUp[0] && pathUp[1] )
+        {
+            SendTrustedPacket( TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, 0 );
+            SendTrustedPacket( TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, 1 );
+            return;
+        }
+
+        int path = ( !pathUp[0] && pathUp[1] ) ? 1 : 0;
+
+        if ( m_config.trustedMultipathBalance && pathUp[0] && pathUp[1] )
+        {
+            path = m_trustedNextPath;
+            m_trustedNextPath = path ^ 1;
+        }
+
+        SendTrustedPacket( TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, path );
+    }
+
+    bool Client::IsTrustedPathUp( int path ) const
+    {
+        if ( path == 1 && !m_trustedSecondaryConnected )
+            return false;
+        return m_trustedPathReceiveTime[path] + TrustedPathTimeout >= GetTime();
+    }
+
+    void Client::ReceiveTrustedPackets()
+    {
+        ReceiveTrustedPackets( 0 );
+        if ( m_trustedSecondarySocket )
+            ReceiveTrustedPackets( 1 );
+    }
+
+    void Client::ReceiveTrustedPackets( int path )
+    {
+        yojimbo_assert( m_trustedSocket );
+        Socket * socket = path ? m_trustedSecondarySocket : m_trustedSocket;
+        while ( true )
+        {
+            Address from;
+            const int packetBytes = socket->ReceivePacket( from, m_trustedReceiveBuffer, TrustedMaxPacketBytes );
+            if ( packetBytes <= 0 )
+                break;
+
+            if ( from != m_trustedServerAddress )
+                continue;
+
+            const uint8_t packetType = m_trustedReceiveBuffer[0];
+
+            if ( packetType == TRUSTED_PACKET_CONNECT_ACCEPTED )
+            {
+                if ( packetBytes != TrustedConnectAcceptedBytes )
+                    continue;
+                if ( path == 1 )
+                {
+                    // the server added the second path to the connection
+                    if ( !IsConnected() )
+                        continue;
+                    m_trustedSecondaryConnected = true;
+                }
+                else
+                {
+                    uint32_t clientIndex;
+                    uint64_t ticket;
+                    memcpy( &clientIndex, m_trustedReceiveBuffer + 1, 4 );
+                    memcpy( &ticket, m_trustedReceiveBuffer + 1 + 4, 8 );
+                    if ( IsConnecting() )
+                    {
+                        m_trustedClientIndex = (int) network_to_host( clientIndex );
+                        SetClientState( CLIENT_STATE_CONNECTED );
+                        StartTrustedPathSearch();
+                    }
+                    else if ( !m_trustedResuming || (int) network_to_host( clientIndex ) != m_trustedClientIndex )
+                    {
+                        continue;
+                    }
+                    else
+                    {
+                        // the server moved the connection to this address, and dropped the secondary path
+                        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted connection resumed\n" );
+                        m_trustedResuming = false;
+                        m_trustedSecondaryConnected = false;
+                        StartTrustedPathSearch();
+                    }
+                    m_trustedResumeTicket = network_to_host( ticket );
+                }
+            }
+            else if ( packetType == TRUSTED_PACKET_CONNECT_DENIED )
+            {
+                if ( IsConnecting() && path == 0 )
+                    m_trustedDenied = true;
+                continue;
+            }
+            else if ( packetType == TRUSTED_PACKET_PAYLOAD )
+            {
+                if ( !IsConnected() || packetBytes <= TrustedPacketHeaderBytes )
+                    continue;
+                reliable_endpoint_receive_packet( GetEndpoint(), m_trustedReceiveBuffer + TrustedPacketHeaderBytes, packetBytes - TrustedPacketHeaderBytes );
+            }
+            else if ( packetType == TRUSTED_PACKET_DISCONNECT )
+            {
+                if ( IsConnected() )
+                    m_trustedRemoteDisconnect = true;
+                continue;
+            }
+            else if ( packetType == TRUSTED_PACKET_PATH_PROBE_ACK )
+            {
+                if ( !m_trustedPathSearching || path != 0 || packetBytes < TrustedPathProbeBytes )
+                    continue;
+                uint16_t probeBytes;
+                memcpy( &probeBytes, m_trustedReceiveBuffer + 1, 2 );
+                probeBytes = network_to_host( probeBytes );
+                // an ack for an earlier probe still narrows the search, as long as it arrived whole
+                if ( probeBytes == packetBytes && probeBytes > m_trustedPathBytes && probeBytes < m_trustedPathFailedBytes )
+                {
+                    SetTrustedPathBytes( probeBytes );
+                    if ( probeBytes == m_trustedPathProbeBytes )
+                        m_trustedPathProbeBytes = 0;
+                }
+            }
+            else if ( packetType != TRUSTED_PACKET_KEEP_ALIVE )
+            {
+                continue;
+            }
+
+            m_trustedLastPacketReceiveTime = GetTime();
+            m_trustedPathReceiveTime[path] = GetTime();
+        }
+    }
+
+    bool Client::UpdateTrusted( double time, ClientState & state )
+    {
+        yojimbo_assert( m_trustedSocket );
+
+        if ( m_trustedDenied )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted connect request denied. server is full\n" );
+            state = CLIENT_STATE_ERROR;
+            return false;
+        }
+
+        if ( m_trustedRemoteDisconnect )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted server disconnected client\n" );
+            state = CLIENT_STATE_DISCONNECTED;
+            return false;
+        }
+
+        if ( IsConnecting() )
+        {
+            if ( m_config.trustedTimeout > 0.0f && m_trustedConnectStartTime + m_config.trustedTimeout < time )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted connect request timed out\n" );
+                state = CLIENT_STATE_ERROR;
+                return false;
+            }
+            if ( m_trustedLastPacketSendTime + TrustedKeepAliveInterval <= time )
+            {
+                SendTrustedPacket( TRUSTED_PACKET_CONNECT_REQUEST, m_trustedConnectRequest + 1, TrustedConnectRequestBytes - 1 );
+            }
+            return true;
+        }
+
+        if ( m_trustedResuming )
+        {
+            if ( m_trustedResumeStartTime + m_config.trustedResumeTime < time )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted resume timed out\n" );
+                state = CLIENT_STATE_DISCONNECTED;
+                return false;
+            }
+            if ( m_trustedResumeRequestTime + TrustedKeepAliveInterval <= time )
+            {
+                SendTrustedResumeRequest();
+            }
+        }
+        else if ( m_config.trustedTimeout > 0.0f && m_trustedLastPacketReceiveTime + m_config.trustedTimeout < time )
+        {
+            if ( m_config.trustedResumeTime > 0.0f )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted connection timed out. resuming\n" );
+                ResumeTrusted();
+            }
+            else
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted connection timed out\n" );
+                state = CLIENT_STATE_DISCONNECTED;
+                return false;
+            }
+        }
+
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
+        {
+            uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
+            int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
+            int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, NULL );
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                SendTrustedPayload( packetData[i], packetBytes[i] );
+                networkSimulator->ReleasePacket( packetData[i] );
+            }
+        }
+
+        if ( m_trustedPathBytes > 0 && !m_trustedResuming )
+        {
+            UpdateTrustedPathSearch( time );
+        }
+
+        if ( m_trustedLastPacketSendTime + TrustedKeepAliveInterval <= time )
+        {
+            SendTrustedPacket( TRUSTED_PACKET_KEEP_ALIVE, NULL, 0 );
+        }
+
+        // the secondary path connects once the primary has. its connect request doubles as keep-alive until accepted
+
+        if ( m_trustedSecondarySocket && m_trustedPathSendTime[1] + TrustedKeepAliveInterval <= time )
+        {
+            if ( m_trustedSecondaryConnected )
+                SendTrustedPacket( TRUSTED_PACKET_KEEP_ALIVE, NULL, 0, 1 );
+            else
+                SendTrustedPacket( TRUSTED_PACKET_CONNECT_REQUEST, m_trustedConnectRequest + 1, TrustedConnectRequestBytes - 1, 1 );
+        }
+
+        return true;
+    }
+
+    void Client::SendTrustedResumeRequest()
+    {
+        uint8_t request[TrustedResumeRequestBytes - 1];
+        const uint64_t protocolId = host_to_network( m_config.protocolId );
+        const uint32_t clientIndex = host_to_network( (uint32_t) m_trustedClientIndex );
+        const uint64_t ticket = host_to_network( m_trustedResumeTicket );
+        memcpy( request, &protocolId, 8 );
+        memcpy( request + 8, &clientIndex, 4 );
+        memcpy( request + 8 + 4, &ticket, 8 );
+        SendTrustedPacket( TRUSTED_PACKET_RESUME_REQUEST, request, TrustedResumeRequestBytes - 1 );
+        m_trustedResumeRequestTime = GetTime();
+    }
+
+    void Client::StartTrustedPathSearch()
+    {
+        if ( !m_config.trustedPathMtuDiscovery )
+            return;
+        SetTrustedPathBytes( TrustedMinPathBytes );
+        m_trustedPathFailedBytes = TrustedMaxPathBytes + 1;
+        m_trustedPathProbeBytes = 0;
+        m_trustedPathProbeAttempts = 0;
+        m_trustedPathSearching = true;
+        m_trustedPathConfirmsLeft = 0;
+    }
+
+    void Client::UpdateTrustedPathSearch( double time )
+    {
+        if ( !m_trustedPathSearching )
+        {
+            if ( m_trustedPathConfirmsLeft > 0 && m_trustedPathProbeTime + TrustedPathProbeTimeout <= time )
+            {
+                SendTrustedPathProbe( TrustedPathProbeBytes );
+                m_trustedPathConfirmsLeft--;
+            }
+            if ( m_trustedPathSearchTime <= time )
+            {
+                // the path may have shrunk as well as grown, so start again from the size every path carries. the first probe tries the largest size, so an unchanged path is confirmed in one round trip
+                StartTrustedPathSearch();
+            }
+            return;
+        }
+
+        if ( m_trustedPathProbeBytes > 0 )
+        {
+            if ( m_trustedPathProbeTime + TrustedPathProbeTimeout > time )
+                return;
+            if ( ++m_trustedPathProbeAttempts >= TrustedPathProbeAttempts )
+            {
+                m_trustedPathFailedBytes = m_trustedPathProbeBytes;
+                m_trustedPathProbeAttempts = 0;
+            }
+            m_trustedPathProbeBytes = 0;
+        }
+
+        if ( m_trustedPathFailedBytes - m_trustedPathBytes <= TrustedPathSearchGranularity )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "trusted path carries %d bytes\n", m_trustedPathBytes );
+            m_trustedPathSearching = false;
+            m_trustedPathConfirmsLeft = TrustedPathProbeAttempts;
+            m_trustedPathSearchTime = time + TrustedPathSearchInterval;
+            return;
+        }
+
+        const int probeBytes = ( m_trustedPathFailedBytes > TrustedMaxPathBytes ) ? TrustedMaxPathBytes : ( m_trustedPathBytes + m_trustedPathFailedBytes ) / 2;
+        SendTrustedPathProbe( probeBytes );
+        m_trustedPathProbeBytes = probeBytes;
+    }
+
+    void Client::SendTrustedPathProbe( int probeBytes )
+    {
+        yojimbo_assert( m_trustedSocket );
+        yojimbo_assert( probeBytes >= TrustedPathProbeBytes );
+        yojimbo_assert( probeBytes <= TrustedMaxPathBytes );
+        uint8_t probe[TrustedMaxPathBytes];
+        memset( probe, 0, probeBytes );
+        probe[0] = TRUSTED_PACKET_PATH_PROBE;
+        const uint16_t pathBytes = host_to_network( (uint16_t) m_trustedPathBytes );
+        memcpy( probe + 1, &pathBytes, 2 );
+        // sent straight to the socket, since a probe too large for the path doesn't count as a keep-alive
+        m_trustedSocket->SendPacket( m_trustedServerAddress, probe, probeBytes );
+        m_trustedPathProbeTime = GetTime();
+    }
+
+    void Client::SetTrustedPathBytes( int pathBytes )
+    {
+        m_trustedPathBytes = pathBytes;
+        GetConnection().SetPathPacketBytes( pathBytes - TrustedPacketHeaderBytes - TrustedReliableHeaderBytes );
+    }
+
+    void Client::DestroyTrustedSocket()
+    {
+        if ( !m_trustedSocket )
+            return;
+        if ( IsConnected() && !m_trustedRemoteDisconnect )
+        {
+            for ( int i = 0; i < TrustedNumDisconnectPackets; ++i )
+            {
+                SendTrustedPacket( TRUSTED_PACKET_DISCONNECT, NULL, 0 );
+            }
+        }
+        YOJIMBO_DELETE( GetClientAllocator(), Socket, m_trustedSocket );
+        YOJIMBO_DELETE( GetClientAllocator(), Socket, m_trustedSecondarySocket );
+        m_trustedSecondaryConnected = false;
+        m_trustedResuming = false;
+        m_trustedClientIndex = -1;
+        m_trustedPathBytes = 0;
+        m_trustedPathSearching = false;
+    }
+
     void Client::StateChangeCallbackFunction( int previous, int current )
     {
         (void) previous;
@@ -415,12 +1700,21 @@ namespace yojimbo
 
     void Client::TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
+        YOJIMBO_PROFILE_SCOPE( "Client::TransmitPacketFunction" );
         (void) packetSequence;
         NetworkSimulator * networkSimulator = GetNetworkSimulator();
         if ( networkSimulator && networkSimulator->IsActive() )
         {
             networkSimulator->SendPacket( 0, packetData, packetBytes );
         }
+        else if ( IsLoopback() )
+        {
+            SendLoopbackPacket( packetData, packetBytes );
+        }
+        else if ( m_trustedSocket )
+        {
+            SendTrustedPayload( packetData, packetBytes );
+        }
         else
         {
             netcode_client_send_packet( m_client, packetData, packetBytes );
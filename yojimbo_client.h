@@ -11,9 +11,13 @@
 #include "yojimbo_adapter.h"
 #include "yojimbo_address.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_socket.h"
+#include "yojimbo_recorder.h"
+#include "yojimbo_histogram.h"
 
 struct netcode_client_t;
 struct reliable_endpoint_t;
+struct reliable_config_t;
 
 /** @file */
 
@@ -21,6 +25,40 @@ namespace yojimbo
 {
     class Connection;
     class NetworkSimulator;
+    class BaseServer;
+    class SharedMemoryLink;
+    struct NetworkLinkConditions;
+    struct ConnectionStats;
+
+    /**
+        Set up a reliable.io endpoint config from the client/server config, for the client endpoint and the endpoint of each server client slot.
+
+        Sets the packet fragmentation and ack buffer sizes. The name, context, packet functions and allocator are left for the caller.
+
+        @param config The client/server config.
+        @param endpointConfig The reliable.io endpoint config (out).
+     */
+
+    void InitializeEndpointConfig( const BaseClientServerConfig & config, reliable_config_t & endpointConfig );
+
+    /**
+        Create the allocator a reliable.io endpoint allocates its packet buffers with, pooling the large ones. See BaseClientServerConfig::packetBufferPoolSize.
+
+        @param allocator The allocator to create it with, and that other endpoint allocations pass through to.
+        @param config The client/server config.
+
+        @returns The endpoint allocator, to destroy with YOJIMBO_DELETE after the endpoint. NULL if packetBufferPoolSize is 0, in which case the endpoint should use the allocator directly.
+     */
+
+    Allocator * CreateEndpointAllocator( Allocator & allocator, const BaseClientServerConfig & config );
+
+    /// A packet waiting in a loopback queue, until the receiving side calls ReceivePackets. See BaseClient::ConnectLoopback.
+
+    struct LoopbackPacket
+    {
+        uint8_t * packetData;                                               ///< Copy of the packet data. Allocated with the allocator of the receiving side.
+        int packetBytes;                                                    ///< Size of the packet (bytes).
+    };
 
     /**
         The set of client states.
@@ -165,6 +203,45 @@ namespace yojimbo
         virtual Message * ReceiveMessage( int channelIndex ) = 0;
 
         virtual void ReleaseMessage( Message * message ) = 0;
+
+        /**
+            Queue messages to be sent to the server on a channel, until the channel can't take any more.
+
+            @param channelIndex The channel to send the messages on.
+            @param messages The messages to send. Create them with CreateMessage.
+            @param numMessages The number of messages.
+
+            @returns The number of messages queued, from the start of the array. The client owns those. The rest still belong to the caller, to send later or release.
+         */
+
+        virtual int SendMessages( int channelIndex, Message ** messages, int numMessages ) = 0;
+
+        /**
+            Receive up to maxMessages messages from the server on a channel, in the order ReceiveMessage would return them.
+
+            @param channelIndex The channel to receive messages on.
+            @param messages The received messages (out). Release them with ReleaseMessages or ReleaseMessage.
+            @param maxMessages The size of the messages array.
+
+            @returns The number of messages received. Less than maxMessages once the channel is drained.
+         */
+
+        virtual int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages ) = 0;
+
+        /**
+            Release messages received from the server.
+
+            @param messages The messages to release.
+            @param numMessages The number of messages.
+         */
+
+        virtual void ReleaseMessages( Message ** messages, int numMessages ) = 0;
+
+        /**
+            Get the part of the next block message received so far on a channel. See Channel::GetReceivedBlockPrefix.
+         */
+
+        virtual bool GetReceivedBlockPrefix( int channelIndex, const uint8_t * & blockData, int & blockBytes ) const = 0;
     };
 
     /**
@@ -216,6 +293,42 @@ namespace yojimbo
 
         void SetDuplicates( float percent );
 
+        /**
+            Set the simulated link conditions for packets sent to the server. See NetworkSimulator::SetLinkConditions.
+
+            @param conditions The link conditions.
+         */
+
+        void SetLinkConditions( const NetworkLinkConditions & conditions );
+
+        /**
+            Record the packets sent to and received from the server. See PacketRecorder.
+
+            @param recorder The packet recorder, or NULL to stop recording. Not owned by the client.
+         */
+
+        void SetPacketRecorder( PacketRecorder * recorder ) { m_packetRecorder = recorder; }
+
+        /**
+            Turn power save mode on or off.
+
+            In power save mode, the client sends packets in bursts of up to BaseClientServerConfig::clientPowerSaveBurstPackets, once every BaseClientServerConfig::clientPowerSaveInterval, instead of every time SendPackets is called. Messages and acks wait for the next burst, so the cellular radio of a mobile device can idle in between and fewer packet headers are sent. Data on channels with ChannelConfig::urgent set starts a burst straight away.
+
+            Turn it on eg. while the game is paused, in a menu, or in the background. netcode.io still sends its own keep-alive packets while no packets are sent.
+
+            @param powerSave True to turn power save mode on.
+         */
+
+        void SetPowerSave( bool powerSave );
+
+        /**
+            Is the client in power save mode?
+
+            @returns True if power save mode is on. See BaseClient::SetPowerSave.
+         */
+
+        bool IsPowerSave() const { return m_powerSave; }
+
         Message * CreateMessage( int type );
 
         uint8_t * AllocateBlock( int bytes );
@@ -226,12 +339,137 @@ namespace yojimbo
 
         bool CanSendMessage( int channelIndex ) const;
 
+        /**
+            Is the client connection low on memory?
+
+            @returns True if the connection is above ConnectionConfig::memoryWatermark. CanSendMessage returns false while this is true.
+
+            @see Adapter::OnConnectionMemoryLow
+         */
+
+        bool IsMemoryLow() const;
+
+        /**
+            Get the channels that may have received messages waiting, so only those need ReceiveMessage calls.
+
+            @returns Bit n is set if channel n may have messages waiting. See Connection::GetChannelsWithMessages.
+         */
+
+        uint64_t GetChannelsWithMessages() const;
+
         void SendMessage( int channelIndex, Message * message );
 
         Message * ReceiveMessage( int channelIndex );
 
         void ReleaseMessage( Message * message );
 
+        int SendMessages( int channelIndex, Message ** messages, int numMessages );
+
+        int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages );
+
+        void ReleaseMessages( Message ** messages, int numMessages );
+
+        bool GetReceivedBlockPrefix( int channelIndex, const uint8_t * & blockData, int & blockBytes ) const;
+
+        /**
+            Get statistics for the client allocator. Use the peak to tune BaseClientServerConfig::clientMemory.
+
+            @param stats The allocator statistics (out). All zero if the client allocator has not been created, ie. when disconnected.
+         */
+
+        void GetAllocatorStats( AllocatorStats & stats ) const;
+
+        /**
+            Get network stats for the connection to the server: RTT, packet loss, bandwidth, and the counters and queue depths of each channel.
+
+            This is cheap enough to call every tick. When the client has a network thread, the stats are read while the network thread updates them, so they may be a tick out of date.
+
+            @param stats The connection stats (out). All zero if the client is not connecting or connected.
+         */
+
+        void GetConnectionStats( ConnectionStats & stats ) const;
+
+        /**
+            Get a latency histogram of a channel on the connection to the server. See ChannelConfig::latencyHistograms.
+
+            When the client has a network thread, the histogram is copied while the network thread records into it, so it may be a tick out of date.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param index The histogram to get. See ChannelLatencyHistograms.
+            @param histogram The histogram (out). Empty if the channel keeps no histograms.
+
+            @returns True if the channel keeps latency histograms.
+         */
+
+        bool GetLatencyHistogram( int channelIndex, int index, LatencyHistogram & histogram ) const;
+
+        /**
+            Change the limits a channel runs with on the connection to the server, without reconnecting. See Connection::SetChannelLimits.
+
+            The limits go back to the ChannelConfig on each new connection.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param limits The new limits. See ChannelLimits.
+
+            @returns True if the limits were changed. False if the client is not connecting or connected, or has a network thread, which owns the connection.
+         */
+
+        bool SetChannelLimits( int channelIndex, const ChannelLimits & limits );
+
+        /**
+            Get the limits a channel runs with on the connection to the server.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param limits The limits (out). The ChannelConfig limits if the client is not connecting or connected.
+         */
+
+        void GetChannelLimits( int channelIndex, ChannelLimits & limits ) const;
+
+        /**
+            Connect to a server running in the same process.
+
+            Packets are exchanged through in-memory queues instead of sockets, and skip netcode.io entirely: there is no connect token and no encryption. The network simulator still applies if it is enabled, so latency and packet loss can be simulated without sockets. Use this for the local player on a listen server, and for tests and benchmarks that run on a virtual clock.
+
+            The client is connected as soon as this returns. The server puts loopback clients in the highest free client slot, to stay out of the way of clients connecting over the network, which fill slots from the bottom.
+
+            @param server The server to connect to. It must be running, and must outlive the connection.
+
+            @returns True if the client is connected. False if the server has no free client slots.
+         */
+
+        bool ConnectLoopback( BaseServer & server );
+
+        /**
+            Connect to a server in another process on the same host, through a shared memory link it opened with BaseServer::ConnectSharedMemoryClient.
+
+            Like ConnectLoopback, there is no connect token and no encryption, and the client is connected as soon as this returns. The client goes to disconnected once the server closes the link, or nothing arrives from it for BaseClientServerConfig::sharedMemoryTimeout seconds.
+
+            @param path The path the server opened the link on.
+
+            @returns True if the client is connected. False if there is no open link at the path, or another client already opened it.
+         */
+
+        bool ConnectSharedMemory( const char * path );
+
+        /**
+            Is the client connected without netcode.io, to a server in the same process or on the same host?
+
+            @returns True if the client is connected with BaseClient::ConnectLoopback or BaseClient::ConnectSharedMemory.
+         */
+
+        bool IsLoopback() const { return m_loopbackServer != NULL || m_sharedMemoryLink != NULL; }
+
+        /**
+            Queue a packet sent by the loopback server. It is processed on the next call to ReceivePackets.
+
+            This is called by BaseServer. You should not need to call it yourself.
+
+            @param packetData The packet data. Copied into the queue.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void QueueLoopbackPacket( const uint8_t * packetData, int packetBytes );
+
     protected:
 
         void * GetContext() { return m_context; }
@@ -240,8 +478,18 @@ namespace yojimbo
 
         void DestroyInternal();
 
+        /**
+            Reset the connection, reliable.io endpoint and network simulator in place, so the next connect reuses them. See BaseClientServerConfig::clientReuseConnection.
+         */
+
+        void ResetInternal();
+
+        void DestroyLoopbackPackets();
+
         void SetClientState( ClientState clientState );
 
+        Allocator & GetAllocator() { yojimbo_assert( m_allocator ); return *m_allocator; }
+
         Allocator & GetClientAllocator() { yojimbo_assert( m_clientAllocator ); return *m_clientAllocator; }
 
         MessageFactory & GetMessageFactory() { yojimbo_assert( m_messageFactory ); return *m_messageFactory; }
@@ -252,6 +500,64 @@ namespace yojimbo
 
         Connection & GetConnection() { yojimbo_assert( m_connection ); return *m_connection; }
 
+        void SendLoopbackPacket( const uint8_t * packetData, int packetBytes );
+
+        void ReceiveLoopbackPackets();
+
+        /**
+            Advance time for the connection, the reliable endpoint and the network simulator. AdvanceTime calls this, then disconnects on error.
+
+            @param time The current time in seconds.
+
+            @returns False if the connection is in an error state and the client should disconnect.
+         */
+
+        bool AdvanceTimeInternal( double time );
+
+        /**
+            Get the number of packets to send now. In power save mode, this is zero between bursts.
+
+            @returns The most packets to send now. Packets after the first should only be sent while the connection has data to send.
+         */
+
+        int GetNumPacketsToSend();
+
+        /**
+            Create the queues that pass messages between the game thread and the network thread. See BaseClientServerConfig::clientNetworkThread.
+
+            While the queues exist, SendMessage and ReceiveMessage go through the queues, instead of the connection.
+         */
+
+        void CreateMessageQueues();
+
+        /**
+            Destroy the message queues and release any messages still in them. Make sure the network thread has stopped.
+         */
+
+        void DestroyMessageQueues();
+
+        bool HasMessageQueues() const { return m_sendMessageQueue != NULL; }
+
+        /**
+            Pass messages queued by the game thread to the connection. Called on the network thread.
+         */
+
+        void FlushSendMessageQueue();
+
+        /**
+            Pass messages received by the connection to the game thread. Called on the network thread.
+         */
+
+        void FillReceiveMessageQueues();
+
+        /**
+            Lock the message factory. The network thread holds this while processing, because the message factory is not thread safe.
+         */
+
+        void LockMessageFactory();
+
+        void UnlockMessageFactory();
+
         virtual void TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
 
         virtual int ProcessPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
@@ -270,15 +576,36 @@ namespace yojimbo
         Allocator * m_allocator;                                            ///< The allocator passed to the client on creation.
         Adapter * m_adapter;                                                ///< The adapter specifies the allocator to use, and the message factory class.
         void * m_context;                                                   ///< Context lets the user pass information to packet serialize functions.
-        uint8_t * m_clientMemory;                                           ///< The memory backing the client allocator. Allocated from m_allocator.
+        uint8_t * m_clientMemory;                                           ///< The memory backing the client allocator. Allocated from m_allocator. NULL when clientSharedMemory is true.
         Allocator * m_clientAllocator;                                      ///< The client allocator. Everything allocated between connect and disconnected is allocated and freed via this allocator.
         reliable_endpoint_t * m_endpoint;                                   ///< reliable.io endpoint.
+        Allocator * m_endpointAllocator;                                    ///< Pools the large packet buffers of the reliable.io endpoint. NULL unless BaseClientServerConfig::packetBufferPoolSize is set.
         MessageFactory * m_messageFactory;                                  ///< The client message factory. Created and destroyed on each connection attempt.
         Connection * m_connection;                                          ///< The client connection for exchanging messages with the server.
         NetworkSimulator * m_networkSimulator;                              ///< The network simulator used to simulate packet loss, latency, jitter etc. Optional. 
+        PacketRecorder * m_packetRecorder;                                  ///< Records packets sent and received. Optional. See BaseClient::SetPacketRecorder.
         ClientState m_clientState;                                          ///< The current client state. See ClientInterface::GetClientState
         int m_clientIndex;                                                  ///< The client slot index on the server [0,maxClients-1]. -1 if not connected.
         double m_time;                                                      ///< The current client time. See ClientInterface::AdvanceTime
+        bool m_powerSave;                                                   ///< True while the client is in power save mode. See BaseClient::SetPowerSave.
+        double m_nextPowerSaveSendTime;                                     ///< Time of the next power save burst.
+        BaseServer * m_loopbackServer;                                      ///< The server in the same process this client is connected to. NULL unless connected with BaseClient::ConnectLoopback.
+        Queue<LoopbackPacket> * m_loopbackPackets;                          ///< Packets from the loopback server, waiting for ReceivePackets. Allocated with the client allocator.
+        SharedMemoryLink * m_sharedMemoryLink;                              ///< The link to a server in another process. NULL unless connected with BaseClient::ConnectSharedMemory. Allocated with the client allocator.
+        double m_sharedMemoryReceiveTime;                                   ///< Time a packet was last received over the shared memory link, or the time it was opened.
+        Allocator * m_clientParentAllocator;                                ///< The allocator wrapped by the thread safe client allocator, when clientNetworkThread is true. NULL otherwise.
+
+        /// A message sent by the game thread, waiting for the network thread.
+
+        struct QueuedMessage
+        {
+            int channelIndex;                                               ///< The channel to send the message on.
+            Message * message;                                              ///< The message.
+        };
+
+        SPSCQueue<QueuedMessage> * m_sendMessageQueue;                      ///< Messages sent by the game thread, waiting for the network thread. NULL unless the client has a network thread.
+        SPSCQueue<Message*> ** m_receiveMessageQueues;                      ///< Per-channel messages received by the network thread, waiting for the game thread.
+        volatile int m_messageFactoryLock;                                  ///< Spin lock for the message factory while there is a network thread. 1 while locked, 0 otherwise.
 
     private:
 
@@ -314,6 +641,53 @@ namespace yojimbo
 
         void Connect( uint64_t clientId, uint8_t * connectToken );
 
+        /**
+            Connect with several connect tokens at once, eg. one for each server the matcher offers, and keep whichever server answers first. See BaseClientServerConfig::clientConnectRace.
+
+            @param clientId The client id.
+            @param connectTokens The connect token data, ConnectTokenBytes for each token.
+            @param numConnectTokens The number of connect tokens, in [1,MaxConnectRace].
+         */
+
+        void Connect( uint64_t clientId, uint8_t * connectTokens, int numConnectTokens );
+
+        /**
+            Connect to a server running in the trusted network mode. See BaseClientServerConfig::trustedNetwork.
+
+            Packets go over a plain UDP socket without encryption, so only use this between machines on a network you trust, like servers in the same datacenter.
+
+            @param privateKey The private key shared with the server. Used once, to authenticate the connect request.
+            @param clientId The client id. Must be unique across clients connected to the server.
+            @param serverAddress The address of the server.
+            @param secondaryAddress With BaseClientServerConfig::trustedMultipath, the address of a second local interface to also connect over once connected, eg. cellular alongside wifi. The port may be 0. Leave invalid to connect over one path.
+         */
+
+        void ConnectTrusted( const uint8_t privateKey[], uint64_t clientId, const Address & serverAddress, const Address & secondaryAddress = Address() );
+
+        /**
+            Resume a trusted connection with the ticket the server sent when it accepted the connection. See BaseClientServerConfig::trustedResumeTime.
+
+            The client does this by itself when the connection times out. Call it as soon as the operating system reports a network change, eg. wifi to cellular, so the server learns the new address in one round trip. The client stays connected while resuming, and disconnects if the server doesn't answer within trustedResumeTime, or refuses the ticket.
+         */
+
+        void ResumeTrusted();
+
+        /**
+            Is the client resuming its trusted connection?
+
+            @returns True between ResumeTrusted and the server accepting the resume request.
+         */
+
+        bool IsResumingTrusted() const { return m_trustedResuming; }
+
+        /**
+            Get the largest packet the path to the server carries without fragmentation. See BaseClientServerConfig::trustedPathMtuDiscovery.
+
+            @returns The largest UDP payload confirmed (bytes). TrustedMinPathBytes until path MTU discovery confirms more. 0 if the client isn't connected in the trusted network mode, or path MTU discovery is off.
+         */
+
+        int GetTrustedPathBytes() const { return m_trustedPathBytes; }
+
         void Disconnect();
 
         void SendPackets();
@@ -324,14 +698,156 @@ namespace yojimbo
 
         int GetClientIndex() const;
 
+        /**
+            Generate a batch of insecure connect tokens, one for each client id.
+
+            This is for load generators that connect many clients at once. The server addresses are converted once for the whole batch, instead of once per token.
+
+            @param connectTokens The connect token data to fill, ConnectTokenBytes for each client id [out].
+            @param privateKey The private key shared with the dedicated servers.
+            @param clientIds The array of client ids to generate connect tokens for.
+            @param numClients The number of client ids in the array.
+            @param serverAddresses The list of server addresses that the tokens allow connecting to.
+            @param numServerAddresses The number of server addresses in the list.
+            @param timeout The connect token timeout in seconds.
+
+            @returns True if all connect tokens were generated successfully.
+         */
+
+        bool GenerateInsecureConnectTokens( uint8_t * connectTokens, const uint8_t privateKey[], const uint64_t clientIds[], int numClients, const Address serverAddresses[], int numServerAddresses, int timeout = 45 );
+
     private:
 
         bool GenerateInsecureConnectToken( uint8_t * connectToken, const uint8_t privateKey[], uint64_t clientId, const Address serverAddresses[], int numServerAddresses, int timeout = 45 );
 
+        void SendPacketsInternal();
+
+        void ReceivePacketsInternal();
+
+        /**
+            Advance client time and update the netcode.io client, without disconnecting. Shared by AdvanceTime and the network thread.
+
+            @param time The current time in seconds.
+            @param state The state the client should be left in after disconnecting [out]. Only set when returning false.
+
+            @returns False if the client should disconnect.
+         */
+
+        bool UpdateInternal( double time, ClientState & state );
+
+        /**
+            Start the network thread. From here on it sends and receives packets, and SendMessage and ReceiveMessage go through the message queues.
+         */
+
+        void StartNetworkThread();
+
+        /**
+            Stop the network thread, wait for it to exit, then destroy the message queues.
+         */
+
+        void StopNetworkThread();
+
+        void NetworkThreadFunction();
+
+        static void StaticNetworkThreadFunction( void * context );
+
         void CreateClient( const Address & address );
 
+        netcode_client_t * CreateNetcodeClient( const Address & address );
+
         void DestroyClient();
 
+        /**
+            Start a netcode.io client for each connect token, each on its own socket. See BaseClientServerConfig::clientConnectRace.
+
+            @param connectTokens The connect token data, ConnectTokenBytes for each token.
+            @param numConnectTokens The number of connect tokens, in [1,MaxConnectRace].
+
+            @returns True if at least one client started.
+         */
+
+        bool StartConnectRace( uint8_t * connectTokens, int numConnectTokens );
+
+        /**
+            Update the clients racing to connect, and keep the first one a server answered as the netcode.io client.
+
+            @param time The current time in seconds.
+            @param state The state the client should be left in after disconnecting [out]. Only set when returning false.
+
+            @returns False if every attempt failed.
+         */
+
+        bool UpdateConnectRace( double time, ClientState & state );
+
+        void DestroyConnectRace();
+
+        /**
+            Send a packet to the server over the trusted network socket.
+
+            @param type The packet type.
+            @param packetData The packet data after the type byte. May be NULL if packetBytes is 0.
+            @param packetBytes The size of the packet data (bytes).
+            @param path The path to send over: 0 for the primary socket, 1 for the secondary socket.
+         */
+
+        void SendTrustedPacket( TrustedPacketType type, const uint8_t * packetData, int packetBytes, int path = 0 );
+
+        /**
+            Send a reliable.io packet to the server, over one or both paths. See BaseClientServerConfig::trustedMultipath.
+
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void SendTrustedPayload( const uint8_t * packetData, int packetBytes );
+
+        bool IsTrustedPathUp( int path ) const;
+
+        void ReceiveTrustedPackets();
+
+        void ReceiveTrustedPackets( int path );
+
+        void SendTrustedResumeRequest();
+
+        /**
+            Start a path MTU search from the size every path carries. Packets are kept within TrustedMinPathBytes until the search confirms more. See BaseClientServerConfig::trustedPathMtuDiscovery.
+         */
+
+        void StartTrustedPathSearch();
+
+        /**
+            Send the next path probe, count lost probes and finish the search once the largest size that fits is narrowed down to TrustedPathSearchGranularity.
+
+            The first probe tries TrustedMaxPathBytes, since most paths carry a full ethernet MTU. After that it is a binary search between the largest size acked and the smallest size lost TrustedPathProbeAttempts times in a row.
+
+            @param time The current time in seconds.
+         */
+
+        void UpdateTrustedPathSearch( double time );
+
+        /**
+            Send a path probe to the server, carrying the size confirmed so far.
+
+            @param probeBytes The size to pad the probe to (bytes), or TrustedPathProbeBytes for an unpadded probe that only tells the server the confirmed size.
+         */
+
+        void SendTrustedPathProbe( int probeBytes );
+
+        void SetTrustedPathBytes( int pathBytes );
+
+        /**
+            Resend the connect request, send keep-alives and check for timeouts in the trusted network mode.
+
+            @param time The current time in seconds.
+            @param state The state the client should be left in after disconnecting [out]. Only set when returning false.
+
+            @returns False if the client should disconnect.
+         */
+
+        bool UpdateTrusted( double time, ClientState & state );
+
+        void DestroyTrustedSocket();
+
         void StateChangeCallbackFunction( int previous, int current );
 
         static void StaticStateChangeCallbackFunction( void * context, int previous, int current );
@@ -342,8 +858,42 @@ namespace yojimbo
 
         ClientServerConfig m_config;                                        ///< Client/server configuration.
         netcode_client_t * m_client;                                        ///< netcode.io client data.
+        netcode_client_t * m_raceClients[MaxConnectRace];                   ///< The netcode.io clients racing to connect. The winner becomes m_client. See BaseClientServerConfig::clientConnectRace.
+        int m_numRaceClients;                                               ///< Number of clients still racing to connect. 0 when not racing.
         Address m_address;                                                  ///< The client address.
         uint64_t m_clientId;                                                ///< The globally unique client id (set on each call to connect)
+        uint8_t * m_packetBufferMemory;                                     ///< Raw allocation backing the packet buffer. Allocated in the constructor with the allocator passed to the client.
+        uint8_t * m_packetBuffer;                                           ///< Cache line aligned scratch buffer packets are generated into by SendPackets. Avoids allocating maxPacketSize on the stack each tick.
+        yojimbo_thread_t * m_networkThread;                                 ///< The network thread, when clientNetworkThread is true and the client is connecting or connected. NULL otherwise.
+        volatile int m_networkThreadQuit;                                   ///< Set to 1 to ask the network thread to exit, or by the network thread when the client disconnects.
+        volatile int m_networkThreadDone;                                   ///< Set to 1 by the network thread when it exits by itself. The next call to AdvanceTime cleans up.
+        Socket * m_trustedSocket;                                           ///< The plain UDP socket used instead of the netcode.io client after ConnectTrusted. NULL otherwise.
+        Socket * m_trustedSecondarySocket;                                  ///< The socket bound to the secondary address passed in to ConnectTrusted. NULL if there is none.
+        bool m_trustedSecondaryConnected;                                   ///< Set when the server accepted the connect request sent over the secondary socket.
+        int m_trustedNextPath;                                              ///< The path the next packet without urgent data goes over. See BaseClientServerConfig::trustedMultipathBalance.
+        double m_trustedPathSendTime[2];                                    ///< The last time a packet was sent over each path.
+        double m_trustedPathReceiveTime[2];                                 ///< The last time a packet was received over each path.
+        Address m_trustedServerAddress;                                     ///< The address of the server passed in to ConnectTrusted.
+        int m_trustedClientIndex;                                           ///< The client index sent by the server in the trusted connect accepted packet. -1 until then.
+        bool m_trustedDenied;                                               ///< Set when the server denied the trusted connect request because it is full.
+        bool m_trustedRemoteDisconnect;                                     ///< Set when the server sent a trusted disconnect packet.
+        double m_trustedConnectStartTime;                                   ///< The time ConnectTrusted was called. Used for the connect timeout.
+        double m_trustedLastPacketSendTime;                                 ///< The last time a packet was sent to the server in the trusted network mode.
+        double m_trustedLastPacketReceiveTime;                              ///< The last time a packet was received from the server in the trusted network mode.
+        uint8_t m_trustedConnectRequest[TrustedConnectRequestBytes];        ///< The trusted connect request, resent until the server accepts it.
+        uint64_t m_trustedResumeTicket;                                     ///< The ticket sent by the server in the last connect accepted packet. See BaseClientServerConfig::trustedResumeTime.
+        bool m_trustedResuming;                                             ///< True while resuming the trusted connection. See ResumeTrusted.
+        double m_trustedResumeStartTime;                                    ///< The time the client started resuming.
+        double m_trustedResumeRequestTime;                                  ///< The last time a resume request was sent.
+        int m_trustedPathBytes;                                             ///< Largest UDP payload confirmed to cross the path to the server whole (bytes). 0 unless path MTU discovery is on. See BaseClientServerConfig::trustedPathMtuDiscovery.
+        int m_trustedPathFailedBytes;                                       ///< Smallest probe size lost TrustedPathProbeAttempts times in a row in the current search (bytes). TrustedMaxPathBytes + 1 until one is.
+        int m_trustedPathProbeBytes;                                        ///< Size of the probe waiting for an ack (bytes). 0 if none.
+        int m_trustedPathProbeAttempts;                                     ///< Number of probes of the current size lost so far.
+        double m_trustedPathProbeTime;                                      ///< Time the last probe was sent.
+        bool m_trustedPathSearching;                                        ///< True while a path MTU search is running.
+        int m_trustedPathConfirmsLeft;                                      ///< Unpadded probes left to send, telling the server the size the last search found.
+        double m_trustedPathSearchTime;                                     ///< Time the next path MTU search starts.
+        uint8_t m_trustedReceiveBuffer[TrustedMaxPacketBytes];              ///< Scratch buffer trusted packets are received into.
     };
 }
 
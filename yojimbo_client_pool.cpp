@@ -0,0 +1,186 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_client_pool.h"
+
+namespace yojimbo
+{
+    ClientPool::ClientPool( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, int numClients, double time, int poolMemory, bool parallel )
+    {
+        yojimbo_assert( numClients > 0 );
+        yojimbo_assert( poolMemory >= 0 );
+        m_allocator = &allocator;
+        m_adapter = &adapter;
+        m_parallel = parallel;
+        m_poolMemory = NULL;
+        m_poolAllocator = NULL;
+        m_threadSafeAllocator = NULL;
+        m_clientAllocator = &allocator;
+        m_numClients = numClients;
+        m_time = time;
+        if ( poolMemory > 0 )
+        {
+            m_poolMemory = (uint8_t*) YOJIMBO_ALLOCATE( allocator, poolMemory );
+            m_poolAllocator = adapter.CreateAllocator( allocator, m_poolMemory, poolMemory );
+            yojimbo_assert( m_poolAllocator );
+            m_clientAllocator = m_poolAllocator;
+        }
+        if ( parallel )
+        {
+            // Clients connecting and disconnecting inside the parallel updates allocate from the shared allocator at the same time.
+            m_threadSafeAllocator = YOJIMBO_NEW( allocator, ThreadSafeAllocator, *m_clientAllocator );
+            m_clientAllocator = m_threadSafeAllocator;
+        }
+        m_clients = (Client**) YOJIMBO_ALLOCATE( allocator, sizeof( Client* ) * numClients );
+        yojimbo_assert( m_clients );
+        for ( int i = 0; i < numClients; ++i )
+        {
+            m_clients[i] = YOJIMBO_NEW( allocator, Client, *m_clientAllocator, address, config, adapter, time );
+        }
+    }
+
+    ClientPool::~ClientPool()
+    {
+        Disconnect();
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            YOJIMBO_DELETE( *m_allocator, Client, m_clients[i] );
+        }
+        YOJIMBO_FREE( *m_allocator, m_clients );
+        YOJIMBO_DELETE( *m_allocator, Allocator, m_threadSafeAllocator );
+        YOJIMBO_DELETE( *m_allocator, Allocator, m_poolAllocator );
+        YOJIMBO_FREE( *m_allocator, m_poolMemory );
+        m_clientAllocator = NULL;
+        m_numClients = 0;
+    }
+
+    void ClientPool::InsecureConnect( const uint8_t privateKey[], uint64_t firstClientId, const Address serverAddresses[], int numServerAddresses )
+    {
+        uint64_t * clientIds = (uint64_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint64_t ) * m_numClients );
+        uint8_t * connectTokens = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, size_t( ConnectTokenBytes ) * m_numClients );
+        if ( !clientIds || !connectTokens )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate connect tokens for %d clients\n", m_numClients );
+        }
+        else
+        {
+            for ( int i = 0; i < m_numClients; ++i )
+            {
+                clientIds[i] = firstClientId + i;
+            }
+            if ( m_clients[0]->GenerateInsecureConnectTokens( connectTokens, privateKey, clientIds, m_numClients, serverAddresses, numServerAddresses ) )
+            {
+                Connect( clientIds, connectTokens );
+            }
+            else
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to generate insecure connect tokens\n" );
+            }
+        }
+        YOJIMBO_FREE( *m_allocator, clientIds );
+        YOJIMBO_FREE( *m_allocator, connectTokens );
+    }
+
+    void ClientPool::Connect( const uint64_t clientIds[], uint8_t * connectTokens )
+    {
+        yojimbo_assert( clientIds );
+        yojimbo_assert( connectTokens );
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            m_clients[i]->Connect( clientIds[i], connectTokens + size_t( i ) * ConnectTokenBytes );
+        }
+    }
+
+    void ClientPool::Disconnect()
+    {
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            m_clients[i]->Disconnect();
+        }
+    }
+
+    void ClientPool::SendPackets()
+    {
+        if ( m_parallel )
+        {
+            m_adapter->ParallelFor( m_numClients, StaticSendPacketsFunction, this );
+            return;
+        }
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            m_clients[i]->SendPackets();
+        }
+    }
+
+    void ClientPool::ReceivePackets()
+    {
+        if ( m_parallel )
+        {
+            m_adapter->ParallelFor( m_numClients, StaticReceivePacketsFunction, this );
+            return;
+        }
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            m_clients[i]->ReceivePackets();
+        }
+    }
+
+    void ClientPool::AdvanceTime( double time )
+    {
+        m_time = time;
+        if ( m_parallel )
+        {
+            m_adapter->ParallelFor( m_numClients, StaticAdvanceTimeFunction, this );
+            return;
+        }
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            m_clients[i]->AdvanceTime( time );
+        }
+    }
+
+    int ClientPool::GetNumConnectedClients() const
+    {
+        int numConnectedClients = 0;
+        for ( int i = 0; i < m_numClients; ++i )
+        {
+            if ( m_clients[i]->IsConnected() )
+                numConnectedClients++;
+        }
+        return numConnectedClients;
+    }
+
+    void ClientPool::GetAllocatorStats( AllocatorStats & stats ) const
+    {
+        stats = AllocatorStats();
+        m_clientAllocator->GetStats( stats );
+    }
+
+    void ClientPool::StaticSendPacketsFunction( void * context, int index )
+    {
+        ClientPool * pool = (ClientPool*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < pool->m_numClients );
+        pool->m_clients[index]->SendPackets();
+    }
+
+    void ClientPool::StaticReceivePacketsFunction( void * context, int index )
+    {
+        ClientPool * pool = (ClientPool*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < pool->m_numClients );
+        pool->m_clients[index]->ReceivePackets();
+    }
+
+    void ClientPool::StaticAdvanceTimeFunction( void * context, int index )
+    {
+        ClientPool * pool = (ClientPool*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < pool->m_numClients );
+        pool->m_clients[index]->AdvanceTime( pool->m_time );
+    }
+}
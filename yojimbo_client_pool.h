@@ -0,0 +1,158 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_CLIENT_POOL_H
+#define YOJIMBO_CLIENT_POOL_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_adapter.h"
+#include "yojimbo_address.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_client.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Runs many clients in one process. This is for load testing, where one box simulates thousands of players.
+
+        The clients share one memory pool, and are driven together by batched SendPackets, ReceivePackets and AdvanceTime calls, which optionally run in parallel across clients via Adapter::ParallelFor.
+
+        Set BaseClientServerConfig::clientSharedMemory so each client allocates from the pool on demand, instead of reserving clientMemory up-front. Each client still binds its own socket, because netcode.io owns the socket of each client.
+     */
+
+    class ClientPool
+    {
+    public:
+
+        /**
+            The client pool constructor.
+
+            @param allocator The allocator for the pool and the clients. Used for everything if poolMemory is 0.
+            @param address The address the clients should bind to. Use port 0, so each client binds to a port picked by the operating system.
+            @param config The client/server configuration, shared by all clients.
+            @param adapter The adapter, shared by all clients. Also runs the parallel updates, when parallel is true.
+            @param numClients The number of clients in the pool.
+            @param time The current time in seconds.
+            @param poolMemory The size of the memory pool shared by the clients (bytes). Set to 0 to allocate directly from the allocator passed in.
+            @param parallel If true, SendPackets, ReceivePackets and AdvanceTime update the clients in parallel via Adapter::ParallelFor. The shared memory pool is made thread safe.
+         */
+
+        ClientPool( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, int numClients, double time, int poolMemory = 0, bool parallel = false );
+
+        /**
+            The client pool destructor. Disconnects any clients that are still connected.
+         */
+
+        ~ClientPool();
+
+        /**
+            Connect all clients with insecure connect tokens generated in one batch. See Client::GenerateInsecureConnectTokens.
+
+            @param privateKey The private key shared with the dedicated servers.
+            @param firstClientId The client id of the first client. Each client after it gets the next client id.
+            @param serverAddresses The list of server addresses to connect to.
+            @param numServerAddresses The number of server addresses in the list.
+         */
+
+        void InsecureConnect( const uint8_t privateKey[], uint64_t firstClientId, const Address serverAddresses[], int numServerAddresses );
+
+        /**
+            Connect all clients with connect tokens fetched in advance, eg. with Matcher::RequestMatches.
+
+            @param clientIds The client id for each client.
+            @param connectTokens The connect token data, ConnectTokenBytes for each client.
+         */
+
+        void Connect( const uint64_t clientIds[], uint8_t * connectTokens );
+
+        /**
+            Disconnect all clients.
+         */
+
+        void Disconnect();
+
+        /**
+            Send packets for all clients.
+         */
+
+        void SendPackets();
+
+        /**
+            Receive packets for all clients.
+         */
+
+        void ReceivePackets();
+
+        /**
+            Advance time for all clients.
+
+            @param time The current time in seconds.
+         */
+
+        void AdvanceTime( double time );
+
+        /**
+            Get the number of clients in the pool.
+
+            @returns The number of clients passed in to the constructor.
+         */
+
+        int GetNumClients() const { return m_numClients; }
+
+        /**
+            Get a client in the pool, eg. to send and receive messages.
+
+            @param index The index of the client in [0,numClients-1].
+
+            @returns The client.
+         */
+
+        Client & GetClient( int index ) { yojimbo_assert( index >= 0 ); yojimbo_assert( index < m_numClients ); return *m_clients[index]; }
+
+        /**
+            Get the number of clients that are connected.
+
+            @returns The number of connected clients in [0,numClients].
+         */
+
+        int GetNumConnectedClients() const;
+
+        /**
+            Get statistics for the memory pool shared by the clients. Use the peak to tune the pool size.
+
+            @param stats The allocator statistics (out).
+         */
+
+        void GetAllocatorStats( AllocatorStats & stats ) const;
+
+    private:
+
+        static void StaticSendPacketsFunction( void * context, int index );
+
+        static void StaticReceivePacketsFunction( void * context, int index );
+
+        static void StaticAdvanceTimeFunction( void * context, int index );
+
+        ClientPool( const ClientPool & other );
+
+        const ClientPool & operator = ( const ClientPool & other );
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        Adapter * m_adapter;                                                ///< The adapter passed in to the constructor.
+        bool m_parallel;                                                    ///< True if clients are updated in parallel via Adapter::ParallelFor.
+        uint8_t * m_poolMemory;                                             ///< The memory backing the pool allocator. NULL if poolMemory is 0.
+        Allocator * m_poolAllocator;                                        ///< The allocator for the memory pool. NULL if poolMemory is 0.
+        Allocator * m_threadSafeAllocator;                                  ///< Makes the allocator shared by the clients thread safe, when updating in parallel. NULL otherwise.
+        Allocator * m_clientAllocator;                                      ///< The allocator shared by the clients. One of the above, or the allocator passed in to the constructor.
+        Client ** m_clients;                                                ///< Array of clients in the pool.
+        int m_numClients;                                                   ///< The number of clients in the pool.
+        double m_time;                                                      ///< The time passed in to the last AdvanceTime call. Read by the parallel update.
+    };
+}
+
+#endif // #ifndef YOJIMBO_CLIENT_POOL_H
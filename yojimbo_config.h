@@ -82,7 +82,29 @@
 #define YOJIMBO_PLATFORM YOJIMBO_PLATFORM_UNIX
 #endif
 
-#define YOJIMBO_SERIALIZE_CHECKS                    1
+#ifndef YOJIMBO_SERIALIZE_CHECKS
+#define YOJIMBO_SERIALIZE_CHECKS                    1       // default for serialize checks on streams and connections. see ConnectionConfig::serializeChecks
+#endif // #ifndef YOJIMBO_SERIALIZE_CHECKS
+
+#ifndef YOJIMBO_BITPACKER_64BIT_WORDS
+#define YOJIMBO_BITPACKER_64BIT_WORDS               0       // flush and fetch bitpacked data 64 bits at a time. the bytes on the wire are identical either way
+#endif // #ifndef YOJIMBO_BITPACKER_64BIT_WORDS
+
+#ifndef YOJIMBO_TSC_CLOCK
+#define YOJIMBO_TSC_CLOCK                           0       // read yojimbo_time from the x86 time stamp counter, calibrated against the monotonic clock. needs an invariant TSC
+#endif // #ifndef YOJIMBO_TSC_CLOCK
+
+#ifndef YOJIMBO_TSC_CALIBRATION_TIME
+#define YOJIMBO_TSC_CALIBRATION_TIME                0.01    // how long the first call to yojimbo_time spins to calibrate the time stamp counter (seconds)
+#endif // #ifndef YOJIMBO_TSC_CALIBRATION_TIME
+
+#ifndef YOJIMBO_DEBUG_STEADY_STATE
+#ifndef NDEBUG
+#define YOJIMBO_DEBUG_STEADY_STATE                  1       // catch allocations made while generating, processing, sending and receiving packets, once armed with ArmSteadyStateCheck
+#else // #ifndef NDEBUG
+#define YOJIMBO_DEBUG_STEADY_STATE                  0
+#endif // #ifndef NDEBUG
+#endif // #ifndef YOJIMBO_DEBUG_STEADY_STATE
 
 #ifndef NDEBUG
 
@@ -94,6 +116,22 @@
 
 #define YOJIMBO_ENABLE_LOGGING                      1
 
+#ifndef YOJIMBO_TLSF_SLABS
+#define YOJIMBO_TLSF_SLABS                          1       // serve allocations up to SlabMaxBytes from TLSF_Allocator out of per-size-class slab pages, instead of one TLSF block each
+#endif // #ifndef YOJIMBO_TLSF_SLABS
+
+#ifndef YOJIMBO_PROFILE
+#define YOJIMBO_PROFILE                             0       // time the main phases of packet processing with scoped timers, and report them to the function set with yojimbo_set_profile_function
+#endif // #ifndef YOJIMBO_PROFILE
+
+#ifndef YOJIMBO_LOG_LEVEL_MAX
+#define YOJIMBO_LOG_LEVEL_MAX                       3       // log levels above this are compiled out, so yojimbo_printf calls for them cost nothing. 3 is YOJIMBO_LOG_LEVEL_DEBUG
+#endif // #ifndef YOJIMBO_LOG_LEVEL_MAX
+
+#ifndef YOJIMBO_LOG_ENTRY_BYTES
+#define YOJIMBO_LOG_ENTRY_BYTES                     512     // size of each entry in the asynchronous log ring (bytes). longer log lines are truncated
+#endif // #ifndef YOJIMBO_LOG_ENTRY_BYTES
+
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -101,22 +139,39 @@
 
 namespace yojimbo
 {
-    const int MaxClients = 64;                                      ///< The maximum number of clients supported by this library. You can increase this if you want, but this library is designed around patterns that work best for [2,64] player games. If your game has less than 64 clients, reducing this will save memory.
+    const int MaxClients = 64;                                      ///< The default number of client slots. Server client tables are sized by the maxClients value passed to Server::Start, so this is not a hard ceiling. The library is designed around patterns that work best for [2,64] player games.
     const int MaxChannels = 64;                                     ///< The maximum number of message channels supported by this library. If you need less than 64 channels per-packet, reducing this will save memory.
     const int KeyBytes = 32;                                        ///< Size of encryption key for dedicated client/server in bytes. Must be equal to key size for libsodium encryption primitive. Do not change.
     const int ConnectTokenBytes = 2048;                             ///< Size of the encrypted connect token data return from the matchmaker. Must equal size of NETCODE_CONNECT_TOKEN_BYTE (2048).
+    const int MaxConnectRace = 4;                                   ///< The most connect attempts a client races in parallel. See BaseClientServerConfig::clientConnectRace.
+    const int SlabPageBytes = 4096;                                 ///< Size of each slab page a TLSF_Allocator carves small allocations from (bytes). Slab pages are aligned to their size.
+    const int SlabClassBytes = 16;                                  ///< Step between slab size classes (bytes). Also the alignment of slab allocations.
+    const int SlabMaxBytes = 256;                                   ///< The largest allocation served from a slab (bytes). See YOJIMBO_TLSF_SLABS.
+    const int CacheLineBytes = 64;                                  ///< Size of a cache line (bytes). Scratch buffers that are touched every tick are aligned to this.
     const uint32_t SerializeCheckValue = 0x12345678;                ///< The value written to the stream for serialize checks. See WriteStream::SerializeCheck and ReadStream::SerializeCheck.
-    const int ConservativeMessageHeaderEstimate = 32;   // todo: bits? bytes? be specific!
-    const int ConservativeFragmentHeaderEstimate = 64;
-    const int ConservativeChannelHeaderEstimate = 32;
-    const int ConservativeConnectionPacketHeaderEstimate = 12;      // todo: actually break this down into component parts, eg. header, serialize check at start, serialize check at end?
+    const int ConservativeMessageHeaderEstimate = 32;               ///< Bits a channel reserves for its channel entry header when selecting messages to send. Also covers the per-entry overhead, since the connection budgets against the bits actually left in the packet.
+    const int ConservativeFragmentHeaderEstimate = 64;              ///< Bits a channel reserves per block fragment header when selecting fragments to send.
+    const int EndpointPacketHeaderBytes = 16;                       ///< Bytes a reliable.io packet buffer may need on top of the packet data, for the packet or fragment header. See BaseClientServerConfig::packetBufferPoolSize.
+    const uint32_t ParityFragmentFlag = 0x80000000;                 ///< Set in the fragment ids a reliable-ordered channel tracks for sent parity fragments, to tell them apart from block fragments. See ChannelConfig::fragmentParityGroupSize.
+    const int MaxResumeFragmentsPerPacket = 512;                    ///< The maximum number of fragments covered by the received fragment bitmap a reliable-ordered channel includes in each packet while resuming a block. See ChannelConfig::resumableBlocks.
+    const int MaxCommonMessageTypes = 8;                            ///< The maximum number of message types that can be declared common, to serialize in fewer bits. See MessageFactory::SetCommonMessageTypes.
+    const int MaxSequenceWindow = 32768;                            ///< The largest packet or message window. Sequence numbers are 16 bits, and are compared within half of the sequence space. See ConnectionConfig::SetHighBandwidthDelay.
+    const int MaxExtendedAckBits = 1024;                            ///< The maximum number of packets covered by an extended ack. See ConnectionConfig::extendedAckBits.
+    const int MemoryOversizeFactor = 4;                             ///< Memory given to an allocator more than this many times what it needs is reported as oversized. See BaseClientServerConfig::checkMemory.
+    const int MaxStringTableSize = 65536;                            ///< The maximum number of entries in a connection string table. See ConnectionConfig::stringTableSize.
+    const int MaxStringDefinitionsPerPacket = 32;                   ///< The maximum number of string table definitions written in one packet. Dictionary strings past this go out in full. See serialize_dictionary_string.
+    const int ConservativeChannelHeaderEstimate = 32;               ///< Bits per channel entry header. No longer reserved by Connection::GeneratePacket, which writes channel data directly into the packet and rolls back anything that doesn't fit.
+    const int ConservativeConnectionPacketHeaderEstimate = 12;      ///< Upper bound on bits in the connection packet header. Checked when YOJIMBO_DEBUG_MESSAGE_BUDGET is enabled.
 
     /// Determines the reliability and ordering guarantees for a channel.
 
     enum ChannelType
     {
         CHANNEL_TYPE_RELIABLE_ORDERED,                              ///< Messages are received reliably and in the same order they were sent. 
-        CHANNEL_TYPE_UNRELIABLE_UNORDERED                           ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_UNRELIABLE_UNORDERED,                          ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_UNRELIABLE_SEQUENCED,                          ///< Messages are sent unreliably. Messages from packets older than the newest packet received on the channel are dropped, so messages never arrive out of order, but may not arrive at all.
+        CHANNEL_TYPE_SNAPSHOT,                                      ///< Only the most recent message is sent, unreliably, delta encoded against the last message the other side acked. Only the newest message received is delivered.
+        CHANNEL_TYPE_RELIABLE_UNORDERED                             ///< Messages are received reliably, but are delivered as soon as they arrive, so they may be received in a different order than they were sent.
     };
 
     /** 
@@ -124,23 +179,35 @@ namespace yojimbo
      
         Channels let you specify different reliability and ordering guarantees for messages sent across a connection.
      
-        They may be configured as one of two types: reliable-ordered or unreliable-unordered.
+        They may be configured as one of five types: reliable-ordered, reliable-unordered, unreliable-unordered, unreliable-sequenced or snapshot.
      
         Reliable ordered channels guarantee that messages (see Message) are received reliably and in the same order they were sent. 
         This channel type is designed for control messages and RPCs sent between the client and server.
+
+        Reliable unordered channels ack and resend messages exactly like reliable-ordered channels, but each message is delivered as soon as it arrives,
+        so one lost packet doesn't hold back the messages sent after it. Each message is still received exactly once. Use this channel type for 
+        independent reliable events, like chat messages or object spawns, where ordering between messages doesn't matter.
     
         Unreliable unordered channels are like UDP. There is no guarantee that messages will arrive, and messages may arrive out of order.
         This channel type is designed for data that is time critical and should not be resent if dropped, like snapshots of world state sent rapidly 
         from server to client, or cosmetic events such as effects and sounds.
         
-        Both channel types support blocks of data attached to messages (see BlockMessage), but their treatment of blocks is quite different.
+        Unreliable sequenced channels are unreliable-unordered channels that drop messages arriving in a packet older than one already received. 
+        This channel type is designed for streams where only the newest data matters, like player inputs or object state.
+
+        Snapshot channels are unreliable-unordered channels specialized for state sent every packet. Only the latest message queued is sent, and only the newest 
+        message received is delivered. Messages must derive from SnapshotMessage, and are delta encoded against the most recent message the other side 
+        acked, using the packet acks the connection already has. Blocks aren't supported over snapshot channels.
+
+        Reliable and unreliable-unordered channels support blocks of data attached to messages (see BlockMessage), but their treatment of blocks is quite different.
         
         Reliable ordered channels are designed for blocks that must be received reliably and in-order with the rest of the messages sent over the channel. 
         Examples of these sort of blocks include the initial state of a level, or server configuration data sent down to a client on connect. These blocks 
         are sent by splitting them into fragments and resending each fragment until the other side has received the entire block. This allows for sending
-        blocks of data larger that maximum packet size quickly and reliably even under packet loss.
+        blocks of data larger that maximum packet size quickly and reliably even under packet loss. Reliable-unordered channels send blocks the same way, 
+        and deliver each block message as soon as its block has been reassembled.
         
-        Unreliable-unordered channels send blocks as-is without splitting them up into fragments. The idea is that transport level packet fragmentation
+        Unreliable-unordered and unreliable-sequenced channels send blocks as-is without splitting them up into fragments. The idea is that transport level packet fragmentation
         should be used on top of the generated packet to split it up into into smaller packets that can be sent across typical Internet MTU (<1500 bytes). 
         Because of this, you need to make sure that the maximum block size for an unreliable-unordered channel fits within the maximum packet size.
         
@@ -149,7 +216,7 @@ namespace yojimbo
 
     struct ChannelConfig
     {
-        ChannelType type;                                           ///< Channel type: reliable-ordered or unreliable-unordered.
+        ChannelType type;                                           ///< Channel type: reliable-ordered, reliable-unordered, unreliable-unordered, unreliable-sequenced or snapshot.
         bool disableBlocks;                                         ///< Disables blocks being sent across this channel.
         int sendQueueSize;                                          ///< Number of messages in the send queue for this channel.
         int receiveQueueSize;                                       ///< Number of messages in the receive queue for this channel.
@@ -158,8 +225,44 @@ namespace yojimbo
         int packetBudget;                                           ///< Maximum amount of message data to write to the packet for this channel (bytes). Specifying -1 means the channel can use up to the rest of the bytes remaining in the packet.
         int maxBlockSize;                                           ///< The size of the largest block that can be sent across this channel (bytes).
         int fragmentSize;                                           ///< Blocks are split up into fragments of this size when sent over a reliable-ordered channel (bytes).
+        int maxBlocksInFlight;                                      ///< Reliable-ordered channels only. Maximum number of consecutive block messages sent over the network at the same time. Must divide 65536 evenly. The receiver reserves maxBlockSize bytes for each block in flight.
+        int maxFragmentsPerPacket;                                  ///< Reliable-ordered channels only. Maximum number of block fragments to include in each packet. Fragments after the first are only included while they fit in the channel packet budget.
+        bool reassembleBlocksInPlace;                               ///< Reliable-ordered channels only. When true, received fragments are written straight into the block allocation that is attached to the message, sized from the fragment count, instead of into a receive buffer that is copied once the block completes. No maxBlockSize receive buffers are reserved in this mode.
+        bool serializeMessagesOnce;                                 ///< Reliable-ordered and reliable-unordered channels only. When true, each message is serialized once when it is sent, and the bits are copied into every packet it is resent in, instead of running its serialize function each time. Messages are serialized with a NULL stream context. See SerializedMessage.
+        bool largeBlocks;                                           ///< Reliable-ordered channels only. Large transfer mode, for blocks of hundreds of MB. Nothing is reserved up-front for blocks: fragment tracking is allocated when a block starts, sized to that block, and freed when it completes. Blocks are reassembled in place, as with reassembleBlocksInPlace. Set maxBlockSize as large as you need.
+        bool resumableBlocks;                                       ///< Reliable-ordered channels only. When true, block transfers interrupted by a disconnect continue where they left off once the same block is sent again on a new connection. Each fragment carries a content hash of its block. The receiver looks up a partly received block with that hash via MessageFactory::FindResumeBlock, and sends the sender a bitmap of the fragments it already has, so they are skipped. Blocks are reassembled in place, as with reassembleBlocksInPlace.
+        bool compressBlocks;                                        ///< Reliable-ordered channels only. When true, each block is compressed with LZ4 once before it is split into fragments, and decompressed once all fragments are received. Blocks that don't get smaller are sent as is. Received blocks are decompressed into the message factory allocator.
+        bool lazyBlockBuffers;                                      ///< Reliable-ordered channels only. If true, the maxBlockSize receive buffer and the fragment tracking for each block in flight are only allocated once the first block is sent or received, and freed again once no block has been sent or received for blockBufferIdleTime. Saves the memory on channels that rarely carry blocks. Only the allocation moves: a block needs the same memory while it is being sent or received.
+        float blockBufferIdleTime;                                  ///< With lazyBlockBuffers, how long the block buffers are kept after the last block completes (seconds).
         float messageResendTime;                                    ///< Minimum delay between message resends (seconds). Avoids sending the same message too frequently.
         float fragmentResendTime;                                   ///< Minimum delay between fragment resends (seconds). Avoids sending the same fragment too frequently.
+        bool adaptiveResendTime;                                    ///< Reliable-ordered and reliable-unordered channels only. If true, messages and fragments are resent once the connection RTT plus four times its variance has passed without an ack, clamped to [minResendTime,maxResendTime], as with TCP's retransmission timeout. messageResendTime and fragmentResendTime are used until the first RTT is measured.
+        float minResendTime;                                        ///< Shortest resend time with adaptiveResendTime (seconds).
+        float maxResendTime;                                        ///< Longest resend time with adaptiveResendTime (seconds).
+        int fragmentParityGroupSize;                                ///< Reliable-ordered channels only. If non-zero, fragments after the first are split into groups of this many, and a parity fragment holding the XOR of each group is sent once the whole group has been sent. The receiver rebuilds a fragment lost from a group from the parity, instead of waiting for fragmentResendTime. Costs about one fragment in this many in extra bandwidth. Fragment 0 carries the block message, so it is not covered. Must match on both ends.
+        int messageLengthBits;                                      ///< Reliable-ordered and reliable-unordered channels only. If non-zero, each message is prefixed with the length of its body in bits, written with this many bits. The receiver then skips over messages it has already received without creating or reading them, which saves work when messages are resent under packet loss. Messages with bodies longer than 2^messageLengthBits - 1 bits fail to serialize, so 16 covers messages up to 8k. Costs this many bits per message. Must match on both ends.
+        bool lazyDecode;                                            ///< Reliable-ordered and reliable-unordered channels only, with messageLengthBits set. If true, message bodies are copied out of packets as they arrive, and each message is only read with its serialize function on the first ReceiveMessage. Moves the decode cost off the thread that processes packets, onto the one that receives messages. Each copied body is one allocation from the message factory allocator, which must be thread safe if those are different threads. Ignored when ConnectionConfig::stringTableSize is set, since strings defined in a message must be read in packet order. Receive side only.
+        bool supersedeMessages;                                     ///< Reliable-ordered and reliable-unordered channels only. If true, sending a message with a non-zero key (see Message::SetKey) supersedes the last unacked message sent with the same key. The superseded message is released, and only an empty placeholder keeping its message id is sent in its place, so ordering is preserved. Block messages are never superseded. Must match on both ends.
+        float messageTimeToLive;                                    ///< Reliable-ordered and reliable-unordered channels only. If non-zero, messages not acked this long after they were queued with SendMessage (seconds) expire: they are released, and only an empty placeholder keeping their message id is sent from then on, so ordering is preserved. Block messages never expire. Must be set on both ends.
+        bool flowControl;                                           ///< Reliable-ordered and reliable-unordered channels only. If true, the receiver advertises the oldest message id its application hasn't dequeued yet, and the sender only sends messages that fit in the receive queue from there. A receiver that falls behind then holds the sender back, instead of the channel failing with CHANNEL_ERROR_DESYNC. Must match on both ends.
+        bool runtimeLimits;                                         ///< Reliable-ordered and reliable-unordered channels only, with flowControl set. If true, the receive window advertisement also carries the receive queue size and the largest block this end takes, so both can be changed at runtime with Connection::SetChannelLimits. The sizes here are the most either end can go up to. Must match on both ends.
+        int fastResendThreshold;                                    ///< Reliable-ordered and reliable-unordered channels only. If non-zero, a sent packet is considered lost once a packet sent this many packets after it is acked, and the messages and fragments it carried are resent in the next packet instead of waiting for the resend time. Packets delivered out of order by fewer packets than this are not resent. Zero disables it.
+        float messageMaxDeferTime;                                  ///< Unreliable-unordered channels only. Messages that don't fit in the current packet stay queued and are retried in later packets until they are this old (seconds). Zero drops them immediately.
+        bool priorityAccumulator;                                   ///< Unreliable-unordered and unreliable-sequenced channels only. If true, packets are filled with the queued messages that have accumulated the most priority instead of oldest first. Each message starts with its priority (see Message::SetPriority) and accumulates it again for every second it waits, so low priority messages still go out eventually. Messages that don't fit stay queued, up to messageMaxDeferTime if that is non-zero.
+        int redundantMessages;                                      ///< Unreliable-unordered and unreliable-sequenced channels only. If non-zero, each packet also carries up to this many of the most recent messages sent that no packet carrying them has been acked yet, space permitting, so a lost packet doesn't lose its messages. The receiver drops copies it has already received. Received message ids are message sequence numbers instead of packet sequence numbers. Must match on both ends.
+        bool jitterBuffer;                                          ///< Unreliable-unordered and unreliable-sequenced channels only. If true, each message carries its sender tick (see Message::SetTick), and the receiver holds messages back and hands them out in tick order once each tick is due for playout. The playout delay adapts to the jitter measured on the ticks as they arrive, so it is only as long as the jitter needs. Messages arriving after a later tick has been handed out are dropped. Must match on both ends.
+        float jitterBufferTickRate;                                 ///< With jitterBuffer, the rate the sender ticks advance at (ticks per second).
+        float jitterBufferDelayScale;                               ///< With jitterBuffer, the playout delay is this many times the measured jitter. Higher is smoother, lower has less latency.
+        float jitterBufferMinDelay;                                 ///< With jitterBuffer, the shortest playout delay (seconds).
+        float jitterBufferMaxDelay;                                 ///< With jitterBuffer, the longest playout delay (seconds), however much jitter is measured.
+        int baselineBufferSize;                                     ///< Snapshot channels only. Number of packets of sent and received snapshots kept as baselines. Snapshots acked longer ago than this many packets can't be used as a baseline. Must be less than 32768.
+        bool latencyHistograms;                                     ///< If true, the channel records how long messages wait in the send queue before they are first put in a packet, and on reliable channels how long until they are acked. See Channel::GetLatencyHistogram. Queue latency isn't recorded for block messages on reliable channels, or on snapshot channels.
+        bool urgent;                                                ///< If true, data waiting on this channel is sent straight away while the client is in power save mode, along with everything else waiting, instead of waiting for the next burst. Set this on gameplay critical channels. See BaseClient::SetPowerSave. With BaseClientServerConfig::trustedMultipath, packets carrying data for urgent channels are also sent over both paths.
+        bool scavenger;                                             ///< If true, the channel only gets the packet space the other channels leave over, at a rate the connection adapts to queuing delay: it grows while the RTT stays within ConnectionConfig::scavengerTargetDelay of the lowest RTT measured, and backs off as soon as it rises further. Meant for bulk block transfers like replays and telemetry, so they fill spare bandwidth without raising the RTT of gameplay channels, and still run at full speed on an idle link. With compactPacketHeader, channels are visited in index order, so give scavenger channels the highest indices. Send side only.
+        int weight;                                                 ///< Share of packet space this channel gets relative to the other channels with data to send. A channel with weight 4 gets four times the space of a channel with weight 1 when both are busy. Space that channels don't use flows to the others. Must be at least 1.
+        bool autoTune;                                              ///< If true, the connection adjusts the packet budget and the most messages per packet this channel runs with every ConnectionConfig::autoTuneInterval, from the traffic it sent. Channels that ran out of space get more, channels that left their budget unused give it back, and the budgets of the channels tuned are scaled down together when they ask for more than the packet size and bandwidth limit leave over. The most messages per packet follows the budget at the average message size sent. packetBudget and maxMessagesPerPacket are the upper bounds, or the packet size if packetBudget is -1. See ChannelLimits. Send side only.
+        int autoTuneMinPacketBudget;                                ///< With autoTune, the lowest packet budget the channel is tuned down to (bytes).
+        int autoTuneMinMessagesPerPacket;                           ///< With autoTune, the fewest messages per packet the channel is tuned down to.
 
         ChannelConfig() : type ( CHANNEL_TYPE_RELIABLE_ORDERED )
         {
@@ -171,14 +274,95 @@ namespace yojimbo
             packetBudget = 1100;
             maxBlockSize = 256 * 1024;
             fragmentSize = 1024;
+            maxBlocksInFlight = 1;
+            maxFragmentsPerPacket = 1;
+            reassembleBlocksInPlace = false;
+            serializeMessagesOnce = false;
+            largeBlocks = false;
+            resumableBlocks = false;
+            compressBlocks = false;
+            lazyBlockBuffers = false;
+            blockBufferIdleTime = 10.0f;
             messageResendTime = 0.1f;
             fragmentResendTime = 0.25f;
+            adaptiveResendTime = false;
+            minResendTime = 0.02f;
+            maxResendTime = 1.0f;
+            messageLengthBits = 0;
+            lazyDecode = false;
+            supersedeMessages = false;
+            messageTimeToLive = 0.0f;
+            flowControl = false;
+            runtimeLimits = false;
+            fastResendThreshold = 0;
+            fragmentParityGroupSize = 0;
+            messageMaxDeferTime = 0.0f;
+            priorityAccumulator = false;
+            redundantMessages = 0;
+            jitterBuffer = false;
+            jitterBufferTickRate = 60.0f;
+            jitterBufferDelayScale = 4.0f;
+            jitterBufferMinDelay = 0.0f;
+            jitterBufferMaxDelay = 0.25f;
+            baselineBufferSize = 64;
+            latencyHistograms = false;
+            urgent = false;
+            scavenger = false;
+            weight = 1;
+            autoTune = false;
+            autoTuneMinPacketBudget = 64;
+            autoTuneMinMessagesPerPacket = 1;
+        }
+
+        bool SendsMessagePlaceholders() const
+        {
+            return supersedeMessages || messageTimeToLive > 0.0f;
         }
 
         int GetMaxFragmentsPerBlock() const
         {
             return maxBlockSize / fragmentSize;
         }
+
+        int GetNumParityGroups( int numFragments ) const
+        {
+            return fragmentParityGroupSize > 0 ? ( numFragments - 1 + fragmentParityGroupSize - 1 ) / fragmentParityGroupSize : 0;
+        }
+    };
+
+    /**
+        Limits a channel runs with, within its ChannelConfig.
+
+        Every connection starts out with the limits of its ChannelConfig, and can lower them and raise them back up again while connected, eg. to shrink queues and packet budgets in the lobby and grow them for match start. See Connection::SetChannelLimits.
+
+        The send queue size, packet budget and most messages per packet only affect this end, and apply straight away. On channels with ChannelConfig::autoTune, the connection sets the packet budget and most messages per packet itself. The receive queue size and largest block are advertised to the other end, which needs ChannelConfig::runtimeLimits. Queues shrink once the messages they hold fit, and grow straight away.
+     */
+
+    struct ChannelLimits
+    {
+        int sendQueueSize;                                          ///< Number of messages in the send queue, in [1,ChannelConfig::sendQueueSize]. Must divide 65536 evenly. Reliable channels stop taking messages while this many are unacked. Unreliable channels drop their oldest queued messages to fit.
+        int receiveQueueSize;                                       ///< Number of messages in the receive queue, in [1,ChannelConfig::receiveQueueSize]. Must divide 65536 evenly. Reliable channels advertise it as their receive window, and only shrink the queue once every message the other end may still send under an earlier advertisement fits. Unreliable channels drop their oldest received messages to fit.
+        int packetBudget;                                           ///< Maximum amount of message data to write to the packet for this channel (bytes). Up to ChannelConfig::packetBudget, or any value if that is -1.
+        int maxMessagesPerPacket;                                   ///< Most messages to write to a packet for this channel, in [1,ChannelConfig::maxMessagesPerPacket]. Send side only, so it only limits what this end writes.
+        int maxBlockSize;                                           ///< Reliable channels only. The largest block the other end may start sending this end (bytes), in [1,ChannelConfig::maxBlockSize]. Blocks the other end already started are still received. Larger blocks queued on the other end wait until the limit is raised again. Bounds the memory received blocks are reassembled in with ChannelConfig::reassembleBlocksInPlace.
+
+        ChannelLimits()
+        {
+            sendQueueSize = 0;
+            receiveQueueSize = 0;
+            packetBudget = 0;
+            maxMessagesPerPacket = 0;
+            maxBlockSize = 0;
+        }
+
+        explicit ChannelLimits( const ChannelConfig & config )
+        {
+            sendQueueSize = config.sendQueueSize;
+            receiveQueueSize = config.receiveQueueSize;
+            packetBudget = config.packetBudget;
+            maxMessagesPerPacket = config.maxMessagesPerPacket;
+            maxBlockSize = config.maxBlockSize;
+        }
     };
 
     /** 
@@ -194,6 +378,28 @@ namespace yojimbo
         int numChannels;                                        ///< Number of message channels in [1,MaxChannels]. Each message channel must have a corresponding configuration below.
         int maxPacketSize;                                      ///< The maximum size of packets generated to transmit messages between client and server (bytes).
         int slidingWindowSize;                                  ///< The size of the sliding window used for packet acks (# of packets in history). Depending on your packet send rate, you should make sure this buffer is large enough to cover at least a few seconds worth of packets.
+        int bandwidthLimit;                                     ///< Maximum rate the connection generates packet data at (bytes per second). Channel data that would exceed it waits for later packets; packets are still generated so acks keep flowing. Counts connection packet bytes only, not reliable.io and netcode.io headers. Zero means unlimited.
+        int bandwidthBurstBytes;                                ///< Size of the bandwidth token bucket (bytes): how much unused bandwidth can be saved up for a burst. Zero means maxPacketSize.
+        bool adaptiveBandwidth;                                 ///< If true, the bandwidth limit used by the connection adapts to measured RTT and packet loss: halved under congestion, probing back up towards bandwidthLimit while the link is clean. Requires bandwidthLimit > 0.
+        int adaptiveBandwidthMin;                               ///< Lowest bandwidth the adaptive limit backs off to (bytes per second). Zero means bandwidthLimit / 8.
+        float congestionPacketLoss;                             ///< Packet loss above which the link is considered congested (percent).
+        float congestionRttIncrease;                            ///< RTT above the lowest RTT measured on the connection by more than this is considered congestion (milliseconds). Queues building up along the path show up as RTT before they show up as loss.
+        float scavengerTargetDelay;                             ///< Queuing delay the scavenger rate aims for (milliseconds): the RTT above the lowest RTT measured. Below it the scavenger rate grows, above it the rate backs off. See ChannelConfig::scavenger.
+        int scavengerMinBandwidth;                              ///< Lowest rate scavenger channels back off to, and the rate they start at (bytes per second). See ChannelConfig::scavenger.
+        bool suppressIdlePackets;                               ///< If true, GeneratePacket returns false instead of generating a packet when no channel has data to send and no received packet with channel data is waiting to be acked.
+        float idlePacketInterval;                               ///< When suppressing idle packets, a packet is still generated if none was for this long, so acks and RTT measurements keep flowing (seconds).
+        int extendedAckBits;                                    ///< If non-zero, every extendedAckInterval packets also carry a bitmask of which of the last this many packets were received, on top of the 33 packets acked by each reliable.io packet header. A run of lost packets in the other direction then doesn't leave packets that did arrive unacked, with their messages resent. Must be a multiple of 32, at most MaxExtendedAckBits and slidingWindowSize. Must match on both ends.
+        int extendedAckInterval;                                ///< Number of packets between extended acks. 1 sends them in every packet.
+        bool dropDuplicatePackets;                              ///< If true, the connection remembers the sequence of the last slidingWindowSize packets it processed, and drops any packet it already processed instead of processing it again. Needed when the same packet can arrive more than once, eg. sent over two paths with BaseClientServerConfig::trustedMultipath. Without it, messages on unreliable channels would be received twice.
+        float coalesceTime;                                     ///< If non-zero, GeneratePacket holds back packets for up to this long while the only new data waiting is a few small messages, so messages sent one at a time go out together in a fuller packet. Acks wait with them. Messages already sent, blocks and snapshots go out as usual. Meant for links driven by events rather than a tick (seconds).
+        int coalesceBytes;                                      ///< When coalescing, a packet is generated straight away once this much new message data is waiting (bytes).
+        int frameAllocatorBytes;                                ///< If non-zero, the connection reserves a FrameAllocator of this size and hands it to the streams that read and write packets, so temporaries allocated inside serialize functions are bump allocated and rewound every AdvanceTime. Only safe if serialize functions free everything they allocate from the stream allocator before returning. Zero means stream allocations go to the message factory allocator.
+        bool compactPacketHeader;                               ///< If true, connection packets start with a bitmask of the channels they carry data for, instead of a count followed by a channel index on each entry. Channel entries also drop the block flag on channels that can't send blocks. Channels are then visited in index order when sharing out packet space, instead of rotating. Saves bits on small packets for connections with a few channels. Must match on both ends.
+        int stringTableSize;                                    ///< If non-zero, the connection keeps a string table of this many entries in each direction, in [1,MaxStringTableSize]. Strings written with serialize_dictionary_string are sent in full with an id the first time, then as the id alone once the packet defining them is acked. Zero disables the dictionary.
+        int memoryWatermark;                                    ///< If non-zero, the connection is low on memory while the allocator passed in to it has more than this many bytes allocated. CanSendMessage then returns false on every channel, so a burst of sends backs off instead of exhausting the allocator and putting the connection in an error state. Set it some way below clientMemory and serverPerClientMemory, leaving room for messages received while memory is low. See Adapter::OnConnectionMemoryLow. Zero disables the watermark.
+        bool serializeChecks;                                   ///< If true, connection packets and the messages in them are written with serialize checks, so desyncs are caught where they happen. False saves 32 bits and an align per check, for release builds. Defaults to YOJIMBO_SERIALIZE_CHECKS. Without negotiateSerializeChecks, must match on both ends.
+        bool negotiateSerializeChecks;                          ///< If true, each connection packet carries a bit saying whether it has serialize checks, and the connection writes checks while serializeChecks is set or the last packet received had them. A peer with checks on then turns them on for both directions, so a debug build can talk to a release build that has them off. Must match on both ends.
+        float autoTuneInterval;                                 ///< Time between adjustments of the limits of channels with ChannelConfig::autoTune set (seconds). Each adjustment works from the traffic sent since the last.
         ChannelConfig channel[MaxChannels];                     ///< Per-channel configuration. See ChannelConfig for details.
 
         ConnectionConfig()
@@ -201,9 +407,64 @@ namespace yojimbo
             numChannels = 1;
             maxPacketSize = 8 * 1024;
             slidingWindowSize = 1024;
+            bandwidthLimit = 0;
+            bandwidthBurstBytes = 0;
+            adaptiveBandwidth = false;
+            adaptiveBandwidthMin = 0;
+            congestionPacketLoss = 5.0f;
+            congestionRttIncrease = 50.0f;
+            scavengerTargetDelay = 25.0f;
+            scavengerMinBandwidth = 4 * 1024;
+            suppressIdlePackets = false;
+            idlePacketInterval = 1.0f;
+            extendedAckBits = 0;
+            extendedAckInterval = 8;
+            dropDuplicatePackets = false;
+            coalesceTime = 0.0f;
+            coalesceBytes = 512;
+            frameAllocatorBytes = 0;
+            compactPacketHeader = false;
+            stringTableSize = 0;
+            memoryWatermark = 0;
+            serializeChecks = YOJIMBO_SERIALIZE_CHECKS != 0;
+            negotiateSerializeChecks = false;
+            autoTuneInterval = 1.0f;
+        }
+
+        /**
+            Size the windows for links with a high bandwidth-delay product, eg. between servers in the same datacenter.
+
+            A reliable channel can't have more messages in flight than its send queue holds, and packets are only acked within the sliding window, so the default windows of 1024 cap throughput at roughly 1024 packets per RTT. This sets slidingWindowSize, and sendQueueSize, receiveQueueSize and sentPacketBufferSize on every channel, to the window size. Each channel then reserves memory for that many entries in each of its queues.
+
+            Sequence numbers stay 16 bits, so packets and messages can't be tracked further apart than MaxSequenceWindow.
+
+            @param windowSize The window size. Must be a power of two, at most MaxSequenceWindow.
+         */
+
+        void SetHighBandwidthDelay( int windowSize = 16384 )
+        {
+            slidingWindowSize = windowSize;
+            for ( int i = 0; i < MaxChannels; ++i )
+            {
+                channel[i].sendQueueSize = windowSize;
+                channel[i].receiveQueueSize = windowSize;
+                channel[i].sentPacketBufferSize = windowSize;
+            }
         }
     };
 
+    /**
+        Ways the server degrades service while it is overloaded, so the tick rate holds for everyone. See BaseClientServerConfig::serverOverloadTickTime.
+     */
+
+    enum ServerOverloadStep
+    {
+        SERVER_OVERLOAD_STEP_LOW_PRIORITY_SEND_RATE,                ///< Send to spectators and clients set with BaseServer::SetClientLowPriority at BaseClientServerConfig::serverOverloadSendRate at most.
+        SERVER_OVERLOAD_STEP_PAUSE_SCAVENGER,                       ///< Pause the channels with ChannelConfig::scavenger set, which carry bulk block transfers like replays and telemetry.
+        SERVER_OVERLOAD_STEP_SHRINK_UNRELIABLE,                     ///< Scale the packet budget of unreliable-unordered and unreliable-sequenced channels by BaseClientServerConfig::serverOverloadBudgetScale.
+        SERVER_OVERLOAD_NUM_STEPS                                   ///< The number of overload steps.
+    };
+
     /** 
         Configuration shared between client and server.
         
@@ -214,23 +475,152 @@ namespace yojimbo
 
     struct BaseClientServerConfig : public ConnectionConfig
     {
-        // todo: config needed to create reliable.io endpoints should go here
-
         uint64_t protocolId;                                    ///< Clients can only connect to servers with the same protocol id. Use this for versioning.
-        int clientMemory;                                       ///< Memory allocated inside Client for packets, messages and stream allocations (bytes)
+        int packetFragmentAbove;                                ///< reliable.io splits packets larger than this into fragments (bytes).
+        int packetFragmentSize;                                 ///< The size of each packet fragment (bytes). Keep fragments under the path MTU.
+        int maxPacketFragments;                                 ///< The most fragments a packet can be split into. maxPacketSize must be at most maxPacketFragments * packetFragmentSize.
+        int packetReassemblyBufferSize;                         ///< Number of fragmented packets each reliable.io endpoint can reassemble at the same time.
+        int packetBufferPoolSize;                               ///< If non-zero, each reliable.io endpoint keeps this many buffers big enough for a packet split into maxPacketFragments, and takes the buffers for reassembling fragmented packets and sending large packets from them, instead of allocating a buffer for each packet. The buffers are reserved the first time a large packet is sent or received. See BufferPoolAllocator.
+        int clientMemory;                                       ///< Memory allocated inside Client for packets, messages and stream allocations (bytes). When clientSharedMemory is true, this is the client quota instead.
+        bool clientSharedMemory;                                ///< If true, the client allocates on demand from the allocator passed in to the client, limited to clientMemory, instead of reserving clientMemory up-front. Use this with ClientPool, so many clients share one pool.
+        bool clientReuseConnection;                             ///< If true, Client::Disconnect keeps the client memory, connection, message factory and reliable.io endpoint, and resets them so the next connect reuses them instead of building them again. Costs clientMemory while disconnected. The memory is freed when the client is destroyed, or on a disconnect after the client allocator ran out of memory.
+        bool clientNetworkThread;                               ///< If true, a client connected to a server over the network does its socket I/O, packet processing and acks on its own thread at clientNetworkRate, so long frames don't delay acks. Messages pass to and from the game thread through lock-free queues.
+        float clientNetworkRate;                                ///< Number of times per second the client network thread sends and receives packets, when clientNetworkThread is true.
+        int clientConnectRace;                                  ///< Number of server addresses Client::InsecureConnect tries in parallel, in [1,MaxConnectRace]. netcode.io tries the addresses in a connect token one after another, waiting for each to time out, so a loaded or dead server at the front of the list costs seconds. With more than one, the client sends connect requests from a socket per attempt and keeps whichever server answers first, which is usually the one with the lowest RTT. Attempt i tries addresses i, i + clientConnectRace, ... in turn. Client::Connect races when passed several connect tokens.
+        float clientPowerSaveInterval;                          ///< While the client is in power save mode, it only sends packets once per interval (seconds), so the radio of a mobile device can idle in between. Messages and acks wait for the next burst. Keep it below the resend time of the server's reliable channels, or the server resends messages that did arrive. See BaseClient::SetPowerSave.
+        int clientPowerSaveBurstPackets;                        ///< Most packets the client sends in each power save burst. Packets after the first are only sent while the connection still has data to send.
         int serverGlobalMemory;                                 ///< Memory allocated inside Server for global connection request and challenge response packets (bytes)
-        int serverPerClientMemory;                              ///< Memory allocated inside Server for packets, messages and stream allocations per-client (bytes)
+        int serverPerClientMemory;                              ///< Memory allocated inside Server for packets, messages and stream allocations per-client (bytes). When serverSharedClientMemory is true, this is the per-client quota instead.
+        bool serverSharedClientMemory;                          ///< If true, clients allocate on demand from a pool shared by all client slots, limited to serverPerClientMemory each, instead of each slot reserving serverPerClientMemory up-front.
+        bool serverWarmRestart;                                 ///< If true, BaseServer::Stop keeps the memory, allocator, message factory, connection and reliable.io endpoint of each client slot, reset, and the next Start reuses them for its slots instead of allocating them again. Start may use a different maxClients. Slots past the previous high-water mark are allocated as usual. Kept slots are freed with BaseServer::ReleaseWarmClientSlots or when the server is destroyed. Ignored when serverSharedClientMemory is true.
+        int serverSharedClientPoolMemory;                       ///< Size of the pool shared by all clients when serverSharedClientMemory is true (bytes). Set to 0 to allocate directly from the allocator passed in to the server, so the pool grows as needed.
+        int serverBroadcastMemory;                              ///< Memory allocated inside Server for messages created with BaseServer::CreateBroadcastMessage, and the serialized bits they share between clients (bytes).
+        int serverSpectatorMemory;                              ///< Per-client quota of spectator slots when serverSharedClientMemory is true, in place of serverPerClientMemory (bytes). Without shared client memory, spectators use the memory their slot reserved. See Adapter::IsSpectator.
+        int serverSpectatorQueueSize;                           ///< Spectator connections cap the send and receive queue of each channel at this many messages, and allocate block buffers lazily. Spectators receive broadcast messages and send little, so their queues only need to cover the messages in flight.
+        bool serverPageMemory;                                  ///< If true, the memory backing the server global, shared and per-client allocators comes straight from the operating system via yojimbo_page_allocate, instead of from the allocator passed in to the server. Each block is placed on the NUMA node returned by Adapter::GetServerMemoryNumaNode.
+        bool serverHugePages;                                   ///< If true, back the server allocator memory with huge pages where possible, to cut down on TLB misses. Requires serverPageMemory.
+        bool serverPrefaultMemory;                              ///< If true, every page of the memory backing the server allocators is faulted in when the server starts, so the first burst of traffic in a match doesn't stall on page faults. Start takes longer.
+        bool serverLockMemory;                                  ///< If true, the memory backing the server allocators is locked into physical memory with yojimbo_page_lock, so it is never swapped out. Implies serverPrefaultMemory. Failure to lock is logged and otherwise ignored.
         bool networkSimulator;                                  ///< If true then a network simulator is created for simulating latency, jitter, packet loss and duplicates.
         int maxSimulatorPackets;                                ///< Maximum number of packets that can be stored in the network simulator. Additional packets are dropped.
+        int simulatorPacketBuffers;                             ///< Number of packet buffers the network simulator reserves up-front, so simulated packets are copied without allocating. Set to 0 to allocate each packet as it is sent.
+        int simulatorPacketBufferBytes;                         ///< Size of each network simulator packet buffer (bytes). Packets larger than this, or sent while every buffer is in use, are allocated instead.
+        uint64_t simulatorSeed;                                 ///< Seed for the network simulator random number generator, so simulated loss, jitter and duplicates are the same on every run. 0 seeds it from rand().
+        int serverReceiveBatchSize;                             ///< Maximum number of packets the server drains from the transport before dispatching them to client endpoints in one batch. Set to 0 to dispatch each packet as it is received.
+        int serverSendBatchSize;                                ///< Maximum number of packets the server collects in SendPackets before flushing them to the transport in one batch. Set to 0 to send each packet as it is generated. Only used in the trusted network mode, where the batch goes to the socket in as few system calls as it can, or with serverParallelTransportSend. Otherwise it is a no-op, since netcode.io sends each packet with its own call.
+        int serverSendBatchBytes;                               ///< Size of the buffer the server collects batched packets in (bytes). The batch is flushed early if the next packet doesn't fit.
+        bool serverParallelSend;                                ///< If true, the server generates packets for connected clients in parallel via Adapter::ParallelFor, then sends them from the calling thread.
+        bool serverParallelReceive;                             ///< If true, the server processes each receive batch in parallel across clients via Adapter::ParallelFor. Requires serverReceiveBatchSize > 0.
+        int serverSubmitQueueSize;                              ///< Number of messages each client slot can queue from job threads with BaseServer::SubmitMessage between calls to Server::SendPackets, which sends them. Lets gameplay jobs create and send messages to different clients in parallel, instead of handing them to the network thread. 0 for no submit queues.
+        bool trustedNetwork;                                    ///< If true, Server::Start opens a plain UDP socket instead of a netcode.io server, and clients connect with Client::ConnectTrusted. Packets are not encrypted, and are accepted by source address once the client has authenticated with the private key. Only use this on a private network you trust, eg. between backend processes in one datacenter.
+        bool trustedMultipath;                                  ///< In the trusted network mode, lets a client connect over a second local interface as well as the first, eg. cellular alongside wifi. See Client::ConnectTrusted. Packets carrying data for channels marked ChannelConfig::urgent go over both paths, and the rest go over one path, alternating with trustedMultipathBalance. A path stops being used when nothing has been received over it for TrustedPathTimeout. Requires dropDuplicatePackets, so the copy that arrives second is dropped. Must match on both ends.
+        bool trustedMultipathBalance;                           ///< With trustedMultipath, packets without urgent data alternate between the two paths instead of going over the first, to spread bulk data over both interfaces.
+        float trustedTimeout;                                   ///< In the trusted network mode, connections time out when nothing is received for this long (seconds). A connect attempt fails after this long without an answer.
+        float trustedResumeTime;                                ///< If non-zero, in the trusted network mode a connection that times out is suspended for this long instead of closed (seconds). The server keeps the slot and the connection state, and the client keeps resending a resume request with the one-time ticket the server sent when it accepted the connection. One round trip resumes the connection where it left off, from the same address or a new one, eg. after a mobile client moved from wifi to cellular. Messages sent meanwhile are delivered after the resume on reliable channels. Through a Relay, only resuming from the same address works. See Client::ResumeTrusted. Must match on both ends.
+        bool trustedPathMtuDiscovery;                           ///< In the trusted network mode, find the largest packet each connection's path carries without IP fragmentation, and keep packets within it. Sockets set the don't fragment bit, and the client probes sizes from TrustedMinPathBytes up to TrustedMaxPathBytes with zero padded probes the server echoes back at the same size. Until a size is confirmed, packets are kept within TrustedMinPathBytes. reliable.io only splits packets too large for TrustedMaxPathBytes, so packets up to the discovered size go out whole instead of in packetFragmentSize pieces. The search is repeated every TrustedPathSearchInterval and after a resume. Channel fragmentSize is fixed by the wire format, so packets never shrink below what one block fragment needs: keep fragmentSize under TrustedMinPathBytes less about 40 bytes of headers. Must match on both ends.
+        int serverUdpSendBufferSize;                            ///< In the trusted network mode, the kernel send buffer size (SO_SNDBUF) of the server's UDP socket (bytes). Raise this on servers with a high packet rate, like relays, so bursts from SendPackets aren't dropped by the kernel. Linux caps it at net.core.wmem_max.
+        int serverUdpReceiveBufferSize;                         ///< In the trusted network mode, the kernel receive buffer size (SO_RCVBUF) of the server's UDP socket (bytes). Raise this on servers with a high packet rate, so packets arriving between ticks aren't dropped by the kernel. Linux caps it at net.core.rmem_max.
+        bool serverSocketRegisteredIO;                          ///< In the trusted network mode on windows, send and receive on the server socket with Registered I/O, falling back to winsock where it isn't available. Ignored on other platforms.
+        bool serverSocketReusePort;                             ///< In the trusted network mode on linux, bind the server socket with SO_REUSEPORT, so several servers in different threads or processes can share one port. Each server owns its own client slots, and the kernel hashes each client address to one of them, so a client keeps landing on the server it connected to. Only start or stop shards while no clients are connecting, since changing the number of sockets on the port moves clients between them.
+        int serverConnectRequestBudget;                         ///< In the trusted network mode, the maximum number of connect requests the server checks per call to ReceivePackets. The rest are dropped, and clients resend them. Keeps connect floods from eating into the tick of connected clients. 0 for no limit. netcode.io processes its own connect requests inside netcode_server_update, so this doesn't apply there.
+        int serverProbeBudget;                                  ///< In the trusted network mode, the maximum number of probes the server answers per call to ReceivePackets, so matchmaking clients can measure the RTT to candidate servers with a Prober before asking for a match. A probe costs a protocol id check and one reply no larger than the probe, with no per-address state. Probes past the budget are dropped. 0 to not answer probes.
+        float serverConnectRequestRate;                         ///< In the trusted network mode, the number of connect requests per second the server checks from each address, with bursts up to the same number. Requests over the rate are dropped before any crypto is done. 0 for no limit.
+        float serverClientPacketRate;                           ///< The number of packets per second the server processes from each connected client, with bursts up to the same number. Packets over the rate are dropped in Server::ReceivePackets before reliable.io and the connection see them, so one client flooding valid packets can't take tick time from everyone else. Counted in BaseServer::GetClientIngressStats. Loopback clients are not limited. 0 for no limit.
+        int serverClientByteRate;                               ///< The number of packet bytes per second the server processes from each connected client, with bursts up to the same number. Works like serverClientPacketRate. 0 for no limit.
+        bool serverParallelTransportSend;                       ///< If true, the server flushes each send batch in parallel across clients via Adapter::ParallelFor, so netcode.io packet encryption runs on the worker threads. Each client's packets stay in order on one worker. Requires serverSendBatchSize > 0. This calls netcode_server_send_packet on the one netcode.io server from several threads at once, which relies on netcode.io internals: packet sequence numbers, keys and send times are per-client, and each packet goes out with a bare sendto. It is not safe if the netcode.io server is created with its own network simulator or a send packet override. Server::Start asserts that it isn't.
+        int serverSendPacingSlices;                             ///< Paces per-client sends across the tick. Each Server::SendPackets call only sends to every Nth connected client, rotating, so calling SendPackets this many times per tick at even intervals spreads the packets out instead of bursting them. 1 sends to every client on every call.
+        int serverMaxClientGroups;                              ///< Number of client groups the server keeps for BaseServer::SendMessageToGroup. Each group can hold every client slot. 0 for none.
+        float serverSendInterval;                               ///< Staggers per-client sends across the tick by time. Each client slot sends at most once per interval (seconds), at its own phase: client i sends at i/maxClients of the way through each interval. Call Server::SendPackets more often than the interval, eg. every millisecond from the network loop, and the clients are spread evenly over it instead of all sending at once. 0 sends to every client on every call.
+        int serverAdmissionMemoryHeadroom;                      ///< With serverSharedClientMemory and a fixed serverSharedClientPoolMemory, refuse new clients while less than this is free in the shared pool (bytes), so the clients already connected don't run out of memory. 0 for no limit. See Adapter::AdmitClient.
+        float serverTickPhaseBudget;                            ///< If non-zero, Server::ReceivePackets, AdvanceTime and SendPackets are each checked against this budget (seconds). A phase that runs over is logged, along with the busiest client and queue depths at that moment, and reported to Adapter::OnTickPhaseOverrun. Nothing is done while phases stay within budget, beyond the clock reads already made for Server::GetTickPhaseTime.
+        float serverOverloadTickTime;                           ///< If non-zero, the server degrades service one step at a time while its tick takes longer than this (seconds), and undoes the steps again, last first, once it is back under. The tick time is the sum of the last Server::ReceivePackets, AdvanceTime and SendPackets phase times. See BaseServer::GetOverloadLevel. 0 disables it.
+        int serverOverloadTicks;                                ///< Number of ticks in a row over serverOverloadTickTime before the next overload step is applied.
+        int serverRecoverTicks;                                 ///< Number of ticks in a row under serverRecoverFraction of serverOverloadTickTime before the last overload step applied is undone. Longer than serverOverloadTicks, so the server doesn't flap.
+        float serverRecoverFraction;                            ///< Fraction of serverOverloadTickTime the tick must stay under to count towards recovering.
+        int numServerOverloadSteps;                             ///< Number of overload steps in serverOverloadSteps, in [0,SERVER_OVERLOAD_NUM_STEPS].
+        int serverOverloadSteps[SERVER_OVERLOAD_NUM_STEPS];     ///< The overload steps to apply, in order. See ServerOverloadStep. Defaults to every step, cheapest for gameplay first.
+        float serverOverloadSendRate;                           ///< Send rate of low priority clients with SERVER_OVERLOAD_STEP_LOW_PRIORITY_SEND_RATE applied (packets per second).
+        float serverOverloadBudgetScale;                        ///< Scale applied to the packet budget of unreliable channels with SERVER_OVERLOAD_STEP_SHRINK_UNRELIABLE applied, in (0,1].
+        float serverAdmissionTickTime;                          ///< Refuse new clients while the last tick time reported with BaseServer::SetTickTime is above this (seconds), so an overloaded server stops taking players instead of slowing down for everyone. 0 for no limit. See Adapter::AdmitClient.
+        int maxLoopbackPackets;                                 ///< Maximum number of packets queued in each direction between a loopback client and the server, between calls to ReceivePackets. Additional packets are dropped. See BaseClient::ConnectLoopback.
+        int sharedMemoryRingBytes;                              ///< Size of the ring in each direction of a shared memory link between a server and a client in another process on the same host (bytes). Must be a power of two. Packets that don't fit are dropped. Set on the server. See BaseServer::ConnectSharedMemoryClient.
+        float sharedMemoryTimeout;                              ///< A shared memory link is closed when nothing is received over it for this long (seconds), so a process that exits without closing its end is noticed. On the server, the client must open the link within this long.
+        bool checkMemory;                                       ///< If true, the client and server work out the memory their connections need when they are created, and warn if clientMemory, serverPerClientMemory or serverGlobalMemory is too small or more than MemoryOversizeFactor times too large. Costs about as much as creating one more connection. See GetConnectionMemoryFootprint.
         
         BaseClientServerConfig()
         {
             protocolId = 0;
+            packetFragmentAbove = 1024;
+            packetFragmentSize = 1024;
+            maxPacketFragments = 16;
+            packetReassemblyBufferSize = 64;
+            packetBufferPoolSize = 0;
             clientMemory = 10 * 1024 * 1024;
+            clientSharedMemory = false;
+            clientReuseConnection = false;
+            clientNetworkThread = false;
+            clientNetworkRate = 60.0f;
+            clientConnectRace = 1;
+            clientPowerSaveInterval = 0.25f;
+            clientPowerSaveBurstPackets = 4;
             serverGlobalMemory = 10 * 1024 * 1024;
             serverPerClientMemory = 10 * 1024 * 1024;
+            serverSharedClientMemory = false;
+            serverWarmRestart = false;
+            serverSharedClientPoolMemory = 0;
+            serverBroadcastMemory = 4 * 1024 * 1024;
+            serverSpectatorMemory = 1024 * 1024;
+            serverSpectatorQueueSize = 64;
+            serverPageMemory = false;
+            serverHugePages = false;
+            serverPrefaultMemory = false;
+            serverLockMemory = false;
             networkSimulator = true;
             maxSimulatorPackets = 4 * 1024;
+            simulatorPacketBuffers = 0;
+            simulatorPacketBufferBytes = 1500;
+            simulatorSeed = 0;
+            serverReceiveBatchSize = 256;
+            serverSendBatchSize = 256;
+            serverSendBatchBytes = 256 * 1024;
+            serverParallelSend = false;
+            serverParallelReceive = false;
+            serverSubmitQueueSize = 0;
+            serverParallelTransportSend = false;
+            trustedNetwork = false;
+            trustedMultipath = false;
+            trustedMultipathBalance = false;
+            trustedTimeout = 5.0f;
+            trustedResumeTime = 0.0f;
+            trustedPathMtuDiscovery = false;
+            serverUdpSendBufferSize = 256 * 1024;
+            serverUdpReceiveBufferSize = 256 * 1024;
+            serverSocketRegisteredIO = false;
+            serverSocketReusePort = false;
+            serverConnectRequestBudget = 32;
+            serverConnectRequestRate = 20.0f;
+            serverClientPacketRate = 0.0f;
+            serverClientByteRate = 0;
+            serverProbeBudget = 0;
+            serverSendPacingSlices = 1;
+            serverMaxClientGroups = 0;
+            serverSendInterval = 0.0f;
+            serverAdmissionMemoryHeadroom = 0;
+            serverAdmissionTickTime = 0.0f;
+            serverTickPhaseBudget = 0.0f;
+            serverOverloadTickTime = 0.0f;
+            serverOverloadTicks = 10;
+            serverRecoverTicks = 100;
+            serverRecoverFraction = 0.75f;
+            numServerOverloadSteps = SERVER_OVERLOAD_NUM_STEPS;
+            for ( int i = 0; i < SERVER_OVERLOAD_NUM_STEPS; ++i )
+                serverOverloadSteps[i] = i;
+            serverOverloadSendRate = 10.0f;
+            serverOverloadBudgetScale = 0.5f;
+            maxLoopbackPackets = 256;
+            sharedMemoryRingBytes = 1024 * 1024;
+            sharedMemoryTimeout = 5.0f;
+            checkMemory = false;
         }
     };
 
@@ -6,6 +6,7 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_connection.h"
+#include <math.h>
 
 namespace yojimbo
 {
@@ -13,13 +14,26 @@ namespace yojimbo
     {
         int numChannelEntries;
         ChannelPacketData * channelEntry;
+        ChannelPacketData * channelEntryScratch;
         MessageFactory * messageFactory;
+        Channel * const * channels;
+        bool missingBaseline;
+        bool hasExtendedAcks;
+        uint16_t extendedAckSequence;
+        uint32_t extendedAcks[MaxExtendedAckBits/32];
+        bool serializeChecks;
 
-        ConnectionPacket()
+        explicit ConnectionPacket( ChannelPacketData * _channelEntryScratch = NULL, Channel * const * _channels = NULL )
         {
             messageFactory = NULL;
             numChannelEntries = 0;
             channelEntry = NULL;
+            channelEntryScratch = _channelEntryScratch;
+            channels = _channels;
+            missingBaseline = false;
+            hasExtendedAcks = false;
+            extendedAckSequence = 0;
+            serializeChecks = false;
         }
 
         ~ConnectionPacket()
@@ -30,7 +44,10 @@ namespace yojimbo
                 {
                     channelEntry[i].Free( *messageFactory );
                 }
-                YOJIMBO_FREE( messageFactory->GetAllocator(), channelEntry );
+                if ( channelEntry != channelEntryScratch )
+                {
+                    YOJIMBO_FREE( messageFactory->GetAllocator(), channelEntry );
+                }
                 messageFactory = NULL;
             }        
         }
@@ -40,10 +57,23 @@ namespace yojimbo
             yojimbo_assert( numEntries > 0 );
             yojimbo_assert( numEntries <= MaxChannels );
             messageFactory = &_messageFactory;
-            Allocator & allocator = messageFactory->GetAllocator();
-            channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
-            if ( channelEntry == NULL )
-                return false;
+            if ( channelEntryScratch )
+            {
+                // entries are owned by the connection, complete with their scratch memory
+
+                channelEntry = channelEntryScratch;
+            }
+            else
+            {
+                Allocator & allocator = messageFactory->GetAllocator();
+                channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
+                if ( channelEntry == NULL )
+                    return false;
+                for ( int i = 0; i < numEntries; ++i )
+                {
+                    channelEntry[i].SetScratch( NULL, NULL, NULL );
+                }
+            }
             for ( int i = 0; i < numEntries; ++i )
             {
                 channelEntry[i].Initialize();
@@ -55,10 +85,63 @@ namespace yojimbo
         template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig )
         {
             const int numChannels = connectionConfig.numChannels;
-            serialize_int( stream, numChannelEntries, 0, connectionConfig.numChannels );
+            const bool compactHeader = connectionConfig.compactPacketHeader;
+            int channelIndex[MaxChannels];
+            if ( compactHeader )
+            {
+                // a bitmask of the channels with an entry. entries follow in channel index order
+                uint32_t channelMask[MaxChannels/32+1];
+                memset( channelMask, 0, sizeof( channelMask ) );
+                if ( Stream::IsWriting )
+                {
+                    for ( int i = 0; i < numChannelEntries; ++i )
+                    {
+                        yojimbo_assert( i == 0 || channelEntry[i].channelIndex > channelEntry[i-1].channelIndex );
+                        channelMask[channelEntry[i].channelIndex/32] |= 1U << ( channelEntry[i].channelIndex % 32 );
+                    }
+                }
+                for ( int i = 0; i < numChannels; i += 32 )
+                {
+                    serialize_bits( stream, channelMask[i/32], yojimbo_min( numChannels - i, 32 ) );
+                }
+                if ( Stream::IsReading )
+                {
+                    numChannelEntries = 0;
+                    for ( int i = 0; i < numChannels; ++i )
+                    {
+                        if ( channelMask[i/32] & ( 1U << ( i % 32 ) ) )
+                            channelIndex[numChannelEntries++] = i;
+                    }
+                }
+            }
+            else
+            {
+                serialize_int( stream, numChannelEntries, 0, connectionConfig.numChannels );
 #if YOJIMBO_DEBUG_MESSAGE_BUDGET
-            yojimbo_assert( stream.GetBitsProcessed() <= ConservativeConnectionPacketHeaderEstimate );
+                yojimbo_assert( stream.GetBitsProcessed() <= ConservativeConnectionPacketHeaderEstimate );
 #endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
+            }
+            if ( connectionConfig.extendedAckBits > 0 )
+            {
+                // the most recent packet received, then a bit for it and each packet before it
+                serialize_bool( stream, hasExtendedAcks );
+                if ( hasExtendedAcks )
+                {
+                    serialize_bits( stream, extendedAckSequence, 16 );
+                    for ( int i = 0; i < connectionConfig.extendedAckBits / 32; ++i )
+                    {
+                        serialize_bits( stream, extendedAcks[i], 32 );
+                    }
+                }
+            }
+            if ( Stream::IsWriting )
+                serializeChecks = stream.GetSerializeChecks();
+            if ( connectionConfig.negotiateSerializeChecks )
+            {
+                // the rest of the packet has serialize checks if this is set. see ConnectionConfig::negotiateSerializeChecks
+                serialize_bool( stream, serializeChecks );
+                stream.SetSerializeChecks( serializeChecks );
+            }
             if ( numChannelEntries > 0 )
             {
                 if ( Stream::IsReading )
@@ -71,13 +154,20 @@ namespace yojimbo
                     for ( int i = 0; i < numChannelEntries; ++i )
                     {
                         yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
+                        if ( compactHeader )
+                            channelEntry[i].channelIndex = channelIndex[i];
                     }
                 }
                 for ( int i = 0; i < numChannelEntries; ++i )
                 {
                     yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
-                    if ( !channelEntry[i].SerializeInternal( stream, messageFactory, connectionConfig.channel, numChannels ) )
+                    if ( !channelEntry[i].SerializeInternal( stream, messageFactory, connectionConfig.channel, numChannels, channels, compactHeader ) )
                     {
+                        if ( channelEntry[i].missingBaseline )
+                        {
+                            missingBaseline = true;
+                            return false;
+                        }
                         yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize channel %d\n", i );
                         return false;
                     }
@@ -110,28 +200,189 @@ namespace yojimbo
 
     // ------------------------------------------------------------------------------
 
-    Connection::Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time ) : m_connectionConfig( connectionConfig )
+    static double GetBandwidthBurstBytes( const ConnectionConfig & connectionConfig )
+    {
+        return connectionConfig.bandwidthBurstBytes > 0 ? connectionConfig.bandwidthBurstBytes : connectionConfig.maxPacketSize;
+    }
+
+    Connection::Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time, bool sharedConfig )
+        : m_ownedConfig( sharedConfig ? NULL : YOJIMBO_NEW( allocator, ConnectionConfig, connectionConfig ) ),
+          m_connectionConfig( m_ownedConfig ? *m_ownedConfig : connectionConfig )
     {
         m_allocator = &allocator;
         m_messageFactory = &messageFactory;
         m_errorLevel = CONNECTION_ERROR_NONE;
+        m_packetScratch = NULL;
+        m_nextChannelIndex = 0;
+        m_time = time;
+        m_bandwidthTokens = GetBandwidthBurstBytes( m_connectionConfig );
+        m_adaptiveBandwidth = m_connectionConfig.bandwidthLimit;
+        m_lastNetworkConditionsTime = time;
+        m_lastBackoffTime = time;
+        m_minRtt = -1.0f;
+        m_lastRtt = 0.0f;
+        m_rttVariance = -1.0f;
+        m_hasScavengerChannels = false;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+            m_hasScavengerChannels = m_hasScavengerChannels || m_connectionConfig.channel[i].scavenger;
+        m_hasAutoTuneChannels = false;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+            m_hasAutoTuneChannels = m_hasAutoTuneChannels || m_connectionConfig.channel[i].autoTune;
+        m_lastAutoTuneTime = time;
+        m_autoTunePacketsGenerated = 0;
+        memset( m_autoTuneCounters, 0, sizeof( m_autoTuneCounters ) );
+        m_scavengerLimited = false;
+        m_scavengerBandwidth = m_connectionConfig.scavengerMinBandwidth;
+        m_scavengerTokens = m_connectionConfig.maxPacketSize;
+        m_lastScavengerBackoffTime = time;
+        m_lastPacketTime = time;
+        m_coalesceStartTime = -1.0;
+        m_pathPacketBytes = 0;
+        m_scavengerPaused = false;
+        m_unreliableBudgetScale = 1.0f;
+        m_acksPending = false;
+        m_memoryLow = false;
+        m_channelsWithMessages = 0;
+        m_channelsWithTimers = 0;
+        m_channelErrors = 0;
+        m_numPacketsGenerated = 0;
+        m_packetBytesGenerated = 0;
+        m_packetBytesCapacity = 0;
+        m_numPacketsProcessed = 0;
+        m_packetBytesProcessed = 0;
+        m_generatePacketTime = 0.0;
+        m_processPacketTime = 0.0;
+        yojimbo_assert( m_connectionConfig.memoryWatermark >= 0 );
+        yojimbo_assert( m_connectionConfig.slidingWindowSize > 0 && m_connectionConfig.slidingWindowSize <= MaxSequenceWindow );
+        yojimbo_assert( !m_connectionConfig.adaptiveBandwidth || m_connectionConfig.bandwidthLimit > 0 );
+        yojimbo_assert( !m_hasScavengerChannels || ( m_connectionConfig.scavengerTargetDelay > 0.0f && m_connectionConfig.scavengerMinBandwidth > 0 ) );
+        yojimbo_assert( !m_hasAutoTuneChannels || m_connectionConfig.autoTuneInterval > 0.0f );
         memset( m_channel, 0, sizeof( m_channel ) );
+        memset( m_channelDeficit, 0, sizeof( m_channelDeficit ) );
+        memset( m_sendChannelData, 0, sizeof( m_sendChannelData ) );
+        memset( m_receivePacketEntries, 0, sizeof( m_receivePacketEntries ) );
+        m_frameAllocator = NULL;
+        if ( m_connectionConfig.frameAllocatorBytes > 0 )
+            m_frameAllocator = YOJIMBO_NEW( *m_allocator, FrameAllocator, *m_allocator, size_t( m_connectionConfig.frameAllocatorBytes ) );
+        m_sendStringTable = NULL;
+        m_receiveStringTable = NULL;
+        m_sentPacketAcked = NULL;
+        m_receivedPackets = NULL;
+        m_processedPackets = NULL;
+        m_numDuplicatePackets = 0;
+        m_lastPacketUrgent = false;
+        if ( m_connectionConfig.dropDuplicatePackets )
+            m_processedPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<uint8_t>, *m_allocator, m_connectionConfig.slidingWindowSize );
+        m_packetsSinceExtendedAcks = 0;
+        m_remoteSerializeChecks = false;
+        yojimbo_assert( m_connectionConfig.extendedAckBits >= 0 );
+        yojimbo_assert( m_connectionConfig.extendedAckBits <= MaxExtendedAckBits );
+        yojimbo_assert( m_connectionConfig.extendedAckBits <= m_connectionConfig.slidingWindowSize );
+        yojimbo_assert( ( m_connectionConfig.extendedAckBits % 32 ) == 0 );
+        if ( m_connectionConfig.extendedAckBits > 0 )
+        {
+            yojimbo_assert( m_connectionConfig.extendedAckInterval >= 1 );
+            m_sentPacketAcked = YOJIMBO_NEW( *m_allocator, SequenceBuffer<uint8_t>, *m_allocator, m_connectionConfig.slidingWindowSize );
+            m_receivedPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<uint8_t>, *m_allocator, m_connectionConfig.extendedAckBits );
+        }
+        yojimbo_assert( m_connectionConfig.stringTableSize >= 0 );
+        yojimbo_assert( m_connectionConfig.stringTableSize <= MaxStringTableSize );
+        if ( m_connectionConfig.stringTableSize > 0 )
+        {
+            m_sendStringTable = YOJIMBO_NEW( *m_allocator, StringTable, *m_allocator, m_connectionConfig.stringTableSize, m_connectionConfig.slidingWindowSize );
+            m_receiveStringTable = YOJIMBO_NEW( *m_allocator, StringTable, *m_allocator, m_connectionConfig.stringTableSize, m_connectionConfig.slidingWindowSize );
+        }
         yojimbo_assert( m_connectionConfig.numChannels >= 1 );
         yojimbo_assert( m_connectionConfig.numChannels <= MaxChannels );
         for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
         {
+            yojimbo_assert( m_connectionConfig.channel[channelIndex].weight >= 1 );
+            if ( m_connectionConfig.channel[channelIndex].autoTune )
+            {
+                const ChannelConfig & channelConfig = m_connectionConfig.channel[channelIndex];
+                yojimbo_assert( channelConfig.autoTuneMinPacketBudget > 0 );
+                yojimbo_assert( channelConfig.packetBudget <= 0 || channelConfig.autoTuneMinPacketBudget <= channelConfig.packetBudget );
+                yojimbo_assert( channelConfig.autoTuneMinMessagesPerPacket >= 1 && channelConfig.autoTuneMinMessagesPerPacket <= channelConfig.maxMessagesPerPacket );
+                (void) channelConfig;
+            }
             switch ( m_connectionConfig.channel[channelIndex].type )
             {
                 case CHANNEL_TYPE_RELIABLE_ORDERED: 
-                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, ReliableOrderedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, time ); 
+                case CHANNEL_TYPE_RELIABLE_UNORDERED: 
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, ReliableOrderedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, m_time ); 
                     break;
 
                 case CHANNEL_TYPE_UNRELIABLE_UNORDERED: 
-                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, UnreliableUnorderedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, time ); 
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, UnreliableUnorderedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, m_time ); 
+                    break;
+
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED: 
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, UnreliableSequencedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, m_time ); 
+                    break;
+
+                case CHANNEL_TYPE_SNAPSHOT: 
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, SnapshotChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelIndex], channelIndex, m_time ); 
                     break;
                 default: 
                     yojimbo_assert( !"unknown channel type" );
             }
+            m_channel[channelIndex]->SetErrorMask( &m_channelErrors );
+            if ( m_channel[channelIndex]->HasTimers() )
+                m_channelsWithTimers |= uint64_t(1) << channelIndex;
+        }
+
+        /*
+            Preallocate the scratch memory for packet generation and processing, sized for the largest channel.
+
+            Every channel slot gets its own message and fragment arrays, because entries for several channels live in the same packet.
+            Receive entries can hold any channel, so each receive slot is sized for the largest channel too. Send fragments point 
+            straight into the block being sent, so only the receive side needs fragment data scratch.
+         */
+
+        const int numChannels = m_connectionConfig.numChannels;
+
+        int maxMessagesPerPacket = 1;
+        int maxFragmentsPerPacket = 0;
+        int maxFragmentBytesPerPacket = 0;
+
+        for ( int channelIndex = 0; channelIndex < numChannels; ++channelIndex )
+        {
+            const ChannelConfig & channelConfig = m_connectionConfig.channel[channelIndex];
+
+            maxMessagesPerPacket = yojimbo_max( maxMessagesPerPacket, channelConfig.maxMessagesPerPacket );
+
+            if ( ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED || channelConfig.type == CHANNEL_TYPE_RELIABLE_UNORDERED ) && !channelConfig.disableBlocks )
+            {
+                maxFragmentsPerPacket = yojimbo_max( maxFragmentsPerPacket, channelConfig.maxFragmentsPerPacket );
+                maxFragmentBytesPerPacket = yojimbo_max( maxFragmentBytesPerPacket, channelConfig.maxFragmentsPerPacket * channelConfig.fragmentSize );
+            }
+        }
+
+        const int messageScratchBytes = sizeof( Message* ) * maxMessagesPerPacket;
+        const int fragmentScratchBytes = sizeof( ChannelPacketData::BlockFragmentData ) * maxFragmentsPerPacket;
+        const int numSlots = numChannels * 2;
+
+        m_packetScratch = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, numSlots * ( messageScratchBytes + fragmentScratchBytes ) + numChannels * maxFragmentBytesPerPacket );
+
+        if ( !m_packetScratch )
+        {
+            // not fatal: channel packet data falls back to allocating per-packet
+            return;
+        }
+
+        uint8_t * messageScratch = m_packetScratch;
+        uint8_t * fragmentScratch = messageScratch + numSlots * messageScratchBytes;
+        uint8_t * fragmentDataScratch = fragmentScratch + numSlots * fragmentScratchBytes;
+
+        for ( int i = 0; i < numChannels; ++i )
+        {
+            m_sendChannelData[i].SetScratch( (Message**) ( messageScratch + i * messageScratchBytes ),
+                                             maxFragmentsPerPacket ? (ChannelPacketData::BlockFragmentData*) ( fragmentScratch + i * fragmentScratchBytes ) : NULL,
+                                             NULL );
+
+            m_receivePacketEntries[i].SetScratch( (Message**) ( messageScratch + ( numChannels + i ) * messageScratchBytes ),
+                                                  maxFragmentsPerPacket ? (ChannelPacketData::BlockFragmentData*) ( fragmentScratch + ( numChannels + i ) * fragmentScratchBytes ) : NULL,
+                                                  maxFragmentBytesPerPacket ? fragmentDataScratch + i * maxFragmentBytesPerPacket : NULL );
         }
     }
 
@@ -143,25 +394,94 @@ namespace yojimbo
         {
             YOJIMBO_DELETE( *m_allocator, Channel, m_channel[i] );
         }
+        YOJIMBO_FREE( *m_allocator, m_packetScratch );
+        YOJIMBO_DELETE( *m_allocator, FrameAllocator, m_frameAllocator );
+        YOJIMBO_DELETE( *m_allocator, StringTable, m_sendStringTable );
+        YOJIMBO_DELETE( *m_allocator, StringTable, m_receiveStringTable );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<uint8_t>, m_sentPacketAcked );
+        YOJIMBO_DELETE( *m_allocator, ConnectionConfig, m_ownedConfig );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<uint8_t>, m_receivedPackets );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<uint8_t>, m_processedPackets );
         m_allocator = NULL;
     }
 
     void Connection::Reset()
     {
         m_errorLevel = CONNECTION_ERROR_NONE;
+        m_nextChannelIndex = 0;
+        m_bandwidthTokens = GetBandwidthBurstBytes( m_connectionConfig );
+        m_adaptiveBandwidth = m_connectionConfig.bandwidthLimit;
+        m_lastNetworkConditionsTime = m_time;
+        m_lastBackoffTime = m_time;
+        m_minRtt = -1.0f;
+        m_lastRtt = 0.0f;
+        m_rttVariance = -1.0f;
+        m_scavengerLimited = false;
+        m_scavengerBandwidth = m_connectionConfig.scavengerMinBandwidth;
+        m_scavengerTokens = m_connectionConfig.maxPacketSize;
+        m_lastScavengerBackoffTime = m_time;
+        m_lastAutoTuneTime = m_time;
+        m_autoTunePacketsGenerated = 0;
+        memset( m_autoTuneCounters, 0, sizeof( m_autoTuneCounters ) );
+        m_lastPacketTime = m_time;
+        m_coalesceStartTime = -1.0;
+        m_pathPacketBytes = 0;
+        m_scavengerPaused = false;
+        m_unreliableBudgetScale = 1.0f;
+        m_acksPending = false;
+        m_memoryLow = false;
+        m_channelsWithMessages = 0;
+        m_numPacketsGenerated = 0;
+        m_packetBytesGenerated = 0;
+        m_packetBytesCapacity = 0;
+        m_numPacketsProcessed = 0;
+        m_packetBytesProcessed = 0;
+        m_generatePacketTime = 0.0;
+        m_processPacketTime = 0.0;
+        memset( m_channelDeficit, 0, sizeof( m_channelDeficit ) );
         for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
         {
             m_channel[i]->Reset();
         }
+        if ( m_sendStringTable )
+            m_sendStringTable->Reset();
+        if ( m_receiveStringTable )
+            m_receiveStringTable->Reset();
+        if ( m_sentPacketAcked )
+            m_sentPacketAcked->Reset();
+        if ( m_receivedPackets )
+            m_receivedPackets->Reset();
+        if ( m_processedPackets )
+            m_processedPackets->Reset();
+        m_numDuplicatePackets = 0;
+        m_lastPacketUrgent = false;
+        m_packetsSinceExtendedAcks = 0;
+        m_remoteSerializeChecks = false;
     }
 
     bool Connection::CanSendMessage( int channelIndex ) const
     {
         yojimbo_assert( channelIndex >= 0 );
         yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        if ( IsMemoryLow() )
+            return false;
         return m_channel[channelIndex]->CanSendMessage();
     }
 
+    bool Connection::IsMemoryLow() const
+    {
+        return m_connectionConfig.memoryWatermark > 0 && m_allocator->GetBytesAllocated() > size_t( m_connectionConfig.memoryWatermark );
+    }
+
+    bool Connection::UpdateMemoryLow()
+    {
+        const bool memoryLow = IsMemoryLow();
+        if ( memoryLow == m_memoryLow )
+            return false;
+        m_memoryLow = memoryLow;
+        return true;
+    }
+
     void Connection::SendMessage( int channelIndex, Message * message )
     {
         yojimbo_assert( channelIndex >= 0 );
@@ -169,11 +489,61 @@ namespace yojimbo
         return m_channel[channelIndex]->SendMessage( message );
     }
 
+    int Connection::SendMessages( int channelIndex, Message ** messages, int numMessages )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        if ( IsMemoryLow() )
+            return 0;
+        return m_channel[channelIndex]->SendMessages( messages, numMessages );
+    }
+
     Message * Connection::ReceiveMessage( int channelIndex )
     {
         yojimbo_assert( channelIndex >= 0 );
         yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
-        return m_channel[channelIndex]->ReceiveMessage();
+        Message * message = m_channel[channelIndex]->ReceiveMessage();
+        if ( !message )
+            m_channelsWithMessages &= ~( uint64_t(1) << channelIndex );
+        return message;
+    }
+
+    int Connection::ReceiveMessages( int channelIndex, Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        const int numReceived = m_channel[channelIndex]->ReceiveMessages( messages, maxMessages );
+        if ( numReceived < maxMessages )
+            m_channelsWithMessages &= ~( uint64_t(1) << channelIndex );
+        return numReceived;
+    }
+
+    bool Connection::GetReceivedBlockPrefix( int channelIndex, const uint8_t * & blockData, int & blockBytes ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->GetReceivedBlockPrefix( blockData, blockBytes );
+    }
+
+    const LatencyHistogram * Connection::GetLatencyHistogram( int channelIndex, int index ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->GetLatencyHistogram( index );
+    }
+
+    void Connection::SetChannelLimits( int channelIndex, const ChannelLimits & limits )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        m_channel[channelIndex]->SetLimits( limits );
+    }
+
+    const ChannelLimits & Connection::GetChannelLimits( int channelIndex ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->GetLimits();
     }
 
     void Connection::ReleaseMessage( Message * message )
@@ -182,110 +552,387 @@ namespace yojimbo
         m_messageFactory->ReleaseMessage( message );
     }
 
-    static int WritePacket( void * context, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, ConnectionPacket & packet, uint8_t * buffer, int bufferSize )
+    void Connection::ReleaseMessages( Message ** messages, int numMessages )
+    {
+        yojimbo_assert( messages || numMessages == 0 );
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            yojimbo_assert( messages[i] );
+            m_messageFactory->ReleaseMessage( messages[i] );
+        }
+    }
+
+    /// Adds the time until the end of the scope to a connection's packet time. See ConnectionStats::generatePacketTime.
+
+    struct ConnectionPacketTimer
     {
-        WriteStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
+        double & totalTime;
+        double startTime;
 
-        stream.SetContext( context );
+        explicit ConnectionPacketTimer( double & _totalTime ) : totalTime( _totalTime ), startTime( yojimbo_time() ) {}
 
-        if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
+        ~ConnectionPacketTimer() { totalTime += yojimbo_time() - startTime; }
+    };
+
+    void Connection::SetPathPacketBytes( int bytes )
+    {
+        yojimbo_assert( bytes >= 0 );
+        if ( bytes == 0 )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (write packet)\n" );
-            return 0;
+            m_pathPacketBytes = 0;
+            return;
         }
-
-#if YOJIMBO_SERIALIZE_CHECKS
-        if ( !stream.SerializeCheck() )
+        // a channel holds on to a fragment until a packet has room for all of it, so the limit has to leave room for the largest fragment next to the packet header
+        int minBits = 0;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check at end of connection packed failed (write packet)\n" );
-            return 0;
+            const ChannelConfig & channelConfig = m_connectionConfig.channel[i];
+            if ( channelConfig.disableBlocks )
+                continue;
+            const int fragmentBits = channelConfig.fragmentSize * 8 + ConservativeMessageHeaderEstimate + ConservativeFragmentHeaderEstimate;
+            minBits = yojimbo_max( minBits, fragmentBits );
         }
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
-
-        stream.Flush();
-
-        return stream.GetBytesProcessed();
+        // on top of the header estimate: the channel entry count or mask, the extended acks with their flag and sequence, and the serialize checks flag and reserved bits
+        if ( minBits > 0 )
+            minBits += ConservativeConnectionPacketHeaderEstimate + m_connectionConfig.numChannels + 17 + m_connectionConfig.extendedAckBits + 1 + 7 + 32;
+        const int minBytes = ( ( minBits + 7 ) / 8 + 3 ) & ~3;
+        m_pathPacketBytes = yojimbo_max( bytes & ~3, minBytes );
     }
 
     bool Connection::GeneratePacket( void * context, uint16_t packetSequence, uint8_t * packetData, int maxPacketBytes, int & packetBytes )
     {
-        ConnectionPacket packet;
+        YOJIMBO_PROFILE_SCOPE( "Connection::GeneratePacket" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Connection::GeneratePacket" );
+        ConnectionPacketTimer packetTimer( m_generatePacketTime );
+        /*
+            Channel data is written straight into the packet in a single pass. Each channel is offered space in the packet, and if 
+            what it returns doesn't fit after all, it is rolled back out of the packet and discarded by the channel.
+
+            Packet space is shared between channels with data to send by deficit round robin. Every packet, each busy channel is 
+            credited its weighted share of the packet, and is charged for the bits it actually writes. Channels are visited in rotating 
+            order, and each is offered whatever is left once the credit of the busy channels visited after it has been set aside. 
+            This way a busy channel can't starve the others, and space that one channel doesn't use flows to the rest.
+         */
 
-        if ( m_connectionConfig.numChannels > 0 )
+        packetBytes = 0;
+
+        m_lastPacketUrgent = false;
+
+        // Hold the packet back while the only new data is a few small messages, so the next ones sent can join them. The delay is bounded, so latency stays bounded too.
+
+        if ( m_connectionConfig.coalesceTime > 0.0f )
         {
-            int numChannelsWithData = 0;
-            bool channelHasData[MaxChannels];
-            memset( channelHasData, 0, sizeof( channelHasData ) );
-            ChannelPacketData channelData[MaxChannels];
-            
-            int availableBits = maxPacketBytes * 8 - ConservativeConnectionPacketHeaderEstimate;
-            
-            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+            const int coalesceBits = GetCoalesceBits();
+            if ( coalesceBits > 0 && coalesceBits < m_connectionConfig.coalesceBytes * 8 )
             {
-                int packetDataBits = m_channel[channelIndex]->GetPacketData( channelData[channelIndex], packetSequence, availableBits );
-                if ( packetDataBits > 0 )
-                {
-                    availableBits -= ConservativeChannelHeaderEstimate;
-                    availableBits -= packetDataBits;
-                    channelHasData[channelIndex] = true;
-                    numChannelsWithData++;
-                }
+                if ( m_coalesceStartTime < 0.0 )
+                    m_coalesceStartTime = m_time;
+                if ( m_time - m_coalesceStartTime < m_connectionConfig.coalesceTime )
+                    return false;
             }
+        }
+
+        if ( m_pathPacketBytes > 0 && maxPacketBytes > m_pathPacketBytes )
+            maxPacketBytes = m_pathPacketBytes;
+
+        WriteStream stream( m_frameAllocator ? *m_frameAllocator : m_messageFactory->GetAllocator(), packetData, maxPacketBytes );
+
+        stream.SetContext( context );
+
+        stream.SetSerializeChecks( GetSerializeChecks() );
+
+        stream.SetStringTable( m_sendStringTable );
 
-            if ( numChannelsWithData > 0 )
+        if ( m_sendStringTable )
+            m_sendStringTable->BeginPacket( packetSequence );
+
+        const int numChannels = m_connectionConfig.numChannels;
+
+        // The number of channel entries isn't known until every channel has been asked for data, so write it now and patch it at the end.
+        // With a compact header this is a bitmask of the channels with an entry instead, written at the start of the packet so each 32 bit chunk patches within one word.
+
+        const bool compactHeader = m_connectionConfig.compactPacketHeader;
+
+        const int numChannelEntriesBitIndex = stream.GetBitsProcessed();
+
+        int numChannelEntries = 0;
+
+        uint32_t channelMask[MaxChannels/32+1];
+
+        memset( channelMask, 0, sizeof( channelMask ) );
+
+        if ( compactHeader )
+        {
+            yojimbo_assert( numChannelEntriesBitIndex == 0 );
+            for ( int i = 0; i < numChannels; i += 32 )
             {
-                if ( !packet.AllocateChannelData( *m_messageFactory, numChannelsWithData ) )
+                if ( !stream.SerializeBits( 0, yojimbo_min( numChannels - i, 32 ) ) )
                 {
-                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate channel data\n" );
-                    return false;
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (generate packet)\n" );
+                    return true;
                 }
+            }
+        }
+        else if ( !stream.SerializeInteger( numChannelEntries, 0, numChannels ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (generate packet)\n" );
+            return true;
+        }
 
-                int index = 0;
+        const bool extendedAcks = m_receivedPackets && m_packetsSinceExtendedAcks + 1 >= m_connectionConfig.extendedAckInterval;
 
-                for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+        if ( m_receivedPackets )
+        {
+            bool failed = !stream.SerializeBits( extendedAcks ? 1 : 0, 1 );
+            if ( extendedAcks )
+            {
+                const uint16_t sequence = m_receivedPackets->GetSequence() - 1;
+                failed = failed || !stream.SerializeBits( sequence, 16 );
+                for ( int i = 0; i < m_connectionConfig.extendedAckBits; i += 32 )
                 {
-                    if ( channelHasData[channelIndex] )
+                    uint32_t received = 0;
+                    for ( int j = 0; j < 32; ++j )
                     {
-                        memcpy( &packet.channelEntry[index], &channelData[channelIndex], sizeof( ChannelPacketData ) );
-                        index++;
+                        if ( m_receivedPackets->Exists( uint16_t( sequence - i - j ) ) )
+                            received |= 1U << j;
                     }
+                    failed = failed || !stream.SerializeBits( received, 32 );
                 }
             }
+            if ( failed )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (generate packet)\n" );
+                return true;
+            }
+        }
+
+        if ( m_connectionConfig.negotiateSerializeChecks && !stream.SerializeBits( stream.GetSerializeChecks() ? 1 : 0, 1 ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (generate packet)\n" );
+            return true;
+        }
+
+        const int reservedBits = stream.GetSerializeChecks() ? 7 + 32 : 0;
+
+        // With a bandwidth limit, channels may only write as much as the token bucket holds. The packet header always goes out.
+
+        int bandwidthBits = stream.GetBitsAvailable();
+
+        if ( m_connectionConfig.bandwidthLimit > 0 )
+            bandwidthBits = yojimbo_max( 0, (int) ( m_bandwidthTokens * 8 ) - stream.GetBitsProcessed() - reservedBits );
+
+        const int channelsStartBits = stream.GetBitsProcessed();
+
+        const int packetBits = yojimbo_min( stream.GetBitsAvailable() - reservedBits, bandwidthBits );
+
+        int numBusyChannels = 0;
+        int busyChannels[MaxChannels];
+        int numScavengerChannels = 0;
+        int scavengerChannels[MaxChannels];
+        int totalWeight = 0;
+
+        for ( int i = 0; i < numChannels; ++i )
+        {
+            // compact headers imply the order of entries from the channel mask, so channels are visited in index order
+
+            const int channelIndex = compactHeader ? i : ( m_nextChannelIndex + i ) % numChannels;
+
+            if ( !m_channel[channelIndex]->HasDataToSend() || ( m_scavengerPaused && m_connectionConfig.channel[channelIndex].scavenger ) )
+            {
+                m_channelDeficit[channelIndex] = 0;
+            }
+            else if ( !m_connectionConfig.channel[channelIndex].scavenger )
+            {
+                busyChannels[numBusyChannels++] = channelIndex;
+                totalWeight += m_connectionConfig.channel[channelIndex].weight;
+            }
+            else if ( compactHeader )
+            {
+                busyChannels[numBusyChannels++] = channelIndex;
+            }
+            else
+            {
+                scavengerChannels[numScavengerChannels++] = channelIndex;
+            }
+        }
+
+        // scavenger channels go last, so they only get the space the other channels leave over
+
+        for ( int i = 0; i < numScavengerChannels; ++i )
+            busyChannels[numBusyChannels++] = scavengerChannels[i];
+
+        m_nextChannelIndex = ( m_nextChannelIndex + 1 ) % numChannels;
+
+        int reservedChannelBits = 0;
+
+        for ( int i = 0; i < numBusyChannels; ++i )
+        {
+            const int channelIndex = busyChannels[i];
+            if ( m_connectionConfig.channel[channelIndex].scavenger )
+                continue;
+            const int quantum = (int) ( int64_t( packetBits ) * m_connectionConfig.channel[channelIndex].weight / totalWeight );
+            m_channelDeficit[channelIndex] = yojimbo_min( m_channelDeficit[channelIndex] + quantum, packetBits );
+            reservedChannelBits += m_channelDeficit[channelIndex];
+        }
+
+        for ( int i = 0; i < numBusyChannels; ++i )
+        {
+            const int channelIndex = busyChannels[i];
+
+            reservedChannelBits -= m_channelDeficit[channelIndex];
+
+            const int remainingBits = yojimbo_min( stream.GetBitsAvailable() - reservedBits, bandwidthBits - ( stream.GetBitsProcessed() - channelsStartBits ) );
+
+            int availableBits = yojimbo_max( yojimbo_min( m_channelDeficit[channelIndex], remainingBits ), remainingBits - reservedChannelBits );
+
+            if ( m_connectionConfig.channel[channelIndex].scavenger )
+            {
+                const int spareBits = remainingBits - reservedChannelBits;
+                const int scavengerBits = (int) ( m_scavengerTokens * 8 );
+                if ( scavengerBits < spareBits )
+                    m_scavengerLimited = true;
+                availableBits = yojimbo_min( spareBits, scavengerBits );
+            }
+
+            if ( m_unreliableBudgetScale < 1.0f && ( m_connectionConfig.channel[channelIndex].type == CHANNEL_TYPE_UNRELIABLE_UNORDERED || m_connectionConfig.channel[channelIndex].type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED ) )
+            {
+                const int packetBudget = m_channel[channelIndex]->GetLimits().packetBudget;
+                const int budgetBits = packetBudget > 0 ? packetBudget * 8 : packetBits;
+                availableBits = yojimbo_min( availableBits, (int) ( budgetBits * m_unreliableBudgetScale ) );
+            }
+
+            if ( availableBits <= 0 )
+                continue;
+
+            ChannelPacketData & channelData = m_sendChannelData[channelIndex];
+
+            if ( m_channel[channelIndex]->GetPacketData( channelData, packetSequence, availableBits ) <= 0 )
+            {
+                // nothing could be sent right now, so the channel doesn't carry credit forward
+                m_channelDeficit[channelIndex] = 0;
+                continue;
+            }
+
+            const int channelStartBits = stream.GetBitsProcessed();
+
+            const WriteStream::Checkpoint checkpoint = stream.GetCheckpoint();
+
+            const int numStringDefinitions = m_sendStringTable ? m_sendStringTable->GetNumDefinitions() : 0;
+
+            const bool result = channelData.SerializeInternal( stream, *m_messageFactory, m_connectionConfig.channel, numChannels, NULL, compactHeader );
+
+            if ( !result || stream.IsOverflow() || channelData.messageFailedToSerialize )
+            {
+                stream.Rollback( checkpoint );
+                if ( m_sendStringTable )
+                    m_sendStringTable->RollbackDefinitions( numStringDefinitions );
+                m_channel[channelIndex]->DiscardPacketData( packetSequence );
+            }
+            else
+            {
+                const int channelBits = stream.GetBitsProcessed() - channelStartBits;
+                m_channelDeficit[channelIndex] = yojimbo_max( m_channelDeficit[channelIndex] - channelBits, 0 );
+                if ( m_connectionConfig.channel[channelIndex].scavenger )
+                    m_scavengerTokens -= channelBits / 8.0;
+                m_channel[channelIndex]->AddCounter( CHANNEL_COUNTER_PACKETS_SENT, 1 );
+                m_channel[channelIndex]->AddCounter( CHANNEL_COUNTER_BITS_SENT, channelBits );
+                if ( !channelData.blockMessage )
+                    m_channel[channelIndex]->AddCounter( CHANNEL_COUNTER_MESSAGES_PACKED, channelData.message.numMessages );
+                channelMask[channelIndex/32] |= 1U << ( channelIndex % 32 );
+                numChannelEntries++;
+                if ( m_connectionConfig.channel[channelIndex].urgent )
+                    m_lastPacketUrgent = true;
+            }
+
+            channelData.Free( *m_messageFactory );
         }
 
-        packetBytes = WritePacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, maxPacketBytes );
+        // Header-only packets exist just to carry acks. Skip them unless the peer is waiting on an ack, or the connection has been quiet too long.
+        // Received header-only packets don't set m_acksPending, otherwise two idle peers would keep acking each other's acks.
+
+        if ( m_connectionConfig.suppressIdlePackets && numChannelEntries == 0 && !m_acksPending && m_time - m_lastPacketTime < m_connectionConfig.idlePacketInterval )
+            return false;
+
+        if ( compactHeader )
+        {
+            for ( int i = 0; i < numChannels; i += 32 )
+            {
+                stream.PatchBits( numChannelEntriesBitIndex + i, channelMask[i/32], yojimbo_min( numChannels - i, 32 ) );
+            }
+        }
+        else
+        {
+            stream.PatchInteger( numChannelEntriesBitIndex, numChannelEntries, 0, numChannels );
+        }
+
+        if ( !stream.SerializeCheck() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check at end of connection packed failed (generate packet)\n" );
+            return true;
+        }
+
+        stream.Flush();
+
+        packetBytes = stream.GetBytesProcessed();
+
+        m_numPacketsGenerated++;
+        m_packetBytesGenerated += packetBytes;
+        m_packetBytesCapacity += maxPacketBytes;
+
+        if ( m_connectionConfig.bandwidthLimit > 0 )
+            m_bandwidthTokens -= packetBytes;
+
+        m_lastPacketTime = m_time;
+        m_coalesceStartTime = -1.0;
+        m_acksPending = false;
+
+        if ( m_sentPacketAcked )
+        {
+            uint8_t * acked = m_sentPacketAcked->Insert( packetSequence );
+            if ( acked )
+                *acked = 0;
+            m_packetsSinceExtendedAcks = extendedAcks ? 0 : m_packetsSinceExtendedAcks + 1;
+        }
 
         return true;
     }
 
-    static bool ReadPacket( void * context, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, ConnectionPacket & packet, const uint8_t * buffer, int bufferSize )
+    static bool ReadPacket( void * context, Allocator & streamAllocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, StringTable * stringTable, ConnectionPacket & packet, const uint8_t * buffer, int bufferSize )
     {
         yojimbo_assert( buffer );
         yojimbo_assert( bufferSize > 0 );
 
-        ReadStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
+        ReadStream stream( streamAllocator, buffer, bufferSize );
 
         stream.SetContext( context );
 
+        stream.SetStringTable( stringTable );
+
+        stream.SetSerializeChecks( connectionConfig.serializeChecks );
+
         if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (read packet)\n" );
+            if ( !packet.missingBaseline )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (read packet)\n" );
             return false;
         }
 
-#if YOJIMBO_SERIALIZE_CHECKS
         if ( !stream.SerializeCheck() )
         {
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check failed at end of connection packet (read packet)\n" );
             return false;
         }
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
 
         return true;
     }
 
     bool Connection::ProcessPacket( void * context, uint16_t packetSequence, const uint8_t * packetData, int packetBytes )
     {
+        YOJIMBO_PROFILE_SCOPE( "Connection::ProcessPacket" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Connection::ProcessPacket" );
+        ConnectionPacketTimer packetTimer( m_processPacketTime );
+        m_numPacketsProcessed++;
+        m_packetBytesProcessed += packetBytes;
         if ( m_errorLevel != CONNECTION_ERROR_NONE )
         {
             // todo
@@ -293,15 +940,36 @@ namespace yojimbo
             return false;
         }
 
-        ConnectionPacket packet;
+        // a duplicate is still reported as processed, so it is acked like the first copy
+
+        if ( m_processedPackets && m_processedPackets->Exists( packetSequence ) )
+        {
+            m_numDuplicatePackets++;
+            return true;
+        }
+
+        ConnectionPacket packet( m_receivePacketEntries, m_channel );
 
-        if ( !ReadPacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, packetBytes ) )
+        if ( !ReadPacket( context, m_frameAllocator ? *m_frameAllocator : m_messageFactory->GetAllocator(), *m_messageFactory, m_connectionConfig, m_receiveStringTable, packet, packetData, packetBytes ) )
         {
+            if ( packet.missingBaseline )
+            {
+                // not an error: the packet is dropped without being acked, so the sender moves on to a baseline we still have
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "snapshot baseline not found. dropping packet %d\n", packetSequence );
+                return false;
+            }
+
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to read packet\n" );
             m_errorLevel = CONNECTION_ERROR_READ_PACKET_FAILED;
             return false;            
         }
 
+        if ( m_connectionConfig.negotiateSerializeChecks )
+            m_remoteSerializeChecks = packet.serializeChecks;
+
+        if ( packet.hasExtendedAcks )
+            ProcessExtendedAcks( packet.extendedAckSequence, packet.extendedAcks );
+
         for ( int i = 0; i < packet.numChannelEntries; ++i )
         {
             const int channelIndex = packet.channelEntry[i].channelIndex;
@@ -314,6 +982,25 @@ namespace yojimbo
                 //printf( "process packet failed: channel error level\n" );
                 return false;
             }
+            if ( m_channel[channelIndex]->GetReceiveQueueDepth() > 0 )
+                m_channelsWithMessages |= uint64_t(1) << channelIndex;
+        }
+
+        if ( packet.numChannelEntries > 0 )
+            m_acksPending = true;
+
+        if ( m_receivedPackets )
+        {
+            uint8_t * received = m_receivedPackets->Insert( packetSequence );
+            if ( received )
+                *received = 1;
+        }
+
+        if ( m_processedPackets )
+        {
+            uint8_t * processed = m_processedPackets->Insert( packetSequence );
+            if ( processed )
+                *processed = 1;
         }
 
         return true;
@@ -321,36 +1008,397 @@ namespace yojimbo
 
     void Connection::ProcessAcks( const uint16_t * acks, int numAcks )
     {
+        if ( !m_sentPacketAcked )
+        {
+            ProcessAcksInternal( acks, numAcks );
+            return;
+        }
+
+        // with extended acks, a packet can be acked twice. only pass on the first ack for each packet
+
+        uint16_t newAcks[256];
+        int numNewAcks = 0;
         for ( int i = 0; i < numAcks; ++i )
         {
-            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+            uint8_t * acked = m_sentPacketAcked->Find( acks[i] );
+            if ( !acked || *acked )
+                continue;
+            *acked = 1;
+            newAcks[numNewAcks++] = acks[i];
+            if ( numNewAcks == 256 )
             {
-                m_channel[channelIndex]->ProcessAck( acks[i] );
+                ProcessAcksInternal( newAcks, numNewAcks );
+                numNewAcks = 0;
             }
         }
+        ProcessAcksInternal( newAcks, numNewAcks );
     }
 
-    void Connection::AdvanceTime( double time )
+    void Connection::ProcessExtendedAcks( uint16_t sequence, const uint32_t * received )
     {
+        yojimbo_assert( m_sentPacketAcked );
+        uint16_t acks[MaxExtendedAckBits];
+        int numAcks = 0;
+        for ( int i = 0; i < m_connectionConfig.extendedAckBits; ++i )
+        {
+            if ( ( received[i/32] & ( 1U << ( i % 32 ) ) ) == 0 )
+                continue;
+            const uint16_t ack = uint16_t( sequence - i );
+            uint8_t * acked = m_sentPacketAcked->Find( ack );
+            if ( !acked || *acked )
+                continue;
+            *acked = 1;
+            acks[numAcks++] = ack;
+        }
+        ProcessAcksInternal( acks, numAcks );
+    }
+
+    void Connection::ProcessAcksInternal( const uint16_t * acks, int numAcks )
+    {
+        if ( numAcks == 0 )
+            return;
+
+        for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+        {
+            m_channel[channelIndex]->ProcessAcks( acks, numAcks );
+        }
+
+        if ( m_sendStringTable )
+        {
+            for ( int i = 0; i < numAcks; ++i )
+            {
+                m_sendStringTable->ProcessAck( acks[i] );
+            }
+        }
+    }
+
+    void Connection::UpdateNetworkConditions( float rtt, float packetLoss )
+    {
+        /*
+            Additive increase, multiplicative decrease. While the link is congested, the bandwidth limit is halved at most once 
+            per round trip, so a single loss event isn't counted twice. While it is clean, the limit probes back up towards 
+            ConnectionConfig::bandwidthLimit, recovering the full range in about ten seconds.
+         */
+
+        const double deltaTime = m_time - m_lastNetworkConditionsTime;
+
+        m_lastNetworkConditionsTime = m_time;
+
+        if ( rtt > 0.0f )
+        {
+            // RFC 6298 style mean deviation. reliable.io only exposes the smoothed RTT, so this follows how much that moves between updates
+
+            if ( m_rttVariance < 0.0f )
+                m_rttVariance = rtt * 0.5f;
+            else
+                m_rttVariance = 0.75f * m_rttVariance + 0.25f * fabsf( rtt - m_lastRtt );
+
+            m_lastRtt = rtt;
+
+            for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+                m_channel[i]->UpdateRoundTripTime( rtt / 1000.0, m_rttVariance / 1000.0 );
+        }
+
+        if ( rtt > 0.0f && ( m_minRtt < 0.0f || rtt < m_minRtt ) )
+            m_minRtt = rtt;
+
+        if ( m_hasScavengerChannels )
+            UpdateScavengerBandwidth( rtt, packetLoss, deltaTime );
+
+        if ( !m_connectionConfig.adaptiveBandwidth )
+            return;
+
+        const double maxBandwidth = m_connectionConfig.bandwidthLimit;
+
+        const double minBandwidth = m_connectionConfig.adaptiveBandwidthMin > 0 ? yojimbo_min( (double) m_connectionConfig.adaptiveBandwidthMin, maxBandwidth ) : maxBandwidth / 8;
+
+        const bool congested = packetLoss > m_connectionConfig.congestionPacketLoss || ( m_minRtt > 0.0f && rtt > m_minRtt + m_connectionConfig.congestionRttIncrease );
+
+        if ( congested )
+        {
+            const double backoffInterval = yojimbo_max( rtt / 1000.0, 0.1 );
+
+            if ( m_time - m_lastBackoffTime >= backoffInterval )
+            {
+                m_adaptiveBandwidth = yojimbo_max( m_adaptiveBandwidth * 0.5, minBandwidth );
+                m_lastBackoffTime = m_time;
+            }
+        }
+        else if ( deltaTime > 0.0 )
+        {
+            m_adaptiveBandwidth = yojimbo_min( m_adaptiveBandwidth + ( maxBandwidth - minBandwidth ) * 0.1 * deltaTime, maxBandwidth );
+        }
+    }
+
+    void Connection::UpdateScavengerBandwidth( float rtt, float packetLoss, double deltaTime )
+    {
+        /*
+            Delay based, after LEDBAT (RFC 6817). Queuing delay is the RTT above the lowest RTT measured. While it is under 
+            the target, the rate grows in proportion to how far under it is, up to e-fold per second, but only while the rate 
+            is what holds the scavenger channels back. Once it goes over, the rate backs off by up to half at most once per 
+            round trip, well before the queues grow enough to cause loss for the other channels.
+         */
+
+        const double minBandwidth = m_connectionConfig.scavengerMinBandwidth;
+
+        const bool limited = m_scavengerLimited;
+
+        m_scavengerLimited = false;
+
+        if ( rtt <= 0.0f || m_minRtt <= 0.0f )
+            return;
+
+        const double targetDelay = m_connectionConfig.scavengerTargetDelay;
+
+        const double offTarget = yojimbo_clamp( ( targetDelay - ( rtt - m_minRtt ) ) / targetDelay, -1.0, 1.0 );
+
+        if ( offTarget < 0.0 || packetLoss > m_connectionConfig.congestionPacketLoss )
+        {
+            const double backoffInterval = yojimbo_max( rtt / 1000.0, 0.1 );
+
+            if ( m_time - m_lastScavengerBackoffTime >= backoffInterval )
+            {
+                const double backoff = packetLoss > m_connectionConfig.congestionPacketLoss ? 0.5 : 1.0 + 0.5 * offTarget;
+                m_scavengerBandwidth = yojimbo_max( m_scavengerBandwidth * backoff, minBandwidth );
+                m_lastScavengerBackoffTime = m_time;
+            }
+        }
+        else if ( limited && deltaTime > 0.0 )
+        {
+            m_scavengerBandwidth += m_scavengerBandwidth * offTarget * yojimbo_min( deltaTime, 1.0 );
+        }
+    }
+
+    void Connection::SetUnreliableBudgetScale( float scale )
+    {
+        yojimbo_assert( scale > 0.0f && scale <= 1.0f );
+        m_unreliableBudgetScale = scale;
+    }
+
+    void Connection::AutoTuneChannels()
+    {
+        /*
+            Each tuned channel asks for a budget from what it sent since the last call: twice its budget if it ran out of space 
+            in more than a quarter of the packets it sent in, otherwise a quarter more than it used per packet, but no less than 
+            half its budget, so a quiet moment doesn't take it all away at once. If the tuned channels ask for more than the 
+            packet size and bandwidth limit leave over after the other channels, the space above their minimum budgets is 
+            shared out in proportion to what they asked for, so it goes where the traffic is.
+         */
+
+        const double deltaTime = m_time - m_lastAutoTuneTime;
+
+        m_lastAutoTuneTime = m_time;
+
+        const uint64_t numPackets = m_numPacketsGenerated - m_autoTunePacketsGenerated;
+
+        m_autoTunePacketsGenerated = m_numPacketsGenerated;
+
+        double packetBytes = m_pathPacketBytes > 0 ? yojimbo_min( m_pathPacketBytes, m_connectionConfig.maxPacketSize ) : m_connectionConfig.maxPacketSize;
+
+        const float bandwidthLimit = GetBandwidthLimit();
+
+        if ( bandwidthLimit > 0.0f && numPackets > 0 )
+            packetBytes = yojimbo_min( packetBytes, bandwidthLimit * deltaTime / numPackets );
+
+        double wantedBudget[MaxChannels];
+        double messageBytes[MaxChannels];
+        double totalWanted = 0.0;
+        double totalMin = 0.0;
+        double otherBytes = 0.0;
+
         for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
         {
-            m_channel[i]->AdvanceTime( time );
+            const ChannelConfig & channelConfig = m_connectionConfig.channel[i];
+            const Channel * channel = m_channel[i];
+            AutoTuneCounters & counters = m_autoTuneCounters[i];
+
+            const uint64_t packetsSent = channel->GetCounter( CHANNEL_COUNTER_PACKETS_SENT ) - counters.packetsSent;
+            const uint64_t bitsSent = channel->GetCounter( CHANNEL_COUNTER_BITS_SENT ) - counters.bitsSent;
+            const uint64_t messagesPacked = channel->GetCounter( CHANNEL_COUNTER_MESSAGES_PACKED ) - counters.messagesPacked;
+            const uint64_t outOfSpace = channel->GetCounter( CHANNEL_COUNTER_OUT_OF_SPACE ) - counters.outOfSpace;
 
-            if ( m_channel[i]->GetErrorLevel() != CHANNEL_ERROR_NONE )
+            counters.packetsSent += packetsSent;
+            counters.bitsSent += bitsSent;
+            counters.messagesPacked += messagesPacked;
+            counters.outOfSpace += outOfSpace;
+
+            if ( !channelConfig.autoTune )
             {
-                m_errorLevel = CONNECTION_ERROR_CHANNEL;
-                return;
+                if ( numPackets > 0 )
+                    otherBytes += bitsSent / 8.0 / numPackets;
+                continue;
             }
+
+            const double minBudget = channelConfig.autoTuneMinPacketBudget;
+            const double maxBudget = channelConfig.packetBudget > 0 ? channelConfig.packetBudget : m_connectionConfig.maxPacketSize;
+            const double budget = channel->GetLimits().packetBudget > 0 ? channel->GetLimits().packetBudget : maxBudget;
+
+            double wanted;
+            if ( outOfSpace * 4 > packetsSent )
+                wanted = budget * 2.0;
+            else
+                wanted = yojimbo_max( packetsSent > 0 ? bitsSent / 8.0 / packetsSent * 1.25 : 0.0, budget * 0.5 );
+
+            wantedBudget[i] = yojimbo_clamp( wanted, minBudget, yojimbo_max( minBudget, maxBudget ) );
+            messageBytes[i] = messagesPacked > 0 ? bitsSent / 8.0 / messagesPacked : 0.0;
+
+            totalWanted += wantedBudget[i];
+            totalMin += minBudget;
+        }
+
+        const double available = yojimbo_max( packetBytes - otherBytes, totalMin );
+
+        const double scale = ( totalWanted > available ) ? ( available - totalMin ) / ( totalWanted - totalMin ) : 1.0;
+
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            const ChannelConfig & channelConfig = m_connectionConfig.channel[i];
+
+            if ( !channelConfig.autoTune )
+                continue;
+
+            const double minBudget = channelConfig.autoTuneMinPacketBudget;
+
+            ChannelLimits limits = m_channel[i]->GetLimits();
+
+            limits.packetBudget = (int) ( minBudget + ( wantedBudget[i] - minBudget ) * scale );
+
+            if ( messageBytes[i] > 0.0 )
+                limits.maxMessagesPerPacket = yojimbo_clamp( (int) ceil( limits.packetBudget / messageBytes[i] ), channelConfig.autoTuneMinMessagesPerPacket, channelConfig.maxMessagesPerPacket );
+
+            m_channel[i]->SetLimits( limits );
+        }
+    }
+
+    float Connection::GetBandwidthLimit() const
+    {
+        return m_connectionConfig.adaptiveBandwidth ? (float) m_adaptiveBandwidth : (float) m_connectionConfig.bandwidthLimit;
+    }
+
+    void Connection::GetStats( ConnectionStats & stats ) const
+    {
+        stats.bandwidthLimit = GetBandwidthLimit();
+        stats.scavengerBandwidth = m_hasScavengerChannels ? (float) m_scavengerBandwidth : 0.0f;
+        stats.numPacketsGenerated = m_numPacketsGenerated;
+        stats.packetBytesGenerated = m_packetBytesGenerated;
+        stats.packetBytesCapacity = m_packetBytesCapacity;
+        stats.numPacketsProcessed = m_numPacketsProcessed;
+        stats.numDuplicatePackets = m_numDuplicatePackets;
+        stats.packetBytesProcessed = m_packetBytesProcessed;
+        stats.generatePacketTime = m_generatePacketTime;
+        stats.processPacketTime = m_processPacketTime;
+        stats.numChannels = m_connectionConfig.numChannels;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            ChannelStats & channelStats = stats.channel[i];
+            for ( int j = 0; j < CHANNEL_COUNTER_NUM_COUNTERS; ++j )
+                channelStats.counters[j] = m_channel[i]->GetCounter( j );
+            channelStats.sendQueueDepth = m_channel[i]->GetSendQueueDepth();
+            channelStats.receiveQueueDepth = m_channel[i]->GetReceiveQueueDepth();
+        }
+    }
+
+    int Connection::GetCoalesceBits() const
+    {
+        // -1 if any channel has data that shouldn't wait, otherwise the bits of new message data waiting across all channels
+
+        int coalesceBits = 0;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( m_scavengerPaused && m_connectionConfig.channel[i].scavenger )
+                continue;
+            const int unsentBits = m_channel[i]->GetUnsentBits();
+            if ( unsentBits < 0 )
+                return -1;
+            coalesceBits += unsentBits;
+        }
+        return coalesceBits;
+    }
+
+    double Connection::GetNextSendTime() const
+    {
+        if ( m_connectionConfig.coalesceTime > 0.0f && m_coalesceStartTime >= 0.0 )
+        {
+            const int coalesceBits = GetCoalesceBits();
+            if ( coalesceBits > 0 && coalesceBits < m_connectionConfig.coalesceBytes * 8 )
+                return m_coalesceStartTime + m_connectionConfig.coalesceTime;
+        }
+        if ( m_acksPending )
+            return m_time;
+        double nextSendTime = m_lastPacketTime + m_connectionConfig.idlePacketInterval;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( m_scavengerPaused && m_connectionConfig.channel[i].scavenger )
+                continue;
+            nextSendTime = yojimbo_min( nextSendTime, m_channel[i]->GetNextSendTime() );
+        }
+        return nextSendTime;
+    }
+
+    bool Connection::HasUrgentDataToSend() const
+    {
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( m_connectionConfig.channel[i].urgent && m_channel[i]->GetNextSendTime() <= m_time )
+                return true;
+        }
+        return false;
+    }
+
+    void Connection::AdvanceTime( double time )
+    {
+        if ( m_connectionConfig.bandwidthLimit > 0 && time > m_time )
+        {
+            m_bandwidthTokens = yojimbo_min( m_bandwidthTokens + ( time - m_time ) * GetBandwidthLimit(), GetBandwidthBurstBytes( m_connectionConfig ) );
+        }
+        if ( m_hasScavengerChannels && time > m_time )
+        {
+            m_scavengerTokens = yojimbo_min( m_scavengerTokens + ( time - m_time ) * m_scavengerBandwidth, (double) m_connectionConfig.maxPacketSize );
+        }
+        m_time = time;
+
+        // Channels share the connection clock, so only channels with timers to run are visited.
+
+        uint64_t channelsWithTimers = m_channelsWithTimers;
+        while ( channelsWithTimers )
+        {
+            const int i = bit_scan_forward64( channelsWithTimers );
+            channelsWithTimers &= channelsWithTimers - 1;
+
+            m_channel[i]->AdvanceTime( time );
+
+            // messages held back by a jitter buffer become ready as time passes
+
+            if ( m_connectionConfig.channel[i].jitterBuffer && m_channel[i]->GetReceiveQueueDepth() > 0 )
+                m_channelsWithMessages |= uint64_t(1) << i;
+        }
+        if ( m_channelErrors )
+        {
+            m_errorLevel = CONNECTION_ERROR_CHANNEL;
+            return;
         }
         if ( m_allocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE )
         {
             m_errorLevel = CONNECTION_ERROR_ALLOCATOR;
             return;
         }
+        if ( m_frameAllocator )
+        {
+            if ( m_frameAllocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE )
+            {
+                m_errorLevel = CONNECTION_ERROR_ALLOCATOR;
+                return;
+            }
+            m_frameAllocator->Reset();
+        }
         if ( m_messageFactory->GetErrorLevel() != MESSAGE_FACTORY_ERROR_NONE )
         {
             m_errorLevel = CONNECTION_ERROR_MESSAGE_FACTORY;
             return;
         }
+        if ( m_hasAutoTuneChannels && m_time - m_lastAutoTuneTime >= m_connectionConfig.autoTuneInterval )
+        {
+            AutoTuneChannels();
+        }
     }
 }
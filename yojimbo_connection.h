@@ -10,6 +10,7 @@
 #include "yojimbo_message.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_channel.h"
+#include "yojimbo_string_table.h"
 
 // windows =p
 #ifdef SendMessage
@@ -31,15 +32,100 @@ namespace yojimbo
         CONNECTION_ERROR_READ_PACKET_FAILED,                    ///< Failed to read packet. Received an invalid packet?     
     };
 
+    /// Stats for one channel of a connection. See ConnectionStats.
+
+    struct ChannelStats
+    {
+        uint64_t counters[CHANNEL_COUNTER_NUM_COUNTERS];                ///< The channel counters. See ChannelCounters.
+        int sendQueueDepth;                                             ///< Messages queued for sending. See Channel::GetSendQueueDepth.
+        int receiveQueueDepth;                                          ///< Messages waiting to be received. See Channel::GetReceiveQueueDepth.
+
+        ChannelStats()
+        {
+            for ( int i = 0; i < CHANNEL_COUNTER_NUM_COUNTERS; ++i )
+                counters[i] = 0;
+            sendQueueDepth = 0;
+            receiveQueueDepth = 0;
+        }
+    };
+
+    /**
+        Network stats for a connection: quality of service from reliable.io, and the state of each channel.
+
+        Nothing here is computed on demand, so it is cheap enough to poll every tick.
+
+        @see Client::GetConnectionStats
+        @see Server::GetConnectionStats
+     */
+
+    struct ConnectionStats
+    {
+        float rtt;                                                      ///< Round trip time, smoothed (milliseconds).
+        float packetLoss;                                               ///< Packet loss, smoothed (percent).
+        float sentBandwidth;                                            ///< Bandwidth sent (kbps).
+        float receivedBandwidth;                                        ///< Bandwidth received (kbps).
+        float ackedBandwidth;                                           ///< Bandwidth sent and acked by the other side (kbps).
+        float bandwidthLimit;                                           ///< Current send bandwidth limit (bytes per second). See ConnectionConfig::bandwidthLimit.
+        float scavengerBandwidth;                                       ///< Current rate of the scavenger channels (bytes per second). Zero without scavenger channels. See ChannelConfig::scavenger.
+        uint64_t numPacketsSent;                                        ///< Number of packets sent.
+        uint64_t numPacketsReceived;                                    ///< Number of packets received.
+        uint64_t numPacketsAcked;                                       ///< Number of packets sent and acked by the other side.
+        uint64_t numPacketsGenerated;                                   ///< Number of packets the connection generated, not counting idle packets it skipped.
+        uint64_t packetBytesGenerated;                                  ///< Total size of the packets generated (bytes).
+        uint64_t packetBytesCapacity;                                   ///< Total maximum packet size the packets were generated with (bytes). packetBytesGenerated / packetBytesCapacity is the average fill ratio. Use it with the per-channel CHANNEL_COUNTER_BITS_SENT and CHANNEL_COUNTER_OUT_OF_SPACE to tune maxPacketSize and each ChannelConfig::packetBudget.
+        uint64_t numPacketsProcessed;                                   ///< Number of packets passed to the connection to process.
+        uint64_t packetBytesProcessed;                                  ///< Total size of the packets processed (bytes).
+        uint64_t numDuplicatePackets;                                   ///< Number of packets dropped because a packet with the same sequence was already processed. See ConnectionConfig::dropDuplicatePackets.
+        double generatePacketTime;                                      ///< Total time spent generating packets, including idle packets skipped (seconds). Compare clients by the change over an interval to find the ones costing the most to serve.
+        double processPacketTime;                                       ///< Total time spent processing packets (seconds).
+        int numChannels;                                                ///< Number of channels on the connection.
+        ChannelStats channel[MaxChannels];                              ///< Stats for each channel in [0,numChannels-1].
+
+        ConnectionStats()
+        {
+            rtt = 0.0f;
+            packetLoss = 0.0f;
+            sentBandwidth = 0.0f;
+            receivedBandwidth = 0.0f;
+            ackedBandwidth = 0.0f;
+            bandwidthLimit = 0.0f;
+            scavengerBandwidth = 0.0f;
+            numPacketsSent = 0;
+            numPacketsReceived = 0;
+            numPacketsAcked = 0;
+            numPacketsGenerated = 0;
+            packetBytesGenerated = 0;
+            packetBytesCapacity = 0;
+            numPacketsProcessed = 0;
+            packetBytesProcessed = 0;
+            numDuplicatePackets = 0;
+            generatePacketTime = 0.0;
+            processPacketTime = 0.0;
+            numChannels = 0;
+        }
+    };
+
     /**
         Connection class.
+
+        Sends and receives messages over the channels set up in the ConnectionConfig. The channel layout is read from the config once, in the constructor. After that, the channels are only called through Channel a few times per packet, while messages are serialized through MessageFactory::SerializeMessage without a virtual call per message. Layout specific work per message is already done by the channel classes themselves, so a connection specialized at compile time for one channel layout has little left to fold away.
      */
 
     class Connection
     {
     public:
 
-        Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time );
+        /**
+            The connection constructor.
+
+            @param allocator The allocator for the channels and packet buffers.
+            @param messageFactory The message factory for creating and destroying messages.
+            @param connectionConfig The connection config.
+            @param time The current time in seconds.
+            @param sharedConfig If true, the connection and its channels refer to connectionConfig instead of copying it, so it must outlive the connection and not change. The server uses this so all client slots read one config.
+         */
+
+        Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time, bool sharedConfig = false );
 
         ~Connection();
 
@@ -49,10 +135,72 @@ namespace yojimbo
 
         void SendMessage( int channelIndex, Message * message );
 
+        /**
+            Queue messages to be sent on a channel, until the channel can't take any more. See Channel::SendMessages.
+
+            @returns The number of messages queued, from the start of the array. The rest still belong to the caller. Zero while the connection is low on memory.
+         */
+
+        int SendMessages( int channelIndex, Message ** messages, int numMessages );
+
         Message * ReceiveMessage( int channelIndex );
 
+        /**
+            Pop up to maxMessages received messages off a channel. See Channel::ReceiveMessages.
+
+            @returns The number of messages received.
+         */
+
+        int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages );
+
+        /**
+            Get the channels that may have received messages waiting.
+
+            A channel's bit is set when a packet leaves messages in its receive queue, and cleared when ReceiveMessage on the channel returns NULL. Server logic can drain just these channels after receiving packets, instead of calling ReceiveMessage on every channel of every client. A set bit is a hint: messages that arrived out of order are counted, so ReceiveMessage may still return NULL once.
+
+            @returns Bit n is set if channel n may have messages waiting.
+         */
+
+        uint64_t GetChannelsWithMessages() const { return m_channelsWithMessages; }
+
+        bool GetReceivedBlockPrefix( int channelIndex, const uint8_t * & blockData, int & blockBytes ) const;
+
+        /**
+            Get a latency histogram of a channel. See Channel::GetLatencyHistogram.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param index The histogram to get. See ChannelLatencyHistograms.
+
+            @returns The histogram, or NULL if ChannelConfig::latencyHistograms is false for the channel.
+         */
+
+        const LatencyHistogram * GetLatencyHistogram( int channelIndex, int index ) const;
+
+        /**
+            Change the queue sizes, packet budget, most messages per packet and largest block a channel runs with, without reconnecting. See ChannelLimits.
+
+            Limits can go down from the ChannelConfig and back up to it, eg. to save memory and bandwidth in the lobby and give it back for match start. The receive queue size and largest block are negotiated with the other end, and need ChannelConfig::runtimeLimits. Reset restores the config limits.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param limits The new limits.
+         */
+
+        void SetChannelLimits( int channelIndex, const ChannelLimits & limits );
+
+        /**
+            Get the limits a channel runs with.
+
+            @param channelIndex The channel index in [0,numChannels-1].
+
+            @returns The limits last set with SetChannelLimits, or the config limits.
+         */
+
+        const ChannelLimits & GetChannelLimits( int channelIndex ) const;
+
         void ReleaseMessage( Message * message );
 
+        void ReleaseMessages( Message ** messages, int numMessages );
+
         bool GeneratePacket( void * context, uint16_t packetSequence, uint8_t * packetData, int maxPacketBytes, int & packetBytes );
 
         bool ProcessPacket( void * context, uint16_t packetSequence, const uint8_t * packetData, int packetBytes );
@@ -61,15 +209,207 @@ namespace yojimbo
 
         void AdvanceTime( double time );
 
+        void UpdateNetworkConditions( float rtt, float packetLoss );
+
+        float GetBandwidthLimit() const;
+
+        /**
+            Fill the per-channel part of the connection stats, and the bandwidth limit.
+
+            @param stats The connection stats to fill [out]. The reliable.io stats are left for the caller, which owns the reliable endpoint.
+         */
+
+        void GetStats( ConnectionStats & stats ) const;
+
+        /**
+            Get the earliest time the connection needs a packet sent.
+
+            This is the earliest time any channel has data to send, now if a received packet is waiting to be acked, or when the connection would otherwise go quiet for longer than ConnectionConfig::idlePacketInterval. While small messages are being coalesced, it is when the coalescing delay runs out. See ConnectionConfig::coalesceTime.
+
+            @returns The time in seconds. May be in the past, if a packet should be sent now.
+         */
+
+        double GetNextSendTime() const;
+
+        /**
+            Does a channel marked urgent have data to send?
+
+            Used by the client in power save mode to send gameplay critical data straight away. See ChannelConfig::urgent.
+
+            @returns True if a channel with ChannelConfig::urgent set has data to send now.
+         */
+
+        bool HasUrgentDataToSend() const;
+
+        /**
+            Did the last packet generated carry data for a channel marked urgent?
+
+            Lets the transport send gameplay critical packets over every path it has, with BaseClientServerConfig::trustedMultipath. See ChannelConfig::urgent.
+
+            @returns True if the last packet generated had data for a channel with ChannelConfig::urgent set.
+         */
+
+        bool IsLastPacketUrgent() const { return m_lastPacketUrgent; }
+
+        /**
+            Limit the size of the packets generated to what the network path carries without fragmentation.
+
+            The limit is rounded down to a multiple of four bytes, and never goes below what the largest block fragment of any channel needs, so blocks keep moving when ChannelConfig::fragmentSize is too large for the path. See BaseClientServerConfig::trustedPathMtuDiscovery.
+
+            @param bytes The largest packet to generate (bytes), on top of the maxPacketBytes passed in to GeneratePacket. 0 for no limit. Reset clears the limit.
+         */
+
+        void SetPathPacketBytes( int bytes );
+
+        /**
+            Get the limit on the size of the packets generated.
+
+            @returns The limit set with SetPathPacketBytes, after rounding and raising it to fit the largest block fragment (bytes). 0 if there is no limit.
+         */
+
+        int GetPathPacketBytes() const { return m_pathPacketBytes; }
+
+        /**
+            Pause the channels with ChannelConfig::scavenger set. They keep what they have queued, and carry on sending it once unpaused. Used by the server while it is overloaded. See SERVER_OVERLOAD_STEP_PAUSE_SCAVENGER.
+
+            @param paused True to pause the scavenger channels. Reset unpauses them.
+         */
+
+        void SetScavengerPaused( bool paused ) { m_scavengerPaused = paused; }
+
+        /**
+            Are the scavenger channels paused?
+
+            @returns True if the scavenger channels are paused with SetScavengerPaused.
+         */
+
+        bool IsScavengerPaused() const { return m_scavengerPaused; }
+
+        /**
+            Scale the packet space offered to unreliable-unordered and unreliable-sequenced channels, down from their packet budget, or from the whole packet if they have none. Used by the server while it is overloaded. See SERVER_OVERLOAD_STEP_SHRINK_UNRELIABLE.
+
+            @param scale The scale, in (0,1]. Reset goes back to 1.
+         */
+
+        void SetUnreliableBudgetScale( float scale );
+
+        /**
+            Get the scale applied to the packet space of unreliable channels.
+
+            @returns The scale set with SetUnreliableBudgetScale.
+         */
+
+        float GetUnreliableBudgetScale() const { return m_unreliableBudgetScale; }
+
         ConnectionErrorLevel GetErrorLevel() { return m_errorLevel; }
 
+        /**
+            Is the connection low on memory?
+
+            @returns True if ConnectionConfig::memoryWatermark is set and the connection allocator has more than that many bytes allocated. CanSendMessage returns false while this is true.
+         */
+
+        bool IsMemoryLow() const;
+
+        /**
+            Check the memory watermark, and remember the result for the next call.
+
+            Called once per update by the client and server, which tell the adapter when the connection goes low on memory or recovers.
+
+            @returns True if the connection went low on memory or recovered since the last call.
+         */
+
+        bool UpdateMemoryLow();
+
+        /**
+            Are packets generated by this connection written with serialize checks?
+
+            @returns True if ConnectionConfig::serializeChecks is set, or ConnectionConfig::negotiateSerializeChecks is set and the last packet received had serialize checks.
+         */
+
+        bool GetSerializeChecks() const { return m_connectionConfig.serializeChecks || ( m_connectionConfig.negotiateSerializeChecks && m_remoteSerializeChecks ); }
+
     private:
 
+        void UpdateScavengerBandwidth( float rtt, float packetLoss, double deltaTime );
+
+        /**
+            Adjust the packet budget and most messages per packet of the channels with ChannelConfig::autoTune, from what they sent since the last call. Called from AdvanceTime every ConnectionConfig::autoTuneInterval.
+         */
+
+        void AutoTuneChannels();
+
+        /// Channel counters at the last AutoTuneChannels call, so each adjustment works from the traffic since.
+
+        struct AutoTuneCounters
+        {
+            uint64_t packetsSent;                               ///< CHANNEL_COUNTER_PACKETS_SENT.
+            uint64_t bitsSent;                                  ///< CHANNEL_COUNTER_BITS_SENT.
+            uint64_t messagesPacked;                            ///< CHANNEL_COUNTER_MESSAGES_PACKED.
+            uint64_t outOfSpace;                                ///< CHANNEL_COUNTER_OUT_OF_SPACE.
+        };
+
+        int GetCoalesceBits() const;
+
+        void ProcessAcksInternal( const uint16_t * acks, int numAcks );
+
+        void ProcessExtendedAcks( uint16_t sequence, const uint32_t * received );
+
         Allocator * m_allocator;                                ///< Allocator passed in to the connection constructor.
         MessageFactory * m_messageFactory;                      ///< Message factory for creating and destroying messages.
-        ConnectionConfig m_connectionConfig;                    ///< Connection configuration.
+        ConnectionConfig * m_ownedConfig;                       ///< The copy of the connection config made in the constructor. NULL if the config is shared.
+        const ConnectionConfig & m_connectionConfig;            ///< Connection configuration. Refers to m_ownedConfig, or to the shared config passed in to the constructor.
         Channel * m_channel[MaxChannels];                       ///< Array of connection channels. Array size corresponds to m_connectionConfig.numChannels
         ConnectionErrorLevel m_errorLevel;                      ///< The connection error level.
+        int m_channelDeficit[MaxChannels];                      ///< Deficit round robin credit per channel (bits). Packet space each channel is owed, carried over between packets while the channel stays busy.
+        int m_nextChannelIndex;                                 ///< Channel offered packet space first in the next packet. Rotates so no channel always goes first.
+        double m_time;                                          ///< Current connection time. Used to refill the bandwidth token bucket.
+        double m_bandwidthTokens;                               ///< Bytes the connection may still send right now without exceeding the bandwidth limit. Can go slightly negative, because packet headers are always sent.
+        double m_adaptiveBandwidth;                             ///< Current adaptive bandwidth limit (bytes per second). See ConnectionConfig::adaptiveBandwidth.
+        double m_lastNetworkConditionsTime;                     ///< Time UpdateNetworkConditions was last called.
+        double m_lastBackoffTime;                               ///< Time the adaptive bandwidth limit was last halved.
+        float m_minRtt;                                         ///< Lowest RTT measured on this connection (milliseconds). Negative until the first measurement.
+        bool m_hasScavengerChannels;                            ///< True if any channel has ChannelConfig::scavenger set.
+        bool m_hasAutoTuneChannels;                             ///< True if any channel has ChannelConfig::autoTune set.
+        double m_lastAutoTuneTime;                              ///< Time AutoTuneChannels was last called.
+        uint64_t m_autoTunePacketsGenerated;                    ///< m_numPacketsGenerated at the last AutoTuneChannels call.
+        AutoTuneCounters m_autoTuneCounters[MaxChannels];       ///< Channel counters at the last AutoTuneChannels call.
+        bool m_scavengerLimited;                                ///< True if the scavenger rate held back data since the last UpdateNetworkConditions. The rate only grows while it is what limits the scavenger channels.
+        double m_scavengerBandwidth;                            ///< Current rate of the scavenger channels (bytes per second). See ChannelConfig::scavenger.
+        double m_scavengerTokens;                               ///< Bytes the scavenger channels may still send right now. Refilled at m_scavengerBandwidth, up to maxPacketSize.
+        double m_lastScavengerBackoffTime;                      ///< Time the scavenger rate last backed off.
+        float m_lastRtt;                                        ///< RTT passed to the last UpdateNetworkConditions (milliseconds).
+        float m_rttVariance;                                    ///< Mean deviation of the RTT (milliseconds). Negative until the first measurement.
+        double m_lastPacketTime;                                ///< Time a packet was last generated.
+        SequenceBuffer<uint8_t> * m_sentPacketAcked;            ///< 1 once the packet sent with that sequence is acked, so a packet acked both by reliable.io and an extended ack is only processed once. NULL unless ConnectionConfig::extendedAckBits is set.
+        SequenceBuffer<uint8_t> * m_receivedPackets;            ///< Packets received, for extended acks. NULL unless ConnectionConfig::extendedAckBits is set.
+        SequenceBuffer<uint8_t> * m_processedPackets;           ///< Packets processed, so duplicates are dropped. NULL unless ConnectionConfig::dropDuplicatePackets is set.
+        uint64_t m_numDuplicatePackets;                         ///< Number of duplicate packets dropped. See ConnectionStats::numDuplicatePackets.
+        bool m_lastPacketUrgent;                                ///< True if the last packet generated carried data for a channel marked urgent. See IsLastPacketUrgent.
+        int m_pathPacketBytes;                                  ///< Largest packet GeneratePacket writes, whatever maxPacketBytes is passed in (bytes). 0 for no limit. See SetPathPacketBytes.
+        bool m_scavengerPaused;                                 ///< True while the scavenger channels are paused. See SetScavengerPaused.
+        float m_unreliableBudgetScale;                          ///< Scale applied to the packet space offered to unreliable channels. See SetUnreliableBudgetScale.
+        int m_packetsSinceExtendedAcks;                         ///< Number of packets generated since the last one carrying extended acks.
+        bool m_remoteSerializeChecks;                           ///< True if the last packet received had serialize checks. Only tracked when ConnectionConfig::negotiateSerializeChecks is set.
+        double m_coalesceStartTime;                             ///< Time GeneratePacket first held back a packet to coalesce small messages. Negative while not coalescing.
+        uint64_t m_numPacketsGenerated;                         ///< Number of packets generated. See ConnectionStats::numPacketsGenerated.
+        uint64_t m_packetBytesGenerated;                        ///< Total size of the packets generated (bytes).
+        uint64_t m_packetBytesCapacity;                         ///< Total maximum packet size passed to GeneratePacket for the packets generated (bytes).
+        uint64_t m_numPacketsProcessed;                         ///< Number of packets passed to ProcessPacket. See ConnectionStats::numPacketsProcessed.
+        uint64_t m_packetBytesProcessed;                        ///< Total size of the packets passed to ProcessPacket (bytes).
+        double m_generatePacketTime;                            ///< Total time spent in GeneratePacket (seconds).
+        double m_processPacketTime;                             ///< Total time spent in ProcessPacket (seconds).
+        uint64_t m_channelsWithMessages;                        ///< Bit per channel that may have received messages waiting. See Connection::GetChannelsWithMessages.
+        uint64_t m_channelsWithTimers;                          ///< Bit per channel that needs Channel::AdvanceTime calls. The rest read the time from m_time when they need it.
+        uint64_t m_channelErrors;                               ///< Bit per channel in an error state, kept up to date by the channels. See Channel::SetErrorMask.
+        bool m_memoryLow;                                       ///< True if the connection was low on memory the last time UpdateMemoryLow was called.
+        bool m_acksPending;                                     ///< True if a packet with channel data was received since the last packet was generated. The peer is waiting for it to be acked.
+        ChannelPacketData m_sendChannelData[MaxChannels];       ///< Per-channel packet data written by GeneratePacket. Reused for every packet.
+        ChannelPacketData m_receivePacketEntries[MaxChannels];  ///< Channel entries for the packet being read. Reused for every packet.
+        uint8_t * m_packetScratch;                              ///< Slab of message, fragment and fragment data scratch backing the channel packet data above. See Connection constructor.
+        FrameAllocator * m_frameAllocator;                      ///< Allocator for stream allocations while reading and writing packets. Rewound every AdvanceTime. NULL unless ConnectionConfig::frameAllocatorBytes is set.
+        StringTable * m_sendStringTable;                        ///< Strings sent with serialize_dictionary_string, and which of them the other end has. NULL unless ConnectionConfig::stringTableSize is set.
+        StringTable * m_receiveStringTable;                     ///< Strings defined by the other end with serialize_dictionary_string. NULL unless ConnectionConfig::stringTableSize is set.
     };
 }
 
@@ -0,0 +1,305 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_footprint.h"
+#include "yojimbo_connection.h"
+#include "yojimbo_client.h"
+#include "yojimbo_channel.h"
+#include "yojimbo_simulator.h"
+#include "yojimbo_platform.h"
+#include "reliable.h"
+#include "tlsf/tlsf.h"
+
+namespace yojimbo
+{
+    /**
+        TLSF allocator that grows by adding pools from a parent allocator, so measuring never runs out of memory.
+
+        Blocks come out the same size as from a TLSF_Allocator, so GetFootprint is what the same allocations take in a TLSF_Allocator, not counting its control structure.
+     */
+
+    class FootprintAllocator : public Allocator
+    {
+    public:
+
+        explicit FootprintAllocator( Allocator & parent )
+        {
+            m_parent = &parent;
+            m_control = YOJIMBO_ALLOCATE( parent, tlsf_size() );
+            yojimbo_assert( m_control );
+            m_tlsf = tlsf_create( m_control );
+            m_numPools = 0;
+            m_nextPoolBytes = 64 * 1024;
+        }
+
+        ~FootprintAllocator()
+        {
+            tlsf_destroy( m_tlsf );
+            for ( int i = 0; i < m_numPools; ++i )
+            {
+                YOJIMBO_FREE( *m_parent, m_pool[i] );
+            }
+            YOJIMBO_FREE( *m_parent, m_control );
+        }
+
+        void * Allocate( size_t size, const char * file, int line )
+        {
+            void * p = tlsf_malloc( m_tlsf, size );
+
+            if ( !p && m_numPools < MaxPools )
+            {
+                // pools double in size, so a large connection only takes a few
+
+                while ( m_nextPoolBytes < size + tlsf_pool_overhead() + tlsf_alloc_overhead() + 64 )
+                    m_nextPoolBytes *= 2;
+
+                m_pool[m_numPools] = YOJIMBO_ALLOCATE( *m_parent, m_nextPoolBytes );
+                if ( m_pool[m_numPools] )
+                {
+                    tlsf_add_pool( m_tlsf, m_pool[m_numPools], m_nextPoolBytes & ~size_t( tlsf_align_size() - 1 ) );
+                    m_numPools++;
+                    p = tlsf_malloc( m_tlsf, size );
+                }
+                m_nextPoolBytes *= 2;
+            }
+
+            if ( !p )
+            {
+                SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+                return NULL;
+            }
+
+            TrackAlloc( p, tlsf_block_size( p ), file, line );
+
+            return p;
+        }
+
+        void Free( void * p, const char * file, int line )
+        {
+            if ( !p )
+                return;
+
+            TrackFree( p, tlsf_block_size( p ), file, line );
+
+            tlsf_free( m_tlsf, p );
+        }
+
+        size_t GetFootprint() const
+        {
+            return m_bytesAllocated + size_t( m_numAllocations - m_numFrees ) * tlsf_alloc_overhead();
+        }
+
+    private:
+
+        enum { MaxPools = 32 };
+
+        Allocator * m_parent;                                               ///< The allocator pools are taken from.
+        void * m_control;                                                   ///< The TLSF control structure.
+        tlsf_t m_tlsf;                                                      ///< The TLSF instance.
+        void * m_pool[MaxPools];                                            ///< The pools added so far.
+        int m_numPools;                                                     ///< The number of pools added so far.
+        size_t m_nextPoolBytes;                                             ///< The size of the next pool to add (bytes).
+
+        FootprintAllocator( const FootprintAllocator & other );
+
+        FootprintAllocator & operator = ( const FootprintAllocator & other );
+    };
+
+    static void * footprint_allocate_function( void * context, uint64_t bytes )
+    {
+        Allocator * allocator = (Allocator*) context;
+        return YOJIMBO_ALLOCATE( *allocator, bytes );
+    }
+
+    static void footprint_free_function( void * context, void * pointer )
+    {
+        Allocator * allocator = (Allocator*) context;
+        YOJIMBO_FREE( *allocator, pointer );
+    }
+
+    // Channels keep a reference to their clock, so it must outlive them.
+
+    static const double FootprintTime = 0.0;
+
+    static Channel * create_channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex )
+    {
+        switch ( config.type )
+        {
+            case CHANNEL_TYPE_RELIABLE_ORDERED:
+            case CHANNEL_TYPE_RELIABLE_UNORDERED:
+                return YOJIMBO_NEW( allocator, ReliableOrderedChannel, allocator, messageFactory, config, channelIndex, FootprintTime );
+
+            case CHANNEL_TYPE_UNRELIABLE_UNORDERED:
+                return YOJIMBO_NEW( allocator, UnreliableUnorderedChannel, allocator, messageFactory, config, channelIndex, FootprintTime );
+
+            case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:
+                return YOJIMBO_NEW( allocator, UnreliableSequencedChannel, allocator, messageFactory, config, channelIndex, FootprintTime );
+
+            case CHANNEL_TYPE_SNAPSHOT:
+                return YOJIMBO_NEW( allocator, SnapshotChannel, allocator, messageFactory, config, channelIndex, FootprintTime );
+
+            default:
+                yojimbo_assert( !"unknown channel type" );
+                return NULL;
+        }
+    }
+
+    void GetConnectionMemoryFootprint( Allocator & allocator, Adapter & adapter, const BaseClientServerConfig & config, bool client, ConnectionMemoryFootprint & footprint )
+    {
+        footprint = ConnectionMemoryFootprint();
+
+        // block buffers are counted on lazy channels too, since they come back as soon as a block is in flight
+
+        BaseClientServerConfig measureConfig = config;
+        for ( int i = 0; i < measureConfig.numChannels; ++i )
+            measureConfig.channel[i].lazyBlockBuffers = false;
+
+        FootprintAllocator messageFactoryAllocator( allocator );
+        MessageFactory * messageFactory = adapter.CreateMessageFactory( messageFactoryAllocator );
+        yojimbo_assert( messageFactory );
+        footprint.messageFactory = messageFactoryAllocator.GetFootprint();
+
+        for ( int i = 0; i < measureConfig.numChannels; ++i )
+        {
+            const ChannelConfig & channelConfig = measureConfig.channel[i];
+
+            FootprintAllocator channelAllocator( allocator );
+            Channel * channel = create_channel( channelAllocator, *messageFactory, channelConfig, i );
+            footprint.channel[i] = channelAllocator.GetFootprint();
+            footprint.channels += footprint.channel[i];
+            YOJIMBO_DELETE( channelAllocator, Channel, channel );
+
+            if ( ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED || channelConfig.type == CHANNEL_TYPE_RELIABLE_UNORDERED ) && !channelConfig.disableBlocks )
+            {
+                FootprintAllocator blockAllocator( allocator );
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( blockAllocator, channelConfig.maxBlockSize );
+                footprint.blockData += blockAllocator.GetFootprint();
+                YOJIMBO_FREE( blockAllocator, blockData );
+            }
+        }
+
+        {
+            FootprintAllocator connectionAllocator( allocator );
+            Connection * connection = YOJIMBO_NEW( connectionAllocator, Connection, connectionAllocator, *messageFactory, measureConfig, 0.0 );
+            const size_t connectionBytes = connectionAllocator.GetFootprint();
+            footprint.connection = connectionBytes > footprint.channels ? connectionBytes - footprint.channels : 0;
+            YOJIMBO_DELETE( connectionAllocator, Connection, connection );
+        }
+
+        {
+            // set up the same as the client and server endpoints
+
+            FootprintAllocator endpointAllocator( allocator );
+            reliable_config_t endpointConfig;
+            InitializeEndpointConfig( config, endpointConfig );
+            endpointConfig.allocator_context = &endpointAllocator;
+            endpointConfig.allocate_function = footprint_allocate_function;
+            endpointConfig.free_function = footprint_free_function;
+            reliable_endpoint_t * endpoint = reliable_endpoint_create( &endpointConfig );
+
+            // the packet buffer pool is reserved with the first large packet, so reserve it here to count it
+
+            Allocator * bufferPoolAllocator = CreateEndpointAllocator( endpointAllocator, config );
+            if ( bufferPoolAllocator )
+            {
+                void * buffer = YOJIMBO_ALLOCATE( *bufferPoolAllocator, size_t( config.maxPacketFragments ) * size_t( config.packetFragmentSize ) );
+                footprint.endpoint = endpointAllocator.GetFootprint();
+                YOJIMBO_FREE( *bufferPoolAllocator, buffer );
+                YOJIMBO_DELETE( endpointAllocator, Allocator, bufferPoolAllocator );
+            }
+            else
+            {
+                footprint.endpoint = endpointAllocator.GetFootprint();
+            }
+
+            if ( endpoint )
+                reliable_endpoint_destroy( endpoint );
+        }
+
+        if ( client && config.networkSimulator )
+        {
+            FootprintAllocator simulatorAllocator( allocator );
+            NetworkSimulator * networkSimulator = YOJIMBO_NEW( simulatorAllocator, NetworkSimulator, simulatorAllocator, config.maxSimulatorPackets, 0.0, config.simulatorPacketBuffers, config.simulatorPacketBufferBytes );
+            footprint.networkSimulator = simulatorAllocator.GetFootprint();
+            YOJIMBO_DELETE( simulatorAllocator, NetworkSimulator, networkSimulator );
+        }
+
+        YOJIMBO_DELETE( messageFactoryAllocator, MessageFactory, messageFactory );
+
+        // the TLSF_Allocator constructor aligns both ends of its memory to 8 bytes
+
+        footprint.allocatorOverhead = tlsf_size() + tlsf_pool_overhead() + 16;
+
+        footprint.total = footprint.channels + footprint.blockData + footprint.connection + footprint.messageFactory + footprint.endpoint + footprint.networkSimulator + footprint.allocatorOverhead;
+    }
+
+    void GetServerMemoryFootprint( Allocator & allocator, Adapter & adapter, const BaseClientServerConfig & config, int maxClients, ServerMemoryFootprint & footprint )
+    {
+        yojimbo_assert( maxClients > 0 );
+        GetConnectionMemoryFootprint( allocator, adapter, config, false, footprint.client );
+        footprint.clientSlots = footprint.client.total * size_t( maxClients );
+    }
+
+    void GetServerEnvironment( ServerEnvironment & environment )
+    {
+        environment.numCpus = yojimbo_cpu_count();
+        environment.memoryLimit = yojimbo_memory_limit();
+    }
+
+    bool ConfigureServerForEnvironment( Allocator & allocator, Adapter & adapter, BaseClientServerConfig & config, int maxClients, float memoryFraction, ServerEnvironment & environment )
+    {
+        yojimbo_assert( maxClients > 0 );
+        yojimbo_assert( memoryFraction > 0.0f );
+        yojimbo_assert( memoryFraction <= 1.0f );
+        yojimbo_assert( environment.numCpus > 0 );
+
+        environment.numWorkerThreads = environment.numCpus - 1;
+        environment.maxClients = maxClients;
+
+        if ( environment.memoryLimit == 0 || config.serverSharedClientMemory )
+            return true;
+
+        ServerMemoryFootprint footprint;
+        GetServerMemoryFootprint( allocator, adapter, config, maxClients, footprint );
+
+        const uint64_t minClientMemory = uint64_t( footprint.client.total ) * 2;
+        const uint64_t budget = uint64_t( double( environment.memoryLimit ) * memoryFraction );
+        const uint64_t fixedMemory = uint64_t( config.serverGlobalMemory ) + uint64_t( config.serverBroadcastMemory );
+        const uint64_t clientBudget = budget > fixedMemory ? budget - fixedMemory : 0;
+
+        uint64_t clientMemory = yojimbo_max( uint64_t( config.serverPerClientMemory ), minClientMemory );
+        if ( clientMemory * uint64_t( maxClients ) > clientBudget )
+            clientMemory = yojimbo_max( clientBudget / uint64_t( maxClients ), minClientMemory );
+
+        config.serverPerClientMemory = int( yojimbo_min( clientMemory, uint64_t( 0x7FFFFFFF ) ) );
+        environment.maxClients = int( yojimbo_min( clientBudget / uint64_t( config.serverPerClientMemory ), uint64_t( maxClients ) ) );
+
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server sized for %d cpus and %.1fMB: %d worker threads, %d of %d clients with %.1fMB each\n",
+            environment.numCpus, environment.memoryLimit / ( 1024.0 * 1024.0 ), environment.numWorkerThreads, environment.maxClients, maxClients, config.serverPerClientMemory / ( 1024.0 * 1024.0 ) );
+
+        return environment.maxClients == maxClients;
+    }
+
+    bool CheckMemoryFootprint( const char * name, size_t memoryBytes, size_t requiredBytes )
+    {
+        yojimbo_assert( name );
+
+        if ( memoryBytes < requiredBytes )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "warning: %s is %d bytes, but needs at least %d bytes\n", name, int( memoryBytes ), int( requiredBytes ) );
+            return false;
+        }
+
+        if ( memoryBytes / size_t( MemoryOversizeFactor ) > requiredBytes )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "warning: %s is %d bytes, but only needs %d bytes\n", name, int( memoryBytes ), int( requiredBytes ) );
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,152 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_FOOTPRINT_H
+#define YOJIMBO_FOOTPRINT_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_adapter.h"
+#include <string.h>
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        The memory one connection needs from its allocator, broken down by component.
+
+        Each component is measured by creating it against a TLSF heap, so sizes include TLSF rounding and the TLSF header of each allocation. Block buffers are counted even on channels with ChannelConfig::lazyBlockBuffers, since they are allocated as soon as a block is in flight.
+
+        Messages and the blocks attached to messages being sent depend on what the application sends, so they aren't counted. Add headroom for the messages you expect to have in flight.
+
+        @see GetConnectionMemoryFootprint
+     */
+
+    struct ConnectionMemoryFootprint
+    {
+        size_t channel[MaxChannels];                                        ///< Each channel, with its queues, block buffers and latency histograms (bytes).
+        size_t channels;                                                    ///< Sum of the channels (bytes).
+        size_t blockData;                                                   ///< The maxBlockSize block handed to the application as each block is received, one per channel with blocks (bytes).
+        size_t connection;                                                  ///< The connection, not counting its channels: packet scratch, sent packet tracking, string tables, extended ack buffers and frame allocator (bytes).
+        size_t messageFactory;                                              ///< The message factory created by the adapter (bytes).
+        size_t endpoint;                                                    ///< The reliable.io endpoint (bytes).
+        size_t networkSimulator;                                            ///< The network simulator. Only the client creates it in the connection allocator (bytes).
+        size_t allocatorOverhead;                                           ///< The TLSF control structure and pool overhead (bytes).
+        size_t total;                                                       ///< Sum of everything above (bytes).
+
+        ConnectionMemoryFootprint()
+        {
+            memset( this, 0, sizeof( ConnectionMemoryFootprint ) );
+        }
+    };
+
+    /**
+        The memory a server needs for its client slots.
+
+        The global allocator is left out: netcode.io allocates from it, so it can't be measured ahead of time. Set BaseClientServerConfig::checkMemory to check serverGlobalMemory once the server has started.
+
+        @see GetServerMemoryFootprint
+     */
+
+    struct ServerMemoryFootprint
+    {
+        ConnectionMemoryFootprint client;                                   ///< The memory each client slot needs. This is the serverPerClientMemory requirement.
+        size_t clientSlots;                                                 ///< The memory for all client slots (bytes). When BaseClientServerConfig::serverSharedClientMemory is true, this is the worst case for the shared pool.
+    };
+
+    /**
+        The CPUs and memory a server process can use, and the server sizes derived from them.
+
+        @see GetServerEnvironment
+        @see ConfigureServerForEnvironment
+     */
+
+    struct ServerEnvironment
+    {
+        int numCpus;                                                        ///< The CPUs the process can run on. See yojimbo_cpu_count.
+        uint64_t memoryLimit;                                               ///< The memory the process can use (bytes), or 0 if unknown. See yojimbo_memory_limit.
+        int numWorkerThreads;                                               ///< The worker threads to create, eg. for a ThreadPool behind Adapter::ParallelFor. One less than numCpus, since the calling thread works too.
+        int maxClients;                                                     ///< The client slots that fit in the memory limit, up to the number asked for. Pass this to Server::Start.
+
+        ServerEnvironment()
+        {
+            numCpus = 1;
+            memoryLimit = 0;
+            numWorkerThreads = 0;
+            maxClients = 0;
+        }
+    };
+
+    /**
+        Read the CPUs and memory this process can use, from the container limits if there are any.
+
+        @param environment The environment (out). Only numCpus and memoryLimit are set.
+     */
+
+    void GetServerEnvironment( ServerEnvironment & environment );
+
+    /**
+        Size a server to the CPUs and memory it can use, so a server in a container doesn't run more threads than its CPU quota, or get killed for going over its memory limit.
+
+        The serverGlobalMemory and serverBroadcastMemory are taken out of the memory budget first. serverPerClientMemory is raised to twice what a connection needs if it is below that, to leave room for messages in flight. It is lowered towards the same floor if the client slots asked for don't fit in what is left. If they still don't fit, maxClients is reduced. With BaseClientServerConfig::serverSharedClientMemory, or an unknown memory limit, the memory config is left alone.
+
+        @param allocator The allocator the scratch memory to measure a connection is taken from. See GetServerMemoryFootprint.
+        @param adapter The adapter that creates the message factory.
+        @param config The client/server config. serverPerClientMemory is adjusted.
+        @param maxClients The number of client slots wanted.
+        @param memoryFraction The fraction of the memory limit the server allocators may take, in (0,1]. The rest is left for the game and the operating system.
+        @param environment The environment, with numCpus and memoryLimit filled in by GetServerEnvironment. numWorkerThreads and maxClients are set (out).
+
+        @returns True if all the client slots asked for fit.
+     */
+
+    bool ConfigureServerForEnvironment( Allocator & allocator, Adapter & adapter, BaseClientServerConfig & config, int maxClients, float memoryFraction, ServerEnvironment & environment );
+
+    /**
+        Work out the memory one connection needs from its allocator.
+
+        Creates the connection, its channels, message factory and reliable.io endpoint in scratch memory taken from the allocator passed in, measures them and frees them again. This takes about as much memory and time as creating a client, so don't call it every frame.
+
+        @param allocator The allocator the scratch memory is taken from.
+        @param adapter The adapter that creates the message factory.
+        @param config The client/server config.
+        @param client True for the client allocator (clientMemory), false for a server client slot (serverPerClientMemory).
+        @param footprint The memory footprint (out).
+     */
+
+    void GetConnectionMemoryFootprint( Allocator & allocator, Adapter & adapter, const BaseClientServerConfig & config, bool client, ConnectionMemoryFootprint & footprint );
+
+    /**
+        Work out the memory a server needs for its client slots.
+
+        @param allocator The allocator the scratch memory is taken from.
+        @param adapter The adapter that creates the message factory.
+        @param config The client/server config.
+        @param maxClients The number of client slots passed to Server::Start.
+        @param footprint The memory footprint (out).
+
+        @see GetConnectionMemoryFootprint
+     */
+
+    void GetServerMemoryFootprint( Allocator & allocator, Adapter & adapter, const BaseClientServerConfig & config, int maxClients, ServerMemoryFootprint & footprint );
+
+    /**
+        Warn if an allocator is too small or much too large for what it needs to hold.
+
+        Prints a warning if memoryBytes is below requiredBytes, or above MemoryOversizeFactor times requiredBytes.
+
+        @param name The config field the memory comes from, for the warning.
+        @param memoryBytes The memory given to the allocator (bytes).
+        @param requiredBytes The memory the allocator needs (bytes).
+
+        @returns True if the memory is within range.
+     */
+
+    bool CheckMemoryFootprint( const char * name, size_t memoryBytes, size_t requiredBytes );
+}
+
+#endif // #ifndef YOJIMBO_FOOTPRINT_H
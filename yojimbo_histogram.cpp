@@ -0,0 +1,100 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_histogram.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static int latency_histogram_bucket( uint32_t microseconds )
+    {
+        // values below the sub-bucket count get a bucket each. above that, each power of two is split into the same number of sub-buckets
+
+        if ( microseconds < uint32_t( LatencyHistogramSubBuckets ) )
+            return int( microseconds );
+
+        int exponent = 0;
+        while ( ( microseconds >> exponent ) >= uint32_t( LatencyHistogramSubBuckets * 2 ) )
+            exponent++;
+
+        const int subBucket = int( microseconds >> exponent ) - LatencyHistogramSubBuckets;
+        const int bucket = ( exponent + 1 ) * LatencyHistogramSubBuckets + subBucket;
+        return bucket < LatencyHistogramNumBuckets ? bucket : LatencyHistogramNumBuckets - 1;
+    }
+
+    static double latency_histogram_bucket_middle( int bucket )
+    {
+        if ( bucket < LatencyHistogramSubBuckets )
+            return double( bucket ) * 0.000001;
+
+        const int exponent = bucket / LatencyHistogramSubBuckets - 1;
+        const int subBucket = bucket % LatencyHistogramSubBuckets;
+        const double lower = double( uint64_t( LatencyHistogramSubBuckets + subBucket ) << exponent );
+        const double width = double( uint64_t( 1 ) << exponent );
+        return ( lower + width * 0.5 ) * 0.000001;
+    }
+
+    void LatencyHistogram::Clear()
+    {
+        memset( buckets, 0, sizeof( buckets ) );
+        count = 0;
+        sum = 0.0;
+        max = 0.0;
+    }
+
+    void LatencyHistogram::Record( double seconds )
+    {
+        if ( seconds < 0.0 )
+            seconds = 0.0;
+        const double microseconds = seconds * 1000000.0;
+        buckets[latency_histogram_bucket( microseconds < 4294967295.0 ? uint32_t( microseconds ) : 0xFFFFFFFF )]++;
+        count++;
+        sum += seconds;
+        if ( seconds > max )
+            max = seconds;
+    }
+
+    void LatencyHistogram::Add( const LatencyHistogram & other )
+    {
+        for ( int i = 0; i < LatencyHistogramNumBuckets; ++i )
+            buckets[i] += other.buckets[i];
+        count += other.count;
+        sum += other.sum;
+        if ( other.max > max )
+            max = other.max;
+    }
+
+    double LatencyHistogram::GetPercentile( double percentile ) const
+    {
+        if ( count == 0 )
+            return 0.0;
+
+        if ( percentile < 0.0 )
+            percentile = 0.0;
+        if ( percentile > 1.0 )
+            percentile = 1.0;
+
+        // the value at this rank is the percentile. ranks start at 1
+
+        uint64_t rank = uint64_t( percentile * double( count ) + 0.5 );
+        if ( rank < 1 )
+            rank = 1;
+
+        uint64_t total = 0;
+        for ( int i = 0; i < LatencyHistogramNumBuckets; ++i )
+        {
+            total += buckets[i];
+            if ( total >= rank )
+            {
+                const double middle = latency_histogram_bucket_middle( i );
+                return middle < max ? middle : max;
+            }
+        }
+
+        return max;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_HISTOGRAM_H
+#define YOJIMBO_HISTOGRAM_H
+
+#include "yojimbo_config.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    const int LatencyHistogramSubBuckets = 8;                               ///< Buckets per power of two in a latency histogram, so each bucket is within 12.5% of the values in it.
+    const int LatencyHistogramNumBuckets = 30 * LatencyHistogramSubBuckets; ///< Number of buckets in a latency histogram. Covers 0 to 2^32 microseconds.
+
+    /**
+        A histogram of latencies, with buckets of constant relative precision over microseconds to hours, as in HDR histograms.
+
+        Recording a value is a few integer operations and no allocations, cheap enough to do for every message. The histogram is a plain fixed size struct, so it can be copied out for reporting.
+
+        @see ChannelConfig::latencyHistograms
+     */
+
+    struct LatencyHistogram
+    {
+        uint32_t buckets[LatencyHistogramNumBuckets];                        ///< Number of values recorded in each bucket.
+        uint64_t count;                                                      ///< Number of values recorded.
+        double sum;                                                          ///< Sum of the values recorded (seconds).
+        double max;                                                          ///< Largest value recorded (seconds).
+
+        LatencyHistogram() { Clear(); }
+
+        /**
+            Remove every value recorded.
+         */
+
+        void Clear();
+
+        /**
+            Record a latency.
+
+            @param seconds The latency (seconds). Negative values are recorded as 0.
+         */
+
+        void Record( double seconds );
+
+        /**
+            Add the values recorded in another histogram to this one. Use this to combine the histograms of many connections.
+
+            @param other The histogram to add.
+         */
+
+        void Add( const LatencyHistogram & other );
+
+        /**
+            Get the mean latency.
+
+            @returns The mean of the values recorded (seconds), or 0 if none were recorded.
+         */
+
+        double GetMean() const { return count > 0 ? sum / double( count ) : 0.0; }
+
+        /**
+            Get a latency percentile, eg. 0.5 for the median or 0.99 for the 99th percentile.
+
+            @param percentile The percentile in [0,1].
+
+            @returns The middle of the bucket holding the percentile (seconds), or 0 if no values were recorded.
+         */
+
+        double GetPercentile( double percentile ) const;
+    };
+}
+
+#endif // #ifndef YOJIMBO_HISTOGRAM_H
@@ -25,6 +25,17 @@
 
 namespace yojimbo
 {
+    static const double PrefetchMinimumLifetime = 5.0;                  ///< Prefetched connect tokens with less time than this left (seconds) aren't handed out, so the netcode handshake can finish before they expire.
+    static const double PrefetchRetryTime = 1.0;                        ///< How long to wait before fetching again after a prefetch request failed (seconds).
+
+    /// Steps of a match request in progress. See Matcher::Update.
+
+    enum MatcherStep
+    {
+        MATCHER_STEP_HANDSHAKE,                                 ///< Performing the TLS handshake.
+        MATCHER_STEP_EXCHANGE                                   ///< Sending the HTTP requests and reading the responses. Requests are pipelined, so both happen at once.
+    };
+
     struct MatcherInternal
     {
         mbedtls_net_context server_fd;
@@ -33,8 +44,58 @@ namespace yojimbo
         mbedtls_ssl_context ssl;
         mbedtls_ssl_config conf;
         mbedtls_x509_crt cacert;
+        mbedtls_ssl_session session;                            ///< The TLS session from the last handshake, for resuming it on the next connection.
+        bool hasSession;                                        ///< True if session holds a session to resume.
+        bool connected;                                         ///< True while the connection to the matcher is open. It is kept open between requests.
+        bool reusedConnection;                                  ///< True if the request in progress was sent on a connection kept open from an earlier request.
+        MatcherStep step;
+        uint64_t protocolId;                                    ///< The protocol id for the requests in progress.
+        uint64_t singleClientId;                                ///< Storage for the client id of a single match request, so it doesn't allocate.
+        uint64_t * clientIds;                                   ///< The client ids to request matches for. One request per client id.
+        int numRequests;                                        ///< The number of requests.
+        int numRequestsWritten;                                 ///< The number of requests sent so far.
+        int numResponsesRead;                                   ///< The number of responses read so far. The connect token for each is decoded as it arrives.
+        char request[1024];
+        int requestBytes;                                       ///< Size of the request being sent. 0 if the next request has not been formatted yet.
+        int bytesWritten;
+        char response[2*ConnectTokenBytes];
+        int bytesRead;
+        bool prefetching;                                       ///< True between Matcher::StartPrefetch and Matcher::StopPrefetch.
+        bool prefetchRequest;                                   ///< True if the request in progress is a prefetch refresh.
+        bool prefetchAdopted;                                   ///< True if Matcher::RequestMatch asked for the token of the prefetch refresh in progress, so it is used up as soon as it arrives.
+        bool hasPrefetchedToken;                                ///< True if prefetchedToken holds a token that hasn't been handed out yet.
+        uint64_t prefetchProtocolId;                            ///< The protocol id to prefetch connect tokens for.
+        uint64_t prefetchClientId;                              ///< The client id to prefetch connect tokens for.
+        double prefetchStartTime;                               ///< When the prefetch request in progress was started. Token lifetimes count from here, to stay on the safe side.
+        double prefetchRefreshTime;                             ///< When to fetch the next token.
+        double prefetchExpireTime;                              ///< When the prefetched token expires, on the yojimbo_time clock.
+        uint8_t prefetchedToken[ConnectTokenBytes];             ///< The prefetched connect token.
     };
 
+    /**
+        Read how long a connect token is valid for from its public header.
+
+        The create and expire timestamps are both set by the matcher, so their difference doesn't depend on the matcher's clock agreeing with ours.
+     */
+
+    static bool read_connect_token_lifetime( const uint8_t * connectToken, double & lifetime )
+    {
+        // version info, then protocol id, create timestamp and expire timestamp, little endian
+
+        const uint8_t * p = connectToken + NETCODE_VERSION_INFO_BYTES + 8;
+        uint64_t createTimestamp = 0;
+        uint64_t expireTimestamp = 0;
+        for ( int i = 0; i < 8; ++i )
+        {
+            createTimestamp |= uint64_t( p[i] ) << ( i * 8 );
+            expireTimestamp |= uint64_t( p[8+i] ) << ( i * 8 );
+        }
+        if ( expireTimestamp <= createTimestamp )
+            return false;
+        lifetime = double( expireTimestamp - createTimestamp );
+        return true;
+    }
+
     Matcher::Matcher( Allocator & allocator )
     {
         yojimbo_assert( ConnectTokenBytes == NETCODE_CONNECT_TOKEN_BYTES );
@@ -42,15 +103,29 @@ namespace yojimbo
         m_initialized = false;
         m_matchStatus = MATCH_IDLE;
         m_internal = YOJIMBO_NEW( allocator, MatcherInternal );
+        m_internal->hasSession = false;
+        m_internal->connected = false;
+        m_internal->reusedConnection = false;
+        m_internal->singleClientId = 0;
+        m_internal->clientIds = NULL;
+        m_internal->numRequests = 0;
+        m_internal->prefetching = false;
+        m_internal->prefetchRequest = false;
+        m_internal->prefetchAdopted = false;
+        m_internal->hasPrefetchedToken = false;
+        m_connectTokens = m_connectToken;
         memset( m_connectToken, 0, sizeof( m_connectToken ) );
     }
 
     Matcher::~Matcher()
     {
+        Disconnect();
+        FreeRequests();
         mbedtls_net_free( &m_internal->server_fd );
         mbedtls_x509_crt_free( &m_internal->cacert );
         mbedtls_ssl_free( &m_internal->ssl );
         mbedtls_ssl_config_free( &m_internal->conf );
+        mbedtls_ssl_session_free( &m_internal->session );
         mbedtls_ctr_drbg_free( &m_internal->ctr_drbg );
         mbedtls_entropy_free( &m_internal->entropy );
         YOJIMBO_DELETE( *m_allocator, MatcherInternal, m_internal );
@@ -63,6 +138,7 @@ namespace yojimbo
         mbedtls_net_init( &m_internal->server_fd );
         mbedtls_ssl_init( &m_internal->ssl );
         mbedtls_ssl_config_init( &m_internal->conf );
+        mbedtls_ssl_session_init( &m_internal->session );
         mbedtls_x509_crt_init( &m_internal->cacert );
         mbedtls_ctr_drbg_init( &m_internal->ctr_drbg );
         mbedtls_entropy_init( &m_internal->entropy );
@@ -81,6 +157,23 @@ namespace yojimbo
             return false;
         }
 
+        if ( ( result = mbedtls_ssl_config_defaults( &m_internal->conf,
+                        MBEDTLS_SSL_IS_CLIENT,
+                        MBEDTLS_SSL_TRANSPORT_STREAM,
+                        MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_config_defaults failed (%d)\n", result );
+            return false;
+        }
+
+        mbedtls_ssl_conf_authmode( &m_internal->conf, MBEDTLS_SSL_VERIFY_OPTIONAL );
+        mbedtls_ssl_conf_ca_chain( &m_internal->conf, &m_internal->cacert, NULL );
+        mbedtls_ssl_conf_rng( &m_internal->conf, mbedtls_ctr_drbg_random, &m_internal->ctr_drbg );
+
+#if defined( MBEDTLS_SSL_SESSION_TICKETS )
+        mbedtls_ssl_conf_session_tickets( &m_internal->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED );
+#endif // #if defined( MBEDTLS_SSL_SESSION_TICKETS )
+
         m_initialized = true;
 
         memset( m_connectToken, 0, sizeof( m_connectToken ) );
@@ -89,147 +182,559 @@ namespace yojimbo
     }
 
     void Matcher::RequestMatch( uint64_t protocolId, uint64_t clientId )
+    {
+        if ( m_internal->prefetching && protocolId == m_internal->prefetchProtocolId && clientId == m_internal->prefetchClientId )
+        {
+            if ( m_matchStatus == MATCH_BUSY && m_internal->prefetchRequest )
+            {
+                // the refresh in flight is what we want. it becomes this request
+
+                m_internal->prefetchAdopted = true;
+                return;
+            }
+
+            if ( HasPrefetchedConnectToken() && m_matchStatus != MATCH_BUSY )
+            {
+                FreeRequests();
+                memcpy( m_connectToken, m_internal->prefetchedToken, ConnectTokenBytes );
+                m_internal->numRequests = 1;
+                m_internal->hasPrefetchedToken = false;
+                m_internal->prefetchRefreshTime = 0.0;
+                m_matchStatus = MATCH_READY;
+                return;
+            }
+        }
+
+        RequestMatches( protocolId, &clientId, 1 );
+    }
+
+    void Matcher::StartPrefetch( uint64_t protocolId, uint64_t clientId )
     {
         yojimbo_assert( m_initialized );
 
-        const char * data;
-        char request[1024];
-        int bytesRead = 0;
+        if ( m_internal->prefetching && ( protocolId != m_internal->prefetchProtocolId || clientId != m_internal->prefetchClientId ) )
+            StopPrefetch();
+
+        m_internal->prefetching = true;
+        m_internal->prefetchProtocolId = protocolId;
+        m_internal->prefetchClientId = clientId;
+        m_internal->prefetchRefreshTime = 0.0;
+
+        UpdatePrefetch();
+    }
+
+    void Matcher::StopPrefetch()
+    {
+        m_internal->prefetching = false;
+        m_internal->prefetchRequest = false;
+        m_internal->prefetchAdopted = false;
+        m_internal->hasPrefetchedToken = false;
+    }
+
+    void Matcher::UpdatePrefetch()
+    {
+        if ( !m_internal->prefetching )
+            return;
+
+        Update();
+
+        if ( m_matchStatus == MATCH_BUSY || yojimbo_time() < m_internal->prefetchRefreshTime )
+            return;
+
+        m_internal->prefetchRequest = true;
+        m_internal->prefetchAdopted = false;
+        m_internal->prefetchStartTime = yojimbo_time();
+
+        RequestMatches( m_internal->prefetchProtocolId, &m_internal->prefetchClientId, 1 );
+
+        // the connect can fail before the request goes out, and that needs a retry too
+
+        if ( m_internal->prefetchRequest && m_matchStatus != MATCH_BUSY )
+            FinishPrefetch();
+    }
+
+    bool Matcher::HasPrefetchedConnectToken() const
+    {
+        return m_internal->hasPrefetchedToken && yojimbo_time() < m_internal->prefetchExpireTime - PrefetchMinimumLifetime;
+    }
+
+    void Matcher::FinishPrefetch()
+    {
+        yojimbo_assert( m_internal->prefetchRequest );
+        yojimbo_assert( m_matchStatus != MATCH_BUSY );
+
+        const bool adopted = m_internal->prefetchAdopted;
+
+        m_internal->prefetchRequest = false;
+        m_internal->prefetchAdopted = false;
+
+        double lifetime = 0.0;
+
+        if ( m_matchStatus != MATCH_READY || !read_connect_token_lifetime( m_connectToken, lifetime ) )
+        {
+            m_internal->prefetchRefreshTime = yojimbo_time() + PrefetchRetryTime;
+            if ( !adopted )
+                m_matchStatus = MATCH_IDLE;
+            return;
+        }
+
+        if ( adopted )
+        {
+            // handed out as soon as it arrived, so fetch the next one straight away
+
+            m_internal->prefetchRefreshTime = 0.0;
+            return;
+        }
+
+        memcpy( m_internal->prefetchedToken, m_connectToken, ConnectTokenBytes );
+        m_internal->hasPrefetchedToken = true;
+        m_internal->prefetchExpireTime = m_internal->prefetchStartTime + lifetime;
+        m_internal->prefetchRefreshTime = m_internal->prefetchStartTime + lifetime * 0.5;
+
+        // nobody asked for this result, so the matcher is idle again
+
+        m_matchStatus = MATCH_IDLE;
+    }
+
+    void Matcher::RequestMatches( uint64_t protocolId, const uint64_t * clientIds, int numClientIds )
+    {
+        yojimbo_assert( m_initialized );
+        yojimbo_assert( clientIds );
+        yojimbo_assert( numClientIds > 0 );
+
+        if ( m_matchStatus == MATCH_BUSY )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: match request is already in progress\n" );
+            return;
+        }
+
+        FreeRequests();
+
+        m_matchStatus = MATCH_FAILED;
+
+        if ( numClientIds == 1 )
+        {
+            m_internal->singleClientId = clientIds[0];
+            m_internal->clientIds = &m_internal->singleClientId;
+        }
+        else
+        {
+            m_internal->clientIds = (uint64_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint64_t ) * numClientIds );
+            m_connectTokens = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, size_t( ConnectTokenBytes ) * numClientIds );
+            if ( !m_internal->clientIds || !m_connectTokens )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate %d match requests\n", numClientIds );
+                FreeRequests();
+                return;
+            }
+            memcpy( m_internal->clientIds, clientIds, sizeof( uint64_t ) * numClientIds );
+        }
+
+        m_internal->protocolId = protocolId;
+        m_internal->numRequests = numClientIds;
+        m_internal->numRequestsWritten = 0;
+        m_internal->numResponsesRead = 0;
+        m_internal->requestBytes = 0;
+        m_internal->bytesWritten = 0;
+        m_internal->bytesRead = 0;
+        memset( m_internal->response, 0, sizeof( m_internal->response ) );
+
+        if ( m_internal->connected )
+        {
+            // skip the connect and handshake entirely and send the requests on the open connection
+
+            m_internal->reusedConnection = true;
+            m_internal->step = MATCHER_STEP_EXCHANGE;
+        }
+        else
+        {
+            m_internal->reusedConnection = false;
+            if ( !Connect() )
+                return;
+        }
+
+        m_matchStatus = MATCH_BUSY;
+
+        Update();
+    }
+
+    void Matcher::FreeRequests()
+    {
+        if ( m_internal->clientIds != &m_internal->singleClientId )
+        {
+            YOJIMBO_FREE( *m_allocator, m_internal->clientIds );
+        }
+        if ( m_connectTokens != m_connectToken )
+        {
+            YOJIMBO_FREE( *m_allocator, m_connectTokens );
+        }
+        m_internal->clientIds = NULL;
+        m_internal->numRequests = 0;
+        m_connectTokens = m_connectToken;
+    }
+
+    bool Matcher::Connect()
+    {
+        // each connection gets a fresh ssl context. the configuration and the session to resume carry over
+
+        mbedtls_net_free( &m_internal->server_fd );
+        mbedtls_ssl_free( &m_internal->ssl );
+        mbedtls_net_init( &m_internal->server_fd );
+        mbedtls_ssl_init( &m_internal->ssl );
 
         int result;
 
         if ( ( result = mbedtls_net_connect( &m_internal->server_fd, SERVER_NAME, SERVER_PORT, MBEDTLS_NET_PROTO_TCP ) ) != 0 )
         {
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_net_connect failed (%d)\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            return false;
         }
 
-        if ( ( result = mbedtls_ssl_config_defaults( &m_internal->conf,
-                        MBEDTLS_SSL_IS_CLIENT,
-                        MBEDTLS_SSL_TRANSPORT_STREAM,
-                        MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
+        if ( ( result = mbedtls_net_set_nonblock( &m_internal->server_fd ) ) != 0 )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_net_connect failed (%d)\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_net_set_nonblock failed (%d)\n", result );
+            mbedtls_net_free( &m_internal->server_fd );
+            return false;
         }
 
-        mbedtls_ssl_conf_authmode( &m_internal->conf, MBEDTLS_SSL_VERIFY_OPTIONAL );
-        mbedtls_ssl_conf_ca_chain( &m_internal->conf, &m_internal->cacert, NULL );
-        mbedtls_ssl_conf_rng( &m_internal->conf, mbedtls_ctr_drbg_random, &m_internal->ctr_drbg );
-
         if ( ( result = mbedtls_ssl_setup( &m_internal->ssl, &m_internal->conf ) ) != 0 )
         {
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_setup failed (%d)\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            mbedtls_net_free( &m_internal->server_fd );
+            return false;
         }
 
         if ( ( result = mbedtls_ssl_set_hostname( &m_internal->ssl, "yojimbo" ) ) != 0 )
         {
             yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_set_hostname failed (%d)\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            mbedtls_net_free( &m_internal->server_fd );
+            return false;
         }
 
         mbedtls_ssl_set_bio( &m_internal->ssl, &m_internal->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
 
-        while ( ( result = mbedtls_ssl_handshake( &m_internal->ssl ) ) != 0 )
+        // offer the previous session, so the handshake is abbreviated: no certificate exchange or key agreement
+
+        if ( m_internal->hasSession && ( result = mbedtls_ssl_set_session( &m_internal->ssl, &m_internal->session ) ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "mbedtls_ssl_set_session failed (%d). doing a full handshake\n", result );
+        }
+
+        m_internal->step = MATCHER_STEP_HANDSHAKE;
+
+        return true;
+    }
+
+    void Matcher::Disconnect()
+    {
+        if ( !m_internal->connected )
+            return;
+
+        // the socket is non-blocking, so the close notify is best effort
+
+        mbedtls_ssl_close_notify( &m_internal->ssl );
+        mbedtls_net_free( &m_internal->server_fd );
+
+        m_internal->connected = false;
+    }
+
+    bool Matcher::Reconnect()
+    {
+        // only requests sent on an old connection that the matcher closed while idle are worth retrying
+
+        if ( !m_internal->reusedConnection || m_internal->bytesRead > 0 )
+            return false;
+
+        Disconnect();
+
+        m_internal->reusedConnection = false;
+        m_internal->numRequestsWritten = m_internal->numResponsesRead;
+        m_internal->requestBytes = 0;
+
+        return Connect();
+    }
+
+    void Matcher::Update()
+    {
+        UpdateRequest();
+
+        if ( m_internal->prefetchRequest && m_matchStatus != MATCH_BUSY )
+            FinishPrefetch();
+    }
+
+    void Matcher::UpdateRequest()
+    {
+        while ( m_matchStatus == MATCH_BUSY )
         {
-            if ( result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE )
+            if ( m_internal->step == MATCHER_STEP_HANDSHAKE )
+            {
+                const int result = mbedtls_ssl_handshake( &m_internal->ssl );
+
+                if ( result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE )
+                    return;
+
+                if ( result != 0 )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_handshake failed (%d)\n", result );
+                    mbedtls_net_free( &m_internal->server_fd );
+                    m_matchStatus = MATCH_FAILED;
+                    return;
+                }
+
+                // todo: you want to turn this on for release
+                /*
+                uint32_t flags;
+                if ( ( flags = mbedtls_ssl_get_verify_result( &m_internal->ssl ) ) != 0 )
+                {
+                    // IMPORTANT: In secure mode you must use a valid certificate, not a self signed one!
+                    debug_printf( "mbedtls_ssl_get_verify_result failed - flags = %x\n", flags );
+                    m_matchStatus = MATCH_FAILED;
+                    return;
+                }
+                */
+
+                m_internal->connected = true;
+
+                mbedtls_ssl_session_free( &m_internal->session );
+                mbedtls_ssl_session_init( &m_internal->session );
+                m_internal->hasSession = mbedtls_ssl_get_session( &m_internal->ssl, &m_internal->session ) == 0;
+
+                m_internal->step = MATCHER_STEP_EXCHANGE;
+                continue;
+            }
+
+            // keep reading while writing, so neither side stalls with a full socket buffer when many requests are pipelined
+
+            bool progress = false;
+            bool closed = false;
+
+            if ( !WriteRequests( progress ) )
+            {
+                if ( Reconnect() )
+                    continue;
+                Disconnect();
+                m_matchStatus = MATCH_FAILED;
+                return;
+            }
+
+            if ( !ReadResponses( progress, closed ) )
             {
-                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_handshake failed (%d)\n", result );
+                Disconnect();
                 m_matchStatus = MATCH_FAILED;
-                goto cleanup;
+                return;
+            }
+
+            if ( m_internal->numResponsesRead == m_internal->numRequests )
+            {
+                m_matchStatus = MATCH_READY;
+                return;
             }
+
+            if ( closed )
+            {
+                if ( Reconnect() )
+                    continue;
+
+                Disconnect();
+
+                // without a content length, the last response ends when the matcher closes the connection
+
+                if ( m_internal->bytesRead > 0 && m_internal->numResponsesRead == m_internal->numRequests - 1 && ParseResponse( m_internal->numResponsesRead, m_internal->bytesRead ) )
+                {
+                    m_internal->numResponsesRead++;
+                    m_matchStatus = MATCH_READY;
+                }
+                else
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: matcher closed the connection after %d of %d responses\n", m_internal->numResponsesRead, m_internal->numRequests );
+                    m_matchStatus = MATCH_FAILED;
+                }
+                return;
+            }
+
+            if ( !progress )
+                return;
         }
+    }
 
-        // todo: you want to turn this on for release
-        /*
-        uint32_t flags;
-        if ( ( flags = mbedtls_ssl_get_verify_result( &m_internal->ssl ) ) != 0 )
+    bool Matcher::WriteRequests( bool & progress )
+    {
+        while ( m_internal->numRequestsWritten < m_internal->numRequests )
         {
-            // IMPORTANT: In secure mode you must use a valid certificate, not a self signed one!
-            debug_printf( "mbedtls_ssl_get_verify_result failed - flags = %x\n", flags );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
-        }
-        */
+            if ( m_internal->requestBytes == 0 )
+            {
+                sprintf( m_internal->request, "GET /match/%" PRIu64 "/%" PRIu64 " HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", m_internal->protocolId, m_internal->clientIds[m_internal->numRequestsWritten], SERVER_NAME );
+
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "match request:\n" );
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "%s\n", m_internal->request );
 
-        sprintf( request, "GET /match/%" PRIu64 "/%" PRIu64 " HTTP/1.0\r\n\r\n", protocolId, clientId );
+                m_internal->requestBytes = (int) strlen( m_internal->request );
+                m_internal->bytesWritten = 0;
+            }
 
-        yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "match request:\n" );
-        yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "%s\n", request );
+            const int result = mbedtls_ssl_write( &m_internal->ssl, (uint8_t*) ( m_internal->request + m_internal->bytesWritten ), m_internal->requestBytes - m_internal->bytesWritten );
 
-        while ( ( result = mbedtls_ssl_write( &m_internal->ssl, (uint8_t*) request, strlen( request ) ) ) <= 0 )
-        {
-            if ( result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE )
+            if ( result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE )
+                return true;
+
+            if ( result <= 0 )
             {
                 yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: mbedtls_ssl_write failed (%d)\n", result );
-                m_matchStatus = MATCH_FAILED;
-                goto cleanup;
+                return false;
+            }
+
+            progress = true;
+
+            m_internal->bytesWritten += result;
+
+            if ( m_internal->bytesWritten == m_internal->requestBytes )
+            {
+                m_internal->numRequestsWritten++;
+                m_internal->requestBytes = 0;
             }
         }
 
-        char buffer[2*ConnectTokenBytes];
+        return true;
+    }
 
-        memset( buffer, 0, sizeof( buffer ) );
+    bool Matcher::ReadResponses( bool & progress, bool & closed )
+    {
+        const int bufferBytes = (int) sizeof( m_internal->response ) - 1;
 
-        do
+        while ( m_internal->numResponsesRead < m_internal->numRequestsWritten )
         {
-            result = mbedtls_ssl_read( &m_internal->ssl, (uint8_t*) ( buffer + bytesRead ), sizeof( buffer ) - bytesRead - 1 );
+            const int result = mbedtls_ssl_read( &m_internal->ssl, (uint8_t*) ( m_internal->response + m_internal->bytesRead ), bufferBytes - m_internal->bytesRead );
 
             if ( result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE )
-                continue;
-
-            if ( result == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY )
-                break;
+                return true;
 
             if ( result <= 0 )
-                break;
+            {
+                closed = true;
+                return true;
+            }
+
+            progress = true;
+
+            m_internal->bytesRead += result;
+
+            // with a content length each response is complete without the matcher closing the connection, so it stays open for the next request.
+            // anything after the response is the start of the next one.
+
+            int responseBytes;
+            while ( m_internal->numResponsesRead < m_internal->numRequests && ( responseBytes = GetResponseBytes() ) > 0 )
+            {
+                if ( !ParseResponse( m_internal->numResponsesRead, responseBytes ) )
+                    return false;
+
+                m_internal->numResponsesRead++;
+
+                memmove( m_internal->response, m_internal->response + responseBytes, m_internal->bytesRead - responseBytes );
+                m_internal->bytesRead -= responseBytes;
+                memset( m_internal->response + m_internal->bytesRead, 0, sizeof( m_internal->response ) - m_internal->bytesRead );
+            }
 
-            bytesRead += result;
+            if ( m_internal->bytesRead == bufferBytes )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: match response is too large\n" );
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int Matcher::GetResponseBytes() const
+    {
+        const char * response = m_internal->response;
+
+        const char * body = strstr( response, "\r\n\r\n" );
+        if ( !body )
+            return 0;
+
+        body += 4;
+
+        // header names are case insensitive
+
+        const char * header = response;
+        while ( header < body )
+        {
+            if ( strncmp( header, "Content-Length:", 15 ) == 0 || strncmp( header, "content-length:", 15 ) == 0 )
+            {
+                const int responseBytes = int( body - response ) + atoi( header + 15 );
+                return ( m_internal->bytesRead >= responseBytes ) ? responseBytes : 0;
+            }
+
+            const char * next = strstr( header, "\r\n" );
+            if ( !next )
+                break;
+            header = next + 2;
         }
-        while( 1 );
 
-        yojimbo_assert( bytesRead <= (int) sizeof( buffer ) );
+        return 0;
+    }
+
+    bool Matcher::ParseResponse( int index, int responseBytes )
+    {
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < m_internal->numRequests );
+        yojimbo_assert( responseBytes <= m_internal->bytesRead );
+
+        char * response = m_internal->response;
 
-        data = strstr( (const char*)buffer, "\r\n\r\n" );
+        // terminate the response, in case the next pipelined response follows it
 
-        while ( *data == 13 || *data == 10 )
-            ++data;
+        const char next = response[responseBytes];
+        response[responseBytes] = '\0';
 
-        yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "================================================\n%s\n================================================\n", data );
+        bool result = true;
 
-        result = base64_decode_data( data, m_connectToken, sizeof( m_connectToken ) );
-        if ( result == ConnectTokenBytes )
+        const char * data = strstr( (const char*) response, "\r\n\r\n" );
+
+        if ( data )
         {
-            m_matchStatus = MATCH_READY;
+            while ( *data == 13 || *data == 10 )
+                ++data;
+
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "================================================\n%s\n================================================\n", data );
+
+            if ( base64_decode_data( data, m_connectTokens + size_t( index ) * ConnectTokenBytes, ConnectTokenBytes ) != ConnectTokenBytes )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "failed to decode connect token base64\n" );
+                result = false;
+            }
         }
         else
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "failed to decode connect token base64\n" );
-            m_matchStatus = MATCH_FAILED;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: match response has no body\n" );
+            result = false;
         }
 
-    cleanup:
+        response[responseBytes] = next;
 
-        mbedtls_ssl_close_notify( &m_internal->ssl );
+        return result;
     }
 
     MatchStatus Matcher::GetMatchStatus()
     {
+        Update();
         return m_matchStatus;
     }
 
     void Matcher::GetConnectToken( uint8_t * connectToken )
+    {
+        GetConnectToken( 0, connectToken );
+    }
+
+    void Matcher::GetConnectToken( int index, uint8_t * connectToken )
     {
         yojimbo_assert( connectToken );
         yojimbo_assert( m_matchStatus == MATCH_READY );
-        if ( m_matchStatus == MATCH_READY )
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < m_internal->numRequests );
+        if ( m_matchStatus == MATCH_READY && index >= 0 && index < m_internal->numRequests )
         {
-            memcpy( connectToken, m_connectToken, ConnectTokenBytes );
+            memcpy( connectToken, m_connectTokens + size_t( index ) * ConnectTokenBytes, ConnectTokenBytes );
         }
     }
 }
@@ -17,7 +17,7 @@ namespace yojimbo
     /**
         Matcher status enum.
 
-        Designed for when the matcher will be made non-blocking. The matcher is currently blocking in Matcher::RequestMatch
+        Poll Matcher::GetMatchStatus while the status is MATCH_BUSY.
      */
 
     enum MatchStatus
@@ -33,7 +33,11 @@ namespace yojimbo
 
         See docker/matcher/matcher.go for details. Launch the matcher via "premake5 matcher".
 
-        This class will be improved in the future, most importantly to make Matcher::RequestMatch a non-blocking operation.
+        The connection to the matcher is kept open between requests, and when it does have to reconnect, the previous TLS session is resumed. Repeated requests skip the TCP connect, and the full handshake.
+
+        Match requests are non-blocking after the TCP connect: the TLS handshake, request and response are advanced a step at a time each time the match status is polled, so they overlap with the rest of your frame.
+
+        With Matcher::StartPrefetch, the matcher keeps a fresh connect token for one client id in the background, so Matcher::RequestMatch for that client is ready at once, without a round trip to the matcher.
      */
 
     class Matcher
@@ -69,7 +73,9 @@ namespace yojimbo
 
             They request a match and the server replies with a set of servers to connect to, and a connect token to pass to that server.
 
-            IMPORTANT: This function is currently blocking. It will be made non-blocking in the near future.
+            This connects to the matcher, which blocks for the TCP connect, then returns with the match status set to MATCH_BUSY. Poll Matcher::GetMatchStatus each frame until the status is MATCH_READY or MATCH_FAILED.
+
+            A request while another is in progress is ignored.
 
             @param protocolId The protocol id that we are using. Used to filter out servers with different protocol versions.
             @param clientId A unique client identifier that identifies each client to your back end services. If you don't have this yet, just roll a random 64 bit number.
@@ -80,10 +86,27 @@ namespace yojimbo
 
         void RequestMatch( uint64_t protocolId, uint64_t clientId );
 
+        /**
+            Request a batch of matches, one for each client id.
+
+            This is for load generators and tests that need many connect tokens. The requests are pipelined on the same connection, so the whole batch takes one round trip to the matcher, instead of one round trip per token.
+
+            The match status is MATCH_READY once every connect token has arrived, and MATCH_FAILED if any of them couldn't be fetched.
+
+            @param protocolId The protocol id that we are using. Used to filter out servers with different protocol versions.
+            @param clientIds The array of client ids to request matches for.
+            @param numClientIds The number of client ids in the array.
+
+            @see Matcher::GetMatchStatus
+            @see Matcher::GetConnectToken
+         */
+
+        void RequestMatches( uint64_t protocolId, const uint64_t * clientIds, int numClientIds );
+
         /**
             Get the current match status.
 
-            Because Matcher::RequestMatch is currently blocking this will be MATCH_READY or MATCH_FAILED immediately after that function returns.
+            While a match request is in progress, this also advances it as far as it can go without blocking, so call it regularly until the status is no longer MATCH_BUSY.
 
             If the status is MATCH_READY you can call Matcher::GetMatchResponse to get the match response data corresponding to the last call to Matcher::RequestMatch.
 
@@ -105,17 +128,161 @@ namespace yojimbo
 
         void GetConnectToken( uint8_t * connectToken );
 
+        /**
+            Get the connect token for one client in the last batch of match requests.
+
+            This can only be called if the match status is MATCH_READY.
+
+            @param index The index of the client id passed in to Matcher::RequestMatches, in [0,numClientIds-1].
+            @param connectToken The connect token data to fill [out].
+
+            @see Matcher::RequestMatches
+         */
+
+        void GetConnectToken( int index, uint8_t * connectToken );
+
+        /**
+            Keep a fresh connect token for a client ready in the background.
+
+            Fetches a connect token now, and a new one once half of its lifetime has passed or after it has been used. Call Matcher::UpdatePrefetch each frame to drive this.
+
+            Matcher::RequestMatch with the same protocol and client id then hands out the prefetched token straight away, and the match status is MATCH_READY on return. A reconnect after a connection blip starts the netcode handshake without waiting for the matcher.
+
+            Each token is only handed out once, since the server won't accept it from another address.
+
+            @param protocolId The protocol id to request matches for.
+            @param clientId The client id to request matches for.
+
+            @see Matcher::UpdatePrefetch
+            @see Matcher::StopPrefetch
+         */
+
+        void StartPrefetch( uint64_t protocolId, uint64_t clientId );
+
+        /**
+            Stop keeping a connect token ready, and drop the one prefetched. A refresh in progress carries on as a normal match request.
+         */
+
+        void StopPrefetch();
+
+        /**
+            Advance prefetching. Call this each frame while prefetching.
+
+            Starts a refresh when the prefetched token is used up or half way to expiry, and advances it without blocking. A refresh is a normal match request: the match status is MATCH_BUSY while it is in flight, and the result of the previous request is replaced, so read any tokens from a batch request before calling this.
+
+            @see Matcher::StartPrefetch
+         */
+
+        void UpdatePrefetch();
+
+        /**
+            Is a prefetched connect token ready to hand out?
+
+            @returns True if Matcher::RequestMatch for the prefetched client id will be ready immediately.
+         */
+
+        bool HasPrefetchedConnectToken() const;
+
+        /**
+            Close the connection to the matcher, if it is open.
+
+            The connection is kept open after each request so the next request can skip connecting. The TLS session is still remembered, so the next connection resumes it.
+         */
+
+        void Disconnect();
+
     private:
 
         Matcher( const Matcher & matcher );
 
         const Matcher & operator = ( const Matcher & other );
 
+        /**
+            Advance the match request in progress without blocking, and pick up the token of a prefetch request once it completes.
+         */
+
+        void Update();
+
+        /**
+            Advance the match request in progress without blocking. Does nothing unless the match status is MATCH_BUSY.
+         */
+
+        void UpdateRequest();
+
+        /**
+            Keep the connect token from a prefetch request that just finished, or schedule a retry if it failed.
+         */
+
+        void FinishPrefetch();
+
+        /**
+            Free the client ids and connect tokens of the last batch of match requests.
+         */
+
+        void FreeRequests();
+
+        /**
+            Send as many of the pending requests as the socket will take without blocking.
+
+            @param progress Set to true if any request data was sent [out].
+
+            @returns False if the write failed.
+         */
+
+        bool WriteRequests( bool & progress );
+
+        /**
+            Read as much response data as has arrived, and decode the connect token of each complete response.
+
+            @param progress Set to true if any response data was read [out].
+            @param closed Set to true if the matcher closed the connection [out].
+
+            @returns False if a response could not be parsed.
+         */
+
+        bool ReadResponses( bool & progress, bool & closed );
+
+        /**
+            Parse a connect token out of a match response at the start of the response buffer.
+
+            @param index The index of the request the response is for.
+            @param responseBytes The size of the response in bytes.
+
+            @returns True if the connect token was decoded successfully.
+         */
+
+        bool ParseResponse( int index, int responseBytes );
+
+        /**
+            Open a new connection to the matcher, offering the previous TLS session for resumption. Blocks for the TCP connect.
+
+            @returns True if the connection was opened and the handshake can start.
+         */
+
+        bool Connect();
+
+        /**
+            Open a new connection and resend the request in progress, if it was sent on a kept open connection that the matcher has since closed.
+
+            @returns True if the request is being retried.
+         */
+
+        bool Reconnect();
+
+        /**
+            Get the size of the first response in the response buffer, if all of it has been read. This needs a content length header, otherwise the response ends when the matcher closes the connection.
+
+            @returns The size of the first response in bytes, or 0 if it is not complete yet.
+         */
+
+        int GetResponseBytes() const;
+
         Allocator * m_allocator;                                ///< The allocator passed into the constructor.
         bool m_initialized;                                     ///< True if the matcher was successfully initialized. See Matcher::Initialize.
         MatchStatus m_matchStatus;                              ///< The current match status.
         struct MatcherInternal * m_internal;                    ///< Internals are in here to avoid spilling details of mbedtls library outside of yojimbo_matcher.cpp
         uint8_t m_connectToken[ConnectTokenBytes];              ///< The connect token data from the last call to Matcher::RequestMatch once the match status is MATCH_READY.
+        uint8_t * m_connectTokens;                              ///< The connect tokens for the last batch of match requests. Points to m_connectToken for a single request, otherwise allocated.
     };
 }
 
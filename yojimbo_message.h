@@ -12,14 +12,151 @@
 #include "yojimbo_serialize.h"
 #include "yojimbo_allocator.h"
 
-#if YOJIMBO_DEBUG_MESSAGE_LEAKS
-#include <map>
-#endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-
 /** @file */
 
 namespace yojimbo
 {
+    class Message;
+
+    /**
+        The serialized bits of a message, written once and copied into packets from then on.
+
+        This lets the same message go to many clients, or be resent many times, without running its serialize function again. Attach it to a message with Message::AttachSerializedMessage, and channels copy these bits into packets instead of calling the message serialize function. The receiver reads the message as usual.
+
+        Aligned data like serialize_bytes and serialize_string pads to a byte boundary in the packet, so the bits depend on where in the packet the message starts. For these messages the bits are written once for each of the 8 starting bit positions in a byte.
+
+        IMPORTANT: The message is serialized once, with the context passed to SerializedMessage::Create. Don't use this for messages with serialize functions that depend on the connection they are sent over, or for snapshot channels, which delta encode each message against a per-connection baseline.
+
+        Reference counted with atomics, so it can be shared between clients that are updated on different threads. Its allocator must be thread safe if so.
+     */
+
+    class SerializedMessage
+    {
+    public:
+
+        /**
+            Serialize a message, and return the serialized bits with a reference count of 1.
+
+            @param allocator The allocator for the serialized bits. Also passed to the serialize function as the stream allocator.
+            @param message The message to serialize. Any block attached to it is not included, blocks are sent separately.
+            @param context The stream context passed to the serialize function. See BaseStream::SetContext.
+
+            @returns The serialized message, or NULL if the serialize function failed or memory could not be allocated.
+         */
+
+        static SerializedMessage * Create( Allocator & allocator, Message & message, void * context = NULL );
+
+        /**
+            Add a reference.
+         */
+
+        void Acquire() { yojimbo_assert( m_refCount > 0 ); yojimbo_atomic_increment( &m_refCount ); }
+
+        /**
+            Remove a reference. The serialized message is freed when the last reference is removed.
+         */
+
+        void Release()
+        {
+            yojimbo_assert( m_refCount > 0 );
+            if ( yojimbo_atomic_decrement( &m_refCount ) == 0 )
+            {
+                Allocator & allocator = *m_allocator;
+                YOJIMBO_FREE( allocator, m_data );
+                SerializedMessage * self = this;
+                YOJIMBO_DELETE( allocator, SerializedMessage, self );
+            }
+        }
+
+        /**
+            Get the number of bits the message takes in a packet. 
+
+            @returns The number of bits, taking the largest when the bits depend on the starting position. Exact otherwise.
+         */
+
+        int GetMaxBits() const { return m_maxBits; }
+
+        /**
+            Write the serialized bits to a stream.
+
+            @param stream The stream to write to.
+
+            @returns True if the bits fit in the stream, false otherwise.
+         */
+
+        bool Write( WriteStream & stream ) const
+        {
+            const int variant = ( m_numVariants > 1 ) ? ( stream.GetBitsProcessed() % 8 ) : 0;
+            BitReader reader( m_data + variant * m_variantBytes, m_variantBytes );
+            // each variant is written after as many padding bits as its starting bit position, so that alignment lands in the same place
+            if ( variant > 0 )
+                reader.ReadBits( variant );
+            int bits = m_numBits[variant];
+            while ( bits >= 32 )
+            {
+                if ( !stream.SerializeBits( reader.ReadBits( 32 ), 32 ) )
+                    return false;
+                bits -= 32;
+            }
+            if ( bits > 0 && !stream.SerializeBits( reader.ReadBits( bits ), bits ) )
+                return false;
+            return true;
+        }
+
+        /**
+            Can these bits be copied into a stream?
+
+            The bits are written with the serialize checks setting a new stream has by default. If the message serializes any checks, they only match streams with the same setting, and the message must be serialized as usual for the others. See ConnectionConfig::serializeChecks.
+
+            @param stream The stream the message is to be written to.
+
+            @returns True if the serialized bits can be written to the stream.
+         */
+
+        bool CanWrite( const BaseStream & stream ) const { return !m_hasChecks || stream.GetSerializeChecks() == m_serializeChecks; }
+
+        /**
+            Count the serialized bits in a measure stream.
+
+            @param stream The stream to measure with.
+
+            @returns Always returns true.
+         */
+
+        bool Write( MeasureStream & stream ) const
+        {
+            int bits = m_maxBits;
+            for ( ; bits >= 32; bits -= 32 )
+                stream.SerializeBits( 0, 32 );
+            if ( bits > 0 )
+                stream.SerializeBits( 0, bits );
+            return true;
+        }
+
+    private:
+
+        SerializedMessage() : m_allocator( NULL ), m_refCount( 1 ), m_data( NULL ), m_variantBytes( 0 ), m_numVariants( 0 ), m_maxBits( 0 ), m_serializeChecks( false ), m_hasChecks( false )
+        {
+            memset( m_numBits, 0, sizeof( m_numBits ) );
+        }
+
+        ~SerializedMessage() {}
+
+        SerializedMessage( const SerializedMessage & other );
+
+        const SerializedMessage & operator = ( const SerializedMessage & other );
+
+        Allocator * m_allocator;                                            ///< The allocator the serialized message was created with.
+        volatile int m_refCount;                                            ///< Number of references. The serialized message is freed when this reaches 0.
+        uint8_t * m_data;                                                   ///< The serialized bits. One variant, or 8 variants back to back, each m_variantBytes long.
+        int m_variantBytes;                                                 ///< Size of each variant (bytes). A multiple of 4, as BitReader requires.
+        int m_numVariants;                                                  ///< 1 if the bits are the same at any position, 8 if they depend on the starting bit position in the byte.
+        int m_maxBits;                                                      ///< The largest number of bits in any variant.
+        int m_numBits[8];                                                   ///< The number of bits in each variant, not counting the padding bits at its start.
+        bool m_serializeChecks;                                             ///< The serialize checks setting the bits were written with.
+        bool m_hasChecks;                                                   ///< True if the message serializes checks, so the bits depend on the serialize checks setting.
+    };
+
     /**
         A reference counted object that can be serialized to a bitstream.
 
@@ -60,7 +197,7 @@ namespace yojimbo
             @see MessageFactory::Create
          */
 
-        Message( int blockMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_blockMessage( blockMessage ) {}
+        Message( int blockMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_blockMessage( blockMessage ), m_serializedMessage( NULL ), m_encodedData( NULL ), m_key( 0 ), m_superseded( false ), m_priority( 1.0f ), m_tick( 0 ) {}
 
         /** 
             Set the message id.
@@ -82,6 +219,76 @@ namespace yojimbo
 
         int GetId() const { return m_id; }
 
+        /**
+            Set the message key.
+
+            On reliable channels with ChannelConfig::supersedeMessages, sending a message supersedes the last message sent with the same key, if that message hasn't been acked yet. Use this for state where only the latest value matters, eg. a key per player and property.
+
+            @param key The message key. 0 means the message has no key and is never superseded (default).
+         */
+
+        void SetKey( uint32_t key ) { m_key = key; }
+
+        /**
+            Get the message key.
+
+            @returns The message key. 0 if no key was set.
+         */
+
+        uint32_t GetKey() const { return m_key; }
+
+        /**
+            Set the message priority.
+
+            On unreliable channels with ChannelConfig::priorityAccumulator, each queued message accumulates its priority for every second it waits, and each packet is filled with the messages that have accumulated the most. Use a higher priority for more important state, eg. objects close to the player.
+
+            @param priority The message priority. Must not be negative. 1 by default.
+         */
+
+        void SetPriority( float priority ) { yojimbo_assert( priority >= 0.0f ); m_priority = priority; }
+
+        /**
+            Get the message priority.
+
+            @returns The message priority.
+         */
+
+        float GetPriority() const { return m_priority; }
+
+        /**
+            Set the sender tick of the message.
+
+            On unreliable channels with ChannelConfig::jitterBuffer, the tick is sent with the message, and the receiver holds the message back until its tick is due for playout. Use the simulation tick the message was generated on, eg. the tick of a snapshot.
+
+            @param tick The sender tick, at ChannelConfig::jitterBufferTickRate ticks per second. Wraps around.
+         */
+
+        void SetTick( uint32_t tick ) { m_tick = tick; }
+
+        /**
+            Get the sender tick of the message.
+
+            @returns The sender tick. 0 if no tick was set.
+         */
+
+        uint32_t GetTick() const { return m_tick; }
+
+        /**
+            Mark the message as superseded.
+
+            Called by reliable channels on the placeholder that takes the place of a superseded or expired message. It keeps its message id, so messages are still delivered in order, but its contents are never serialized and it is dropped on receive.
+         */
+
+        void SetSuperseded() { m_superseded = true; }
+
+        /**
+            Is this a placeholder for a superseded message?
+
+            @returns True if the message was superseded by a newer message with the same key, or expired. See ChannelConfig::messageTimeToLive.
+         */
+
+        bool IsSuperseded() const { return m_superseded; }
+
         /**
             Get the message type.
 
@@ -160,6 +367,54 @@ namespace yojimbo
 
         virtual bool SerializeInternal ( MeasureStream & stream ) = 0;
 
+        /**
+            Get the maximum number of bits this message takes to serialize, if known at compile time.
+
+            Messages made only of fixed range fields have a size known at compile time. Declaring it with the YOJIMBO_MESSAGE_MAX_BITS macro lets channels skip running the measure stream over the message each time it is sent.
+
+            The value must be an upper bound. It doesn't include any block attached to a block message. This is checked against the measured size when YOJIMBO_DEBUG_MESSAGE_BUDGET is enabled.
+
+            @returns The maximum number of bits the message serializes to, or -1 if the message must be measured at runtime (default).
+         */
+
+        virtual int GetMaxBits() const { return -1; }
+
+        /**
+            Attach serialized bits to the message. Channels then copy these bits into packets, instead of calling the message serialize function.
+
+            Adds a reference to the serialized message, which is released when the message is destroyed. The serialized bits must have been created from this message, or from a message of the same type with the same contents.
+
+            @param serializedMessage The serialized message to attach.
+
+            @see SerializedMessage::Create
+         */
+
+        void AttachSerializedMessage( SerializedMessage * serializedMessage )
+        {
+            yojimbo_assert( serializedMessage );
+            yojimbo_assert( !m_serializedMessage );
+            serializedMessage->Acquire();
+            m_serializedMessage = serializedMessage;
+        }
+
+        /**
+            Get the serialized bits attached to the message.
+
+            @returns The serialized message, or NULL if none is attached.
+         */
+
+        SerializedMessage * GetSerializedMessage() const { return m_serializedMessage; }
+
+        /**
+            Is the message waiting to be decoded?
+
+            Messages received on channels with ChannelConfig::lazyDecode hold their body as it arrived in the packet until the channel decodes it on ReceiveMessage. Messages returned by ReceiveMessage are always decoded.
+
+            @returns True if the message body has not been read yet.
+         */
+
+        bool IsEncoded() const { return m_encodedData != NULL; }
+
     protected:
 
         /**
@@ -201,6 +456,11 @@ namespace yojimbo
         virtual ~Message()
         {
             yojimbo_assert( m_refCount == 0 );
+            if ( m_serializedMessage )
+            {
+                m_serializedMessage->Release();
+                m_serializedMessage = NULL;
+            }
         }
 
     private:
@@ -215,6 +475,202 @@ namespace yojimbo
         uint32_t m_id : 16;                                                 ///< The message id. For messages sent over reliable-ordered channels, this starts at 0 and increases with each message sent. For unreliable-unordered channels this is set to the sequence number of the packet the message was included in.
         uint32_t m_type : 15;                                               ///< The message type. Corresponds to the type integer used when the message was created though the message factory.
         uint32_t m_blockMessage : 1;                                        ///< 1 if this is a block message. 0 otherwise. If 1 then you can cast the Message* to BlockMessage*. In short, it's a lightweight RTTI.
+        SerializedMessage * m_serializedMessage;                            ///< Serialized bits copied into packets instead of calling the serialize function. NULL if the message is serialized as usual.
+        uint8_t * m_encodedData;                                            ///< The message body as it arrived in the packet, allocated with the message factory allocator. NULL once decoded. See ChannelConfig::lazyDecode.
+        uint32_t m_key;                                                     ///< The message key. See ChannelConfig::supersedeMessages.
+        bool m_superseded;                                                  ///< True if this is a placeholder for a superseded message.
+        float m_priority;                                                   ///< The message priority. See ChannelConfig::priorityAccumulator.
+        uint32_t m_tick;                                                    ///< The sender tick. See ChannelConfig::jitterBuffer.
+    };
+
+    /**
+        A reference counted, immutable block of data that can be attached to many block messages at once.
+
+        Use this to send the same block to many clients without a copy per client. Each channel fragments the block straight from the shared data. See BlockMessage::AttachSharedBlock.
+
+        A shared block can also be a mapped range of a file. The file is read page by page as fragments are sent, so sending a multi-MB file takes almost no memory. See SharedBlock::CreateMapped.
+
+        Reference counted with atomics, because clients updated on different threads release their references. Its allocator must be thread safe if so.
+     */
+
+    class SharedBlock
+    {
+    public:
+
+        /**
+            Create a shared block with a reference count of 1. Write the block data via SharedBlock::GetData before attaching it to any message.
+
+            @param allocator The allocator for the shared block and its data.
+            @param bytes The size of the block (bytes).
+
+            @returns The shared block, or NULL if memory could not be allocated.
+         */
+
+        static SharedBlock * Create( Allocator & allocator, int bytes )
+        {
+            yojimbo_assert( bytes > 0 );
+            uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bytes );
+            if ( !data )
+                return NULL;
+            SharedBlock * block = Create( allocator, data, bytes, &allocator );
+            if ( !block )
+                YOJIMBO_FREE( allocator, data );
+            return block;
+        }
+
+        /**
+            Create a shared block for data that is already in memory, with a reference count of 1. The data is not copied.
+
+            @param allocator The allocator for the shared block.
+            @param data The block data. Must not change while the shared block exists.
+            @param bytes The size of the block (bytes).
+            @param dataAllocator The allocator the data was allocated with. The data is freed with it when the last reference is released. Pass NULL for data owned elsewhere, which must stay valid until the last reference is released.
+
+            @returns The shared block, or NULL if memory could not be allocated.
+         */
+
+        static SharedBlock * Create( Allocator & allocator, uint8_t * data, int bytes, Allocator * dataAllocator = NULL )
+        {
+            yojimbo_assert( data );
+            yojimbo_assert( bytes > 0 );
+            SharedBlock * block = YOJIMBO_NEW( allocator, SharedBlock );
+            if ( !block )
+                return NULL;
+            block->m_allocator = &allocator;
+            block->m_dataAllocator = dataAllocator;
+            block->m_data = data;
+            block->m_size = bytes;
+            return block;
+        }
+
+        /**
+            Create a shared block for a range of a file, mapped into memory with yojimbo_file_map, with a reference count of 1. The range is unmapped when the last reference is released.
+
+            @param allocator The allocator for the shared block.
+            @param path The path of the file.
+            @param offset The offset of the range in the file (bytes).
+            @param bytes The size of the range (bytes).
+            @param writable True to map the range for writing, eg. to receive a block straight into a file. See MessageFactory::CreateReceiveBlock.
+
+            @returns The shared block, or NULL if the file could not be mapped or memory could not be allocated.
+         */
+
+        static SharedBlock * CreateMapped( Allocator & allocator, const char * path, uint64_t offset, int bytes, bool writable = false )
+        {
+            yojimbo_assert( bytes > 0 );
+            uint8_t * data = (uint8_t*) yojimbo_file_map( path, offset, bytes, writable );
+            if ( !data )
+                return NULL;
+            SharedBlock * block = Create( allocator, data, bytes );
+            if ( !block )
+            {
+                yojimbo_file_unmap( data, offset, bytes );
+                return NULL;
+            }
+            block->m_mapped = true;
+            block->m_mappedOffset = offset;
+            return block;
+        }
+
+        /**
+            Add a reference.
+         */
+
+        void Acquire() { yojimbo_assert( m_refCount > 0 ); yojimbo_atomic_increment( &m_refCount ); }
+
+        /**
+            Remove a reference. The shared block is freed when the last reference is removed.
+         */
+
+        void Release()
+        {
+            yojimbo_assert( m_refCount > 0 );
+            if ( yojimbo_atomic_decrement( &m_refCount ) == 0 )
+            {
+                if ( m_mapped )
+                    yojimbo_file_unmap( m_data, m_mappedOffset, m_size );
+                else if ( m_dataAllocator )
+                    YOJIMBO_FREE( *m_dataAllocator, m_data );
+                YOJIMBO_DELETE( *m_allocator, BitArray, m_receivedFragments );
+                Allocator & allocator = *m_allocator;
+                SharedBlock * self = this;
+                YOJIMBO_DELETE( allocator, SharedBlock, self );
+            }
+        }
+
+        /**
+            Get the block data.
+
+            IMPORTANT: Only write to the block before it is attached to a message.
+
+            @returns The block data.
+         */
+
+        uint8_t * GetData() { return m_data; }
+
+        /**
+            Get the size of the block.
+
+            @returns The size of the block (bytes).
+         */
+
+        int GetSize() const { return m_size; }
+
+        /**
+            Start tracking which fragments of a block being received into this shared block have arrived, so the transfer can be resumed on a new connection.
+
+            Called by reliable-ordered channels with ChannelConfig::resumableBlocks set. Any fragments tracked for an earlier block are forgotten.
+
+            @param blockHash The content hash of the block being received.
+            @param numFragments The number of fragments in the block.
+
+            @returns True if successful, false if memory could not be allocated.
+         */
+
+        bool InitializeResume( uint64_t blockHash, int numFragments )
+        {
+            yojimbo_assert( numFragments > 0 );
+            YOJIMBO_DELETE( *m_allocator, BitArray, m_receivedFragments );
+            m_receivedFragments = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, numFragments );
+            m_blockHash = blockHash;
+            return m_receivedFragments != NULL;
+        }
+
+        /**
+            Get the content hash of the block being received into this shared block. See InitializeResume.
+
+            @returns The content hash of the block.
+         */
+
+        uint64_t GetBlockHash() const { return m_blockHash; }
+
+        /**
+            Get the fragments of the block that have been received into this shared block. See InitializeResume.
+
+            @returns The received fragment bitmap, or NULL if fragments aren't being tracked.
+         */
+
+        BitArray * GetReceivedFragments() { return m_receivedFragments; }
+
+    private:
+
+        SharedBlock() : m_allocator( NULL ), m_dataAllocator( NULL ), m_refCount( 1 ), m_data( NULL ), m_size( 0 ), m_mapped( false ), m_mappedOffset( 0 ), m_blockHash( 0 ), m_receivedFragments( NULL ) {}
+
+        ~SharedBlock() {}
+
+        SharedBlock( const SharedBlock & other );
+
+        const SharedBlock & operator = ( const SharedBlock & other );
+
+        Allocator * m_allocator;                                            ///< The allocator the shared block was created with.
+        Allocator * m_dataAllocator;                                        ///< The allocator the block data is freed with. NULL if the data is owned elsewhere.
+        volatile int m_refCount;                                            ///< Number of references. The shared block is freed when this reaches 0.
+        uint8_t * m_data;                                                   ///< The block data.
+        int m_size;                                                         ///< The size of the block (bytes).
+        bool m_mapped;                                                      ///< True if the data is a file range mapped with yojimbo_file_map.
+        uint64_t m_mappedOffset;                                            ///< The offset of the mapped range in the file (bytes). Needed to unmap it.
+        uint64_t m_blockHash;                                               ///< The content hash of the block being received. See InitializeResume.
+        BitArray * m_receivedFragments;                                     ///< The fragments of the block received so far. NULL unless InitializeResume was called.
     };
 
     /**
@@ -243,7 +699,7 @@ namespace yojimbo
             @see MessageFactory::CreateMessage
          */
 
-        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_blockData(NULL), m_blockSize(0) {}
+        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_blockData(NULL), m_blockSize(0), m_sharedBlock(NULL) {}
 
         /**
             Attach a block to this message.
@@ -262,16 +718,44 @@ namespace yojimbo
             m_blockSize = blockSize;
         }
 
+        /**
+            Attach a shared block to this message. Adds a reference to the block, which is released when the message is destroyed.
+
+            The same shared block can be attached to messages sent to many clients. You can only attach one block. This method will assert if a block is already attached.
+
+            @param block The shared block to attach.
+            @param blockSize The size of the block attached to the message (bytes), from the start of the shared block. Pass -1 to attach the whole shared block.
+         */
+
+        void AttachSharedBlock( SharedBlock * block, int blockSize = -1 )
+        {
+            yojimbo_assert( block );
+            yojimbo_assert( !m_blockData );
+            yojimbo_assert( blockSize <= block->GetSize() );
+
+            block->Acquire();
+            m_sharedBlock = block;
+            m_blockData = block->GetData();
+            m_blockSize = ( blockSize >= 0 ) ? blockSize : block->GetSize();
+        }
+
         /** 
             Detach the block from this message.
 
             By doing this you are responsible for copying the block pointer and allocator and making sure the block is freed.
 
             This could be used for example, if you wanted to copy off the block and store it somewhere, without the cost of copying it.
+
+            For a shared block, the reference held by the message is released. Acquire the shared block first if you want to keep it.
          */
 
         void DetachBlock()
         {
+            if ( m_sharedBlock )
+            {
+                m_sharedBlock->Release();
+                m_sharedBlock = NULL;
+            }
             m_allocator = NULL;
             m_blockData = NULL;
             m_blockSize = 0;
@@ -280,7 +764,7 @@ namespace yojimbo
         /**
             Get the allocator used to allocate the block.
 
-            @returns The allocator for the block. NULL if no block is attached to this message.
+            @returns The allocator for the block. NULL if no block is attached to this message, or the block is shared.
          */
 
         Allocator * GetAllocator()
@@ -310,6 +794,17 @@ namespace yojimbo
             return m_blockData;
         }
 
+        /**
+            Get the shared block attached to this message.
+
+            @returns The shared block. NULL if no block is attached, or the block is not shared.
+         */
+
+        SharedBlock * GetSharedBlock() const
+        {
+            return m_sharedBlock;
+        }
+
         /**
             Get the size of the block attached to this message.
 
@@ -344,6 +839,11 @@ namespace yojimbo
 
         ~BlockMessage()
         {
+            if ( m_sharedBlock )
+            {
+                m_sharedBlock->Release();
+                m_sharedBlock = NULL;
+            }
             if ( m_allocator )
             {
                 YOJIMBO_FREE( *m_allocator, m_blockData );
@@ -357,13 +857,210 @@ namespace yojimbo
         Allocator * m_allocator;                                                ///< Allocator for the block attached to the message. NULL if no block is attached.
         uint8_t * m_blockData;                                                  ///< The block data. NULL if no block is attached.
         int m_blockSize;                                                        ///< The block size (bytes). 0 if no block is attached.
+        SharedBlock * m_sharedBlock;                                            ///< The shared block attached to the message. NULL if no block is attached, or the block is not shared.
     };
 
     /**
-        Message factory error level.
-     */
+        A message that can be delta encoded against an earlier message of the same type.
 
-    enum MessageFactoryErrorLevel
+        Messages sent over a snapshot channel must derive from this class. Each time a snapshot is sent, the channel picks the most recent snapshot of the same type that the other side has acked and sets it as the baseline, on both sides, before the message is serialized. 
+        
+        Serialize only what changed relative to the baseline, and copy the rest from the baseline on read. When there is no baseline, eg. for the first snapshot, or if nothing sent recently has been acked, serialize everything.
+
+        @see CHANNEL_TYPE_SNAPSHOT
+        @see SnapshotChannel
+     */
+
+    class SnapshotMessage : public Message
+    {
+    public:
+
+        /**
+            Snapshot message constructor.
+
+            Don't call this directly, use a message factory instead.
+
+            @see MessageFactory::Create
+         */
+
+        SnapshotMessage() : m_baseline( NULL ), m_baselineSequence( 0 ) {}
+
+        /**
+            Get the baseline to delta encode against.
+
+            IMPORTANT: Only valid inside the serialize function. The baseline is released by the channel once it is no longer needed, so don't hold on to it.
+
+            @returns The baseline message, which has the same type as this message. NULL if there is no baseline and the message must be serialized in full.
+         */
+
+        const SnapshotMessage * GetBaseline() const { return m_baseline; }
+
+        /**
+            Get the sequence number of the packet the baseline was sent in.
+
+            @returns The packet sequence number of the baseline. Only meaningful if GetBaseline returns non-NULL.
+         */
+
+        uint16_t GetBaselineSequence() const { return m_baselineSequence; }
+
+        /**
+            Set the baseline to delta encode against.
+
+            Called by the snapshot channel before the message is serialized. You don't need to call this yourself.
+
+            @param baseline The baseline message, or NULL for no baseline.
+            @param baselineSequence The sequence number of the packet the baseline was sent in.
+         */
+
+        void SetBaseline( const SnapshotMessage * baseline, uint16_t baselineSequence )
+        {
+            m_baseline = baseline;
+            m_baselineSequence = baselineSequence;
+        }
+
+    private:
+
+        const SnapshotMessage * m_baseline;                                     ///< The baseline to delta encode against. NULL if none.
+        uint16_t m_baselineSequence;                                            ///< The sequence number of the packet the baseline was sent in.
+    };
+
+    /**
+        A message that packs many small sub-messages into one bitpacked buffer.
+
+        Sending lots of tiny messages, like entity events, costs an allocation, a reference count and a virtual serialize call per message on each side. Instead, add them as sub-messages to a batch message and send that. The channel treats the batch as a single message, and the receiver reads the sub-messages back out in the order they were added.
+
+        Sub-messages can be any type with a templated serialize method, like a Serializable or your own struct. They are serialized as they are added, so the batch doesn't hold on to them and they can live on the stack.
+
+        Sub-messages can no longer be added once the batch message has been serialized for sending.
+
+        Derive your own message class from this one if you want to send several types of batches, or include extra data along with the sub-messages.
+
+        @param MaxBytes The capacity of the batch in bytes. Must be a multiple of 8.
+     */
+
+    template <int MaxBytes> class BatchMessage : public Message
+    {
+    public:
+
+        /**
+            Batch message constructor.
+
+            Don't call this directly, use a message factory instead.
+
+            @see MessageFactory::Create
+         */
+
+        BatchMessage() : m_numSubMessages( 0 ), m_numSubMessagesRead( 0 ), m_numBytes( 0 ), m_finished( false ),
+            m_writeStream( GetDefaultAllocator(), (uint8_t*) m_data, MaxBytes ), m_readStream( GetDefaultAllocator(), (const uint8_t*) m_data, MaxBytes )
+        {
+            yojimbo_assert( ( MaxBytes % 8 ) == 0 );
+            memset( m_data, 0, sizeof( m_data ) );
+        }
+
+        /**
+            Add a sub-message to the batch.
+
+            @param subMessage The sub-message to serialize into the batch.
+
+            @returns True if the sub-message was added. False if it doesn't fit in what is left of the batch, or if its serialize failed. Nothing is added on failure.
+         */
+
+        template <typename T> bool AddSubMessage( T & subMessage )
+        {
+            yojimbo_assert( !m_finished );
+
+            if ( m_finished )
+                return false;
+
+            const WriteStream::Checkpoint checkpoint = m_writeStream.GetCheckpoint();
+
+            if ( !subMessage.Serialize( m_writeStream ) || m_writeStream.IsOverflow() )
+            {
+                m_writeStream.Rollback( checkpoint );
+                return false;
+            }
+
+            m_numSubMessages++;
+
+            return true;
+        }
+
+        /**
+            Read the next sub-message out of a received batch.
+
+            Sub-messages must be read back as the same types, and in the same order, that they were added.
+
+            @param subMessage The sub-message to read into.
+
+            @returns True if the sub-message was read. False if all sub-messages have already been read, or if the sub-message failed to serialize.
+         */
+
+        template <typename T> bool ReadSubMessage( T & subMessage )
+        {
+            if ( m_numSubMessagesRead >= m_numSubMessages )
+                return false;
+
+            if ( !subMessage.Serialize( m_readStream ) || m_readStream.GetBitsProcessed() > m_numBytes * 8 )
+            {
+                m_numSubMessagesRead = m_numSubMessages;
+                return false;
+            }
+
+            m_numSubMessagesRead++;
+
+            return true;
+        }
+
+        /**
+            Get the number of sub-messages in the batch.
+
+            @returns The number of sub-messages added to the batch on the sender, or included in the batch on the receiver.
+         */
+
+        int GetNumSubMessages() const { return m_numSubMessages; }
+
+        /**
+            Get the number of bytes used by the sub-messages.
+
+            @returns The number of bytes the sub-messages take up in the batch, once the batch has been serialized. Before that, the number of whole or partial bytes written so far.
+         */
+
+        int GetNumBytes() const { return m_finished ? m_numBytes : ( m_writeStream.GetBitsProcessed() + 7 ) / 8; }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            if ( Stream::IsWriting && !m_finished )
+            {
+                m_writeStream.Flush();
+                m_numBytes = ( m_writeStream.GetBitsProcessed() + 7 ) / 8;
+                m_finished = true;
+            }
+
+            serialize_int( stream, m_numSubMessages, 0, MaxBytes * 8 );
+            serialize_int( stream, m_numBytes, 0, MaxBytes );
+            serialize_bytes( stream, (uint8_t*) m_data, m_numBytes );
+
+            return true;
+        }
+
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+
+    private:
+
+        int m_numSubMessages;                                                   ///< The number of sub-messages in the batch.
+        int m_numSubMessagesRead;                                               ///< The number of sub-messages read from the batch so far (receiver).
+        int m_numBytes;                                                         ///< The number of bytes used by sub-messages. Set once the batch is serialized for sending, or when it is received.
+        bool m_finished;                                                        ///< True once the batch has been serialized for sending. No more sub-messages can be added after this.
+        uint64_t m_data[MaxBytes/8];                                            ///< The bitpacked sub-messages. 64 bit words keep the buffer aligned for the bit writer and reader.
+        WriteStream m_writeStream;                                              ///< Writes sub-messages into the buffer as they are added (sender).
+        ReadStream m_readStream;                                                ///< Reads sub-messages out of the buffer (receiver).
+    };
+
+    /**
+        Message factory error level.
+     */
+
+    enum MessageFactoryErrorLevel
     {
         MESSAGE_FACTORY_ERROR_NONE,                                             ///< No error. All is well.
         MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE,                       ///< Failed to allocate a message. Typically this means we ran out of memory on the allocator backing the message factory.
@@ -384,7 +1081,7 @@ namespace yojimbo
     class MessageFactory
     {        
         #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-        std::map<void*,int> allocated_messages;                                 ///< The set of allocated messages for this factory. Used to track down message leaks.
+        PointerHashMap<int> allocated_messages;                                 ///< The set of allocated messages for this factory. Used to track down message leaks.
         #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
 
         Allocator * m_allocator;                                                ///< The allocator used to create messages.
@@ -393,6 +1090,25 @@ namespace yojimbo
         
         MessageFactoryErrorLevel m_errorLevel;                                  ///< The message factory error level.
 
+        /**
+            Free list of released messages of one type, kept for reuse.
+
+            The memory of each released message stores the pointer to the next one, so the pool itself never allocates.
+         */
+
+        struct MessagePool
+        {
+            void * freeList;                                                    ///< The most recently released message memory, or NULL if the pool is empty.
+            int numFree;                                                        ///< The number of messages in the free list.
+            int maxFree;                                                        ///< The maximum number of messages kept in the free list. 0 disables pooling for this type.
+        };
+
+        MessagePool * m_pools;                                                  ///< Per-type message pools, indexed by message type. NULL until MessageFactory::SetMessagePoolSize is first called.
+
+        int m_numCommonTypes;                                                   ///< The number of common message types. See MessageFactory::SetCommonMessageTypes.
+
+        int m_commonTypes[MaxCommonMessageTypes];                              ///< The common message types, most frequent first.
+
     public:
 
         /**
@@ -409,6 +1125,8 @@ namespace yojimbo
             m_allocator = &allocator;
             m_numTypes = numTypes;
             m_errorLevel = MESSAGE_FACTORY_ERROR_NONE;
+            m_pools = NULL;
+            m_numCommonTypes = 0;
         }
 
         /**
@@ -421,17 +1139,26 @@ namespace yojimbo
         {
             yojimbo_assert( m_allocator );
 
+            if ( m_pools )
+            {
+                for ( int i = 0; i < m_numTypes; ++i )
+                    SetMessagePoolSize( i, 0 );
+
+                YOJIMBO_FREE( *m_allocator, m_pools );
+            }
+
             m_allocator = NULL;
 
             #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-            if ( allocated_messages.size() )
+            if ( allocated_messages.GetSize() )
             {
                 printf( "you leaked messages!\n" );
-                printf( "%d messages leaked\n", (int) allocated_messages.size() );
-                typedef std::map<void*,int>::iterator itor_type;
-                for ( itor_type i = allocated_messages.begin(); i != allocated_messages.end(); ++i ) 
+                printf( "%d messages leaked\n", allocated_messages.GetSize() );
+                for ( int i = 0; i < allocated_messages.GetCapacity(); ++i ) 
                 {
-                    Message * message = (Message*) i->first;
+                    const Message * message = (const Message*) allocated_messages.GetKeyAtIndex( i );
+                    if ( !message )
+                        continue;
                     printf( "leaked message %p (type %d, refcount %d)\n", message, message->GetType(), message->GetRefCount() );
                 }
                 exit(1);
@@ -467,8 +1194,7 @@ namespace yojimbo
             }
 
             #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-            allocated_messages[message] = 1;
-            yojimbo_assert( allocated_messages.find( message ) != allocated_messages.end() );
+            allocated_messages.Insert( message, 1 );
             #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
 
             return message;
@@ -510,16 +1236,286 @@ namespace yojimbo
             if ( message->GetRefCount() == 0 )
             {
                 #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-                yojimbo_assert( allocated_messages.find( message ) != allocated_messages.end() );
-                allocated_messages.erase( message );
+                const bool found = allocated_messages.Remove( message );
+                yojimbo_assert( found );
+                (void) found;
                 #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
             
                 yojimbo_assert( m_allocator );
 
-                YOJIMBO_DELETE( *m_allocator, Message, message );
+                const int type = message->GetType();
+
+                if ( message->m_encodedData )
+                    YOJIMBO_FREE( *m_allocator, message->m_encodedData );
+
+                message->~Message();
+
+                FreeMessage( type, message );
+            }
+        }
+
+        /**
+            Keep released messages of a type around for reuse.
+
+            Pooling is off by default. With a pool, released messages of that type are destroyed but their memory goes on a free list, and the next message of the same type is constructed in place from it. Steady state message traffic then never touches the allocator.
+
+            Pooling only applies to messages created through MessageFactory::AllocateMessage, like the ones created by the YOJIMBO_DECLARE_MESSAGE_TYPE macro.
+
+            @param type The message type in [0,numTypes-1].
+            @param maxPooledMessages The maximum number of released messages of this type to keep. Pass 0 to disable pooling for this type and free any pooled messages.
+         */
+
+        void SetMessagePoolSize( int type, int maxPooledMessages )
+        {
+            yojimbo_assert( type >= 0 );
+            yojimbo_assert( type < m_numTypes );
+            yojimbo_assert( maxPooledMessages >= 0 );
+            yojimbo_assert( m_allocator );
+
+            if ( !m_pools )
+            {
+                if ( maxPooledMessages == 0 )
+                    return;
+
+                m_pools = (MessagePool*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( MessagePool ) * m_numTypes );
+                if ( !m_pools )
+                    return;
+
+                memset( m_pools, 0, sizeof( MessagePool ) * m_numTypes );
+            }
+
+            MessagePool & pool = m_pools[type];
+
+            pool.maxFree = maxPooledMessages;
+
+            while ( pool.numFree > pool.maxFree )
+            {
+                void * memory = pool.freeList;
+                pool.freeList = *( (void**) memory );
+                pool.numFree--;
+                YOJIMBO_FREE( *m_allocator, memory );
             }
         }
 
+        /**
+            Get the number of released messages of a type waiting in the pool for reuse.
+
+            @param type The message type in [0,numTypes-1].
+
+            @returns The number of pooled messages of this type.
+         */
+
+        int GetNumPooledMessages( int type ) const
+        {
+            yojimbo_assert( type >= 0 );
+            yojimbo_assert( type < m_numTypes );
+            return m_pools ? m_pools[type].numFree : 0;
+        }
+
+        /**
+            Create the memory a block received over a reliable channel is reassembled into, when ChannelConfig::reassembleBlocksInPlace is set.
+
+            Override this in your message factory to receive blocks somewhere other than the message factory allocator, eg. straight into a file with SharedBlock::CreateMapped. Every message sent before the block on the channel has been received when this is called.
+
+            @param channelIndex The channel the block is received on.
+            @param messageId The id of the block message.
+            @param bytes The size to create (bytes). An upper bound on the block size, which isn't known until the last fragment arrives.
+
+            @returns A shared block of at least this many bytes, with a reference count of 1, which the channel takes over. Return NULL to allocate the block from the message factory allocator (default).
+         */
+
+        virtual SharedBlock * CreateReceiveBlock( int channelIndex, uint16_t messageId, int bytes )
+        {
+            (void) channelIndex;
+            (void) messageId;
+            (void) bytes;
+            return NULL;
+        }
+
+        /**
+            Find a partly received block to resume, when ChannelConfig::resumableBlocks is set.
+
+            Called when a block starts arriving, before CreateReceiveBlock. To resume transfers across reconnects, keep a reference to the shared blocks you create in CreateReceiveBlock, and return the one with the same content hash here (see SharedBlock::GetBlockHash). The channel keeps the fragments already received into it, and tells the sender to skip them.
+
+            @param channelIndex The channel the block is received on.
+            @param blockHash The content hash of the block.
+            @param bytes The size the block must hold (bytes). See CreateReceiveBlock.
+
+            @returns A shared block with a reference added for the channel to take over (see SharedBlock::Acquire), or NULL to receive the block from scratch (default).
+         */
+
+        virtual SharedBlock * FindResumeBlock( int channelIndex, uint64_t blockHash, int bytes )
+        {
+            (void) channelIndex;
+            (void) blockHash;
+            (void) bytes;
+            return NULL;
+        }
+
+        /**
+            Declare the message types sent most often, so they are serialized in fewer bits.
+
+            By default every message type costs bits_required( 0, numTypes - 1 ) bits. With common types, the type ranked r costs r + 1 bits, so the most common type costs 1 bit, the next 2 bits and so on. Every other type costs numCommonTypes bits more than it did before. Rank types by how often they are sent.
+
+            IMPORTANT: Both ends must declare the same common types in the same order, before any packets are exchanged.
+
+            @param types The common message types, most frequent first. Each type must be in [0,numTypes-1], and appear once.
+            @param numCommonTypes The number of common types in [0,MaxCommonMessageTypes]. Pass 0 to go back to fixed size message types.
+         */
+
+        void SetCommonMessageTypes( const int types[], int numCommonTypes )
+        {
+            yojimbo_assert( numCommonTypes >= 0 );
+            yojimbo_assert( numCommonTypes <= MaxCommonMessageTypes );
+            yojimbo_assert( numCommonTypes == 0 || types );
+            for ( int i = 0; i < numCommonTypes; ++i )
+            {
+                yojimbo_assert( types[i] >= 0 );
+                yojimbo_assert( types[i] < m_numTypes );
+                m_commonTypes[i] = types[i];
+            }
+            m_numCommonTypes = numCommonTypes;
+        }
+
+        /**
+            Get the number of common message types.
+
+            @returns The number of common types passed in to SetCommonMessageTypes.
+         */
+
+        int GetNumCommonMessageTypes() const
+        {
+            return m_numCommonTypes;
+        }
+
+        /**
+            Get a common message type by rank.
+
+            @param rank The rank in [0,GetNumCommonMessageTypes()-1].
+
+            @returns The message type.
+         */
+
+        int GetCommonMessageType( int rank ) const
+        {
+            yojimbo_assert( rank >= 0 );
+            yojimbo_assert( rank < m_numCommonTypes );
+            return m_commonTypes[rank];
+        }
+
+        /**
+            Get the rank of a common message type.
+
+            @param type The message type.
+
+            @returns The rank of the type, or -1 if it isn't a common type.
+         */
+
+        int GetCommonMessageTypeRank( int type ) const
+        {
+            for ( int i = 0; i < m_numCommonTypes; ++i )
+            {
+                if ( m_commonTypes[i] == type )
+                    return i;
+            }
+            return -1;
+        }
+
+        /**
+            Get the number of bits a message type is serialized in.
+
+            @param type The message type.
+
+            @returns The size of the message type in a packet (bits).
+         */
+
+        int GetMessageTypeBits( int type ) const
+        {
+            const int fullBits = m_numTypes > 1 ? bits_required( 0, m_numTypes - 1 ) : 0;
+            if ( m_numCommonTypes == 0 )
+                return fullBits;
+            const int rank = GetCommonMessageTypeRank( type );
+            return rank >= 0 ? rank + 1 : m_numCommonTypes + fullBits;
+        }
+
+        /**
+            Serialize a message (read).
+
+            The YOJIMBO_MESSAGE_FACTORY_START and YOJIMBO_DECLARE_MESSAGE_TYPE macros override this with a switch on the message type that calls the templated Serialize of each message class directly. The call through the factory always goes to the same place, so it predicts well, while the virtual Message::SerializeInternal call it replaces goes somewhere different for each message type.
+
+            @param stream The read stream.
+            @param message The message to serialize.
+
+            @returns True if the message serialized successfully, false otherwise.
+         */
+
+        virtual bool SerializeMessage( ReadStream & stream, Message * message ) { yojimbo_assert( message ); return message->SerializeInternal( stream ); }
+
+        /**
+            Serialize a fixed size message that is already known to fit in the packet being read (read, unchecked).
+
+            By default this serializes through the checked read stream overload. The YOJIMBO_MESSAGE_FACTORY_START and YOJIMBO_DECLARE_MESSAGE_TYPE macros override it to call the templated Serialize of each message class with the unchecked stream.
+
+            @param stream The unchecked read stream.
+            @param message The message to serialize.
+
+            @returns True if the message serialized successfully, false otherwise.
+
+            @see UncheckedReadStream
+         */
+
+        virtual bool SerializeMessage( UncheckedReadStream & stream, Message * message ) { return SerializeMessage( static_cast<ReadStream&>( stream ), message ); }
+
+        /**
+            Serialize a message (write).
+
+            @param stream The write stream.
+            @param message The message to serialize.
+
+            @returns True if the message serialized successfully, false otherwise.
+
+            @see MessageFactory::SerializeMessage
+         */
+
+        virtual bool SerializeMessage( WriteStream & stream, Message * message ) { yojimbo_assert( message ); return message->SerializeInternal( stream ); }
+
+        /**
+            Serialize a message (measure).
+
+            @param stream The measure stream.
+            @param message The message to serialize.
+
+            @returns True if the message serialized successfully, false otherwise.
+
+            @see MessageFactory::SerializeMessage
+         */
+
+        virtual bool SerializeMessage( MeasureStream & stream, Message * message ) { yojimbo_assert( message ); return message->SerializeInternal( stream ); }
+
+        /**
+            Copy the body of a message out of a packet being read, to decode it later with DecodeMessage.
+
+            Called by channels configured with ChannelConfig::lazyDecode. You should not need to call it yourself.
+
+            @param stream The stream, positioned at the start of the message body.
+            @param message The message the body belongs to. Must not already hold a body.
+            @param numBits The length of the body (bits).
+
+            @returns True if the body was copied. False if the stream ran out of bits, or memory could not be allocated.
+         */
+
+        bool EncodeMessage( ReadStream & stream, Message * message, int numBits );
+
+        /**
+            Read a message body copied with EncodeMessage, with the stream context and serialize checks setting of the packet it arrived in. The copy is freed, whether the read succeeds or not.
+
+            @param message The message to decode.
+
+            @returns True if the message serialize function succeeded and read the whole body.
+         */
+
+        bool DecodeMessage( Message * message );
+
         /**
             Get the number of message types supported by this message factory.
 
@@ -575,6 +1571,56 @@ namespace yojimbo
 
         virtual Message * CreateMessageInternal( int type ) { (void) type; return NULL; }
 
+        /**
+            Get memory for a new message, from the pool for its type if there is one.
+
+            Construct the message in place with placement new. The YOJIMBO_DECLARE_MESSAGE_TYPE macro does this for you.
+
+            @param type The message type. The same type must always be allocated with the same size.
+            @param bytes The size of the message class (bytes).
+
+            @returns The memory for the message, or NULL if the allocation failed.
+         */
+
+        void * AllocateMessage( int type, int bytes )
+        {
+            yojimbo_assert( m_allocator );
+
+            if ( m_pools && m_pools[type].freeList )
+            {
+                MessagePool & pool = m_pools[type];
+                void * memory = pool.freeList;
+                pool.freeList = *( (void**) memory );
+                pool.numFree--;
+                return memory;
+            }
+
+            return YOJIMBO_ALLOCATE( *m_allocator, bytes );
+        }
+
+        /**
+            Free the memory of a destroyed message, or keep it in the pool for its type.
+
+            @param type The message type.
+            @param memory The memory of the destroyed message.
+         */
+
+        void FreeMessage( int type, void * memory )
+        {
+            yojimbo_assert( m_allocator );
+
+            if ( m_pools && m_pools[type].numFree < m_pools[type].maxFree )
+            {
+                MessagePool & pool = m_pools[type];
+                *( (void**) memory ) = pool.freeList;
+                pool.freeList = memory;
+                pool.numFree++;
+                return;
+            }
+
+            YOJIMBO_FREE( *m_allocator, memory );
+        }
+
         /**
             Set the message type of a message.
 
@@ -588,6 +1634,20 @@ namespace yojimbo
     };
 }
 
+/**
+    Declare the maximum number of bits a message takes to serialize.
+
+    Use this in message classes that only serialize fixed range fields, so channels use the size directly instead of measuring each message sent. The bits are typically a compile-time sum of yojimbo::BitsRequired<min,max>::result for each serialize_int, the bit count for each serialize_bits and 1 for each serialize_bool.
+
+    @param max_bits The maximum number of bits the message serializes to, excluding any attached block.
+
+    @see Message::GetMaxBits
+ */
+
+#define YOJIMBO_MESSAGE_MAX_BITS( max_bits )                                                                                            \
+    enum { MaxBits = ( max_bits ) };                                                                                                    \
+    int GetMaxBits() const { return MaxBits; }
+
 /** 
     Start a definition of a new message factory.
 
@@ -596,6 +1656,8 @@ namespace yojimbo
     @param factory_class The name of the message factory class to generate.
     @param num_message_types The number of message types for this factory.
 
+    The generated factory creates and serializes messages through one switch on the message type, so each message class is serialized with a direct call to its templated Serialize method instead of through Message::SerializeInternal. Message classes added with YOJIMBO_DECLARE_MESSAGE_TYPE must have a public templated Serialize method.
+
     See tests/shared.h for an example of usage.
  */
 
@@ -607,7 +1669,28 @@ namespace yojimbo
         factory_class( yojimbo::Allocator & allocator ) : MessageFactory( allocator, num_message_types ) {}                             \
         yojimbo::Message * CreateMessageInternal( int type )                                                                            \
         {                                                                                                                               \
-            Message * message;                                                                                                          \
+            yojimbo::Message * message = NULL;                                                                                          \
+            DispatchMessageType( type, message, (yojimbo::MeasureStream*) NULL );                                                       \
+            return message;                                                                                                             \
+        }                                                                                                                               \
+        bool SerializeMessage( yojimbo::ReadStream & stream, yojimbo::Message * message )                                               \
+        {                                                                                                                               \
+            return DispatchMessageType( message->GetType(), message, &stream );                                                         \
+        }                                                                                                                               \
+        bool SerializeMessage( yojimbo::UncheckedReadStream & stream, yojimbo::Message * message )                                      \
+        {                                                                                                                               \
+            return DispatchMessageType( message->GetType(), message, &stream );                                                         \
+        }                                                                                                                               \
+        bool SerializeMessage( yojimbo::WriteStream & stream, yojimbo::Message * message )                                              \
+        {                                                                                                                               \
+            return DispatchMessageType( message->GetType(), message, &stream );                                                         \
+        }                                                                                                                               \
+        bool SerializeMessage( yojimbo::MeasureStream & stream, yojimbo::Message * message )                                            \
+        {                                                                                                                               \
+            return DispatchMessageType( message->GetType(), message, &stream );                                                         \
+        }                                                                                                                               \
+        template <typename Stream> bool DispatchMessageType( int type, yojimbo::Message * & message, Stream * stream )                  \
+        {                                                                                                                               \
             yojimbo::Allocator & allocator = GetAllocator();                                                                            \
             (void) allocator;                                                                                                           \
             switch ( type )                                                                                                             \
@@ -627,11 +1710,16 @@ namespace yojimbo
 #define YOJIMBO_DECLARE_MESSAGE_TYPE( message_type, message_class )                                                                     \
                                                                                                                                         \
                 case message_type:                                                                                                      \
-                    message = YOJIMBO_NEW( allocator, message_class );                                                                  \
-                    if ( !message )                                                                                                     \
-                        return NULL;                                                                                                    \
+                {                                                                                                                       \
+                    if ( stream )                                                                                                       \
+                        return static_cast<message_class*>( message )->Serialize( *stream );                                            \
+                    void * memory = AllocateMessage( message_type, sizeof( message_class ) );                                           \
+                    if ( !memory )                                                                                                      \
+                        return false;                                                                                                   \
+                    message = new ( memory ) message_class;                                                                             \
                     SetMessageType( message, message_type );                                                                            \
-                    return message;
+                    return true;                                                                                                        \
+                }
 
 /** 
     Finish the definition of a new message factory.
@@ -643,7 +1731,8 @@ namespace yojimbo
 
 #define YOJIMBO_MESSAGE_FACTORY_FINISH()                                                                                                \
                                                                                                                                         \
-                default: return NULL;                                                                                                   \
+                default:                                                                                                                \
+                    return stream && message ? message->SerializeInternal( *stream ) : false;                                           \
             }                                                                                                                           \
         }                                                                                                                               \
     };
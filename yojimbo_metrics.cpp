@@ -0,0 +1,438 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_metrics.h"
+#include "yojimbo_connection.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace yojimbo
+{
+    const float MetricsLossBuckets[MetricsLossNumBuckets] = { 0.1f, 0.5f, 1.0f, 2.0f, 5.0f, 10.0f, 25.0f, 100.0f };
+
+    static const char * const MetricsChannelCounterNames[CHANNEL_COUNTER_NUM_COUNTERS] =
+    {
+        "messages_sent",
+        "messages_received",
+        "packets_lost",
+        "fragments_recovered",
+        "messages_superseded",
+        "messages_expired",
+        "packets_sent",
+        "bits_sent",
+        "messages_packed",
+        "out_of_space",
+        "messages_resent",
+        "fragments_resent",
+        "messages_skipped",
+    };
+
+    static const char * const MetricsTickPhaseNames[SERVER_TICK_PHASE_NUM_PHASES] =
+    {
+        "receive_packets",
+        "advance_time",
+        "send_packets",
+    };
+
+    const int MetricsSlotFresh = 4;                                 ///< Flag set on the latest slot index when it holds a snapshot that hasn't been taken yet.
+    const int MetricsSlotMask = 3;                                  ///< Mask for the slot index in the latest slot.
+    const double MetricsExportPollTime = 0.01;                      ///< How often the export thread checks for a new snapshot (seconds).
+
+    void ServerMetrics::Clear()
+    {
+        time = 0.0;
+        maxClients = 0;
+        numConnectedClients = 0;
+        numPacketsSent = 0;
+        numPacketsReceived = 0;
+        numPacketsAcked = 0;
+        packetBytesGenerated = 0;
+        numIngressPacketsDropped = 0;
+        ingressBytesDropped = 0;
+        sentBandwidth = 0.0;
+        receivedBandwidth = 0.0;
+        tickTime = 0.0;
+        overloadLevel = 0;
+        for ( int i = 0; i < SERVER_TICK_PHASE_NUM_PHASES; ++i )
+            tickPhaseTime[i] = 0.0;
+        globalAllocator = AllocatorStats();
+        clientBytesAllocated = 0;
+        maxClientBytesAllocated = 0;
+        rtt.Clear();
+        memset( lossBuckets, 0, sizeof( lossBuckets ) );
+        lossSum = 0.0;
+        numChannels = 0;
+        memset( channel, 0, sizeof( channel ) );
+    }
+
+    void CollectServerMetrics( const Server & server, double time, ServerMetrics & metrics )
+    {
+        metrics.Clear();
+        metrics.time = time;
+        metrics.maxClients = server.GetMaxClients();
+        metrics.numConnectedClients = server.GetNumConnectedClients();
+        metrics.tickTime = server.GetTickTime();
+        metrics.overloadLevel = server.GetOverloadLevel();
+        for ( int i = 0; i < SERVER_TICK_PHASE_NUM_PHASES; ++i )
+            metrics.tickPhaseTime[i] = server.GetTickPhaseTime( i );
+        server.GetGlobalAllocatorStats( metrics.globalAllocator );
+
+        ConnectionStats stats;
+        AllocatorStats allocatorStats;
+        for ( int clientIndex = 0; clientIndex < metrics.maxClients; ++clientIndex )
+        {
+            if ( !server.IsClientConnected( clientIndex ) )
+                continue;
+
+            server.GetConnectionStats( clientIndex, stats );
+            metrics.numPacketsSent += stats.numPacketsSent;
+            metrics.numPacketsReceived += stats.numPacketsReceived;
+            metrics.numPacketsAcked += stats.numPacketsAcked;
+            metrics.packetBytesGenerated += stats.packetBytesGenerated;
+            uint64_t numPacketsDropped, numBytesDropped;
+            server.GetClientIngressStats( clientIndex, numPacketsDropped, numBytesDropped );
+            metrics.numIngressPacketsDropped += numPacketsDropped;
+            metrics.ingressBytesDropped += numBytesDropped;
+            metrics.sentBandwidth += stats.sentBandwidth;
+            metrics.receivedBandwidth += stats.receivedBandwidth;
+            metrics.rtt.Record( stats.rtt * 0.001 );
+
+            int lossBucket = 0;
+            while ( lossBucket < MetricsLossNumBuckets - 1 && stats.packetLoss > MetricsLossBuckets[lossBucket] )
+                lossBucket++;
+            metrics.lossBuckets[lossBucket]++;
+            metrics.lossSum += stats.packetLoss;
+
+            metrics.numChannels = yojimbo_max( metrics.numChannels, stats.numChannels );
+            for ( int channelIndex = 0; channelIndex < stats.numChannels; ++channelIndex )
+            {
+                const ChannelStats & channelStats = stats.channel[channelIndex];
+                ChannelMetrics & channelMetrics = metrics.channel[channelIndex];
+                for ( int i = 0; i < CHANNEL_COUNTER_NUM_COUNTERS; ++i )
+                    channelMetrics.counters[i] += channelStats.counters[i];
+                channelMetrics.sendQueueDepth += channelStats.sendQueueDepth;
+                channelMetrics.maxSendQueueDepth = yojimbo_max( channelMetrics.maxSendQueueDepth, channelStats.sendQueueDepth );
+                channelMetrics.receiveQueueDepth += channelStats.receiveQueueDepth;
+                channelMetrics.maxReceiveQueueDepth = yojimbo_max( channelMetrics.maxReceiveQueueDepth, channelStats.receiveQueueDepth );
+            }
+
+            server.GetClientAllocatorStats( clientIndex, allocatorStats );
+            metrics.clientBytesAllocated += allocatorStats.bytesAllocated;
+            metrics.maxClientBytesAllocated = yojimbo_max( metrics.maxClientBytesAllocated, (uint64_t) allocatorStats.bytesAllocated );
+        }
+    }
+
+    /// Writes metrics text in one of the MetricsFormat formats. Stops writing once the buffer is full.
+
+    struct MetricsWriter
+    {
+        int format;
+        const char * prefix;
+        char * buffer;
+        int bufferSize;
+        int bytes;
+        bool overflow;
+
+        MetricsWriter( int _format, const char * _prefix, char * _buffer, int _bufferSize )
+        {
+            format = _format;
+            prefix = _prefix;
+            buffer = _buffer;
+            bufferSize = _bufferSize;
+            bytes = 0;
+            overflow = bufferSize <= 0;
+            if ( !overflow )
+                buffer[0] = '\0';
+        }
+
+        void Print( const char * fmt, ... )
+        {
+            if ( overflow )
+                return;
+            va_list args;
+            va_start( args, fmt );
+            const int result = vsnprintf( buffer + bytes, bufferSize - bytes, fmt, args );
+            va_end( args );
+            if ( result < 0 || result >= bufferSize - bytes )
+            {
+                overflow = true;
+                return;
+            }
+            bytes += result;
+        }
+
+        void Type( const char * name, const char * type )
+        {
+            if ( format == METRICS_FORMAT_PROMETHEUS )
+                Print( "# TYPE %s_%s %s\n", prefix, name, type );
+        }
+
+        void Value( const char * name, const char * label, const char * labelValue, double value )
+        {
+            if ( format == METRICS_FORMAT_PROMETHEUS )
+            {
+                if ( label )
+                    Print( "%s_%s{%s=\"%s\"} %.15g\n", prefix, name, label, labelValue, value );
+                else
+                    Print( "%s_%s %.15g\n", prefix, name, value );
+            }
+            else
+            {
+                if ( label )
+                {
+                    // dots separate the parts of a statsd name, so they can't appear in label values
+
+                    char statsdValue[32];
+                    strncpy( statsdValue, labelValue, sizeof( statsdValue ) - 1 );
+                    statsdValue[sizeof( statsdValue ) - 1] = '\0';
+                    for ( char * p = statsdValue; *p; ++p )
+                    {
+                        if ( *p == '.' )
+                            *p = '_';
+                    }
+                    Print( "%s.%s.%s_%s:%.15g|g\n", prefix, name, label, statsdValue, value );
+                }
+                else
+                {
+                    Print( "%s.%s:%.15g|g\n", prefix, name, value );
+                }
+            }
+        }
+
+        void Gauge( const char * name, double value )
+        {
+            Type( name, "gauge" );
+            Value( name, NULL, NULL, value );
+        }
+    };
+
+    static double MetricsRate( uint64_t current, uint64_t previous, double deltaTime )
+    {
+        return current > previous ? double( current - previous ) / deltaTime : 0.0;
+    }
+
+    int WriteServerMetrics( int format, const char * prefix, const ServerMetrics & metrics, const ServerMetrics * previous, char * buffer, int bufferSize )
+    {
+        yojimbo_assert( format == METRICS_FORMAT_PROMETHEUS || format == METRICS_FORMAT_STATSD );
+        yojimbo_assert( prefix );
+        yojimbo_assert( buffer || bufferSize == 0 );
+
+        MetricsWriter writer( format, prefix, buffer, bufferSize );
+
+        writer.Gauge( "connected_clients", metrics.numConnectedClients );
+        writer.Gauge( "max_clients", metrics.maxClients );
+        writer.Gauge( "packets_sent", double( metrics.numPacketsSent ) );
+        writer.Gauge( "packets_received", double( metrics.numPacketsReceived ) );
+        writer.Gauge( "packets_acked", double( metrics.numPacketsAcked ) );
+        writer.Gauge( "packet_bytes_generated", double( metrics.packetBytesGenerated ) );
+        writer.Gauge( "ingress_packets_dropped", double( metrics.numIngressPacketsDropped ) );
+        writer.Gauge( "ingress_bytes_dropped", double( metrics.ingressBytesDropped ) );
+
+        const double deltaTime = previous ? metrics.time - previous->time : 0.0;
+        if ( deltaTime > 0.0 )
+        {
+            writer.Gauge( "packets_sent_per_second", MetricsRate( metrics.numPacketsSent, previous->numPacketsSent, deltaTime ) );
+            writer.Gauge( "packets_received_per_second", MetricsRate( metrics.numPacketsReceived, previous->numPacketsReceived, deltaTime ) );
+            writer.Gauge( "packet_bytes_generated_per_second", MetricsRate( metrics.packetBytesGenerated, previous->packetBytesGenerated, deltaTime ) );
+        }
+
+        writer.Gauge( "sent_bandwidth_kbps", metrics.sentBandwidth );
+        writer.Gauge( "received_bandwidth_kbps", metrics.receivedBandwidth );
+
+        writer.Gauge( "tick_seconds", metrics.tickTime );
+        writer.Gauge( "overload_level", metrics.overloadLevel );
+        writer.Type( "tick_phase_seconds", "gauge" );
+        for ( int i = 0; i < SERVER_TICK_PHASE_NUM_PHASES; ++i )
+            writer.Value( "tick_phase_seconds", "phase", MetricsTickPhaseNames[i], metrics.tickPhaseTime[i] );
+
+        writer.Gauge( "global_allocator_bytes", double( metrics.globalAllocator.bytesAllocated ) );
+        writer.Gauge( "global_allocator_peak_bytes", double( metrics.globalAllocator.peakBytesAllocated ) );
+        writer.Gauge( "global_allocator_largest_free_block_bytes", double( metrics.globalAllocator.largestFreeBlock ) );
+        writer.Gauge( "client_allocator_bytes", double( metrics.clientBytesAllocated ) );
+        writer.Gauge( "client_allocator_max_bytes", double( metrics.maxClientBytesAllocated ) );
+
+        writer.Type( "rtt_seconds", "summary" );
+        writer.Value( "rtt_seconds", "quantile", "0.5", metrics.rtt.GetPercentile( 0.5 ) );
+        writer.Value( "rtt_seconds", "quantile", "0.9", metrics.rtt.GetPercentile( 0.9 ) );
+        writer.Value( "rtt_seconds", "quantile", "0.99", metrics.rtt.GetPercentile( 0.99 ) );
+        writer.Value( "rtt_seconds_sum", NULL, NULL, metrics.rtt.sum );
+        writer.Value( "rtt_seconds_count", NULL, NULL, double( metrics.rtt.count ) );
+
+        writer.Type( "packet_loss_percent", "histogram" );
+        uint32_t lossCount = 0;
+        for ( int i = 0; i < MetricsLossNumBuckets; ++i )
+        {
+            char bound[32];
+            snprintf( bound, sizeof( bound ), "%g", MetricsLossBuckets[i] );
+            lossCount += metrics.lossBuckets[i];
+            writer.Value( "packet_loss_percent_bucket", "le", bound, lossCount );
+        }
+        writer.Value( "packet_loss_percent_bucket", "le", "+Inf", lossCount );
+        writer.Value( "packet_loss_percent_sum", NULL, NULL, metrics.lossSum );
+        writer.Value( "packet_loss_percent_count", NULL, NULL, lossCount );
+
+        char channelName[64];
+        char channelLabel[16];
+        for ( int i = 0; i < CHANNEL_COUNTER_NUM_COUNTERS; ++i )
+        {
+            snprintf( channelName, sizeof( channelName ), "channel_%s", MetricsChannelCounterNames[i] );
+            writer.Type( channelName, "gauge" );
+            for ( int channelIndex = 0; channelIndex < metrics.numChannels; ++channelIndex )
+            {
+                snprintf( channelLabel, sizeof( channelLabel ), "%d", channelIndex );
+                writer.Value( channelName, "channel", channelLabel, double( metrics.channel[channelIndex].counters[i] ) );
+            }
+        }
+
+        static const char * const queueNames[] = { "channel_send_queue_depth", "channel_max_send_queue_depth", "channel_receive_queue_depth", "channel_max_receive_queue_depth" };
+        for ( int i = 0; i < 4; ++i )
+        {
+            writer.Type( queueNames[i], "gauge" );
+            for ( int channelIndex = 0; channelIndex < metrics.numChannels; ++channelIndex )
+            {
+                const ChannelMetrics & channelMetrics = metrics.channel[channelIndex];
+                const int values[] = { channelMetrics.sendQueueDepth, channelMetrics.maxSendQueueDepth, channelMetrics.receiveQueueDepth, channelMetrics.maxReceiveQueueDepth };
+                snprintf( channelLabel, sizeof( channelLabel ), "%d", channelIndex );
+                writer.Value( queueNames[i], "channel", channelLabel, values[i] );
+            }
+        }
+
+        if ( writer.overflow )
+        {
+            if ( bufferSize > 0 )
+                buffer[0] = '\0';
+            return -1;
+        }
+
+        return writer.bytes;
+    }
+
+    MetricsExporter::MetricsExporter( Allocator & allocator, const MetricsConfig & config )
+    {
+        yojimbo_assert( config.interval >= 0.0 );
+        yojimbo_assert( config.prefix );
+        yojimbo_assert( config.textBufferSize > 0 );
+        m_allocator = &allocator;
+        m_config = config;
+        for ( int i = 0; i < 3; ++i )
+            m_slots[i] = YOJIMBO_NEW( allocator, ServerMetrics );
+        m_writeSlot = 0;
+        m_latestSlot = 1;
+        m_readSlot = 2;
+        m_previous = YOJIMBO_NEW( allocator, ServerMetrics );
+        m_hasPrevious = false;
+        m_text = (char*) YOJIMBO_ALLOCATE( allocator, config.textBufferSize );
+        m_nextCollectTime = 0.0;
+        m_thread = NULL;
+        m_quit = 0;
+        if ( config.exportFunction )
+        {
+            m_thread = yojimbo_thread_create( StaticExportFunction, this );
+            if ( !m_thread )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create metrics export thread\n" );
+        }
+    }
+
+    MetricsExporter::~MetricsExporter()
+    {
+        if ( m_thread )
+        {
+            yojimbo_atomic_compare_exchange( &m_quit, 1, 0 );
+            yojimbo_thread_join( m_thread );
+            m_thread = NULL;
+        }
+        for ( int i = 0; i < 3; ++i )
+            YOJIMBO_DELETE( *m_allocator, ServerMetrics, m_slots[i] );
+        YOJIMBO_DELETE( *m_allocator, ServerMetrics, m_previous );
+        YOJIMBO_FREE( *m_allocator, m_text );
+        m_allocator = NULL;
+    }
+
+    bool MetricsExporter::Collect( const Server & server, double time )
+    {
+        if ( time < m_nextCollectTime )
+            return false;
+        m_nextCollectTime = time + m_config.interval;
+        CollectServerMetrics( server, time, *m_slots[m_writeSlot] );
+        PublishWriteSlot();
+        return true;
+    }
+
+    void MetricsExporter::Publish( const ServerMetrics & metrics )
+    {
+        *m_slots[m_writeSlot] = metrics;
+        PublishWriteSlot();
+    }
+
+    bool MetricsExporter::GetLatest( ServerMetrics & metrics )
+    {
+        yojimbo_assert( !m_thread );
+        if ( !TakeLatestSlot() )
+            return false;
+        metrics = *m_slots[m_readSlot];
+        return true;
+    }
+
+    void MetricsExporter::PublishWriteSlot()
+    {
+        // swap the slot just written with the latest slot. the slot that was latest is written next, even if it was never taken, so the reader only ever sees the newest snapshot
+
+        while ( true )
+        {
+            const int latestSlot = m_latestSlot;
+            if ( yojimbo_atomic_compare_exchange( &m_latestSlot, m_writeSlot | MetricsSlotFresh, latestSlot ) == latestSlot )
+            {
+                m_writeSlot = latestSlot & MetricsSlotMask;
+                break;
+            }
+        }
+    }
+
+    bool MetricsExporter::TakeLatestSlot()
+    {
+        while ( true )
+        {
+            const int latestSlot = m_latestSlot;
+            if ( ( latestSlot & MetricsSlotFresh ) == 0 )
+                return false;
+            if ( yojimbo_atomic_compare_exchange( &m_latestSlot, m_readSlot, latestSlot ) == latestSlot )
+            {
+                m_readSlot = latestSlot & MetricsSlotMask;
+                return true;
+            }
+        }
+    }
+
+    void MetricsExporter::StaticExportFunction( void * context )
+    {
+        MetricsExporter * exporter = (MetricsExporter*) context;
+        exporter->ExportFunction();
+    }
+
+    void MetricsExporter::ExportFunction()
+    {
+        while ( !m_quit )
+        {
+            if ( !TakeLatestSlot() )
+            {
+                yojimbo_sleep( MetricsExportPollTime );
+                continue;
+            }
+            const ServerMetrics & metrics = *m_slots[m_readSlot];
+            int textBytes = WriteServerMetrics( m_config.format, m_config.prefix, metrics, m_hasPrevious ? m_previous : NULL, m_text, m_config.textBufferSize );
+            if ( textBytes < 0 )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: metrics text does not fit in %d bytes. increase MetricsConfig::textBufferSize\n", m_config.textBufferSize );
+                textBytes = 0;
+            }
+            m_config.exportFunction( m_config.exportContext, metrics, m_text, textBytes );
+            *m_previous = metrics;
+            m_hasPrevious = true;
+        }
+    }
+}
@@ -0,0 +1,235 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_METRICS_H
+#define YOJIMBO_METRICS_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_platform.h"
+#include "yojimbo_channel.h"
+#include "yojimbo_histogram.h"
+#include "yojimbo_server.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    const int MetricsLossNumBuckets = 8;                                    ///< Number of packet loss buckets in ServerMetrics. See MetricsLossBuckets.
+
+    extern const float MetricsLossBuckets[MetricsLossNumBuckets];           ///< Upper bound of each packet loss bucket in ServerMetrics (percent). The last bucket is 100.
+
+    /// Output formats for WriteServerMetrics.
+
+    enum MetricsFormat
+    {
+        METRICS_FORMAT_PROMETHEUS,                                          ///< Prometheus text exposition format. Per-channel values are labeled with channel="n".
+        METRICS_FORMAT_STATSD                                               ///< StatsD gauges, one per line. Labels are folded into the metric name, eg. prefix.channel_send_queue_depth.channel_0.
+    };
+
+    /// Server wide totals for one channel. See ServerMetrics.
+
+    struct ChannelMetrics
+    {
+        uint64_t counters[CHANNEL_COUNTER_NUM_COUNTERS];                    ///< The channel counters summed over connected clients. See ChannelCounters.
+        int sendQueueDepth;                                                 ///< Messages queued for sending, summed over connected clients.
+        int maxSendQueueDepth;                                              ///< The deepest send queue of any connected client.
+        int receiveQueueDepth;                                              ///< Messages waiting to be received, summed over connected clients.
+        int maxReceiveQueueDepth;                                           ///< The deepest receive queue of any connected client.
+    };
+
+    /**
+        A snapshot of server wide metrics, aggregated over every connected client. See MetricsExporter.
+
+        Totals are summed over the clients connected when the snapshot was taken, so they drop when clients disconnect. Rates computed from two snapshots are clamped at zero for that reason.
+
+        The struct is plain data, so it can be copied, or sent as is to a collector built with the same version of yojimbo.
+     */
+
+    struct ServerMetrics
+    {
+        double time;                                                        ///< The server time the snapshot was taken (seconds).
+        int maxClients;                                                     ///< Number of client slots.
+        int numConnectedClients;                                            ///< Number of connected clients.
+        uint64_t numPacketsSent;                                            ///< Packets sent, summed over connected clients. See ConnectionStats::numPacketsSent.
+        uint64_t numPacketsReceived;                                        ///< Packets received, summed over connected clients.
+        uint64_t numPacketsAcked;                                           ///< Packets acked, summed over connected clients.
+        uint64_t packetBytesGenerated;                                      ///< Size of the packets generated, summed over connected clients (bytes).
+        uint64_t numIngressPacketsDropped;                                  ///< Packets dropped for going over the per-client ingress budget, summed over connected clients. See BaseServer::GetClientIngressStats.
+        uint64_t ingressBytesDropped;                                       ///< Size of the packets dropped for going over the per-client ingress budget, summed over connected clients (bytes).
+        double sentBandwidth;                                               ///< Bandwidth sent, summed over connected clients (kbps).
+        double receivedBandwidth;                                           ///< Bandwidth received, summed over connected clients (kbps).
+        double tickTime;                                                    ///< The tick time reported with Server::SetTickTime (seconds).
+        int overloadLevel;                                                  ///< The number of overload steps applied. See BaseServer::GetOverloadLevel.
+        double tickPhaseTime[SERVER_TICK_PHASE_NUM_PHASES];                 ///< Time each phase of the last tick took (seconds). See ServerTickPhase.
+        AllocatorStats globalAllocator;                                     ///< Stats of the server global allocator.
+        uint64_t clientBytesAllocated;                                      ///< Bytes allocated by client allocators, summed over connected clients.
+        uint64_t maxClientBytesAllocated;                                   ///< The most bytes allocated by any connected client's allocator.
+        LatencyHistogram rtt;                                               ///< Distribution of the smoothed RTT of connected clients (seconds).
+        uint32_t lossBuckets[MetricsLossNumBuckets];                        ///< Number of connected clients in each packet loss bucket. See MetricsLossBuckets.
+        double lossSum;                                                     ///< Packet loss summed over connected clients (percent).
+        int numChannels;                                                    ///< Number of channels in [0,MaxChannels]. The highest number of channels of any connected client.
+        ChannelMetrics channel[MaxChannels];                                ///< Totals for each channel in [0,numChannels-1].
+
+        ServerMetrics() { Clear(); }
+
+        /**
+            Reset everything to zero.
+         */
+
+        void Clear();
+    };
+
+    /**
+        Collect server wide metrics from a server.
+
+        Walks every client slot, so call it at the rate you export metrics, not every tick. MetricsExporter::Collect does that for you.
+
+        @param server The server to collect metrics from.
+        @param time The current time (seconds).
+        @param metrics The metrics (out).
+     */
+
+    void CollectServerMetrics( const Server & server, double time, ServerMetrics & metrics );
+
+    /**
+        Write metrics as text for a metrics collector.
+
+        Rates per second are written when a previous snapshot is passed in, from the difference between the two.
+
+        @param format The text format. See MetricsFormat.
+        @param prefix Prefix for metric names, eg. "yojimbo".
+        @param metrics The metrics to write.
+        @param previous The previous snapshot to compute rates from. May be NULL.
+        @param buffer The buffer to write to. The text is null terminated.
+        @param bufferSize The size of the buffer (bytes).
+
+        @returns The length of the text (bytes), or -1 if the buffer is too small.
+     */
+
+    int WriteServerMetrics( int format, const char * prefix, const ServerMetrics & metrics, const ServerMetrics * previous, char * buffer, int bufferSize );
+
+    /**
+        Function called on the export thread with each new metrics snapshot. See MetricsConfig::exportFunction.
+
+        @param context The context pointer passed in MetricsConfig::exportContext.
+        @param metrics The snapshot, for collectors that want the numbers rather than text.
+        @param text The snapshot written with WriteServerMetrics, null terminated.
+        @param textBytes The length of the text (bytes).
+     */
+
+    typedef void (*MetricsExportFunction)( void * context, const ServerMetrics & metrics, const char * text, int textBytes );
+
+    /**
+        Configuration for a MetricsExporter.
+     */
+
+    struct MetricsConfig
+    {
+        double interval;                                                    ///< Time between snapshots (seconds).
+        int format;                                                         ///< The text format passed to the export function. See MetricsFormat.
+        const char * prefix;                                                ///< Prefix for metric names. Must outlive the exporter.
+        int textBufferSize;                                                 ///< Size of the text buffer (bytes). Allow about 1k per channel in use.
+        MetricsExportFunction exportFunction;                               ///< Called on the export thread with each snapshot, eg. to write it to a socket or a file scraped by Prometheus. NULL to start no thread and poll with MetricsExporter::GetLatest instead.
+        void * exportContext;                                               ///< Context pointer passed to the export function.
+
+        MetricsConfig()
+        {
+            interval = 1.0;
+            format = METRICS_FORMAT_PROMETHEUS;
+            prefix = "yojimbo";
+            textBufferSize = 64 * 1024;
+            exportFunction = NULL;
+            exportContext = NULL;
+        }
+    };
+
+    /**
+        Exports server wide metrics from a background thread.
+
+        Call Collect on the thread that ticks the server. Once per MetricsConfig::interval it takes a snapshot with CollectServerMetrics and hands it to the export thread through a triple buffer: one atomic exchange, no locks and no allocations, so the network thread never waits for the exporter. The export thread turns the latest snapshot into text with WriteServerMetrics and passes it to the export function. If the exporter falls behind, it skips to the latest snapshot.
+
+        Memory is allocated in the constructor only.
+     */
+
+    class MetricsExporter
+    {
+    public:
+
+        /**
+            Allocate the snapshot and text buffers, and start the export thread if there is an export function.
+
+            @param allocator The allocator for the buffers.
+            @param config The metrics configuration.
+         */
+
+        MetricsExporter( Allocator & allocator, const MetricsConfig & config = MetricsConfig() );
+
+        /**
+            Stop the export thread, then free the buffers.
+         */
+
+        ~MetricsExporter();
+
+        /**
+            Take a snapshot of the server and publish it, if MetricsConfig::interval has passed since the last one. Call this once per tick, after SendPackets.
+
+            @param server The server to collect metrics from.
+            @param time The current time (seconds).
+
+            @returns True if a snapshot was taken.
+         */
+
+        bool Collect( const Server & server, double time );
+
+        /**
+            Publish a snapshot collected elsewhere, eg. merged from several servers in one process. Only call this from one thread, the same one that calls Collect.
+
+            @param metrics The snapshot.
+         */
+
+        void Publish( const ServerMetrics & metrics );
+
+        /**
+            Take the latest published snapshot, when there is no export function. Only call this from one thread.
+
+            @param metrics The snapshot (out).
+
+            @returns True if a snapshot was published since the last call.
+         */
+
+        bool GetLatest( ServerMetrics & metrics );
+
+    private:
+
+        void PublishWriteSlot();
+
+        bool TakeLatestSlot();
+
+        static void StaticExportFunction( void * context );
+
+        void ExportFunction();
+
+        MetricsExporter( const MetricsExporter & other );
+
+        const MetricsExporter & operator = ( const MetricsExporter & other );
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        MetricsConfig m_config;                                             ///< The metrics configuration.
+        ServerMetrics * m_slots[3];                                         ///< The snapshot slots of the triple buffer.
+        int m_writeSlot;                                                    ///< The slot the next snapshot is written to. Owned by the publishing thread.
+        int m_readSlot;                                                     ///< The slot holding the snapshot last taken. Owned by the reading thread.
+        volatile int m_latestSlot;                                          ///< The slot holding the latest snapshot, plus 4 if it hasn't been taken yet. Swapped with atomic compare exchange.
+        ServerMetrics * m_previous;                                         ///< The snapshot exported before the current one, for rates. Owned by the export thread.
+        bool m_hasPrevious;                                                 ///< True once m_previous holds a snapshot.
+        char * m_text;                                                      ///< The text buffer, MetricsConfig::textBufferSize bytes. Owned by the export thread.
+        double m_nextCollectTime;                                           ///< The time Collect takes the next snapshot.
+        yojimbo_thread_t * m_thread;                                        ///< The export thread. NULL without an export function.
+        volatile int m_quit;                                                ///< Set to 1 to make the export thread exit.
+    };
+}
+
+#endif // #ifndef YOJIMBO_METRICS_H
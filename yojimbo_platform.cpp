@@ -10,6 +10,7 @@
 #include "reliable.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 static void default_assert_handler( const char * condition, const char * function, const char * file, int line )
 {
@@ -47,23 +48,170 @@ void yojimbo_set_assert_function( void (*function)( const char *, const char *,
     reliable_set_assert_function( function );
 }
 
+/*
+    Asynchronous logging. The ring is a bounded multi-producer queue: each entry has a sequence number that says whether
+    it is free to write for a given write index, or ready to read for a given read index. Threads claim an entry by
+    advancing the write index with a compare exchange, format into it, then publish it by bumping its sequence number.
+    There is only ever one reader, the log thread.
+*/
+
+struct log_entry_t
+{
+    volatile int sequence;
+    char text[YOJIMBO_LOG_ENTRY_BYTES];
+};
+
+static log_entry_t * log_entries = NULL;
+static int log_num_entries = 0;
+static volatile int log_write_index = 0;
+static int log_read_index = 0;
+static volatile int log_num_dropped = 0;
+static volatile int log_async = 0;
+static volatile int log_thread_quit = 0;
+static yojimbo_thread_t * log_thread = NULL;
+
+static inline int log_sequence_difference( int a, int b )
+{
+    return (int) ( (unsigned int) a - (unsigned int) b );
+}
+
+static bool log_flush_entry()
+{
+    log_entry_t * entry = &log_entries[log_read_index & ( log_num_entries - 1 )];
+    if ( log_sequence_difference( entry->sequence, log_read_index + 1 ) != 0 )
+        return false;
+    yojimbo_memory_barrier();
+    printf_function( "%s", entry->text );
+    yojimbo_memory_barrier();
+    entry->sequence = (int) ( (unsigned int) log_read_index + (unsigned int) log_num_entries );
+    log_read_index = (int) ( (unsigned int) log_read_index + 1 );
+    return true;
+}
+
+static void log_thread_function( void * context )
+{
+    (void) context;
+    while ( true )
+    {
+        const int quit = log_thread_quit;
+        yojimbo_memory_barrier();
+        bool flushed = false;
+        while ( log_flush_entry() )
+            flushed = true;
+        if ( quit )
+            break;
+        if ( !flushed )
+            yojimbo_sleep( 0.001 );
+    }
+}
+
+static void log_push_entry( const char * format, va_list args )
+{
+    int writeIndex = log_write_index;
+    log_entry_t * entry = NULL;
+    while ( true )
+    {
+        entry = &log_entries[writeIndex & ( log_num_entries - 1 )];
+        const int difference = log_sequence_difference( entry->sequence, writeIndex );
+        if ( difference == 0 )
+        {
+            const int nextWriteIndex = (int) ( (unsigned int) writeIndex + 1 );
+            const int previous = yojimbo_atomic_compare_exchange( &log_write_index, nextWriteIndex, writeIndex );
+            if ( previous == writeIndex )
+                break;
+            writeIndex = previous;
+        }
+        else if ( difference < 0 )
+        {
+            // the ring is full. the log thread is behind by a whole ring
+            yojimbo_atomic_increment( &log_num_dropped );
+            return;
+        }
+        else
+        {
+            writeIndex = log_write_index;
+        }
+    }
+    vsnprintf( entry->text, YOJIMBO_LOG_ENTRY_BYTES, format, args );
+    entry->text[YOJIMBO_LOG_ENTRY_BYTES-1] = '\0';
+    yojimbo_memory_barrier();
+    entry->sequence = (int) ( (unsigned int) writeIndex + 1 );
+}
+
+bool yojimbo_log_start_async( int numEntries )
+{
+    yojimbo_assert( numEntries > 0 );
+    if ( log_thread )
+        return false;
+    int size = 1;
+    while ( size < numEntries )
+        size *= 2;
+    log_entries = (log_entry_t*) malloc( sizeof( log_entry_t ) * size );
+    if ( !log_entries )
+        return false;
+    for ( int i = 0; i < size; ++i )
+        log_entries[i].sequence = i;
+    log_num_entries = size;
+    log_write_index = 0;
+    log_read_index = 0;
+    log_num_dropped = 0;
+    log_thread_quit = 0;
+    log_thread = yojimbo_thread_create( log_thread_function, NULL );
+    if ( !log_thread )
+    {
+        free( log_entries );
+        log_entries = NULL;
+        return false;
+    }
+    yojimbo_memory_barrier();
+    log_async = 1;
+    return true;
+}
+
+void yojimbo_log_stop_async()
+{
+    if ( !log_thread )
+        return;
+    // IMPORTANT: Make sure no other thread is logging while asynchronous logging stops
+    log_async = 0;
+    yojimbo_memory_barrier();
+    log_thread_quit = 1;
+    yojimbo_thread_join( log_thread );
+    log_thread = NULL;
+    free( log_entries );
+    log_entries = NULL;
+    log_num_entries = 0;
+}
+
+int yojimbo_log_num_dropped()
+{
+    return log_num_dropped;
+}
+
 #if YOJIMBO_ENABLE_LOGGING
 
-void yojimbo_printf( int level, const char * format, ... ) 
+void yojimbo_log_printf( int level, const char * format, ... ) 
 {
     if ( level > log_level )
         return;
     va_list args;
     va_start( args, format );
-    char buffer[4*1024];
-    vsprintf( buffer, format, args );
-    printf_function( "%s", buffer );
+    if ( log_async )
+    {
+        log_push_entry( format, args );
+    }
+    else
+    {
+        char buffer[4*1024];
+        vsnprintf( buffer, sizeof( buffer ), format, args );
+        printf_function( "%s", buffer );
+    }
     va_end( args );
 }
 
 #else // #if YOJIMBO_ENABLE_LOGGING
 
-void yojimbo_printf( int level, const char * format, ... ) 
+void yojimbo_log_printf( int level, const char * format, ... ) 
 {
     (void) level;
     (void) format;
@@ -78,33 +226,247 @@ void yojimbo_printf( int level, const char * format, ... )
 // ===============================
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <mach/mach.h>
 #include <mach/mach_time.h>
+#include <pthread.h>
 
 void yojimbo_sleep( double time )
 {
     usleep( (int) ( time * 1000000 ) );
 }
 
-double yojimbo_time()
-{
-    static uint64_t start = 0;
-
-    static mach_timebase_info_data_t timebase_info;
+static uint64_t time_start = 0;
+static mach_timebase_info_data_t timebase_info;
 
-    if ( start == 0 )
+static double platform_time()
+{
+    if ( time_start == 0 )
     {
         mach_timebase_info( &timebase_info );
-        start = mach_absolute_time();
+        time_start = mach_absolute_time();
         return 0.0;
     }
 
     uint64_t current = mach_absolute_time();
 
-    if ( current < start )
-        current = start;
+    if ( current < time_start )
+        current = time_start;
+
+    return ( double( current - time_start ) * double( timebase_info.numer ) / double( timebase_info.denom ) ) / 1000000000.0;
+}
+
+// wake up this long before the deadline, and spin for the rest. covers scheduler wakeup latency (seconds)
+
+static const double sleep_spin_time = 0.0005;
+
+void yojimbo_sleep_until( double time )
+{
+    const double wakeTime = time - sleep_spin_time;
+
+    if ( wakeTime > yojimbo_time() )
+    {
+        const uint64_t deadline = time_start + uint64_t( wakeTime * 1000000000.0 * double( timebase_info.denom ) / double( timebase_info.numer ) );
+        mach_wait_until( deadline );
+    }
+
+    while ( yojimbo_time() < time )
+    {
+        // spin
+    }
+}
+
+int yojimbo_atomic_compare_exchange( volatile int * destination, int exchange, int comparand )
+{
+    return __sync_val_compare_and_swap( destination, comparand, exchange );
+}
+
+void * yojimbo_atomic_compare_exchange_pointer( void * volatile * destination, void * exchange, void * comparand )
+{
+    return __sync_val_compare_and_swap( destination, comparand, exchange );
+}
+
+int yojimbo_atomic_increment( volatile int * value )
+{
+    return __sync_add_and_fetch( value, 1 );
+}
+
+int yojimbo_atomic_decrement( volatile int * value )
+{
+    return __sync_sub_and_fetch( value, 1 );
+}
+
+void yojimbo_memory_barrier()
+{
+    __sync_synchronize();
+}
+
+struct yojimbo_thread_t
+{
+    pthread_t thread;
+    void (*function)( void * context );
+    void * context;
+};
+
+static void * yojimbo_thread_start( void * data )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) data;
+    thread->function( thread->context );
+    return NULL;
+}
+
+yojimbo_thread_t * yojimbo_thread_create( void (*function)( void * context ), void * context )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) malloc( sizeof( yojimbo_thread_t ) );
+    if ( !thread )
+        return NULL;
+    thread->function = function;
+    thread->context = context;
+    if ( pthread_create( &thread->thread, NULL, yojimbo_thread_start, thread ) != 0 )
+    {
+        free( thread );
+        return NULL;
+    }
+    return thread;
+}
+
+void yojimbo_thread_join( yojimbo_thread_t * thread )
+{
+    yojimbo_assert( thread );
+    pthread_join( thread->thread, NULL );
+    free( thread );
+}
+
+struct yojimbo_semaphore_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    int count;
+};
+
+yojimbo_semaphore_t * yojimbo_semaphore_create()
+{
+    yojimbo_semaphore_t * semaphore = (yojimbo_semaphore_t*) malloc( sizeof( yojimbo_semaphore_t ) );
+    if ( !semaphore )
+        return NULL;
+    pthread_mutex_init( &semaphore->mutex, NULL );
+    pthread_cond_init( &semaphore->condition, NULL );
+    semaphore->count = 0;
+    return semaphore;
+}
+
+void yojimbo_semaphore_destroy( yojimbo_semaphore_t * semaphore )
+{
+    if ( !semaphore )
+        return;
+    pthread_cond_destroy( &semaphore->condition );
+    pthread_mutex_destroy( &semaphore->mutex );
+    free( semaphore );
+}
+
+void yojimbo_semaphore_signal( yojimbo_semaphore_t * semaphore, int count )
+{
+    yojimbo_assert( semaphore );
+    yojimbo_assert( count > 0 );
+    pthread_mutex_lock( &semaphore->mutex );
+    semaphore->count += count;
+    if ( count == 1 )
+        pthread_cond_signal( &semaphore->condition );
+    else
+        pthread_cond_broadcast( &semaphore->condition );
+    pthread_mutex_unlock( &semaphore->mutex );
+}
+
+void yojimbo_semaphore_wait( yojimbo_semaphore_t * semaphore )
+{
+    yojimbo_assert( semaphore );
+    pthread_mutex_lock( &semaphore->mutex );
+    while ( semaphore->count == 0 )
+        pthread_cond_wait( &semaphore->condition, &semaphore->mutex );
+    semaphore->count--;
+    pthread_mutex_unlock( &semaphore->mutex );
+}
+
+void * yojimbo_page_allocate( size_t bytes, bool hugePages, int numaNode )
+{
+    // macOS has no NUMA nodes, and superpages are only available on some hardware, so both hints are ignored
+
+    (void) hugePages;
+    (void) numaNode;
+
+    void * memory = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0 );
+
+    return ( memory != MAP_FAILED ) ? memory : NULL;
+}
+
+void yojimbo_page_free( void * memory, size_t bytes, bool hugePages )
+{
+    (void) hugePages;
+
+    if ( memory )
+        munmap( memory, bytes );
+}
+
+bool yojimbo_page_lock( void * memory, size_t bytes )
+{
+    yojimbo_assert( memory );
+    return mlock( memory, bytes ) == 0;
+}
+
+void yojimbo_page_unlock( void * memory, size_t bytes )
+{
+    if ( memory )
+        munlock( memory, bytes );
+}
+
+void * yojimbo_file_map( const char * path, uint64_t offset, size_t bytes, bool writable )
+{
+    yojimbo_assert( path );
+    yojimbo_assert( bytes > 0 );
+
+    const int file = open( path, writable ? ( O_RDWR | O_CREAT ) : O_RDONLY, 0644 );
+    if ( file < 0 )
+        return NULL;
+
+    // reading past the end of the file through a mapping faults, so read-only ranges must be inside the file
+
+    struct stat fileStat;
+    bool valid = fstat( file, &fileStat ) == 0;
+    if ( valid && uint64_t( fileStat.st_size ) < offset + bytes )
+        valid = writable && ftruncate( file, off_t( offset + bytes ) ) == 0;
+
+    void * memory = MAP_FAILED;
+    const uint64_t pageOffset = offset % uint64_t( sysconf( _SC_PAGESIZE ) );
+    if ( valid )
+        memory = mmap( NULL, bytes + pageOffset, writable ? ( PROT_READ | PROT_WRITE ) : PROT_READ, MAP_SHARED, file, off_t( offset - pageOffset ) );
+
+    // the mapping keeps its own reference to the file
+    close( file );
+
+    return ( memory != MAP_FAILED ) ? (uint8_t*) memory + pageOffset : NULL;
+}
+
+void yojimbo_file_unmap( void * data, uint64_t offset, size_t bytes )
+{
+    if ( !data )
+        return;
+    const uint64_t pageOffset = offset % uint64_t( sysconf( _SC_PAGESIZE ) );
+    munmap( (uint8_t*) data - pageOffset, bytes + pageOffset );
+}
+
+int yojimbo_cpu_count()
+{
+    const long numCpus = sysconf( _SC_NPROCESSORS_ONLN );
+    return numCpus > 0 ? int( numCpus ) : 1;
+}
 
-    return ( double( current - start ) * double( timebase_info.numer ) / double( timebase_info.denom ) ) / 1000000000.0;
+uint64_t yojimbo_memory_limit()
+{
+    const long numPages = sysconf( _SC_PHYS_PAGES );
+    const long pageSize = sysconf( _SC_PAGESIZE );
+    return ( numPages > 0 && pageSize > 0 ) ? uint64_t( numPages ) * uint64_t( pageSize ) : 0;
 }
 
 #elif __linux
@@ -115,30 +477,397 @@ double yojimbo_time()
 
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
 
 void yojimbo_sleep( double time )
 {
     usleep( (int) ( time * 1000000 ) );
 }
 
-double yojimbo_time()
-{
-    static double start = -1;
+// CLOCK_MONOTONIC rather than CLOCK_MONOTONIC_RAW, because clock_nanosleep can only sleep on the former
+
+static double time_start = -1;
 
-    if ( start == -1 )
+static double platform_time()
+{
+    if ( time_start == -1 )
     {
         timespec ts;
-        clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
-        start = ts.tv_sec + double( ts.tv_nsec ) / 1000000000.0;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        time_start = ts.tv_sec + double( ts.tv_nsec ) / 1000000000.0;
         return 0.0;
     }
 
     timespec ts;
-    clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+    clock_gettime( CLOCK_MONOTONIC, &ts );
     double current = ts.tv_sec + double( ts.tv_nsec ) / 1000000000.0;
-    if ( current < start )
-        current = start;
-    return current - start;
+    if ( current < time_start )
+        current = time_start;
+    return current - time_start;
+}
+
+// wake up this long before the deadline, and spin for the rest. covers timer slack and scheduler wakeup latency (seconds)
+
+static const double sleep_spin_time = 0.0002;
+
+void yojimbo_sleep_until( double time )
+{
+    const double wakeTime = time - sleep_spin_time;
+
+    if ( wakeTime > yojimbo_time() )
+    {
+        const double deadline = time_start + wakeTime;
+        timespec ts;
+        ts.tv_sec = (time_t) deadline;
+        ts.tv_nsec = (long) ( ( deadline - double( ts.tv_sec ) ) * 1000000000.0 );
+        if ( ts.tv_nsec >= 1000000000L )
+            ts.tv_nsec = 999999999L;
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR )
+        {
+            // interrupted by a signal. the deadline is absolute, so just sleep again
+        }
+    }
+
+    while ( yojimbo_time() < time )
+    {
+        // spin
+    }
+}
+
+int yojimbo_atomic_compare_exchange( volatile int * destination, int exchange, int comparand )
+{
+    return __sync_val_compare_and_swap( destination, comparand, exchange );
+}
+
+void * yojimbo_atomic_compare_exchange_pointer( void * volatile * destination, void * exchange, void * comparand )
+{
+    return __sync_val_compare_and_swap( destination, comparand, exchange );
+}
+
+int yojimbo_atomic_increment( volatile int * value )
+{
+    return __sync_add_and_fetch( value, 1 );
+}
+
+int yojimbo_atomic_decrement( volatile int * value )
+{
+    return __sync_sub_and_fetch( value, 1 );
+}
+
+void yojimbo_memory_barrier()
+{
+    __sync_synchronize();
+}
+
+struct yojimbo_thread_t
+{
+    pthread_t thread;
+    void (*function)( void * context );
+    void * context;
+};
+
+static void * yojimbo_thread_start( void * data )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) data;
+    thread->function( thread->context );
+    return NULL;
+}
+
+yojimbo_thread_t * yojimbo_thread_create( void (*function)( void * context ), void * context )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) malloc( sizeof( yojimbo_thread_t ) );
+    if ( !thread )
+        return NULL;
+    thread->function = function;
+    thread->context = context;
+    if ( pthread_create( &thread->thread, NULL, yojimbo_thread_start, thread ) != 0 )
+    {
+        free( thread );
+        return NULL;
+    }
+    return thread;
+}
+
+void yojimbo_thread_join( yojimbo_thread_t * thread )
+{
+    yojimbo_assert( thread );
+    pthread_join( thread->thread, NULL );
+    free( thread );
+}
+
+struct yojimbo_semaphore_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    int count;
+};
+
+yojimbo_semaphore_t * yojimbo_semaphore_create()
+{
+    yojimbo_semaphore_t * semaphore = (yojimbo_semaphore_t*) malloc( sizeof( yojimbo_semaphore_t ) );
+    if ( !semaphore )
+        return NULL;
+    pthread_mutex_init( &semaphore->mutex, NULL );
+    pthread_cond_init( &semaphore->condition, NULL );
+    semaphore->count = 0;
+    return semaphore;
+}
+
+void yojimbo_semaphore_destroy( yojimbo_semaphore_t * semaphore )
+{
+    if ( !semaphore )
+        return;
+    pthread_cond_destroy( &semaphore->condition );
+    pthread_mutex_destroy( &semaphore->mutex );
+    free( semaphore );
+}
+
+void yojimbo_semaphore_signal( yojimbo_semaphore_t * semaphore, int count )
+{
+    yojimbo_assert( semaphore );
+    yojimbo_assert( count > 0 );
+    pthread_mutex_lock( &semaphore->mutex );
+    semaphore->count += count;
+    if ( count == 1 )
+        pthread_cond_signal( &semaphore->condition );
+    else
+        pthread_cond_broadcast( &semaphore->condition );
+    pthread_mutex_unlock( &semaphore->mutex );
+}
+
+void yojimbo_semaphore_wait( yojimbo_semaphore_t * semaphore )
+{
+    yojimbo_assert( semaphore );
+    pthread_mutex_lock( &semaphore->mutex );
+    while ( semaphore->count == 0 )
+        pthread_cond_wait( &semaphore->condition, &semaphore->mutex );
+    semaphore->count--;
+    pthread_mutex_unlock( &semaphore->mutex );
+}
+
+static size_t yojimbo_page_bytes( size_t bytes, bool hugePages )
+{
+    const size_t pageBytes = hugePages ? YOJIMBO_HUGE_PAGE_BYTES : (size_t) sysconf( _SC_PAGESIZE );
+    return ( bytes + pageBytes - 1 ) & ~( pageBytes - 1 );
+}
+
+void * yojimbo_page_allocate( size_t bytes, bool hugePages, int numaNode )
+{
+    bytes = yojimbo_page_bytes( bytes, hugePages );
+
+    uint8_t * memory = NULL;
+
+#ifdef MAP_HUGETLB
+    if ( hugePages )
+    {
+        void * p = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( p != MAP_FAILED )
+            memory = (uint8_t*) p;
+    }
+#endif // #ifdef MAP_HUGETLB
+
+    if ( !memory && hugePages )
+    {
+        // no huge pages reserved. map a huge page aligned range and ask for transparent huge pages instead
+
+        const size_t mappedBytes = bytes + YOJIMBO_HUGE_PAGE_BYTES;
+        
+        void * p = mmap( NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+            return NULL;
+
+        uint8_t * start = (uint8_t*) p;
+        uint8_t * aligned = (uint8_t*) ( ( uintptr_t( start ) + YOJIMBO_HUGE_PAGE_BYTES - 1 ) & ~uintptr_t( YOJIMBO_HUGE_PAGE_BYTES - 1 ) );
+        uint8_t * finish = start + mappedBytes;
+
+        if ( aligned > start )
+            munmap( start, aligned - start );
+        if ( finish > aligned + bytes )
+            munmap( aligned + bytes, finish - ( aligned + bytes ) );
+
+        memory = aligned;
+
+#ifdef MADV_HUGEPAGE
+        madvise( memory, bytes, MADV_HUGEPAGE );
+#endif // #ifdef MADV_HUGEPAGE
+    }
+
+    if ( !memory )
+    {
+        void * p = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+            return NULL;
+        memory = (uint8_t*) p;
+    }
+
+#ifdef SYS_mbind
+    if ( numaNode >= 0 )
+    {
+        // set the policy before anything touches the memory, because pages are placed on first touch.
+        // called directly, so there is no dependency on libnuma. a failure leaves the default policy in place.
+
+        const int MPOL_PREFERRED_MODE = 1;
+        const int NodeMaskWords = 16;
+        const int BitsPerWord = sizeof( unsigned long ) * 8;
+
+        unsigned long nodeMask[NodeMaskWords];
+        memset( nodeMask, 0, sizeof( nodeMask ) );
+
+        if ( numaNode < NodeMaskWords * BitsPerWord )
+        {
+            nodeMask[numaNode/BitsPerWord] |= 1UL << ( numaNode % BitsPerWord );
+            if ( syscall( SYS_mbind, memory, bytes, MPOL_PREFERRED_MODE, nodeMask, NodeMaskWords * BitsPerWord, 0 ) != 0 )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to bind memory to numa node %d\n", numaNode );
+        }
+    }
+#else // #ifdef SYS_mbind
+    (void) numaNode;
+#endif // #ifdef SYS_mbind
+
+    return memory;
+}
+
+void yojimbo_page_free( void * memory, size_t bytes, bool hugePages )
+{
+    if ( memory )
+        munmap( memory, yojimbo_page_bytes( bytes, hugePages ) );
+}
+
+bool yojimbo_page_lock( void * memory, size_t bytes )
+{
+    yojimbo_assert( memory );
+    return mlock( memory, bytes ) == 0;
+}
+
+void yojimbo_page_unlock( void * memory, size_t bytes )
+{
+    if ( memory )
+        munlock( memory, bytes );
+}
+
+void * yojimbo_file_map( const char * path, uint64_t offset, size_t bytes, bool writable )
+{
+    yojimbo_assert( path );
+    yojimbo_assert( bytes > 0 );
+
+    const int file = open( path, writable ? ( O_RDWR | O_CREAT ) : O_RDONLY, 0644 );
+    if ( file < 0 )
+        return NULL;
+
+    // reading past the end of the file through a mapping faults, so read-only ranges must be inside the file
+
+    struct stat fileStat;
+    bool valid = fstat( file, &fileStat ) == 0;
+    if ( valid && uint64_t( fileStat.st_size ) < offset + bytes )
+        valid = writable && ftruncate( file, off_t( offset + bytes ) ) == 0;
+
+    void * memory = MAP_FAILED;
+    const uint64_t pageOffset = offset % uint64_t( sysconf( _SC_PAGESIZE ) );
+    if ( valid )
+        memory = mmap( NULL, bytes + pageOffset, writable ? ( PROT_READ | PROT_WRITE ) : PROT_READ, MAP_SHARED, file, off_t( offset - pageOffset ) );
+
+    // the mapping keeps its own reference to the file
+    close( file );
+
+    return ( memory != MAP_FAILED ) ? (uint8_t*) memory + pageOffset : NULL;
+}
+
+void yojimbo_file_unmap( void * data, uint64_t offset, size_t bytes )
+{
+    if ( !data )
+        return;
+    const uint64_t pageOffset = offset % uint64_t( sysconf( _SC_PAGESIZE ) );
+    munmap( (uint8_t*) data - pageOffset, bytes + pageOffset );
+}
+
+// inside a container the cgroup namespace makes the container's own cgroup the root, so the limits are read from the top of the hierarchy
+
+static bool yojimbo_read_cgroup_file( const char * path, char * buffer, int bufferBytes )
+{
+    FILE * file = fopen( path, "r" );
+    if ( !file )
+        return false;
+    const bool result = fgets( buffer, bufferBytes, file ) != NULL;
+    fclose( file );
+    return result;
+}
+
+static double yojimbo_cgroup_cpu_quota()
+{
+    char buffer[256];
+
+    // cgroup v2: "<quota> <period>", or "max <period>" for no limit
+
+    if ( yojimbo_read_cgroup_file( "/sys/fs/cgroup/cpu.max", buffer, sizeof( buffer ) ) )
+    {
+        long long quota = 0;
+        long long period = 0;
+        if ( sscanf( buffer, "%lld %lld", &quota, &period ) == 2 && quota > 0 && period > 0 )
+            return double( quota ) / double( period );
+        return 0.0;
+    }
+
+    // cgroup v1: a quota of -1 means no limit
+
+    long long quota = 0;
+    long long period = 0;
+    if ( yojimbo_read_cgroup_file( "/sys/fs/cgroup/cpu/cpu.cfs_quota_us", buffer, sizeof( buffer ) ) )
+        quota = atoll( buffer );
+    if ( yojimbo_read_cgroup_file( "/sys/fs/cgroup/cpu/cpu.cfs_period_us", buffer, sizeof( buffer ) ) )
+        period = atoll( buffer );
+    if ( quota > 0 && period > 0 )
+        return double( quota ) / double( period );
+
+    return 0.0;
+}
+
+int yojimbo_cpu_count()
+{
+    long numCpus = sysconf( _SC_NPROCESSORS_ONLN );
+
+#ifdef CPU_COUNT
+    cpu_set_t affinity;
+    if ( sched_getaffinity( 0, sizeof( affinity ), &affinity ) == 0 )
+        numCpus = CPU_COUNT( &affinity );
+#endif // #ifdef CPU_COUNT
+
+    const double quota = yojimbo_cgroup_cpu_quota();
+    if ( quota > 0.0 )
+    {
+        const long quotaCpus = long( ceil( quota ) );
+        if ( quotaCpus < numCpus )
+            numCpus = quotaCpus;
+    }
+
+    return numCpus > 0 ? int( numCpus ) : 1;
+}
+
+uint64_t yojimbo_memory_limit()
+{
+    const long numPages = sysconf( _SC_PHYS_PAGES );
+    const long pageSize = sysconf( _SC_PAGESIZE );
+    uint64_t limit = ( numPages > 0 && pageSize > 0 ) ? uint64_t( numPages ) * uint64_t( pageSize ) : 0;
+
+    // cgroup v2 writes "max" for no limit. cgroup v1 writes a huge number instead, which the physical memory check takes care of
+
+    char buffer[256];
+    if ( yojimbo_read_cgroup_file( "/sys/fs/cgroup/memory.max", buffer, sizeof( buffer ) ) ||
+         yojimbo_read_cgroup_file( "/sys/fs/cgroup/memory/memory.limit_in_bytes", buffer, sizeof( buffer ) ) )
+    {
+        unsigned long long cgroupLimit = 0;
+        if ( sscanf( buffer, "%llu", &cgroupLimit ) == 1 && cgroupLimit > 0 && ( limit == 0 || cgroupLimit < limit ) )
+            limit = uint64_t( cgroupLimit );
+    }
+
+    return limit;
 }
 
 #elif defined(_WIN32)
@@ -149,6 +878,7 @@ double yojimbo_time()
 
 #define NOMINMAX
 #include <windows.h>
+#include <string.h>
 
 void yojimbo_sleep( double time )
 {
@@ -160,7 +890,7 @@ static bool timer_initialized = false;
 static LARGE_INTEGER timer_frequency;
 static LARGE_INTEGER timer_start;
 
-double yojimbo_time()
+static double platform_time()
 {
     if ( !timer_initialized )
     {
@@ -175,8 +905,410 @@ double yojimbo_time()
     return double( now.QuadPart - timer_start.QuadPart ) / double( timer_frequency.QuadPart );
 }
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif // #ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+
+void yojimbo_sleep_until( double time )
+{
+    // high resolution waitable timers need Windows 10 1803. older timers tick at the system timer resolution, so spin for longer
+
+    HANDLE timer = CreateWaitableTimerExW( NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS );
+
+    double spinTime = 0.0005;
+
+    if ( !timer )
+    {
+        timer = CreateWaitableTimerW( NULL, TRUE, NULL );
+        spinTime = 0.002;
+    }
+
+    const double sleepTime = time - spinTime - yojimbo_time();
+
+    if ( timer && sleepTime > 0.0 )
+    {
+        // negative due times are relative, in 100 nanosecond units. QueryPerformanceCounter has no absolute timer to wait on
+
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -(LONGLONG) ( sleepTime * 10000000.0 );
+        if ( SetWaitableTimer( timer, &dueTime, 0, NULL, NULL, FALSE ) )
+        {
+            WaitForSingleObject( timer, INFINITE );
+        }
+    }
+
+    if ( timer )
+    {
+        CloseHandle( timer );
+    }
+
+    while ( yojimbo_time() < time )
+    {
+        // spin
+    }
+}
+
+int yojimbo_atomic_compare_exchange( volatile int * destination, int exchange, int comparand )
+{
+    return (int) InterlockedCompareExchange( (volatile LONG*) destination, (LONG) exchange, (LONG) comparand );
+}
+
+void * yojimbo_atomic_compare_exchange_pointer( void * volatile * destination, void * exchange, void * comparand )
+{
+    return InterlockedCompareExchangePointer( destination, exchange, comparand );
+}
+
+int yojimbo_atomic_increment( volatile int * value )
+{
+    return (int) InterlockedIncrement( (volatile LONG*) value );
+}
+
+int yojimbo_atomic_decrement( volatile int * value )
+{
+    return (int) InterlockedDecrement( (volatile LONG*) value );
+}
+
+void yojimbo_memory_barrier()
+{
+    MemoryBarrier();
+}
+
+struct yojimbo_thread_t
+{
+    HANDLE handle;
+    void (*function)( void * context );
+    void * context;
+};
+
+static DWORD WINAPI yojimbo_thread_start( LPVOID data )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) data;
+    thread->function( thread->context );
+    return 0;
+}
+
+yojimbo_thread_t * yojimbo_thread_create( void (*function)( void * context ), void * context )
+{
+    yojimbo_thread_t * thread = (yojimbo_thread_t*) malloc( sizeof( yojimbo_thread_t ) );
+    if ( !thread )
+        return NULL;
+    thread->function = function;
+    thread->context = context;
+    thread->handle = CreateThread( NULL, 0, yojimbo_thread_start, thread, 0, NULL );
+    if ( !thread->handle )
+    {
+        free( thread );
+        return NULL;
+    }
+    return thread;
+}
+
+void yojimbo_thread_join( yojimbo_thread_t * thread )
+{
+    yojimbo_assert( thread );
+    WaitForSingleObject( thread->handle, INFINITE );
+    CloseHandle( thread->handle );
+    free( thread );
+}
+
+struct yojimbo_semaphore_t
+{
+    HANDLE handle;
+};
+
+yojimbo_semaphore_t * yojimbo_semaphore_create()
+{
+    yojimbo_semaphore_t * semaphore = (yojimbo_semaphore_t*) malloc( sizeof( yojimbo_semaphore_t ) );
+    if ( !semaphore )
+        return NULL;
+    semaphore->handle = CreateSemaphore( NULL, 0, 0x7FFFFFFF, NULL );
+    if ( !semaphore->handle )
+    {
+        free( semaphore );
+        return NULL;
+    }
+    return semaphore;
+}
+
+void yojimbo_semaphore_destroy( yojimbo_semaphore_t * semaphore )
+{
+    if ( !semaphore )
+        return;
+    CloseHandle( semaphore->handle );
+    free( semaphore );
+}
+
+void yojimbo_semaphore_signal( yojimbo_semaphore_t * semaphore, int count )
+{
+    yojimbo_assert( semaphore );
+    yojimbo_assert( count > 0 );
+    ReleaseSemaphore( semaphore->handle, count, NULL );
+}
+
+void yojimbo_semaphore_wait( yojimbo_semaphore_t * semaphore )
+{
+    yojimbo_assert( semaphore );
+    WaitForSingleObject( semaphore->handle, INFINITE );
+}
+
+void * yojimbo_page_allocate( size_t bytes, bool hugePages, int numaNode )
+{
+    void * memory = NULL;
+
+    const DWORD flags = MEM_RESERVE | MEM_COMMIT;
+
+    const SIZE_T largePageBytes = GetLargePageMinimum();
+
+    if ( hugePages && largePageBytes > 0 )
+    {
+        // large pages need the lock pages in memory privilege. without it this fails and regular pages are used
+
+        const SIZE_T largeBytes = ( bytes + largePageBytes - 1 ) & ~( largePageBytes - 1 );
+
+        if ( numaNode >= 0 )
+            memory = VirtualAllocExNuma( GetCurrentProcess(), NULL, largeBytes, flags | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD) numaNode );
+        else
+            memory = VirtualAlloc( NULL, largeBytes, flags | MEM_LARGE_PAGES, PAGE_READWRITE );
+    }
+
+    if ( !memory )
+    {
+        if ( numaNode >= 0 )
+            memory = VirtualAllocExNuma( GetCurrentProcess(), NULL, bytes, flags, PAGE_READWRITE, (DWORD) numaNode );
+        else
+            memory = VirtualAlloc( NULL, bytes, flags, PAGE_READWRITE );
+    }
+
+    return memory;
+}
+
+void yojimbo_page_free( void * memory, size_t bytes, bool hugePages )
+{
+    (void) bytes;
+    (void) hugePages;
+
+    if ( memory )
+        VirtualFree( memory, 0, MEM_RELEASE );
+}
+
+bool yojimbo_page_lock( void * memory, size_t bytes )
+{
+    yojimbo_assert( memory );
+    return VirtualLock( memory, bytes ) != 0;
+}
+
+void yojimbo_page_unlock( void * memory, size_t bytes )
+{
+    if ( memory )
+        VirtualUnlock( memory, bytes );
+}
+
+static uint64_t yojimbo_file_map_granularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return info.dwAllocationGranularity;
+}
+
+void * yojimbo_file_map( const char * path, uint64_t offset, size_t bytes, bool writable )
+{
+    yojimbo_assert( path );
+    yojimbo_assert( bytes > 0 );
+
+    HANDLE file = CreateFileA( path, writable ? ( GENERIC_READ | GENERIC_WRITE ) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( file == INVALID_HANDLE_VALUE )
+        return NULL;
+
+    // a writable mapping extends the file to its size. a read-only mapping larger than the file fails
+
+    const uint64_t end = offset + bytes;
+    HANDLE mapping = CreateFileMappingA( file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, DWORD( end >> 32 ), DWORD( end ), NULL );
+    CloseHandle( file );
+    if ( !mapping )
+        return NULL;
+
+    // views must start on the allocation granularity. the view keeps its own reference to the mapping
+
+    const uint64_t viewOffset = offset % yojimbo_file_map_granularity();
+    const uint64_t viewStart = offset - viewOffset;
+    void * view = MapViewOfFile( mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, DWORD( viewStart >> 32 ), DWORD( viewStart ), SIZE_T( bytes + viewOffset ) );
+    CloseHandle( mapping );
+
+    return view ? (uint8_t*) view + viewOffset : NULL;
+}
+
+void yojimbo_file_unmap( void * data, uint64_t offset, size_t bytes )
+{
+    (void) bytes;
+    if ( data )
+        UnmapViewOfFile( (uint8_t*) data - offset % yojimbo_file_map_granularity() );
+}
+
+int yojimbo_cpu_count()
+{
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    int numCpus = 0;
+    if ( GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask ) )
+    {
+        for ( ; processMask; processMask &= processMask - 1 )
+            numCpus++;
+    }
+    if ( numCpus == 0 )
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo( &info );
+        numCpus = int( info.dwNumberOfProcessors );
+    }
+    return numCpus > 0 ? numCpus : 1;
+}
+
+uint64_t yojimbo_memory_limit()
+{
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof( status );
+    uint64_t limit = GlobalMemoryStatusEx( &status ) ? uint64_t( status.ullTotalPhys ) : 0;
+
+    // containers on windows are job objects, with the memory limit set on the job
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION job;
+    memset( &job, 0, sizeof( job ) );
+    if ( QueryInformationJobObject( NULL, JobObjectExtendedLimitInformation, &job, sizeof( job ), NULL ) )
+    {
+        const DWORD flags = job.BasicLimitInformation.LimitFlags;
+        if ( ( flags & JOB_OBJECT_LIMIT_JOB_MEMORY ) && job.JobMemoryLimit > 0 && ( limit == 0 || job.JobMemoryLimit < limit ) )
+            limit = uint64_t( job.JobMemoryLimit );
+        if ( ( flags & JOB_OBJECT_LIMIT_PROCESS_MEMORY ) && job.ProcessMemoryLimit > 0 && ( limit == 0 || job.ProcessMemoryLimit < limit ) )
+            limit = uint64_t( job.ProcessMemoryLimit );
+    }
+
+    return limit;
+}
+
 #else
 
 #error unsupported platform!
 
 #endif
+
+void yojimbo_page_prefault( void * memory, size_t bytes )
+{
+    // 4k is the smallest page size on every supported platform, so touching at that stride hits every page whatever the real page size is
+
+    const size_t PrefaultStride = 4096;
+
+    volatile uint8_t * p = (volatile uint8_t*) memory;
+    if ( !p || bytes == 0 )
+        return;
+    for ( size_t i = 0; i < bytes; i += PrefaultStride )
+        p[i] = p[i];
+    p[bytes-1] = p[bytes-1];
+}
+
+static volatile int thread_index_counter = 0;
+
+static YOJIMBO_THREAD_LOCAL int thread_index = -1;
+
+int yojimbo_thread_index()
+{
+    if ( thread_index < 0 )
+        thread_index = yojimbo_atomic_increment( &thread_index_counter ) - 1;
+    return thread_index;
+}
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+
+#define YOJIMBO_HAS_TSC 1
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif // #if defined( _MSC_VER )
+
+static inline uint64_t read_tsc()
+{
+#if defined( _MSC_VER )
+    return __rdtsc();
+#else // #if defined( _MSC_VER )
+    return __builtin_ia32_rdtsc();
+#endif // #if defined( _MSC_VER )
+}
+
+#else // #if defined( __x86_64__ ) ...
+
+#define YOJIMBO_HAS_TSC 0
+
+#endif // #if defined( __x86_64__ ) ...
+
+#if YOJIMBO_TSC_CLOCK && YOJIMBO_HAS_TSC
+
+static bool tsc_calibrated = false;
+static uint64_t tsc_start = 0;
+static double tsc_time_start = 0.0;
+static double tsc_seconds_per_tick = 0.0;
+
+double yojimbo_time()
+{
+    if ( !tsc_calibrated )
+    {
+        // IMPORTANT: This assumes an invariant TSC, which runs at a constant rate across cores and power states. All recent x86 CPUs have one.
+
+        const double calibrationStart = platform_time();
+        const uint64_t calibrationTicks = read_tsc();
+        double calibrationEnd = platform_time();
+        while ( calibrationEnd - calibrationStart < YOJIMBO_TSC_CALIBRATION_TIME )
+        {
+            calibrationEnd = platform_time();
+        }
+        tsc_start = read_tsc();
+        tsc_time_start = calibrationEnd;
+        tsc_seconds_per_tick = ( calibrationEnd - calibrationStart ) / double( tsc_start - calibrationTicks );
+        tsc_calibrated = true;
+    }
+    return tsc_time_start + double( read_tsc() - tsc_start ) * tsc_seconds_per_tick;
+}
+
+#else // #if YOJIMBO_TSC_CLOCK && YOJIMBO_HAS_TSC
+
+double yojimbo_time()
+{
+    return platform_time();
+}
+
+#endif // #if YOJIMBO_TSC_CLOCK && YOJIMBO_HAS_TSC
+
+static YOJIMBO_THREAD_LOCAL double cached_time = 0.0;
+
+double yojimbo_time_update()
+{
+    cached_time = yojimbo_time();
+    return cached_time;
+}
+
+double yojimbo_time_cached()
+{
+    return cached_time;
+}
+
+static void (*profile_function)( void *, const char *, uint64_t, uint64_t ) = NULL;
+static void * profile_context = NULL;
+
+void yojimbo_set_profile_function( void (*function)( void * context, const char * name, uint64_t startTicks, uint64_t endTicks ), void * context )
+{
+    profile_function = function;
+    profile_context = context;
+}
+
+uint64_t yojimbo_profile_ticks()
+{
+#if YOJIMBO_HAS_TSC
+    return read_tsc();
+#else // #if YOJIMBO_HAS_TSC
+    return uint64_t( yojimbo_time() * 1000000000.0 );
+#endif // #if YOJIMBO_HAS_TSC
+}
+
+void yojimbo_profile_zone( const char * name, uint64_t startTicks, uint64_t endTicks )
+{
+    if ( profile_function )
+        profile_function( profile_context, name, startTicks, endTicks );
+}
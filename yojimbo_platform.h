@@ -99,11 +99,349 @@ void yojimbo_sleep( double time );
 
     IMPORTANT: Please store time in doubles so you retain sufficient precision as time increases.
 
+    When YOJIMBO_TSC_CLOCK is 1, this reads the x86 time stamp counter instead of the operating system clock, so it never makes a system call. The first call calibrates the counter against the operating system clock, which takes YOJIMBO_TSC_CALIBRATION_TIME. InitializeYojimbo makes that first call.
+
     @returns The current time value in seconds since the program started.
  */
 
 double yojimbo_time();
 
+/**
+    Read the time once per tick, for code that needs the time often.
+
+    Reads yojimbo_time and caches it for this thread, so yojimbo_time_cached can return it without reading the clock again.
+
+    @returns The current time value in seconds since the program started.
+ */
+
+double yojimbo_time_update();
+
+/**
+    Get the time cached by the last call to yojimbo_time_update on this thread.
+
+    @returns The cached time value in seconds since the program started. 0.0 if yojimbo_time_update hasn't been called on this thread.
+ */
+
+double yojimbo_time_cached();
+
+/**
+    Sleep until yojimbo_time reaches a point in time, precisely.
+
+    Sleeps on the same clock as yojimbo_time, with an absolute deadline, until just before the time, then spins for the rest. Use this to pace fixed-rate loops: add the tick period to the previous deadline, instead of sleeping for the time left, so ticks land on schedule without drifting.
+
+    @param time The time to wake up, in seconds. See yojimbo_time. Returns straight away if this time has passed.
+ */
+
+void yojimbo_sleep_until( double time );
+
+/// Declares a variable with one instance per thread.
+
+#if defined( _MSC_VER )
+#define YOJIMBO_THREAD_LOCAL __declspec( thread )
+#else // #if defined( _MSC_VER )
+#define YOJIMBO_THREAD_LOCAL __thread
+#endif // #if defined( _MSC_VER )
+
+/**
+    Atomically replace an integer if it holds an expected value. This is a full memory barrier.
+
+    @param destination The integer to update.
+    @param exchange The value to store if the integer holds the comparand.
+    @param comparand The value the integer is expected to hold.
+
+    @returns The value the integer held before the call. The exchange happened if this equals the comparand.
+ */
+
+int yojimbo_atomic_compare_exchange( volatile int * destination, int exchange, int comparand );
+
+/**
+    Atomically replace a pointer if it holds an expected value. This is a full memory barrier.
+
+    @param destination The pointer to update.
+    @param exchange The value to store if the pointer holds the comparand.
+    @param comparand The value the pointer is expected to hold.
+
+    @returns The value the pointer held before the call. The exchange happened if this equals the comparand.
+ */
+
+void * yojimbo_atomic_compare_exchange_pointer( void * volatile * destination, void * exchange, void * comparand );
+
+/**
+    Atomically increment an integer. This is a full memory barrier.
+
+    @param value The integer to increment.
+
+    @returns The incremented value.
+ */
+
+int yojimbo_atomic_increment( volatile int * value );
+
+/**
+    Atomically decrement an integer. This is a full memory barrier.
+
+    @param value The integer to decrement.
+
+    @returns The decremented value.
+ */
+
+int yojimbo_atomic_decrement( volatile int * value );
+
+/**
+    Hint that memory is about to be read, so the cache line holding it can be fetched while other work is done.
+
+    Used by server loops over connected clients to fetch the next client's connection while the current client is processed. Does nothing on compilers without a prefetch intrinsic.
+
+    @param pointer The memory about to be read. May be NULL.
+ */
+
+inline void yojimbo_prefetch( const void * pointer )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+    __builtin_prefetch( pointer );
+#else // #if defined( __GNUC__ ) || defined( __clang__ )
+    (void) pointer;
+#endif // #if defined( __GNUC__ ) || defined( __clang__ )
+}
+
+/**
+    Full memory barrier. Reads and writes before the barrier complete before reads and writes after it, as seen by other threads.
+ */
+
+void yojimbo_memory_barrier();
+
+/// Opaque handle to a thread created with yojimbo_thread_create.
+
+struct yojimbo_thread_t;
+
+/**
+    Create a thread and start it running a function.
+
+    @param function The function to run on the thread. The thread exits when the function returns.
+    @param context Context pointer passed to the function.
+
+    @returns The thread, or NULL if it could not be created. Pass it to yojimbo_thread_join once you are done with it.
+ */
+
+yojimbo_thread_t * yojimbo_thread_create( void (*function)( void * context ), void * context );
+
+/**
+    Wait for a thread to exit, then free the thread handle.
+
+    @param thread The thread returned by yojimbo_thread_create.
+ */
+
+void yojimbo_thread_join( yojimbo_thread_t * thread );
+
+/// Opaque handle to a semaphore created with yojimbo_semaphore_create.
+
+struct yojimbo_semaphore_t;
+
+/**
+    Create a counting semaphore. The count starts at zero.
+
+    @returns The semaphore, or NULL if it could not be created. Free it with yojimbo_semaphore_destroy.
+ */
+
+yojimbo_semaphore_t * yojimbo_semaphore_create();
+
+/**
+    Destroy a semaphore. No thread may be waiting on it.
+
+    @param semaphore The semaphore returned by yojimbo_semaphore_create.
+ */
+
+void yojimbo_semaphore_destroy( yojimbo_semaphore_t * semaphore );
+
+/**
+    Add to the semaphore count, waking up to that many waiting threads.
+
+    @param semaphore The semaphore.
+    @param count The amount to add. Must be positive.
+ */
+
+void yojimbo_semaphore_signal( yojimbo_semaphore_t * semaphore, int count );
+
+/**
+    Wait until the semaphore count is positive, then take one from it.
+
+    @param semaphore The semaphore.
+ */
+
+void yojimbo_semaphore_wait( yojimbo_semaphore_t * semaphore );
+
+/**
+    Set the function that receives profile zones. See YOJIMBO_PROFILE.
+
+    Zones are reported on the thread that ran them, as soon as they finish. Set this before starting any threads that send or receive packets.
+
+    @param function The function to call for each finished zone, with the zone name and its start and end ticks. NULL to stop reporting zones.
+    @param context Context pointer passed to the function.
+ */
+
+void yojimbo_set_profile_function( void (*function)( void * context, const char * name, uint64_t startTicks, uint64_t endTicks ), void * context );
+
+/**
+    Read the profile clock.
+
+    @returns The time stamp counter on x86, which profilers like Tracy take as is. Nanoseconds of yojimbo_time elsewhere.
+ */
+
+uint64_t yojimbo_profile_ticks();
+
+/**
+    Report a finished profile zone to the profile function. Use YOJIMBO_PROFILE_SCOPE instead of calling this directly.
+
+    @param name The zone name. Must be a string literal, or otherwise outlive the profile function's use of it.
+    @param startTicks The profile clock when the zone started.
+    @param endTicks The profile clock when the zone finished.
+ */
+
+void yojimbo_profile_zone( const char * name, uint64_t startTicks, uint64_t endTicks );
+
+#if YOJIMBO_PROFILE
+
+/// Times a scope and reports it as a profile zone when the scope exits. See YOJIMBO_PROFILE_SCOPE.
+
+struct yojimbo_profile_scope_t
+{
+    const char * name;
+    uint64_t startTicks;
+
+    explicit yojimbo_profile_scope_t( const char * zoneName ) : name( zoneName ), startTicks( yojimbo_profile_ticks() ) {}
+
+    ~yojimbo_profile_scope_t() { yojimbo_profile_zone( name, startTicks, yojimbo_profile_ticks() ); }
+};
+
+#define YOJIMBO_PROFILE_CONCAT_INTERNAL( a, b ) a##b
+#define YOJIMBO_PROFILE_CONCAT( a, b ) YOJIMBO_PROFILE_CONCAT_INTERNAL( a, b )
+#define YOJIMBO_PROFILE_SCOPE( name ) yojimbo_profile_scope_t YOJIMBO_PROFILE_CONCAT( yojimbo_profile_scope_, __LINE__ )( name )
+
+#else // #if YOJIMBO_PROFILE
+
+#define YOJIMBO_PROFILE_SCOPE( name ) do {} while(0)
+
+#endif // #if YOJIMBO_PROFILE
+
+/// The size of a huge page (bytes). See yojimbo_page_allocate.
+
+#define YOJIMBO_HUGE_PAGE_BYTES ( 2 * 1024 * 1024 )
+
+/**
+    Allocate memory directly from the operating system, in whole pages.
+
+    This is intended for large, long lived blocks such as the memory backing server allocators. The memory is zero filled.
+
+    Huge pages cut down on TLB misses when the memory is accessed all over. On Linux explicit huge pages are used if the system has them reserved, otherwise the memory is aligned to a huge page and transparent huge pages are requested with madvise. On Windows large pages are used if the process has the lock pages in memory privilege. Elsewhere the hint is ignored.
+
+    Binding to a NUMA node sets the preferred node for the memory, so pages are taken from that node when it has them free. Only supported on Linux and Windows. Pass -1 to use the default policy, which usually places memory on the node of the thread that first touches it.
+
+    @param bytes The number of bytes to allocate. Rounded up to a whole number of pages.
+    @param hugePages True to back the memory with huge pages where possible.
+    @param numaNode The NUMA node to place the memory on, or -1 for the default.
+
+    @returns The memory, page aligned. NULL if the allocation failed.
+ */
+
+void * yojimbo_page_allocate( size_t bytes, bool hugePages, int numaNode );
+
+/**
+    Free memory allocated with yojimbo_page_allocate.
+
+    @param memory The memory to free. May be NULL.
+    @param bytes The number of bytes passed to yojimbo_page_allocate.
+    @param hugePages The huge pages flag passed to yojimbo_page_allocate.
+ */
+
+void yojimbo_page_free( void * memory, size_t bytes, bool hugePages );
+
+/**
+    Fault in every page of a block of memory, so the first real use of it doesn't stall on page faults.
+
+    Each page is read and written back, so the contents are unchanged. Pages without a NUMA binding are placed on the node of the calling thread.
+
+    @param memory The memory to fault in. May be NULL.
+    @param bytes The size of the block (bytes).
+ */
+
+void yojimbo_page_prefault( void * memory, size_t bytes );
+
+/**
+    Lock a block of memory into physical memory, so its pages are never swapped out.
+
+    Locking is limited by RLIMIT_MEMLOCK on Linux and macOS, and by the process working set size on Windows.
+
+    @param memory The memory to lock.
+    @param bytes The size of the block (bytes).
+
+    @returns True if the memory was locked.
+ */
+
+bool yojimbo_page_lock( void * memory, size_t bytes );
+
+/**
+    Unlock a block of memory locked with yojimbo_page_lock. Call this before freeing memory that is not returned to the operating system, such as heap memory.
+
+    @param memory The memory to unlock. May be NULL.
+    @param bytes The size of the block (bytes).
+ */
+
+void yojimbo_page_unlock( void * memory, size_t bytes );
+
+/**
+    Map a range of a file into memory.
+
+    Pages are read from the file as they are first accessed, so only the parts of the range in use take up memory. Writes to a writable mapping go to the file.
+
+    @param path The path of the file.
+    @param offset The offset of the range in the file (bytes). Doesn't need to be page aligned.
+    @param bytes The size of the range (bytes).
+    @param writable True to map the range for writing. The file is created if it doesn't exist, and extended to cover the range if it is too short. Otherwise the range must be inside the file.
+
+    @returns A pointer to the start of the range. NULL if the file could not be opened or mapped.
+ */
+
+void * yojimbo_file_map( const char * path, uint64_t offset, size_t bytes, bool writable );
+
+/**
+    Unmap a file range mapped with yojimbo_file_map.
+
+    @param data The pointer returned by yojimbo_file_map. May be NULL.
+    @param offset The offset passed to yojimbo_file_map.
+    @param bytes The size passed to yojimbo_file_map.
+ */
+
+void yojimbo_file_unmap( void * data, uint64_t offset, size_t bytes );
+
+/**
+    Get the number of CPUs this process can run on.
+
+    Takes the CPU affinity of the process into account, and on linux the cgroup v1 or v2 CPU quota of the container it runs in, rounded up. A container limited to 2.5 CPUs on a 64 core machine gets 3, not 64.
+
+    @returns The number of CPUs. At least 1.
+ */
+
+int yojimbo_cpu_count();
+
+/**
+    Get the amount of memory this process can use.
+
+    This is the physical memory of the machine, or less if the process is limited: by the cgroup v1 or v2 memory limit of its container on linux, or by its job object on windows. Allocating past it gets the process killed, or fails.
+
+    @returns The memory limit (bytes), or 0 if it could not be determined.
+ */
+
+uint64_t yojimbo_memory_limit();
+
+/**
+    Get a small integer identifying the calling thread.
+
+    Threads are numbered 0, 1, 2... in the order they first call this function. Numbers are never reused, even after the thread exits.
+
+    @returns The index of the calling thread.
+ */
+
+int yojimbo_thread_index();
+
 // todo: document this
 
 #define YOJIMBO_LOG_LEVEL_NONE      0
@@ -113,7 +451,49 @@ double yojimbo_time();
 
 void yojimbo_log_level( int level );
 
-void yojimbo_printf( int level, const char * format, ... );
+/**
+    Print a log message, if its level is enabled. Use the yojimbo_printf macro instead, so levels above YOJIMBO_LOG_LEVEL_MAX are compiled out.
+
+    @param level The log level of the message. See YOJIMBO_LOG_LEVEL_*.
+    @param format The printf style format string.
+ */
+
+void yojimbo_log_printf( int level, const char * format, ... );
+
+#define yojimbo_printf( level, ... )                                                        \
+do                                                                                          \
+{                                                                                           \
+    if ( (level) <= YOJIMBO_LOG_LEVEL_MAX )                                                 \
+        yojimbo_log_printf( (level), __VA_ARGS__ );                                         \
+} while(0)
+
+/**
+    Start logging asynchronously.
+
+    Log messages are formatted on the thread that logs them, into a lock-free ring. A background thread takes them from the ring and passes them to the printf function, so slow log output doesn't stall the thread that logs. Messages logged while the ring is full are dropped.
+
+    @param numEntries The number of entries in the ring. Rounded up to a power of two. Each entry is YOJIMBO_LOG_ENTRY_BYTES.
+
+    @returns True if asynchronous logging started, false if it is already running, or the ring or thread could not be created.
+ */
+
+bool yojimbo_log_start_async( int numEntries );
+
+/**
+    Stop logging asynchronously. Prints any messages left in the ring, then waits for the background thread to exit.
+
+    Log messages are printed synchronously again from here on.
+ */
+
+void yojimbo_log_stop_async();
+
+/**
+    Get the number of log messages dropped because the asynchronous log ring was full.
+
+    @returns The number of dropped log messages since asynchronous logging last started.
+ */
+
+int yojimbo_log_num_dropped();
 
 extern void (*yojimbo_assert_function)( const char *, const char *, const char * file, int line );
 
@@ -0,0 +1,148 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_probe.h"
+#include "yojimbo_utility.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    Prober::Prober( Allocator & allocator, const Address & address, uint64_t protocolId, int maxServers )
+    {
+        yojimbo_assert( maxServers > 0 );
+        yojimbo_assert( maxServers <= 65536 );
+        m_allocator = &allocator;
+        m_protocolId = protocolId;
+        random_bytes( (uint8_t*) &m_salt, 4 );
+        m_round = 0;
+        m_socket = YOJIMBO_NEW( allocator, Socket, address );
+        m_maxServers = maxServers;
+        m_numServers = 0;
+        m_servers = (ServerEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( ServerEntry ) * maxServers );
+        yojimbo_assert( m_servers );
+        if ( IsError() )
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create prober socket\n" );
+    }
+
+    Prober::~Prober()
+    {
+        yojimbo_assert( m_allocator );
+        YOJIMBO_FREE( *m_allocator, m_servers );
+        YOJIMBO_DELETE( *m_allocator, Socket, m_socket );
+        m_allocator = NULL;
+    }
+
+    void Prober::SetServers( const Address serverAddresses[], int numServers )
+    {
+        yojimbo_assert( numServers >= 0 );
+        yojimbo_assert( numServers <= m_maxServers );
+        for ( int i = 0; i < numServers; ++i )
+        {
+            ServerEntry & server = m_servers[i];
+            server.address = serverAddresses[i];
+            server.probeSendTime = 0.0;
+            server.rtt = -1.0;
+            server.numConnectedClients = 0;
+            server.maxClients = 0;
+        }
+        m_numServers = numServers;
+        m_round++;
+    }
+
+    void Prober::SendProbes( double time )
+    {
+        if ( IsError() )
+            return;
+
+        m_round++;
+
+        uint8_t probe[TrustedProbeBytes];
+        probe[0] = TRUSTED_PACKET_PROBE;
+        const uint64_t protocolId = host_to_network( m_protocolId );
+        memcpy( probe + 1, &protocolId, 8 );
+
+        for ( int i = 0; i < m_numServers; ++i )
+        {
+            const uint64_t token = host_to_network( ( uint64_t( m_salt ) << 32 ) | ( uint64_t( m_round ) << 16 ) | uint64_t( i ) );
+            memcpy( probe + 1 + 8, &token, 8 );
+            m_socket->SendPacket( m_servers[i].address, probe, TrustedProbeBytes );
+            m_servers[i].probeSendTime = time;
+        }
+    }
+
+    void Prober::ReceiveReplies( double time )
+    {
+        if ( IsError() )
+            return;
+
+        while ( true )
+        {
+            Address from;
+            uint8_t reply[TrustedProbeReplyBytes];
+            const int packetBytes = m_socket->ReceivePacket( from, reply, TrustedProbeReplyBytes );
+            if ( packetBytes <= 0 )
+                break;
+
+            if ( packetBytes != TrustedProbeReplyBytes || reply[0] != TRUSTED_PACKET_PROBE_REPLY )
+                continue;
+
+            uint64_t token;
+            memcpy( &token, reply + 1, 8 );
+            token = network_to_host( token );
+
+            const int serverIndex = int( token & 0xFFFF );
+            if ( uint32_t( token >> 32 ) != m_salt || uint16_t( token >> 16 ) != m_round || serverIndex >= m_numServers )
+                continue;
+
+            ServerEntry & server = m_servers[serverIndex];
+            if ( from != server.address )
+                continue;
+
+            uint32_t numConnectedClients;
+            uint32_t maxClients;
+            memcpy( &numConnectedClients, reply + 1 + 8, 4 );
+            memcpy( &maxClients, reply + 1 + 8 + 4, 4 );
+            server.numConnectedClients = (int) network_to_host( numConnectedClients );
+            server.maxClients = (int) network_to_host( maxClients );
+
+            const double rtt = time - server.probeSendTime;
+            if ( server.rtt < 0.0 || rtt < server.rtt )
+                server.rtt = rtt;
+        }
+    }
+
+    double Prober::GetRTT( int serverIndex ) const
+    {
+        yojimbo_assert( serverIndex >= 0 );
+        yojimbo_assert( serverIndex < m_numServers );
+        return m_servers[serverIndex].rtt;
+    }
+
+    bool Prober::GetServerLoad( int serverIndex, int & numConnectedClients, int & maxClients ) const
+    {
+        yojimbo_assert( serverIndex >= 0 );
+        yojimbo_assert( serverIndex < m_numServers );
+        const ServerEntry & server = m_servers[serverIndex];
+        numConnectedClients = server.numConnectedClients;
+        maxClients = server.maxClients;
+        return server.rtt >= 0.0;
+    }
+
+    int Prober::GetBestServer() const
+    {
+        int best = -1;
+        for ( int i = 0; i < m_numServers; ++i )
+        {
+            const ServerEntry & server = m_servers[i];
+            if ( server.rtt < 0.0 || server.numConnectedClients >= server.maxClients )
+                continue;
+            if ( best < 0 || server.rtt < m_servers[best].rtt )
+                best = i;
+        }
+        return best;
+    }
+}
@@ -0,0 +1,147 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_PROBE_H
+#define YOJIMBO_PROBE_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_address.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_socket.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Measures the RTT to a set of servers before connecting to any of them, eg. to pick a region before asking the matcher for a match.
+
+        Probes go out to every server at once from one socket, and servers in the trusted network mode answer them outside the connect path. See BaseClientServerConfig::serverProbeBudget. Each probe carries a token with a random salt, the round and the server index, so replies are matched to probes without searching, and replies to earlier rounds or from other probers are ignored.
+
+        Probes are unauthenticated and may be lost, so send a few rounds and use the lowest RTT.
+     */
+
+    class Prober
+    {
+    public:
+
+        /**
+            The prober constructor.
+
+            @param allocator The allocator for the socket and the per-server results.
+            @param address The address to bind the socket to. Use port 0 to bind to a port picked by the operating system.
+            @param protocolId The protocol id of the servers. Servers with a different protocol id don't answer.
+            @param maxServers The most servers that can be probed at once, in [1,65536].
+         */
+
+        Prober( Allocator & allocator, const Address & address, uint64_t protocolId, int maxServers );
+
+        /**
+            The prober destructor.
+         */
+
+        ~Prober();
+
+        /**
+            Did the prober fail to bind its socket?
+
+            @returns True if the prober can't be used.
+         */
+
+        bool IsError() const { return !m_socket || m_socket->IsError(); }
+
+        /**
+            Set the servers to probe. Clears the results of any servers probed before.
+
+            @param serverAddresses The server addresses.
+            @param numServers The number of servers, in [0,maxServers].
+         */
+
+        void SetServers( const Address serverAddresses[], int numServers );
+
+        /**
+            Start a new round, sending one probe to each server. Replies to earlier rounds are ignored from now on.
+
+            @param time The current time in seconds.
+         */
+
+        void SendProbes( double time );
+
+        /**
+            Receive the replies waiting on the socket.
+
+            @param time The current time in seconds.
+         */
+
+        void ReceiveReplies( double time );
+
+        /**
+            Get the number of servers being probed.
+
+            @returns The number of servers passed in to SetServers.
+         */
+
+        int GetNumServers() const { return m_numServers; }
+
+        /**
+            Get the lowest RTT measured to a server.
+
+            @param serverIndex The server index, in [0,numServers-1].
+
+            @returns The lowest RTT (seconds), or a negative value if the server hasn't answered.
+         */
+
+        double GetRTT( int serverIndex ) const;
+
+        /**
+            Get the load a server reported in its last reply.
+
+            @param serverIndex The server index, in [0,numServers-1].
+            @param numConnectedClients The number of connected clients [out].
+            @param maxClients The number of client slots [out].
+
+            @returns True if the server has answered.
+         */
+
+        bool GetServerLoad( int serverIndex, int & numConnectedClients, int & maxClients ) const;
+
+        /**
+            Get the server with the lowest RTT that has a free client slot.
+
+            @returns The server index, or -1 if no server with a free slot has answered.
+         */
+
+        int GetBestServer() const;
+
+    private:
+
+        Prober( const Prober & other );
+
+        const Prober & operator = ( const Prober & other );
+
+        /// What the prober knows about one server.
+
+        struct ServerEntry
+        {
+            Address address;                                                ///< The address of the server.
+            double probeSendTime;                                           ///< The time the probe of the current round was sent.
+            double rtt;                                                     ///< The lowest RTT measured (seconds). Negative until the server answers.
+            int numConnectedClients;                                        ///< The number of connected clients in the last reply.
+            int maxClients;                                                 ///< The number of client slots in the last reply.
+        };
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        uint64_t m_protocolId;                                              ///< The protocol id sent in each probe.
+        uint32_t m_salt;                                                    ///< Random salt in the top of each token, so replies to other probers are ignored.
+        uint16_t m_round;                                                   ///< The current round. Replies to other rounds are ignored.
+        Socket * m_socket;                                                  ///< The socket probes are sent from.
+        int m_maxServers;                                                   ///< The number of server entries.
+        int m_numServers;                                                   ///< The number of servers being probed.
+        ServerEntry * m_servers;                                            ///< The server entries.
+    };
+}
+
+#endif // #ifndef YOJIMBO_PROBE_H
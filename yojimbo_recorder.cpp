@@ -0,0 +1,233 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_recorder.h"
+#include "yojimbo_platform.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static inline uint32_t packet_record_bytes( int packetBytes )
+    {
+        return ( uint32_t( sizeof( PacketRecordHeader ) ) + uint32_t( packetBytes ) + 7 ) & ~uint32_t( 7 );
+    }
+
+    PacketRecorder::PacketRecorder( const char * path, int segmentBytes, int numSegments )
+    {
+        yojimbo_assert( path );
+        yojimbo_assert( segmentBytes > int( sizeof( PacketSegmentHeader ) + sizeof( PacketRecordHeader ) ) );
+        yojimbo_assert( ( segmentBytes % 8 ) == 0 );
+        yojimbo_assert( numSegments > 0 );
+
+        m_segmentBytes = segmentBytes;
+        m_numSegments = numSegments;
+        m_segmentIndex = 0;
+        m_segmentSequence = 1;
+        m_numPacketsRecorded = 0;
+        m_lock = 0;
+        m_bytes = sizeof( PacketRecordingHeader ) + size_t( segmentBytes ) * size_t( numSegments );
+        m_data = (uint8_t*) yojimbo_file_map( path, 0, m_bytes, true );
+
+        if ( !m_data )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to map packet recording file %s\n", path );
+            return;
+        }
+
+        // only the segment headers are cleared. the rest of the file is written as packets are recorded
+
+        PacketRecordingHeader * header = (PacketRecordingHeader*) m_data;
+        header->magic = PacketRecordingMagic;
+        header->version = PacketRecordingVersion;
+        header->segmentBytes = uint32_t( segmentBytes );
+        header->numSegments = uint32_t( numSegments );
+
+        for ( int i = 0; i < numSegments; ++i )
+        {
+            PacketSegmentHeader * segment = (PacketSegmentHeader*) ( m_data + sizeof( PacketRecordingHeader ) + size_t( i ) * size_t( segmentBytes ) );
+            segment->sequence = 0;
+            segment->usedBytes = 0;
+            segment->numRecords = 0;
+        }
+
+        PacketSegmentHeader * first = (PacketSegmentHeader*) ( m_data + sizeof( PacketRecordingHeader ) );
+        first->sequence = m_segmentSequence;
+    }
+
+    PacketRecorder::~PacketRecorder()
+    {
+        yojimbo_file_unmap( m_data, 0, m_bytes );
+        m_data = NULL;
+    }
+
+    void PacketRecorder::RecordPacket( double time, int direction, int clientIndex, uint16_t packetSequence, const uint8_t * packetData, int packetBytes )
+    {
+        yojimbo_assert( packetData );
+        yojimbo_assert( packetBytes >= 0 );
+
+        if ( !m_data )
+            return;
+
+        const uint32_t recordBytes = packet_record_bytes( packetBytes );
+        const uint32_t capacity = uint32_t( m_segmentBytes ) - uint32_t( sizeof( PacketSegmentHeader ) );
+        if ( recordBytes > capacity )
+            return;
+
+        while ( yojimbo_atomic_compare_exchange( &m_lock, 1, 0 ) != 0 )
+        {
+            // spin
+        }
+
+        uint8_t * segmentData = m_data + sizeof( PacketRecordingHeader ) + size_t( m_segmentIndex ) * size_t( m_segmentBytes );
+        PacketSegmentHeader * segment = (PacketSegmentHeader*) segmentData;
+
+        if ( segment->usedBytes + recordBytes > capacity )
+        {
+            // move on to the oldest segment. it is emptied before its sequence changes, so readers never see a mix of old and new records
+
+            m_segmentIndex = ( m_segmentIndex + 1 ) % m_numSegments;
+            m_segmentSequence++;
+            segmentData = m_data + sizeof( PacketRecordingHeader ) + size_t( m_segmentIndex ) * size_t( m_segmentBytes );
+            segment = (PacketSegmentHeader*) segmentData;
+            segment->usedBytes = 0;
+            segment->numRecords = 0;
+            yojimbo_memory_barrier();
+            segment->sequence = m_segmentSequence;
+        }
+
+        uint8_t * record = segmentData + sizeof( PacketSegmentHeader ) + segment->usedBytes;
+        PacketRecordHeader recordHeader;
+        recordHeader.time = time;
+        recordHeader.clientIndex = clientIndex;
+        recordHeader.packetBytes = uint32_t( packetBytes );
+        recordHeader.direction = uint32_t( direction );
+        recordHeader.packetSequence = packetSequence;
+        recordHeader.padding = 0;
+        memcpy( record, &recordHeader, sizeof( PacketRecordHeader ) );
+        memcpy( record + sizeof( PacketRecordHeader ), packetData, packetBytes );
+
+        // publish the record only once it is complete
+
+        yojimbo_memory_barrier();
+        segment->usedBytes += recordBytes;
+        segment->numRecords++;
+        m_numPacketsRecorded++;
+
+        const int previous = yojimbo_atomic_compare_exchange( &m_lock, 0, 1 );
+        yojimbo_assert( previous == 1 );
+        (void) previous;
+    }
+
+    PacketPlayback::PacketPlayback( const char * path )
+    {
+        yojimbo_assert( path );
+
+        m_data = NULL;
+        m_bytes = 0;
+        m_segmentBytes = 0;
+        m_numSegments = 0;
+        m_segmentIndex = -1;
+        m_segmentSequence = 0;
+        m_readOffset = 0;
+
+        // map the header first to find out how large the rest of the file is
+
+        const PacketRecordingHeader * header = (const PacketRecordingHeader*) yojimbo_file_map( path, 0, sizeof( PacketRecordingHeader ), false );
+        if ( !header )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to map packet recording file %s\n", path );
+            return;
+        }
+
+        const bool valid = header->magic == PacketRecordingMagic && header->version == PacketRecordingVersion && header->numSegments > 0 && header->segmentBytes > sizeof( PacketSegmentHeader );
+        const uint32_t segmentBytes = header->segmentBytes;
+        const uint32_t numSegments = header->numSegments;
+        yojimbo_file_unmap( (void*) header, 0, sizeof( PacketRecordingHeader ) );
+
+        if ( !valid )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: %s is not a packet recording\n", path );
+            return;
+        }
+
+        m_bytes = sizeof( PacketRecordingHeader ) + size_t( segmentBytes ) * size_t( numSegments );
+        m_data = (uint8_t*) yojimbo_file_map( path, 0, m_bytes, false );
+        if ( !m_data )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to map packet recording file %s\n", path );
+            return;
+        }
+
+        m_segmentBytes = int( segmentBytes );
+        m_numSegments = int( numSegments );
+    }
+
+    PacketPlayback::~PacketPlayback()
+    {
+        yojimbo_file_unmap( m_data, 0, m_bytes );
+        m_data = NULL;
+    }
+
+    bool PacketPlayback::NextSegment()
+    {
+        // the segment with the lowest sequence above the one just read. segments are few, so a scan is fine
+
+        int nextIndex = -1;
+        uint64_t nextSequence = 0;
+        for ( int i = 0; i < m_numSegments; ++i )
+        {
+            const PacketSegmentHeader * segment = (const PacketSegmentHeader*) ( m_data + sizeof( PacketRecordingHeader ) + size_t( i ) * size_t( m_segmentBytes ) );
+            if ( segment->sequence > m_segmentSequence && ( nextIndex < 0 || segment->sequence < nextSequence ) )
+            {
+                nextIndex = i;
+                nextSequence = segment->sequence;
+            }
+        }
+
+        if ( nextIndex < 0 )
+            return false;
+
+        m_segmentIndex = nextIndex;
+        m_segmentSequence = nextSequence;
+        m_readOffset = 0;
+        return true;
+    }
+
+    bool PacketPlayback::ReadPacket( PacketRecordHeader & header, const uint8_t * & packetData )
+    {
+        if ( !m_data )
+            return false;
+
+        const uint32_t capacity = uint32_t( m_segmentBytes ) - uint32_t( sizeof( PacketSegmentHeader ) );
+
+        while ( true )
+        {
+            if ( m_segmentIndex >= 0 )
+            {
+                const uint8_t * segmentData = m_data + sizeof( PacketRecordingHeader ) + size_t( m_segmentIndex ) * size_t( m_segmentBytes );
+                const PacketSegmentHeader * segment = (const PacketSegmentHeader*) segmentData;
+                const uint32_t usedBytes = segment->usedBytes <= capacity ? segment->usedBytes : capacity;
+
+                if ( m_readOffset + sizeof( PacketRecordHeader ) <= usedBytes )
+                {
+                    const uint8_t * record = segmentData + sizeof( PacketSegmentHeader ) + m_readOffset;
+                    memcpy( &header, record, sizeof( PacketRecordHeader ) );
+                    const uint32_t recordBytes = packet_record_bytes( int( header.packetBytes ) );
+                    if ( header.packetBytes <= capacity && m_readOffset + recordBytes <= usedBytes )
+                    {
+                        packetData = record + sizeof( PacketRecordHeader );
+                        m_readOffset += recordBytes;
+                        return true;
+                    }
+                }
+            }
+
+            if ( !NextSegment() )
+                return false;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_RECORDER_H
+#define YOJIMBO_RECORDER_H
+
+#include "yojimbo_config.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /// The direction of a recorded packet.
+
+    enum PacketDirection
+    {
+        PACKET_DIRECTION_SEND,                                              ///< The packet was sent.
+        PACKET_DIRECTION_RECEIVE                                            ///< The packet was received.
+    };
+
+    const uint32_t PacketRecordingMagic = 0x5250594a;                       ///< First four bytes of a packet recording file ("JYPR" little endian).
+    const uint32_t PacketRecordingVersion = 1;                              ///< Version of the packet recording file layout.
+
+    /// The header at the start of a packet recording file.
+
+    struct PacketRecordingHeader
+    {
+        uint32_t magic;                                                     ///< PacketRecordingMagic.
+        uint32_t version;                                                   ///< PacketRecordingVersion.
+        uint32_t segmentBytes;                                              ///< Size of each segment, including its header (bytes).
+        uint32_t numSegments;                                               ///< Number of segments following the file header.
+    };
+
+    /// The header at the start of each segment in a packet recording file.
+
+    struct PacketSegmentHeader
+    {
+        uint64_t sequence;                                                  ///< Starts at 1 and goes up each time the recorder moves to a new segment. 0 for segments never written.
+        uint32_t usedBytes;                                                 ///< Bytes of records following the header. Only updated once a record is complete.
+        uint32_t numRecords;                                                ///< Number of records in the segment.
+    };
+
+    /// The header in front of each recorded packet. Records are padded to 8 bytes.
+
+    struct PacketRecordHeader
+    {
+        double time;                                                        ///< Time the packet was sent or received (seconds).
+        int32_t clientIndex;                                                ///< The client index on the server, or the client's own index on the client.
+        uint32_t packetBytes;                                               ///< Size of the packet following the header (bytes).
+        uint32_t direction;                                                 ///< PacketDirection.
+        uint16_t packetSequence;                                            ///< The reliable.io packet sequence number.
+        uint16_t padding;                                                   ///< Zero.
+    };
+
+    /**
+        Records packets to a memory mapped file, for debugging and replaying sessions.
+
+        Packets are recorded unencrypted. Sent packets are recorded as reliable.io packets, header and all, as they are handed to netcode.io. Received packets are recorded as the connection packets reliable.io passes up, after it strips its header and reassembles fragments, so they can be fed straight back into Connection::ProcessPacket. Set the recorder with BaseServer::SetPacketRecorder or BaseClient::SetPacketRecorder.
+
+        The whole file is mapped when the recorder is created, so recording a packet is a copy into the mapping with no system calls or allocations, and the operating system writes the pages back in the background. The file is a ring of fixed size segments. Records never span segments: when a record doesn't fit in the current segment the recorder moves to the next one, overwriting the oldest, so a long session keeps its most recent packets. Each segment header is only updated after its record is copied, so a process that crashes leaves a readable recording.
+
+        Recording is thread safe, since packets are processed from several threads with BaseClientServerConfig::serverParallelReceive.
+
+        @see PacketPlayback
+     */
+
+    class PacketRecorder
+    {
+    public:
+
+        /**
+            Create or overwrite a recording file and map it.
+
+            @param path The path of the recording file.
+            @param segmentBytes The size of each segment (bytes). Must be a multiple of 8 with room for at least one full size packet.
+            @param numSegments The number of segments. The file is segmentBytes * numSegments bytes, plus the header.
+         */
+
+        PacketRecorder( const char * path, int segmentBytes = 1024 * 1024, int numSegments = 64 );
+
+        /**
+            Unmap the recording file. The operating system writes back any pages not yet written.
+         */
+
+        ~PacketRecorder();
+
+        /**
+            Did the recording file fail to open or map?
+
+            @returns True if no packets will be recorded.
+         */
+
+        bool IsError() const { return m_data == NULL; }
+
+        /**
+            Record a packet. Packets too large for a segment are dropped.
+
+            @param time The time the packet was sent or received (seconds).
+            @param direction The direction of the packet (PacketDirection).
+            @param clientIndex The client index the packet belongs to.
+            @param packetSequence The reliable.io packet sequence number.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void RecordPacket( double time, int direction, int clientIndex, uint16_t packetSequence, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Get the number of packets recorded.
+
+            @returns The number of packets recorded since the recorder was created, including packets whose segments have since been overwritten.
+         */
+
+        uint64_t GetNumPacketsRecorded() const { return m_numPacketsRecorded; }
+
+    private:
+
+        PacketRecorder( const PacketRecorder & other );
+
+        const PacketRecorder & operator = ( const PacketRecorder & other );
+
+        uint8_t * m_data;                                                   ///< The mapped recording file. NULL if the file failed to map.
+        size_t m_bytes;                                                     ///< Size of the mapping (bytes).
+        int m_segmentBytes;                                                 ///< Size of each segment (bytes).
+        int m_numSegments;                                                  ///< Number of segments.
+        int m_segmentIndex;                                                 ///< The segment being written.
+        uint64_t m_segmentSequence;                                         ///< Sequence of the segment being written.
+        uint64_t m_numPacketsRecorded;                                      ///< Number of packets recorded.
+        volatile int m_lock;                                                ///< Spin lock around recording, so threads can record at the same time.
+    };
+
+    /**
+        Reads back a recording written by PacketRecorder, oldest packet first.
+     */
+
+    class PacketPlayback
+    {
+    public:
+
+        /**
+            Open a recording file and map it for reading.
+
+            @param path The path of the recording file.
+         */
+
+        explicit PacketPlayback( const char * path );
+
+        /**
+            Unmap the recording file.
+         */
+
+        ~PacketPlayback();
+
+        /**
+            Did the recording file fail to open, or is it not a packet recording?
+
+            @returns True if there are no packets to read.
+         */
+
+        bool IsError() const { return m_data == NULL; }
+
+        /**
+            Read the next recorded packet.
+
+            @param header The record header of the packet (out).
+            @param packetData The packet data, pointing into the mapping (out). Valid until the playback is destroyed.
+
+            @returns True if a packet was read, false once every packet has been read.
+         */
+
+        bool ReadPacket( PacketRecordHeader & header, const uint8_t * & packetData );
+
+    private:
+
+        bool NextSegment();
+
+        PacketPlayback( const PacketPlayback & other );
+
+        const PacketPlayback & operator = ( const PacketPlayback & other );
+
+        uint8_t * m_data;                                                   ///< The mapped recording file. NULL if the file failed to map.
+        size_t m_bytes;                                                     ///< Size of the mapping (bytes).
+        int m_segmentBytes;                                                 ///< Size of each segment (bytes).
+        int m_numSegments;                                                  ///< Number of segments.
+        int m_segmentIndex;                                                 ///< The segment being read. -1 before the first.
+        uint64_t m_segmentSequence;                                         ///< Sequence of the segment being read. 0 before the first.
+        uint32_t m_readOffset;                                              ///< Offset of the next record in the segment being read, from the end of its header (bytes).
+    };
+}
+
+#endif // #ifndef YOJIMBO_RECORDER_H
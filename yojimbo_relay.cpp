@@ -0,0 +1,278 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_relay.h"
+#include "yojimbo_utility.h"
+#include <string.h>
+#include <sodium.h>
+
+namespace yojimbo
+{
+    Relay::Relay( Allocator & allocator, const uint8_t privateKey[], const Address & address, const Address & upstreamAddress, const BaseClientServerConfig & config, int maxSessions, double time )
+    {
+        yojimbo_assert( privateKey );
+        yojimbo_assert( upstreamAddress.IsValid() );
+        yojimbo_assert( maxSessions > 0 );
+        m_allocator = &allocator;
+        memcpy( m_privateKey, privateKey, KeyBytes );
+        m_upstreamAddress = upstreamAddress;
+        m_protocolId = config.protocolId;
+        m_timeout = config.trustedTimeout;
+        m_time = time;
+        m_socket = YOJIMBO_NEW( allocator, Socket, address, config.serverUdpSendBufferSize, config.serverUdpReceiveBufferSize, config.serverSocketRegisteredIO, config.serverSocketReusePort );
+        m_maxSessions = maxSessions;
+        m_numSessions = 0;
+        m_sessions = (Session*) YOJIMBO_ALLOCATE( allocator, sizeof( Session ) * maxSessions );
+        yojimbo_assert( m_sessions );
+        for ( int i = 0; i < maxSessions; ++i )
+        {
+            m_sessions[i].upstreamSocket = NULL;
+            m_sessions[i].clientAddress = Address();
+            m_sessions[i].lastClientReceiveTime = 0.0;
+            m_sessions[i].lastUpstreamReceiveTime = 0.0;
+        }
+        m_sessionIndexSize = 1;
+        while ( m_sessionIndexSize < maxSessions * 2 )
+            m_sessionIndexSize *= 2;
+        m_sessionIndex = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * m_sessionIndexSize );
+        yojimbo_assert( m_sessionIndex );
+        memset( m_sessionIndex, 0xFF, sizeof( int ) * m_sessionIndexSize );
+        if ( IsError() )
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create relay socket\n" );
+    }
+
+    Relay::~Relay()
+    {
+        yojimbo_assert( m_allocator );
+        for ( int i = 0; i < m_maxSessions; ++i )
+        {
+            if ( m_sessions[i].upstreamSocket )
+                CloseSession( i, true );
+        }
+        YOJIMBO_FREE( *m_allocator, m_sessionIndex );
+        YOJIMBO_FREE( *m_allocator, m_sessions );
+        YOJIMBO_DELETE( *m_allocator, Socket, m_socket );
+        m_allocator = NULL;
+    }
+
+    void Relay::Update( double time )
+    {
+        m_time = time;
+
+        if ( IsError() )
+            return;
+
+        ReceiveClientPackets();
+
+        ReceiveUpstreamPackets();
+
+        for ( int i = 0; i < m_maxSessions; ++i )
+        {
+            Session & session = m_sessions[i];
+            if ( !session.upstreamSocket )
+                continue;
+            if ( session.lastClientReceiveTime + m_timeout < time || session.lastUpstreamReceiveTime + m_timeout < time )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "relay session %d timed out\n", i );
+                CloseSession( i, true );
+            }
+        }
+    }
+
+    void Relay::ReceiveClientPackets()
+    {
+        while ( true )
+        {
+            Address from;
+            const int packetBytes = m_socket->ReceivePacket( from, m_packetBuffer, TrustedMaxPacketBytes );
+            if ( packetBytes <= 0 )
+                break;
+
+            const int sessionIndex = FindSession( from );
+
+            if ( sessionIndex < 0 )
+            {
+                if ( m_packetBuffer[0] == TRUSTED_PACKET_CONNECT_REQUEST )
+                    ProcessConnectRequest( from, m_packetBuffer, packetBytes );
+                continue;
+            }
+
+            // everything from a client with a session, including connect requests it resends, goes upstream as is
+
+            Session & session = m_sessions[sessionIndex];
+            session.lastClientReceiveTime = m_time;
+            session.upstreamSocket->SendPacket( m_upstreamAddress, m_packetBuffer, packetBytes );
+
+            if ( m_packetBuffer[0] == TRUSTED_PACKET_DISCONNECT )
+                CloseSession( sessionIndex, false );
+        }
+    }
+
+    void Relay::ReceiveUpstreamPackets()
+    {
+        for ( int i = 0; i < m_maxSessions; ++i )
+        {
+            Session & session = m_sessions[i];
+            while ( session.upstreamSocket )
+            {
+                Address from;
+                const int packetBytes = session.upstreamSocket->ReceivePacket( from, m_packetBuffer, TrustedMaxPacketBytes );
+                if ( packetBytes <= 0 )
+                    break;
+
+                if ( from != m_upstreamAddress )
+                    continue;
+
+                session.lastUpstreamReceiveTime = m_time;
+                m_socket->SendPacket( session.clientAddress, m_packetBuffer, packetBytes );
+
+                const uint8_t packetType = m_packetBuffer[0];
+                if ( packetType == TRUSTED_PACKET_DISCONNECT || packetType == TRUSTED_PACKET_CONNECT_DENIED )
+                    CloseSession( i, false );
+            }
+        }
+    }
+
+    void Relay::ProcessConnectRequest( const Address & from, const uint8_t * packetData, int packetBytes )
+    {
+        if ( packetBytes != TrustedConnectRequestBytes )
+            return;
+
+        uint64_t protocolId;
+        uint64_t clientId;
+        memcpy( &protocolId, packetData + 1, 8 );
+        memcpy( &clientId, packetData + 1 + 8, 8 );
+        protocolId = network_to_host( protocolId );
+        clientId = network_to_host( clientId );
+
+        if ( protocolId != m_protocolId )
+            return;
+
+        // check the auth before opening a socket, so unauthenticated requests cost the relay nothing but the hash
+
+        uint8_t auth[TrustedAuthBytes];
+        trusted_connect_auth( m_privateKey, protocolId, clientId, auth );
+        if ( crypto_verify_32( auth, packetData + 1 + 8 + 8 ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "relay connect request failed auth\n" );
+            return;
+        }
+
+        int sessionIndex = -1;
+        for ( int i = 0; i < m_maxSessions; ++i )
+        {
+            if ( !m_sessions[i].upstreamSocket )
+            {
+                sessionIndex = i;
+                break;
+            }
+        }
+
+        if ( sessionIndex < 0 )
+        {
+            const uint8_t denied = TRUSTED_PACKET_CONNECT_DENIED;
+            m_socket->SendPacket( from, &denied, 1 );
+            return;
+        }
+
+        // each session binds its own port, so the upstream server tells the clients apart by address
+
+        const Address bindAddress = m_upstreamAddress.GetType() == ADDRESS_IPV6 ? Address( 0, 0, 0, 0, 0, 0, 0, 0, 0 ) : Address( 0, 0, 0, 0, 0 );
+
+        Socket * upstreamSocket = YOJIMBO_NEW( *m_allocator, Socket, bindAddress );
+        if ( !upstreamSocket || upstreamSocket->IsError() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create relay upstream socket\n" );
+            YOJIMBO_DELETE( *m_allocator, Socket, upstreamSocket );
+            return;
+        }
+
+        Session & session = m_sessions[sessionIndex];
+        session.upstreamSocket = upstreamSocket;
+        session.clientAddress = from;
+        session.lastClientReceiveTime = m_time;
+        session.lastUpstreamReceiveTime = m_time;
+
+        const int slot = FindSessionSlot( from );
+        yojimbo_assert( m_sessionIndex[slot] < 0 );
+        m_sessionIndex[slot] = sessionIndex;
+        m_numSessions++;
+
+        char addressString[MaxAddressLength];
+        from.ToString( addressString, MaxAddressLength );
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "relay session %d opened for %s\n", sessionIndex, addressString );
+
+        upstreamSocket->SendPacket( m_upstreamAddress, packetData, packetBytes );
+    }
+
+    void Relay::CloseSession( int sessionIndex, bool sendDisconnectPackets )
+    {
+        yojimbo_assert( sessionIndex >= 0 );
+        yojimbo_assert( sessionIndex < m_maxSessions );
+        Session & session = m_sessions[sessionIndex];
+        yojimbo_assert( session.upstreamSocket );
+        if ( sendDisconnectPackets )
+        {
+            const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+            for ( int i = 0; i < TrustedNumDisconnectPackets; ++i )
+            {
+                m_socket->SendPacket( session.clientAddress, &disconnect, 1 );
+                session.upstreamSocket->SendPacket( m_upstreamAddress, &disconnect, 1 );
+            }
+        }
+        RemoveSessionAddress( sessionIndex );
+        YOJIMBO_DELETE( *m_allocator, Socket, session.upstreamSocket );
+        session.clientAddress = Address();
+        m_numSessions--;
+        yojimbo_assert( m_numSessions >= 0 );
+    }
+
+    int Relay::FindSession( const Address & address ) const
+    {
+        return m_sessionIndex[FindSessionSlot( address )];
+    }
+
+    int Relay::FindSessionSlot( const Address & address ) const
+    {
+        // linear probing. returns the slot holding the address, or the empty slot it would go in
+
+        const int mask = m_sessionIndexSize - 1;
+        int slot = (int) ( address.GetHash() & uint64_t( mask ) );
+        while ( m_sessionIndex[slot] >= 0 && m_sessions[m_sessionIndex[slot]].clientAddress != address )
+        {
+            slot = ( slot + 1 ) & mask;
+        }
+        return slot;
+    }
+
+    void Relay::RemoveSessionAddress( int sessionIndex )
+    {
+        int slot = FindSessionSlot( m_sessions[sessionIndex].clientAddress );
+        yojimbo_assert( m_sessionIndex[slot] == sessionIndex );
+        m_sessionIndex[slot] = -1;
+
+        // shift later entries of the probe run back into the hole, so lookups never stop short of them
+
+        const int mask = m_sessionIndexSize - 1;
+        int next = slot;
+        while ( true )
+        {
+            next = ( next + 1 ) & mask;
+            const int entry = m_sessionIndex[next];
+            if ( entry < 0 )
+                break;
+            const int home = (int) ( m_sessions[entry].clientAddress.GetHash() & uint64_t( mask ) );
+            const bool movable = ( next > slot ) ? ( home <= slot || home > next ) : ( home <= slot && home > next );
+            if ( movable )
+            {
+                m_sessionIndex[slot] = entry;
+                m_sessionIndex[next] = -1;
+                slot = next;
+            }
+        }
+    }
+}
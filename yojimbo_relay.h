@@ -0,0 +1,133 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_RELAY_H
+#define YOJIMBO_RELAY_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_address.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_socket.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Forwards trusted network mode traffic between clients and one upstream server, without looking inside it.
+
+        Clients connect to the relay with Client::ConnectTrusted as if it were the server. The relay checks the auth in the connect request with the private key, then opens a session: a socket of its own towards the upstream server, so the upstream server sees each session as a different client address. From then on packets are forwarded as they arrive, in both directions, straight from the receive buffer. Nothing is decrypted, parsed or re-serialized, and a session has no connection, channels or message factory.
+
+        The upstream server checks the connect request again, so the relay can't be used to connect clients the server wouldn't accept.
+
+        Sessions close when either side sends a disconnect, the upstream server denies the connect, or nothing is received from one side for BaseClientServerConfig::trustedTimeout.
+
+        @see BaseClientServerConfig::trustedNetwork
+     */
+
+    class Relay
+    {
+    public:
+
+        /**
+            The relay constructor.
+
+            @param allocator The allocator for the sessions and their sockets.
+            @param privateKey The private key shared with the clients and the upstream server (KeyBytes).
+            @param address The address clients connect to. Use port 0 to bind to a port picked by the operating system.
+            @param upstreamAddress The address of the upstream server, running in the trusted network mode.
+            @param config The client/server configuration. The protocol id, trusted timeout and server socket settings are used.
+            @param maxSessions The maximum number of clients forwarded at the same time.
+            @param time The current time in seconds.
+         */
+
+        Relay( Allocator & allocator, const uint8_t privateKey[], const Address & address, const Address & upstreamAddress, const BaseClientServerConfig & config, int maxSessions, double time );
+
+        /**
+            The relay destructor. Closes all sessions, sending disconnects to both sides.
+         */
+
+        ~Relay();
+
+        /**
+            Did the relay fail to bind its socket?
+
+            @returns True if the relay can't be used.
+         */
+
+        bool IsError() const { return !m_socket || m_socket->IsError(); }
+
+        /**
+            Get the address clients connect to.
+
+            @returns The bound address. If port 0 was passed in, this has the port picked by the operating system.
+         */
+
+        const Address & GetAddress() const { return m_socket->GetAddress(); }
+
+        /**
+            Forward the packets waiting in both directions, then time out idle sessions.
+
+            @param time The current time in seconds.
+         */
+
+        void Update( double time );
+
+        /**
+            Get the number of open sessions.
+
+            @returns The number of clients currently being forwarded.
+         */
+
+        int GetNumSessions() const { return m_numSessions; }
+
+    private:
+
+        void ReceiveClientPackets();
+
+        void ReceiveUpstreamPackets();
+
+        void ProcessConnectRequest( const Address & from, const uint8_t * packetData, int packetBytes );
+
+        void CloseSession( int sessionIndex, bool sendDisconnectPackets );
+
+        int FindSession( const Address & address ) const;
+
+        int FindSessionSlot( const Address & address ) const;
+
+        void RemoveSessionAddress( int sessionIndex );
+
+        Relay( const Relay & other );
+
+        const Relay & operator = ( const Relay & other );
+
+        /// A client being forwarded to the upstream server.
+
+        struct Session
+        {
+            Socket * upstreamSocket;                                        ///< The socket towards the upstream server. NULL if the session is not open.
+            Address clientAddress;                                          ///< The address of the client.
+            double lastClientReceiveTime;                                   ///< Time a packet was last received from the client.
+            double lastUpstreamReceiveTime;                                 ///< Time a packet was last received from the upstream server.
+        };
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        uint8_t m_privateKey[KeyBytes];                                     ///< The private key the auth in connect requests is checked with.
+        Address m_upstreamAddress;                                          ///< The address of the upstream server.
+        uint64_t m_protocolId;                                              ///< Connect requests with other protocol ids are dropped.
+        double m_timeout;                                                   ///< Sessions close when nothing is received from one side for this long (seconds).
+        double m_time;                                                      ///< The current time, as of the last Update.
+        Socket * m_socket;                                                  ///< The socket clients connect to.
+        int m_maxSessions;                                                  ///< The number of session slots.
+        int m_numSessions;                                                  ///< The number of open sessions.
+        Session * m_sessions;                                               ///< The session slots.
+        int m_sessionIndexSize;                                             ///< The number of slots in the session address index. A power of two, at least twice maxSessions.
+        int * m_sessionIndex;                                               ///< Open addressing hash index from client address to session, for constant time lookup on receive. -1 for empty slots.
+        uint8_t m_packetBuffer[TrustedMaxPacketBytes];                      ///< Packets are received into this buffer and forwarded from it.
+    };
+}
+
+#endif // #ifndef YOJIMBO_RELAY_H
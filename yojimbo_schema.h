@@ -0,0 +1,95 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_SCHEMA_H
+#define YOJIMBO_SCHEMA_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_utility.h"
+#include "yojimbo_serialize.h"
+#include "yojimbo_message.h"
+
+/** @file */
+
+/**
+    Declare a message class from a schema.
+
+    The schema is a macro listing the fields of the message. It takes one argument, the field macro, and calls it once per field with the field kind, the field name and any arguments for that kind:
+
+        #define PLAYER_INPUT_SCHEMA( field )                            \
+            field( BITS, buttons, 12 )                                  \
+            field( BOOL, crouch )                                       \
+            field( INT, weapon, 0, 9 )                                  \
+            field( COMPRESSED_FLOAT, aim, -1.0f, 1.0f, 0.001f )
+
+        YOJIMBO_SCHEMA_MESSAGE( PlayerInputMessage, PLAYER_INPUT_SCHEMA );
+
+    This generates the message class with a member per field, a constructor that zeroes them, and a templated Serialize method that serializes each field in order. Message::GetMaxBits is generated from the field sizes, so channels never run the measure stream over these messages. Register the class with YOJIMBO_DECLARE_MESSAGE_TYPE like any other message.
+
+    Field kinds:
+
+        INT( name, min, max )                           int32_t in [min,max]. See serialize_int.
+        BITS( name, bits )                              uint32_t of bits in [1,32]. See serialize_bits.
+        BOOL( name )                                    bool. See serialize_bool.
+        FLOAT( name )                                   Full precision float. See serialize_float.
+        COMPRESSED_FLOAT( name, min, max, res )         Float quantized to res in [min,max]. See serialize_compressed_float.
+        UINT64( name )                                  uint64_t. See serialize_uint64.
+
+    Since every field kind has a fixed size, schema messages can't hold strings, arrays or other variable length data. Write those messages by hand.
+
+    @param message_class The name of the message class to generate.
+    @param schema The schema macro listing the fields.
+ */
+
+#define YOJIMBO_SCHEMA_MESSAGE( message_class, schema )                                                                         \
+    class message_class : public yojimbo::Message                                                                               \
+    {                                                                                                                           \
+    public:                                                                                                                     \
+        schema( YOJIMBO_SCHEMA_DECLARE_FIELD )                                                                                  \
+        message_class() { schema( YOJIMBO_SCHEMA_INIT_FIELD ) }                                                                 \
+        template <typename Stream> bool Serialize( Stream & stream ) { schema( YOJIMBO_SCHEMA_SERIALIZE_FIELD ) return true; }  \
+        int GetMaxBits() const { return 0 schema( YOJIMBO_SCHEMA_FIELD_BITS ); }                                                \
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS()                                                                                   \
+    }
+
+#define YOJIMBO_SCHEMA_EXPAND( x ) x
+
+#define YOJIMBO_SCHEMA_DECLARE_FIELD( kind, ... ) YOJIMBO_SCHEMA_EXPAND( YOJIMBO_SCHEMA_DECLARE_##kind( __VA_ARGS__ ) )
+#define YOJIMBO_SCHEMA_INIT_FIELD( kind, ... ) YOJIMBO_SCHEMA_EXPAND( YOJIMBO_SCHEMA_INIT_##kind( __VA_ARGS__ ) )
+#define YOJIMBO_SCHEMA_SERIALIZE_FIELD( kind, ... ) YOJIMBO_SCHEMA_EXPAND( YOJIMBO_SCHEMA_SERIALIZE_##kind( __VA_ARGS__ ) )
+#define YOJIMBO_SCHEMA_FIELD_BITS( kind, ... ) YOJIMBO_SCHEMA_EXPAND( YOJIMBO_SCHEMA_BITS_##kind( __VA_ARGS__ ) )
+
+#define YOJIMBO_SCHEMA_DECLARE_INT( name, min, max ) int32_t name;
+#define YOJIMBO_SCHEMA_INIT_INT( name, min, max ) name = ( min );
+#define YOJIMBO_SCHEMA_SERIALIZE_INT( name, min, max ) serialize_int( stream, name, min, max );
+#define YOJIMBO_SCHEMA_BITS_INT( name, min, max ) + int( yojimbo::BitsRequired<(min),(max)>::result )
+
+#define YOJIMBO_SCHEMA_DECLARE_BITS( name, bits ) uint32_t name;
+#define YOJIMBO_SCHEMA_INIT_BITS( name, bits ) name = 0;
+#define YOJIMBO_SCHEMA_SERIALIZE_BITS( name, bits ) serialize_bits( stream, name, bits );
+#define YOJIMBO_SCHEMA_BITS_BITS( name, bits ) + ( bits )
+
+#define YOJIMBO_SCHEMA_DECLARE_BOOL( name ) bool name;
+#define YOJIMBO_SCHEMA_INIT_BOOL( name ) name = false;
+#define YOJIMBO_SCHEMA_SERIALIZE_BOOL( name ) serialize_bool( stream, name );
+#define YOJIMBO_SCHEMA_BITS_BOOL( name ) + 1
+
+#define YOJIMBO_SCHEMA_DECLARE_FLOAT( name ) float name;
+#define YOJIMBO_SCHEMA_INIT_FLOAT( name ) name = 0.0f;
+#define YOJIMBO_SCHEMA_SERIALIZE_FLOAT( name ) serialize_float( stream, name );
+#define YOJIMBO_SCHEMA_BITS_FLOAT( name ) + 32
+
+#define YOJIMBO_SCHEMA_DECLARE_COMPRESSED_FLOAT( name, min, max, res ) float name;
+#define YOJIMBO_SCHEMA_INIT_COMPRESSED_FLOAT( name, min, max, res ) name = ( min );
+#define YOJIMBO_SCHEMA_SERIALIZE_COMPRESSED_FLOAT( name, min, max, res ) serialize_compressed_float( stream, name, min, max, res );
+#define YOJIMBO_SCHEMA_BITS_COMPRESSED_FLOAT( name, min, max, res ) + yojimbo::compressed_float_bits( min, max, res )
+
+#define YOJIMBO_SCHEMA_DECLARE_UINT64( name ) uint64_t name;
+#define YOJIMBO_SCHEMA_INIT_UINT64( name ) name = 0;
+#define YOJIMBO_SCHEMA_SERIALIZE_UINT64( name ) serialize_uint64( stream, name );
+#define YOJIMBO_SCHEMA_BITS_UINT64( name ) + 64
+
+#endif // #ifndef YOJIMBO_SCHEMA_H
@@ -11,6 +11,7 @@
 #include "yojimbo_bitpack.h"
 #include "yojimbo_stream.h"
 #include "yojimbo_address.h"
+#include <math.h>
 
 /** @file */
 
@@ -140,6 +141,210 @@ namespace yojimbo
                 return false;                                                       \
         } while (0)
 
+    /**
+        Calculate the number of bits serialize_compressed_float uses for a given range and resolution.
+
+        @param min The minimum value.
+        @param max The maximum value.
+        @param res The resolution. Values are quantized to steps of at most this size.
+
+        @returns The number of bits each compressed float takes in the stream.
+     */
+
+    inline int compressed_float_bits( float min, float max, float res )
+    {
+        yojimbo_assert( max > min );
+        yojimbo_assert( res > 0.0f );
+        const double steps = ceil( ( double( max ) - double( min ) ) / res );
+        yojimbo_assert( steps <= 4294967295.0 );
+        return bits_required( 0, uint32_t( steps ) );
+    }
+
+    template <typename Stream> bool serialize_compressed_float_internal( Stream & stream, float & value, float min, float max, float res )
+    {
+        yojimbo_assert( max > min );
+        yojimbo_assert( res > 0.0f );
+
+        const double delta = double( max ) - double( min );
+        const double steps = ceil( delta / res );
+        yojimbo_assert( steps <= 4294967295.0 );
+        const uint32_t maxIntegerValue = uint32_t( steps );
+        const int bits = bits_required( 0, maxIntegerValue );
+
+        uint32_t integerValue = 0;
+
+        if ( Stream::IsWriting )
+        {
+            double normalizedValue = ( double( value ) - min ) / delta;
+            if ( normalizedValue < 0.0 )
+                normalizedValue = 0.0;
+            if ( normalizedValue > 1.0 )
+                normalizedValue = 1.0;
+            integerValue = uint32_t( normalizedValue * maxIntegerValue + 0.5 );
+        }
+
+        if ( !stream.SerializeBits( integerValue, bits ) )
+            return false;
+
+        if ( Stream::IsReading )
+        {
+            if ( integerValue > maxIntegerValue )
+                return false;
+            value = float( min + ( integerValue / double( maxIntegerValue ) ) * delta );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a float quantized to a bounded range (read/write/measure).
+
+        The value is quantized to steps of at most res within [min,max] and written as an integer with only as many bits as that takes. Values outside the range are clamped on write.
+
+        This is a helper macro to make writing unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The float value to serialize.
+        @param min The minimum value.
+        @param max The maximum value.
+        @param res The resolution. Values are quantized to steps of at most this size.
+
+        @see compressed_float_bits
+     */
+
+    #define serialize_compressed_float( stream, value, min, max, res )                          \
+        do                                                                                      \
+        {                                                                                       \
+            if ( !yojimbo::serialize_compressed_float_internal( stream, value, min, max, res ) ) \
+                return false;                                                                   \
+        } while (0)
+
+    template <typename Stream> bool serialize_compressed_vector_internal( Stream & stream, float * vector, float min, float max, float res )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( !serialize_compressed_float_internal( stream, vector[i], min, max, res ) )
+                return false;
+        }
+        return true;
+    }
+
+    /**
+        Serialize a vector with each component quantized to a bounded range (read/write/measure).
+
+        Each of the x, y and z components is written with serialize_compressed_float. Use this for positions inside a known world bounds, and velocities with a known maximum speed.
+
+        This is a helper macro to make writing unified serialize functions easier.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param vector Pointer to the three floats of the vector.
+        @param min The minimum value of each component.
+        @param max The maximum value of each component.
+        @param res The resolution of each component.
+     */
+
+    #define serialize_compressed_vector( stream, vector, min, max, res )                        \
+        do                                                                                      \
+        {                                                                                       \
+            if ( !yojimbo::serialize_compressed_vector_internal( stream, vector, min, max, res ) ) \
+                return false;                                                                   \
+        } while (0)
+
+    template <typename Stream> bool serialize_compressed_quaternion_internal( Stream & stream, float * quaternion, int bits )
+    {
+        yojimbo_assert( bits >= 2 );
+        yojimbo_assert( bits <= 31 );
+
+        // the smallest three components of a unit quaternion are all in [-1/sqrt(2),1/sqrt(2)]
+
+        const float minimum = -0.707107f;
+        const float maximum = +0.707107f;
+        const float scale = float( ( uint32_t(1) << bits ) - 1 );
+
+        uint32_t largest = 0;
+        uint32_t integerValue[3] = { 0, 0, 0 };
+
+        if ( Stream::IsWriting )
+        {
+            float largestValue = fabsf( quaternion[0] );
+            for ( int i = 1; i < 4; ++i )
+            {
+                if ( fabsf( quaternion[i] ) > largestValue )
+                {
+                    largest = i;
+                    largestValue = fabsf( quaternion[i] );
+                }
+            }
+
+            // q and -q are the same rotation, so flip the quaternion to make the largest component positive
+
+            const float sign = ( quaternion[largest] < 0.0f ) ? -1.0f : 1.0f;
+
+            int j = 0;
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( i == int( largest ) )
+                    continue;
+                float normalizedValue = ( quaternion[i] * sign - minimum ) / ( maximum - minimum );
+                if ( normalizedValue < 0.0f )
+                    normalizedValue = 0.0f;
+                if ( normalizedValue > 1.0f )
+                    normalizedValue = 1.0f;
+                integerValue[j++] = uint32_t( normalizedValue * scale + 0.5f );
+            }
+        }
+
+        serialize_bits( stream, largest, 2 );
+        serialize_bits( stream, integerValue[0], bits );
+        serialize_bits( stream, integerValue[1], bits );
+        serialize_bits( stream, integerValue[2], bits );
+
+        if ( Stream::IsReading )
+        {
+            float sumSquares = 0.0f;
+            int j = 0;
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( i == int( largest ) )
+                    continue;
+                quaternion[i] = minimum + ( integerValue[j++] / scale ) * ( maximum - minimum );
+                sumSquares += quaternion[i] * quaternion[i];
+            }
+            quaternion[largest] = ( sumSquares < 1.0f ) ? sqrtf( 1.0f - sumSquares ) : 0.0f;
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a unit quaternion with smallest three compression (read/write/measure).
+
+        The largest component is dropped and rebuilt on read from the unit length, so only its index and the three smallest components are sent. This takes 2 + 3 * bits bits, eg. 32 bits at 10 bits per component instead of 128 bits for four floats.
+
+        The quaternion read may be the negation of the one written. Both represent the same rotation.
+
+        This is a helper macro to make writing unified serialize functions easier.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param quaternion Pointer to the four floats of the quaternion, in x, y, z, w order. Must be normalized on write.
+        @param bits The number of bits per component in [2,31].
+     */
+
+    #define serialize_compressed_quaternion( stream, quaternion, bits )                         \
+        do                                                                                      \
+        {                                                                                       \
+            if ( !yojimbo::serialize_compressed_quaternion_internal( stream, quaternion, bits ) ) \
+                return false;                                                                   \
+        } while (0)
+
     /**
         Serialize a 32 bit unsigned integer to the stream (read/write/measure).
 
@@ -257,6 +462,129 @@ namespace yojimbo
                 return false;                                                       \
         } while (0)
 
+    template <typename Stream> bool serialize_bytes_view_internal( Stream & stream, const uint8_t * & data, int bytes )
+    {
+        return stream.SerializeBytesView( data, bytes );
+    }
+
+    /**
+        Serialize an array of bytes to the stream without copying on read (read/write/measure).
+
+        On write and measure this is the same as serialize_bytes. On read, the pointer is set to the bytes inside the packet buffer instead of copying them out, which saves a copy for large payloads like voice and pre-compressed data.
+
+        IMPORTANT: On read the pointer is only valid while the packet buffer is alive. Consume or copy the data before the packet has finished processing.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param data A const uint8_t pointer. Points to the data to write on write/measure, set to point into the packet on read.
+        @param bytes The number of bytes to serialize.
+     */
+
+    #define serialize_bytes_view( stream, data, bytes )                             \
+        do                                                                          \
+        {                                                                           \
+            if ( !yojimbo::serialize_bytes_view_internal( stream, data, bytes ) )   \
+                return false;                                                       \
+        } while (0)
+
+    template <typename Stream> bool serialize_bits_array_internal( Stream & stream, uint32_t * values, int count, int bits )
+    {
+        return stream.SerializeBitsArray( values, count, bits );
+    }
+
+    /**
+        Serialize an array of values with the same number of bits each to the stream (read/write/measure).
+
+        Same bits on the wire as calling serialize_bits for each value, but much faster for large arrays, eg. quantized positions. Space is checked once for the whole array, and 8, 16 and 32 bit values are copied a dword at a time when the stream is dword aligned.
+
+        This is a helper macro to make unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param values Pointer to an array of uint32_t values to serialize.
+        @param count The number of values in the array.
+        @param bits The number of bits to serialize per value in [1,32].
+     */
+
+    #define serialize_bits_array( stream, values, count, bits )                     \
+        do                                                                          \
+        {                                                                           \
+            if ( !yojimbo::serialize_bits_array_internal( stream, values, count, bits ) ) \
+                return false;                                                       \
+        } while (0)
+
+    template <typename Stream> bool serialize_int_array_internal( Stream & stream, int32_t * values, int count, int32_t min, int32_t max )
+    {
+        yojimbo_assert( min < max );
+        yojimbo_assert( count >= 0 );
+
+        const int bits = bits_required( min, max );
+
+        if ( Stream::IsWriting )
+        {
+            // offset values into [0,max-min] a chunk at a time, so the array kernels can run on them
+
+            const int ChunkSize = 64;
+            uint32_t chunk[ChunkSize];
+            for ( int i = 0; i < count; i += ChunkSize )
+            {
+                const int chunkCount = yojimbo_min( ChunkSize, count - i );
+                for ( int j = 0; j < chunkCount; ++j )
+                {
+                    yojimbo_assert( int64_t( values[i+j] ) >= int64_t( min ) );
+                    yojimbo_assert( int64_t( values[i+j] ) <= int64_t( max ) );
+                    chunk[j] = uint32_t( values[i+j] - min );
+                }
+                if ( !stream.SerializeBitsArray( chunk, chunkCount, bits ) )
+                    return false;
+            }
+            return true;
+        }
+
+        uint32_t * unsigned_values = (uint32_t*) values;
+
+        if ( !stream.SerializeBitsArray( unsigned_values, count, bits ) )
+            return false;
+
+        for ( int i = 0; i < count; ++i )
+        {
+            if ( unsigned_values[i] > uint32_t( max - min ) )
+                return false;
+            values[i] = int32_t( unsigned_values[i] + uint32_t( min ) );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize an array of integers to the stream (read/write/measure).
+
+        Same bits on the wire as calling serialize_int for each value, but much faster for large arrays, eg. entity ids. See serialize_bits_array.
+
+        This is a helper macro to make unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param values Pointer to an array of int32_t values to serialize. Each must be in [min,max].
+        @param count The number of values in the array.
+        @param min The minimum value.
+        @param max The maximum value.
+     */
+
+    #define serialize_int_array( stream, values, count, min, max )                  \
+        do                                                                          \
+        {                                                                           \
+            if ( !yojimbo::serialize_int_array_internal( stream, values, count, min, max ) ) \
+                return false;                                                       \
+        } while (0)
+
     template <typename Stream> bool serialize_string_internal( Stream & stream, char * string, int buffer_size )
     {
         int length = 0;
@@ -504,6 +832,36 @@ namespace yojimbo
                 return false;                                                               \
         } while (0)
 
+    /**
+        Calculate the number of bits serialize_int_relative uses to encode current relative to previous, without a stream.
+
+        Matches the bits processed by a MeasureStream exactly. Use this when packing packets to avoid measuring with a throwaway stream.
+
+        @param previous The previous integer value.
+        @param current The current integer value. Must be greater than previous.
+
+        @returns The number of bits required to serialize current relative to previous.
+     */
+
+    inline int int_relative_bits( uint32_t previous, uint32_t current )
+    {
+        yojimbo_assert( previous < current );
+        const uint32_t difference = current - previous;
+        if ( difference == 1 )
+            return 1;
+        if ( difference <= 6 )
+            return 2 + BitsRequired<2,6>::result;
+        if ( difference <= 23 )
+            return 3 + BitsRequired<7,23>::result;
+        if ( difference <= 280 )
+            return 4 + BitsRequired<24,280>::result;
+        if ( difference <= 4377 )
+            return 5 + BitsRequired<281,4377>::result;
+        if ( difference <= 69914 )
+            return 6 + BitsRequired<4378,69914>::result;
+        return 6 + 32;
+    }
+
     template <typename Stream> bool serialize_ack_relative_internal( Stream & stream, uint16_t sequence, uint16_t & ack )
     {
         int ack_delta = 0;
@@ -559,6 +917,22 @@ namespace yojimbo
                 return false;                                                                       \
         } while (0)
 
+    /**
+        Calculate the number of bits serialize_ack_relative uses to encode an ack relative to the current sequence number, without a stream.
+
+        @param sequence The current sequence number.
+        @param ack The ack sequence number. Must not be equal to sequence.
+
+        @returns The number of bits required to serialize the ack relative to the sequence number.
+     */
+
+    inline int ack_relative_bits( uint16_t sequence, uint16_t ack )
+    {
+        const int ack_delta = ( ack < sequence ) ? ( sequence - ack ) : ( (int)sequence + 65536 - ack );
+        yojimbo_assert( ack_delta > 0 );
+        return 1 + ( ( ack_delta <= 64 ) ? (int) BitsRequired<1,64>::result : 16 );
+    }
+
     template <typename Stream> bool serialize_sequence_relative_internal( Stream & stream, uint16_t sequence1, uint16_t & sequence2 )
     {
         if ( Stream::IsWriting )
@@ -580,6 +954,22 @@ namespace yojimbo
         return true;
     }
 
+    /**
+        Calculate the number of bits serialize_sequence_relative uses to encode sequence2 relative to sequence1, without a stream.
+
+        @param sequence1 The first sequence number to serialize relative to.
+        @param sequence2 The second sequence number to be encoded relative to the first. Must not be equal to sequence1.
+
+        @returns The number of bits required to serialize sequence2 relative to sequence1.
+     */
+
+    inline int sequence_relative_bits( uint16_t sequence1, uint16_t sequence2 )
+    {
+        const uint32_t a = sequence1;
+        const uint32_t b = sequence2 + ( ( sequence1 > sequence2 ) ? 65536 : 0 );
+        return int_relative_bits( a, b );
+    }
+
     /**
         Serialize a sequence number relative to another (read/write/measure).
 
@@ -601,6 +991,298 @@ namespace yojimbo
                 return false;                                                                       \
         } while (0)
 
+    template <typename Stream, typename T> bool serialize_varint_internal( Stream & stream, T & value, int groupBits )
+    {
+        yojimbo_assert( groupBits > 0 );
+        yojimbo_assert( groupBits < 32 );
+
+        const int valueBits = sizeof( T ) * 8;
+        const int maxGroups = ( valueBits + groupBits - 1 ) / groupBits;
+
+        uint64_t remaining = 0;
+        if ( Stream::IsWriting )
+            remaining = uint64_t( value );
+
+        uint64_t result = 0;
+
+        for ( int i = 0; i < maxGroups; ++i )
+        {
+            uint32_t group = 0;
+            bool more = false;
+            if ( Stream::IsWriting )
+            {
+                group = uint32_t( remaining & ( ( uint64_t(1) << groupBits ) - 1 ) );
+                remaining >>= groupBits;
+                more = remaining != 0;
+            }
+
+            serialize_bits( stream, group, groupBits );
+
+            if ( Stream::IsReading )
+            {
+                const int shift = i * groupBits;
+                if ( valueBits - shift < groupBits && ( group >> ( valueBits - shift ) ) != 0 )
+                    return false;
+                result |= uint64_t( group ) << shift;
+            }
+
+            // the last group never has a continuation bit, so a value can't be longer than its type on the wire
+
+            if ( i == maxGroups - 1 )
+                break;
+
+            serialize_bool( stream, more );
+
+            if ( !more )
+                break;
+        }
+
+        if ( Stream::IsReading )
+            value = T( result );
+
+        return true;
+    }
+
+    /**
+        Serialize an unsigned integer with a variable length encoding (read/write/measure).
+
+        The value is split into groups of group_bits bits, lowest first. Each group is followed by a continuation bit that is 1 if more groups follow, like LEB128 but at the bit level, so small values cost only a few bits without needing a fixed range.
+
+        Use this for counters and ids that are usually small but can occasionally be large. For values that are always in a known range, serialize_int is smaller.
+
+        This is a helper macro to make unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The unsigned integer value to serialize. May be 8, 16, 32 or 64 bits.
+        @param group_bits The number of value bits per group in [1,31]. Larger groups cost fewer continuation bits for large values, smaller groups cost less for small values.
+     */
+
+    #define serialize_varint( stream, value, group_bits )                                           \
+        do                                                                                          \
+        {                                                                                           \
+            if ( !yojimbo::serialize_varint_internal( stream, value, group_bits ) )                 \
+                return false;                                                                       \
+        } while (0)
+
+    /**
+        Calculate the number of bits serialize_varint uses to encode a value, without a stream.
+
+        @param value The unsigned integer value.
+        @param valueBits The size of the integer type in bits, eg. 32 for uint32_t.
+        @param groupBits The number of value bits per group in [1,31].
+
+        @returns The number of bits required to serialize the value.
+     */
+
+    inline int varint_bits( uint64_t value, int valueBits, int groupBits )
+    {
+        yojimbo_assert( groupBits > 0 );
+        yojimbo_assert( groupBits < 32 );
+        const int maxGroups = ( valueBits + groupBits - 1 ) / groupBits;
+        int groups = 1;
+        while ( groups < maxGroups && ( value >> ( groups * groupBits ) ) != 0 )
+            groups++;
+        return groups * groupBits + ( groups < maxGroups ? groups : groups - 1 );
+    }
+
+    /**
+        Map a signed integer to an unsigned integer so values close to zero stay small (zigzag encoding).
+
+        0, -1, 1, -2, 2 ... map to 0, 1, 2, 3, 4 ...
+
+        @param value The signed integer value.
+
+        @returns The zigzag encoded value.
+     */
+
+    inline uint64_t zigzag_encode( int64_t value )
+    {
+        return ( uint64_t( value ) << 1 ) ^ uint64_t( value >> 63 );
+    }
+
+    /**
+        Reverse zigzag encoding.
+
+        @param value The zigzag encoded value.
+
+        @returns The signed integer value.
+     */
+
+    inline int64_t zigzag_decode( uint64_t value )
+    {
+        return int64_t( value >> 1 ) ^ -int64_t( value & 1 );
+    }
+
+    template <typename Stream, typename T> bool serialize_varint_signed_internal( Stream & stream, T & value, int groupBits )
+    {
+        const int valueBits = sizeof( T ) * 8;
+
+        uint64_t unsigned_value = 0;
+        if ( Stream::IsWriting )
+            unsigned_value = zigzag_encode( int64_t( value ) );
+
+        if ( valueBits == 64 )
+        {
+            if ( !serialize_varint_internal( stream, unsigned_value, groupBits ) )
+                return false;
+        }
+        else
+        {
+            uint32_t unsigned_value32 = uint32_t( unsigned_value );
+            if ( !serialize_varint_internal( stream, unsigned_value32, groupBits ) )
+                return false;
+            unsigned_value = unsigned_value32;
+        }
+
+        if ( Stream::IsReading )
+        {
+            const int64_t signed_value = zigzag_decode( unsigned_value );
+            if ( T( signed_value ) != signed_value )
+                return false;
+            value = T( signed_value );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a signed integer with a variable length encoding (read/write/measure).
+
+        The value is zigzag encoded so small positive and negative values both get small, then written with serialize_varint.
+
+        This is a helper macro to make unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The signed integer value to serialize. May be 8, 16, 32 or 64 bits.
+        @param group_bits The number of value bits per group in [1,31].
+     */
+
+    #define serialize_varint_signed( stream, value, group_bits )                                    \
+        do                                                                                          \
+        {                                                                                           \
+            if ( !yojimbo::serialize_varint_signed_internal( stream, value, group_bits ) )          \
+                return false;                                                                       \
+        } while (0)
+
+    template <typename Stream> bool serialize_exp_golomb_internal( Stream & stream, uint32_t & value, int k )
+    {
+        yojimbo_assert( k >= 0 );
+        yojimbo_assert( k < 32 );
+
+        // x = value + 2^k is written as n-k zero bits, a one bit, then the n low bits of x, where n = floor(log2(x)). x < 2^33, so n is at most 32.
+
+        uint64_t x = 0;
+        int numZeros = 0;
+        if ( Stream::IsWriting )
+        {
+            x = uint64_t( value ) + ( uint64_t(1) << k );
+            int n = 0;
+            while ( ( x >> ( n + 1 ) ) != 0 )
+                n++;
+            numZeros = n - k;
+        }
+
+        const int maxZeros = 32 - k;
+
+        if ( Stream::IsWriting )
+        {
+            for ( int i = 0; i < numZeros; ++i )
+            {
+                bool zero = false;
+                serialize_bool( stream, zero );
+            }
+            bool one = true;
+            serialize_bool( stream, one );
+        }
+        else
+        {
+            while ( true )
+            {
+                bool bit = false;
+                serialize_bool( stream, bit );
+                if ( bit )
+                    break;
+                if ( ++numZeros > maxZeros )
+                    return false;
+            }
+        }
+
+        const int n = numZeros + k;
+
+        yojimbo_assert( n <= 32 );
+
+        uint32_t low = 0;
+        if ( Stream::IsWriting )
+            low = uint32_t( x & ( ( uint64_t(1) << n ) - 1 ) );
+
+        if ( n > 0 )
+            serialize_bits( stream, low, n );
+
+        if ( Stream::IsReading )
+        {
+            x = ( uint64_t(1) << n ) | low;
+            const uint64_t decoded = x - ( uint64_t(1) << k );
+            if ( decoded > 0xFFFFFFFF )
+                return false;
+            value = uint32_t( decoded );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize an unsigned 32 bit integer with exponential-Golomb coding of order k (read/write/measure).
+
+        Costs 2*floor(log2(value+2^k)) - k + 1 bits, so small values are cheap and cost grows smoothly with magnitude, with no groups to tune. Values below 2^k all cost the same k+1 bits, so pick k near the typical magnitude of the value.
+
+        With k = 0 this is Elias-gamma coding of value+1.
+
+        This is a helper macro to make unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The unsigned 32 bit integer value to serialize.
+        @param k The order of the code in [0,31].
+     */
+
+    #define serialize_exp_golomb( stream, value, k )                                                \
+        do                                                                                          \
+        {                                                                                           \
+            if ( !yojimbo::serialize_exp_golomb_internal( stream, value, k ) )                      \
+                return false;                                                                       \
+        } while (0)
+
+    /**
+        Calculate the number of bits serialize_exp_golomb uses to encode a value, without a stream.
+
+        @param value The unsigned integer value.
+        @param k The order of the code in [0,31].
+
+        @returns The number of bits required to serialize the value.
+     */
+
+    inline int exp_golomb_bits( uint32_t value, int k )
+    {
+        yojimbo_assert( k >= 0 );
+        yojimbo_assert( k < 32 );
+        const uint64_t x = uint64_t( value ) + ( uint64_t(1) << k );
+        int n = 0;
+        while ( ( x >> ( n + 1 ) ) != 0 )
+            n++;
+        return 2 * n - k + 1;
+    }
+
     // read macros corresponding to each serialize_*. useful when you want separate read and write functions for some reason.
 
     #define read_bits( stream, value, bits )                                                \
@@ -641,6 +1323,12 @@ namespace yojimbo
     #define read_int_relative           serialize_int_relative
     #define read_ack_relative           serialize_ack_relative
     #define read_sequence_relative      serialize_sequence_relative
+    #define read_varint                 serialize_varint
+    #define read_varint_signed          serialize_varint_signed
+    #define read_exp_golomb             serialize_exp_golomb
+    #define read_compressed_float       serialize_compressed_float
+    #define read_compressed_vector      serialize_compressed_vector
+    #define read_compressed_quaternion  serialize_compressed_quaternion
 
     // write macros corresponding to each serialize_*. useful when you want separate read and write functions for some reason.
 
@@ -678,6 +1366,12 @@ namespace yojimbo
     #define write_int_relative          serialize_int_relative
     #define write_ack_relative          serialize_ack_relative
     #define write_sequence_relative     serialize_sequence_relative
+    #define write_varint                serialize_varint
+    #define write_varint_signed         serialize_varint_signed
+    #define write_exp_golomb            serialize_exp_golomb
+    #define write_compressed_float      serialize_compressed_float
+    #define write_compressed_vector     serialize_compressed_vector
+    #define write_compressed_quaternion serialize_compressed_quaternion
 
     /**
         Interface for an object that knows how to read, write and measure how many bits it would take up in a bit stream.
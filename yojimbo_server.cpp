@@ -6,14 +6,40 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_server.h"
+#include "yojimbo_client.h"
 #include "yojimbo_simulator.h"
+#include "yojimbo_footprint.h"
+#include "yojimbo_shared_memory.h"
 #include "netcode.h"
 #include "reliable.h"
+#include <float.h>
+#include <math.h>
+#include <sodium.h>
 
 namespace yojimbo
 {
     // -----------------------------------------------------------------------------------------------------
 
+    static size_t cache_line_round( size_t bytes )
+    {
+        return ( bytes + CacheLineBytes - 1 ) & ~size_t( CacheLineBytes - 1 );
+    }
+
+    static void SubmitLock( volatile int & lock )
+    {
+        while ( yojimbo_atomic_compare_exchange( &lock, 1, 0 ) != 0 )
+        {
+            // spin
+        }
+    }
+
+    static void SubmitUnlock( volatile int & lock )
+    {
+        const int previous = yojimbo_atomic_compare_exchange( &lock, 0, 1 );
+        yojimbo_assert( previous == 1 );
+        (void) previous;
+    }
+
     BaseServer::BaseServer( Allocator & allocator, const BaseClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
     {
         m_allocator = &allocator;
@@ -24,21 +50,65 @@ namespace yojimbo
         m_maxClients = 0;
         m_globalMemory = NULL;
         m_globalAllocator = NULL;
-        for ( int i = 0; i < MaxClients; ++i )
+        m_sharedClientMemory = NULL;
+        m_sharedClientAllocator = NULL;
+        m_clientMemory = NULL;
+        m_clientAllocator = NULL;
+        m_broadcastMemory = NULL;
+        m_broadcastAllocator = NULL;
+        m_broadcastPoolAllocator = NULL;
+        m_broadcastMessageFactory = NULL;
+        m_clientMessageFactory = NULL;
+        m_clientConnection = NULL;
+        m_clientEndpoint = NULL;
+        m_clientEndpointAllocator = NULL;
+        m_activeClientMemory = NULL;
+        m_activeClients = NULL;
+        m_activeConnection = NULL;
+        m_activeEndpoint = NULL;
+        m_activeClientPosition = NULL;
+        m_numActiveClients = 0;
+        m_tickTime = 0.0;
+        m_clientSendRate = NULL;
+        m_numClientGroups = 0;
+        m_groupClients = NULL;
+        m_groupClientPosition = NULL;
+        m_groupNumClients = NULL;
+        m_networkSimulator = NULL;
+        m_packetRecorder = NULL;
+        m_loopbackClients = NULL;
+        m_loopbackPackets = NULL;
+        m_numLoopbackClients = 0;
+        m_sharedMemoryLinks = NULL;
+        m_sharedMemoryReceiveTime = NULL;
+        m_warmSlots = NULL;
+        m_numWarmSlots = 0;
+        m_clientSpectator = NULL;
+        m_clientLowPriority = NULL;
+        m_overloadLevel = 0;
+        m_overloadSteps = 0;
+        m_overloadTicks = 0;
+        m_recoverTicks = 0;
+        m_clientIngress = NULL;
+        m_clientSubmitMemory = NULL;
+        m_clientSubmitQueues = NULL;
+        m_clientSubmitQueueStride = 0;
+        // Spectators keep every channel, so their packets read and write exactly like a player's. Only the local queues shrink, and block buffers are only allocated if a block is sent.
+        m_spectatorConfig = m_config;
+        for ( int i = 0; i < m_spectatorConfig.numChannels; ++i )
         {
-            m_clientMemory[i] = NULL;
-            m_clientAllocator[i] = NULL;
-            m_clientMessageFactory[i] = NULL;
-            m_clientConnection[i] = NULL;
-            m_clientEndpoint[i] = NULL;
+            ChannelConfig & channelConfig = m_spectatorConfig.channel[i];
+            channelConfig.sendQueueSize = yojimbo_min( channelConfig.sendQueueSize, m_config.serverSpectatorQueueSize );
+            channelConfig.receiveQueueSize = yojimbo_min( channelConfig.receiveQueueSize, m_config.serverSpectatorQueueSize );
+            channelConfig.lazyBlockBuffers = true;
         }
-        m_networkSimulator = NULL;
     }
 
     BaseServer::~BaseServer()
     {
         // IMPORTANT: Please stop the server before destroying it!
         yojimbo_assert( !IsRunning () );
+        ReleaseWarmClientSlots();
         m_allocator = NULL;
     }
 
@@ -51,89 +121,693 @@ namespace yojimbo
     void BaseServer::Start( int maxClients )
     {
         Stop();
+        yojimbo_assert( maxClients > 0 );
         m_running = true;
         m_maxClients = maxClients;
+        if ( m_config.checkMemory )
+        {
+            ServerMemoryFootprint footprint;
+            GetServerMemoryFootprint( *m_allocator, *m_adapter, m_config, maxClients, footprint );
+            CheckMemoryFootprint( "serverPerClientMemory", m_config.serverPerClientMemory, footprint.client.total );
+            if ( m_config.serverSharedClientMemory && m_config.serverSharedClientPoolMemory > 0 )
+                CheckMemoryFootprint( "serverSharedClientPoolMemory", m_config.serverSharedClientPoolMemory, footprint.clientSlots );
+        }
         yojimbo_assert( !m_globalMemory );
         yojimbo_assert( !m_globalAllocator );
-        m_globalMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverGlobalMemory );
+        m_globalMemory = AllocateServerMemory( -1, m_config.serverGlobalMemory );
         m_globalAllocator = m_adapter->CreateAllocator( *m_allocator, m_globalMemory, m_config.serverGlobalMemory );
         yojimbo_assert( m_globalAllocator );
         if ( m_config.networkSimulator )
         {
-            m_networkSimulator = YOJIMBO_NEW( *m_globalAllocator, NetworkSimulator, *m_globalAllocator, m_config.maxSimulatorPackets, m_time );
+            m_networkSimulator = YOJIMBO_NEW( *m_globalAllocator, NetworkSimulator, *m_globalAllocator, m_config.maxSimulatorPackets, m_time, m_config.simulatorPacketBuffers, m_config.simulatorPacketBufferBytes );
+            if ( m_config.simulatorSeed )
+                m_networkSimulator->SetSeed( m_config.simulatorSeed );
+        }
+        if ( m_config.serverSharedClientMemory && m_config.serverSharedClientPoolMemory > 0 )
+        {
+            m_sharedClientMemory = AllocateServerMemory( -1, m_config.serverSharedClientPoolMemory );
+            m_sharedClientAllocator = m_adapter->CreateAllocator( *m_allocator, m_sharedClientMemory, m_config.serverSharedClientPoolMemory );
+            yojimbo_assert( m_sharedClientAllocator );
+        }
+        m_broadcastMemory = AllocateServerMemory( -1, m_config.serverBroadcastMemory );
+        m_broadcastPoolAllocator = m_adapter->CreateAllocator( *m_allocator, m_broadcastMemory, m_config.serverBroadcastMemory );
+        yojimbo_assert( m_broadcastPoolAllocator );
+        m_broadcastAllocator = YOJIMBO_NEW( *m_allocator, ThreadSafeAllocator, *m_broadcastPoolAllocator );
+        m_broadcastMessageFactory = m_adapter->CreateMessageFactory( *m_broadcastAllocator );
+        yojimbo_assert( m_broadcastMessageFactory );
+        // Client tables are sized for the number of client slots requested, so memory scales with maxClients rather than a compile time maximum.
+        m_clientMemory = (uint8_t**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( uint8_t* ) * m_maxClients );
+        m_clientAllocator = (Allocator**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( Allocator* ) * m_maxClients );
+        m_clientMessageFactory = (MessageFactory**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( MessageFactory* ) * m_maxClients );
+        m_clientConnection = (Connection**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( Connection* ) * m_maxClients );
+        m_clientEndpoint = (reliable_endpoint_t**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( reliable_endpoint_t* ) * m_maxClients );
+        m_clientEndpointAllocator = (Allocator**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( Allocator* ) * m_maxClients );
+        // The active client arrays are read every tick, so they share one cache line aligned block, each array starting on a fresh line.
+        const size_t activeClientBytes = cache_line_round( sizeof( int ) * m_maxClients );
+        const size_t activePointerBytes = cache_line_round( sizeof( void* ) * m_maxClients );
+        m_activeClientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_globalAllocator, activeClientBytes + activePointerBytes * 2 + CacheLineBytes - 1 );
+        yojimbo_assert( m_activeClientMemory );
+        uint8_t * activeClientArrays = (uint8_t*) ( ( uintptr_t( m_activeClientMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
+        m_activeClients = (int*) activeClientArrays;
+        m_activeConnection = (Connection**) ( activeClientArrays + activeClientBytes );
+        m_activeEndpoint = (reliable_endpoint_t**) ( activeClientArrays + activeClientBytes + activePointerBytes );
+        m_activeClientPosition = (int*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( int ) * m_maxClients );
+        m_numActiveClients = 0;
+        m_clientSendRate = (float*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( float ) * m_maxClients );
+        yojimbo_assert( m_clientSendRate );
+        memset( m_clientSendRate, 0, sizeof( float ) * m_maxClients );
+        m_clientSpectator = (bool*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( bool ) * m_maxClients );
+        yojimbo_assert( m_clientSpectator );
+        memset( m_clientSpectator, 0, sizeof( bool ) * m_maxClients );
+        m_clientLowPriority = (bool*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( bool ) * m_maxClients );
+        yojimbo_assert( m_clientLowPriority );
+        memset( m_clientLowPriority, 0, sizeof( bool ) * m_maxClients );
+        yojimbo_assert( m_config.numServerOverloadSteps >= 0 && m_config.numServerOverloadSteps <= SERVER_OVERLOAD_NUM_STEPS );
+        for ( int i = 0; i < m_config.numServerOverloadSteps; ++i )
+            yojimbo_assert( m_config.serverOverloadSteps[i] >= 0 && m_config.serverOverloadSteps[i] < SERVER_OVERLOAD_NUM_STEPS );
+        yojimbo_assert( m_config.serverOverloadBudgetScale > 0.0f && m_config.serverOverloadBudgetScale <= 1.0f );
+        yojimbo_assert( m_config.serverOverloadSendRate > 0.0f );
+        m_overloadLevel = 0;
+        m_overloadSteps = 0;
+        m_overloadTicks = 0;
+        m_recoverTicks = 0;
+        if ( m_config.serverClientPacketRate > 0.0f || m_config.serverClientByteRate > 0 )
+        {
+            m_clientIngress = (ClientIngressBudget*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( ClientIngressBudget ) * m_maxClients );
+            yojimbo_assert( m_clientIngress );
+            memset( m_clientIngress, 0, sizeof( ClientIngressBudget ) * m_maxClients );
+        }
+        if ( m_config.serverSubmitQueueSize > 0 )
+        {
+            m_clientSubmitQueueStride = cache_line_round( sizeof( ClientSubmitQueue ) + sizeof( SubmittedMessage ) * m_config.serverSubmitQueueSize );
+            m_clientSubmitMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_globalAllocator, m_clientSubmitQueueStride * m_maxClients + CacheLineBytes - 1 );
+            yojimbo_assert( m_clientSubmitMemory );
+            m_clientSubmitQueues = (uint8_t*) ( ( uintptr_t( m_clientSubmitMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                ClientSubmitQueue & queue = GetClientSubmitQueue( i );
+                queue.lock = 0;
+                queue.numMessages = 0;
+                queue.messages = (SubmittedMessage*) ( ( (uint8_t*) &queue ) + sizeof( ClientSubmitQueue ) );
+            }
+        }
+        m_numClientGroups = m_config.serverMaxClientGroups;
+        if ( m_numClientGroups > 0 )
+        {
+            m_groupClients = (int*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( int ) * m_numClientGroups * m_maxClients );
+            m_groupClientPosition = (int*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( int ) * m_numClientGroups * m_maxClients );
+            m_groupNumClients = (int*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( int ) * m_numClientGroups );
+            yojimbo_assert( m_groupClients && m_groupClientPosition && m_groupNumClients );
+            memset( m_groupClientPosition, 0xFF, sizeof( int ) * m_numClientGroups * m_maxClients );
+            memset( m_groupNumClients, 0, sizeof( int ) * m_numClientGroups );
+        }
+        m_loopbackClients = (BaseClient**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( BaseClient* ) * m_maxClients );
+        m_loopbackPackets = (Queue<LoopbackPacket>**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( Queue<LoopbackPacket>* ) * m_maxClients );
+        m_numLoopbackClients = 0;
+        yojimbo_assert( m_loopbackClients && m_loopbackPackets );
+        memset( m_loopbackClients, 0, sizeof( BaseClient* ) * m_maxClients );
+        memset( m_loopbackPackets, 0, sizeof( Queue<LoopbackPacket>* ) * m_maxClients );
+        m_sharedMemoryLinks = (SharedMemoryLink**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( SharedMemoryLink* ) * m_maxClients );
+        m_sharedMemoryReceiveTime = (double*) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( double ) * m_maxClients );
+        yojimbo_assert( m_sharedMemoryLinks && m_sharedMemoryReceiveTime );
+        memset( m_sharedMemoryLinks, 0, sizeof( SharedMemoryLink* ) * m_maxClients );
+        memset( m_sharedMemoryReceiveTime, 0, sizeof( double ) * m_maxClients );
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            m_activeClientPosition[i] = -1;
         }
+        yojimbo_assert( m_clientMemory && m_clientAllocator && m_clientMessageFactory && m_clientConnection && m_clientEndpoint && m_clientEndpointAllocator );
+        memset( m_clientMemory, 0, sizeof( uint8_t* ) * m_maxClients );
+        memset( m_clientAllocator, 0, sizeof( Allocator* ) * m_maxClients );
+        memset( m_clientMessageFactory, 0, sizeof( MessageFactory* ) * m_maxClients );
+        memset( m_clientConnection, 0, sizeof( Connection* ) * m_maxClients );
+        memset( m_clientEndpoint, 0, sizeof( reliable_endpoint_t* ) * m_maxClients );
+        memset( m_clientEndpointAllocator, 0, sizeof( Allocator* ) * m_maxClients );
         for ( int i = 0; i < m_maxClients; ++i )
         {
             yojimbo_assert( !m_clientMemory[i] );
             yojimbo_assert( !m_clientAllocator[i] );
-            m_clientMemory[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverPerClientMemory );
-            m_clientAllocator[i] = m_adapter->CreateAllocator( *m_allocator, m_clientMemory[i], m_config.serverPerClientMemory );
+            if ( i < m_numWarmSlots && m_warmSlots[i].allocator )
+            {
+                WarmClientSlot & slot = m_warmSlots[i];
+                m_clientMemory[i] = slot.memory;
+                m_clientAllocator[i] = slot.allocator;
+                m_clientMessageFactory[i] = slot.messageFactory;
+                m_clientConnection[i] = slot.connection;
+                m_clientEndpoint[i] = slot.endpoint;
+                m_clientEndpointAllocator[i] = slot.endpointAllocator;
+                memset( &slot, 0, sizeof( WarmClientSlot ) );
+            }
+            else if ( m_config.serverSharedClientMemory )
+            {
+                m_clientAllocator[i] = YOJIMBO_NEW( *m_allocator, QuotaAllocator, GetSharedClientAllocator(), m_config.serverPerClientMemory );
+            }
+            else
+            {
+                m_clientMemory[i] = AllocateServerMemory( i, m_config.serverPerClientMemory );
+                m_clientAllocator[i] = m_adapter->CreateAllocator( *m_allocator, m_clientMemory[i], m_config.serverPerClientMemory );
+            }
             yojimbo_assert( m_clientAllocator[i] );
-            m_clientMessageFactory[i] = m_adapter->CreateMessageFactory( *m_clientAllocator[i] );
-            yojimbo_assert( m_clientMessageFactory[i] );
-            m_clientConnection[i] = YOJIMBO_NEW( *m_clientAllocator[i], Connection, *m_clientAllocator[i], *m_clientMessageFactory[i], m_config, m_time );
-            yojimbo_assert( m_clientConnection[i] );
-            // todo: fully setup endpoint config from client/server config
-            reliable_config_t config;
-            reliable_default_config( &config );
-            sprintf( config.name, "server endpoint" );
-            config.context = (void*) this;
-            config.index = i;
-            config.transmit_packet_function = BaseServer::StaticTransmitPacketFunction;
-            config.process_packet_function = BaseServer::StaticProcessPacketFunction;
-            config.allocator_context = &GetGlobalAllocator();
-            config.allocate_function = BaseServer::StaticAllocateFunction;
-            config.free_function = BaseServer::StaticFreeFunction;
-            m_clientEndpoint[i] = reliable_endpoint_create( &config );
-            reliable_endpoint_reset( m_clientEndpoint[i] );
         }
     }
 
+    void BaseServer::CreateClientConnection( int clientIndex, bool spectator )
+    {
+        // Connections, message factories and endpoints are created the first time a client connects to a slot, then reset and reused for later clients.
+        // This keeps server start fast and avoids holding channel queues and block buffers for slots that are never used.
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientAllocator[clientIndex] );
+        if ( m_clientConnection[clientIndex] )
+        {
+            if ( m_clientSpectator[clientIndex] == spectator )
+                return;
+            // The slot was last used by a player and now a spectator connects to it, or the other way round, so build it again for the new client.
+            DestroyClientConnection( clientIndex );
+        }
+        m_clientSpectator[clientIndex] = spectator;
+        if ( m_config.serverSharedClientMemory )
+        {
+            QuotaAllocator * quotaAllocator = (QuotaAllocator*) m_clientAllocator[clientIndex];
+            quotaAllocator->SetQuota( spectator ? m_config.serverSpectatorMemory : m_config.serverPerClientMemory );
+        }
+        const ConnectionConfig & connectionConfig = spectator ? m_spectatorConfig : m_config;
+        m_clientMessageFactory[clientIndex] = m_adapter->CreateMessageFactory( *m_clientAllocator[clientIndex] );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        m_clientConnection[clientIndex] = YOJIMBO_NEW( *m_clientAllocator[clientIndex], Connection, *m_clientAllocator[clientIndex], *m_clientMessageFactory[clientIndex], connectionConfig, m_time, true );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        m_clientEndpointAllocator[clientIndex] = CreateEndpointAllocator( *m_clientAllocator[clientIndex], m_config );
+        reliable_config_t config;
+        InitializeEndpointConfig( m_config, config );
+        sprintf( config.name, "server endpoint" );
+        config.context = (void*) this;
+        config.index = clientIndex;
+        config.transmit_packet_function = BaseServer::StaticTransmitPacketFunction;
+        config.process_packet_function = BaseServer::StaticProcessPacketFunction;
+        config.allocator_context = m_clientEndpointAllocator[clientIndex] ? m_clientEndpointAllocator[clientIndex] : m_clientAllocator[clientIndex];
+        config.allocate_function = BaseServer::StaticAllocateFunction;
+        config.free_function = BaseServer::StaticFreeFunction;
+        m_clientEndpoint[clientIndex] = reliable_endpoint_create( &config );
+        reliable_endpoint_reset( m_clientEndpoint[clientIndex] );
+    }
+
+    void BaseServer::DestroyClientConnection( int clientIndex )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientAllocator[clientIndex] );
+        if ( m_clientEndpoint[clientIndex] )
+        {
+            reliable_endpoint_destroy( m_clientEndpoint[clientIndex] ); m_clientEndpoint[clientIndex] = NULL;
+        }
+        YOJIMBO_DELETE( *m_clientAllocator[clientIndex], Allocator, m_clientEndpointAllocator[clientIndex] );
+        YOJIMBO_DELETE( *m_clientAllocator[clientIndex], Connection, m_clientConnection[clientIndex] );
+        YOJIMBO_DELETE( *m_clientAllocator[clientIndex], MessageFactory, m_clientMessageFactory[clientIndex] );
+        m_clientSpectator[clientIndex] = false;
+    }
+
+    void BaseServer::AddActiveClient( int clientIndex )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_activeClientPosition[clientIndex] >= 0 )
+            return;
+        yojimbo_assert( m_numActiveClients < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        yojimbo_assert( m_clientEndpoint[clientIndex] );
+        m_activeClientPosition[clientIndex] = m_numActiveClients;
+        m_activeClients[m_numActiveClients] = clientIndex;
+        m_activeConnection[m_numActiveClients] = m_clientConnection[clientIndex];
+        m_activeEndpoint[m_numActiveClients] = m_clientEndpoint[clientIndex];
+        m_numActiveClients++;
+        ApplyOverload( *m_clientConnection[clientIndex] );
+        if ( m_clientIngress )
+        {
+            // a client starts with a full burst, like a new address does for connect requests
+            ClientIngressBudget & ingress = m_clientIngress[clientIndex];
+            ingress.packetTokens = yojimbo_max( m_config.serverClientPacketRate, 1.0f );
+            ingress.byteTokens = float( yojimbo_max( m_config.serverClientByteRate, m_config.maxPacketSize ) );
+            ingress.lastTime = m_time;
+            ingress.numPacketsDropped = 0;
+            ingress.numBytesDropped = 0;
+        }
+    }
+
+    bool BaseServer::FilterClientPacket( int clientIndex, int packetBytes )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+
+        if ( !m_clientIngress )
+            return true;
+
+        ClientIngressBudget & ingress = m_clientIngress[clientIndex];
+
+        const float elapsed = float( m_time - ingress.lastTime );
+        ingress.lastTime = m_time;
+
+        const float packetRate = m_config.serverClientPacketRate;
+        if ( packetRate > 0.0f )
+            ingress.packetTokens = yojimbo_min( yojimbo_max( packetRate, 1.0f ), ingress.packetTokens + elapsed * packetRate );
+
+        // the byte burst is at least one packet, so a low byte rate can't block every packet for good
+
+        const float byteRate = float( m_config.serverClientByteRate );
+        if ( byteRate > 0.0f )
+            ingress.byteTokens = yojimbo_min( yojimbo_max( byteRate, float( m_config.maxPacketSize ) ), ingress.byteTokens + elapsed * byteRate );
+
+        if ( ( packetRate > 0.0f && ingress.packetTokens < 1.0f ) || ( byteRate > 0.0f && ingress.byteTokens < float( packetBytes ) ) )
+        {
+            ingress.numPacketsDropped++;
+            ingress.numBytesDropped += packetBytes;
+            return false;
+        }
+
+        ingress.packetTokens -= 1.0f;
+        ingress.byteTokens -= float( packetBytes );
+        return true;
+    }
+
+    void BaseServer::GetClientIngressStats( int clientIndex, uint64_t & numPacketsDropped, uint64_t & numBytesDropped ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        numPacketsDropped = 0;
+        numBytesDropped = 0;
+        if ( !m_clientIngress )
+            return;
+        yojimbo_assert( clientIndex < m_maxClients );
+        numPacketsDropped = m_clientIngress[clientIndex].numPacketsDropped;
+        numBytesDropped = m_clientIngress[clientIndex].numBytesDropped;
+    }
+
+    bool BaseServer::AdmitClient( int clientIndex )
+    {
+        const bool admit = IsAdmittingClients();
+        if ( m_adapter->AdmitClient( clientIndex, admit ) )
+            return true;
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server refused client %d (%s)\n", clientIndex, admit ? "adapter" : "overloaded" );
+        return false;
+    }
+
+    int BaseServer::GetSharedClientMemoryFree() const
+    {
+        if ( !m_sharedClientAllocator )
+            return -1;
+        const size_t allocated = m_sharedClientAllocator->GetBytesAllocated();
+        const size_t poolBytes = size_t( m_config.serverSharedClientPoolMemory );
+        return allocated < poolBytes ? int( poolBytes - allocated ) : 0;
+    }
+
+    bool BaseServer::IsAdmittingClients() const
+    {
+        if ( m_config.serverAdmissionTickTime > 0.0f && m_tickTime > m_config.serverAdmissionTickTime )
+            return false;
+        if ( m_config.serverAdmissionMemoryHeadroom > 0 )
+        {
+            const int memoryFree = GetSharedClientMemoryFree();
+            if ( memoryFree >= 0 && memoryFree < m_config.serverAdmissionMemoryHeadroom )
+                return false;
+        }
+        return true;
+    }
+
+    void BaseServer::RemoveActiveClient( int clientIndex )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        const int position = m_activeClientPosition[clientIndex];
+        if ( position < 0 )
+            return;
+        for ( int i = 0; i < m_numClientGroups; ++i )
+        {
+            RemoveClientFromGroup( i, clientIndex );
+        }
+        ReleaseSubmittedMessages( clientIndex );
+        m_clientSendRate[clientIndex] = 0.0f;
+        m_clientLowPriority[clientIndex] = false;
+        const int lastClientIndex = m_activeClients[m_numActiveClients-1];
+        m_activeClients[position] = lastClientIndex;
+        m_activeConnection[position] = m_activeConnection[m_numActiveClients-1];
+        m_activeEndpoint[position] = m_activeEndpoint[m_numActiveClients-1];
+        m_activeClientPosition[lastClientIndex] = position;
+        m_activeClientPosition[clientIndex] = -1;
+        m_numActiveClients--;
+    }
+
     void BaseServer::Stop()
     {
         if ( IsRunning() )
         {
             yojimbo_assert( m_globalMemory );
             yojimbo_assert( m_globalAllocator );
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                DisconnectLoopbackClient( i );
+            }
+            YOJIMBO_FREE( *m_globalAllocator, m_loopbackClients );
+            YOJIMBO_FREE( *m_globalAllocator, m_loopbackPackets );
+            YOJIMBO_FREE( *m_globalAllocator, m_sharedMemoryLinks );
+            YOJIMBO_FREE( *m_globalAllocator, m_sharedMemoryReceiveTime );
             YOJIMBO_DELETE( *m_globalAllocator, NetworkSimulator, m_networkSimulator );
+            if ( m_config.serverWarmRestart && !m_config.serverSharedClientMemory && m_maxClients > m_numWarmSlots )
+            {
+                WarmClientSlot * warmSlots = (WarmClientSlot*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( WarmClientSlot ) * m_maxClients );
+                yojimbo_assert( warmSlots );
+                memset( warmSlots, 0, sizeof( WarmClientSlot ) * m_maxClients );
+                if ( m_warmSlots )
+                    memcpy( warmSlots, m_warmSlots, sizeof( WarmClientSlot ) * m_numWarmSlots );
+                YOJIMBO_FREE( *m_allocator, m_warmSlots );
+                m_warmSlots = warmSlots;
+                m_numWarmSlots = m_maxClients;
+            }
             for ( int i = 0; i < m_maxClients; ++i )
             {
-                yojimbo_assert( m_clientMemory[i] );
+                yojimbo_assert( m_clientMemory[i] || m_config.serverSharedClientMemory );
                 yojimbo_assert( m_clientAllocator[i] );
-                yojimbo_assert( m_clientMessageFactory[i] );
-                yojimbo_assert( m_clientEndpoint[i] );
-                reliable_endpoint_destroy( m_clientEndpoint[i] ); m_clientEndpoint[i] = NULL;
-                YOJIMBO_DELETE( *m_clientAllocator[i], Connection, m_clientConnection[i] );
-                YOJIMBO_DELETE( *m_clientAllocator[i], MessageFactory, m_clientMessageFactory[i] );
+                ReleaseSubmittedMessages( i );
+                if ( KeepWarmClientSlot( i ) )
+                    continue;
+                DestroyClientConnection( i );
                 YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator[i] );
-                YOJIMBO_FREE( *m_allocator, m_clientMemory[i] );
+                FreeServerMemory( m_clientMemory[i], m_config.serverPerClientMemory );
             }
+            YOJIMBO_DELETE( *m_broadcastAllocator, MessageFactory, m_broadcastMessageFactory );
+            YOJIMBO_DELETE( *m_allocator, Allocator, m_broadcastAllocator );
+            YOJIMBO_DELETE( *m_allocator, Allocator, m_broadcastPoolAllocator );
+            FreeServerMemory( m_broadcastMemory, m_config.serverBroadcastMemory );
+            YOJIMBO_DELETE( *m_allocator, Allocator, m_sharedClientAllocator );
+            FreeServerMemory( m_sharedClientMemory, m_config.serverSharedClientPoolMemory );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientMemory );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientAllocator );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientMessageFactory );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientConnection );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientEndpoint );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientEndpointAllocator );
+            YOJIMBO_FREE( *m_globalAllocator, m_activeClientMemory );
+            m_activeClients = NULL;
+            m_activeConnection = NULL;
+            m_activeEndpoint = NULL;
+            YOJIMBO_FREE( *m_globalAllocator, m_activeClientPosition );
+            m_numActiveClients = 0;
+            YOJIMBO_FREE( *m_globalAllocator, m_clientSendRate );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientSpectator );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientLowPriority );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientIngress );
+            YOJIMBO_FREE( *m_globalAllocator, m_clientSubmitMemory );
+            m_clientSubmitQueues = NULL;
+            YOJIMBO_FREE( *m_globalAllocator, m_groupClients );
+            YOJIMBO_FREE( *m_globalAllocator, m_groupClientPosition );
+            YOJIMBO_FREE( *m_globalAllocator, m_groupNumClients );
+            m_numClientGroups = 0;
             YOJIMBO_DELETE( *m_allocator, Allocator, m_globalAllocator );
-            YOJIMBO_FREE( *m_allocator, m_globalMemory );
+            FreeServerMemory( m_globalMemory, m_config.serverGlobalMemory );
         }
         m_running = false;
         m_maxClients = 0;
     }
 
+    bool BaseServer::KeepWarmClientSlot( int clientIndex )
+    {
+        // Only slots with their own memory are kept. Shared client memory lives in a pool that Stop destroys.
+        if ( !m_config.serverWarmRestart || m_config.serverSharedClientMemory )
+            return false;
+        yojimbo_assert( clientIndex < m_numWarmSlots );
+        yojimbo_assert( !m_warmSlots[clientIndex].allocator );
+        // An allocator that ran out of memory may have left the connection half built, so build the slot again from scratch.
+        if ( m_clientAllocator[clientIndex]->GetErrorLevel() != ALLOCATOR_ERROR_NONE )
+            return false;
+        // Warm slots come back as player slots, so a slot built for a spectator is not kept.
+        if ( m_clientSpectator[clientIndex] )
+            return false;
+        if ( m_clientEndpoint[clientIndex] )
+            reliable_endpoint_reset( m_clientEndpoint[clientIndex] );
+        if ( m_clientConnection[clientIndex] )
+            m_clientConnection[clientIndex]->Reset();
+        WarmClientSlot & slot = m_warmSlots[clientIndex];
+        slot.memory = m_clientMemory[clientIndex];
+        slot.allocator = m_clientAllocator[clientIndex];
+        slot.messageFactory = m_clientMessageFactory[clientIndex];
+        slot.connection = m_clientConnection[clientIndex];
+        slot.endpoint = m_clientEndpoint[clientIndex];
+        slot.endpointAllocator = m_clientEndpointAllocator[clientIndex];
+        m_clientMemory[clientIndex] = NULL;
+        m_clientAllocator[clientIndex] = NULL;
+        m_clientMessageFactory[clientIndex] = NULL;
+        m_clientConnection[clientIndex] = NULL;
+        m_clientEndpoint[clientIndex] = NULL;
+        m_clientEndpointAllocator[clientIndex] = NULL;
+        return true;
+    }
+
+    void BaseServer::DestroyWarmClientSlot( WarmClientSlot & slot )
+    {
+        if ( !slot.allocator )
+            return;
+        if ( slot.endpoint )
+        {
+            reliable_endpoint_destroy( slot.endpoint ); slot.endpoint = NULL;
+        }
+        YOJIMBO_DELETE( *slot.allocator, Allocator, slot.endpointAllocator );
+        YOJIMBO_DELETE( *slot.allocator, Connection, slot.connection );
+        YOJIMBO_DELETE( *slot.allocator, MessageFactory, slot.messageFactory );
+        YOJIMBO_DELETE( *m_allocator, Allocator, slot.allocator );
+        FreeServerMemory( slot.memory, m_config.serverPerClientMemory );
+    }
+
+    void BaseServer::ReleaseWarmClientSlots()
+    {
+        yojimbo_assert( !IsRunning() );
+        for ( int i = 0; i < m_numWarmSlots; ++i )
+        {
+            DestroyWarmClientSlot( m_warmSlots[i] );
+        }
+        YOJIMBO_FREE( *m_allocator, m_warmSlots );
+        m_numWarmSlots = 0;
+    }
+
+    int BaseServer::GetNumWarmClientSlots() const
+    {
+        int numWarmSlots = 0;
+        for ( int i = 0; i < m_numWarmSlots; ++i )
+        {
+            if ( m_warmSlots[i].allocator )
+                numWarmSlots++;
+        }
+        return numWarmSlots;
+    }
+
+    int BaseServer::ConnectLoopbackClient( BaseClient & client )
+    {
+        yojimbo_assert( IsRunning() );
+        for ( int i = m_maxClients - 1; i >= 0; --i )
+        {
+            if ( IsClientConnected( i ) )
+                continue;
+            CreateClientConnection( i );
+            m_loopbackPackets[i] = YOJIMBO_NEW( *m_clientAllocator[i], Queue<LoopbackPacket>, *m_clientAllocator[i], m_config.maxLoopbackPackets );
+            m_loopbackClients[i] = &client;
+            m_numLoopbackClients++;
+            AddActiveClient( i );
+            return i;
+        }
+        return -1;
+    }
+
+    int BaseServer::ConnectSharedMemoryClient( const char * path )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( path );
+        for ( int i = m_maxClients - 1; i >= 0; --i )
+        {
+            if ( IsClientConnected( i ) )
+                continue;
+            CreateClientConnection( i );
+            SharedMemoryLink * link = YOJIMBO_NEW( *m_clientAllocator[i], SharedMemoryLink, path, m_config.sharedMemoryRingBytes, i );
+            if ( !link || link->IsError() )
+            {
+                YOJIMBO_DELETE( *m_clientAllocator[i], SharedMemoryLink, link );
+                return -1;
+            }
+            m_sharedMemoryLinks[i] = link;
+            m_sharedMemoryReceiveTime[i] = m_time;
+            m_numLoopbackClients++;
+            AddActiveClient( i );
+            return i;
+        }
+        return -1;
+    }
+
+    void BaseServer::DisconnectLoopbackClient( int clientIndex )
+    {
+        if ( !IsLoopbackClient( clientIndex ) )
+            return;
+        if ( m_sharedMemoryLinks[clientIndex] )
+        {
+            // closing the link tells the client, which disconnects on its next update
+            YOJIMBO_DELETE( *m_clientAllocator[clientIndex], SharedMemoryLink, m_sharedMemoryLinks[clientIndex] );
+            m_numLoopbackClients--;
+            RemoveActiveClient( clientIndex );
+            reliable_endpoint_reset( m_clientEndpoint[clientIndex] );
+            m_clientConnection[clientIndex]->Reset();
+            if ( m_networkSimulator && m_networkSimulator->IsActive() )
+                m_networkSimulator->DiscardClientPackets( clientIndex );
+            return;
+        }
+        BaseClient * client = m_loopbackClients[clientIndex];
+        m_loopbackClients[clientIndex] = NULL;
+        m_numLoopbackClients--;
+        RemoveActiveClient( clientIndex );
+        reliable_endpoint_reset( m_clientEndpoint[clientIndex] );
+        m_clientConnection[clientIndex]->Reset();
+        Queue<LoopbackPacket> * packets = m_loopbackPackets[clientIndex];
+        while ( !packets->IsEmpty() )
+        {
+            LoopbackPacket packet = packets->Pop();
+            YOJIMBO_FREE( *m_clientAllocator[clientIndex], packet.packetData );
+        }
+        YOJIMBO_DELETE( *m_clientAllocator[clientIndex], Queue<LoopbackPacket>, m_loopbackPackets[clientIndex] );
+        if ( m_networkSimulator && m_networkSimulator->IsActive() )
+            m_networkSimulator->DiscardClientPackets( clientIndex );
+        // a client disconnecting itself has already unlinked from the server
+        if ( client->IsLoopback() )
+            client->Disconnect();
+    }
+
+    bool BaseServer::IsLoopbackClient( int clientIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_loopbackClients && ( m_loopbackClients[clientIndex] != NULL || m_sharedMemoryLinks[clientIndex] != NULL );
+    }
+
+    double BaseServer::GetNextEventTime() const
+    {
+        double nextEventTime = DBL_MAX;
+        if ( !m_running )
+            return nextEventTime;
+        for ( int i = 0; i < m_numActiveClients; ++i )
+        {
+            PrefetchActiveClient( i + 1 );
+            const int clientIndex = m_activeClients[i];
+            if ( m_loopbackPackets[clientIndex] && !m_loopbackPackets[clientIndex]->IsEmpty() )
+                return m_time;
+            nextEventTime = yojimbo_min( nextEventTime, m_activeConnection[i]->GetNextSendTime() );
+        }
+        if ( m_networkSimulator && m_networkSimulator->IsActive() )
+        {
+            nextEventTime = yojimbo_min( nextEventTime, m_networkSimulator->GetNextDeliveryTime() );
+        }
+        return nextEventTime;
+    }
+
+    void BaseServer::QueueLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes )
+    {
+        yojimbo_assert( IsLoopbackClient( clientIndex ) );
+        Queue<LoopbackPacket> * packets = m_loopbackPackets[clientIndex];
+        if ( packets->IsFull() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "loopback packet queue is full for client %d. dropping packet\n", clientIndex );
+            return;
+        }
+        LoopbackPacket packet;
+        packet.packetData = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], packetBytes );
+        if ( !packet.packetData )
+            return;
+        memcpy( packet.packetData, packetData, packetBytes );
+        packet.packetBytes = packetBytes;
+        packets->Push( packet );
+    }
+
+    void BaseServer::SendLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes )
+    {
+        yojimbo_assert( IsLoopbackClient( clientIndex ) );
+        if ( m_sharedMemoryLinks[clientIndex] )
+        {
+            if ( !m_sharedMemoryLinks[clientIndex]->SendPacket( packetData, packetBytes ) )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "shared memory ring is full for client %d. dropping packet\n", clientIndex );
+            return;
+        }
+        m_loopbackClients[clientIndex]->QueueLoopbackPacket( packetData, packetBytes );
+    }
+
+    void BaseServer::ReceiveLoopbackPackets()
+    {
+        if ( m_numLoopbackClients == 0 )
+            return;
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            if ( m_sharedMemoryLinks[i] )
+            {
+                ReceiveSharedMemoryPackets( i );
+                continue;
+            }
+            if ( !m_loopbackClients[i] )
+                continue;
+            Queue<LoopbackPacket> * packets = m_loopbackPackets[i];
+            while ( !packets->IsEmpty() )
+            {
+                LoopbackPacket packet = packets->Pop();
+                reliable_endpoint_receive_packet( m_clientEndpoint[i], packet.packetData, packet.packetBytes );
+                YOJIMBO_FREE( *m_clientAllocator[i], packet.packetData );
+            }
+        }
+    }
+
+    void BaseServer::ReceiveSharedMemoryPackets( int clientIndex )
+    {
+        SharedMemoryLink * link = m_sharedMemoryLinks[clientIndex];
+        yojimbo_assert( link );
+        int packetBytes;
+        uint8_t * packetData;
+        while ( ( packetData = link->ReceivePacket( packetBytes ) ) != NULL )
+        {
+            reliable_endpoint_receive_packet( m_clientEndpoint[clientIndex], packetData, packetBytes );
+            link->ReleasePacket();
+            m_sharedMemoryReceiveTime[clientIndex] = m_time;
+        }
+        if ( link->IsClosed() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "shared memory client %d closed the link\n", clientIndex );
+            DisconnectClient( clientIndex );
+        }
+        else if ( m_config.sharedMemoryTimeout > 0.0f && m_time - m_sharedMemoryReceiveTime[clientIndex] > m_config.sharedMemoryTimeout )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "shared memory client %d timed out\n", clientIndex );
+            DisconnectClient( clientIndex );
+        }
+    }
+
     void BaseServer::AdvanceTime( double time )
     {
         m_time = time;
         if ( IsRunning() )
         {
-            for ( int i = 0; i < m_maxClients; ++i )
+            // Iterate in reverse, because disconnecting a client removes it from the active client list by swapping in the last entry.
+            for ( int activeIndex = m_numActiveClients - 1; activeIndex >= 0; --activeIndex )
             {
-                m_clientConnection[i]->AdvanceTime( time );
-                if ( m_clientConnection[i]->GetErrorLevel() != CONNECTION_ERROR_NONE )
+                PrefetchActiveClient( activeIndex - 1 );
+                const int i = m_activeClients[activeIndex];
+                Connection * connection = m_activeConnection[activeIndex];
+                reliable_endpoint_t * endpoint = m_activeEndpoint[activeIndex];
+                connection->AdvanceTime( time );
+                if ( connection->GetErrorLevel() != CONNECTION_ERROR_NONE )
                 {
-                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client %d connection is in error state. disconnecting client\n", m_clientConnection[i]->GetErrorLevel() );
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client %d connection is in error state. disconnecting client\n", connection->GetErrorLevel() );
                     DisconnectClient( i );
                     continue;
                 }
-                reliable_endpoint_update( m_clientEndpoint[i] );
+                if ( connection->UpdateMemoryLow() )
+                    m_adapter->OnConnectionMemoryLow( i, connection->IsMemoryLow() );
+                reliable_endpoint_update( endpoint );
                 int numAcks;
-                const uint16_t * acks = reliable_endpoint_get_acks( m_clientEndpoint[i], &numAcks );
-                m_clientConnection[i]->ProcessAcks( acks, numAcks );
-                reliable_endpoint_clear_acks( m_clientEndpoint[i] );
+                const uint16_t * acks = reliable_endpoint_get_acks( endpoint, &numAcks );
+                if ( numAcks > 0 )
+                {
+                    connection->ProcessAcks( acks, numAcks );
+                    reliable_endpoint_clear_acks( endpoint );
+                }
+                connection->UpdateNetworkConditions( reliable_endpoint_rtt( endpoint ), reliable_endpoint_packet_loss( endpoint ) );
             }
             NetworkSimulator * networkSimulator = GetNetworkSimulator();
             if ( networkSimulator )
@@ -175,6 +849,16 @@ namespace yojimbo
         }
     }
 
+    void BaseServer::SetClientLinkConditions( int clientIndex, const NetworkLinkConditions & conditions )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLinkConditions( clientIndex, conditions );
+        }
+    }
+
     Message * BaseServer::CreateMessage( int clientIndex, int type )
     {
         yojimbo_assert( clientIndex >= 0 );
@@ -218,6 +902,42 @@ namespace yojimbo
         return m_clientConnection[clientIndex]->CanSendMessage( channelIndex );
     }
 
+    bool BaseServer::IsClientMemoryLow( int clientIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return m_clientConnection[clientIndex]->IsMemoryLow();
+    }
+
+    bool BaseServer::IsClientSpectator( int clientIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_clientSpectator[clientIndex];
+    }
+
+    uint64_t BaseServer::GetClientChannelsWithMessages( int clientIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return m_clientConnection[clientIndex]->GetChannelsWithMessages();
+    }
+
+    int BaseServer::GetClientsWithMessages( int * clientIndices, int maxClients ) const
+    {
+        yojimbo_assert( clientIndices );
+        int numClients = 0;
+        for ( int i = 0; i < m_numActiveClients && numClients < maxClients; ++i )
+        {
+            PrefetchActiveClient( i + 1 );
+            if ( m_activeConnection[i]->GetChannelsWithMessages() )
+                clientIndices[numClients++] = m_activeClients[i];
+        }
+        return numClients;
+    }
+
     void BaseServer::SendMessage( int clientIndex, int channelIndex, Message * message )
     {
         yojimbo_assert( clientIndex >= 0 );
@@ -242,40 +962,571 @@ namespace yojimbo
         m_clientConnection[clientIndex]->ReleaseMessage( message );
     }
 
-    MessageFactory & BaseServer::GetClientMessageFactory( int clientIndex ) 
-    { 
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
+    int BaseServer::SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages )
+    {
+        yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        return *m_clientMessageFactory[clientIndex];
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return m_clientConnection[clientIndex]->SendMessages( channelIndex, messages, numMessages );
     }
 
-    reliable_endpoint_t * BaseServer::GetClientEndpoint( int clientIndex )
+    int BaseServer::ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages )
     {
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        return m_clientEndpoint[clientIndex];
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return m_clientConnection[clientIndex]->ReceiveMessages( channelIndex, messages, maxMessages );
     }
 
-    Connection & BaseServer::GetClientConnection( int clientIndex )
+    void BaseServer::ReleaseMessages( int clientIndex, Message ** messages, int numMessages )
     {
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
         yojimbo_assert( m_clientConnection[clientIndex] );
-        return *m_clientConnection[clientIndex];
+        m_clientConnection[clientIndex]->ReleaseMessages( messages, numMessages );
     }
 
-    void BaseServer::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    BaseServer::ClientSubmitQueue & BaseServer::GetClientSubmitQueue( int clientIndex )
     {
-        BaseServer * server = (BaseServer*) context;
-        server->TransmitPacketFunction( index, packetSequence, packetData, packetBytes );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientSubmitQueues );
+        return *( (ClientSubmitQueue*) ( m_clientSubmitQueues + clientIndex * m_clientSubmitQueueStride ) );
     }
-    
-    int BaseServer::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+
+    Message * BaseServer::CreateMessageConcurrent( int clientIndex, int type )
+    {
+        ClientSubmitQueue & queue = GetClientSubmitQueue( clientIndex );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        SubmitLock( queue.lock );
+        Message * message = m_clientMessageFactory[clientIndex]->CreateMessage( type );
+        SubmitUnlock( queue.lock );
+        return message;
+    }
+
+    uint8_t * BaseServer::AllocateBlockConcurrent( int clientIndex, int bytes )
+    {
+        ClientSubmitQueue & queue = GetClientSubmitQueue( clientIndex );
+        SubmitLock( queue.lock );
+        uint8_t * block = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], bytes );
+        SubmitUnlock( queue.lock );
+        return block;
+    }
+
+    void BaseServer::ReleaseMessageConcurrent( int clientIndex, Message * message )
+    {
+        ClientSubmitQueue & queue = GetClientSubmitQueue( clientIndex );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        SubmitLock( queue.lock );
+        m_clientMessageFactory[clientIndex]->ReleaseMessage( message );
+        SubmitUnlock( queue.lock );
+    }
+
+    bool BaseServer::SubmitMessage( int clientIndex, int channelIndex, Message * message )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_config.numChannels );
+        ClientSubmitQueue & queue = GetClientSubmitQueue( clientIndex );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        SubmitLock( queue.lock );
+        const bool queued = queue.numMessages < m_config.serverSubmitQueueSize;
+        if ( queued )
+        {
+            SubmittedMessage & entry = queue.messages[queue.numMessages++];
+            entry.message = message;
+            entry.channelIndex = channelIndex;
+        }
+        else
+        {
+            m_clientMessageFactory[clientIndex]->ReleaseMessage( message );
+        }
+        SubmitUnlock( queue.lock );
+        return queued;
+    }
+
+    void BaseServer::SendSubmittedMessages()
+    {
+        // job threads are done by now, so the queues are read without taking the locks
+        if ( !m_clientSubmitQueues )
+            return;
+        for ( int i = 0; i < m_numActiveClients; ++i )
+        {
+            ClientSubmitQueue & queue = GetClientSubmitQueue( m_activeClients[i] );
+            for ( int j = 0; j < queue.numMessages; ++j )
+            {
+                m_activeConnection[i]->SendMessage( queue.messages[j].channelIndex, queue.messages[j].message );
+            }
+            queue.numMessages = 0;
+        }
+    }
+
+    void BaseServer::ReleaseSubmittedMessages( int clientIndex )
+    {
+        if ( !m_clientSubmitQueues )
+            return;
+        ClientSubmitQueue & queue = GetClientSubmitQueue( clientIndex );
+        for ( int i = 0; i < queue.numMessages; ++i )
+        {
+            m_clientMessageFactory[clientIndex]->ReleaseMessage( queue.messages[i].message );
+        }
+        queue.numMessages = 0;
+    }
+
+    Message * BaseServer::CreateBroadcastMessage( int type )
+    {
+        yojimbo_assert( m_broadcastMessageFactory );
+        return m_broadcastMessageFactory->CreateMessage( type );
+    }
+
+    uint8_t * BaseServer::AllocateBroadcastBlock( int bytes )
+    {
+        yojimbo_assert( m_broadcastAllocator );
+        return (uint8_t*) YOJIMBO_ALLOCATE( *m_broadcastAllocator, bytes );
+    }
+
+    void BaseServer::AttachBlockToBroadcastMessage( Message * message, uint8_t * block, int bytes )
+    {
+        yojimbo_assert( m_broadcastAllocator );
+        yojimbo_assert( message );
+        yojimbo_assert( block );
+        yojimbo_assert( bytes > 0 );
+        yojimbo_assert( message->IsBlockMessage() );
+        BlockMessage * blockMessage = (BlockMessage*) message;
+        blockMessage->AttachBlock( *m_broadcastAllocator, block, bytes );
+    }
+
+    SharedBlock * BaseServer::CreateSharedBlock( int bytes )
+    {
+        yojimbo_assert( m_broadcastAllocator );
+        return SharedBlock::Create( *m_broadcastAllocator, bytes );
+    }
+
+    void BaseServer::ReleaseBroadcastMessage( Message * message )
+    {
+        yojimbo_assert( m_broadcastMessageFactory );
+        m_broadcastMessageFactory->ReleaseMessage( message );
+    }
+
+    int BaseServer::BroadcastMessage( int channelIndex, Message * message )
+    {
+        yojimbo_assert( IsRunning() );
+        return SendMessageToClients( m_activeClients, m_numActiveClients, channelIndex, message );
+    }
+
+    int BaseServer::SendMessageToClients( const int clientIndices[], int numClients, int channelIndex, Message * message )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( message );
+        yojimbo_assert( numClients == 0 || clientIndices );
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_config.numChannels );
+
+        if ( m_config.channel[channelIndex].type == CHANNEL_TYPE_SNAPSHOT )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: can't send a message to many clients on snapshot channel %d\n", channelIndex );
+            ReleaseBroadcastMessage( message );
+            return 0;
+        }
+
+        SerializedMessage * serializedMessage = SerializedMessage::Create( *m_broadcastAllocator, *message, m_context );
+        if ( !serializedMessage )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize message of type %d for sending to many clients\n", message->GetType() );
+            ReleaseBroadcastMessage( message );
+            return 0;
+        }
+
+        // share the block between clients. a block that isn't shared yet moves into a shared block, so it's freed with the last client message
+        SharedBlock * sharedBlock = NULL;
+        BlockMessage * blockMessage = message->IsBlockMessage() ? (BlockMessage*) message : NULL;
+        if ( blockMessage && blockMessage->GetBlockSize() > 0 )
+        {
+            sharedBlock = blockMessage->GetSharedBlock();
+            if ( sharedBlock )
+            {
+                sharedBlock->Acquire();
+            }
+            else
+            {
+                sharedBlock = SharedBlock::Create( *m_broadcastAllocator, blockMessage->GetBlockData(), blockMessage->GetBlockSize(), blockMessage->GetAllocator() );
+                if ( !sharedBlock )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to share block of message type %d for sending to many clients\n", message->GetType() );
+                    serializedMessage->Release();
+                    ReleaseBroadcastMessage( message );
+                    return 0;
+                }
+            }
+            blockMessage->DetachBlock();
+        }
+
+        int numSent = 0;
+        for ( int i = 0; i < numClients; ++i )
+        {
+            const int clientIndex = clientIndices[i];
+            yojimbo_assert( clientIndex >= 0 );
+            yojimbo_assert( clientIndex < m_maxClients );
+            if ( !IsClientConnected( clientIndex ) || !CanSendMessage( clientIndex, channelIndex ) )
+                continue;
+            Message * clientMessage = CreateMessage( clientIndex, message->GetType() );
+            if ( !clientMessage )
+                continue;
+            if ( sharedBlock )
+            {
+                yojimbo_assert( clientMessage->IsBlockMessage() );
+                ( (BlockMessage*) clientMessage )->AttachSharedBlock( sharedBlock );
+            }
+            clientMessage->AttachSerializedMessage( serializedMessage );
+            SendMessage( clientIndex, channelIndex, clientMessage );
+            numSent++;
+        }
+
+        if ( sharedBlock )
+            sharedBlock->Release();
+        serializedMessage->Release();
+        ReleaseBroadcastMessage( message );
+
+        return numSent;
+    }
+
+    void BaseServer::SetClientSendRate( int clientIndex, float packetsPerSecond )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( packetsPerSecond >= 0.0f );
+        m_clientSendRate[clientIndex] = packetsPerSecond;
+    }
+
+    float BaseServer::GetClientSendRate( int clientIndex ) const
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_clientSendRate[clientIndex];
+    }
+
+    void BaseServer::SetClientLowPriority( int clientIndex, bool lowPriority )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        m_clientLowPriority[clientIndex] = lowPriority;
+    }
+
+    bool BaseServer::IsClientLowPriority( int clientIndex ) const
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_clientLowPriority[clientIndex] || m_clientSpectator[clientIndex];
+    }
+
+    void BaseServer::UpdateOverload( double tickTime )
+    {
+        if ( !IsRunning() || m_config.serverOverloadTickTime <= 0.0f )
+            return;
+
+        // over budget counts towards the next step, well under budget towards undoing the last one. anything in between holds the level where it is
+
+        if ( tickTime > m_config.serverOverloadTickTime )
+        {
+            m_recoverTicks = 0;
+            if ( ++m_overloadTicks < m_config.serverOverloadTicks || m_overloadLevel >= m_config.numServerOverloadSteps )
+                return;
+            m_overloadTicks = 0;
+            SetOverloadStep( m_config.serverOverloadSteps[m_overloadLevel], true );
+            m_overloadLevel++;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server overloaded: tick took %.2fms. overload level %d\n", tickTime * 1000.0, m_overloadLevel );
+        }
+        else if ( tickTime < m_config.serverOverloadTickTime * m_config.serverRecoverFraction )
+        {
+            m_overloadTicks = 0;
+            if ( m_overloadLevel == 0 || ++m_recoverTicks < m_config.serverRecoverTicks )
+                return;
+            m_recoverTicks = 0;
+            m_overloadLevel--;
+            SetOverloadStep( m_config.serverOverloadSteps[m_overloadLevel], false );
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server recovering: overload level %d\n", m_overloadLevel );
+        }
+        else
+        {
+            m_overloadTicks = 0;
+            m_recoverTicks = 0;
+        }
+    }
+
+    void BaseServer::SetOverloadStep( int step, bool applied )
+    {
+        yojimbo_assert( step >= 0 && step < SERVER_OVERLOAD_NUM_STEPS );
+        if ( applied )
+            m_overloadSteps |= 1U << step;
+        else
+            m_overloadSteps &= ~( 1U << step );
+        for ( int activeIndex = 0; activeIndex < m_numActiveClients; ++activeIndex )
+            ApplyOverload( *m_activeConnection[activeIndex] );
+    }
+
+    void BaseServer::ApplyOverload( Connection & connection )
+    {
+        connection.SetScavengerPaused( IsOverloadStepApplied( SERVER_OVERLOAD_STEP_PAUSE_SCAVENGER ) );
+        connection.SetUnreliableBudgetScale( IsOverloadStepApplied( SERVER_OVERLOAD_STEP_SHRINK_UNRELIABLE ) ? m_config.serverOverloadBudgetScale : 1.0f );
+    }
+
+    bool BaseServer::AddClientToGroup( int groupIndex, int clientIndex )
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_activeClientPosition[clientIndex] < 0 )
+            return false;
+        int * positions = m_groupClientPosition + groupIndex * m_maxClients;
+        if ( positions[clientIndex] >= 0 )
+            return true;
+        int & numClients = m_groupNumClients[groupIndex];
+        yojimbo_assert( numClients < m_maxClients );
+        positions[clientIndex] = numClients;
+        m_groupClients[groupIndex*m_maxClients+numClients] = clientIndex;
+        numClients++;
+        return true;
+    }
+
+    void BaseServer::RemoveClientFromGroup( int groupIndex, int clientIndex )
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        int * positions = m_groupClientPosition + groupIndex * m_maxClients;
+        const int position = positions[clientIndex];
+        if ( position < 0 )
+            return;
+        int * clients = m_groupClients + groupIndex * m_maxClients;
+        int & numClients = m_groupNumClients[groupIndex];
+        const int lastClientIndex = clients[numClients-1];
+        clients[position] = lastClientIndex;
+        positions[lastClientIndex] = position;
+        positions[clientIndex] = -1;
+        numClients--;
+    }
+
+    void BaseServer::ClearClientGroup( int groupIndex )
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        const int * clients = m_groupClients + groupIndex * m_maxClients;
+        int * positions = m_groupClientPosition + groupIndex * m_maxClients;
+        for ( int i = 0; i < m_groupNumClients[groupIndex]; ++i )
+        {
+            positions[clients[i]] = -1;
+        }
+        m_groupNumClients[groupIndex] = 0;
+    }
+
+    bool BaseServer::IsClientInGroup( int groupIndex, int clientIndex ) const
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_groupClientPosition[groupIndex*m_maxClients+clientIndex] >= 0;
+    }
+
+    int BaseServer::GetNumClientsInGroup( int groupIndex ) const
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        return m_groupNumClients[groupIndex];
+    }
+
+    const int * BaseServer::GetClientsInGroup( int groupIndex ) const
+    {
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        return m_groupClients + groupIndex * m_maxClients;
+    }
+
+    int BaseServer::SendMessageToGroup( int groupIndex, int channelIndex, Message * message )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( groupIndex >= 0 );
+        yojimbo_assert( groupIndex < m_numClientGroups );
+        return SendMessageToClients( GetClientsInGroup( groupIndex ), m_groupNumClients[groupIndex], channelIndex, message );
+    }
+
+    bool BaseServer::GetReceivedBlockPrefix( int clientIndex, int channelIndex, const uint8_t * & blockData, int & blockBytes ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return m_clientConnection[clientIndex]->GetReceivedBlockPrefix( channelIndex, blockData, blockBytes );
+    }
+
+    void BaseServer::GetClientAllocatorStats( int clientIndex, AllocatorStats & stats ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        stats = AllocatorStats();
+        if ( !IsRunning() )
+            return;
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientAllocator[clientIndex] );
+        m_clientAllocator[clientIndex]->GetStats( stats );
+    }
+
+    bool BaseServer::GetLatencyHistogram( int clientIndex, int channelIndex, int index, LatencyHistogram & histogram ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        histogram.Clear();
+        if ( !IsRunning() )
+            return false;
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_activeClientPosition[clientIndex] < 0 )
+            return false;
+        const LatencyHistogram * channelHistogram = m_clientConnection[clientIndex]->GetLatencyHistogram( channelIndex, index );
+        if ( !channelHistogram )
+            return false;
+        histogram = *channelHistogram;
+        return true;
+    }
+
+    bool BaseServer::SetClientChannelLimits( int clientIndex, int channelIndex, const ChannelLimits & limits )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        if ( !IsRunning() )
+            return false;
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_activeClientPosition[clientIndex] < 0 )
+            return false;
+        m_clientConnection[clientIndex]->SetChannelLimits( channelIndex, limits );
+        return true;
+    }
+
+    void BaseServer::GetClientChannelLimits( int clientIndex, int channelIndex, ChannelLimits & limits ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_config.numChannels );
+        if ( !IsRunning() )
+        {
+            limits = ChannelLimits( m_config.channel[channelIndex] );
+            return;
+        }
+        yojimbo_assert( clientIndex < m_maxClients );
+        limits = m_clientConnection[clientIndex]->GetChannelLimits( channelIndex );
+    }
+
+    void BaseServer::GetConnectionStats( int clientIndex, ConnectionStats & stats ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        stats = ConnectionStats();
+        if ( !IsRunning() )
+            return;
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_activeClientPosition[clientIndex] < 0 )
+            return;
+        reliable_endpoint_t * endpoint = m_clientEndpoint[clientIndex];
+        yojimbo_assert( endpoint );
+        stats.rtt = reliable_endpoint_rtt( endpoint );
+        stats.packetLoss = reliable_endpoint_packet_loss( endpoint );
+        reliable_endpoint_bandwidth( endpoint, &stats.sentBandwidth, &stats.receivedBandwidth, &stats.ackedBandwidth );
+        const uint64_t * counters = reliable_endpoint_counters( endpoint );
+        stats.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
+        stats.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
+        stats.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
+        m_clientConnection[clientIndex]->GetStats( stats );
+    }
+
+    void BaseServer::GetGlobalAllocatorStats( AllocatorStats & stats ) const
+    {
+        stats = AllocatorStats();
+        if ( !IsRunning() )
+            return;
+        yojimbo_assert( m_globalAllocator );
+        m_globalAllocator->GetStats( stats );
+    }
+
+    uint8_t * BaseServer::AllocateServerMemory( int clientIndex, int bytes )
+    {
+        uint8_t * memory = NULL;
+        if ( !m_config.serverPageMemory )
+        {
+            memory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, bytes );
+        }
+        else
+        {
+            const int numaNode = m_adapter->GetServerMemoryNumaNode( clientIndex );
+            memory = (uint8_t*) yojimbo_page_allocate( bytes, m_config.serverHugePages, numaNode );
+            if ( !memory )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate %d bytes of server memory from the operating system\n", bytes );
+        }
+        if ( !memory )
+            return NULL;
+        if ( m_config.serverLockMemory )
+        {
+            // locking faults the pages in as well
+            if ( yojimbo_page_lock( memory, bytes ) )
+                return memory;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "warning: failed to lock %d bytes of server memory\n", bytes );
+        }
+        if ( m_config.serverPrefaultMemory || m_config.serverLockMemory )
+            yojimbo_page_prefault( memory, bytes );
+        return memory;
+    }
+
+    void BaseServer::FreeServerMemory( uint8_t * & memory, int bytes )
+    {
+        if ( m_config.serverLockMemory )
+            yojimbo_page_unlock( memory, bytes );
+        if ( !m_config.serverPageMemory )
+        {
+            YOJIMBO_FREE( *m_allocator, memory );
+            return;
+        }
+        yojimbo_page_free( memory, bytes, m_config.serverHugePages );
+        memory = NULL;
+    }
+
+    MessageFactory & BaseServer::GetClientMessageFactory( int clientIndex ) 
+    { 
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        return *m_clientMessageFactory[clientIndex];
+    }
+
+    reliable_endpoint_t * BaseServer::GetClientEndpoint( int clientIndex )
+    {
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_clientEndpoint[clientIndex];
+    }
+
+    Connection & BaseServer::GetClientConnection( int clientIndex )
+    {
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return *m_clientConnection[clientIndex];
+    }
+
+    void BaseServer::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
         BaseServer * server = (BaseServer*) context;
+        if ( server->m_packetRecorder )
+            server->m_packetRecorder->RecordPacket( server->m_time, PACKET_DIRECTION_SEND, index, packetSequence, packetData, packetBytes );
+        server->TransmitPacketFunction( index, packetSequence, packetData, packetBytes );
+    }
+    
+    int BaseServer::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        BaseServer * server = (BaseServer*) context;
+        if ( server->m_packetRecorder )
+            server->m_packetRecorder->RecordPacket( server->m_time, PACKET_DIRECTION_RECEIVE, index, packetSequence, packetData, packetBytes );
         return server->ProcessPacketFunction( index, packetSequence, packetData, packetBytes );
     }
 
@@ -294,175 +1545,1446 @@ namespace yojimbo
         YOJIMBO_FREE( *allocator, pointer );
     }
 
-    // -----------------------------------------------------------------------------------------------------
-
-    Server::Server( Allocator & allocator, const uint8_t privateKey[], const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) : BaseServer( allocator, config, adapter, time )
+    // -----------------------------------------------------------------------------------------------------
+
+    Server::Server( Allocator & allocator, const uint8_t privateKey[], const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) : BaseServer( allocator, config, adapter, time )
+    {
+        yojimbo_assert( KeyBytes == NETCODE_KEY_BYTES );
+        memcpy( m_privateKey, privateKey, NETCODE_KEY_BYTES );
+        m_address = address;
+        m_config = config;
+        m_server = NULL;
+        m_packetBufferMemory = NULL;
+        m_packetBuffer = NULL;
+        m_simulatorPacketData = NULL;
+        m_simulatorPacketBytes = NULL;
+        m_simulatorPacketTo = NULL;
+        m_receiveBatchPacketData = NULL;
+        m_receiveBatchPacketBytes = NULL;
+        m_receiveBatchClientIndex = NULL;
+        m_parallelPacketMemory = NULL;
+        m_parallelNumClients = 0;
+        m_parallelClientIndex = NULL;
+        m_parallelPacketSequence = NULL;
+        m_parallelPacketBytes = NULL;
+        m_parallelRunStart = NULL;
+        m_parallelRunCount = NULL;
+        m_sendBatchActive = false;
+        m_sendBatchNumPackets = 0;
+        m_sendBatchNumBytes = 0;
+        m_sendPacingSlice = 0;
+        m_clientNextSendTime = NULL;
+        m_sendBatchBuffer = NULL;
+        m_sendBatchPacketData = NULL;
+        m_sendBatchPacketBytes = NULL;
+        m_sendBatchClientIndex = NULL;
+        m_sendBatchNumRuns = 0;
+        m_sendBatchRunStart = NULL;
+        m_sendBatchRunCount = NULL;
+        m_socket = NULL;
+        m_trustedClients = NULL;
+        m_numTrustedClients = 0;
+        m_trustedAddressIndexSize = 0;
+        m_trustedAddressIndex = NULL;
+        m_trustedConnectFilter = NULL;
+        m_trustedConnectRequestsThisTick = 0;
+        m_trustedProbesThisTick = 0;
+        m_trustedReceiveBatchBuffer = NULL;
+        m_trustedReceiveBatchFrom = NULL;
+        m_sendBatchAddress = NULL;
+        for ( int i = 0; i < SERVER_TICK_PHASE_NUM_PHASES; ++i )
+            m_tickPhaseTime[i] = 0.0;
+    }
+
+    Server::~Server()
+    {
+        // IMPORTANT: Please stop the server before destroying it!
+        yojimbo_assert( !m_server );
+        yojimbo_assert( !m_socket );
+    }
+
+    void Server::Start( int maxClients )
+    {
+        yojimbo_assert( maxClients <= NETCODE_MAX_CLIENTS );
+        if ( IsRunning() )
+            Stop();
+        BaseServer::Start( maxClients );
+        if ( m_config.trustedNetwork )
+        {
+            m_socket = YOJIMBO_NEW( GetGlobalAllocator(), Socket, m_address, m_config.serverUdpSendBufferSize, m_config.serverUdpReceiveBufferSize, m_config.serverSocketRegisteredIO, m_config.serverSocketReusePort );
+            if ( !m_socket || m_socket->IsError() )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create trusted network socket\n" );
+                Stop();
+                return;
+            }
+            m_address = m_socket->GetAddress();
+            if ( m_config.trustedPathMtuDiscovery && !m_socket->SetDontFragment() )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "warning: failed to set don't fragment on trusted network socket\n" );
+            m_trustedClients = (TrustedClient*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( TrustedClient ) * maxClients );
+            for ( int i = 0; i < maxClients; ++i )
+            {
+                m_trustedClients[i].connected = false;
+                m_trustedClients[i].address = Address();
+                m_trustedClients[i].secondaryAddress = Address();
+                m_trustedClients[i].suspended = false;
+                m_trustedClients[i].pathBytes = 0;
+            }
+            m_numTrustedClients = 0;
+            yojimbo_assert( !m_config.trustedMultipath || m_config.dropDuplicatePackets );
+            const int maxTrustedAddresses = m_config.trustedMultipath ? maxClients * 2 : maxClients;
+            m_trustedAddressIndexSize = 1;
+            while ( m_trustedAddressIndexSize < maxTrustedAddresses * 2 )
+                m_trustedAddressIndexSize *= 2;
+            m_trustedAddressIndex = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_trustedAddressIndexSize );
+            memset( m_trustedAddressIndex, 0xFF, sizeof( int ) * m_trustedAddressIndexSize );
+            if ( m_config.serverConnectRequestRate > 0.0f )
+            {
+                m_trustedConnectFilter = (TrustedConnectFilterEntry*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( TrustedConnectFilterEntry ) * TrustedConnectFilterSize );
+                for ( int i = 0; i < TrustedConnectFilterSize; ++i )
+                {
+                    m_trustedConnectFilter[i].address = Address();
+                    m_trustedConnectFilter[i].tokens = 0.0f;
+                    m_trustedConnectFilter[i].lastTime = 0.0;
+                }
+            }
+            if ( m_config.serverReceiveBatchSize > 0 )
+            {
+                m_trustedReceiveBatchBuffer = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), TrustedReceiveBatchSize * TrustedMaxPacketBytes );
+                m_trustedReceiveBatchFrom = (Address*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( Address ) * TrustedReceiveBatchSize );
+                for ( int i = 0; i < TrustedReceiveBatchSize; ++i )
+                    m_trustedReceiveBatchFrom[i] = Address();
+            }
+        }
+        else
+        {
+            char addressString[MaxAddressLength];
+            m_address.ToString( addressString, MaxAddressLength );
+            // serverParallelTransportSend has worker threads call netcode_server_send_packet on this server at once. that is only safe while netcode.io
+            // sends with a bare sendto and per-client state, so the server must not be created with a netcode.io network simulator or send override
+            const bool netcodeSendOverridden = false;
+            yojimbo_assert( !m_config.serverParallelTransportSend || !netcodeSendOverridden );
+            (void) netcodeSendOverridden;
+            m_server = netcode_server_create_with_allocator( addressString, m_config.protocolId, m_privateKey, GetTime(), &GetGlobalAllocator(), StaticAllocateFunction, StaticFreeFunction );
+            if ( !m_server )
+            {
+                Stop();
+                return;
+            }
+        }
+        m_packetBufferMemory = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), m_config.maxPacketSize + CacheLineBytes - 1 );
+        m_packetBuffer = (uint8_t*) ( ( uintptr_t( m_packetBufferMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
+        if ( m_config.networkSimulator )
+        {
+            m_simulatorPacketData = (uint8_t**) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( uint8_t* ) * m_config.maxSimulatorPackets );
+            m_simulatorPacketBytes = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.maxSimulatorPackets );
+            m_simulatorPacketTo = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.maxSimulatorPackets );
+        }
+        m_clientNextSendTime = (double*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( double ) * maxClients );
+        yojimbo_assert( m_clientNextSendTime );
+        for ( int i = 0; i < maxClients; ++i )
+        {
+            m_clientNextSendTime[i] = 0.0;
+        }
+        if ( m_config.serverParallelSend )
+        {
+            m_parallelPacketMemory = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), m_config.maxPacketSize * maxClients );
+        }
+        if ( m_config.serverParallelSend || m_config.serverParallelReceive )
+        {
+            m_parallelClientIndex = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * maxClients );
+            m_parallelPacketSequence = (uint16_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( uint16_t ) * maxClients );
+            m_parallelPacketBytes = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * maxClients );
+            m_parallelRunStart = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * maxClients );
+            m_parallelRunCount = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * maxClients );
+        }
+        if ( m_config.serverReceiveBatchSize > 0 )
+        {
+            m_receiveBatchPacketData = (uint8_t**) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( uint8_t* ) * m_config.serverReceiveBatchSize );
+            m_receiveBatchPacketBytes = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverReceiveBatchSize );
+            m_receiveBatchClientIndex = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverReceiveBatchSize );
+        }
+        // netcode.io sends one packet per call however they are collected, so without a parallel flush the batch would only add a copy per packet
+        if ( m_config.serverSendBatchSize > 0 && m_config.serverSendBatchBytes > 0 && ( m_socket || m_config.serverParallelTransportSend ) )
+        {
+            m_sendBatchBuffer = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), m_config.serverSendBatchBytes );
+            m_sendBatchPacketData = (uint8_t**) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( uint8_t* ) * m_config.serverSendBatchSize );
+            m_sendBatchPacketBytes = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverSendBatchSize );
+            m_sendBatchClientIndex = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverSendBatchSize );
+            if ( m_socket )
+            {
+                m_sendBatchAddress = (Address*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( Address ) * m_config.serverSendBatchSize );
+                for ( int i = 0; i < m_config.serverSendBatchSize; ++i )
+                    m_sendBatchAddress[i] = Address();
+            }
+            if ( m_config.serverParallelTransportSend )
+            {
+                m_sendBatchRunStart = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverSendBatchSize );
+                m_sendBatchRunCount = (int*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), sizeof( int ) * m_config.serverSendBatchSize );
+            }
+        }
+        m_sendBatchNumPackets = 0;
+        m_sendBatchNumBytes = 0;
+        if ( m_server )
+        {
+            netcode_server_connect_disconnect_callback( m_server, this, StaticConnectDisconnectCallbackFunction );
+            netcode_server_start( m_server, maxClients );
+        }
+        if ( m_config.checkMemory )
+        {
+            // everything the server keeps in global memory is allocated by now
+            CheckMemoryFootprint( "serverGlobalMemory", m_config.serverGlobalMemory, GetGlobalAllocator().GetBytesAllocated() );
+        }
+    }
+
+    void Server::Stop()
+    {
+        if ( m_server )
+        {
+            netcode_server_stop( m_server );
+            netcode_server_destroy( m_server );
+            m_server = NULL;
+        }
+        if ( m_trustedClients )
+        {
+            for ( int i = 0; i < GetMaxClients(); ++i )
+            {
+                if ( m_trustedClients[i].connected )
+                    DisconnectTrustedClient( i, true );
+            }
+            YOJIMBO_FREE( GetGlobalAllocator(), m_trustedClients );
+        }
+        YOJIMBO_FREE( GetGlobalAllocator(), m_trustedAddressIndex );
+        m_trustedAddressIndexSize = 0;
+        YOJIMBO_FREE( GetGlobalAllocator(), m_trustedConnectFilter );
+        YOJIMBO_FREE( GetGlobalAllocator(), m_trustedReceiveBatchBuffer );
+        YOJIMBO_FREE( GetGlobalAllocator(), m_trustedReceiveBatchFrom );
+        if ( m_socket )
+        {
+            YOJIMBO_DELETE( GetGlobalAllocator(), Socket, m_socket );
+        }
+        if ( IsRunning() )
+        {
+            m_packetBuffer = NULL;
+            YOJIMBO_FREE( GetGlobalAllocator(), m_packetBufferMemory );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_simulatorPacketData );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_simulatorPacketBytes );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_simulatorPacketTo );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_clientNextSendTime );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelPacketMemory );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelClientIndex );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelPacketSequence );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelPacketBytes );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelRunStart );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_parallelRunCount );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_receiveBatchPacketData );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_receiveBatchPacketBytes );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_receiveBatchClientIndex );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchBuffer );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchPacketData );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchPacketBytes );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchClientIndex );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchAddress );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchRunStart );
+            YOJIMBO_FREE( GetGlobalAllocator(), m_sendBatchRunCount );
+        }
+        BaseServer::Stop();
+    }
+
+    void Server::DisconnectClient( int clientIndex )
+    {
+        if ( IsLoopbackClient( clientIndex ) )
+        {
+            DisconnectLoopbackClient( clientIndex );
+            return;
+        }
+        if ( m_socket )
+        {
+            if ( m_trustedClients[clientIndex].connected )
+                DisconnectTrustedClient( clientIndex, true );
+            return;
+        }
+        yojimbo_assert( m_server );
+        netcode_server_disconnect_client( m_server, clientIndex );
+    }
+
+    void Server::DisconnectAllClients()
+    {
+        for ( int i = 0; i < GetMaxClients(); ++i )
+        {
+            DisconnectLoopbackClient( i );
+        }
+        if ( m_socket )
+        {
+            for ( int i = 0; i < GetMaxClients(); ++i )
+            {
+                if ( m_trustedClients[i].connected )
+                    DisconnectTrustedClient( i, true );
+            }
+            return;
+        }
+        yojimbo_assert( m_server );
+        netcode_server_disconnect_all_clients( m_server );
+    }
+
+    /// Times a server tick phase until the end of the scope, and reports it if it ran over budget. See Server::GetTickPhaseTime.
+
+    struct ServerTickPhaseTimer
+    {
+        Server & server;
+        int phase;
+        double startTime;
+
+        ServerTickPhaseTimer( Server & _server, int _phase ) : server( _server ), phase( _phase ), startTime( yojimbo_time() ) {}
+
+        ~ServerTickPhaseTimer()
+        {
+            const double phaseTime = yojimbo_time() - startTime;
+            server.m_tickPhaseTime[phase] = phaseTime;
+            if ( server.m_config.serverTickPhaseBudget > 0.0f && phaseTime > server.m_config.serverTickPhaseBudget )
+                server.ReportTickPhaseOverrun( phase );
+        }
+    };
+
+    void Server::ReportTickPhaseOverrun( int phase )
+    {
+        static const char * phaseNames[] = { "receive packets", "advance time", "send packets" };
+        yojimbo_assert( phase >= 0 && phase < SERVER_TICK_PHASE_NUM_PHASES );
+
+        TickOverrunReport report;
+        memset( &report, 0, sizeof( report ) );
+        report.phase = phase;
+        report.phaseTime = m_tickPhaseTime[phase];
+        report.budget = m_config.serverTickPhaseBudget;
+        report.time = GetTime();
+        report.numConnectedClients = GetNumConnectedClients();
+        report.clientIndex = -1;
+
+        ConnectionStats stats;
+        for ( int clientIndex = 0; clientIndex < GetMaxClients(); ++clientIndex )
+        {
+            if ( !IsClientConnected( clientIndex ) )
+                continue;
+            GetConnectionStats( clientIndex, stats );
+            int sendQueueDepth = 0;
+            int receiveQueueDepth = 0;
+            uint64_t numMessagesSent = 0;
+            uint64_t numMessagesReceived = 0;
+            for ( int channelIndex = 0; channelIndex < stats.numChannels; ++channelIndex )
+            {
+                const ChannelStats & channelStats = stats.channel[channelIndex];
+                sendQueueDepth += channelStats.sendQueueDepth;
+                receiveQueueDepth += channelStats.receiveQueueDepth;
+                numMessagesSent += channelStats.counters[CHANNEL_COUNTER_MESSAGES_SENT];
+                numMessagesReceived += channelStats.counters[CHANNEL_COUNTER_MESSAGES_RECEIVED];
+            }
+            report.totalSendQueueDepth += sendQueueDepth;
+            report.totalReceiveQueueDepth += receiveQueueDepth;
+            if ( report.clientIndex < 0 || sendQueueDepth + receiveQueueDepth > report.sendQueueDepth + report.receiveQueueDepth )
+            {
+                report.clientIndex = clientIndex;
+                report.sendQueueDepth = sendQueueDepth;
+                report.receiveQueueDepth = receiveQueueDepth;
+                report.numMessagesSent = numMessagesSent;
+                report.numMessagesReceived = numMessagesReceived;
+            }
+        }
+
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "server %s took %.2fms, over the %.2fms budget. %d clients, %d messages queued to send, %d to receive. busiest client %d: %d to send, %d to receive\n",
+            phaseNames[phase], report.phaseTime * 1000.0, report.budget * 1000.0, report.numConnectedClients, report.totalSendQueueDepth, report.totalReceiveQueueDepth,
+            report.clientIndex, report.sendQueueDepth, report.receiveQueueDepth );
+
+        GetAdapter().OnTickPhaseOverrun( report );
+    }
+
+    void Server::SendPackets()
+    {
+        YOJIMBO_PROFILE_SCOPE( "Server::SendPackets" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Server::SendPackets" );
+        ServerTickPhaseTimer phaseTimer( *this, SERVER_TICK_PHASE_SEND_PACKETS );
+        SendSubmittedMessages();
+        if ( m_server || m_socket )
+        {
+            m_sendBatchActive = m_sendBatchBuffer != NULL;
+            if ( m_parallelPacketMemory )
+            {
+                SendPacketsParallel();
+            }
+            else
+            {
+                SendPacketsSerial();
+            }
+            if ( m_sendBatchActive )
+            {
+                FlushSendBatch();
+                m_sendBatchActive = false;
+            }
+            if ( m_config.serverSendPacingSlices > 1 )
+            {
+                m_sendPacingSlice = ( m_sendPacingSlice + 1 ) % m_config.serverSendPacingSlices;
+            }
+        }
+    }
+
+    bool Server::IsClientInSendPacingSlice( int clientIndex ) const
+    {
+        if ( m_config.serverSendPacingSlices <= 1 )
+            return true;
+        return ( clientIndex % m_config.serverSendPacingSlices ) == m_sendPacingSlice;
+    }
+
+    bool Server::IsClientSendDue( int clientIndex )
+    {
+        if ( !IsClientInSendPacingSlice( clientIndex ) )
+            return false;
+        const float sendRate = GetClientSendRate( clientIndex );
+        double interval = sendRate > 0.0f ? 1.0 / sendRate : m_config.serverSendInterval;
+        if ( IsOverloadStepApplied( SERVER_OVERLOAD_STEP_LOW_PRIORITY_SEND_RATE ) && IsClientLowPriority( clientIndex ) )
+            interval = yojimbo_max( interval, 1.0 / m_config.serverOverloadSendRate );
+        if ( interval <= 0.0 )
+            return true;
+        // a send time more than one interval away was set before the rate went up, so it is replaced straight away
+        const double time = GetTime();
+        if ( time < m_clientNextSendTime[clientIndex] && m_clientNextSendTime[clientIndex] - time <= interval )
+            return false;
+        // the next send time is recomputed from the client phase each time, so late SendPackets calls don't drift the slots
+        const double phase = interval * clientIndex / GetMaxClients();
+        m_clientNextSendTime[clientIndex] = ( floor( ( time - phase ) / interval ) + 1.0 ) * interval + phase;
+        return true;
+    }
+
+    void Server::SendPacketsSerial()
+    {
+        const int numActiveClients = GetNumActiveClients();
+        for ( int activeIndex = 0; activeIndex < numActiveClients; ++activeIndex )
+        {
+            const int i = GetActiveClientIndex( activeIndex );
+            if ( !IsClientSendDue( i ) )
+                continue;
+            PrefetchActiveClient( activeIndex + 1 );
+            reliable_endpoint_t * endpoint = GetActiveClientEndpoint( activeIndex );
+            uint8_t * packetData = m_packetBuffer;
+            int packetBytes;
+            uint16_t packetSequence = reliable_endpoint_next_packet_sequence( endpoint );
+            if ( GetActiveClientConnection( activeIndex ).GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
+            {
+                reliable_endpoint_send_packet( endpoint, packetData, packetBytes );
+            }
+        }
+    }
+
+    void Server::SendPacketsParallel()
+    {
+        // Packet generation only touches per-client state (connection, message factory and allocator), so it can run in parallel across clients.
+        // Sending goes through the reliable endpoints, the network simulator and the transport, so that happens afterwards on this thread.
+        yojimbo_assert( m_parallelPacketMemory );
+        const int numActiveClients = GetNumActiveClients();
+        m_parallelNumClients = 0;
+        for ( int activeIndex = 0; activeIndex < numActiveClients; ++activeIndex )
+        {
+            const int i = GetActiveClientIndex( activeIndex );
+            if ( !IsClientSendDue( i ) )
+                continue;
+            m_parallelClientIndex[m_parallelNumClients] = i;
+            m_parallelPacketSequence[m_parallelNumClients] = reliable_endpoint_next_packet_sequence( GetActiveClientEndpoint( activeIndex ) );
+            m_parallelPacketBytes[m_parallelNumClients] = 0;
+            m_parallelNumClients++;
+        }
+        GetAdapter().ParallelFor( m_parallelNumClients, StaticGeneratePacketFunction, this );
+        for ( int i = 0; i < m_parallelNumClients; ++i )
+        {
+            if ( m_parallelPacketBytes[i] > 0 )
+            {
+                const int clientIndex = m_parallelClientIndex[i];
+                uint8_t * packetData = m_parallelPacketMemory + clientIndex * m_config.maxPacketSize;
+                reliable_endpoint_send_packet( GetClientEndpoint( clientIndex ), packetData, m_parallelPacketBytes[i] );
+            }
+        }
+    }
+
+    void Server::StaticGeneratePacketFunction( void * context, int index )
+    {
+        Server * server = (Server*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < server->m_parallelNumClients );
+        const int clientIndex = server->m_parallelClientIndex[index];
+        const int maxPacketSize = server->m_config.maxPacketSize;
+        uint8_t * packetData = server->m_parallelPacketMemory + clientIndex * maxPacketSize;
+        int packetBytes;
+        if ( server->GetClientConnection( clientIndex ).GeneratePacket( server->GetContext(), server->m_parallelPacketSequence[index], packetData, maxPacketSize, packetBytes ) )
+        {
+            server->m_parallelPacketBytes[index] = packetBytes;
+        }
+    }
+
+    void Server::FlushSendBatch()
+    {
+        YOJIMBO_PROFILE_SCOPE( "Server::FlushSendBatch" );
+        yojimbo_assert( m_server || m_socket );
+
+        if ( m_socket )
+        {
+            // trusted packets aren't encrypted, so the whole batch goes to the socket in as few system calls as it can
+
+            const int numSent = m_socket->SendPackets( m_sendBatchAddress, m_sendBatchPacketData, m_sendBatchPacketBytes, m_sendBatchNumPackets );
+            if ( numSent < m_sendBatchNumPackets )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to send %d trusted packets\n", m_sendBatchNumPackets - numSent );
+            }
+            m_sendBatchNumPackets = 0;
+            m_sendBatchNumBytes = 0;
+            return;
+        }
+
+        // each packet is still encrypted on its own inside netcode_server_send_packet. a batched encrypt belongs here once netcode.io has one.
+
+        if ( m_sendBatchRunStart && m_sendBatchNumPackets > 1 )
+        {
+            // Encryption keys and packet sequence numbers are per-client in netcode.io, so clients can be sent in parallel.
+            // Packets are transmitted one client at a time, so each client's packets form one contiguous run in the batch.
+            m_sendBatchNumRuns = 0;
+            for ( int i = 0; i < m_sendBatchNumPackets; ++i )
+            {
+                if ( i == 0 || m_sendBatchClientIndex[i] != m_sendBatchClientIndex[i-1] )
+                {
+                    m_sendBatchRunStart[m_sendBatchNumRuns] = i;
+                    m_sendBatchRunCount[m_sendBatchNumRuns] = 0;
+                    m_sendBatchNumRuns++;
+                }
+                m_sendBatchRunCount[m_sendBatchNumRuns-1]++;
+            }
+            GetAdapter().ParallelFor( m_sendBatchNumRuns, StaticSendBatchFunction, this );
+        }
+        else
+        {
+            for ( int i = 0; i < m_sendBatchNumPackets; ++i )
+            {
+                netcode_server_send_packet( m_server, m_sendBatchClientIndex[i], m_sendBatchPacketData[i], m_sendBatchPacketBytes[i] );
+            }
+        }
+        m_sendBatchNumPackets = 0;
+        m_sendBatchNumBytes = 0;
+    }
+
+    void Server::StaticSendBatchFunction( void * context, int index )
+    {
+        Server * server = (Server*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < server->m_sendBatchNumRuns );
+        const int start = server->m_sendBatchRunStart[index];
+        const int finish = start + server->m_sendBatchRunCount[index];
+        for ( int i = start; i < finish; ++i )
+        {
+            yojimbo_assert( server->m_sendBatchClientIndex[i] == server->m_sendBatchClientIndex[start] );
+            netcode_server_send_packet( server->m_server, server->m_sendBatchClientIndex[i], server->m_sendBatchPacketData[i], server->m_sendBatchPacketBytes[i] );
+        }
+    }
+
+    void Server::ReceivePackets()
+    {
+        YOJIMBO_PROFILE_SCOPE( "Server::ReceivePackets" );
+        YOJIMBO_STEADY_STATE_SCOPE( "Server::ReceivePackets" );
+        ServerTickPhaseTimer phaseTimer( *this, SERVER_TICK_PHASE_RECEIVE_PACKETS );
+        ReceiveLoopbackPackets();
+        if ( m_socket )
+        {
+            ReceiveTrustedPackets();
+        }
+        else if ( m_server )
+        {
+            if ( m_receiveBatchPacketData )
+            {
+                ReceivePacketsBatched();
+                return;
+            }
+            const int numActiveClients = GetNumActiveClients();
+            for ( int activeIndex = 0; activeIndex < numActiveClients; ++activeIndex )
+            {
+                const int clientIndex = GetActiveClientIndex( activeIndex );
+                reliable_endpoint_t * endpoint = GetActiveClientEndpoint( activeIndex );
+                while ( true )
+                {
+                    int packetBytes;
+                    uint64_t packetSequence;
+                    uint8_t * packetData = netcode_server_receive_packet( m_server, clientIndex, &packetBytes, &packetSequence );
+                    if ( !packetData )
+                        break;
+                    if ( FilterClientPacket( clientIndex, packetBytes ) )
+                        reliable_endpoint_receive_packet( endpoint, packetData, packetBytes );
+                    netcode_server_free_packet( m_server, packetData );
+                }
+            }
+        }
+    }
+
+    void Server::ReceivePacketsBatched()
+    {
+        // Drain packets from the transport for all clients first, then dispatch the whole batch to the client endpoints.
+        // This keeps transport work and connection processing in separate tight loops, instead of interleaving them per-packet.
+        yojimbo_assert( m_server );
+        yojimbo_assert( m_receiveBatchPacketData );
+        const int numActiveClients = GetNumActiveClients();
+        const int batchSize = m_config.serverReceiveBatchSize;
+        int activeIndex = 0;
+        while ( activeIndex < numActiveClients )
+        {
+            int numPackets = 0;
+            while ( activeIndex < numActiveClients && numPackets < batchSize )
+            {
+                const int clientIndex = GetActiveClientIndex( activeIndex );
+                int packetBytes;
+                uint64_t packetSequence;
+                uint8_t * packetData = netcode_server_receive_packet( m_server, clientIndex, &packetBytes, &packetSequence );
+                if ( !packetData )
+                {
+                    activeIndex++;
+                    continue;
+                }
+                if ( !FilterClientPacket( clientIndex, packetBytes ) )
+                {
+                    netcode_server_free_packet( m_server, packetData );
+                    continue;
+                }
+                m_receiveBatchPacketData[numPackets] = packetData;
+                m_receiveBatchPacketBytes[numPackets] = packetBytes;
+                m_receiveBatchClientIndex[numPackets] = clientIndex;
+                numPackets++;
+            }
+            if ( m_config.serverParallelReceive )
+            {
+                // Packets are drained one client at a time, so each client's packets form one contiguous run in the batch.
+                m_parallelNumClients = 0;
+                for ( int i = 0; i < numPackets; ++i )
+                {
+                    if ( i == 0 || m_receiveBatchClientIndex[i] != m_receiveBatchClientIndex[i-1] )
+                    {
+                        yojimbo_assert( m_parallelNumClients < GetMaxClients() );
+                        m_parallelClientIndex[m_parallelNumClients] = m_receiveBatchClientIndex[i];
+                        m_parallelRunStart[m_parallelNumClients] = i;
+                        m_parallelRunCount[m_parallelNumClients] = 0;
+                        m_parallelNumClients++;
+                    }
+                    m_parallelRunCount[m_parallelNumClients-1]++;
+                }
+                GetAdapter().ParallelFor( m_parallelNumClients, StaticProcessPacketsFunction, this );
+            }
+            else
+            {
+                for ( int i = 0; i < numPackets; ++i )
+                {
+                    reliable_endpoint_receive_packet( GetClientEndpoint( m_receiveBatchClientIndex[i] ), m_receiveBatchPacketData[i], m_receiveBatchPacketBytes[i] );
+                }
+            }
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                netcode_server_free_packet( m_server, m_receiveBatchPacketData[i] );
+            }
+        }
+    }
+
+    void Server::StaticProcessPacketsFunction( void * context, int index )
+    {
+        Server * server = (Server*) context;
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < server->m_parallelNumClients );
+        reliable_endpoint_t * endpoint = server->GetClientEndpoint( server->m_parallelClientIndex[index] );
+        const int start = server->m_parallelRunStart[index];
+        const int finish = start + server->m_parallelRunCount[index];
+        for ( int i = start; i < finish; ++i )
+        {
+            yojimbo_assert( server->m_receiveBatchClientIndex[i] == server->m_parallelClientIndex[index] );
+            reliable_endpoint_receive_packet( endpoint, server->m_receiveBatchPacketData[i], server->m_receiveBatchPacketBytes[i] );
+        }
+    }
+
+    void Server::AdvanceTime( double time )
+    {
+        ServerTickPhaseTimer phaseTimer( *this, SERVER_TICK_PHASE_ADVANCE_TIME );
+        UpdateOverload( m_tickPhaseTime[SERVER_TICK_PHASE_RECEIVE_PACKETS] + m_tickPhaseTime[SERVER_TICK_PHASE_ADVANCE_TIME] + m_tickPhaseTime[SERVER_TICK_PHASE_SEND_PACKETS] );
+        if ( m_server )
+        {
+            YOJIMBO_PROFILE_SCOPE( "netcode_server_update" );
+            netcode_server_update( m_server, time );
+        }
+        BaseServer::AdvanceTime( time );
+        if ( m_socket )
+        {
+            UpdateTrustedClients();
+        }
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
+        {
+            yojimbo_assert( m_simulatorPacketData );
+            uint8_t ** packetData = m_simulatorPacketData;
+            int * packetBytes = m_simulatorPacketBytes;
+            int * to = m_simulatorPacketTo;
+            int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, to );
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                if ( IsLoopbackClient( to[i] ) )
+                    SendLoopbackPacket( to[i], packetData[i], packetBytes[i] );
+                else if ( m_socket )
+                    SendTrustedClientPayload( to[i], packetData[i], packetBytes[i] );
+                else
+                    netcode_server_send_packet( m_server, to[i], (uint8_t*) packetData[i], packetBytes[i] );
+                networkSimulator->ReleasePacket( packetData[i] );
+            }
+        }
+    }
+
+    bool Server::IsClientConnected( int clientIndex ) const
+    {
+        if ( IsLoopbackClient( clientIndex ) )
+            return true;
+        if ( m_socket )
+            return m_trustedClients[clientIndex].connected;
+        return netcode_server_client_connected( m_server, clientIndex ) != 0;
+    }
+
+    int Server::GetNumConnectedClients() const
+    {
+        if ( m_socket )
+            return m_numTrustedClients + GetNumLoopbackClients();
+        return netcode_server_num_connected_clients( m_server ) + GetNumLoopbackClients();
+    }
+
+    double Server::GetNextEventTime() const
+    {
+        double nextEventTime = BaseServer::GetNextEventTime();
+        if ( m_server && netcode_server_num_connected_clients( m_server ) > 0 )
+        {
+            // netcode.io sends keep-alives and times out clients in netcode_server_update, 10 times a second
+            nextEventTime = yojimbo_min( nextEventTime, GetTime() + 0.1 );
+        }
+        if ( m_socket && m_numTrustedClients > 0 )
+        {
+            nextEventTime = yojimbo_min( nextEventTime, GetTime() + TrustedKeepAliveInterval );
+        }
+        return nextEventTime;
+    }
+
+    void Server::TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        YOJIMBO_PROFILE_SCOPE( "Server::TransmitPacketFunction" );
+        (void) packetSequence;
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
+        {
+            // loopback packets go through the simulator too, so in-process tests see the same latency and loss as real clients
+            networkSimulator->SendPacket( clientIndex, packetData, packetBytes );
+        }
+        else if ( IsLoopbackClient( clientIndex ) )
+        {
+            SendLoopbackPacket( clientIndex, packetData, packetBytes );
+        }
+        else if ( m_socket )
+        {
+            SendTrustedClientPayload( clientIndex, packetData, packetBytes );
+        }
+        else if ( m_sendBatchActive )
+        {
+            if ( m_sendBatchNumPackets == m_config.serverSendBatchSize || m_sendBatchNumBytes + packetBytes > m_config.serverSendBatchBytes )
+            {
+                FlushSendBatch();
+            }
+            if ( packetBytes > m_config.serverSendBatchBytes )
+            {
+                netcode_server_send_packet( m_server, clientIndex, packetData, packetBytes );
+                return;
+            }
+            uint8_t * batchPacketData = m_sendBatchBuffer + m_sendBatchNumBytes;
+            memcpy( batchPacketData, packetData, packetBytes );
+            m_sendBatchPacketData[m_sendBatchNumPackets] = batchPacketData;
+            m_sendBatchPacketBytes[m_sendBatchNumPackets] = packetBytes;
+            m_sendBatchClientIndex[m_sendBatchNumPackets] = clientIndex;
+            m_sendBatchNumPackets++;
+            m_sendBatchNumBytes += packetBytes;
+        }
+        else
+        {
+            netcode_server_send_packet( m_server, clientIndex, packetData, packetBytes );
+        }
+    }
+
+    int Server::ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        return (int) GetClientConnection(clientIndex).ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+    }
+
+    void Server::ConnectDisconnectCallbackFunction( int clientIndex, int connected )
+    {
+        if ( IsLoopbackClient( clientIndex ) )
+        {
+            // netcode.io doesn't know about loopback clients, so it can hand out their slot when every other slot is full
+            if ( connected )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client slot %d is taken by a loopback client. disconnecting client\n", clientIndex );
+                netcode_server_disconnect_client( m_server, clientIndex );
+            }
+        }
+        else if ( connected )
+        {
+            if ( !AdmitClient( clientIndex ) )
+            {
+                netcode_server_disconnect_client( m_server, clientIndex );
+                return;
+            }
+            CreateClientConnection( clientIndex, GetAdapter().IsSpectator( clientIndex ) );
+            AddActiveClient( clientIndex );
+        }
+        else if ( GetClientEndpoint( clientIndex ) )
+        {
+            RemoveActiveClient( clientIndex );
+            reliable_endpoint_reset( GetClientEndpoint( clientIndex ) );
+            GetClientConnection( clientIndex ).Reset();
+            NetworkSimulator * networkSimulator = GetNetworkSimulator();
+            if ( networkSimulator && networkSimulator->IsActive() )
+            {
+                networkSimulator->DiscardClientPackets( clientIndex );
+            }
+        }
+    }
+
+    void Server::StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected )
+    {
+        Server * server = (Server*) context;
+        server->ConnectDisconnectCallbackFunction( clientIndex, connected );
+    }
+
+    int Server::FindTrustedClient( const Address & address ) const
+    {
+        yojimbo_assert( m_trustedAddressIndex );
+        const int entry = m_trustedAddressIndex[FindTrustedAddressSlot( address )];
+        return entry >= 0 ? entry / 2 : -1;
+    }
+
+    int Server::FindTrustedAddressSlot( const Address & address ) const
+    {
+        // linear probing. returns the slot holding the address, or the empty slot it would go in
+
+        const int mask = m_trustedAddressIndexSize - 1;
+        int slot = (int) ( address.GetHash() & uint64_t( mask ) );
+        while ( m_trustedAddressIndex[slot] >= 0 && GetTrustedEntryAddress( m_trustedAddressIndex[slot] ) != address )
+        {
+            slot = ( slot + 1 ) & mask;
+        }
+        return slot;
+    }
+
+    const Address & Server::GetTrustedEntryAddress( int entry ) const
     {
-        yojimbo_assert( KeyBytes == NETCODE_KEY_BYTES );
-        memcpy( m_privateKey, privateKey, NETCODE_KEY_BYTES );
-        m_address = address;
-        m_config = config;
-        m_server = NULL;
+        const TrustedClient & client = m_trustedClients[entry / 2];
+        return ( entry & 1 ) ? client.secondaryAddress : client.address;
     }
 
-    Server::~Server()
+    void Server::AddTrustedAddress( int clientIndex, int path )
     {
-        // IMPORTANT: Please stop the server before destroying it!
-        yojimbo_assert( !m_server );
+        const int slot = FindTrustedAddressSlot( GetTrustedEntryAddress( clientIndex * 2 + path ) );
+        yojimbo_assert( m_trustedAddressIndex[slot] < 0 );
+        m_trustedAddressIndex[slot] = clientIndex * 2 + path;
     }
 
-    void Server::Start( int maxClients )
+    void Server::RemoveTrustedAddress( int clientIndex, int path )
     {
-        if ( IsRunning() )
-            Stop();
-        BaseServer::Start( maxClients );
-        char addressString[MaxAddressLength];
-        m_address.ToString( addressString, MaxAddressLength );
-        m_server = netcode_server_create_with_allocator( addressString, m_config.protocolId, m_privateKey, GetTime(), &GetGlobalAllocator(), StaticAllocateFunction, StaticFreeFunction );
-        if ( !m_server )
+        int slot = FindTrustedAddressSlot( GetTrustedEntryAddress( clientIndex * 2 + path ) );
+        yojimbo_assert( m_trustedAddressIndex[slot] == clientIndex * 2 + path );
+        m_trustedAddressIndex[slot] = -1;
+
+        // shift later entries of the probe run back into the hole, so lookups never stop short of them
+
+        const int mask = m_trustedAddressIndexSize - 1;
+        int next = slot;
+        while ( true )
         {
-            Stop();
-            return;
+            next = ( next + 1 ) & mask;
+            const int entry = m_trustedAddressIndex[next];
+            if ( entry < 0 )
+                break;
+            const int home = (int) ( GetTrustedEntryAddress( entry ).GetHash() & uint64_t( mask ) );
+            const bool movable = ( next > slot ) ? ( home <= slot || home > next ) : ( home <= slot && home > next );
+            if ( movable )
+            {
+                m_trustedAddressIndex[slot] = entry;
+                m_trustedAddressIndex[next] = -1;
+                slot = next;
+            }
         }
-        netcode_server_connect_disconnect_callback( m_server, this, StaticConnectDisconnectCallbackFunction );
-        netcode_server_start( m_server, maxClients );
     }
 
-    void Server::Stop()
+    int Server::AddTrustedPath( const Address & from, uint64_t clientId )
     {
-        if ( m_server )
+        for ( int i = 0; i < GetMaxClients(); ++i )
         {
-            netcode_server_stop( m_server );
-            netcode_server_destroy( m_server );
-            m_server = NULL;
+            TrustedClient & client = m_trustedClients[i];
+            if ( !client.connected || client.suspended || client.clientId != clientId )
+                continue;
+
+            // a client that moved its second interface to a new address replaces the old path
+
+            if ( client.secondaryAddress.IsValid() )
+                RemoveTrustedAddress( i, 1 );
+
+            client.secondaryAddress = from;
+            client.secondaryLastPacketSendTime = GetTime();
+            client.pathReceiveTime[1] = GetTime();
+            AddTrustedAddress( i, 1 );
+
+            char addressString[MaxAddressLength];
+            from.ToString( addressString, MaxAddressLength );
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d added path from %s\n", i, addressString );
+
+            return i;
         }
-        BaseServer::Stop();
+        return -1;
     }
 
-    void Server::DisconnectClient( int clientIndex )
+    bool Server::IsTrustedPathUp( int clientIndex, int path ) const
     {
-        yojimbo_assert( m_server );
-        netcode_server_disconnect_client( m_server, clientIndex );
+        const TrustedClient & client = m_trustedClients[clientIndex];
+        if ( path == 1 && !client.secondaryAddress.IsValid() )
+            return false;
+        return client.pathReceiveTime[path] + TrustedPathTimeout >= GetTime();
     }
 
-    void Server::DisconnectAllClients()
+    void Server::SendTrustedPacket( const Address & address, const uint8_t * packetData, int packetBytes )
     {
-        yojimbo_assert( m_server );
-        netcode_server_disconnect_all_clients( m_server );
+        yojimbo_assert( m_socket );
+        if ( !m_socket->SendPacket( address, packetData, packetBytes ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to send trusted packet (%d bytes)\n", packetBytes );
+        }
     }
 
-    void Server::SendPackets()
+    void Server::SendTrustedClientPayload( int clientIndex, const uint8_t * packetData, int packetBytes )
     {
-        if ( m_server )
+        const TrustedClient & client = m_trustedClients[clientIndex];
+
+        if ( !client.secondaryAddress.IsValid() )
         {
-            const int maxClients = GetMaxClients();
-            for ( int i = 0; i < maxClients; ++i )
+            SendTrustedClientPacket( clientIndex, TRUSTED_PACKET_PAYLOAD, packetData, packetBytes );
+            return;
+        }
+
+        // urgent data goes over every path that is up. the rest goes over one, preferring the first
+
+        const bool pathUp[2] = { IsTrustedPathUp( clientIndex, 0 ), IsTrustedPathUp( clientIndex, 1 ) };
+
+        if ( GetClientConnection( clientIndex ).IsLastPacketUrgent() && pathUp[0] && pathUp[1] )
+        {
+            SendTrustedClientPacket( clientIndex, TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, 0 );
+            SendTrustedClientPacket( clientIndex, TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, 1 );
+            return;
+        }
+
+        int path = ( !pathUp[0] && pathUp[1] ) ? 1 : 0;
+
+        if ( m_config.trustedMultipathBalance && pathUp[0] && pathUp[1] )
+        {
+            path = client.nextPath;
+            m_trustedClients[clientIndex].nextPath = path ^ 1;
+        }
+
+        SendTrustedClientPacket( clientIndex, TRUSTED_PACKET_PAYLOAD, packetData, packetBytes, path );
+    }
+
+    void Server::SendTrustedClientPacket( int clientIndex, TrustedPacketType type, const uint8_t * packetData, int packetBytes, int path )
+    {
+        yojimbo_assert( m_trustedClients );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < GetMaxClients() );
+        yojimbo_assert( packetBytes >= 0 );
+        yojimbo_assert( path == 0 || path == 1 );
+        TrustedClient & client = m_trustedClients[clientIndex];
+        if ( !client.connected || client.suspended )
+            return;
+        const Address & address = path ? client.secondaryAddress : client.address;
+        double & lastPacketSendTime = path ? client.secondaryLastPacketSendTime : client.lastPacketSendTime;
+        if ( TrustedPacketHeaderBytes + packetBytes > TrustedMaxPacketBytes )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: trusted packet too large (%d bytes)\n", packetBytes );
+            return;
+        }
+        const int framedBytes = TrustedPacketHeaderBytes + packetBytes;
+        if ( m_sendBatchActive )
+        {
+            if ( m_sendBatchNumPackets == m_config.serverSendBatchSize || m_sendBatchNumBytes + framedBytes > m_config.serverSendBatchBytes )
             {
-                if ( IsClientConnected( i ) )
-                {
-                    // todo: we don't want to allocate this on the stack, as packet size can be larger than that now
-                    uint8_t * packetData = (uint8_t*) alloca( m_config.maxPacketSize );
-                    int packetBytes;
-                    uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetClientEndpoint(i) );
-                    if ( GetClientConnection(i).GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
-                    {
-                        reliable_endpoint_send_packet( GetClientEndpoint(i), packetData, packetBytes );
-                    }
-                }
+                FlushSendBatch();
+            }
+            if ( framedBytes <= m_config.serverSendBatchBytes )
+            {
+                uint8_t * batchPacketData = m_sendBatchBuffer + m_sendBatchNumBytes;
+                batchPacketData[0] = (uint8_t) type;
+                if ( packetBytes > 0 )
+                    memcpy( batchPacketData + TrustedPacketHeaderBytes, packetData, packetBytes );
+                m_sendBatchPacketData[m_sendBatchNumPackets] = batchPacketData;
+                m_sendBatchPacketBytes[m_sendBatchNumPackets] = framedBytes;
+                m_sendBatchClientIndex[m_sendBatchNumPackets] = clientIndex;
+                m_sendBatchAddress[m_sendBatchNumPackets] = address;
+                m_sendBatchNumPackets++;
+                m_sendBatchNumBytes += framedBytes;
+                lastPacketSendTime = GetTime();
+                return;
             }
         }
+        // the payload is usually the reliable endpoint's own transmit buffer. send the header in front of it without copying it
+        const uint8_t header = (uint8_t) type;
+        if ( !m_socket->SendPacket( address, &header, TrustedPacketHeaderBytes, packetData, packetBytes ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to send trusted packet (%d bytes)\n", framedBytes );
+        }
+        lastPacketSendTime = GetTime();
     }
 
-    void Server::ReceivePackets()
+    void Server::ReceiveTrustedPackets()
     {
-        if ( m_server )
+        yojimbo_assert( m_socket );
+        m_trustedConnectRequestsThisTick = 0;
+        m_trustedProbesThisTick = 0;
+        if ( m_trustedReceiveBatchBuffer )
         {
-            const int maxClients = GetMaxClients();
-            for ( int clientIndex = 0; clientIndex < maxClients; ++clientIndex )
+            // drain the socket a batch at a time, so a busy server makes one recvmmsg call per batch instead of one recvfrom per packet
+            yojimbo_assert( m_receiveBatchPacketData );
+            const int batchSize = yojimbo_min( m_config.serverReceiveBatchSize, TrustedReceiveBatchSize );
+            for ( int i = 0; i < batchSize; ++i )
+                m_receiveBatchPacketData[i] = m_trustedReceiveBatchBuffer + i * TrustedMaxPacketBytes;
+            while ( true )
             {
-                while ( true )
-                {
-                    int packetBytes;
-                    uint64_t packetSequence;
-                    uint8_t * packetData = netcode_server_receive_packet( m_server, clientIndex, &packetBytes, &packetSequence );
-                    if ( !packetData )
-                        break;
-                    reliable_endpoint_receive_packet( GetClientEndpoint( clientIndex ), packetData, packetBytes );
-                    netcode_server_free_packet( m_server, packetData );
-                }
+                const int numPackets = m_socket->ReceivePackets( m_trustedReceiveBatchFrom, m_receiveBatchPacketData, m_receiveBatchPacketBytes, TrustedMaxPacketBytes, batchSize );
+                for ( int i = 0; i < numPackets; ++i )
+                    ProcessTrustedPacket( m_trustedReceiveBatchFrom[i], m_receiveBatchPacketData[i], m_receiveBatchPacketBytes[i] );
+                if ( numPackets < batchSize )
+                    break;
             }
+            return;
+        }
+        while ( true )
+        {
+            Address from;
+            const int packetBytes = m_socket->ReceivePacket( from, m_trustedReceiveBuffer, TrustedMaxPacketBytes );
+            if ( packetBytes <= 0 )
+                break;
+            ProcessTrustedPacket( from, m_trustedReceiveBuffer, packetBytes );
         }
     }
 
-    void Server::AdvanceTime( double time )
+    void Server::ProcessTrustedPacket( const Address & from, uint8_t * packetData, int packetBytes )
     {
-        if ( m_server )
+        yojimbo_assert( packetBytes > 0 );
+
+        const uint8_t packetType = packetData[0];
+
+        if ( packetType == TRUSTED_PACKET_CONNECT_REQUEST )
         {
-            netcode_server_update( m_server, time );
+            ProcessTrustedConnectRequest( from, packetData, packetBytes );
+            return;
         }
-        BaseServer::AdvanceTime( time );
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator && networkSimulator->IsActive() )
+
+        if ( packetType == TRUSTED_PACKET_RESUME_REQUEST )
         {
-            uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
-            int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
-            int * to = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
-            int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, to );
-            for ( int i = 0; i < numPackets; ++i )
+            ProcessTrustedResumeRequest( from, packetData, packetBytes );
+            return;
+        }
+
+        if ( packetType == TRUSTED_PACKET_PROBE )
+        {
+            ProcessTrustedProbe( from, packetData, packetBytes );
+            return;
+        }
+
+        // everything else is only accepted from the address of a connected client
+
+        const int entry = m_trustedAddressIndex[FindTrustedAddressSlot( from )];
+        if ( entry < 0 )
+            return;
+
+        const int clientIndex = entry / 2;
+
+        m_trustedClients[clientIndex].lastPacketReceiveTime = GetTime();
+        m_trustedClients[clientIndex].pathReceiveTime[entry & 1] = GetTime();
+
+        if ( packetType == TRUSTED_PACKET_PAYLOAD && packetBytes > TrustedPacketHeaderBytes )
+        {
+            if ( !FilterClientPacket( clientIndex, packetBytes - TrustedPacketHeaderBytes ) )
+                return;
+            reliable_endpoint_receive_packet( GetClientEndpoint( clientIndex ), packetData + TrustedPacketHeaderBytes, packetBytes - TrustedPacketHeaderBytes );
+        }
+        else if ( packetType == TRUSTED_PACKET_PATH_PROBE )
+        {
+            ProcessTrustedPathProbe( clientIndex, entry & 1, packetData, packetBytes );
+        }
+        else if ( packetType == TRUSTED_PACKET_DISCONNECT )
+        {
+            DisconnectTrustedClient( clientIndex, false );
+        }
+    }
+
+    void Server::ProcessTrustedConnectRequest( const Address & from, const uint8_t * packetData, int packetBytes )
+    {
+        if ( packetBytes != TrustedConnectRequestBytes )
+            return;
+
+        uint64_t protocolId;
+        uint64_t clientId;
+        memcpy( &protocolId, packetData + 1, 8 );
+        memcpy( &clientId, packetData + 1 + 8, 8 );
+        protocolId = network_to_host( protocolId );
+        clientId = network_to_host( clientId );
+
+        if ( protocolId != m_config.protocolId )
+            return;
+
+        if ( !FilterTrustedConnectRequest( from ) )
+            return;
+
+        uint8_t auth[TrustedAuthBytes];
+        trusted_connect_auth( m_privateKey, protocolId, clientId, auth );
+        if ( crypto_verify_32( auth, packetData + 1 + 8 + 8 ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "trusted connect request failed auth\n" );
+            return;
+        }
+
+        // the client resends its request until it is accepted, so a client that is already connected just gets the accept again
+
+        int clientIndex = FindTrustedClient( from );
+
+        // with multipath, a request from a new address for a client that is already connected adds a second path to it
+
+        if ( clientIndex < 0 && m_config.trustedMultipath )
+            clientIndex = AddTrustedPath( from, clientId );
+
+        if ( clientIndex < 0 )
+        {
+            // a client that gave up resuming connects again from scratch. its suspended slot is no use to it
+
+            for ( int i = 0; i < GetMaxClients(); ++i )
+            {
+                if ( m_trustedClients[i].connected && m_trustedClients[i].suspended && m_trustedClients[i].clientId == clientId )
+                    DisconnectTrustedClient( i, false );
+            }
+
+            for ( int i = 0; i < GetMaxClients(); ++i )
             {
-                netcode_server_send_packet( m_server, to[i], (uint8_t*) packetData[i], packetBytes[i] );
-                YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
+                if ( !IsClientConnected( i ) )
+                {
+                    clientIndex = i;
+                    break;
+                }
+            }
+
+            if ( clientIndex < 0 || !AdmitClient( clientIndex ) )
+            {
+                const uint8_t denied = TRUSTED_PACKET_CONNECT_DENIED;
+                SendTrustedPacket( from, &denied, 1 );
+                return;
             }
+
+            TrustedClient & client = m_trustedClients[clientIndex];
+            client.connected = true;
+            client.address = from;
+            client.clientId = clientId;
+            client.secondaryAddress = Address();
+            client.lastPacketSendTime = GetTime();
+            client.lastPacketReceiveTime = GetTime();
+            client.secondaryLastPacketSendTime = GetTime();
+            client.pathReceiveTime[0] = GetTime();
+            client.pathReceiveTime[1] = GetTime();
+            client.nextPath = 0;
+            client.suspended = false;
+            random_bytes( (uint8_t*) &client.resumeTicket, 8 );
+            client.previousResumeTicket = client.resumeTicket;
+            AddTrustedAddress( clientIndex );
+            m_numTrustedClients++;
+
+            char addressString[MaxAddressLength];
+            from.ToString( addressString, MaxAddressLength );
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d connected from %s\n", clientIndex, addressString );
+
+            ConnectDisconnectCallbackFunction( clientIndex, 1 );
+
+            SetTrustedClientPathBytes( clientIndex, TrustedMinPathBytes );
         }
+
+        SendTrustedConnectAccepted( from, clientIndex );
     }
 
-    bool Server::IsClientConnected( int clientIndex ) const
+    void Server::ProcessTrustedProbe( const Address & from, const uint8_t * packetData, int packetBytes )
     {
-        return netcode_server_client_connected( m_server, clientIndex ) != 0;
+        if ( packetBytes != TrustedProbeBytes || m_trustedProbesThisTick >= m_config.serverProbeBudget )
+            return;
+
+        uint64_t protocolId;
+        memcpy( &protocolId, packetData + 1, 8 );
+        if ( network_to_host( protocolId ) != m_config.protocolId )
+            return;
+
+        m_trustedProbesThisTick++;
+
+        // the token goes back as is. the prober matches it to the probe and works out the RTT
+
+        uint8_t reply[TrustedProbeReplyBytes];
+        reply[0] = TRUSTED_PACKET_PROBE_REPLY;
+        memcpy( reply + 1, packetData + 1 + 8, 8 );
+        const uint32_t numConnectedClients = host_to_network( (uint32_t) GetNumConnectedClients() );
+        const uint32_t maxClients = host_to_network( (uint32_t) GetMaxClients() );
+        memcpy( reply + 1 + 8, &numConnectedClients, 4 );
+        memcpy( reply + 1 + 8 + 4, &maxClients, 4 );
+        SendTrustedPacket( from, reply, TrustedProbeReplyBytes );
     }
 
-    int Server::GetNumConnectedClients() const
+    void Server::ProcessTrustedPathProbe( int clientIndex, int path, const uint8_t * packetData, int packetBytes )
     {
-        return netcode_server_num_connected_clients( m_server );
+        if ( !m_config.trustedPathMtuDiscovery || path != 0 || packetBytes < TrustedPathProbeBytes || packetBytes > TrustedMaxPathBytes )
+            return;
+
+        uint16_t confirmedBytes;
+        memcpy( &confirmedBytes, packetData + 1, 2 );
+        confirmedBytes = network_to_host( confirmedBytes );
+
+        if ( confirmedBytes >= TrustedMinPathBytes && confirmedBytes <= TrustedMaxPathBytes && confirmedBytes != m_trustedClients[clientIndex].pathBytes )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "trusted client %d path carries %d bytes\n", clientIndex, confirmedBytes );
+            SetTrustedClientPathBytes( clientIndex, confirmedBytes );
+        }
+
+        if ( packetBytes == TrustedPathProbeBytes )
+            return;
+
+        // the ack is the same size as the probe, so one round trip confirms the size both ways. acks go to connected clients only, so this can't be used to amplify traffic
+
+        uint8_t ack[TrustedMaxPathBytes];
+        memset( ack, 0, packetBytes );
+        ack[0] = TRUSTED_PACKET_PATH_PROBE_ACK;
+        const uint16_t probeBytes = host_to_network( (uint16_t) packetBytes );
+        memcpy( ack + 1, &probeBytes, 2 );
+        SendTrustedPacket( m_trustedClients[clientIndex].address, ack, packetBytes );
     }
 
-    void Server::TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void Server::SetTrustedClientPathBytes( int clientIndex, int pathBytes )
     {
-        (void) packetSequence;
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator && networkSimulator->IsActive() )
+        if ( !m_config.trustedPathMtuDiscovery )
+            return;
+        m_trustedClients[clientIndex].pathBytes = pathBytes;
+        GetClientConnection( clientIndex ).SetPathPacketBytes( pathBytes - TrustedPacketHeaderBytes - TrustedReliableHeaderBytes );
+    }
+
+    int Server::GetClientPathBytes( int clientIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < GetMaxClients() );
+        if ( !m_trustedClients || !m_trustedClients[clientIndex].connected )
+            return 0;
+        return m_trustedClients[clientIndex].pathBytes;
+    }
+
+    void Server::ProcessTrustedResumeRequest( const Address & from, const uint8_t * packetData, int packetBytes )
+    {
+        if ( packetBytes != TrustedResumeRequestBytes || m_config.trustedResumeTime <= 0.0f )
+            return;
+
+        uint64_t protocolId;
+        uint32_t index;
+        uint64_t ticket;
+        memcpy( &protocolId, packetData + 1, 8 );
+        memcpy( &index, packetData + 1 + 8, 4 );
+        memcpy( &ticket, packetData + 1 + 8 + 4, 8 );
+        protocolId = network_to_host( protocolId );
+        const int clientIndex = (int) network_to_host( index );
+        ticket = network_to_host( ticket );
+
+        if ( protocolId != m_config.protocolId )
+            return;
+
+        if ( !FilterTrustedConnectRequest( from ) )
+            return;
+
+        // the ticket is random and replaced each time it is redeemed, so a stale or guessed ticket gets a disconnect and the client connects from scratch
+
+        if ( clientIndex < 0 || clientIndex >= GetMaxClients() || !m_trustedClients[clientIndex].connected )
         {
-            networkSimulator->SendPacket( clientIndex, packetData, packetBytes );
+            const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+            SendTrustedPacket( from, &disconnect, 1 );
+            return;
         }
-        else
+
+        TrustedClient & client = m_trustedClients[clientIndex];
+
+        if ( !client.suspended && client.previousResumeTicket == ticket && client.address == from )
         {
-            netcode_server_send_packet( m_server, clientIndex, packetData, packetBytes );
+            // the client resends its request until it is accepted
+            SendTrustedConnectAccepted( from, clientIndex );
+            return;
+        }
+
+        if ( client.resumeTicket != ticket )
+        {
+            const uint8_t disconnect = TRUSTED_PACKET_DISCONNECT;
+            SendTrustedPacket( from, &disconnect, 1 );
+            return;
+        }
+
+        if ( !client.suspended )
+        {
+            // the client moved to a new address before the server noticed it was gone
+            RemoveTrustedAddress( clientIndex );
+            if ( client.secondaryAddress.IsValid() )
+                RemoveTrustedAddress( clientIndex, 1 );
         }
+
+        client.suspended = false;
+        client.address = from;
+        client.secondaryAddress = Address();
+        client.lastPacketReceiveTime = GetTime();
+        client.pathReceiveTime[0] = GetTime();
+        client.nextPath = 0;
+        client.previousResumeTicket = client.resumeTicket;
+        random_bytes( (uint8_t*) &client.resumeTicket, 8 );
+        AddTrustedAddress( clientIndex );
+
+        // the new address may take a different path. start again from the size every path carries
+        SetTrustedClientPathBytes( clientIndex, TrustedMinPathBytes );
+
+        char addressString[MaxAddressLength];
+        from.ToString( addressString, MaxAddressLength );
+        yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d resumed from %s\n", clientIndex, addressString );
+
+        SendTrustedConnectAccepted( from, clientIndex );
     }
 
-    int Server::ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void Server::SendTrustedConnectAccepted( const Address & to, int clientIndex )
     {
-        return (int) GetClientConnection(clientIndex).ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+        TrustedClient & client = m_trustedClients[clientIndex];
+        uint8_t accepted[TrustedConnectAcceptedBytes];
+        accepted[0] = TRUSTED_PACKET_CONNECT_ACCEPTED;
+        const uint32_t index = host_to_network( (uint32_t) clientIndex );
+        const uint64_t ticket = host_to_network( client.resumeTicket );
+        memcpy( accepted + 1, &index, 4 );
+        memcpy( accepted + 1 + 4, &ticket, 8 );
+        SendTrustedPacket( to, accepted, TrustedConnectAcceptedBytes );
+        if ( to == client.address )
+            client.lastPacketSendTime = GetTime();
+        else
+            client.secondaryLastPacketSendTime = GetTime();
     }
 
-    void Server::ConnectDisconnectCallbackFunction( int clientIndex, int connected )
+    void Server::SuspendTrustedClient( int clientIndex )
+    {
+        TrustedClient & client = m_trustedClients[clientIndex];
+        yojimbo_assert( client.connected );
+        yojimbo_assert( !client.suspended );
+        RemoveTrustedAddress( clientIndex );
+        if ( client.secondaryAddress.IsValid() )
+            RemoveTrustedAddress( clientIndex, 1 );
+        client.address = Address();
+        client.secondaryAddress = Address();
+        client.suspended = true;
+        client.suspendTime = GetTime();
+    }
+
+    bool Server::FilterTrustedConnectRequest( const Address & from )
     {
-        if ( connected == 0 )
+        if ( m_config.serverConnectRequestBudget > 0 )
         {
-            reliable_endpoint_reset( GetClientEndpoint( clientIndex ) );
-            GetClientConnection( clientIndex ).Reset();
-            NetworkSimulator * networkSimulator = GetNetworkSimulator();
-            if ( networkSimulator && networkSimulator->IsActive() )
+            if ( m_trustedConnectRequestsThisTick >= m_config.serverConnectRequestBudget )
+                return false;
+            m_trustedConnectRequestsThisTick++;
+        }
+
+        if ( !m_trustedConnectFilter )
+            return true;
+
+        // a client that is already connected gets its accept resent without spending tokens
+
+        if ( FindTrustedClient( from ) >= 0 )
+            return true;
+
+        const double time = GetTime();
+        const float rate = m_config.serverConnectRequestRate;
+        const float burst = yojimbo_max( rate, 1.0f );
+
+        TrustedConnectFilterEntry & entry = m_trustedConnectFilter[from.GetHash() & ( TrustedConnectFilterSize - 1 )];
+        if ( entry.address != from )
+        {
+            entry.address = from;
+            entry.tokens = burst;
+            entry.lastTime = time;
+        }
+
+        entry.tokens = yojimbo_min( burst, entry.tokens + float( time - entry.lastTime ) * rate );
+        entry.lastTime = time;
+
+        if ( entry.tokens < 1.0f )
+            return false;
+
+        entry.tokens -= 1.0f;
+        return true;
+    }
+
+    void Server::UpdateTrustedClients()
+    {
+        yojimbo_assert( m_trustedClients );
+        const double time = GetTime();
+        for ( int i = 0; i < GetMaxClients(); ++i )
+        {
+            TrustedClient & client = m_trustedClients[i];
+            if ( !client.connected )
+                continue;
+            if ( client.suspended )
             {
-                networkSimulator->DiscardClientPackets( clientIndex );
+                if ( client.suspendTime + m_config.trustedResumeTime < time )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d did not resume\n", i );
+                    DisconnectTrustedClient( i, false );
+                }
+                continue;
+            }
+            if ( m_config.trustedTimeout > 0.0f && client.lastPacketReceiveTime + m_config.trustedTimeout < time )
+            {
+                if ( m_config.trustedResumeTime > 0.0f )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d timed out. suspended\n", i );
+                    SuspendTrustedClient( i );
+                    continue;
+                }
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "trusted client %d timed out\n", i );
+                DisconnectTrustedClient( i, false );
+                continue;
+            }
+            if ( client.lastPacketSendTime + TrustedKeepAliveInterval <= time )
+            {
+                SendTrustedClientPacket( i, TRUSTED_PACKET_KEEP_ALIVE, NULL, 0 );
+            }
+            if ( client.secondaryAddress.IsValid() && client.secondaryLastPacketSendTime + TrustedKeepAliveInterval <= time )
+            {
+                SendTrustedClientPacket( i, TRUSTED_PACKET_KEEP_ALIVE, NULL, 0, 1 );
             }
         }
     }
 
-    void Server::StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected )
+    void Server::DisconnectTrustedClient( int clientIndex, bool sendDisconnectPackets )
     {
-        Server * server = (Server*) context;
-        server->ConnectDisconnectCallbackFunction( clientIndex, connected );
+        yojimbo_assert( m_trustedClients );
+        yojimbo_assert( m_trustedClients[clientIndex].connected );
+        if ( sendDisconnectPackets )
+        {
+            for ( int i = 0; i < TrustedNumDisconnectPackets; ++i )
+            {
+                SendTrustedClientPacket( clientIndex, TRUSTED_PACKET_DISCONNECT, NULL, 0 );
+            }
+        }
+        ConnectDisconnectCallbackFunction( clientIndex, 0 );
+        if ( !m_trustedClients[clientIndex].suspended )
+            RemoveTrustedAddress( clientIndex );
+        if ( m_trustedClients[clientIndex].secondaryAddress.IsValid() )
+            RemoveTrustedAddress( clientIndex, 1 );
+        m_trustedClients[clientIndex].connected = false;
+        m_trustedClients[clientIndex].suspended = false;
+        m_trustedClients[clientIndex].pathBytes = 0;
+        m_trustedClients[clientIndex].address = Address();
+        m_trustedClients[clientIndex].secondaryAddress = Address();
+        m_numTrustedClients--;
+        yojimbo_assert( m_numTrustedClients >= 0 );
     }
 
     // -----------------------------------------------------------------------------------------------------
@@ -10,7 +10,10 @@
 #include "yojimbo_config.h"
 #include "yojimbo_adapter.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_platform.h"
 #include "yojimbo_connection.h"
+#include "yojimbo_socket.h"
+#include "yojimbo_recorder.h"
 
 /** @file */
 
@@ -21,6 +24,10 @@ namespace yojimbo
 {
     class Connection;
     class NetworkSimulator;
+    class BaseClient;
+    class SharedMemoryLink;
+    struct NetworkLinkConditions;
+    struct LoopbackPacket;
 
     /**
         Server interface
@@ -49,7 +56,7 @@ namespace yojimbo
             
             Each client that connects to this server occupies one of the client slots allocated by this function.
 
-            @param maxClients The number of client slots to allocate. Must be in range [1,MaxClients]
+            @param maxClients The number of client slots to allocate. Must be at least 1, and no more than the maximum number of clients supported by the transport. Per-client tables are sized from this value.
 
             @see Server::Stop
          */
@@ -160,6 +167,18 @@ namespace yojimbo
 
         virtual double GetTime() const = 0;
 
+        /**
+            Get the time of the next event the server must wake up for: the next packet due to a client (messages to send or resend, acks, keep-alives) or the next packet due out of the network simulator.
+
+            Use this to sleep between updates until there is something to do, instead of polling at a fixed rate. Cap the sleep at your own maximum wait, because packets arriving from the network are not events here, so a sleeping server only sees them when it wakes up.
+
+            @returns The time in seconds. May be in the past, if there is something to do now. DBL_MAX if there is nothing scheduled.
+
+            @see Server::AdvanceTime
+         */
+
+        virtual double GetNextEventTime() const = 0;
+
         // todo: document these methods
 
         virtual Message * CreateMessage( int clientIndex, int type ) = 0;
@@ -177,6 +196,50 @@ namespace yojimbo
         virtual Message * ReceiveMessage( int clientIndex, int channelIndex ) = 0;
 
         virtual void ReleaseMessage( int clientIndex, Message * message ) = 0;
+
+        /**
+            Queue messages to be sent to a client on a channel, until the channel can't take any more.
+
+            One call queues the lot, instead of a CanSendMessage and SendMessage call per message.
+
+            @param clientIndex The index of the client.
+            @param channelIndex The channel to send the messages on.
+            @param messages The messages to send. Create them with CreateMessage for this client.
+            @param numMessages The number of messages.
+
+            @returns The number of messages queued, from the start of the array. The server owns those. The rest still belong to the caller, to send later or release.
+         */
+
+        virtual int SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages ) = 0;
+
+        /**
+            Receive up to maxMessages messages from a client on a channel, in the order ReceiveMessage would return them.
+
+            @param clientIndex The index of the client.
+            @param channelIndex The channel to receive messages on.
+            @param messages The received messages (out). Release them with ReleaseMessages or ReleaseMessage.
+            @param maxMessages The size of the messages array.
+
+            @returns The number of messages received. Less than maxMessages once the channel is drained.
+         */
+
+        virtual int ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages ) = 0;
+
+        /**
+            Release messages received from a client.
+
+            @param clientIndex The index of the client.
+            @param messages The messages to release.
+            @param numMessages The number of messages.
+         */
+
+        virtual void ReleaseMessages( int clientIndex, Message ** messages, int numMessages ) = 0;
+
+        /**
+            Get the part of the next block message received so far from a client on a channel. See Channel::GetReceivedBlockPrefix.
+         */
+
+        virtual bool GetReceivedBlockPrefix( int clientIndex, int channelIndex, const uint8_t * & blockData, int & blockBytes ) const = 0;
     };
 
     /**
@@ -197,6 +260,22 @@ namespace yojimbo
 
         void Stop();
 
+        /**
+            Free the client slots kept by Stop for a warm restart. See BaseClientServerConfig::serverWarmRestart.
+
+            Call this while the server is stopped to give the memory back between matches. The server destructor calls it too.
+         */
+
+        void ReleaseWarmClientSlots();
+
+        /**
+            Get the number of client slots kept by Stop for a warm restart.
+
+            @returns The number of kept slots. Start reuses the first maxClients of them.
+         */
+
+        int GetNumWarmClientSlots() const;
+
         void AdvanceTime( double time );
 
         bool IsRunning() const { return m_running; }
@@ -205,6 +284,8 @@ namespace yojimbo
 
         double GetTime() const { return m_time; }
 
+        double GetNextEventTime() const;
+
         void SetLatency( float milliseconds );
 
         void SetJitter( float milliseconds );
@@ -213,6 +294,23 @@ namespace yojimbo
 
         void SetDuplicates( float percent );
 
+        /**
+            Set the simulated link conditions for packets sent to a client. See NetworkSimulator::SetLinkConditions.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param conditions The link conditions.
+         */
+
+        void SetClientLinkConditions( int clientIndex, const NetworkLinkConditions & conditions );
+
+        /**
+            Record the packets sent to and received from clients. See PacketRecorder.
+
+            @param recorder The packet recorder, or NULL to stop recording. Not owned by the server.
+         */
+
+        void SetPacketRecorder( PacketRecorder * recorder ) { m_packetRecorder = recorder; }
+
         Message * CreateMessage( int clientIndex, int type );
 
         uint8_t * AllocateBlock( int clientIndex, int bytes );
@@ -223,26 +321,621 @@ namespace yojimbo
 
         bool CanSendMessage( int clientIndex, int channelIndex ) const;
 
+        /**
+            Is a client connection low on memory?
+
+            @param clientIndex The index of the client slot.
+
+            @returns True if the client connection is above ConnectionConfig::memoryWatermark. CanSendMessage returns false for the client while this is true.
+
+            @see Adapter::OnConnectionMemoryLow
+         */
+
+        bool IsClientMemoryLow( int clientIndex ) const;
+
+        /**
+            Is a client a spectator? See Adapter::IsSpectator.
+
+            @param clientIndex The index of the client slot.
+
+            @returns True if the client in this slot connected as a spectator.
+         */
+
+        bool IsClientSpectator( int clientIndex ) const;
+
+        /**
+            Set the rate packets are sent to a client.
+
+            SendPackets skips generating packets for the client until 1/rate seconds have passed since its last packet, so clients that need fewer updates, like mobile players, spectators or players away from the keyboard, cost less CPU and bandwidth without a separate send loop. Sends are staggered across the interval by client slot, as with BaseClientServerConfig::serverSendInterval.
+
+            The rate goes back to the default when a client disconnects.
+
+            @param clientIndex The index of the client slot.
+            @param packetsPerSecond The send rate (packets per second). 0 for the default, which is the serverSendInterval, or every SendPackets call if that is 0.
+         */
+
+        void SetClientSendRate( int clientIndex, float packetsPerSecond );
+
+        /**
+            Get the rate packets are sent to a client.
+
+            @param clientIndex The index of the client slot.
+
+            @returns The send rate set with SetClientSendRate (packets per second), or 0 for the default.
+         */
+
+        float GetClientSendRate( int clientIndex ) const;
+
+        /**
+            Mark a client as low priority, so its send rate is the first thing cut while the server is overloaded. Spectators are always low priority. See SERVER_OVERLOAD_STEP_LOW_PRIORITY_SEND_RATE.
+
+            The flag is cleared when a client disconnects.
+
+            @param clientIndex The index of the client slot.
+            @param lowPriority True if the client is low priority.
+         */
+
+        void SetClientLowPriority( int clientIndex, bool lowPriority );
+
+        /**
+            Is a client low priority?
+
+            @param clientIndex The index of the client slot.
+
+            @returns True if the client was set low priority with SetClientLowPriority, or is a spectator.
+         */
+
+        bool IsClientLowPriority( int clientIndex ) const;
+
+        /**
+            Report how long the last server tick took, for admission control. See BaseClientServerConfig::serverAdmissionTickTime.
+
+            @param seconds The time the last tick took (seconds).
+         */
+
+        void SetTickTime( double seconds ) { m_tickTime = seconds; }
+
+        /**
+            Get the tick time reported with SetTickTime.
+
+            @returns The tick time (seconds).
+         */
+
+        double GetTickTime() const { return m_tickTime; }
+
+        /**
+            Get the free memory in the pool shared by client slots.
+
+            @returns The free memory in the shared client pool (bytes), or -1 if there is no fixed size shared pool. See BaseClientServerConfig::serverSharedClientPoolMemory.
+         */
+
+        int GetSharedClientMemoryFree() const;
+
+        /**
+            Would the built-in admission policy let a new client connect right now?
+
+            @returns False if BaseClientServerConfig::serverAdmissionMemoryHeadroom or serverAdmissionTickTime is exceeded.
+         */
+
+        bool IsAdmittingClients() const;
+
+        /**
+            Get the number of overload steps applied. See BaseClientServerConfig::serverOverloadTickTime.
+
+            @returns The number of steps applied, from the start of BaseClientServerConfig::serverOverloadSteps. 0 while the server is not overloaded.
+         */
+
+        int GetOverloadLevel() const { return m_overloadLevel; }
+
+        /**
+            Is an overload step applied right now?
+
+            @param step The overload step. See ServerOverloadStep.
+
+            @returns True if the step is applied.
+         */
+
+        bool IsOverloadStepApplied( int step ) const { yojimbo_assert( step >= 0 && step < SERVER_OVERLOAD_NUM_STEPS ); return ( m_overloadSteps & ( 1U << step ) ) != 0; }
+
+        /**
+            Get the channels of a client that may have received messages waiting.
+
+            @param clientIndex The index of the client slot.
+
+            @returns Bit n is set if channel n may have messages waiting. See Connection::GetChannelsWithMessages.
+         */
+
+        uint64_t GetClientChannelsWithMessages( int clientIndex ) const;
+
+        /**
+            Get the connected clients that may have received messages waiting, so server logic only drains those, instead of every channel of every client.
+
+            Call this after ReceivePackets. Clients stay in the list until ReceiveMessage returns NULL on each of their channels with messages.
+
+            @param clientIndices The client indices (out).
+            @param maxClients The size of the clientIndices array.
+
+            @returns The number of client indices written.
+         */
+
+        int GetClientsWithMessages( int * clientIndices, int maxClients ) const;
+
         void SendMessage( int clientIndex, int channelIndex, Message * message );
 
         Message * ReceiveMessage( int clientIndex, int channelIndex );
 
         void ReleaseMessage( int clientIndex, Message * message );
 
+        int SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages );
+
+        int ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages );
+
+        void ReleaseMessages( int clientIndex, Message ** messages, int numMessages );
+
+        bool GetReceivedBlockPrefix( int clientIndex, int channelIndex, const uint8_t * & blockData, int & blockBytes ) const;
+
+        /**
+            Create a message for a client from a job thread. See BaseClientServerConfig::serverSubmitQueueSize.
+
+            The submit functions may be called from any number of threads at once, while the network thread is outside of ReceivePackets, AdvanceTime and SendPackets, eg. from gameplay jobs run between AdvanceTime and SendPackets. Calls for different clients never wait on each other. Calls for the same client take turns on a spin lock held just long enough to touch its message factory or submit queue. BaseServer::AttachBlockToMessage doesn't allocate, so jobs may call it directly.
+
+            @param clientIndex The index of a connected client slot in [0,maxClients-1].
+            @param type The message type.
+
+            @returns The message, or NULL if it could not be created.
+         */
+
+        Message * CreateMessageConcurrent( int clientIndex, int type );
+
+        /**
+            Allocate a block for a client from a job thread, to attach to a message created with BaseServer::CreateMessageConcurrent.
+
+            @param clientIndex The index of a connected client slot in [0,maxClients-1].
+            @param bytes The size of the block (bytes).
+
+            @returns The block, or NULL if it could not be allocated.
+         */
+
+        uint8_t * AllocateBlockConcurrent( int clientIndex, int bytes );
+
+        /**
+            Release a message created with BaseServer::CreateMessageConcurrent without submitting it, from a job thread.
+
+            @param clientIndex The index of the client slot the message was created for.
+            @param message The message to release.
+         */
+
+        void ReleaseMessageConcurrent( int clientIndex, Message * message );
+
+        /**
+            Queue a message to send to a client, from a job thread.
+
+            The message is sent at the start of the next call to Server::SendPackets, in the order it was submitted, as if BaseServer::SendMessage was called then. As with SendMessage, the channel must have room for it by then. Messages submitted for a client that disconnects before then are released.
+
+            @param clientIndex The index of a connected client slot in [0,maxClients-1].
+            @param channelIndex The channel to send the message on.
+            @param message The message created with BaseServer::CreateMessageConcurrent. Ownership passes to the server.
+
+            @returns True if the message was queued. False if the submit queue of the client is full, in which case the message is released.
+         */
+
+        bool SubmitMessage( int clientIndex, int channelIndex, Message * message );
+
+        /**
+            Create a message to send to many clients with BaseServer::BroadcastMessage or BaseServer::SendMessageToClients.
+
+            Broadcast messages come from a message factory shared by all clients, backed by BaseClientServerConfig::serverBroadcastMemory.
+
+            @param type The message type.
+
+            @returns The message, or NULL if it could not be created.
+         */
+
+        Message * CreateBroadcastMessage( int type );
+
+        /**
+            Allocate a block to attach to a broadcast message.
+
+            @param bytes The size of the block (bytes).
+
+            @returns The block, or NULL if it could not be allocated.
+         */
+
+        uint8_t * AllocateBroadcastBlock( int bytes );
+
+        /**
+            Attach a block allocated with BaseServer::AllocateBroadcastBlock to a broadcast message.
+
+            @param message The broadcast message. Must be a block message.
+            @param block The block data. Ownership passes to the message.
+            @param bytes The size of the block (bytes).
+         */
+
+        void AttachBlockToBroadcastMessage( Message * message, uint8_t * block, int bytes );
+
+        /**
+            Create a shared block from the broadcast allocator, to attach to block messages for many clients with BlockMessage::AttachSharedBlock.
+
+            Use this to send the same block to clients at different times, eg. a map chunk to clients as they join. Release your reference once the block is attached to the messages.
+
+            @param bytes The size of the block (bytes).
+
+            @returns The shared block with a reference count of 1, or NULL if it could not be allocated.
+         */
+
+        SharedBlock * CreateSharedBlock( int bytes );
+
+        /**
+            Release a broadcast message without sending it.
+
+            @param message The broadcast message to release.
+         */
+
+        void ReleaseBroadcastMessage( Message * message );
+
+        /**
+            Send a message to every connected client.
+
+            See BaseServer::SendMessageToClients.
+
+            @param channelIndex The channel to send the message on.
+            @param message The message created with BaseServer::CreateBroadcastMessage. Ownership passes to the server.
+
+            @returns The number of clients the message was sent to.
+         */
+
+        int BroadcastMessage( int channelIndex, Message * message );
+
+        /**
+            Send a message to a list of clients.
+
+            The message is measured and serialized once, into serialized bits shared by all clients. Each client gets its own message of the same type with these bits attached, which its channel copies into packets instead of serializing the message again. See SerializedMessage.
+
+            Clients that are not connected, or can't send a message on the channel right now, are skipped. Snapshot channels are not supported, because each message is delta encoded per-client.
+
+            A block attached to the message is shared by all clients, not copied. See SharedBlock.
+
+            @param clientIndices The client slots to send the message to.
+            @param numClients The number of client slots in the list.
+            @param channelIndex The channel to send the message on.
+            @param message The message created with BaseServer::CreateBroadcastMessage. Ownership passes to the server.
+
+            @returns The number of clients the message was sent to.
+         */
+
+        int SendMessageToClients( const int clientIndices[], int numClients, int channelIndex, Message * message );
+
+        /**
+            Get the number of client groups. See BaseClientServerConfig::serverMaxClientGroups.
+
+            @returns The number of client groups. Group indices are in [0,numGroups-1].
+         */
+
+        int GetNumClientGroups() const { return m_numClientGroups; }
+
+        /**
+            Add a connected client to a client group.
+
+            Groups are for interest management, eg. the players in one zone. Adding and removing clients is O(1), so membership can change every tick. A client can be in any number of groups, and is removed from all of them when it disconnects.
+
+            @param groupIndex The client group in [0,numGroups-1].
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+
+            @returns True if the client is in the group, false if no client is connected to the slot.
+         */
+
+        bool AddClientToGroup( int groupIndex, int clientIndex );
+
+        /**
+            Remove a client from a client group. Does nothing if the client is not in the group.
+
+            @param groupIndex The client group in [0,numGroups-1].
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+         */
+
+        void RemoveClientFromGroup( int groupIndex, int clientIndex );
+
+        /**
+            Remove every client from a client group.
+
+            @param groupIndex The client group in [0,numGroups-1].
+         */
+
+        void ClearClientGroup( int groupIndex );
+
+        /**
+            Is a client in a client group?
+
+            @param groupIndex The client group in [0,numGroups-1].
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+
+            @returns True if the client is in the group.
+         */
+
+        bool IsClientInGroup( int groupIndex, int clientIndex ) const;
+
+        /**
+            Get the number of clients in a client group.
+
+            @param groupIndex The client group in [0,numGroups-1].
+
+            @returns The number of clients in the group.
+         */
+
+        int GetNumClientsInGroup( int groupIndex ) const;
+
+        /**
+            Get the clients in a client group.
+
+            @param groupIndex The client group in [0,numGroups-1].
+
+            @returns The client slots in the group, in no particular order. Valid until the group changes.
+         */
+
+        const int * GetClientsInGroup( int groupIndex ) const;
+
+        /**
+            Send a message to every client in a client group.
+
+            The message is serialized once and shared by the clients, as with BaseServer::SendMessageToClients.
+
+            @param groupIndex The client group in [0,numGroups-1].
+            @param channelIndex The channel to send the message on.
+            @param message The message created with BaseServer::CreateBroadcastMessage. Ownership passes to the server.
+
+            @returns The number of clients the message was sent to.
+         */
+
+        int SendMessageToGroup( int groupIndex, int channelIndex, Message * message );
+
+        /**
+            Get statistics for the allocator used for a client slot. Use the peak to tune BaseClientServerConfig::serverPerClientMemory.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param stats The allocator statistics (out). All zero if the server is not running.
+         */
+
+        void GetClientAllocatorStats( int clientIndex, AllocatorStats & stats ) const;
+
+        /**
+            Get the number of packets dropped from a client slot for going over its ingress budget, since the client connected.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param numPacketsDropped The number of packets dropped (out). Zero if no ingress budget is set.
+            @param numBytesDropped The size of the packets dropped (out).
+
+            @see BaseClientServerConfig::serverClientPacketRate
+            @see BaseClientServerConfig::serverClientByteRate
+         */
+
+        void GetClientIngressStats( int clientIndex, uint64_t & numPacketsDropped, uint64_t & numBytesDropped ) const;
+
+        /**
+            Get statistics for the server global allocator. Use the peak to tune BaseClientServerConfig::serverGlobalMemory.
+
+            @param stats The allocator statistics (out). All zero if the server is not running.
+         */
+
+        void GetGlobalAllocatorStats( AllocatorStats & stats ) const;
+
+        /**
+            Get network stats for the connection to a client: RTT, packet loss, bandwidth, and the counters and queue depths of each channel.
+
+            This is cheap enough to call for every client, every tick.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param stats The connection stats (out). All zero if no client is connected to the slot.
+         */
+
+        void GetConnectionStats( int clientIndex, ConnectionStats & stats ) const;
+
+        /**
+            Get a latency histogram of a channel on the connection to a client. See ChannelConfig::latencyHistograms.
+
+            Add the histograms of every client together with LatencyHistogram::Add for server wide percentiles.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param index The histogram to get. See ChannelLatencyHistograms.
+            @param histogram The histogram (out). Empty if no client is connected to the slot, or the channel keeps no histograms.
+
+            @returns True if the histogram was copied.
+         */
+
+        bool GetLatencyHistogram( int clientIndex, int channelIndex, int index, LatencyHistogram & histogram ) const;
+
+        /**
+            Change the limits a channel runs with on the connection to a client, without reconnecting it. See Connection::SetChannelLimits.
+
+            Eg. shrink the queues and packet budgets of every client while in the lobby, and grow them back for match start. The limits go back to the ChannelConfig when the client slot is reused.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param limits The new limits. See ChannelLimits.
+
+            @returns True if the limits were changed. False if no client is connected to the slot.
+         */
+
+        bool SetClientChannelLimits( int clientIndex, int channelIndex, const ChannelLimits & limits );
+
+        /**
+            Get the limits a channel runs with on the connection to a client.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param limits The limits (out). The ChannelConfig limits if no client is connected to the slot.
+         */
+
+        void GetClientChannelLimits( int clientIndex, int channelIndex, ChannelLimits & limits ) const;
+
+        /**
+            Connect a client in the same process to a free client slot. Packets are exchanged through in-memory queues instead of the transport.
+
+            This is called by BaseClient::ConnectLoopback. You should not need to call it yourself.
+
+            @param client The loopback client.
+
+            @returns The client slot the client is connected to, or -1 if there are no free client slots.
+         */
+
+        int ConnectLoopbackClient( BaseClient & client );
+
+        /**
+            Open a shared memory link in a free client slot, for a client in another process on the same host to connect to with BaseClient::ConnectSharedMemory. Packets are exchanged through lock-free rings in the mapped file, with no syscalls, crypto or netcode.io.
+
+            The slot counts as a loopback client from now on, and is disconnected if the client doesn't open the link within BaseClientServerConfig::sharedMemoryTimeout, or closes it. Only use this between processes that trust each other, like a game server and its sidecars.
+
+            @param path The path of the file to map, eg. "/dev/shm/game-voice" on linux. Removed again when the slot is disconnected.
+
+            @returns The client slot the link is open in, or -1 if there are no free client slots or the file could not be mapped.
+         */
+
+        int ConnectSharedMemoryClient( const char * path );
+
+        /**
+            Disconnect a loopback client. Does nothing if the client slot doesn't have a loopback client.
+
+            The client is disconnected as well, as if it was disconnected by a remote server.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+         */
+
+        void DisconnectLoopbackClient( int clientIndex );
+
+        /**
+            Is a loopback client connected to this client slot?
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+
+            @returns True if the client in this slot is connected with BaseClient::ConnectLoopback, or through a shared memory link.
+         */
+
+        bool IsLoopbackClient( int clientIndex ) const;
+
+        int GetNumLoopbackClients() const { return m_numLoopbackClients; }
+
+        /**
+            Queue a packet sent by a loopback client. It is processed on the next call to ReceivePackets.
+
+            This is called by BaseClient. You should not need to call it yourself.
+
+            @param clientIndex The client slot of the loopback client.
+            @param packetData The packet data. Copied into the queue.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void QueueLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes );
+
     protected:
 
         void * GetContext() { return m_context; }
 
+        Adapter & GetAdapter() { yojimbo_assert( m_adapter ); return *m_adapter; }
+
         Allocator & GetGlobalAllocator() { yojimbo_assert( m_globalAllocator ); return *m_globalAllocator; }
 
+        Allocator & GetSharedClientAllocator() { return m_sharedClientAllocator ? *m_sharedClientAllocator : *m_allocator; }
+
         MessageFactory & GetClientMessageFactory( int clientIndex );
 
+        /**
+            Allocate memory to back one of the server allocators. See BaseClientServerConfig::serverPageMemory.
+
+            @param clientIndex The client slot the memory is for, or -1 for the global and shared allocators.
+            @param bytes The number of bytes to allocate.
+
+            @returns The memory, or NULL if the allocation failed.
+         */
+
+        uint8_t * AllocateServerMemory( int clientIndex, int bytes );
+
+        /**
+            Free memory allocated with BaseServer::AllocateServerMemory, and set the pointer to NULL.
+
+            @param memory The memory to free. May be NULL.
+            @param bytes The number of bytes passed to BaseServer::AllocateServerMemory.
+         */
+
+        void FreeServerMemory( uint8_t * & memory, int bytes );
+
         NetworkSimulator * GetNetworkSimulator() { return m_networkSimulator; }
 
         reliable_endpoint_t * GetClientEndpoint( int clientIndex );
 
         Connection & GetClientConnection( int clientIndex );
 
+        void CreateClientConnection( int clientIndex, bool spectator = false );
+
+        void DestroyClientConnection( int clientIndex );
+
+        void AddActiveClient( int clientIndex );
+
+        bool AdmitClient( int clientIndex );
+
+        void RemoveActiveClient( int clientIndex );
+
+        /**
+            Apply the next overload step, or undo the last one, once the tick has been over or under budget for long enough. Called once per tick by Server::AdvanceTime.
+
+            @param tickTime The time the last tick took (seconds).
+
+            @see BaseClientServerConfig::serverOverloadTickTime
+         */
+
+        void UpdateOverload( double tickTime );
+
+        /**
+            Check a packet received from a connected client against the client's ingress budget, before reliable.io and the connection process it.
+
+            @param clientIndex The client slot the packet came from.
+            @param packetBytes The size of the packet (bytes).
+
+            @returns True if the packet should be processed. False if it should be dropped.
+
+            @see BaseClientServerConfig::serverClientPacketRate
+            @see BaseClientServerConfig::serverClientByteRate
+         */
+
+        bool FilterClientPacket( int clientIndex, int packetBytes );
+
+        void SendLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes );
+
+        void ReceiveLoopbackPackets();
+
+        /**
+            Pass the packets waiting on a shared memory link to reliable.io, and disconnect the client if it closed the link or timed out.
+
+            @param clientIndex The client slot of the link.
+         */
+
+        void ReceiveSharedMemoryPackets( int clientIndex );
+
+        /**
+            Send the messages submitted from job threads with BaseServer::SubmitMessage to their clients, and empty the submit queues. Called at the start of Server::SendPackets.
+         */
+
+        void SendSubmittedMessages();
+
+        int GetNumActiveClients() const { return m_numActiveClients; }
+
+        int GetActiveClientIndex( int activeIndex ) const { yojimbo_assert( activeIndex >= 0 ); yojimbo_assert( activeIndex < m_numActiveClients ); return m_activeClients[activeIndex]; }
+
+        Connection & GetActiveClientConnection( int activeIndex ) { yojimbo_assert( activeIndex >= 0 ); yojimbo_assert( activeIndex < m_numActiveClients ); return *m_activeConnection[activeIndex]; }
+
+        reliable_endpoint_t * GetActiveClientEndpoint( int activeIndex ) { yojimbo_assert( activeIndex >= 0 ); yojimbo_assert( activeIndex < m_numActiveClients ); return m_activeEndpoint[activeIndex]; }
+
+        /**
+            Start fetching the connection of an active client into cache, ahead of a loop reaching it.
+
+            @param activeIndex The position in the active client list. Positions outside the list are ignored, so loops can prefetch one ahead without checking.
+         */
+
+        void PrefetchActiveClient( int activeIndex ) const
+        {
+            if ( activeIndex >= 0 && activeIndex < m_numActiveClients )
+                yojimbo_prefetch( m_activeConnection[activeIndex] );
+        }
+
         virtual void TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
 
         virtual int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
@@ -257,6 +950,60 @@ namespace yojimbo
 
     private:
 
+        /// Token buckets limiting the packets processed from one connected client. See BaseClientServerConfig::serverClientPacketRate.
+
+        struct ClientIngressBudget
+        {
+            float packetTokens;                                     ///< Packets the client may send before being rate limited.
+            float byteTokens;                                       ///< Bytes the client may send before being rate limited.
+            double lastTime;                                        ///< Time the tokens were last refilled.
+            uint64_t numPacketsDropped;                             ///< Packets dropped since the client connected.
+            uint64_t numBytesDropped;                               ///< Size of the packets dropped since the client connected (bytes).
+        };
+
+        /**
+            The per-client resources of a slot, kept across Stop and Start for a warm restart.
+         */
+
+        struct WarmClientSlot
+        {
+            uint8_t * memory;                                       ///< The block of memory backing the allocator.
+            Allocator * allocator;                                  ///< The client allocator. NULL if the slot is not kept.
+            MessageFactory * messageFactory;                        ///< The message factory, or NULL if no client connected to the slot.
+            Connection * connection;                                ///< The connection, reset. NULL if no client connected to the slot.
+            reliable_endpoint_t * endpoint;                         ///< The reliable.io endpoint, reset. NULL if no client connected to the slot.
+            Allocator * endpointAllocator;                          ///< The allocator of the reliable.io endpoint, or NULL if it uses the client allocator.
+        };
+
+        /// A message submitted from a job thread, waiting for Server::SendPackets.
+
+        struct SubmittedMessage
+        {
+            Message * message;                                      ///< The message. Owned by the submit queue until it is sent.
+            int channelIndex;                                       ///< The channel to send the message on.
+        };
+
+        /// The queue of messages submitted for one client slot. Each queue starts on its own cache line, so job threads working on different clients don't share lines.
+
+        struct ClientSubmitQueue
+        {
+            volatile int lock;                                      ///< Spin lock held by a job thread while it uses the client message factory or allocator, or the queue.
+            int numMessages;                                        ///< The number of messages in the queue.
+            SubmittedMessage * messages;                            ///< The queue entries, serverSubmitQueueSize of them, in the same block right after this header.
+        };
+
+        ClientSubmitQueue & GetClientSubmitQueue( int clientIndex );
+
+        void ReleaseSubmittedMessages( int clientIndex );
+
+        bool KeepWarmClientSlot( int clientIndex );
+
+        void DestroyWarmClientSlot( WarmClientSlot & slot );
+
+        void SetOverloadStep( int step, bool applied );
+
+        void ApplyOverload( Connection & connection );
+
         BaseClientServerConfig m_config;                            ///< Base client/server config.
         Allocator * m_allocator;                                    ///< Allocator passed in to constructor.
         Adapter * m_adapter;                                        ///< The adapter specifies the allocator to use, and the message factory class.
@@ -265,17 +1012,69 @@ namespace yojimbo
         bool m_running;                                             ///< True if server is currently running, eg. after "Start" is called, before "Stop".
         double m_time;                                              ///< Current server time in seconds.
         uint8_t * m_globalMemory;                                   ///< The block of memory backing the global allocator. Allocated with m_allocator.
-        uint8_t * m_clientMemory[MaxClients];                       ///< The block of memory backing the per-client allocators. Allocated with m_allocator.
+        uint8_t * m_sharedClientMemory;                             ///< The block of memory backing the shared client allocator, when serverSharedClientMemory is true and serverSharedClientPoolMemory > 0. Allocated with m_allocator.
+        Allocator * m_sharedClientAllocator;                        ///< Pool shared by all per-client quota allocators. NULL if clients draw directly from m_allocator, or client memory is not shared.
+        uint8_t ** m_clientMemory;                                  ///< Per-client blocks of memory backing the per-client allocators. Blocks are allocated with m_allocator, the table with the global allocator in Start.
         Allocator * m_globalAllocator;                              ///< The global allocator. Used for allocations that don't belong to a specific client.
-        Allocator * m_clientAllocator[MaxClients];                  ///< Array of per-client allocator. These are used for allocations related to connected clients.
-        MessageFactory * m_clientMessageFactory[MaxClients];        ///< Array of per-client message factories. This silos message allocations per-client slot.
-        Connection * m_clientConnection[MaxClients];                ///< Array of per-client connection classes. This is how messages are exchanged with clients.
-        reliable_endpoint_t * m_clientEndpoint[MaxClients];         ///< Array of per-client reliable.io endpoints.
+        Allocator ** m_clientAllocator;                             ///< Array of per-client allocator. These are used for allocations related to connected clients.
+        uint8_t * m_broadcastMemory;                                ///< The block of memory backing the broadcast allocator. Allocated with m_allocator.
+        Allocator * m_broadcastAllocator;                           ///< The allocator for broadcast messages and their serialized bits. Thread safe, because clients release the serialized bits while they are updated in parallel.
+        Allocator * m_broadcastPoolAllocator;                       ///< The allocator over the broadcast memory, wrapped by m_broadcastAllocator.
+        MessageFactory * m_broadcastMessageFactory;                 ///< The message factory for broadcast messages. See BaseServer::CreateBroadcastMessage.
+        MessageFactory ** m_clientMessageFactory;                   ///< Array of per-client message factories. This silos message allocations per-client slot. Created when a client first connects to the slot.
+        Connection ** m_clientConnection;                           ///< Array of per-client connection classes. This is how messages are exchanged with clients. Created when a client first connects to the slot, and reused after it disconnects.
+        reliable_endpoint_t ** m_clientEndpoint;                    ///< Array of per-client reliable.io endpoints. Created when a client first connects to the slot.
+        Allocator ** m_clientEndpointAllocator;                     ///< Array of per-client allocators that pool the large packet buffers of each reliable.io endpoint. NULL entries unless BaseClientServerConfig::packetBufferPoolSize is set.
+        uint8_t * m_activeClientMemory;                             ///< The block the active client arrays below are carved from. Each array starts on its own cache line. Allocated with the global allocator in Start.
+        int * m_activeClients;                                      ///< Dense list of the indices of connected clients. Server hot loops iterate this instead of every client slot.
+        Connection ** m_activeConnection;                           ///< Connection of each entry in the active client list, so hot loops stream through one array instead of looking up each client slot.
+        reliable_endpoint_t ** m_activeEndpoint;                    ///< Reliable.io endpoint of each entry in the active client list.
+        int * m_activeClientPosition;                               ///< Position of each client slot in the active client list, or -1 if the slot is not active.
+        int m_numActiveClients;                                     ///< Number of entries in the active client list.
+        double m_tickTime;                                          ///< The last tick time reported with SetTickTime (seconds).
+        float * m_clientSendRate;                                   ///< Send rate of each client slot (packets per second), or 0 for the default. See BaseServer::SetClientSendRate.
+        int m_numClientGroups;                                      ///< Number of client groups. See BaseServer::AddClientToGroup.
+        int * m_groupClients;                                       ///< Dense list of the clients in each group, maxClients entries per group.
+        int * m_groupClientPosition;                                ///< Position of each client slot in the list of each group, maxClients entries per group, or -1 if the client is not in the group.
+        int * m_groupNumClients;                                    ///< Number of clients in each group.
         NetworkSimulator * m_networkSimulator;                      ///< The network simulator used to simulate packet loss, latency, jitter etc. Optional. 
+        PacketRecorder * m_packetRecorder;                          ///< Records packets sent and received. Optional. See BaseServer::SetPacketRecorder.
+        BaseClient ** m_loopbackClients;                            ///< Array of loopback clients for each client slot. NULL for slots without a loopback client. See BaseClient::ConnectLoopback.
+        Queue<LoopbackPacket> ** m_loopbackPackets;                 ///< Array of per-client queues of packets from loopback clients, waiting for ReceivePackets. Allocated with the client allocator while a loopback client is connected.
+        int m_numLoopbackClients;                                   ///< Number of loopback clients connected, including shared memory links.
+        SharedMemoryLink ** m_sharedMemoryLinks;                    ///< Array of shared memory links for each client slot. NULL for slots without one. Allocated with the client allocator. See BaseServer::ConnectSharedMemoryClient.
+        double * m_sharedMemoryReceiveTime;                         ///< Time a packet was last received over each shared memory link, or the time it was opened.
+        WarmClientSlot * m_warmSlots;                               ///< Client slots kept by Stop for a warm restart, indexed by client slot. Allocated with m_allocator, so it outlives the global allocator.
+        int m_numWarmSlots;                                         ///< Number of entries in m_warmSlots. The high-water mark of maxClients while warm restart is on.
+        bool * m_clientSpectator;                                   ///< True for client slots whose connection was built for a spectator. See Adapter::IsSpectator.
+        bool * m_clientLowPriority;                                 ///< True for client slots set low priority with BaseServer::SetClientLowPriority.
+        int m_overloadLevel;                                        ///< Number of overload steps applied, from the start of serverOverloadSteps. See BaseServer::GetOverloadLevel.
+        uint32_t m_overloadSteps;                                   ///< Bit mask of the overload steps applied, indexed by ServerOverloadStep.
+        int m_overloadTicks;                                        ///< Ticks in a row over serverOverloadTickTime.
+        int m_recoverTicks;                                         ///< Ticks in a row under serverRecoverFraction of serverOverloadTickTime.
+        ClientIngressBudget * m_clientIngress;                      ///< Per-client ingress budgets. Allocated in Start with the global allocator when serverClientPacketRate or serverClientByteRate is set.
+        ConnectionConfig m_spectatorConfig;                         ///< The connection config of spectators: m_config with channel queues capped at serverSpectatorQueueSize and lazy block buffers.
+        uint8_t * m_clientSubmitMemory;                             ///< The block the per-client submit queues are carved from. NULL unless serverSubmitQueueSize is set. Allocated with the global allocator in Start.
+        uint8_t * m_clientSubmitQueues;                             ///< The first submit queue, aligned to a cache line. Queue i is at i * m_clientSubmitQueueStride bytes past it.
+        size_t m_clientSubmitQueueStride;                           ///< Bytes between the submit queues of consecutive client slots. A whole number of cache lines.
+    };
+
+    /**
+        Phases of a server tick timed by Server. See Server::GetTickPhaseTime.
+     */
+
+    enum ServerTickPhase
+    {
+        SERVER_TICK_PHASE_RECEIVE_PACKETS,                          ///< Time spent in Server::ReceivePackets.
+        SERVER_TICK_PHASE_ADVANCE_TIME,                             ///< Time spent in Server::AdvanceTime.
+        SERVER_TICK_PHASE_SEND_PACKETS,                             ///< Time spent in Server::SendPackets.
+        SERVER_TICK_PHASE_NUM_PHASES                                ///< The number of tick phases.
     };
 
     /**
         Dedicated server implementation.
+
+        A client slot can't be moved to another server process while the client stays connected. The netcode.io keys and sequence numbers for the slot live inside netcode.io, and the reliable.io endpoint state is opaque to yojimbo, so neither can be exported. To move players between servers, disconnect them and have them connect to the new server with a fresh connect token, and carry game state across at the application level.
      */
 
     class Server : public BaseServer
@@ -304,8 +1103,40 @@ namespace yojimbo
 
         int GetNumConnectedClients() const;
 
+        double GetNextEventTime() const;
+
+        /**
+            Get how long a phase of the server tick took the last time it ran. Two clock reads per phase, so this is always on.
+
+            @param phase The tick phase. See ServerTickPhase.
+
+            @returns The time the phase took (seconds).
+         */
+
+        double GetTickPhaseTime( int phase ) const { yojimbo_assert( phase >= 0 && phase < SERVER_TICK_PHASE_NUM_PHASES ); return m_tickPhaseTime[phase]; }
+
+        /**
+            Get the largest packet the path to a trusted client carries without fragmentation, as confirmed by the client. See BaseClientServerConfig::trustedPathMtuDiscovery.
+
+            @param clientIndex The client index.
+
+            @returns The largest UDP payload confirmed (bytes). TrustedMinPathBytes until the client confirms more. 0 if the client isn't connected in the trusted network mode, or path MTU discovery is off.
+         */
+
+        int GetClientPathBytes( int clientIndex ) const;
+
     private:
 
+        friend struct ServerTickPhaseTimer;
+
+        /**
+            Report a tick phase that ran over BaseClientServerConfig::serverTickPhaseBudget. See Adapter::OnTickPhaseOverrun.
+
+            @param phase The tick phase. See ServerTickPhase.
+         */
+
+        void ReportTickPhaseOverrun( int phase );
+
         void TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
 
         int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
@@ -314,10 +1145,223 @@ namespace yojimbo
 
         static void StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected );
 
+        void ReceivePacketsBatched();
+
+        void FlushSendBatch();
+
+        void SendPacketsSerial();
+
+        void SendPacketsParallel();
+
+        bool IsClientInSendPacingSlice( int clientIndex ) const;
+
+        bool IsClientSendDue( int clientIndex );
+
+        static void StaticGeneratePacketFunction( void * context, int index );
+
+        static void StaticProcessPacketsFunction( void * context, int index );
+
+        static void StaticSendBatchFunction( void * context, int index );
+
+        /**
+            Find the trusted client connected from an address, via the address index.
+
+            @param address The address to look for.
+
+            @returns The client index, or -1 if no trusted client is connected from the address.
+         */
+
+        int FindTrustedClient( const Address & address ) const;
+
+        int FindTrustedAddressSlot( const Address & address ) const;
+
+        /**
+            Get the address an entry in the trusted address index stands for.
+
+            @param entry The index entry: the client index times two, plus one for the secondary path.
+
+            @returns The address of that path of the client.
+         */
+
+        const Address & GetTrustedEntryAddress( int entry ) const;
+
+        void AddTrustedAddress( int clientIndex, int path = 0 );
+
+        void RemoveTrustedAddress( int clientIndex, int path = 0 );
+
+        /**
+            Add the address a connect request came from as the secondary path of the trusted client with the same client id. See BaseClientServerConfig::trustedMultipath.
+
+            @param from The address the connect request came from.
+            @param clientId The client id in the connect request.
+
+            @returns The client index, or -1 if no trusted client with that client id is connected.
+         */
+
+        int AddTrustedPath( const Address & from, uint64_t clientId );
+
+        bool IsTrustedPathUp( int clientIndex, int path ) const;
+
+        void SendTrustedPacket( const Address & address, const uint8_t * packetData, int packetBytes );
+
+        void SendTrustedClientPacket( int clientIndex, TrustedPacketType type, const uint8_t * packetData, int packetBytes, int path = 0 );
+
+        /**
+            Send a reliable.io packet to a trusted client, over one or both of its paths. See BaseClientServerConfig::trustedMultipath.
+
+            @param clientIndex The client index.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void SendTrustedClientPayload( int clientIndex, const uint8_t * packetData, int packetBytes );
+
+        void ReceiveTrustedPackets();
+
+        void ProcessTrustedPacket( const Address & from, uint8_t * packetData, int packetBytes );
+
+        void ProcessTrustedConnectRequest( const Address & from, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Answer a probe, if the probe budget for this call to ReceivePackets isn't spent. See BaseClientServerConfig::serverProbeBudget.
+
+            @param from The address the probe came from.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void ProcessTrustedProbe( const Address & from, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Take the path size a trusted client confirmed from a path probe, and echo padded probes back at the same size. See BaseClientServerConfig::trustedPathMtuDiscovery.
+
+            @param clientIndex The client the probe came from.
+            @param path The path the probe came over. Only the first path is probed.
+            @param packetData The probe, including the packet type.
+            @param packetBytes The size of the probe (bytes).
+         */
+
+        void ProcessTrustedPathProbe( int clientIndex, int path, const uint8_t * packetData, int packetBytes );
+
+        void SetTrustedClientPathBytes( int clientIndex, int pathBytes );
+
+        /**
+            Resume a trusted connection that timed out, or moved to a new address, with the ticket sent in the last connect accepted packet. See BaseClientServerConfig::trustedResumeTime.
+
+            @param from The address the resume request came from.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void ProcessTrustedResumeRequest( const Address & from, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Send a connect accepted packet with the client index and the current resume ticket.
+
+            @param to The address to send the packet to.
+            @param clientIndex The client index.
+         */
+
+        void SendTrustedConnectAccepted( const Address & to, int clientIndex );
+
+        /**
+            Suspend a trusted client that timed out. The slot and connection are kept for BaseClientServerConfig::trustedResumeTime, but packets are no longer accepted from its address.
+
+            @param clientIndex The client index.
+         */
+
+        void SuspendTrustedClient( int clientIndex );
+
+        /**
+            Check a trusted connect request against the per-tick budget and the per-address rate limit, before doing any crypto.
+
+            @param from The address the connect request came from.
+
+            @returns True if the request should be processed. False if it should be dropped.
+
+            @see BaseClientServerConfig::serverConnectRequestBudget
+            @see BaseClientServerConfig::serverConnectRequestRate
+         */
+
+        bool FilterTrustedConnectRequest( const Address & from );
+
+        void UpdateTrustedClients();
+
+        void DisconnectTrustedClient( int clientIndex, bool sendDisconnectPackets );
+
+        /// Per-client state for the trusted network mode. See BaseClientServerConfig::trustedNetwork.
+
+        struct TrustedClient
+        {
+            bool connected;                                         ///< True if a client is connected to this slot.
+            Address address;                                        ///< The address the client connected from. Packets are accepted from this address only, and from secondaryAddress.
+            Address secondaryAddress;                               ///< The address of the second path the client connected over. Invalid if none. See BaseClientServerConfig::trustedMultipath.
+            uint64_t clientId;                                      ///< The client id sent in the connect request.
+            double lastPacketSendTime;                              ///< Time a packet was last sent to the client.
+            double lastPacketReceiveTime;                           ///< Time a packet was last received from the client, over either path.
+            double secondaryLastPacketSendTime;                     ///< Time a packet was last sent over the secondary path.
+            double pathReceiveTime[2];                              ///< Time a packet was last received over each path.
+            int nextPath;                                           ///< The path the next packet without urgent data goes over. See BaseClientServerConfig::trustedMultipathBalance.
+            uint64_t resumeTicket;                                  ///< The ticket the client resumes the connection with. Replaced each time it is redeemed. See BaseClientServerConfig::trustedResumeTime.
+            uint64_t previousResumeTicket;                          ///< The ticket redeemed last. Resume requests resent with it from the address the client resumed from get the accept again.
+            bool suspended;                                         ///< True while the connection is suspended after a timeout, waiting for the client to resume it. The slot stays connected, but has no address.
+            double suspendTime;                                     ///< Time the connection was suspended.
+            int pathBytes;                                          ///< Largest UDP payload the client confirmed the path carries whole (bytes). Reset to TrustedMinPathBytes on connect and resume. See BaseClientServerConfig::trustedPathMtuDiscovery.
+        };
+
+        /// Token bucket limiting the rate of trusted connect requests from one address. See BaseClientServerConfig::serverConnectRequestRate.
+
+        struct TrustedConnectFilterEntry
+        {
+            Address address;                                        ///< The address this entry is tracking. Invalid if unused.
+            float tokens;                                           ///< Connect requests the address may send before being rate limited.
+            double lastTime;                                        ///< Time the tokens were last refilled.
+        };
+
         ClientServerConfig m_config;
         netcode_server_t * m_server;
         Address m_address;
         uint8_t m_privateKey[KeyBytes];
+        uint8_t * m_packetBufferMemory;                             ///< Raw allocation backing the packet buffer. Allocated in Start with the global allocator.
+        uint8_t * m_packetBuffer;                                   ///< Cache line aligned scratch buffer packets are generated into by SendPackets. Avoids allocating maxPacketSize on the stack each tick.
+        uint8_t ** m_simulatorPacketData;                           ///< Scratch array used to drain packets from the network simulator each tick.
+        int * m_simulatorPacketBytes;                               ///< Scratch array of packet sizes drained from the network simulator each tick.
+        int * m_simulatorPacketTo;                                  ///< Scratch array of client indices for packets drained from the network simulator each tick.
+        uint8_t ** m_receiveBatchPacketData;                        ///< Packets drained from the transport this batch. Allocated in Start with the global allocator.
+        int * m_receiveBatchPacketBytes;                            ///< Size of each packet in the receive batch (bytes).
+        int * m_receiveBatchClientIndex;                            ///< Client index that sent each packet in the receive batch.
+        uint8_t * m_parallelPacketMemory;                           ///< Per-client packet buffers used when generating packets in parallel. Allocated in Start with the global allocator when serverParallelSend is true.
+        int m_parallelNumClients;                                   ///< Number of clients packets are being generated for in parallel this tick.
+        int * m_parallelClientIndex;                                ///< Client index for each parallel work item.
+        uint16_t * m_parallelPacketSequence;                        ///< Packet sequence for each parallel work item.
+        int * m_parallelPacketBytes;                                ///< Size of the packet generated for each parallel work item (bytes). Zero if no packet was generated.
+        int * m_parallelRunStart;                                   ///< Index of the first packet in the receive batch for each parallel work item.
+        int * m_parallelRunCount;                                   ///< Number of packets in the receive batch for each parallel work item.
+        bool m_sendBatchActive;                                     ///< True while inside SendPackets with send batching enabled. Transmitted packets are copied into the send batch instead of being sent immediately.
+        int m_sendBatchNumPackets;                                  ///< Number of packets currently in the send batch.
+        int m_sendBatchNumBytes;                                    ///< Number of bytes of the send batch buffer currently in use.
+        int m_sendPacingSlice;                                      ///< Slice of clients the next SendPackets call sends to, when serverSendPacingSlices > 1. Clients are in slice clientIndex % serverSendPacingSlices.
+        double * m_clientNextSendTime;                              ///< Time each client slot next sends at, with serverSendInterval or a client send rate. Allocated in Start with the global allocator.
+        uint8_t * m_sendBatchBuffer;                                ///< Buffer holding packet data for the send batch. Allocated in Start with the global allocator.
+        uint8_t ** m_sendBatchPacketData;                           ///< Pointers into the send batch buffer for each packet in the batch.
+        int * m_sendBatchPacketBytes;                               ///< Size of each packet in the send batch (bytes).
+        int * m_sendBatchClientIndex;                               ///< Client index each packet in the send batch is going to.
+        int m_sendBatchNumRuns;                                     ///< Number of per-client runs of packets in the send batch being flushed in parallel.
+        int * m_sendBatchRunStart;                                  ///< Index of the first packet in the send batch for each run. Allocated in Start when serverParallelTransportSend is true.
+        int * m_sendBatchRunCount;                                  ///< Number of packets in the send batch for each run.
+        Socket * m_socket;                                          ///< The plain UDP socket used instead of the netcode.io server in the trusted network mode. NULL otherwise.
+        TrustedClient * m_trustedClients;                           ///< Per-client state for the trusted network mode. Allocated in Start with the global allocator.
+        int m_numTrustedClients;                                    ///< Number of clients connected in the trusted network mode.
+        int m_trustedAddressIndexSize;                              ///< Number of slots in the trusted address index. A power of two, at least twice maxClients.
+        int * m_trustedAddressIndex;                                ///< Open addressing hash index from client address to trusted client index, for constant time lookup on receive. -1 for empty slots.
+        TrustedConnectFilterEntry * m_trustedConnectFilter;         ///< Per-address connect request rate limits, indexed by address hash. Allocated in Start with the global allocator when serverConnectRequestRate > 0.
+        int m_trustedConnectRequestsThisTick;                       ///< Number of connect requests checked in the current call to ReceivePackets.
+        int m_trustedProbesThisTick;                                ///< Number of probes answered in the current call to ReceivePackets.
+        uint8_t m_trustedReceiveBuffer[TrustedMaxPacketBytes];      ///< Scratch buffer trusted packets are received into.
+        uint8_t * m_trustedReceiveBatchBuffer;                      ///< Buffers for a batch of TrustedReceiveBatchSize received trusted packets. Allocated in Start with the global allocator when serverReceiveBatchSize > 0.
+        Address * m_trustedReceiveBatchFrom;                        ///< The address each packet in the trusted receive batch came from.
+        Address * m_sendBatchAddress;                               ///< The address each packet in the send batch is going to, in the trusted network mode. Allocated in Start with the send batch.
+        double m_tickPhaseTime[SERVER_TICK_PHASE_NUM_PHASES];       ///< Time each tick phase took the last time it ran (seconds). See GetTickPhaseTime.
     };
 }
 
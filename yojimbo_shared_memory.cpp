@@ -0,0 +1,258 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_shared_memory.h"
+#include "yojimbo_platform.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace yojimbo
+{
+    const uint32_t SharedMemoryMagic = 0x4D48534A;                          ///< Written last when the server end is set up, so a client never opens a half written mapping.
+    const uint32_t SharedMemoryWrapMarker = 0xFFFFFFFF;                     ///< Length of the record at the end of a ring that tells the reader to go back to the start.
+
+    /// The first cache line of the mapping. The rings follow it.
+
+    struct SharedMemoryLink::Header
+    {
+        volatile uint32_t magic;                                            ///< SharedMemoryMagic once the server end is set up.
+        uint32_t ringBytes;                                                 ///< The size of each ring (bytes).
+        int32_t clientIndex;                                                ///< The client slot of the link.
+        volatile int serverOpen;                                            ///< 1 while the server end is open.
+        volatile int clientState;                                           ///< 0 until a client opens the link, 1 while it is open, 2 once it closed.
+        uint8_t padding[CacheLineBytes - 20];
+    };
+
+    /// The indices of one ring, each on its own cache line, so the producer and consumer don't share one. The ring data follows.
+
+    struct SharedMemoryLink::Ring
+    {
+        volatile uint32_t writeIndex;                                       ///< Bytes written to the ring so far. Only the producer writes it.
+        uint8_t writePadding[CacheLineBytes - 4];
+        volatile uint32_t readIndex;                                        ///< Bytes read from the ring so far. Only the consumer writes it.
+        uint8_t readPadding[CacheLineBytes - 4];
+    };
+
+    // records are a 4 byte length followed by the packet, padded to 4 bytes. a record never wraps: if it doesn't fit before the end, a wrap marker fills the rest
+
+    static inline uint32_t GetRecordBytes( int packetBytes )
+    {
+        return 4 + ( ( uint32_t( packetBytes ) + 3 ) & ~3U );
+    }
+
+    SharedMemoryLink::SharedMemoryLink( const char * path, int ringBytes, int clientIndex )
+    {
+        yojimbo_assert( path );
+        yojimbo_assert( ringBytes >= 1024 );
+        yojimbo_assert( ( ringBytes & ( ringBytes - 1 ) ) == 0 );
+        yojimbo_assert( clientIndex >= 0 );
+        strncpy( m_path, path, sizeof( m_path ) - 1 );
+        m_path[sizeof(m_path)-1] = '\0';
+        m_server = true;
+        m_ringBytes = ringBytes;
+        m_mappingBytes = GetMappingBytes( ringBytes );
+        m_receiveIndex = 0;
+        m_header = (Header*) yojimbo_file_map( m_path, 0, m_mappingBytes, true );
+        if ( !m_header )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to map shared memory link %s\n", m_path );
+            return;
+        }
+        m_header->magic = 0;
+        yojimbo_memory_barrier();
+        memset( m_header, 0, sizeof( Header ) );
+        memset( GetRing( 0 ), 0, sizeof( Ring ) );
+        memset( GetRing( 1 ), 0, sizeof( Ring ) );
+        m_header->ringBytes = uint32_t( ringBytes );
+        m_header->clientIndex = clientIndex;
+        m_header->serverOpen = 1;
+        yojimbo_memory_barrier();
+        m_header->magic = SharedMemoryMagic;
+    }
+
+    SharedMemoryLink::SharedMemoryLink( const char * path )
+    {
+        yojimbo_assert( path );
+        strncpy( m_path, path, sizeof( m_path ) - 1 );
+        m_path[sizeof(m_path)-1] = '\0';
+        m_server = false;
+        m_ringBytes = 0;
+        m_mappingBytes = 0;
+        m_receiveIndex = 0;
+        m_header = NULL;
+
+        // map the header alone first, to find out how large the rings are
+
+        Header * header = (Header*) yojimbo_file_map( m_path, 0, sizeof( Header ), false );
+        if ( !header )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to open shared memory link %s\n", m_path );
+            return;
+        }
+        const bool valid = header->magic == SharedMemoryMagic && header->serverOpen;
+        const int ringBytes = int( header->ringBytes );
+        yojimbo_file_unmap( header, 0, sizeof( Header ) );
+        if ( !valid || ringBytes < 1024 || ( ringBytes & ( ringBytes - 1 ) ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: shared memory link %s is not open on the server\n", m_path );
+            return;
+        }
+
+        Header * mapping = (Header*) yojimbo_file_map( m_path, 0, GetMappingBytes( ringBytes ), true );
+        if ( !mapping )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to map shared memory link %s\n", m_path );
+            return;
+        }
+
+        if ( yojimbo_atomic_compare_exchange( &mapping->clientState, 1, 0 ) != 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: shared memory link %s is already open on another client\n", m_path );
+            yojimbo_file_unmap( mapping, 0, GetMappingBytes( ringBytes ) );
+            return;
+        }
+
+        m_ringBytes = ringBytes;
+        m_mappingBytes = GetMappingBytes( ringBytes );
+        m_header = mapping;
+        m_receiveIndex = GetRing( 0 )->readIndex;
+    }
+
+    SharedMemoryLink::~SharedMemoryLink()
+    {
+        if ( !m_header )
+            return;
+        yojimbo_memory_barrier();
+        if ( m_server )
+            m_header->serverOpen = 0;
+        else
+            m_header->clientState = 2;
+        yojimbo_file_unmap( m_header, 0, m_mappingBytes );
+        m_header = NULL;
+        // the client keeps its own mapping until it closes. on windows the file stays until then too
+        if ( m_server )
+            remove( m_path );
+    }
+
+    bool SharedMemoryLink::IsClosed() const
+    {
+        if ( !m_header )
+            return true;
+        return m_server ? m_header->clientState == 2 : m_header->serverOpen == 0;
+    }
+
+    int SharedMemoryLink::GetClientIndex() const
+    {
+        yojimbo_assert( m_header );
+        return m_header->clientIndex;
+    }
+
+    bool SharedMemoryLink::SendPacket( const uint8_t * packetData, int packetBytes )
+    {
+        yojimbo_assert( m_header );
+        yojimbo_assert( packetData );
+        yojimbo_assert( packetBytes > 0 );
+
+        // the server sends on ring 0 and the client on ring 1
+
+        Ring * ring = GetRing( m_server ? 0 : 1 );
+        uint8_t * data = GetRingData( m_server ? 0 : 1 );
+
+        const uint32_t recordBytes = GetRecordBytes( packetBytes );
+        if ( recordBytes > uint32_t( m_ringBytes ) / 2 )
+            return false;
+
+        uint32_t writeIndex = ring->writeIndex;
+        const uint32_t readIndex = ring->readIndex;
+        const uint32_t offset = writeIndex & uint32_t( m_ringBytes - 1 );
+        const uint32_t bytesToEnd = uint32_t( m_ringBytes ) - offset;
+        const uint32_t wrapBytes = ( recordBytes > bytesToEnd ) ? bytesToEnd : 0;
+
+        if ( writeIndex - readIndex + wrapBytes + recordBytes > uint32_t( m_ringBytes ) )
+            return false;
+
+        // the space must be seen free before it is written over
+
+        yojimbo_memory_barrier();
+
+        if ( wrapBytes )
+        {
+            *(uint32_t*) ( data + offset ) = SharedMemoryWrapMarker;
+            writeIndex += wrapBytes;
+        }
+
+        uint8_t * record = data + ( writeIndex & uint32_t( m_ringBytes - 1 ) );
+        *(uint32_t*) record = uint32_t( packetBytes );
+        memcpy( record + 4, packetData, packetBytes );
+
+        // the record must be written before the consumer can see it
+
+        yojimbo_memory_barrier();
+
+        ring->writeIndex = writeIndex + recordBytes;
+
+        return true;
+    }
+
+    uint8_t * SharedMemoryLink::ReceivePacket( int & packetBytes )
+    {
+        yojimbo_assert( m_header );
+
+        Ring * ring = GetRing( m_server ? 1 : 0 );
+        uint8_t * data = GetRingData( m_server ? 1 : 0 );
+
+        uint32_t readIndex = ring->readIndex;
+        if ( readIndex == ring->writeIndex )
+            return NULL;
+
+        // the record must be read after the write index that published it
+
+        yojimbo_memory_barrier();
+
+        uint32_t offset = readIndex & uint32_t( m_ringBytes - 1 );
+        uint32_t length = *(const uint32_t*) ( data + offset );
+        if ( length == SharedMemoryWrapMarker )
+        {
+            readIndex += uint32_t( m_ringBytes ) - offset;
+            offset = 0;
+            length = *(const uint32_t*) data;
+        }
+
+        yojimbo_assert( length > 0 );
+        yojimbo_assert( GetRecordBytes( length ) <= uint32_t( m_ringBytes ) / 2 );
+
+        m_receiveIndex = readIndex + GetRecordBytes( length );
+        packetBytes = int( length );
+        return data + offset + 4;
+    }
+
+    void SharedMemoryLink::ReleasePacket()
+    {
+        yojimbo_assert( m_header );
+
+        // and read before the producer can reuse it
+
+        yojimbo_memory_barrier();
+
+        GetRing( m_server ? 1 : 0 )->readIndex = m_receiveIndex;
+    }
+
+    size_t SharedMemoryLink::GetMappingBytes( int ringBytes )
+    {
+        return sizeof( Header ) + 2 * ( sizeof( Ring ) + size_t( ringBytes ) );
+    }
+
+    SharedMemoryLink::Ring * SharedMemoryLink::GetRing( int index )
+    {
+        yojimbo_assert( index == 0 || index == 1 );
+        return (Ring*) ( (uint8_t*) m_header + sizeof( Header ) + index * ( sizeof( Ring ) + size_t( m_ringBytes ) ) );
+    }
+
+    uint8_t * SharedMemoryLink::GetRingData( int index )
+    {
+        return (uint8_t*) GetRing( index ) + sizeof( Ring );
+    }
+}
@@ -0,0 +1,127 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_SHARED_MEMORY_H
+#define YOJIMBO_SHARED_MEMORY_H
+
+#include "yojimbo_config.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        A packet link between two processes on the same host, through a pair of single producer, single consumer rings in a shared file mapping.
+
+        The server creates the link and a client in another process opens it by path. Sending copies the packet into a ring and publishes it with a memory barrier. Receiving hands out a pointer into the ring, so reliable.io reads the packet in place. There are no syscalls per packet and no encryption, so only connect processes that trust each other, like a game server and its sidecars. On linux, put the file in /dev/shm so it never touches the disk.
+
+        Each end must be used from one thread at a time. See BaseServer::ConnectSharedMemoryClient and BaseClient::ConnectSharedMemory.
+     */
+
+    class SharedMemoryLink
+    {
+    public:
+
+        /**
+            Create a link, as the server end. Anything left in the file from an earlier link is cleared.
+
+            @param path The path of the file to map. Removed again when the link is destroyed.
+            @param ringBytes The size of the ring in each direction (bytes). Must be a power of two, with room for at least two of the largest packets.
+            @param clientIndex The client slot the link is connected to. Passed on to the client end.
+         */
+
+        SharedMemoryLink( const char * path, int ringBytes, int clientIndex );
+
+        /**
+            Open a link created by a server, as the client end. Fails if the server end is closed, or another client already opened the link.
+
+            @param path The path passed in to the server end.
+         */
+
+        explicit SharedMemoryLink( const char * path );
+
+        /**
+            Close the link, so the other end sees it closed, and unmap the file.
+         */
+
+        ~SharedMemoryLink();
+
+        /**
+            Did the link fail to create or open?
+
+            @returns True if the link can't be used.
+         */
+
+        bool IsError() const { return m_header == NULL; }
+
+        /**
+            Has the other end closed the link? The server end of a link that no client has opened yet is not closed.
+
+            @returns True if the other end closed the link.
+         */
+
+        bool IsClosed() const;
+
+        /**
+            Get the client slot the link is connected to.
+
+            @returns The client index passed in to the server end.
+         */
+
+        int GetClientIndex() const;
+
+        /**
+            Send a packet to the other end.
+
+            @param packetData The packet data. Copied into the ring.
+            @param packetBytes The size of the packet (bytes).
+
+            @returns True if the packet was sent. False if the ring is full, in which case the packet is dropped.
+         */
+
+        bool SendPacket( const uint8_t * packetData, int packetBytes );
+
+        /**
+            Get the next packet from the other end, without copying it. Call ReleasePacket once done with it.
+
+            @param packetBytes The size of the packet (out).
+
+            @returns The packet data, in the ring, or NULL if there is no packet waiting.
+         */
+
+        uint8_t * ReceivePacket( int & packetBytes );
+
+        /**
+            Release the packet returned by the last call to ReceivePacket, so the other end can reuse its space in the ring.
+         */
+
+        void ReleasePacket();
+
+    private:
+
+        SharedMemoryLink( const SharedMemoryLink & other );
+
+        const SharedMemoryLink & operator = ( const SharedMemoryLink & other );
+
+        struct Header;
+        struct Ring;
+
+        static size_t GetMappingBytes( int ringBytes );
+
+        Ring * GetRing( int index );
+
+        uint8_t * GetRingData( int index );
+
+        char m_path[256];                                                   ///< The path of the mapped file.
+        bool m_server;                                                      ///< True for the server end, which created the link.
+        int m_ringBytes;                                                    ///< The size of each ring (bytes).
+        size_t m_mappingBytes;                                              ///< The size of the mapping (bytes).
+        Header * m_header;                                                  ///< The mapping. NULL if the link failed to create or open.
+        uint32_t m_receiveIndex;                                            ///< The read index just past the packet returned by ReceivePacket, published by ReleasePacket.
+    };
+}
+
+#endif // #ifndef YOJIMBO_SHARED_MEMORY_H
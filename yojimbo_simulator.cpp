@@ -7,14 +7,17 @@
 #include "yojimbo_config.h"
 #include "yojimbo_simulator.h"
 #include "yojimbo_platform.h"
+#include <float.h>
 
 namespace yojimbo
 {
-    NetworkSimulator::NetworkSimulator( Allocator & allocator, int numPackets, double time )
+    NetworkSimulator::NetworkSimulator( Allocator & allocator, int numPackets, double time, int numPacketBuffers, int packetBufferBytes )
     {
         yojimbo_assert( numPackets > 0 );
         m_allocator = &allocator;
-        m_currentIndex = 0;
+        m_random.Seed( (uint64_t) rand() );
+        m_sequence = 0;
+        m_numPackets = 0;
         m_time = time;
         m_latency = 0.0f;
         m_jitter = 0.0f;
@@ -25,6 +28,31 @@ namespace yojimbo
         m_packetEntries = (PacketEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( PacketEntry ) * numPackets );
         yojimbo_assert( m_packetEntries );
         memset( m_packetEntries, 0, sizeof( PacketEntry ) * numPackets );
+        m_numPacketBuffers = 0;
+        m_packetBufferBytes = 0;
+        m_packetBuffers = NULL;
+        m_freePacketBuffers = NULL;
+        m_numFreePacketBuffers = 0;
+        m_links = NULL;
+        m_numLinks = 0;
+        if ( numPacketBuffers > 0 && packetBufferBytes > 0 )
+        {
+            m_packetBuffers = (uint8_t*) YOJIMBO_ALLOCATE( allocator, size_t( numPacketBuffers ) * packetBufferBytes );
+            m_freePacketBuffers = (uint8_t**) YOJIMBO_ALLOCATE( allocator, sizeof( uint8_t* ) * numPacketBuffers );
+            if ( m_packetBuffers && m_freePacketBuffers )
+            {
+                m_numPacketBuffers = numPacketBuffers;
+                m_packetBufferBytes = packetBufferBytes;
+                for ( int i = 0; i < numPacketBuffers; ++i )
+                    m_freePacketBuffers[i] = m_packetBuffers + size_t( numPacketBuffers - 1 - i ) * packetBufferBytes;
+                m_numFreePacketBuffers = numPacketBuffers;
+            }
+            else
+            {
+                YOJIMBO_FREE( allocator, m_packetBuffers );
+                YOJIMBO_FREE( allocator, m_freePacketBuffers );
+            }
+        }
     }
 
     NetworkSimulator::~NetworkSimulator()
@@ -33,6 +61,10 @@ namespace yojimbo
         yojimbo_assert( m_packetEntries );
         yojimbo_assert( m_numPacketEntries > 0 );
         DiscardPackets();
+        yojimbo_assert( m_numFreePacketBuffers == m_numPacketBuffers );
+        YOJIMBO_FREE( *m_allocator, m_packetBuffers );
+        YOJIMBO_FREE( *m_allocator, m_freePacketBuffers );
+        YOJIMBO_FREE( *m_allocator, m_links );
         YOJIMBO_FREE( *m_allocator, m_packetEntries );
         m_numPacketEntries = 0;
         m_allocator = NULL;
@@ -62,6 +94,45 @@ namespace yojimbo
         UpdateActive();
     }
 
+    bool NetworkSimulator::SetLinkConditions( int to, const NetworkLinkConditions & conditions )
+    {
+        yojimbo_assert( to >= 0 );
+
+        if ( to >= m_numLinks )
+        {
+            // links are set up once, when network conditions are configured, so growing one at a time is fine
+
+            const int numLinks = to + 1;
+            Link * links = (Link*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Link ) * numLinks );
+            if ( !links )
+                return false;
+            for ( int i = 0; i < numLinks; ++i )
+            {
+                if ( i < m_numLinks )
+                {
+                    links[i] = m_links[i];
+                    continue;
+                }
+                links[i].conditions = NetworkLinkConditions();
+                links[i].burstLossState = false;
+                links[i].queueFinishTime = 0.0;
+                links[i].traceIndex = 0;
+            }
+            YOJIMBO_FREE( *m_allocator, m_links );
+            m_links = links;
+            m_numLinks = numLinks;
+        }
+
+        yojimbo_assert( !conditions.trace || conditions.traceBytes >= 2 );
+
+        m_links[to].conditions = conditions;
+        m_links[to].traceIndex = 0;
+
+        UpdateActive();
+
+        return true;
+    }
+
     bool NetworkSimulator::IsActive() const
     {
         return m_active;
@@ -71,6 +142,11 @@ namespace yojimbo
     {
         bool previous = m_active;
         m_active = m_latency != 0.0f || m_jitter != 0.0f || m_packetLoss != 0.0f || m_duplicates != 0.0f;
+        for ( int i = 0; i < m_numLinks && !m_active; ++i )
+        {
+            if ( m_links[i].conditions.IsActive() )
+                m_active = true;
+        }
         if ( previous && !m_active )
         {
             DiscardPackets();
@@ -83,43 +159,190 @@ namespace yojimbo
         yojimbo_assert( packetData );
         yojimbo_assert( packetBytes > 0 );
 
-        if ( random_float( 0.0f, 100.0f ) <= m_packetLoss )
+        const bool traced = to < m_numLinks && m_links[to].conditions.trace;
+
+        double delay = 0.0;
+
+        if ( traced )
+        {
+            if ( !ReadTrace( to, delay ) )
+                return;
+        }
+        else
+        {
+            if ( m_random.GetFloat( 0.0f, 100.0f ) <= m_packetLoss )
+            {
+                return;
+            }
+
+            delay = m_latency / 1000.0;
+
+            if ( m_jitter > 0 )
+                delay += m_random.GetFloat( -m_jitter, +m_jitter ) / 1000.0;
+        }
+
+        if ( to < m_numLinks && !ApplyLinkConditions( to, packetBytes, delay ) )
         {
             return;
         }
 
-        PacketEntry & packetEntry = m_packetEntries[m_currentIndex];
+        InsertPacket( to, packetData, packetBytes, m_time + delay );
 
-        if ( packetEntry.packetData )
+        if ( !traced && m_random.GetFloat( 0.0f, 100.0f ) <= m_duplicates )
         {
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
-            packetEntry = PacketEntry();
+            InsertPacket( to, packetData, packetBytes, m_time + delay + m_random.GetFloat( 0, +1.0 ) );
+        }
+    }
+
+    bool NetworkSimulator::ApplyLinkConditions( int to, int packetBytes, double & delay )
+    {
+        Link & link = m_links[to];
+
+        const NetworkLinkConditions & conditions = link.conditions;
+
+        if ( conditions.burstLossEnter > 0.0f && !conditions.trace )
+        {
+            if ( link.burstLossState )
+            {
+                if ( m_random.GetFloat( 0.0f, 100.0f ) < conditions.burstLossExit )
+                    link.burstLossState = false;
+            }
+            else if ( m_random.GetFloat( 0.0f, 100.0f ) < conditions.burstLossEnter )
+            {
+                link.burstLossState = true;
+            }
+
+            if ( link.burstLossState && m_random.GetFloat( 0.0f, 100.0f ) < conditions.burstLoss )
+                return false;
         }
 
-        double delay = m_latency / 1000.0;
+        if ( conditions.bandwidth > 0.0f )
+        {
+            // packets go out one after another at the link rate. the backlog ahead of this packet is the queue
+
+            const double bytesPerSecond = conditions.bandwidth * 1000.0 / 8.0;
+            const double startTime = yojimbo_max( m_time, link.queueFinishTime );
+            const double queuedBytes = ( startTime - m_time ) * bytesPerSecond;
+
+            if ( queuedBytes + packetBytes > conditions.queueBytes )
+                return false;
+
+            link.queueFinishTime = startTime + packetBytes / bytesPerSecond;
+
+            delay += link.queueFinishTime - m_time;
+        }
+
+        if ( conditions.reorder > 0.0f && m_random.GetFloat( 0.0f, 100.0f ) < conditions.reorder )
+        {
+            delay += m_random.GetFloat( 0.0f, conditions.reorderDelay ) / 1000.0;
+        }
+
+        return true;
+    }
+
+    bool NetworkSimulator::ReadTrace( int to, double & delay )
+    {
+        Link & link = m_links[to];
 
-        if ( m_jitter > 0 )
-            delay += random_float( -m_jitter, +m_jitter ) / 1000.0;
+        const NetworkLinkConditions & conditions = link.conditions;
 
+        yojimbo_assert( conditions.trace );
+        yojimbo_assert( conditions.traceBytes >= 2 );
+
+        const uint8_t * entry = conditions.trace + link.traceIndex * 2;
+
+        const uint16_t value = uint16_t( entry[0] ) | ( uint16_t( entry[1] ) << 8 );
+
+        link.traceIndex = ( link.traceIndex + 1 ) % ( conditions.traceBytes / 2 );
+
+        if ( value == NetworkTraceLost )
+            return false;
+
+        delay = value / 10000.0;
+
+        return true;
+    }
+
+    void NetworkSimulator::InsertPacket( int to, const uint8_t * packetData, int packetBytes, double deliveryTime )
+    {
+        if ( m_numPackets == m_numPacketEntries )
+            return;
+
+        uint8_t * packetCopy = AcquirePacketBuffer( packetBytes );
+        if ( !packetCopy )
+            return;
+
+        memcpy( packetCopy, packetData, packetBytes );
+
+        PacketEntry & packetEntry = m_packetEntries[m_numPackets];
         packetEntry.to = to;
-        packetEntry.packetData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
-        memcpy( packetEntry.packetData, packetData, packetBytes );
+        packetEntry.deliveryTime = deliveryTime;
+        packetEntry.sequence = m_sequence++;
+        packetEntry.packetData = packetCopy;
         packetEntry.packetBytes = packetBytes;
-        packetEntry.deliveryTime = m_time + delay;
-        m_currentIndex = ( m_currentIndex + 1 ) % m_numPacketEntries;
 
-        if ( random_float( 0.0f, 100.0f ) <= m_duplicates )
+        SiftUp( m_numPackets++ );
+    }
+
+    uint8_t * NetworkSimulator::AcquirePacketBuffer( int packetBytes )
+    {
+        if ( packetBytes <= m_packetBufferBytes && m_numFreePacketBuffers > 0 )
+            return m_freePacketBuffers[--m_numFreePacketBuffers];
+        return (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
+    }
+
+    void NetworkSimulator::ReleasePacket( uint8_t * packetData )
+    {
+        if ( !packetData )
+            return;
+
+        if ( packetData >= m_packetBuffers && packetData < m_packetBuffers + size_t( m_numPacketBuffers ) * m_packetBufferBytes )
+        {
+            yojimbo_assert( ( packetData - m_packetBuffers ) % m_packetBufferBytes == 0 );
+            yojimbo_assert( m_numFreePacketBuffers < m_numPacketBuffers );
+            m_freePacketBuffers[m_numFreePacketBuffers++] = packetData;
+            return;
+        }
+
+        YOJIMBO_FREE( *m_allocator, packetData );
+    }
+
+    void NetworkSimulator::SiftUp( int index )
+    {
+        while ( index > 0 )
+        {
+            const int parent = ( index - 1 ) / 2;
+            if ( !m_packetEntries[index].DeliverBefore( m_packetEntries[parent] ) )
+                break;
+            yojimbo_swap( m_packetEntries[index], m_packetEntries[parent] );
+            index = parent;
+        }
+    }
+
+    void NetworkSimulator::SiftDown( int index )
+    {
+        while ( true )
         {
-            PacketEntry & nextPacketEntry = m_packetEntries[m_currentIndex];
-            nextPacketEntry.to = to;
-            nextPacketEntry.packetData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
-            memcpy( nextPacketEntry.packetData, packetData, packetBytes );
-            nextPacketEntry.packetBytes = packetBytes;
-            nextPacketEntry.deliveryTime = m_time + delay + random_float( 0, +1.0 );
-            m_currentIndex = ( m_currentIndex + 1 ) % m_numPacketEntries;
+            const int left = index * 2 + 1;
+            const int right = left + 1;
+            int first = index;
+            if ( left < m_numPackets && m_packetEntries[left].DeliverBefore( m_packetEntries[first] ) )
+                first = left;
+            if ( right < m_numPackets && m_packetEntries[right].DeliverBefore( m_packetEntries[first] ) )
+                first = right;
+            if ( first == index )
+                break;
+            yojimbo_swap( m_packetEntries[index], m_packetEntries[first] );
+            index = first;
         }
     }
 
+    double NetworkSimulator::GetNextDeliveryTime() const
+    {
+        // the packet entries are a min-heap ordered by delivery time
+        return m_numPackets > 0 ? m_packetEntries[0].deliveryTime : DBL_MAX;
+    }
+
     int NetworkSimulator::ReceivePackets( int maxPackets, uint8_t * packetData[], int packetBytes[], int to[] )
     {
         if ( !IsActive() )
@@ -127,22 +350,22 @@ namespace yojimbo
 
         int numPackets = 0;
 
-        for ( int i = 0; i < yojimbo_min( m_numPacketEntries, maxPackets ); ++i )
-        {
-            if ( !m_packetEntries[i].packetData )
-                continue;
+        // the root of the heap is always the next packet due, so only due packets are visited, in delivery order
 
-            if ( m_packetEntries[i].deliveryTime < m_time )
+        while ( numPackets < maxPackets && m_numPackets > 0 && m_packetEntries[0].deliveryTime < m_time )
+        {
+            packetData[numPackets] = m_packetEntries[0].packetData;
+            packetBytes[numPackets] = m_packetEntries[0].packetBytes;
+            if ( to )
             {
-                packetData[numPackets] = m_packetEntries[i].packetData;
-                packetBytes[numPackets] = m_packetEntries[i].packetBytes;
-                if ( to )
-                {
-                    to[numPackets] = m_packetEntries[i].to;
-                }
-                m_packetEntries[i].packetData = NULL;
-                numPackets++;
+                to[numPackets] = m_packetEntries[0].to;
             }
+            numPackets++;
+
+            m_numPackets--;
+            m_packetEntries[0] = m_packetEntries[m_numPackets];
+            m_packetEntries[m_numPackets] = PacketEntry();
+            SiftDown( 0 );
         }
 
         return numPackets;
@@ -150,30 +373,62 @@ namespace yojimbo
 
     void NetworkSimulator::DiscardPackets()
     {
-        for ( int i = 0; i < m_numPacketEntries; ++i )
+        for ( int i = 0; i < m_numPackets; ++i )
         {
             PacketEntry & packetEntry = m_packetEntries[i];
-            if ( !packetEntry.packetData )
-                continue;
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            ReleasePacket( packetEntry.packetData );
             packetEntry = PacketEntry();
         }
+        m_numPackets = 0;
+        for ( int i = 0; i < m_numLinks; ++i )
+        {
+            m_links[i].burstLossState = false;
+            m_links[i].queueFinishTime = 0.0;
+            m_links[i].traceIndex = 0;
+        }
     }
 
     void NetworkSimulator::DiscardClientPackets( int clientIndex )
     {
-        for ( int i = 0; i < m_numPacketEntries; ++i )
+        if ( clientIndex >= 0 && clientIndex < m_numLinks )
+        {
+            m_links[clientIndex].burstLossState = false;
+            m_links[clientIndex].queueFinishTime = 0.0;
+            m_links[clientIndex].traceIndex = 0;
+        }
+
+        // compact the remaining packets, then rebuild the heap in place. this only happens on disconnect, so linear time is fine
+
+        int numPackets = 0;
+        for ( int i = 0; i < m_numPackets; ++i )
         {
             PacketEntry & packetEntry = m_packetEntries[i];
-            if ( !packetEntry.packetData || packetEntry.to != clientIndex )
+            if ( packetEntry.to == clientIndex )
+            {
+                ReleasePacket( packetEntry.packetData );
+                packetEntry = PacketEntry();
                 continue;
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
-            packetEntry = PacketEntry();
+            }
+            if ( numPackets != i )
+            {
+                m_packetEntries[numPackets] = packetEntry;
+                packetEntry = PacketEntry();
+            }
+            numPackets++;
         }
+
+        if ( numPackets == m_numPackets )
+            return;
+
+        m_numPackets = numPackets;
+
+        for ( int i = m_numPackets / 2 - 1; i >= 0; --i )
+            SiftDown( i );
     }
 
     void NetworkSimulator::AdvanceTime( double time )
     {
+        YOJIMBO_PROFILE_SCOPE( "NetworkSimulator::AdvanceTime" );
         m_time = time;
     }
 }
@@ -15,6 +15,49 @@
 
 namespace yojimbo
 {
+    /// Trace entry value for a packet that was lost. See NetworkLinkConditions::trace.
+
+    const uint16_t NetworkTraceLost = 0xFFFF;
+
+    /**
+        Conditions of a simulated link, on top of the network simulator latency, jitter, loss and duplicates. See NetworkSimulator::SetLinkConditions.
+
+        The defaults are an ideal link, which adds nothing.
+     */
+
+    struct NetworkLinkConditions
+    {
+        float bandwidth;                                ///< Link bandwidth (kbps). Packets queue up behind each other at this rate, so sending faster than the link adds latency. 0 is unlimited.
+        int queueBytes;                                 ///< Maximum bytes waiting to go out over the bandwidth limited link. Packets that would overflow the queue are dropped, like a router with a full buffer.
+        float burstLossEnter;                           ///< Percentage chance per packet that the link goes from the good state to the bad state (Gilbert-Elliott model).
+        float burstLossExit;                            ///< Percentage chance per packet that the link goes from the bad state back to the good state. The average burst is 100 / burstLossExit packets long.
+        float burstLoss;                                ///< Packet loss percentage while in the bad state.
+        float reorder;                                  ///< Percentage chance a packet is held back by an extra random delay, so packets sent after it arrive first.
+        float reorderDelay;                             ///< Maximum extra delay for held back packets (milliseconds). The delay is uniform in [0,reorderDelay].
+        const uint8_t * trace;                          ///< Recorded per-packet delay and loss to replay, or NULL. One 16 bit little endian entry per packet sent: the one way delay in tenths of a millisecond, or NetworkTraceLost. The trace loops when it runs out. It replaces latency, jitter, packet loss, burst loss and duplicates for the link, so replay is deterministic. Not copied, so it can point into a memory mapped file, but it must stay valid while it is set.
+        int traceBytes;                                 ///< Size of the trace (bytes).
+
+        NetworkLinkConditions()
+        {
+            bandwidth = 0.0f;
+            queueBytes = 64 * 1024;
+            burstLossEnter = 0.0f;
+            burstLossExit = 100.0f;
+            burstLoss = 100.0f;
+            reorder = 0.0f;
+            reorderDelay = 0.0f;
+            trace = NULL;
+            traceBytes = 0;
+        }
+
+        /// True if these conditions change anything about the link.
+
+        bool IsActive() const
+        {
+            return bandwidth > 0.0f || burstLossEnter > 0.0f || ( reorder > 0.0f && reorderDelay > 0.0f ) || trace != NULL;
+        }
+    };
+
     /**
         Simulates packet loss, latency, jitter and duplicate packets.
 
@@ -38,11 +81,13 @@ namespace yojimbo
                 Duplicates: 0%
 
             @param allocator The allocator to use.
-            @param numPackets The maximum number of packets that can be stored in the simulator at any time.
+            @param numPackets The maximum number of packets that can be stored in the simulator at any time. Packets sent while the simulator is full are dropped.
             @param time The initial time value in seconds.
+            @param numPacketBuffers The number of packet buffers to reserve up-front. Packets are copied into these instead of being allocated one by one. 0 allocates every packet.
+            @param packetBufferBytes The size of each packet buffer (bytes). Larger packets are allocated.
          */
 
-        NetworkSimulator( Allocator & allocator, int numPackets, double time );
+        NetworkSimulator( Allocator & allocator, int numPackets, double time, int numPacketBuffers = 0, int packetBufferBytes = 0 );
 
         /**
             Network simulator destructor.
@@ -90,10 +135,33 @@ namespace yojimbo
 
         void SetDuplicates( float percent );
 
+        /**
+            Set the conditions of the link packets sent to a slot index take: bandwidth limit and queueing, burst loss and reordering.
+
+            These apply on top of the latency, jitter, loss and duplicates, which are shared by every link. Links start out as ideal links.
+
+            @param to The slot index the conditions apply to. On the server this is the client index. The client sends everything to slot 0.
+            @param conditions The link conditions.
+
+            @returns True if the conditions were set, false if storage for the link could not be allocated.
+         */
+
+        bool SetLinkConditions( int to, const NetworkLinkConditions & conditions );
+
+        /**
+            Seed the random number generator that drives loss, jitter, duplicates and reordering.
+
+            Each simulator has its own generator, seeded from rand() when it is created. Seed it explicitly to send exactly the same simulated traffic on every run.
+
+            @param seed The seed.
+         */
+
+        void SetSeed( uint64_t seed ) { m_random.Seed( seed ); }
+
         /**
             Is the network simulator active?
 
-            The network simulator is active when packet loss, latency, duplicates or jitter are non-zero values.
+            The network simulator is active when packet loss, latency, duplicates or jitter are non-zero values, or any link has conditions set.
 
             This is used by the transport to know whether it should shunt packets through the simulator, or send them directly to the network. This is a minor optimization.
          */
@@ -115,7 +183,7 @@ namespace yojimbo
         /**
             Receive packets sent to any address.
 
-            IMPORTANT: You take ownership of the packet data you receive and are responsible for freeing it. See NetworkSimulator::GetAllocator.
+            IMPORTANT: You take ownership of the packet data you receive and are responsible for releasing it with NetworkSimulator::ReleasePacket.
 
             @param maxPackets The maximum number of packets to receive.
             @param packetData Array of packet data pointers to be filled [out].
@@ -127,6 +195,32 @@ namespace yojimbo
 
         int ReceivePackets( int maxPackets, uint8_t * packetData[], int packetBytes[], int to[] );
 
+        /**
+            Get the number of packets in the simulator, waiting to be delivered.
+
+            @returns The number of packets in flight.
+         */
+
+        int GetNumPackets() const { return m_numPackets; }
+
+        /**
+            Get the time the next packet in the simulator is due to be delivered.
+
+            @returns The delivery time in seconds, or DBL_MAX if there are no packets in the simulator.
+         */
+
+        double GetNextDeliveryTime() const;
+
+        /**
+            Release packet data returned by NetworkSimulator::ReceivePackets.
+
+            Pooled buffers go back to the pool. Anything else is freed with the simulator allocator.
+
+            @param packetData The packet data to release. May be NULL.
+         */
+
+        void ReleasePacket( uint8_t * packetData );
+
         /**
             Discard all packets in the network simulator.
 
@@ -154,9 +248,9 @@ namespace yojimbo
         void AdvanceTime( double time );
 
         /**
-            Get the allocator to use to free packet data.
+            Get the allocator the simulator allocates with.
 
-            @returns The allocator that packet data is allocated with.
+            @returns The allocator passed in to the constructor.
          */
 
         Allocator & GetAllocator() { yojimbo_assert( m_allocator ); return *m_allocator; }
@@ -171,6 +265,68 @@ namespace yojimbo
 
         void UpdateActive();
 
+        /**
+            Copy a packet into the delivery queue.
+
+            Dropped if the queue is full, so packets waiting to be delivered are never overwritten.
+
+            @param to The slot index the packet should be sent to.
+            @param packetData The packet data.
+            @param packetBytes The packet size (bytes).
+            @param deliveryTime The time the packet should be delivered (seconds).
+         */
+
+        void InsertPacket( int to, const uint8_t * packetData, int packetBytes, double deliveryTime );
+
+        /**
+            Get a buffer to copy a packet into, from the pool if possible.
+
+            @param packetBytes The packet size (bytes).
+
+            @returns The buffer, or NULL if it could not be allocated.
+         */
+
+        uint8_t * AcquirePacketBuffer( int packetBytes );
+
+        /**
+            Apply link conditions to a packet being sent.
+
+            @param to The slot index the packet is sent to.
+            @param packetBytes The packet size (bytes).
+            @param delay The delay so far (seconds). Increased by queueing and reordering [in/out].
+
+            @returns False if the link drops the packet.
+         */
+
+        bool ApplyLinkConditions( int to, int packetBytes, double & delay );
+
+        /**
+            Read the next entry of a link trace.
+
+            @param to The slot index of the link, which must have a trace.
+            @param delay The delay recorded for the packet (seconds) [out].
+
+            @returns False if the trace recorded the packet as lost.
+         */
+
+        bool ReadTrace( int to, double & delay );
+
+        /**
+            Restore the heap property by moving an entry towards the root.
+
+            @param index The index of the entry in the packet entry array.
+         */
+
+        void SiftUp( int index );
+
+        /**
+            Restore the heap property by moving an entry towards the leaves.
+
+            @param index The index of the entry in the packet entry array.
+         */
+
+        void SiftDown( int index );
+
     private:
 
         Allocator * m_allocator;                        ///< The allocator passed in to the constructor. It's used to allocate and free packet data.
@@ -179,6 +335,7 @@ namespace yojimbo
         float m_packetLoss;                             ///< Packet loss percentage.
         float m_duplicates;                             ///< Duplicate packet percentage
         bool m_active;                                  ///< True if network simulator is active, eg. if any of the network settings above are enabled.
+        Random m_random;                                ///< Random number generator for the simulated network conditions.
 
         /// A packet buffered in the network simulator.
 
@@ -188,20 +345,50 @@ namespace yojimbo
             {
                 to = 0;
                 deliveryTime = 0.0;
+                sequence = 0;
                 packetData = NULL;
                 packetBytes = 0;
             }
 
+            /// True if this packet should be delivered before the other. Packets with the same delivery time are delivered in the order they were sent.
+
+            bool DeliverBefore( const PacketEntry & other ) const
+            {
+                if ( deliveryTime != other.deliveryTime )
+                    return deliveryTime < other.deliveryTime;
+                return sequence < other.sequence;
+            }
+
             int to;                                     ///< To index this packet should be sent to (for server -> client packets).
             double deliveryTime;                        ///< Delivery time for this packet (seconds).
+            uint64_t sequence;                          ///< Order the packet was inserted in. Breaks ties between packets with the same delivery time.
             uint8_t * packetData;                       ///< Packet data (owns this pointer).
             int packetBytes;                            ///< Size of packet in bytes.
         };
 
         double m_time;                                  ///< Current time from last call to advance time.
-        int m_currentIndex;                             ///< Current index in the packet entry array. New packets are inserted here.
+        uint64_t m_sequence;                            ///< Sequence number for the next packet inserted.
+        int m_numPackets;                               ///< Number of packets in the simulator. These are the first m_numPackets entries of the packet entry array.
         int m_numPacketEntries;                         ///< Number of elements in the packet entry array.
-        PacketEntry * m_packetEntries;                  ///< Pointer to dynamically allocated packet entries. This is where buffered packets are stored.
+        PacketEntry * m_packetEntries;                  ///< Pointer to dynamically allocated packet entries. A binary min-heap ordered by delivery time, so due packets are found without scanning.
+
+        /// A simulated link to one slot index.
+
+        struct Link
+        {
+            NetworkLinkConditions conditions;           ///< The link conditions.
+            bool burstLossState;                        ///< True while the link is in the bad state of the burst loss model.
+            double queueFinishTime;                     ///< Time the last packet queued on the link finishes going out (seconds).
+            int traceIndex;                             ///< Index of the next trace entry to replay.
+        };
+
+        Link * m_links;                                 ///< Links for slot indices [0,m_numLinks-1]. Slots without a link use ideal conditions. NULL until link conditions are first set.
+        int m_numLinks;                                 ///< Number of elements in the links array.
+        int m_numPacketBuffers;                         ///< Number of buffers in the packet buffer pool.
+        int m_packetBufferBytes;                        ///< Size of each buffer in the packet buffer pool (bytes).
+        uint8_t * m_packetBuffers;                      ///< Memory for the packet buffer pool. NULL if there is no pool.
+        uint8_t ** m_freePacketBuffers;                 ///< Stack of the packet buffers not in use.
+        int m_numFreePacketBuffers;                     ///< Number of entries in the free packet buffer stack.
     };
 }
 
@@ -0,0 +1,779 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#if defined( __linux__ ) && !defined( _GNU_SOURCE )
+#define _GNU_SOURCE                 // recvmmsg and sendmmsg
+#endif // #if defined( __linux__ ) && !defined( _GNU_SOURCE )
+
+#include "yojimbo_config.h"
+#include "yojimbo_platform.h"
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+    #define NOMINMAX
+    #define _WINSOCK_DEPRECATED_NO_WARNINGS
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <ws2ipdef.h>
+    #include <mswsock.h>
+    #pragma comment( lib, "WS2_32.lib" )
+
+    #ifdef SetPort
+    #undef SetPort
+    #endif // #ifdef SetPort
+
+    typedef int socklen_t;
+    typedef SOCKET SocketHandle;
+
+#elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
+
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <netinet/in.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+
+    typedef int SocketHandle;
+
+#else
+
+    #error yojimbo unknown platform!
+
+#endif
+
+#include <memory.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "yojimbo_socket.h"
+#include "yojimbo_utility.h"
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined( __linux__ )
+#define YOJIMBO_SOCKET_MMSG 1
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined( __linux__ )
+#define YOJIMBO_SOCKET_MMSG 0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined( __linux__ )
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#define YOJIMBO_SOCKET_RIO 1
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#define YOJIMBO_SOCKET_RIO 0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+namespace yojimbo
+{
+    static socklen_t AddressToSocketAddress( const Address & address, sockaddr_storage & socketAddress )
+    {
+        memset( &socketAddress, 0, sizeof( socketAddress ) );
+        if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            sockaddr_in6 * address6 = (sockaddr_in6*) &socketAddress;
+            address6->sin6_family = AF_INET6;
+            const uint16_t * words = address.GetAddress6();
+            for ( int i = 0; i < 8; ++i )
+                ( (uint16_t*) &address6->sin6_addr )[i] = htons( words[i] );
+            address6->sin6_port = htons( address.GetPort() );
+            return sizeof( sockaddr_in6 );
+        }
+        else
+        {
+            sockaddr_in * address4 = (sockaddr_in*) &socketAddress;
+            address4->sin_family = AF_INET;
+            memcpy( &address4->sin_addr, address.GetAddress4(), 4 );
+            address4->sin_port = htons( address.GetPort() );
+            return sizeof( sockaddr_in );
+        }
+    }
+
+    static bool SocketAddressToAddress( const sockaddr_storage & socketAddress, Address & address )
+    {
+        if ( socketAddress.ss_family == AF_INET6 )
+        {
+            const sockaddr_in6 * address6 = (const sockaddr_in6*) &socketAddress;
+            uint16_t words[8];
+            for ( int i = 0; i < 8; ++i )
+                words[i] = ntohs( ( (const uint16_t*) &address6->sin6_addr )[i] );
+            address = Address( words, ntohs( address6->sin6_port ) );
+            return true;
+        }
+        else if ( socketAddress.ss_family == AF_INET )
+        {
+            const sockaddr_in * address4 = (const sockaddr_in*) &socketAddress;
+            address = Address( (const uint8_t*) &address4->sin_addr, ntohs( address4->sin_port ) );
+            return true;
+        }
+        return false;
+    }
+
+#if YOJIMBO_SOCKET_RIO
+
+    /*
+        Registered I/O state for a socket. Receives are kept posted in every receive slot, and completions are polled
+        without notification, so a batch costs one dequeue call instead of one system call per packet. Packets are
+        copied between the registered slots and the buffers passed in by the caller.
+     */
+
+    const int RegisteredIONumReceiveSlots = SocketBatchSize * 4;
+    const int RegisteredIONumSendSlots = SocketBatchSize * 4;
+    const int RegisteredIONumSlots = RegisteredIONumReceiveSlots + RegisteredIONumSendSlots;
+    const int RegisteredIOSlotBytes = 2048;
+
+    struct RegisteredIO
+    {
+        RIO_EXTENSION_FUNCTION_TABLE rio;
+        uint8_t * data;
+        SOCKADDR_INET * addresses;
+        RIO_BUFFERID dataBufferId;
+        RIO_BUFFERID addressBufferId;
+        RIO_CQ receiveQueue;
+        RIO_CQ sendQueue;
+        RIO_RQ requestQueue;
+        int numFreeSendSlots;
+        int freeSendSlots[RegisteredIONumSendSlots];
+    };
+
+    static void RegisteredIODestroy( RegisteredIO * registeredIO )
+    {
+        if ( !registeredIO )
+            return;
+        if ( registeredIO->receiveQueue != RIO_INVALID_CQ )
+            registeredIO->rio.RIOCloseCompletionQueue( registeredIO->receiveQueue );
+        if ( registeredIO->sendQueue != RIO_INVALID_CQ )
+            registeredIO->rio.RIOCloseCompletionQueue( registeredIO->sendQueue );
+        if ( registeredIO->dataBufferId != RIO_INVALID_BUFFERID )
+            registeredIO->rio.RIODeregisterBuffer( registeredIO->dataBufferId );
+        if ( registeredIO->addressBufferId != RIO_INVALID_BUFFERID )
+            registeredIO->rio.RIODeregisterBuffer( registeredIO->addressBufferId );
+        if ( registeredIO->data )
+            VirtualFree( registeredIO->data, 0, MEM_RELEASE );
+        if ( registeredIO->addresses )
+            VirtualFree( registeredIO->addresses, 0, MEM_RELEASE );
+        delete registeredIO;
+    }
+
+    static bool RegisteredIOPostReceive( RegisteredIO * registeredIO, int slot, DWORD flags )
+    {
+        RIO_BUF data;
+        data.BufferId = registeredIO->dataBufferId;
+        data.Offset = slot * RegisteredIOSlotBytes;
+        data.Length = RegisteredIOSlotBytes;
+        RIO_BUF address;
+        address.BufferId = registeredIO->addressBufferId;
+        address.Offset = slot * sizeof( SOCKADDR_INET );
+        address.Length = sizeof( SOCKADDR_INET );
+        return registeredIO->rio.RIOReceiveEx( registeredIO->requestQueue, &data, 1, NULL, &address, NULL, NULL, flags, (PVOID) (intptr_t) slot ) != FALSE;
+    }
+
+    static RegisteredIO * RegisteredIOCreate( SOCKET handle )
+    {
+        RegisteredIO * registeredIO = new RegisteredIO;
+        memset( registeredIO, 0, sizeof( RegisteredIO ) );
+        registeredIO->dataBufferId = RIO_INVALID_BUFFERID;
+        registeredIO->addressBufferId = RIO_INVALID_BUFFERID;
+        registeredIO->receiveQueue = RIO_INVALID_CQ;
+        registeredIO->sendQueue = RIO_INVALID_CQ;
+        registeredIO->requestQueue = RIO_INVALID_RQ;
+
+        GUID functionTableId = WSAID_MULTIPLE_RIO;
+        DWORD bytes = 0;
+        if ( WSAIoctl( handle, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof( GUID ), &registeredIO->rio, sizeof( registeredIO->rio ), &bytes, NULL, NULL ) != 0 )
+        {
+            RegisteredIODestroy( registeredIO );
+            return NULL;
+        }
+
+        registeredIO->data = (uint8_t*) VirtualAlloc( NULL, RegisteredIONumSlots * RegisteredIOSlotBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+        registeredIO->addresses = (SOCKADDR_INET*) VirtualAlloc( NULL, RegisteredIONumSlots * sizeof( SOCKADDR_INET ), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+        if ( !registeredIO->data || !registeredIO->addresses )
+        {
+            RegisteredIODestroy( registeredIO );
+            return NULL;
+        }
+
+        registeredIO->dataBufferId = registeredIO->rio.RIORegisterBuffer( (PCHAR) registeredIO->data, RegisteredIONumSlots * RegisteredIOSlotBytes );
+        registeredIO->addressBufferId = registeredIO->rio.RIORegisterBuffer( (PCHAR) registeredIO->addresses, RegisteredIONumSlots * sizeof( SOCKADDR_INET ) );
+        registeredIO->receiveQueue = registeredIO->rio.RIOCreateCompletionQueue( RegisteredIONumReceiveSlots, NULL );
+        registeredIO->sendQueue = registeredIO->rio.RIOCreateCompletionQueue( RegisteredIONumSendSlots, NULL );
+        if ( registeredIO->dataBufferId == RIO_INVALID_BUFFERID || registeredIO->addressBufferId == RIO_INVALID_BUFFERID || 
+             registeredIO->receiveQueue == RIO_INVALID_CQ || registeredIO->sendQueue == RIO_INVALID_CQ )
+        {
+            RegisteredIODestroy( registeredIO );
+            return NULL;
+        }
+
+        registeredIO->requestQueue = registeredIO->rio.RIOCreateRequestQueue( handle, RegisteredIONumReceiveSlots, 1, RegisteredIONumSendSlots, 1, registeredIO->receiveQueue, registeredIO->sendQueue, NULL );
+        if ( registeredIO->requestQueue == RIO_INVALID_RQ )
+        {
+            RegisteredIODestroy( registeredIO );
+            return NULL;
+        }
+
+        // the receive slots come first, then the send slots
+
+        for ( int i = 0; i < RegisteredIONumReceiveSlots; ++i )
+        {
+            if ( !RegisteredIOPostReceive( registeredIO, i, RIO_MSG_DEFER ) )
+            {
+                RegisteredIODestroy( registeredIO );
+                return NULL;
+            }
+        }
+        registeredIO->rio.RIOReceive( registeredIO->requestQueue, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL );
+
+        registeredIO->numFreeSendSlots = RegisteredIONumSendSlots;
+        for ( int i = 0; i < RegisteredIONumSendSlots; ++i )
+            registeredIO->freeSendSlots[i] = RegisteredIONumReceiveSlots + i;
+
+        return registeredIO;
+    }
+
+    static void RegisteredIOReclaimSendSlots( RegisteredIO * registeredIO )
+    {
+        RIORESULT results[SocketBatchSize];
+        while ( true )
+        {
+            const ULONG numResults = registeredIO->rio.RIODequeueCompletion( registeredIO->sendQueue, results, SocketBatchSize );
+            if ( numResults == 0 || numResults == RIO_CORRUPT_CQ )
+                return;
+            for ( ULONG i = 0; i < numResults; ++i )
+            {
+                yojimbo_assert( registeredIO->numFreeSendSlots < RegisteredIONumSendSlots );
+                registeredIO->freeSendSlots[registeredIO->numFreeSendSlots++] = (int) results[i].RequestContext;
+            }
+        }
+    }
+
+    static int RegisteredIOSendPackets( RegisteredIO * registeredIO, const Address * to, uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        int numSent = 0;
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            if ( packetBytes[i] > RegisteredIOSlotBytes )
+                continue;
+            if ( registeredIO->numFreeSendSlots == 0 )
+            {
+                // commit what is queued so far, then wait for the completions to come back
+                registeredIO->rio.RIOSend( registeredIO->requestQueue, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL );
+                RegisteredIOReclaimSendSlots( registeredIO );
+                if ( registeredIO->numFreeSendSlots == 0 )
+                    break;
+            }
+            const int slot = registeredIO->freeSendSlots[--registeredIO->numFreeSendSlots];
+            memcpy( registeredIO->data + slot * RegisteredIOSlotBytes, packetData[i], packetBytes[i] );
+            sockaddr_storage socketAddress;
+            AddressToSocketAddress( to[i], socketAddress );
+            memcpy( &registeredIO->addresses[slot], &socketAddress, sizeof( SOCKADDR_INET ) );
+            RIO_BUF data;
+            data.BufferId = registeredIO->dataBufferId;
+            data.Offset = slot * RegisteredIOSlotBytes;
+            data.Length = packetBytes[i];
+            RIO_BUF address;
+            address.BufferId = registeredIO->addressBufferId;
+            address.Offset = slot * sizeof( SOCKADDR_INET );
+            address.Length = sizeof( SOCKADDR_INET );
+            if ( !registeredIO->rio.RIOSendEx( registeredIO->requestQueue, &data, 1, NULL, &address, NULL, NULL, RIO_MSG_DEFER, (PVOID) (intptr_t) slot ) )
+            {
+                registeredIO->freeSendSlots[registeredIO->numFreeSendSlots++] = slot;
+                continue;
+            }
+            numSent++;
+        }
+        registeredIO->rio.RIOSend( registeredIO->requestQueue, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL );
+        RegisteredIOReclaimSendSlots( registeredIO );
+        return numSent;
+    }
+
+    static int RegisteredIOReceivePackets( RegisteredIO * registeredIO, Address * from, uint8_t * const * packetData, int * packetBytes, int maxPacketBytes, int maxPackets )
+    {
+        RIORESULT results[SocketBatchSize];
+        int numPackets = 0;
+        while ( numPackets < maxPackets )
+        {
+            const ULONG batchSize = (ULONG) yojimbo_min( maxPackets - numPackets, SocketBatchSize );
+            const ULONG numResults = registeredIO->rio.RIODequeueCompletion( registeredIO->receiveQueue, results, batchSize );
+            if ( numResults == 0 || numResults == RIO_CORRUPT_CQ )
+                break;
+            for ( ULONG i = 0; i < numResults; ++i )
+            {
+                const int slot = (int) results[i].RequestContext;
+                const int bytes = (int) results[i].BytesTransferred;
+                if ( results[i].Status == 0 && bytes > 0 && bytes <= maxPacketBytes )
+                {
+                    sockaddr_storage socketAddress;
+                    memset( &socketAddress, 0, sizeof( socketAddress ) );
+                    memcpy( &socketAddress, &registeredIO->addresses[slot], sizeof( SOCKADDR_INET ) );
+                    if ( SocketAddressToAddress( socketAddress, from[numPackets] ) )
+                    {
+                        memcpy( packetData[numPackets], registeredIO->data + slot * RegisteredIOSlotBytes, bytes );
+                        packetBytes[numPackets++] = bytes;
+                    }
+                }
+                RegisteredIOPostReceive( registeredIO, slot, RIO_MSG_DEFER );
+            }
+            registeredIO->rio.RIOReceive( registeredIO->requestQueue, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL );
+            if ( numResults < batchSize )
+                break;
+        }
+        return numPackets;
+    }
+
+#endif // #if YOJIMBO_SOCKET_RIO
+
+    Socket::Socket( const Address & address, int sendBufferSize, int receiveBufferSize, bool registeredIO, bool reusePort )
+    {
+        yojimbo_assert( address.IsValid() );
+
+        m_handle = 0;
+        m_address = address;
+        m_error = true;
+        m_registeredIO = NULL;
+
+        const int family = address.GetType() == ADDRESS_IPV6 ? AF_INET6 : AF_INET;
+
+#if YOJIMBO_SOCKET_RIO
+        SocketHandle handle = registeredIO ? WSASocket( family, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO ) : socket( family, SOCK_DGRAM, IPPROTO_UDP );
+#else // #if YOJIMBO_SOCKET_RIO
+        (void) registeredIO;
+        SocketHandle handle = socket( family, SOCK_DGRAM, IPPROTO_UDP );
+#endif // #if YOJIMBO_SOCKET_RIO
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( handle == INVALID_SOCKET )
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( handle < 0 )
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create socket\n" );
+            return;
+        }
+
+        m_handle = (uint64_t) handle;
+
+        setsockopt( handle, SOL_SOCKET, SO_SNDBUF, (char*) &sendBufferSize, sizeof( int ) );
+        setsockopt( handle, SOL_SOCKET, SO_RCVBUF, (char*) &receiveBufferSize, sizeof( int ) );
+
+        if ( reusePort )
+        {
+#if defined( __linux__ ) && defined( SO_REUSEPORT )
+            int enable = 1;
+            if ( setsockopt( handle, SOL_SOCKET, SO_REUSEPORT, (char*) &enable, sizeof( enable ) ) != 0 )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to set SO_REUSEPORT on socket\n" );
+#else // #if defined( __linux__ ) && defined( SO_REUSEPORT )
+            // other platforms either lack SO_REUSEPORT, or deliver every packet to the last socket bound instead of hashing between them
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "reuse port is only supported on linux\n" );
+#endif // #if defined( __linux__ ) && defined( SO_REUSEPORT )
+        }
+
+        if ( family == AF_INET6 )
+        {
+            int ipv6Only = 1;
+            setsockopt( handle, IPPROTO_IPV6, IPV6_V6ONLY, (char*) &ipv6Only, sizeof( ipv6Only ) );
+
+            sockaddr_in6 socketAddress;
+            memset( &socketAddress, 0, sizeof( socketAddress ) );
+            socketAddress.sin6_family = AF_INET6;
+            const uint16_t * address6 = address.GetAddress6();
+            for ( int i = 0; i < 8; ++i )
+                ( (uint16_t*) &socketAddress.sin6_addr )[i] = htons( address6[i] );
+            socketAddress.sin6_port = htons( address.GetPort() );
+            if ( bind( handle, (sockaddr*) &socketAddress, sizeof( socketAddress ) ) < 0 )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to bind socket (ipv6)\n" );
+                return;
+            }
+            socklen_t length = sizeof( socketAddress );
+            if ( getsockname( handle, (sockaddr*) &socketAddress, &length ) == 0 )
+                m_address.SetPort( ntohs( socketAddress.sin6_port ) );
+        }
+        else
+        {
+            sockaddr_in socketAddress;
+            memset( &socketAddress, 0, sizeof( socketAddress ) );
+            socketAddress.sin_family = AF_INET;
+            memcpy( &socketAddress.sin_addr, address.GetAddress4(), 4 );
+            socketAddress.sin_port = htons( address.GetPort() );
+            if ( bind( handle, (sockaddr*) &socketAddress, sizeof( socketAddress ) ) < 0 )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to bind socket (ipv4)\n" );
+                return;
+            }
+            socklen_t length = sizeof( socketAddress );
+            if ( getsockname( handle, (sockaddr*) &socketAddress, &length ) == 0 )
+                m_address.SetPort( ntohs( socketAddress.sin_port ) );
+        }
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        DWORD nonBlocking = 1;
+        if ( ioctlsocket( handle, FIONBIO, &nonBlocking ) != 0 )
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( fcntl( handle, F_SETFL, O_NONBLOCK, 1 ) == -1 )
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to make socket non-blocking\n" );
+            return;
+        }
+
+#if YOJIMBO_SOCKET_RIO
+        if ( registeredIO )
+        {
+            m_registeredIO = RegisteredIOCreate( handle );
+            if ( !m_registeredIO )
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_INFO, "registered i/o not available. falling back to winsock\n" );
+        }
+#endif // #if YOJIMBO_SOCKET_RIO
+
+        m_error = false;
+    }
+
+    Socket::~Socket()
+    {
+        if ( !m_handle )
+            return;
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        closesocket( (SocketHandle) m_handle );
+#if YOJIMBO_SOCKET_RIO
+        // the request queue goes with the socket. the completion queues and buffers are released after it
+        RegisteredIODestroy( (RegisteredIO*) m_registeredIO );
+        m_registeredIO = NULL;
+#endif // #if YOJIMBO_SOCKET_RIO
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        close( (SocketHandle) m_handle );
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        m_handle = 0;
+    }
+
+    bool Socket::SetDontFragment()
+    {
+        if ( m_error )
+            return false;
+        const SocketHandle handle = (SocketHandle) m_handle;
+        const bool ipv6 = m_address.GetType() == ADDRESS_IPV6;
+        int result = -1;
+#if defined( IP_MTU_DISCOVER ) && defined( IP_PMTUDISC_PROBE )
+        // probe mode sets DF without clamping sends to the cached path MTU, so packets above the discovered size are dropped rather than fragmented locally
+        int value = IP_PMTUDISC_PROBE;
+        if ( ipv6 )
+        {
+#if defined( IPV6_MTU_DISCOVER ) && defined( IPV6_PMTUDISC_PROBE )
+            value = IPV6_PMTUDISC_PROBE;
+            result = setsockopt( handle, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (char*) &value, sizeof( value ) );
+#endif // #if defined( IPV6_MTU_DISCOVER ) && defined( IPV6_PMTUDISC_PROBE )
+        }
+        else
+        {
+            result = setsockopt( handle, IPPROTO_IP, IP_MTU_DISCOVER, (char*) &value, sizeof( value ) );
+        }
+#else // #if defined( IP_MTU_DISCOVER ) && defined( IP_PMTUDISC_PROBE )
+        int value = 1;
+        if ( ipv6 )
+        {
+#if defined( IPV6_DONTFRAG )
+            result = setsockopt( handle, IPPROTO_IPV6, IPV6_DONTFRAG, (char*) &value, sizeof( value ) );
+#endif // #if defined( IPV6_DONTFRAG )
+        }
+        else
+        {
+#if defined( IP_DONTFRAGMENT )
+            result = setsockopt( handle, IPPROTO_IP, IP_DONTFRAGMENT, (char*) &value, sizeof( value ) );
+#elif defined( IP_DONTFRAG )
+            result = setsockopt( handle, IPPROTO_IP, IP_DONTFRAG, (char*) &value, sizeof( value ) );
+#endif // #if defined( IP_DONTFRAGMENT )
+        }
+#endif // #if defined( IP_MTU_DISCOVER ) && defined( IP_PMTUDISC_PROBE )
+        (void) handle;
+        (void) value;
+        return result == 0;
+    }
+
+    bool Socket::SendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        yojimbo_assert( packetData );
+        yojimbo_assert( packetBytes > 0 );
+        yojimbo_assert( to.IsValid() );
+
+        if ( m_error )
+            return false;
+
+#if YOJIMBO_SOCKET_RIO
+        if ( m_registeredIO )
+        {
+            uint8_t * data = (uint8_t*) packetData;
+            return RegisteredIOSendPackets( (RegisteredIO*) m_registeredIO, &to, &data, &packetBytes, 1 ) == 1;
+        }
+#endif // #if YOJIMBO_SOCKET_RIO
+
+        sockaddr_storage socketAddress;
+        const socklen_t length = AddressToSocketAddress( to, socketAddress );
+        return sendto( (SocketHandle) m_handle, (const char*) packetData, packetBytes, 0, (sockaddr*) &socketAddress, length ) == packetBytes;
+    }
+
+    bool Socket::SendPacket( const Address & to, const void * headerData, int headerBytes, const void * packetData, int packetBytes )
+    {
+        yojimbo_assert( headerData );
+        yojimbo_assert( headerBytes > 0 );
+        yojimbo_assert( packetData || packetBytes == 0 );
+        yojimbo_assert( packetBytes >= 0 );
+        yojimbo_assert( to.IsValid() );
+
+        if ( m_error )
+            return false;
+
+        if ( packetBytes == 0 )
+            return SendPacket( to, headerData, headerBytes );
+
+#if YOJIMBO_SOCKET_RIO
+        if ( m_registeredIO )
+        {
+            // registered sends are copied into the registered buffer anyway, so join the two parts there
+
+            if ( headerBytes + packetBytes > RegisteredIOSlotBytes )
+                return false;
+            uint8_t data[RegisteredIOSlotBytes];
+            memcpy( data, headerData, headerBytes );
+            memcpy( data + headerBytes, packetData, packetBytes );
+            return SendPacket( to, data, headerBytes + packetBytes );
+        }
+#endif // #if YOJIMBO_SOCKET_RIO
+
+        sockaddr_storage socketAddress;
+        const socklen_t length = AddressToSocketAddress( to, socketAddress );
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+        WSABUF buffers[2];
+        buffers[0].buf = (CHAR*) headerData;
+        buffers[0].len = (ULONG) headerBytes;
+        buffers[1].buf = (CHAR*) packetData;
+        buffers[1].len = (ULONG) packetBytes;
+        DWORD bytesSent = 0;
+        if ( WSASendTo( (SocketHandle) m_handle, buffers, 2, &bytesSent, 0, (sockaddr*) &socketAddress, length, NULL, NULL ) != 0 )
+            return false;
+        return (int) bytesSent == headerBytes + packetBytes;
+
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+        iovec vectors[2];
+        vectors[0].iov_base = (void*) headerData;
+        vectors[0].iov_len = headerBytes;
+        vectors[1].iov_base = (void*) packetData;
+        vectors[1].iov_len = packetBytes;
+        msghdr message;
+        memset( &message, 0, sizeof( message ) );
+        message.msg_name = &socketAddress;
+        message.msg_namelen = length;
+        message.msg_iov = vectors;
+        message.msg_iovlen = 2;
+        return sendmsg( (SocketHandle) m_handle, &message, 0 ) == headerBytes + packetBytes;
+
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+    }
+
+    int Socket::ReceivePacket( Address & from, void * packetData, int maxPacketBytes )
+    {
+        yojimbo_assert( packetData );
+        yojimbo_assert( maxPacketBytes > 0 );
+
+        if ( m_error )
+            return 0;
+
+#if YOJIMBO_SOCKET_RIO
+        if ( m_registeredIO )
+        {
+            uint8_t * data = (uint8_t*) packetData;
+            int packetBytes = 0;
+            return RegisteredIOReceivePackets( (RegisteredIO*) m_registeredIO, &from, &data, &packetBytes, maxPacketBytes, 1 ) == 1 ? packetBytes : 0;
+        }
+#endif // #if YOJIMBO_SOCKET_RIO
+
+        while ( true )
+        {
+            sockaddr_storage socketAddress;
+            socklen_t length = sizeof( socketAddress );
+
+            const int result = (int) recvfrom( (SocketHandle) m_handle, (char*) packetData, maxPacketBytes, 0, (sockaddr*) &socketAddress, &length );
+
+            if ( result <= 0 )
+            {
+                // no packet waiting. windows fails packets too large for the buffer with WSAEMSGSIZE, so skip those
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+                if ( result < 0 && WSAGetLastError() == WSAEMSGSIZE )
+                    continue;
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+                return 0;
+            }
+
+            if ( !SocketAddressToAddress( socketAddress, from ) )
+                continue;
+
+            return result;
+        }
+    }
+
+    int Socket::SendPackets( const Address * to, uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        yojimbo_assert( to );
+        yojimbo_assert( packetData );
+        yojimbo_assert( packetBytes );
+        yojimbo_assert( numPackets >= 0 );
+
+        if ( m_error )
+            return 0;
+
+        int numSent = 0;
+
+#if YOJIMBO_SOCKET_RIO
+        if ( m_registeredIO )
+            return RegisteredIOSendPackets( (RegisteredIO*) m_registeredIO, to, packetData, packetBytes, numPackets );
+#endif // #if YOJIMBO_SOCKET_RIO
+
+#if YOJIMBO_SOCKET_MMSG
+
+        // one sendmmsg per SocketBatchSize packets instead of one sendto per packet
+
+        mmsghdr messages[SocketBatchSize];
+        iovec vectors[SocketBatchSize];
+        sockaddr_storage socketAddresses[SocketBatchSize];
+
+        int start = 0;
+
+        while ( start < numPackets )
+        {
+            const int batchSize = yojimbo_min( numPackets - start, SocketBatchSize );
+
+            for ( int i = 0; i < batchSize; ++i )
+            {
+                yojimbo_assert( packetBytes[start+i] > 0 );
+                memset( &messages[i], 0, sizeof( mmsghdr ) );
+                vectors[i].iov_base = packetData[start+i];
+                vectors[i].iov_len = packetBytes[start+i];
+                messages[i].msg_hdr.msg_name = &socketAddresses[i];
+                messages[i].msg_hdr.msg_namelen = AddressToSocketAddress( to[start+i], socketAddresses[i] );
+                messages[i].msg_hdr.msg_iov = &vectors[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            const int result = sendmmsg( (SocketHandle) m_handle, messages, batchSize, 0 );
+
+            if ( result <= 0 )
+            {
+                // the first packet of the batch failed. skip it so one bad packet doesn't hold up the rest
+                start++;
+                continue;
+            }
+
+            numSent += result;
+            start += result;
+        }
+
+#else // #if YOJIMBO_SOCKET_MMSG
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            if ( SendPacket( to[i], packetData[i], packetBytes[i] ) )
+                numSent++;
+        }
+
+#endif // #if YOJIMBO_SOCKET_MMSG
+
+        return numSent;
+    }
+
+    int Socket::ReceivePackets( Address * from, uint8_t * const * packetData, int * packetBytes, int maxPacketBytes, int maxPackets )
+    {
+        yojimbo_assert( from );
+        yojimbo_assert( packetData );
+        yojimbo_assert( packetBytes );
+        yojimbo_assert( maxPacketBytes > 0 );
+        yojimbo_assert( maxPackets >= 0 );
+
+        if ( m_error )
+            return 0;
+
+#if YOJIMBO_SOCKET_RIO
+        if ( m_registeredIO )
+            return RegisteredIOReceivePackets( (RegisteredIO*) m_registeredIO, from, packetData, packetBytes, maxPacketBytes, maxPackets );
+#endif // #if YOJIMBO_SOCKET_RIO
+
+#if YOJIMBO_SOCKET_MMSG
+
+        // one recvmmsg per SocketBatchSize packets instead of one recvfrom per packet
+
+        mmsghdr messages[SocketBatchSize];
+        iovec vectors[SocketBatchSize];
+        sockaddr_storage socketAddresses[SocketBatchSize];
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const int batchSize = yojimbo_min( maxPackets - numPackets, SocketBatchSize );
+
+            for ( int i = 0; i < batchSize; ++i )
+            {
+                memset( &messages[i], 0, sizeof( mmsghdr ) );
+                vectors[i].iov_base = packetData[numPackets+i];
+                vectors[i].iov_len = maxPacketBytes;
+                messages[i].msg_hdr.msg_name = &socketAddresses[i];
+                messages[i].msg_hdr.msg_namelen = sizeof( sockaddr_storage );
+                messages[i].msg_hdr.msg_iov = &vectors[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            const int result = recvmmsg( (SocketHandle) m_handle, messages, batchSize, MSG_DONTWAIT, NULL );
+
+            if ( result <= 0 )
+                break;
+
+            // packets with an unknown address family or no data are dropped, and the rest moved down over them
+
+            int numReceived = 0;
+
+            for ( int i = 0; i < result; ++i )
+            {
+                if ( messages[i].msg_len == 0 || !SocketAddressToAddress( socketAddresses[i], from[numPackets+numReceived] ) )
+                    continue;
+                if ( numReceived != i )
+                    memcpy( packetData[numPackets+numReceived], packetData[numPackets+i], messages[i].msg_len );
+                packetBytes[numPackets+numReceived] = (int) messages[i].msg_len;
+                numReceived++;
+            }
+
+            numPackets += numReceived;
+
+            if ( result < batchSize )
+                break;
+        }
+
+        return numPackets;
+
+#else // #if YOJIMBO_SOCKET_MMSG
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const int bytes = ReceivePacket( from[numPackets], packetData[numPackets], maxPacketBytes );
+            if ( bytes <= 0 )
+                break;
+            packetBytes[numPackets++] = bytes;
+        }
+
+        return numPackets;
+
+#endif // #if YOJIMBO_SOCKET_MMSG
+    }
+
+    void trusted_connect_auth( const uint8_t privateKey[], uint64_t protocolId, uint64_t clientId, uint8_t auth[] )
+    {
+        yojimbo_assert( privateKey );
+        yojimbo_assert( auth );
+        uint64_t message[2];
+        message[0] = host_to_network( protocolId );
+        message[1] = host_to_network( clientId );
+        crypto_generichash( auth, TrustedAuthBytes, (const unsigned char*) message, sizeof( message ), privateKey, KeyBytes );
+    }
+}
@@ -0,0 +1,209 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_SOCKET_H
+#define YOJIMBO_SOCKET_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_address.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        A non-blocking UDP socket.
+
+        Packets normally go through netcode.io, which owns its own sockets. This socket carries the unencrypted packets of the trusted network mode. See BaseClientServerConfig::trustedNetwork.
+     */
+
+    class Socket
+    {
+    public:
+
+        /**
+            Create a socket and bind it to an address.
+
+            @param address The address to bind to. Use port 0 to bind to a port picked by the operating system. The address type picks IPv4 or IPv6.
+            @param sendBufferSize The socket send buffer size (bytes).
+            @param receiveBufferSize The socket receive buffer size (bytes).
+            @param registeredIO If true, send and receive with Registered I/O on windows, where available. Receives are kept posted in preregistered buffers and completions are polled in batches. Ignored on other platforms.
+            @param reusePort If true, set SO_REUSEPORT so several sockets can bind the same address. Linux spreads incoming packets between them by a hash of the source and destination addresses, so each sender always reaches the same socket while the set of sockets doesn't change. Linux only.
+         */
+
+        explicit Socket( const Address & address, int sendBufferSize = 256 * 1024, int receiveBufferSize = 256 * 1024, bool registeredIO = false, bool reusePort = false );
+
+        /**
+            Close the socket.
+         */
+
+        ~Socket();
+
+        /**
+            Did the socket fail to create or bind?
+
+            @returns True if the socket can't be used.
+         */
+
+        bool IsError() const { return m_error; }
+
+        /**
+            Get the address the socket is bound to.
+
+            @returns The bound address. If port 0 was passed in, this has the port picked by the operating system.
+         */
+
+        const Address & GetAddress() const { return m_address; }
+
+        /**
+            Set the don't fragment bit on packets sent from this socket, so packets larger than the path MTU are dropped instead of fragmented along the way.
+
+            Needed for path MTU discovery, where a probe that arrives must have crossed the path in one piece. See BaseClientServerConfig::trustedPathMtuDiscovery.
+
+            @returns True if the option was set. False on platforms without it, where probes may pass in fragments.
+         */
+
+        bool SetDontFragment();
+
+        /**
+            Send a packet.
+
+            @param to The address to send the packet to. Must be the same address type as the socket.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+
+            @returns True if the packet was handed to the operating system.
+         */
+
+        bool SendPacket( const Address & to, const void * packetData, int packetBytes );
+
+        /**
+            Send a packet made of a header followed by a payload, without joining them into one buffer first.
+
+            The two parts are handed to the operating system as a gather list (sendmsg, or WSASendTo on windows), so a caller that frames a packet it doesn't own can send it in place.
+
+            @param to The address to send the packet to. Must be the same address type as the socket.
+            @param headerData The header bytes, sent first.
+            @param headerBytes The size of the header (bytes).
+            @param packetData The payload, sent after the header.
+            @param packetBytes The size of the payload (bytes). May be 0.
+
+            @returns True if the packet was handed to the operating system.
+         */
+
+        bool SendPacket( const Address & to, const void * headerData, int headerBytes, const void * packetData, int packetBytes );
+
+        /**
+            Receive a packet, if one is waiting. Never blocks.
+
+            @param from The address the packet came from (out).
+            @param packetData The buffer to receive the packet into.
+            @param maxPacketBytes The size of the buffer (bytes). Larger packets are dropped on windows and truncated elsewhere, so size this for the largest packet expected.
+
+            @returns The size of the packet received (bytes), or 0 if no packet is waiting.
+         */
+
+        int ReceivePacket( Address & from, void * packetData, int maxPacketBytes );
+
+        /**
+            Send a batch of packets.
+
+            On linux this is one sendmmsg system call per SocketBatchSize packets. With Registered I/O on windows the packets are queued and committed together. Elsewhere it sends the packets one at a time.
+
+            @param to The address to send each packet to.
+            @param packetData The data of each packet.
+            @param packetBytes The size of each packet (bytes).
+            @param numPackets The number of packets to send.
+
+            @returns The number of packets handed to the operating system.
+         */
+
+        int SendPackets( const Address * to, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        /**
+            Receive the packets waiting on the socket, up to a maximum. Never blocks.
+
+            On linux this is one recvmmsg system call per SocketBatchSize packets. With Registered I/O on windows completions are dequeued SocketBatchSize at a time. Elsewhere it receives the packets one at a time.
+
+            @param from The address each packet came from (out).
+            @param packetData The buffer to receive each packet into. Each must be maxPacketBytes in size.
+            @param packetBytes The size of each packet received (out, bytes).
+            @param maxPacketBytes The size of each buffer (bytes).
+            @param maxPackets The maximum number of packets to receive.
+
+            @returns The number of packets received.
+         */
+
+        int ReceivePackets( Address * from, uint8_t * const * packetData, int * packetBytes, int maxPacketBytes, int maxPackets );
+
+    private:
+
+        Socket( const Socket & other );
+
+        const Socket & operator = ( const Socket & other );
+
+        uint64_t m_handle;                                                  ///< The operating system socket handle.
+        Address m_address;                                                  ///< The address the socket is bound to.
+        bool m_error;                                                       ///< True if the socket failed to create or bind.
+        void * m_registeredIO;                                              ///< Registered I/O buffers and queues on windows. NULL when not using Registered I/O.
+    };
+
+    /// The first byte of each packet in the trusted network mode. See BaseClientServerConfig::trustedNetwork.
+
+    enum TrustedPacketType
+    {
+        TRUSTED_PACKET_CONNECT_REQUEST,                                     ///< Client to server: protocol id, client id and the connect auth.
+        TRUSTED_PACKET_CONNECT_ACCEPTED,                                    ///< Server to client: the client index assigned to the client, and the ticket to resume the connection with.
+        TRUSTED_PACKET_CONNECT_DENIED,                                      ///< Server to client: the server is full.
+        TRUSTED_PACKET_KEEP_ALIVE,                                          ///< Either way: sent while no packets are, so the other side doesn't time out.
+        TRUSTED_PACKET_PAYLOAD,                                             ///< Either way: a reliable.io packet.
+        TRUSTED_PACKET_DISCONNECT,                                          ///< Either way: the connection is closed.
+        TRUSTED_PACKET_RESUME_REQUEST,                                      ///< Client to server: protocol id, client index and resume ticket. Answered with a connect accepted packet carrying a new ticket, or a disconnect packet. See BaseClientServerConfig::trustedResumeTime.
+        TRUSTED_PACKET_PROBE,                                               ///< Anyone to server: protocol id and an 8 byte token. Answered with a probe reply, without authentication or per-address state. See BaseClientServerConfig::serverProbeBudget.
+        TRUSTED_PACKET_PROBE_REPLY,                                         ///< Server to prober: the token from the probe, the number of connected clients and the number of client slots.
+        TRUSTED_PACKET_PATH_PROBE,                                          ///< Client to server: the path size the client has confirmed, padded with zeros to the size being probed. Unpadded probes only carry the confirmed size. See BaseClientServerConfig::trustedPathMtuDiscovery.
+        TRUSTED_PACKET_PATH_PROBE_ACK                                       ///< Server to client: the size of the padded path probe received, padded with zeros to the same size, so one round trip confirms the size in both directions.
+    };
+
+    const int SocketBatchSize = 32;                                         ///< Maximum number of packets sent or received per system call by Socket::SendPackets and Socket::ReceivePackets.
+    const int TrustedReceiveBatchSize = 64;                                 ///< Maximum number of packets the server receives from the socket in one batch in the trusted network mode, when BaseClientServerConfig::serverReceiveBatchSize is set.
+
+    const int TrustedAuthBytes = 32;                                        ///< Size of the connect auth in a trusted connect request (bytes).
+    const int TrustedConnectRequestBytes = 1 + 8 + 8 + TrustedAuthBytes;    ///< Size of a trusted connect request packet (bytes).
+    const int TrustedConnectAcceptedBytes = 1 + 4 + 8;                      ///< Size of a trusted connect accepted packet (bytes).
+    const int TrustedResumeRequestBytes = 1 + 8 + 4 + 8;                    ///< Size of a trusted resume request packet (bytes).
+    const int TrustedProbeBytes = 1 + 8 + 8;                                ///< Size of a probe packet (bytes).
+    const int TrustedProbeReplyBytes = 1 + 8 + 4 + 4;                       ///< Size of a probe reply packet (bytes). No larger than the probe, so the server can't be used to amplify traffic.
+    const int TrustedPacketHeaderBytes = 1;                                 ///< Bytes in front of the reliable.io packet in a trusted payload packet.
+    const int TrustedMaxPacketBytes = 1500;                                 ///< Largest packet in the trusted network mode (bytes). reliable.io fragments packets above 1024 bytes, so packets fit in an ethernet MTU.
+    const int TrustedNumDisconnectPackets = 4;                              ///< Number of disconnect packets sent when closing a trusted connection, in case some are lost.
+    const double TrustedKeepAliveInterval = 0.1;                            ///< A keep-alive is sent when nothing else was sent to the other side for this long (seconds).
+    const double TrustedPathTimeout = 1.0;                                  ///< With BaseClientServerConfig::trustedMultipath, a path is only used while something was received over it within this long (seconds).
+    const int TrustedPathProbeBytes = 1 + 2;                                ///< Size of an unpadded path probe or path probe ack (bytes).
+    const int TrustedMinPathBytes = 1200;                                   ///< UDP payload every path is assumed to carry without fragmentation (bytes). Path MTU discovery starts here and never goes below it.
+    const int TrustedMaxPathBytes = 1472;                                   ///< Largest UDP payload path MTU discovery probes for (bytes). An ethernet MTU less the IPv4 and UDP headers.
+    const int TrustedPathSearchGranularity = 16;                            ///< Path MTU discovery stops once the largest size confirmed and the smallest size that failed are closer than this (bytes).
+    const int TrustedPathProbeAttempts = 3;                                 ///< Number of probes of one size lost in a row before path MTU discovery decides the size doesn't fit. Also the number of times the final size is sent to the server.
+    const double TrustedPathProbeTimeout = 0.25;                            ///< Time path MTU discovery waits for a probe ack before counting the probe lost (seconds).
+    const double TrustedPathSearchInterval = 60.0;                          ///< Time between path MTU searches once one finishes, so a path that changed is picked up (seconds).
+    const int TrustedReliableHeaderBytes = 9;                               ///< Largest reliable.io packet header in front of the connection packet (bytes). Subtracted from the path size to get the largest connection packet.
+    const int TrustedConnectFilterSize = 1024;                              ///< Number of per-address rate limit entries the server keeps for trusted connect requests. Must be a power of two. Addresses that hash to the same entry share it until one replaces the other.
+
+    /**
+        Compute the auth a client sends in a trusted connect request.
+
+        This is a keyed hash of the protocol id and client id with the private key shared by client and server. It is only checked once, when the client connects. After that packets are accepted from the address the client connected from.
+
+        @param privateKey The private key shared by client and server (KeyBytes).
+        @param protocolId The protocol id.
+        @param clientId The client id.
+        @param auth The connect auth (out, TrustedAuthBytes).
+     */
+
+    void trusted_connect_auth( const uint8_t privateKey[], uint64_t protocolId, uint64_t clientId, uint8_t auth[] );
+}
+
+#endif // #ifndef YOJIMBO_SOCKET_H
@@ -19,6 +19,8 @@
 
 namespace yojimbo
 {
+    class StringTable;
+
     /** 
         Functionality common to all stream classes.
      */
@@ -33,7 +35,7 @@ namespace yojimbo
             @param allocator The allocator to use for stream allocations. This lets you dynamically allocate memory as you read and write packets.
          */
 
-        explicit BaseStream( Allocator & allocator ) : m_allocator( &allocator ), m_context( NULL ) {}
+        explicit BaseStream( Allocator & allocator ) : m_allocator( &allocator ), m_context( NULL ), m_stringTable( NULL ), m_serializeChecks( YOJIMBO_SERIALIZE_CHECKS != 0 ) {}
 
         /**
             Set a context on the stream.
@@ -66,6 +68,30 @@ namespace yojimbo
             return m_context;
         }
 
+        /**
+            Set the string table used by serialize_dictionary_string.
+
+            The connection sets its send string table on the streams that write packets, and its receive string table on the streams that read them. See ConnectionConfig::stringTableSize.
+
+            @param stringTable The string table. NULL disables the dictionary, so strings are always sent in full.
+         */
+
+        void SetStringTable( StringTable * stringTable )
+        {
+            m_stringTable = stringTable;
+        }
+
+        /**
+            Get the string table set on the stream.
+
+            @returns The string table. May be NULL.
+         */
+
+        StringTable * GetStringTable() const
+        {
+            return m_stringTable;
+        }
+
         /**
             Get the allocator set on the stream.
 
@@ -79,10 +105,36 @@ namespace yojimbo
             return *m_allocator;
         }
 
+        /**
+            Turn serialize checks on or off for this stream.
+
+            Checks are on by default when YOJIMBO_SERIALIZE_CHECKS is 1, and off when it is 0. With checks off, serialize_check reads and writes nothing, so the reading and writing streams must agree. The connection sets this from ConnectionConfig::serializeChecks, and per packet when ConnectionConfig::negotiateSerializeChecks is set.
+
+            @param serializeChecks True to read and write serialize checks, false to skip them.
+         */
+
+        void SetSerializeChecks( bool serializeChecks )
+        {
+            m_serializeChecks = serializeChecks;
+        }
+
+        /**
+            Are serialize checks read and written by this stream?
+
+            @returns True if serialize checks are on.
+         */
+
+        bool GetSerializeChecks() const
+        {
+            return m_serializeChecks;
+        }
+
     private:
 
         Allocator * m_allocator;                            ///< The allocator passed into the constructor.
         void * m_context;                                   ///< The context pointer set on the stream. May be NULL.
+        StringTable * m_stringTable;                        ///< The string table used by serialize_dictionary_string. May be NULL.
+        bool m_serializeChecks;                             ///< True if serialize checks are read and written. See BaseStream::SetSerializeChecks.
     };
 
     /**
@@ -114,7 +166,7 @@ namespace yojimbo
             @param allocator The allocator to use for stream allocations. This lets you dynamically allocate memory as you read and write packets.
          */
 
-        WriteStream( Allocator & allocator, uint8_t * buffer, int bytes ) : BaseStream( allocator ), m_writer( buffer, bytes ) {}
+        WriteStream( Allocator & allocator, uint8_t * buffer, int bytes ) : BaseStream( allocator ), m_writer( buffer, bytes ), m_overflow( false ), m_numAligns( 0 ) {}
 
         /**
             Serialize an integer (write).
@@ -123,7 +175,7 @@ namespace yojimbo
             @param min The minimum value.
             @param max The maximum value.
 
-            @returns Always returns true. All checking is performed by debug asserts only on write.
+            @returns False if the value doesn't fit in the buffer, otherwise true. All other checking is performed by debug asserts only on write.
          */
 
         bool SerializeInteger( int32_t value, int32_t min, int32_t max )
@@ -132,6 +184,8 @@ namespace yojimbo
             yojimbo_assert( value >= min );
             yojimbo_assert( value <= max );
             const int bits = bits_required( min, max );
+            if ( WouldOverflow( bits ) )
+                return false;
             uint32_t unsigned_value = value - min;
             m_writer.WriteBits( unsigned_value, bits );
             return true;
@@ -143,44 +197,90 @@ namespace yojimbo
             @param value The unsigned integer value to serialize. Must be in range [0,(1<<bits)-1].
             @param bits The number of bits to write in [1,32].
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns False if the bits don't fit in the buffer, otherwise true. All other checking is performed by debug asserts on write.
          */
 
         bool SerializeBits( uint32_t value, int bits )
         {
             yojimbo_assert( bits > 0 );
             yojimbo_assert( bits <= 32 );
+            if ( WouldOverflow( bits ) )
+                return false;
             m_writer.WriteBits( value, bits );
             return true;
         }
 
+        /**
+            Serialize an array of values with the same number of bits each (write).
+
+            @param values The values to write. Each must be in range [0,(1<<bits)-1].
+            @param count The number of values to write.
+            @param bits The number of bits to write per value in [1,32].
+
+            @returns False if the values don't fit in the buffer, otherwise true. All other checking is performed by debug asserts on write.
+         */
+
+        bool SerializeBitsArray( const uint32_t * values, int count, int bits )
+        {
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( count >= 0 );
+            if ( WouldOverflow( count * bits ) )
+                return false;
+            m_writer.WriteBitsArray( values, count, bits );
+            return true;
+        }
+
         /**
             Serialize an array of bytes (write).
 
             @param data Array of bytes to be written.
             @param bytes The number of bytes to write.
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns False if the bytes don't fit in the buffer, otherwise true. All other checking is performed by debug asserts on write.
          */
 
         bool SerializeBytes( const uint8_t * data, int bytes )
         {
             yojimbo_assert( data );
             yojimbo_assert( bytes >= 0 );
+            if ( WouldOverflow( m_writer.GetAlignBits() + bytes * 8 ) )
+                return false;
             SerializeAlign();
             m_writer.WriteBytes( data, bytes );
             return true;
         }
 
+        /**
+            Serialize a view of an array of bytes (write).
+
+            Writes the bytes exactly like SerializeBytes. Only the read side differs: it points at the bytes in the packet instead of copying them.
+
+            @param data Reference to the pointer to the bytes to write.
+            @param bytes The number of bytes to write.
+
+            @returns True if the serialize write succeeded, false otherwise.
+
+            @see ReadStream::SerializeBytesView
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            return SerializeBytes( data, bytes );
+        }
+
         /**
             Serialize an align (write).
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns False if the align doesn't fit in the buffer, otherwise true.
          */
 
         bool SerializeAlign()
         {
+            if ( WouldOverflow( m_writer.GetAlignBits() ) )
+                return false;
             m_writer.WriteAlign();
+            m_numAligns++;
             return true;
         }
 
@@ -200,18 +300,14 @@ namespace yojimbo
 
             Safety checks help track down desyncs. A check is written to the stream, and on the other side if the check is not present it asserts and fails the serialize.
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns False if the check doesn't fit in the buffer, otherwise true.
          */
 
         bool SerializeCheck()
         {
-#if YOJIMBO_SERIALIZE_CHECKS
-            SerializeAlign();
-            SerializeBits( SerializeCheckValue, 32 );
-#else // #if YOJIMBO_SERIALIZE_CHECKS
-            (void)string;
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
-            return true;
+            if ( !GetSerializeChecks() )
+                return true;
+            return SerializeAlign() && SerializeBits( SerializeCheckValue, 32 );
         }
 
         /**
@@ -262,9 +358,117 @@ namespace yojimbo
             return m_writer.GetBitsWritten();
         }
 
+        /**
+            Get number of bits still available to write.
+
+            @returns Number of bits left in the buffer.
+         */
+
+        int GetBitsAvailable() const
+        {
+            return m_writer.GetBitsAvailable();
+        }
+
+        /**
+            Did a serialize call fail because it would have written past the end of the buffer?
+
+            Serialize functions don't always propagate failure, so after writing something that may not fit, check this rather than the return value.
+
+            @returns True if the stream overflowed since it was created, or since the last rollback.
+         */
+
+        bool IsOverflow() const
+        {
+            return m_overflow;
+        }
+
+        /**
+            How many times has the stream aligned to a byte boundary?
+
+            Aligned data, eg. from serialize_bytes or serialize_string, pads to the next byte in the packet, so the bits written depend on the bit position they start at. SerializedMessage uses this to tell if cached bits can go anywhere in a packet.
+
+            @returns The number of WriteStream::SerializeAlign calls, including those made by SerializeBytes and SerializeCheck.
+         */
+
+        int GetNumAligns() const
+        {
+            return m_numAligns;
+        }
+
+        typedef BitWriter::Checkpoint Checkpoint;
+
+        /**
+            Save the current write position. 
+
+            Use this to build packets in a single pass: write directly into the stream and roll back to the checkpoint if what was written doesn't fit.
+
+            @returns The checkpoint for the current write position.
+
+            @see WriteStream::Rollback
+         */
+
+        Checkpoint GetCheckpoint() const
+        {
+            return m_writer.GetCheckpoint();
+        }
+
+        /**
+            Discard everything written since the checkpoint, and clear the overflow flag.
+
+            @param checkpoint A checkpoint previously returned by WriteStream::GetCheckpoint on this stream.
+         */
+
+        void Rollback( const Checkpoint & checkpoint )
+        {
+            m_writer.Rollback( checkpoint );
+            m_overflow = false;
+        }
+
+        /**
+            Overwrite an integer that was already written with serialize_int.
+
+            @param bitIndex The value of WriteStream::GetBitsProcessed just before the integer was originally written.
+            @param value The integer value in [min,max].
+            @param min The minimum value the integer was written with.
+            @param max The maximum value the integer was written with.
+         */
+
+        void PatchInteger( int bitIndex, int32_t value, int32_t min, int32_t max )
+        {
+            yojimbo_assert( min < max );
+            yojimbo_assert( value >= min );
+            yojimbo_assert( value <= max );
+            m_writer.PatchBits( bitIndex, uint32_t( value - min ), bits_required( min, max ) );
+        }
+
+        /**
+            Overwrite bits that were already written with serialize_bits.
+
+            @param bitIndex The value of WriteStream::GetBitsProcessed just before the bits were originally written. The bits must not straddle a 32 bit word boundary.
+            @param value The value to write.
+            @param bits The number of bits to write, in [1,32].
+         */
+
+        void PatchBits( int bitIndex, uint32_t value, int bits )
+        {
+            m_writer.PatchBits( bitIndex, value, bits );
+        }
+
     private:
 
+        bool WouldOverflow( int bits )
+        {
+            if ( m_overflow || bits > m_writer.GetBitsAvailable() )
+            {
+                m_overflow = true;
+                return true;
+            }
+            return false;
+        }
+
         BitWriter m_writer;                                 ///< The bit writer used for all bitpacked write operations.
+        bool m_overflow;                                    ///< True if a write failed because it didn't fit in the buffer. Cleared by WriteStream::Rollback.
+        int m_numAligns;                                    ///< Number of byte alignments written. See WriteStream::GetNumAligns.
     };
 
     /**
@@ -339,6 +543,27 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of values with the same number of bits each (read).
+
+            @param values The values read are stored here. Each will be in range [0,(1<<bits)-1].
+            @param count The number of values to read.
+            @param bits The number of bits to read per value in [1,32].
+
+            @returns Returns true if the serialize read succeeded, false otherwise.
+         */
+
+        bool SerializeBitsArray( uint32_t * values, int count, int bits )
+        {
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( count >= 0 );
+            if ( m_reader.WouldReadPastEnd( count * bits ) )
+                return false;
+            m_reader.ReadBitsArray( values, count, bits );
+            return true;
+        }
+
         /**
             Serialize an array of bytes (read).
 
@@ -358,6 +583,29 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize a view of an array of bytes (read).
+
+            Instead of copying the bytes out, data is set to point at them inside the buffer being read. Use this for large payloads like voice and pre-compressed data that are consumed in place.
+
+            IMPORTANT: The pointer is only valid while the buffer passed in to the read stream is alive. For messages, this means it must be consumed or copied before the packet containing it has finished processing.
+
+            @param data Set to point at the bytes inside the buffer being read.
+            @param bytes The number of bytes to read.
+
+            @returns True if the serialize read succeeded, false otherwise.
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            if ( !SerializeAlign() )
+                return false;
+            if ( m_reader.WouldReadPastEnd( bytes * 8 ) )
+                return false;
+            data = m_reader.SkipBytes( bytes );
+            return true;
+        }
+
         /**
             Serialize an align (read).
 
@@ -395,7 +643,8 @@ namespace yojimbo
 
         bool SerializeCheck()
         {
-#if YOJIMBO_SERIALIZE_CHECKS            
+            if ( !GetSerializeChecks() )
+                return true;
             if ( !SerializeAlign() )
                 return false;
             uint32_t value = 0;
@@ -406,9 +655,6 @@ namespace yojimbo
                 yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "serialize check failed: expected %x, got %x\n", SerializeCheckValue, value );
             }
             return value == SerializeCheckValue;
-#else // #if YOJIMBO_SERIALIZE_CHECKS
-            return true;
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
         }
 
         /**
@@ -433,11 +679,112 @@ namespace yojimbo
             return ( m_reader.GetBitsRead() + 7 ) / 8;
         }
 
+        /**
+            Would reading this many bits read past the end of the stream?
+
+            @param bits The number of bits.
+
+            @returns True if fewer than this many bits are left to read.
+
+            @see UncheckedReadStream
+         */
+
+        bool WouldReadPastEnd( int bits ) const
+        {
+            return m_reader.WouldReadPastEnd( bits );
+        }
+
     private:
 
+        friend class UncheckedReadStream;
+
         BitReader m_reader;                                 ///< The bit reader used for all bitpacked read operations.
     };
 
+    /**
+        Stream class for reading a fixed size object that is already known to fit in what is left of a read stream.
+
+        The caller checks once with ReadStream::WouldReadPastEnd that the object's maximum size in bits is left to read, then serializes it with this stream, which skips the check on each integer and bits read. Values are still checked against their ranges by the serialize_* macros, and byte, align and safety check reads are still checked, so a malformed packet fails the same way it does with ReadStream.
+
+        It starts at the read position of the stream it is created from. Call UncheckedReadStream::Finish to move that stream past what was read.
+
+        IMPORTANT: Only use this for objects whose serialize reads no more than the bits checked for, like messages declared with YOJIMBO_MESSAGE_MAX_BITS.
+
+        @see Message::GetMaxBits
+     */
+
+    class UncheckedReadStream : public ReadStream
+    {
+    public:
+
+        /**
+            Unchecked read stream constructor.
+
+            @param stream The read stream to continue reading from.
+         */
+
+        explicit UncheckedReadStream( const ReadStream & stream ) : ReadStream( stream ) {}
+
+        /**
+            Serialize an integer (read, unchecked).
+
+            @param value The integer value read is stored here. The serialize_int macro checks it is in [min,max].
+            @param min The minimum allowed value.
+            @param max The maximum allowed value.
+
+            @returns Always returns true.
+         */
+
+        bool SerializeInteger( int32_t & value, int32_t min, int32_t max )
+        {
+            yojimbo_assert( min < max );
+            value = (int32_t) m_reader.ReadBits( bits_required( min, max ) ) + min;
+            return true;
+        }
+
+        /**
+            Serialize a number of bits (read, unchecked).
+
+            @param value The integer value read is stored here. Will be in range [0,(1<<bits)-1].
+            @param bits The number of bits to read in [1,32].
+
+            @returns Always returns true.
+         */
+
+        bool SerializeBits( uint32_t & value, int bits )
+        {
+            value = m_reader.ReadBits( bits );
+            return true;
+        }
+
+        /**
+            Serialize an array of values with the same number of bits each (read, unchecked).
+
+            @param values The values read are stored here. Each will be in range [0,(1<<bits)-1].
+            @param count The number of values to read.
+            @param bits The number of bits to read per value in [1,32].
+
+            @returns Always returns true.
+         */
+
+        bool SerializeBitsArray( uint32_t * values, int count, int bits )
+        {
+            m_reader.ReadBitsArray( values, count, bits );
+            return true;
+        }
+
+        /**
+            Move the read stream this was created from past everything read with this stream.
+
+            @param stream The read stream passed in to the constructor.
+         */
+
+        void Finish( ReadStream & stream ) const
+        {
+            stream.m_reader = m_reader;
+        }
+    };
+
     /**
         Stream class for estimating how many bits it would take to serialize something.
 
@@ -505,6 +852,26 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of values with the same number of bits each (measure).
+
+            @param values The values to 'write'. Not actually used.
+            @param count The number of values to 'write'.
+            @param bits The number of bits per value in [1,32].
+
+            @returns Always returns true. All checking is performed by debug asserts on measure.
+         */
+
+        bool SerializeBitsArray( const uint32_t * values, int count, int bits )
+        {
+            (void) values;
+            yojimbo_assert( bits > 0 );
+            yojimbo_assert( bits <= 32 );
+            yojimbo_assert( count >= 0 );
+            m_bitsWritten += count * bits;
+            return true;
+        }
+
         /**
             Serialize an array of bytes (measure).
 
@@ -522,6 +889,20 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize a view of an array of bytes (measure).
+
+            @param data Reference to the pointer to the bytes to measure.
+            @param bytes The number of bytes to measure.
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            return SerializeBytes( data, bytes );
+        }
+
         /**
             Serialize an align (measure).
 
@@ -556,10 +937,11 @@ namespace yojimbo
 
         bool SerializeCheck()
         {
-#if YOJIMBO_SERIALIZE_CHECKS
-            SerializeAlign();
-            m_bitsWritten += 32;
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
+            if ( GetSerializeChecks() )
+            {
+                SerializeAlign();
+                m_bitsWritten += 32;
+            }
             return true;
         }
 
@@ -585,6 +967,22 @@ namespace yojimbo
             return ( m_bitsWritten + 7 ) / 8;
         }
 
+        /**
+            Count bits without serializing anything.
+
+            Use this for fixed size objects whose maximum size is already known, instead of measuring each field.
+
+            @param bits The number of bits to add to the measurement.
+
+            @see Message::GetMaxBits
+         */
+
+        void AddBits( int bits )
+        {
+            yojimbo_assert( bits >= 0 );
+            m_bitsWritten += bits;
+        }
+
     private:
 
         int m_bitsWritten;                                  ///< Counter for the number of bits written.
@@ -0,0 +1,181 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_string_table.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    StringTable::StringTable( Allocator & allocator, int numEntries, int sentPacketBufferSize )
+    {
+        yojimbo_assert( numEntries > 0 );
+        yojimbo_assert( numEntries <= MaxStringTableSize );
+        yojimbo_assert( sentPacketBufferSize > 0 );
+        m_allocator = &allocator;
+        m_numEntries = numEntries;
+        m_numStrings = 0;
+        m_strings = (char**) YOJIMBO_ALLOCATE( allocator, sizeof( char* ) * numEntries );
+        yojimbo_assert( m_strings );
+        memset( m_strings, 0, sizeof( char* ) * numEntries );
+        m_indexSize = 1;
+        while ( m_indexSize < numEntries * 2 )
+            m_indexSize *= 2;
+        m_index = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * m_indexSize );
+        yojimbo_assert( m_index );
+        memset( m_index, 0xFF, sizeof( int ) * m_indexSize );
+        m_acked = YOJIMBO_NEW( allocator, BitArray, allocator, numEntries );
+        m_sentPackets = YOJIMBO_NEW( allocator, SequenceBuffer<SentPacketEntry>, allocator, sentPacketBufferSize );
+        m_currentPacket = NULL;
+    }
+
+    StringTable::~StringTable()
+    {
+        yojimbo_assert( m_allocator );
+        Reset();
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
+        YOJIMBO_DELETE( *m_allocator, BitArray, m_acked );
+        YOJIMBO_FREE( *m_allocator, m_index );
+        YOJIMBO_FREE( *m_allocator, m_strings );
+        m_allocator = NULL;
+    }
+
+    void StringTable::Reset()
+    {
+        for ( int i = 0; i < m_numEntries; ++i )
+        {
+            YOJIMBO_FREE( *m_allocator, m_strings[i] );
+        }
+        m_numStrings = 0;
+        memset( m_index, 0xFF, sizeof( int ) * m_indexSize );
+        m_acked->Clear();
+        m_sentPackets->Reset();
+        m_currentPacket = NULL;
+    }
+
+    int StringTable::FindSlot( const char * string, uint64_t hash ) const
+    {
+        // strings are never removed, so linear probing stops at the first empty slot
+
+        int slot = (int) ( hash & uint64_t( m_indexSize - 1 ) );
+        while ( m_index[slot] >= 0 && strcmp( m_strings[m_index[slot]], string ) != 0 )
+        {
+            slot = ( slot + 1 ) & ( m_indexSize - 1 );
+        }
+        return slot;
+    }
+
+    int StringTable::FindString( const char * string ) const
+    {
+        yojimbo_assert( string );
+        const int slot = FindSlot( string, wyhash_64( string, (uint32_t) strlen( string ), 0 ) );
+        return m_index[slot];
+    }
+
+    int StringTable::AddString( const char * string )
+    {
+        yojimbo_assert( string );
+
+        if ( m_numStrings == m_numEntries )
+            return -1;
+
+        const int length = (int) strlen( string );
+        const int slot = FindSlot( string, wyhash_64( string, (uint32_t) length, 0 ) );
+        yojimbo_assert( m_index[slot] < 0 );
+
+        const int id = m_numStrings;
+        m_strings[id] = (char*) YOJIMBO_ALLOCATE( *m_allocator, length + 1 );
+        if ( !m_strings[id] )
+            return -1;
+        memcpy( m_strings[id], string, length + 1 );
+
+        m_index[slot] = id;
+        m_numStrings++;
+
+        return id;
+    }
+
+    bool StringTable::IsAcked( int id ) const
+    {
+        yojimbo_assert( id >= 0 );
+        yojimbo_assert( id < m_numStrings );
+        return m_acked->GetBit( id ) != 0;
+    }
+
+    void StringTable::BeginPacket( uint16_t sequence )
+    {
+        m_currentPacket = m_sentPackets->Insert( sequence );
+        if ( m_currentPacket )
+            m_currentPacket->numDefinitions = 0;
+    }
+
+    bool StringTable::AddDefinition( int id )
+    {
+        yojimbo_assert( id >= 0 );
+        yojimbo_assert( id < m_numStrings );
+        if ( !m_currentPacket || m_currentPacket->numDefinitions == MaxStringDefinitionsPerPacket )
+            return false;
+        m_currentPacket->id[m_currentPacket->numDefinitions++] = (uint16_t) id;
+        return true;
+    }
+
+    int StringTable::GetNumDefinitions() const
+    {
+        return m_currentPacket ? m_currentPacket->numDefinitions : 0;
+    }
+
+    void StringTable::RollbackDefinitions( int numDefinitions )
+    {
+        if ( !m_currentPacket )
+            return;
+        yojimbo_assert( numDefinitions >= 0 );
+        yojimbo_assert( numDefinitions <= m_currentPacket->numDefinitions );
+        m_currentPacket->numDefinitions = numDefinitions;
+    }
+
+    void StringTable::ProcessAck( uint16_t sequence )
+    {
+        SentPacketEntry * entry = m_sentPackets->Find( sequence );
+        if ( !entry )
+            return;
+        for ( int i = 0; i < entry->numDefinitions; ++i )
+        {
+            m_acked->SetBit( entry->id[i] );
+        }
+        m_sentPackets->Remove( sequence );
+        if ( entry == m_currentPacket )
+            m_currentPacket = NULL;
+    }
+
+    bool StringTable::SetString( int id, const char * string )
+    {
+        yojimbo_assert( id >= 0 );
+        yojimbo_assert( id < m_numEntries );
+        yojimbo_assert( string );
+
+        // the same id is defined again until the sender sees an ack, and always with the same string
+
+        if ( m_strings[id] && strcmp( m_strings[id], string ) == 0 )
+            return true;
+
+        YOJIMBO_FREE( *m_allocator, m_strings[id] );
+
+        const int length = (int) strlen( string );
+        m_strings[id] = (char*) YOJIMBO_ALLOCATE( *m_allocator, length + 1 );
+        if ( !m_strings[id] )
+            return false;
+        memcpy( m_strings[id], string, length + 1 );
+
+        return true;
+    }
+
+    const char * StringTable::GetString( int id ) const
+    {
+        yojimbo_assert( id >= 0 );
+        yojimbo_assert( id < m_numEntries );
+        return m_strings[id];
+    }
+}
@@ -0,0 +1,293 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_STRING_TABLE_H
+#define YOJIMBO_STRING_TABLE_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_utility.h"
+#include "yojimbo_stream.h"
+#include "yojimbo_serialize.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Maps strings to small integer ids, kept in sync between the two ends of a connection.
+
+        Each connection has one string table for the strings it sends, and one for the strings it receives. Strings are only ever added, so an id means the same string for the lifetime of the connection, until Reset.
+
+        The first time a string is written with serialize_dictionary_string, it goes out in full along with its id. The packet that carried the definition is tracked, and once it is acked the string is sent as the id alone. Until then every use carries the definition again, so a lost packet costs nothing but the bits.
+
+        @see ConnectionConfig::stringTableSize
+        @see serialize_dictionary_string
+     */
+
+    class StringTable
+    {
+    public:
+
+        /**
+            The string table constructor.
+
+            @param allocator The allocator used for the table and the strings in it.
+            @param numEntries The number of strings the table can hold, in [1,MaxStringTableSize].
+            @param sentPacketBufferSize The number of sent packets to track definitions for. Should match the sliding window of the connection.
+         */
+
+        StringTable( Allocator & allocator, int numEntries, int sentPacketBufferSize );
+
+        /**
+            The string table destructor.
+         */
+
+        ~StringTable();
+
+        /**
+            Remove all strings from the table. Call this on both ends when the connection is reset.
+         */
+
+        void Reset();
+
+        /**
+            Get the number of strings the table can hold.
+
+            @returns The table size passed in to the constructor.
+         */
+
+        int GetSize() const { return m_numEntries; }
+
+        /**
+            Find the id of a string (sender).
+
+            @param string The string to look for.
+
+            @returns The id of the string, or -1 if it isn't in the table.
+         */
+
+        int FindString( const char * string ) const;
+
+        /**
+            Add a string to the table (sender).
+
+            The string isn't acked until a packet that defined it is acked. See AddDefinition.
+
+            @param string The string to add. Must not already be in the table.
+
+            @returns The id of the new string, or -1 if the table is full.
+         */
+
+        int AddString( const char * string );
+
+        /**
+            Check if the other end of the connection is known to have a string (sender).
+
+            @param id The id of the string.
+
+            @returns True if a packet defining the string was acked, so the id alone may be sent.
+         */
+
+        bool IsAcked( int id ) const;
+
+        /**
+            Start tracking the definitions written in a packet (sender).
+
+            @param sequence The sequence number of the packet being written.
+         */
+
+        void BeginPacket( uint16_t sequence );
+
+        /**
+            Record that a string definition was written in the current packet (sender).
+
+            @param id The id of the string defined.
+
+            @returns True if the definition is tracked. False if no packet was started, or the packet already holds MaxStringDefinitionsPerPacket definitions. The string must then be sent in full without an id.
+         */
+
+        bool AddDefinition( int id );
+
+        /**
+            Get the number of definitions recorded in the current packet so far (sender).
+
+            @returns The number of definitions. Pass this to RollbackDefinitions to drop the definitions recorded after this point.
+         */
+
+        int GetNumDefinitions() const;
+
+        /**
+            Drop definitions recorded in the current packet, when the data that wrote them is rolled back out of the packet (sender).
+
+            @param numDefinitions The number of definitions to keep, as returned by GetNumDefinitions.
+         */
+
+        void RollbackDefinitions( int numDefinitions );
+
+        /**
+            Process a packet ack (sender). The strings defined in the packet are acked.
+
+            @param sequence The sequence number of the packet that was acked.
+         */
+
+        void ProcessAck( uint16_t sequence );
+
+        /**
+            Store a string definition read from a packet (receiver).
+
+            @param id The id of the string, in [0,GetSize()-1].
+            @param string The string.
+
+            @returns True if the string was stored. False if the string could not be allocated.
+         */
+
+        bool SetString( int id, const char * string );
+
+        /**
+            Get a string by id (receiver).
+
+            @param id The id of the string.
+
+            @returns The string, or NULL if no string was defined for the id.
+         */
+
+        const char * GetString( int id ) const;
+
+    private:
+
+        int FindSlot( const char * string, uint64_t hash ) const;
+
+        StringTable( const StringTable & other );
+
+        const StringTable & operator = ( const StringTable & other );
+
+        /// Definitions written in a sent packet. Acked together when the packet is acked.
+
+        struct SentPacketEntry
+        {
+            int numDefinitions;                                             ///< The number of strings defined in the packet.
+            uint16_t id[MaxStringDefinitionsPerPacket];                     ///< The ids of the strings defined in the packet.
+        };
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        int m_numEntries;                                                   ///< The number of strings the table can hold.
+        int m_numStrings;                                                   ///< The number of strings added so far (sender). The next string gets this id.
+        char ** m_strings;                                                  ///< The string for each id. NULL where no string is defined.
+        int m_indexSize;                                                    ///< The number of slots in the hash index. A power of two, at least twice the number of entries.
+        int * m_index;                                                      ///< Open addressing hash index from string to id (sender). -1 for empty slots.
+        BitArray * m_acked;                                                 ///< Set for each id that the other end is known to have (sender).
+        SequenceBuffer<SentPacketEntry> * m_sentPackets;                    ///< Definitions written in each sent packet, so they can be acked (sender).
+        SentPacketEntry * m_currentPacket;                                  ///< The packet being written. NULL outside of BeginPacket.
+    };
+
+    /**
+        Serialize a string through the string table set on the stream (read/write/measure).
+
+        Strings the other end is known to have are written as an id. Otherwise the string is written in full, along with an id when there is room in the table. The measure stream counts the worst case, a full string with an id.
+
+        Without a string table on the stream, or for messages serialized outside of a connection packet, the string is always written in full.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param string The string to serialize write/measure. Pointer to buffer to be filled on read.
+        @param buffer_size The size of the string buffer. String with terminating null character must fit into this buffer.
+
+        @returns Returns true if the serialize succeeded, false otherwise.
+     */
+
+    template <typename Stream> bool serialize_dictionary_string_internal( Stream & stream, char * string, int buffer_size )
+    {
+        StringTable * stringTable = stream.GetStringTable();
+
+        bool reference = false;
+        bool define = false;
+        int id = 0;
+
+        if ( Stream::IsWriting && stringTable )
+        {
+            id = stringTable->FindString( string );
+            if ( id >= 0 && stringTable->IsAcked( id ) )
+            {
+                reference = true;
+            }
+            else
+            {
+                if ( id < 0 )
+                    id = stringTable->AddString( string );
+                define = id >= 0 && stringTable->AddDefinition( id );
+            }
+        }
+
+        serialize_bool( stream, reference );
+
+        if ( reference )
+        {
+            if ( !stringTable )
+                return false;
+            serialize_int( stream, id, 0, stringTable->GetSize() - 1 );
+            if ( Stream::IsReading )
+            {
+                const char * value = stringTable->GetString( id );
+                if ( !value || (int) strlen( value ) >= buffer_size - 1 )
+                    return false;
+                strcpy( string, value );
+            }
+            return true;
+        }
+
+        serialize_bool( stream, define );
+
+        if ( define )
+        {
+            if ( !stringTable )
+                return false;
+            serialize_int( stream, id, 0, stringTable->GetSize() - 1 );
+        }
+
+        serialize_string( stream, string, buffer_size );
+
+        if ( Stream::IsReading && define && !stringTable->SetString( id, string ) )
+            return false;
+
+        return true;
+    }
+
+    inline bool serialize_dictionary_string_internal( MeasureStream & stream, char * string, int buffer_size )
+    {
+        // reference and define flags, then the largest id
+
+        stream.SerializeBits( 0, 2 + 16 );
+
+        return serialize_string_internal( stream, string, buffer_size );
+    }
+
+    /**
+        Serialize a string through the connection string table (read/write/measure).
+
+        Use this instead of serialize_string for strings that repeat a lot, like item names or player names. Once the other end has a string, it costs an id instead of the full string. See ConnectionConfig::stringTableSize.
+
+        This is a helper macro to make writing unified serialize functions easier.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        IMPORTANT: Messages with a SerializedMessage attached are serialized outside of any connection, so their strings always go out in full. See Message::AttachSerializedMessage.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param string The string to serialize write/measure. Pointer to buffer to be filled on read.
+        @param buffer_size The size of the string buffer. String with terminating null character must fit into this buffer.
+     */
+
+    #define serialize_dictionary_string( stream, string, buffer_size )                              \
+        do                                                                                          \
+        {                                                                                           \
+            if ( !yojimbo::serialize_dictionary_string_internal( stream, string, buffer_size ) )    \
+                return false;                                                                       \
+        } while (0)
+}
+
+#endif // #ifndef YOJIMBO_STRING_TABLE_H
@@ -0,0 +1,135 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_thread_pool.h"
+
+namespace yojimbo
+{
+    ThreadPool::ThreadPool( Allocator & allocator, int numThreads )
+    {
+        yojimbo_assert( numThreads >= 0 );
+        m_allocator = &allocator;
+        m_numThreads = 0;
+        m_threads = NULL;
+        m_function = NULL;
+        m_context = NULL;
+        m_count = 0;
+        m_nextIndex = 0;
+        m_numWoken = 0;
+        m_numWorking = 0;
+        m_quit = 0;
+        m_running = false;
+        m_workSemaphore = yojimbo_semaphore_create();
+        m_doneSemaphore = yojimbo_semaphore_create();
+        if ( !m_workSemaphore || !m_doneSemaphore || numThreads == 0 )
+            return;
+        m_threads = (yojimbo_thread_t**) YOJIMBO_ALLOCATE( allocator, sizeof( yojimbo_thread_t* ) * numThreads );
+        yojimbo_assert( m_threads );
+        for ( int i = 0; i < numThreads; ++i )
+        {
+            m_threads[i] = yojimbo_thread_create( StaticWorkerFunction, this );
+            if ( !m_threads[i] )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create thread pool worker %d\n", i );
+                break;
+            }
+            m_numThreads++;
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        yojimbo_assert( !m_running );
+        if ( m_numThreads > 0 )
+        {
+            yojimbo_atomic_compare_exchange( &m_quit, 1, 0 );
+            yojimbo_semaphore_signal( m_workSemaphore, m_numThreads );
+            for ( int i = 0; i < m_numThreads; ++i )
+            {
+                yojimbo_thread_join( m_threads[i] );
+            }
+        }
+        YOJIMBO_FREE( *m_allocator, m_threads );
+        yojimbo_semaphore_destroy( m_workSemaphore );
+        yojimbo_semaphore_destroy( m_doneSemaphore );
+        m_allocator = NULL;
+    }
+
+    void ThreadPool::Run( int count, ParallelForFunction function, void * context )
+    {
+        yojimbo_assert( !m_running );
+        yojimbo_assert( count >= 0 );
+        yojimbo_assert( function );
+        m_running = true;
+        m_function = function;
+        m_context = context;
+        m_count = count;
+        m_nextIndex = 0;
+
+        // the caller takes work items in Wait, so one less worker than work items is enough
+
+        m_numWoken = yojimbo_max( 0, yojimbo_min( m_numThreads, count - 1 ) );
+        m_numWorking = m_numWoken;
+        yojimbo_memory_barrier();
+        if ( m_numWoken > 0 )
+            yojimbo_semaphore_signal( m_workSemaphore, m_numWoken );
+    }
+
+    void ThreadPool::Wait()
+    {
+        yojimbo_assert( m_running );
+        RunWorkItems();
+
+        // every worker woken for the job has to finish with it before the next Run resets the job, even if the caller ran every work item itself
+
+        if ( m_numWoken > 0 )
+            yojimbo_semaphore_wait( m_doneSemaphore );
+        yojimbo_memory_barrier();
+        m_function = NULL;
+        m_context = NULL;
+        m_count = 0;
+        m_numWoken = 0;
+        m_running = false;
+    }
+
+    void ThreadPool::ParallelFor( int count, ParallelForFunction function, void * context )
+    {
+        Run( count, function, context );
+        Wait();
+    }
+
+    void ThreadPool::StaticWorkerFunction( void * context )
+    {
+        ThreadPool * threadPool = (ThreadPool*) context;
+        threadPool->WorkerFunction();
+    }
+
+    void ThreadPool::WorkerFunction()
+    {
+        while ( true )
+        {
+            yojimbo_semaphore_wait( m_workSemaphore );
+            yojimbo_memory_barrier();
+            if ( m_quit )
+                break;
+            RunWorkItems();
+            if ( yojimbo_atomic_decrement( &m_numWorking ) == 0 )
+                yojimbo_semaphore_signal( m_doneSemaphore, 1 );
+        }
+    }
+
+    void ThreadPool::RunWorkItems()
+    {
+        while ( true )
+        {
+            const int index = yojimbo_atomic_increment( &m_nextIndex ) - 1;
+            if ( index >= m_count )
+                break;
+            m_function( m_context, index );
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+    Yojimbo Network Library.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+*/
+
+#ifndef YOJIMBO_THREAD_POOL_H
+#define YOJIMBO_THREAD_POOL_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_adapter.h"
+#include "yojimbo_platform.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        A small pool of worker threads for Adapter::ParallelFor.
+
+        The server and client pool never create threads for their parallel paths. They call Adapter::ParallelFor, so if your engine has a job system, override Adapter::ParallelFor to run the work items on it instead. Use this pool if you don't have one:
+
+            void ParallelFor( int count, ParallelForFunction function, void * context ) { m_threadPool->ParallelFor( count, function, context ); }
+
+        Work items are claimed one at a time by the workers and by the calling thread, so uneven work items balance out. Workers sleep on a semaphore between jobs, so an idle pool costs nothing.
+
+        The pool runs one job at a time. Only call it from one thread.
+     */
+
+    class ThreadPool
+    {
+    public:
+
+        /**
+            Start the worker threads.
+
+            @param allocator The allocator for the thread table.
+            @param numThreads The number of worker threads. The thread calling Wait works too, so pass one less than the number of cores to be used. Zero runs everything on the calling thread.
+         */
+
+        ThreadPool( Allocator & allocator, int numThreads );
+
+        /**
+            Stop the worker threads and wait for them to exit. No job may be running.
+         */
+
+        ~ThreadPool();
+
+        /**
+            Get the number of worker threads.
+
+            @returns The number of worker threads that started, not counting the thread calling Wait.
+         */
+
+        int GetNumThreads() const { return m_numThreads; }
+
+        /**
+            Start a job: call a function once for each index in [0,count), on the worker threads.
+
+            Returns straight away, so the calling thread can do other work before it calls Wait. Each Run must be followed by a Wait before the next Run.
+
+            @param count The number of work items.
+            @param function The function to call for each work item.
+            @param context Context pointer passed to the function.
+         */
+
+        void Run( int count, ParallelForFunction function, void * context );
+
+        /**
+            Wait for the job started by Run to finish. The calling thread works on the job until no work items are left.
+
+            Memory written by the work items is visible to the caller once this returns.
+         */
+
+        void Wait();
+
+        /**
+            Run a job and wait for it to finish. Matches Adapter::ParallelFor.
+
+            @param count The number of work items.
+            @param function The function to call for each work item.
+            @param context Context pointer passed to the function.
+         */
+
+        void ParallelFor( int count, ParallelForFunction function, void * context );
+
+    private:
+
+        static void StaticWorkerFunction( void * context );
+
+        void WorkerFunction();
+
+        void RunWorkItems();
+
+        ThreadPool( const ThreadPool & other );
+
+        const ThreadPool & operator = ( const ThreadPool & other );
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+        int m_numThreads;                                                   ///< The number of worker threads.
+        yojimbo_thread_t ** m_threads;                                      ///< The worker threads.
+        yojimbo_semaphore_t * m_workSemaphore;                              ///< Signaled once per worker woken for a job, and once per worker on shutdown.
+        yojimbo_semaphore_t * m_doneSemaphore;                              ///< Signaled by the last woken worker to finish with a job.
+        ParallelForFunction m_function;                                     ///< The function of the current job.
+        void * m_context;                                                   ///< The context of the current job.
+        int m_count;                                                        ///< The number of work items in the current job.
+        volatile int m_nextIndex;                                           ///< The next work item to claim. Claimed with an atomic increment, so it runs past m_count once the job is claimed.
+        int m_numWoken;                                                     ///< The number of workers woken for the current job.
+        volatile int m_numWorking;                                          ///< The number of workers woken for the current job that haven't finished with it yet.
+        volatile int m_quit;                                                ///< Set to 1 to make the workers exit.
+        bool m_running;                                                     ///< True between Run and Wait.
+    };
+}
+
+#endif // #ifndef YOJIMBO_THREAD_POOL_H
@@ -77,6 +77,124 @@ namespace yojimbo
         return h;
     }
 
+    static const uint64_t WyHashSecret[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+
+    static inline void wyhash_multiply( uint64_t & a, uint64_t & b )
+    {
+#ifdef __SIZEOF_INT128__
+        const __uint128_t r = __uint128_t( a ) * b;
+        a = uint64_t( r );
+        b = uint64_t( r >> 64 );
+#else // #ifdef __SIZEOF_INT128__
+        const uint64_t ha = a >> 32, hb = b >> 32, la = uint32_t( a ), lb = uint32_t( b );
+        const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        const uint64_t t = rl + ( rm0 << 32 );
+        uint64_t c = t < rl;
+        const uint64_t lo = t + ( rm1 << 32 );
+        c += lo < t;
+        a = lo;
+        b = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+#endif // #ifdef __SIZEOF_INT128__
+    }
+
+    static inline uint64_t wyhash_mix( uint64_t a, uint64_t b )
+    {
+        wyhash_multiply( a, b );
+        return a ^ b;
+    }
+
+    static inline uint64_t wyhash_read64( const uint8_t * p )
+    {
+        uint64_t value;
+        memcpy( &value, p, 8 );
+#if YOJIMBO_LITTLE_ENDIAN
+        return value;
+#else // #if YOJIMBO_LITTLE_ENDIAN
+        return bswap( value );
+#endif // #if YOJIMBO_LITTLE_ENDIAN
+    }
+
+    static inline uint64_t wyhash_read32( const uint8_t * p )
+    {
+        uint32_t value;
+        memcpy( &value, p, 4 );
+#if YOJIMBO_LITTLE_ENDIAN
+        return value;
+#else // #if YOJIMBO_LITTLE_ENDIAN
+        return bswap( value );
+#endif // #if YOJIMBO_LITTLE_ENDIAN
+    }
+
+    uint64_t wyhash_64( const void * key, uint32_t length, uint64_t seed )
+    {
+        const uint8_t * p = (const uint8_t*) key;
+
+        seed ^= wyhash_mix( seed ^ WyHashSecret[0], WyHashSecret[1] );
+
+        uint64_t a, b;
+
+        if ( length <= 16 )
+        {
+            // short keys are read as two overlapping pairs of 32 bit words, so there is no per byte tail
+
+            if ( length >= 4 )
+            {
+                const uint32_t offset = ( length >> 3 ) << 2;
+                a = ( wyhash_read32( p ) << 32 ) | wyhash_read32( p + offset );
+                b = ( wyhash_read32( p + length - 4 ) << 32 ) | wyhash_read32( p + length - 4 - offset );
+            }
+            else if ( length > 0 )
+            {
+                a = ( uint64_t( p[0] ) << 16 ) | ( uint64_t( p[length >> 1] ) << 8 ) | p[length-1];
+                b = 0;
+            }
+            else
+            {
+                a = b = 0;
+            }
+        }
+        else
+        {
+            uint32_t i = length;
+
+            if ( i > 48 )
+            {
+                // three independent lanes keep the multipliers busy on long keys
+
+                uint64_t see1 = seed;
+                uint64_t see2 = seed;
+                do
+                {
+                    seed = wyhash_mix( wyhash_read64( p ) ^ WyHashSecret[1], wyhash_read64( p + 8 ) ^ seed );
+                    see1 = wyhash_mix( wyhash_read64( p + 16 ) ^ WyHashSecret[2], wyhash_read64( p + 24 ) ^ see1 );
+                    see2 = wyhash_mix( wyhash_read64( p + 32 ) ^ WyHashSecret[3], wyhash_read64( p + 40 ) ^ see2 );
+                    p += 48;
+                    i -= 48;
+                }
+                while ( i > 48 );
+                seed ^= see1 ^ see2;
+            }
+
+            while ( i > 16 )
+            {
+                seed = wyhash_mix( wyhash_read64( p ) ^ WyHashSecret[1], wyhash_read64( p + 8 ) ^ seed );
+                i -= 16;
+                p += 16;
+            }
+
+            // the last 16 bytes overlap what came before, which is fine since the key is at least 17 bytes
+
+            a = wyhash_read64( p + i - 16 );
+            b = wyhash_read64( p + i - 8 );
+        }
+
+        a ^= WyHashSecret[1];
+        b ^= seed;
+        wyhash_multiply( a, b );
+
+        return wyhash_mix( a ^ WyHashSecret[0] ^ length, b ^ WyHashSecret[1] );
+    }
+
     void print_bytes( const char * label, const uint8_t * data, int data_bytes )
     {
         printf( "%s: ", label );
@@ -93,13 +211,11 @@ namespace yojimbo
         yojimbo_assert( output );
         yojimbo_assert( output_size > 0 );
 
-        size_t output_length = 0;
-
         const int input_length = (int) ( strlen( input ) + 1 );
 
-        int result = mbedtls_base64_encode( (unsigned char*) output, output_size, &output_length, (unsigned char*) input, input_length );
+        const int output_length = base64_encode_data( (const uint8_t*) input, input_length, output, output_size );
 
-        return ( result == 0 ) ? (int) output_length + 1 : -1;
+        return ( output_length >= 0 ) ? output_length + 1 : -1;
     }
 
     int base64_decode_string( const char * input, char * output, int output_size )
@@ -108,30 +224,80 @@ namespace yojimbo
         yojimbo_assert( output );
         yojimbo_assert( output_size > 0 );
 
-        size_t output_length = 0;
-
-        int result = mbedtls_base64_decode( (unsigned char*) output, output_size, &output_length, (const unsigned char*) input, strlen( input ) );
+        const int output_length = base64_decode_data( input, (uint8_t*) output, output_size );
 
-        if ( result != 0 || output[output_length-1] != '\0' )
+        if ( output_length <= 0 || output[output_length-1] != '\0' )
         {
             output[0] = '\0';
             return -1;
         }
 
-        return (int) output_length;
+        return output_length;
     }
 
+    static const char Base64EncodeTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    #define YOJIMBO_BASE64_ROW( x ) x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x
+
+    static const uint8_t Base64DecodeTable[256] = 
+    {
+        YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ),
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 62, 0xFF, 0xFF, 0xFF, 63,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ),
+        YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ), YOJIMBO_BASE64_ROW( 0xFF ),
+    };
+
+    #undef YOJIMBO_BASE64_ROW
+
     int base64_encode_data( const uint8_t * input, int input_length, char * output, int output_size )
     {
         yojimbo_assert( input );
         yojimbo_assert( output );
         yojimbo_assert( output_size > 0 );
+        yojimbo_assert( input_length >= 0 );
+
+        const int output_length = ( ( input_length + 2 ) / 3 ) * 4;
 
-        size_t output_length = 0;
+        if ( output_size < output_length + 1 )
+            return -1;
+
+        // each group of 3 bytes becomes 4 characters, with no branches inside the loop
+
+        const uint8_t * p = input;
+        const uint8_t * const end = input + ( input_length / 3 ) * 3;
+        char * q = output;
+
+        while ( p < end )
+        {
+            const uint32_t group = ( uint32_t( p[0] ) << 16 ) | ( uint32_t( p[1] ) << 8 ) | p[2];
+            q[0] = Base64EncodeTable[ group >> 18 ];
+            q[1] = Base64EncodeTable[ ( group >> 12 ) & 63 ];
+            q[2] = Base64EncodeTable[ ( group >> 6 ) & 63 ];
+            q[3] = Base64EncodeTable[ group & 63 ];
+            p += 3;
+            q += 4;
+        }
+
+        const int remainder = input_length - int( end - input );
+
+        if ( remainder )
+        {
+            const uint32_t group = ( uint32_t( p[0] ) << 16 ) | ( remainder == 2 ? uint32_t( p[1] ) << 8 : 0 );
+            q[0] = Base64EncodeTable[ group >> 18 ];
+            q[1] = Base64EncodeTable[ ( group >> 12 ) & 63 ];
+            q[2] = remainder == 2 ? Base64EncodeTable[ ( group >> 6 ) & 63 ] : '=';
+            q[3] = '=';
+            q += 4;
+        }
 
-        int result = mbedtls_base64_encode( (unsigned char*) output, output_size, &output_length, (unsigned char*) input, input_length );
+        *q = '\0';
 
-        return ( result == 0 ) ? (int) output_length : -1;
+        return output_length;
     }
 
     int base64_decode_data( const char * input, uint8_t * output, int output_size )
@@ -140,10 +306,250 @@ namespace yojimbo
         yojimbo_assert( output );
         yojimbo_assert( output_size > 0 );
 
-        size_t output_length = 0;
+        const size_t input_length = strlen( input );
+
+        const uint8_t * p = (const uint8_t*) input;
+
+        int padding = 0;
+        if ( input_length >= 4 && ( input_length & 3 ) == 0 )
+        {
+            padding = ( p[input_length-1] == '=' ) + ( p[input_length-1] == '=' && p[input_length-2] == '=' );
+        }
+        else
+        {
+            // whitespace, line breaks and missing padding are rare, so leave them to mbedtls
+
+            size_t output_length = 0;
+            int result = mbedtls_base64_decode( (unsigned char*) output, output_size, &output_length, (const unsigned char*) input, input_length );
+            return ( result == 0 ) ? (int) output_length : -1;
+        }
+
+        const int output_length = int( input_length / 4 ) * 3 - padding;
+
+        if ( output_length > output_size )
+            return -1;
+
+        // decode all full groups, checking for invalid characters once per group. the last group may be padded
+
+        const size_t full_groups = input_length / 4 - ( padding ? 1 : 0 );
+
+        uint8_t * q = output;
+
+        for ( size_t i = 0; i < full_groups; ++i )
+        {
+            const uint32_t a = Base64DecodeTable[p[0]];
+            const uint32_t b = Base64DecodeTable[p[1]];
+            const uint32_t c = Base64DecodeTable[p[2]];
+            const uint32_t d = Base64DecodeTable[p[3]];
+            if ( ( a | b | c | d ) & 0x80 )
+                return -1;
+            const uint32_t group = ( a << 18 ) | ( b << 12 ) | ( c << 6 ) | d;
+            q[0] = uint8_t( group >> 16 );
+            q[1] = uint8_t( group >> 8 );
+            q[2] = uint8_t( group );
+            p += 4;
+            q += 3;
+        }
+
+        if ( padding )
+        {
+            const uint32_t a = Base64DecodeTable[p[0]];
+            const uint32_t b = Base64DecodeTable[p[1]];
+            const uint32_t c = padding == 1 ? Base64DecodeTable[p[2]] : 0;
+            if ( ( a | b | c ) & 0x80 )
+                return -1;
+            const uint32_t group = ( a << 18 ) | ( b << 12 ) | ( c << 6 );
+            q[0] = uint8_t( group >> 16 );
+            if ( padding == 1 )
+                q[1] = uint8_t( group >> 8 );
+        }
+
+        return output_length;
+    }
+
+    static const int LZ4MinMatch = 4;
+    static const int LZ4LastLiterals = 5;
+    static const int LZ4MatchSearchLimit = 12;
+    static const int LZ4HashBits = 12;
+    static const int LZ4MaxOffset = 65535;
+
+    static inline uint32_t lz4_read32( const uint8_t * p )
+    {
+        uint32_t value;
+        memcpy( &value, p, 4 );
+        return value;
+    }
+
+    static inline uint32_t lz4_hash( uint32_t value )
+    {
+        return ( value * 2654435761U ) >> ( 32 - LZ4HashBits );
+    }
+
+    static inline uint8_t * lz4_write_length( uint8_t * op, int length )
+    {
+        while ( length >= 255 )
+        {
+            *op++ = 255;
+            length -= 255;
+        }
+        *op++ = uint8_t( length );
+        return op;
+    }
+
+    int lz4_compress_data( const uint8_t * input, int input_bytes, uint8_t * output, int output_size )
+    {
+        yojimbo_assert( input );
+        yojimbo_assert( output );
+        yojimbo_assert( input_bytes >= 0 );
+
+        // the hash table maps the hash of 4 bytes to the last position they were seen at. stale entries are caught by comparing the bytes
+
+        int table[1<<LZ4HashBits];
+        memset( table, 0, sizeof( table ) );
+
+        uint8_t * op = output;
+        uint8_t * const output_end = output + output_size;
+
+        int ip = 0;
+        int anchor = 0;
+
+        // the format requires the last match to start at least 12 bytes before the end, and end at least 5 bytes before it
+
+        const int match_start_limit = input_bytes - LZ4MatchSearchLimit;
+        const int match_end_limit = input_bytes - LZ4LastLiterals;
+
+        while ( ip <= match_start_limit )
+        {
+            const uint32_t sequence = lz4_read32( input + ip );
+            const uint32_t hash = lz4_hash( sequence );
+            const int ref = table[hash];
+            table[hash] = ip;
+
+            if ( ref >= ip || ip - ref > LZ4MaxOffset || lz4_read32( input + ref ) != sequence )
+            {
+                ip++;
+                continue;
+            }
+
+            int match_length = LZ4MinMatch;
+            while ( ip + match_length < match_end_limit && input[ref+match_length] == input[ip+match_length] )
+                match_length++;
+
+            const int literal_length = ip - anchor;
+
+            if ( output_end - op < 1 + literal_length + literal_length / 255 + 1 + 2 + ( match_length - LZ4MinMatch ) / 255 + 1 )
+                return 0;
+
+            uint8_t * token = op++;
+
+            *token = uint8_t( yojimbo_min( literal_length, 15 ) << 4 );
+            if ( literal_length >= 15 )
+                op = lz4_write_length( op, literal_length - 15 );
+
+            memcpy( op, input + anchor, literal_length );
+            op += literal_length;
+
+            const int offset = ip - ref;
+            *op++ = uint8_t( offset );
+            *op++ = uint8_t( offset >> 8 );
 
-        int result = mbedtls_base64_decode( (unsigned char*) output, output_size, &output_length, (const unsigned char*) input, strlen( input ) );
+            const int extra_length = match_length - LZ4MinMatch;
+            *token |= uint8_t( yojimbo_min( extra_length, 15 ) );
+            if ( extra_length >= 15 )
+                op = lz4_write_length( op, extra_length - 15 );
+
+            ip += match_length;
+            anchor = ip;
+        }
+
+        // everything after the last match goes out as literals
+
+        const int literal_length = input_bytes - anchor;
+
+        if ( output_end - op < 1 + literal_length + literal_length / 255 + 1 )
+            return 0;
+
+        uint8_t * token = op++;
+
+        *token = uint8_t( yojimbo_min( literal_length, 15 ) << 4 );
+        if ( literal_length >= 15 )
+            op = lz4_write_length( op, literal_length - 15 );
+
+        memcpy( op, input + anchor, literal_length );
+        op += literal_length;
+
+        return int( op - output );
+    }
+
+    static inline bool lz4_read_length( const uint8_t * input, int input_bytes, int & ip, int & length, int max_length )
+    {
+        while ( true )
+        {
+            if ( ip >= input_bytes )
+                return false;
+            const uint8_t value = input[ip++];
+            length += value;
+            if ( length > max_length )
+                return false;
+            if ( value != 255 )
+                return true;
+        }
+    }
+
+    int lz4_decompress_data( const uint8_t * input, int input_bytes, uint8_t * output, int output_size )
+    {
+        yojimbo_assert( input );
+        yojimbo_assert( output );
+
+        int ip = 0;
+        int op = 0;
+
+        while ( ip < input_bytes )
+        {
+            const uint8_t token = input[ip++];
+
+            int literal_length = token >> 4;
+            if ( literal_length == 15 && !lz4_read_length( input, input_bytes, ip, literal_length, output_size ) )
+                return -1;
+
+            if ( literal_length > input_bytes - ip || literal_length > output_size - op )
+                return -1;
+
+            memcpy( output + op, input + ip, literal_length );
+            ip += literal_length;
+            op += literal_length;
+
+            // the last sequence has literals only
+
+            if ( ip == input_bytes )
+                break;
+
+            if ( input_bytes - ip < 2 )
+                return -1;
+
+            const int offset = input[ip] | ( input[ip+1] << 8 );
+            ip += 2;
+
+            if ( offset == 0 || offset > op )
+                return -1;
+
+            int match_length = token & 15;
+            if ( match_length == 15 && !lz4_read_length( input, input_bytes, ip, match_length, output_size ) )
+                return -1;
+
+            match_length += LZ4MinMatch;
+
+            if ( match_length > output_size - op )
+                return -1;
+
+            // matches may overlap the bytes they produce, so copy forwards one byte at a time
+
+            const uint8_t * match = output + op - offset;
+            for ( int i = 0; i < match_length; ++i )
+                output[op+i] = match[i];
+            op += match_length;
+        }
 
-        return ( result == 0 ) ? (int) output_length : -1;
+        return op;
     }
 }
@@ -68,6 +68,99 @@ namespace yojimbo
         return a + r;
     }
 
+    /**
+        Small, fast, seedable pseudo random number generator (PCG32).
+
+        Unlike random_int and random_float, which share the global rand state, each instance has its own state. The same seed gives the same sequence on every platform, and instances on different threads never contend.
+
+        IMPORTANT: This is not a cryptographically secure random. Use random_bytes for keys, nonces and ids.
+     */
+
+    class Random
+    {
+    public:
+
+        /**
+            Create a generator.
+
+            @param seed The seed. The same seed always gives the same sequence.
+            @param stream Selects one of 2^63 independent sequences for the same seed.
+         */
+
+        explicit Random( uint64_t seed = 0, uint64_t stream = 0 )
+        {
+            Seed( seed, stream );
+        }
+
+        /**
+            Restart the generator with a new seed.
+
+            @param seed The seed.
+            @param stream Selects one of 2^63 independent sequences for the same seed.
+         */
+
+        void Seed( uint64_t seed, uint64_t stream = 0 )
+        {
+            m_state = 0;
+            m_increment = ( stream << 1 ) | 1;
+            GetUint32();
+            m_state += seed;
+            GetUint32();
+        }
+
+        /**
+            Generate a random 32 bit value.
+
+            @returns A pseudo random value, with all 32 bits uniformly distributed.
+         */
+
+        uint32_t GetUint32()
+        {
+            const uint64_t previous = m_state;
+            m_state = previous * 6364136223846793005ULL + m_increment;
+            const uint32_t xorshifted = uint32_t( ( ( previous >> 18 ) ^ previous ) >> 27 );
+            const uint32_t rotation = uint32_t( previous >> 59 );
+            return ( xorshifted >> rotation ) | ( xorshifted << ( ( 32 - rotation ) & 31 ) );
+        }
+
+        /**
+            Generate a random integer between a and b (inclusive).
+
+            @param a The minimum integer value to generate.
+            @param b The maximum integer value to generate.
+
+            @returns A pseudo random integer value in [a,b].
+         */
+
+        int GetInt( int a, int b )
+        {
+            yojimbo_assert( a <= b );
+            const uint64_t range = uint64_t( int64_t( b ) - int64_t( a ) ) + 1;
+            return int( int64_t( a ) + int64_t( ( GetUint32() * range ) >> 32 ) );
+        }
+
+        /**
+            Generate a random float between a and b.
+
+            @param a The minimum value to generate.
+            @param b The maximum value to generate.
+
+            @returns A pseudo random float value in [a,b).
+         */
+
+        float GetFloat( float a, float b )
+        {
+            yojimbo_assert( a <= b );
+            const float random = ( GetUint32() >> 8 ) * ( 1.0f / 16777216.0f );
+            return a + random * ( b - a );
+        }
+
+    private:
+
+        uint64_t m_state;                                       ///< The generator state.
+        uint64_t m_increment;                                   ///< The stream increment. Always odd.
+    };
+
     /**
         Calculates the population count of an unsigned 32 bit integer at compile time.
 
@@ -148,6 +241,41 @@ namespace yojimbo
 #endif // #ifdef __GNUC__
     }
 
+    /**
+        Calculates the population count of an unsigned 64 bit integer.
+
+        @param x The input integer value.
+
+        @returns The number of bits set to 1 in the input value.
+     */
+
+    inline int popcount64( uint64_t x )
+    {
+#ifdef __GNUC__
+        return __builtin_popcountll( x );
+#else // #ifdef __GNUC__
+        return int( popcount( uint32_t( x ) ) + popcount( uint32_t( x >> 32 ) ) );
+#endif // #ifdef __GNUC__
+    }
+
+    /**
+        Finds the index of the lowest bit set in an unsigned 64 bit integer.
+
+        @param x The input integer value. Must not be zero.
+
+        @returns The index of the lowest bit set to 1, in [0,63].
+     */
+
+    inline int bit_scan_forward64( uint64_t x )
+    {
+        yojimbo_assert( x != 0 );
+#ifdef __GNUC__
+        return __builtin_ctzll( x );
+#else // #ifdef __GNUC__
+        return popcount64( ( x & ( ~x + 1 ) ) - 1 );
+#endif // #ifdef __GNUC__
+    }
+
     /**
         Calculates the log base 2 of an unsigned 32 bit integer.
     
@@ -364,6 +492,20 @@ namespace yojimbo
 
     uint64_t murmur_hash_64( const void * key, uint32_t length, uint64_t seed );
 
+    /**
+        Implementation of the 64 bit wyhash.
+
+        Several times faster than murmur_hash_64 on short keys like addresses and strings, with similar quality. Use it for hash tables. The result is not stable across library versions, so don't send it over the network or store it.
+
+        @param key The input value.
+        @param length The length of the key (bytes).
+        @param seed The initial seed for the hash. Used to chain together multiple hash calls.
+
+        @returns A 64 bit hash of the input value.
+     */
+
+    uint64_t wyhash_64( const void * key, uint32_t length, uint64_t seed );
+
     /**
         Base 64 encode a string.
     
@@ -413,6 +555,49 @@ namespace yojimbo
 
     int base64_decode_data( const char * input, uint8_t * output, int output_size );
 
+    /**
+        Get the worst case size of data compressed with lz4_compress_data.
+
+        @param input_bytes The size of the data to compress (bytes).
+
+        @returns The size of the output buffer that can hold any compressed data of that size (bytes).
+     */
+
+    inline int lz4_compress_bound( int input_bytes )
+    {
+        return input_bytes + input_bytes / 255 + 16;
+    }
+
+    /**
+        Compress data in the LZ4 block format.
+
+        Favors speed over ratio, so it is cheap enough to run on blocks as they are sent. The output can be read by any LZ4 block decoder.
+
+        @param input The data to compress.
+        @param input_bytes The size of the data to compress (bytes).
+        @param output The compressed data [out].
+        @param output_size The size of the output buffer (bytes). See lz4_compress_bound.
+
+        @returns The size of the compressed data (bytes). 0 if it didn't fit in the output buffer.
+     */
+
+    int lz4_compress_data( const uint8_t * input, int input_bytes, uint8_t * output, int output_size );
+
+    /**
+        Decompress data in the LZ4 block format.
+
+        The input is checked as it is read, so it is safe to decompress data received over the network.
+
+        @param input The compressed data.
+        @param input_bytes The size of the compressed data (bytes).
+        @param output The decompressed data [out].
+        @param output_size The size of the output buffer (bytes).
+
+        @returns The size of the decompressed data (bytes). -1 if the compressed data is invalid, or doesn't fit in the output buffer.
+     */
+
+    int lz4_decompress_data( const uint8_t * input, int input_bytes, uint8_t * output, int output_size );
+
     /**
         Print bytes with a label. 
 
@@ -528,6 +713,115 @@ namespace yojimbo
             return ( m_data[data_index] >> bit_index ) & 1;
         }
 
+        /**
+            Set all bits in a range to 1.
+
+            @param begin The index of the first bit to set.
+            @param end One past the index of the last bit to set.
+         */
+
+        void SetRange( int begin, int end )
+        {
+            yojimbo_assert( begin >= 0 );
+            yojimbo_assert( begin <= end );
+            yojimbo_assert( end <= m_size );
+            ApplyRange( begin, end, true );
+        }
+
+        /**
+            Clear all bits in a range to 0.
+
+            @param begin The index of the first bit to clear.
+            @param end One past the index of the last bit to clear.
+         */
+
+        void ClearRange( int begin, int end )
+        {
+            yojimbo_assert( begin >= 0 );
+            yojimbo_assert( begin <= end );
+            yojimbo_assert( end <= m_size );
+            ApplyRange( begin, end, false );
+        }
+
+        /**
+            Find the first bit set to 1, starting from an index.
+
+            Works a 64 bit word at a time. Call again with the index after the one returned to walk all the set bits.
+
+            @param start The index to start searching from, in [0,GetSize()].
+
+            @returns The index of the first bit set at or after start. -1 if there isn't one.
+         */
+
+        int FindFirstSet( int start ) const
+        {
+            yojimbo_assert( start >= 0 );
+            yojimbo_assert( start <= m_size );
+            if ( start >= m_size )
+                return -1;
+            const int numWords = m_bytes / 8;
+            int word_index = start >> 6;
+            uint64_t word = m_data[word_index] & ( ~uint64_t(0) << ( start & 63 ) );
+            while ( true )
+            {
+                if ( word )
+                {
+                    const int index = ( word_index << 6 ) + bit_scan_forward64( word );
+                    return index < m_size ? index : -1;
+                }
+                if ( ++word_index >= numWords )
+                    return -1;
+                word = m_data[word_index];
+            }
+        }
+
+        /**
+            Find the first bit set to 0, starting from an index.
+
+            Works a 64 bit word at a time. Call again with the index after the one returned to walk all the clear bits.
+
+            @param start The index to start searching from, in [0,GetSize()].
+
+            @returns The index of the first bit clear at or after start. -1 if there isn't one.
+         */
+
+        int FindFirstClear( int start ) const
+        {
+            yojimbo_assert( start >= 0 );
+            yojimbo_assert( start <= m_size );
+            if ( start >= m_size )
+                return -1;
+            const int numWords = m_bytes / 8;
+            int word_index = start >> 6;
+            uint64_t word = ~m_data[word_index] & ( ~uint64_t(0) << ( start & 63 ) );
+            while ( true )
+            {
+                if ( word )
+                {
+                    const int index = ( word_index << 6 ) + bit_scan_forward64( word );
+                    return index < m_size ? index : -1;
+                }
+                if ( ++word_index >= numWords )
+                    return -1;
+                word = ~m_data[word_index];
+            }
+        }
+
+        /**
+            Count the bits set to 1.
+
+            @returns The number of bits set.
+         */
+
+        int CountSet() const
+        {
+            const int numWords = m_bytes / 8;
+            int count = 0;
+            for ( int i = 0; i < numWords; ++i )
+                count += popcount64( m_data[i] );
+            return count;
+        }
+
         /**
             Gets the size of the bit array, in number of bits.
 
@@ -541,6 +835,22 @@ namespace yojimbo
 
     private:
 
+        void ApplyRange( int begin, int end, bool value )
+        {
+            while ( begin < end )
+            {
+                const int word_index = begin >> 6;
+                const int bit_index = begin & 63;
+                const int count = yojimbo_min( 64 - bit_index, end - begin );
+                const uint64_t mask = ( count == 64 ) ? ~uint64_t(0) : ( ( ( uint64_t(1) << count ) - 1 ) << bit_index );
+                if ( value )
+                    m_data[word_index] |= mask;
+                else
+                    m_data[word_index] &= ~mask;
+                begin += count;
+            }
+        }
+
         Allocator * m_allocator;                            ///< Allocator passed in to the constructor.
         int m_size;                                         ///< The size of the bit array in bits.
         int m_bytes;                                        ///< The size of the bit array in bytes.
@@ -716,6 +1026,35 @@ namespace yojimbo
             return m_numEntries;
         }
 
+        /**
+            Change the size of the queue, keeping its entries in order.
+
+            IMPORTANT: Will assert if the entries don't fit in the new size. Pop the oldest entries first!
+
+            @param size The new maximum number of entries in the queue.
+
+            @returns True if the queue was resized. False if the new array couldn't be allocated, in which case the queue is left as it was.
+         */
+
+        bool Resize( int size )
+        {
+            yojimbo_assert( size > 0 );
+            yojimbo_assert( m_numEntries <= size );
+            if ( size == m_arraySize )
+                return true;
+            T * entries = (T*) YOJIMBO_ALLOCATE( *m_allocator, sizeof(T) * size );
+            if ( !entries )
+                return false;
+            memset( entries, 0, sizeof(T) * size );
+            for ( int i = 0; i < m_numEntries; ++i )
+                entries[i] = m_entries[ ( m_startIndex + i ) % m_arraySize ];
+            YOJIMBO_FREE( *m_allocator, m_entries );
+            m_entries = entries;
+            m_arraySize = size;
+            m_startIndex = 0;
+            return true;
+        }
+
     private:
 
 
@@ -726,6 +1065,153 @@ namespace yojimbo
         int m_numEntries;                               ///< The number of entries currently stored in the queue.
     };
 
+    /**
+        A lock-free FIFO queue for passing values from one thread to another.
+
+        Exactly one thread may push values, and exactly one other thread may pop them. Neither side ever waits for the other: push fails when the queue is full, and pop fails when it is empty.
+     */
+
+    template <typename T> class SPSCQueue
+    {
+    public:
+
+        /**
+            SPSC queue constructor.
+
+            @param allocator The allocator to use.
+            @param size The maximum number of entries in the queue.
+         */
+
+        SPSCQueue( Allocator & allocator, int size )
+        {
+            yojimbo_assert( size > 0 );
+            m_allocator = &allocator;
+            // one entry is always left empty, so a full queue can be told apart from an empty one
+            m_arraySize = size + 1;
+            m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * m_arraySize );
+            memset( m_entries, 0, sizeof(T) * m_arraySize );
+            m_readIndex = 0;
+            m_writeIndex = 0;
+        }
+
+        /**
+            SPSC queue destructor. Make sure neither thread is using the queue.
+         */
+
+        ~SPSCQueue()
+        {
+            yojimbo_assert( m_allocator );
+            YOJIMBO_FREE( *m_allocator, m_entries );
+            m_arraySize = 0;
+            m_allocator = NULL;
+        }
+
+        /**
+            Push a value on to the queue. Only call this from the producer thread.
+
+            @param value The value to push onto the queue.
+
+            @returns True if the value was pushed. False if the queue is full.
+         */
+
+        bool Push( const T & value )
+        {
+            const int writeIndex = m_writeIndex;
+            const int nextWriteIndex = ( writeIndex + 1 ) % m_arraySize;
+            if ( nextWriteIndex == m_readIndex )
+                return false;
+            m_entries[writeIndex] = value;
+            // the entry must be written before the consumer can see it
+            yojimbo_memory_barrier();
+            m_writeIndex = nextWriteIndex;
+            return true;
+        }
+
+        /**
+            Pop a value off the queue. Only call this from the consumer thread.
+
+            @param value The value popped off the queue [out].
+
+            @returns True if a value was popped. False if the queue is empty.
+         */
+
+        bool Pop( T & value )
+        {
+            const int readIndex = m_readIndex;
+            if ( readIndex == m_writeIndex )
+                return false;
+            // the entry must be read after the write index that published it
+            yojimbo_memory_barrier();
+            value = m_entries[readIndex];
+            // and read before the producer can reuse it
+            yojimbo_memory_barrier();
+            m_readIndex = ( readIndex + 1 ) % m_arraySize;
+            return true;
+        }
+
+        /**
+            Get the value at the front of the queue without popping it. Only call this from the consumer thread.
+
+            @param value The value at the front of the queue [out].
+
+            @returns True if there is a value. False if the queue is empty.
+         */
+
+        bool Peek( T & value ) const
+        {
+            const int readIndex = m_readIndex;
+            if ( readIndex == m_writeIndex )
+                return false;
+            yojimbo_memory_barrier();
+            value = m_entries[readIndex];
+            return true;
+        }
+
+        /**
+            Is the queue full? Call this from the producer thread, where the queue can only become less full behind its back.
+
+            @returns True if the queue is full.
+         */
+
+        bool IsFull() const
+        {
+            return ( m_writeIndex + 1 ) % m_arraySize == m_readIndex;
+        }
+
+        /**
+            Is the queue empty? Call this from the consumer thread, where the queue can only become less empty behind its back.
+
+            @returns True if the queue is empty.
+         */
+
+        bool IsEmpty() const
+        {
+            return m_readIndex == m_writeIndex;
+        }
+
+        /**
+            Get the size of the queue.
+
+            @returns The maximum number of values that can be in the queue at once.
+         */
+
+        int GetSize() const
+        {
+            return m_arraySize - 1;
+        }
+
+    private:
+
+        Allocator * m_allocator;                        ///< The allocator passed in to the constructor.
+        T * m_entries;                                  ///< Array of entries backing the queue (circular buffer). Has one more entry than the size of the queue.
+        int m_arraySize;                                ///< The size of the entry array.
+        volatile int m_readIndex;                       ///< Index of the next entry to pop. Only written by the consumer thread.
+        volatile int m_writeIndex;                      ///< Index of the next entry to push. Only written by the producer thread.
+
+        SPSCQueue( const SPSCQueue & other );
+        SPSCQueue & operator = ( const SPSCQueue & other );
+    };
+
     /**
         Data structure that stores data indexed by sequence number.
 
@@ -753,6 +1239,7 @@ namespace yojimbo
         {
             yojimbo_assert( size > 0 );
             m_size = size;
+            m_mask = ( size & ( size - 1 ) ) == 0 ? size - 1 : 0;
             m_sequence = 0;
             m_allocator = &allocator;
             m_entry_sequence = (uint32_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint32_t ) * size );
@@ -807,7 +1294,7 @@ namespace yojimbo
                 return NULL;
             }
 
-            const int index = sequence % m_size;
+            const int index = GetIndex( sequence );
 
             m_entry_sequence[index] = sequence;
 
@@ -822,7 +1309,7 @@ namespace yojimbo
 
         void Remove( uint16_t sequence )
         {
-            m_entry_sequence[ sequence % m_size ] = 0xFFFFFFFF;
+            m_entry_sequence[ GetIndex( sequence ) ] = 0xFFFFFFFF;
         }
 
         /**
@@ -837,7 +1324,7 @@ namespace yojimbo
 
         bool Available( uint16_t sequence ) const
         {
-            return m_entry_sequence[ sequence % m_size ] == 0xFFFFFFFF;
+            return m_entry_sequence[ GetIndex( sequence ) ] == 0xFFFFFFFF;
         }
 
         /**
@@ -850,7 +1337,7 @@ namespace yojimbo
 
         bool Exists( uint16_t sequence ) const
         {
-            return m_entry_sequence[ sequence % m_size ] == uint32_t( sequence );
+            return m_entry_sequence[ GetIndex( sequence ) ] == uint32_t( sequence );
         }
 
         /**
@@ -863,7 +1350,7 @@ namespace yojimbo
 
         T * Find( uint16_t sequence )
         {
-            const int index = sequence % m_size;
+            const int index = GetIndex( sequence );
             if ( m_entry_sequence[index] == uint32_t( sequence ) )
                 return &m_entries[index];
             else
@@ -880,7 +1367,7 @@ namespace yojimbo
 
         const T * Find( uint16_t sequence ) const
         {
-            const int index = sequence % m_size;
+            const int index = GetIndex( sequence );
             if ( m_entry_sequence[index] == uint32_t( sequence ) )
                 return &m_entries[index];
             else
@@ -940,7 +1427,7 @@ namespace yojimbo
         /**
             Get the entry index for a sequence number.
 
-            This is simply the sequence number modulo the sequence buffer size.
+            This is simply the sequence number modulo the sequence buffer size. When the size is a power of two this is a mask instead of a divide.
 
             @param sequence The sequence number.
 
@@ -949,7 +1436,7 @@ namespace yojimbo
 
         int GetIndex( uint16_t sequence ) const
         {
-            return sequence % m_size;
+            return m_mask ? ( sequence & m_mask ) : ( sequence % m_size );
         }
 
         /** 
@@ -963,6 +1450,50 @@ namespace yojimbo
             return m_size;
         }
 
+        /**
+            Change the size of the sequence buffer, keeping its entries.
+
+            IMPORTANT: The entries must span fewer sequence numbers than the new size, so each still has an index of its own. Entries are moved with memcpy, like they are stored.
+
+            @param size The new size of the sequence buffer.
+
+            @returns True if the sequence buffer was resized. False if the new arrays couldn't be allocated, in which case the sequence buffer is left as it was.
+         */
+
+        bool Resize( int size )
+        {
+            yojimbo_assert( size > 0 );
+            if ( size == m_size )
+                return true;
+            uint32_t * entry_sequence = (uint32_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint32_t ) * size );
+            T * entries = (T*) YOJIMBO_ALLOCATE( *m_allocator, sizeof(T) * size );
+            if ( !entry_sequence || !entries )
+            {
+                YOJIMBO_FREE( *m_allocator, entry_sequence );
+                YOJIMBO_FREE( *m_allocator, entries );
+                return false;
+            }
+            memset( entry_sequence, 0xFF, sizeof( uint32_t ) * size );
+            const int mask = ( size & ( size - 1 ) ) == 0 ? size - 1 : 0;
+            for ( int i = 0; i < m_size; ++i )
+            {
+                if ( m_entry_sequence[i] == 0xFFFFFFFF )
+                    continue;
+                const uint16_t sequence = uint16_t( m_entry_sequence[i] );
+                const int index = mask ? ( sequence & mask ) : ( sequence % size );
+                yojimbo_assert( entry_sequence[index] == 0xFFFFFFFF );
+                entry_sequence[index] = m_entry_sequence[i];
+                memcpy( &entries[index], &m_entries[i], sizeof(T) );
+            }
+            YOJIMBO_FREE( *m_allocator, m_entries );
+            YOJIMBO_FREE( *m_allocator, m_entry_sequence );
+            m_entry_sequence = entry_sequence;
+            m_entries = entries;
+            m_size = size;
+            m_mask = mask;
+            return true;
+        }
+
     protected:
 
         /** 
@@ -978,18 +1509,24 @@ namespace yojimbo
 
         void RemoveEntries( int start_sequence, int finish_sequence )
         {
-            if ( finish_sequence < start_sequence ) 
-                finish_sequence += 65535;
-            yojimbo_assert( finish_sequence >= start_sequence );
-            if ( finish_sequence - start_sequence < m_size )
+            const int count = uint16_t( finish_sequence - start_sequence ) + 1;
+            if ( count >= m_size )
+            {
+                memset( m_entry_sequence, 0xFF, sizeof( uint32_t ) * m_size );
+            }
+            else if ( m_mask )
             {
-                for ( int sequence = start_sequence; sequence <= finish_sequence; ++sequence )
-                    m_entry_sequence[sequence % m_size] = 0xFFFFFFFF;
+                // power of two sizes divide the sequence space, so the range is at most two contiguous runs
+
+                const int start = start_sequence & m_mask;
+                const int first = count < m_size - start ? count : m_size - start;
+                memset( m_entry_sequence + start, 0xFF, sizeof( uint32_t ) * first );
+                memset( m_entry_sequence, 0xFF, sizeof( uint32_t ) * ( count - first ) );
             }
             else
             {
-                for ( int i = 0; i < m_size; ++i )
-                    m_entry_sequence[i] = 0xFFFFFFFF;
+                for ( int i = 0; i < count; ++i )
+                    m_entry_sequence[ GetIndex( uint16_t( start_sequence + i ) ) ] = 0xFFFFFFFF;
             }
         }
 
@@ -997,6 +1534,7 @@ namespace yojimbo
 
         Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
         int m_size;                                                         ///< The size of the sequence buffer.
+        int m_mask;                                                         ///< m_size - 1 when the size is a power of two, so entries are indexed with a mask. 0 otherwise.
         uint16_t m_sequence;                                                ///< The most recent sequence number added to the buffer.
         uint32_t * m_entry_sequence;                                        ///< Array of sequence numbers corresponding to each sequence buffer entry for fast lookup. Set to 0xFFFFFFFF if no entry exists at that index.
         T * m_entries;                                                      ///< The sequence buffer entries. This is where the data is stored per-entry. Separate from the sequence numbers for fast lookup (hot/cold split) when the data per-sequence number is relatively large.